@@ -63,7 +63,7 @@ BB8::BB8()
 }
 
 Result BB8::initialize() {
-  paramsHandle_ = ConfigStorage::storage.reserveBlock(sizeof(params_));
+  paramsHandle_ = ConfigStorage::storage.reserveBlock("bb8", 1, sizeof(params_));
   if (ConfigStorage::storage.blockIsValid(paramsHandle_)) {
     ConfigStorage::storage.readBlock(paramsHandle_, (uint8_t *)&params_);
   } else {
@@ -383,7 +383,7 @@ Result BB8::incomingPacket(const Packet &packet) {
   return RES_OK;
 }
 
-Result BB8::handleConsoleCommand(const std::vector<String> &words, ConsoleStream *stream) {
+Result BB8::handleConsoleCommand(const ConsoleArgs& words, ConsoleStream *stream) {
   if (words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
 
   if (words[0] == "status") {
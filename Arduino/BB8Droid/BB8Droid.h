@@ -34,7 +34,7 @@ public:
   virtual void printStatus(ConsoleStream *stream);
 
   virtual Result incomingPacket(const Packet& packet);
-  virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
+  virtual Result handleConsoleCommand(const ConsoleArgs& words, ConsoleStream *stream);
   virtual Result fillAndSendStatusPacket();
 
   virtual void parameterChangedCallback(const String& name);
@@ -204,7 +204,7 @@ Result BB8Servos::step() {
   return RES_OK;
 }
 
-Result BB8Servos::handleConsoleCommand(const std::vector<String>& words, ConsoleStream* stream) {
+Result BB8Servos::handleConsoleCommand(const ConsoleArgs& words, ConsoleStream* stream) {
   (void)stream;
   if (words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
 
@@ -336,19 +336,19 @@ Result BB8Servos::handleConsoleCommand(const std::vector<String>& words, Console
   return bb::Subsystem::handleConsoleCommand(words, stream);
 }
 
-Result BB8Servos::handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream* stream) {
+Result BB8Servos::handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const ConsoleArgs& words, ConsoleStream* stream) {
   if (words.size() < 2 || words.size() > 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
   int id = words[1].toInt();
   if (servos_.count(id) == 0) return RES_CMD_INVALID_ARGUMENT;
   if (words.size() == 2) {
     int val = (int)dxl_.readControlTableItem(idx, id);
-    stream->println(words[0] + "=" + val);
+    stream->println(String(words[0].c_str()) + "=" + val);
   } else {
     int val = words[2].toInt();
-    stream->println(String("Setting ") + words[0] + " (" + (int)idx + ") to " + val);
+    stream->println(String("Setting ") + words[0].c_str() + " (" + (int)idx + ") to " + val);
     dxl_.writeControlTableItem(idx, id, val);
     val = (int)dxl_.readControlTableItem(idx, id);
-    stream->println(words[0] + "=" + val);
+    stream->println(String(words[0].c_str()) + "=" + val);
   }
   return RES_OK;
 }
@@ -33,8 +33,8 @@ public:
 	virtual Result start(ConsoleStream *stream = NULL);
 	virtual Result stop(ConsoleStream *stream = NULL);
 	virtual Result step();
-  virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
-  Result handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream *stream);
+  virtual Result handleConsoleCommand(const ConsoleArgs& words, ConsoleStream *stream);
+  Result handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const ConsoleArgs& words, ConsoleStream *stream);
 
   Result homeServos(float vel, ConsoleStream* stream = NULL);
 
@@ -45,20 +45,36 @@ static const float WHEEL_DISTANCE = 95.0;
 static const uint8_t BATT_STATUS_ADDR   = 0x40;
 static const uint8_t IMU_ADDR           = 0x6a;
 
-static const float SPEED_KP = 0.013;
-static const float SPEED_KI = 1.0; //0.8; 
+// Drive cascade: position sets the speed goal, speed sets the pitch goal, balance drives the motors. The outer
+// loops run every SPEED_LOOP_DIVIDER-th and POS_LOOP_DIVIDER-th control cycle.
+static const unsigned int SPEED_LOOP_DIVIDER = 2;
+static const unsigned int POS_LOOP_DIVIDER   = 8;
+static const float MAX_PITCH_GOAL = 8.0;   // degrees
+static const float MAX_SPEED_GOAL = 400.0; // mm/s
+static const float POS_HOLD_SPEED = 30.0;  // mm/s; below this the position loop takes over when the remote is released
+static const float SPEED_GOAL_RAMP = 800.0; // mm/s^2; remote speed goals, and stopping when it is released, ramp at this
+static const float SPEED_KP = 0.008;
+static const float SPEED_KI = 0.05;
 static const float SPEED_KD = 0;
-static const float POS_KP = 0.05;
+static const float POS_KP = 0.5;
 static const float POS_KI = 0;
-static const float POS_KD = 0;
+static const float POS_KD = 0.5;
 static const float BAL_KP = 25;
 static const float BAL_KI = 0;
 static const float BAL_KD = 2;
+// Balance autotuning ("autotune start" on the console, any remote button aborts). The relay pushes the motors by
+// AUTOTUNE_AMPLITUDE PWM either way; beyond AUTOTUNE_MAX_PITCH degrees it gives up and the cascade
+// balances again in the same cycle.
+static const float AUTOTUNE_AMPLITUDE = 60.0;
+static const float AUTOTUNE_HYSTERESIS = 0.2; // degrees
+static const float AUTOTUNE_MAX_PITCH = 15.0; // degrees
 static const float PITCH_BIAS = 1.35;
 static const float PITCH_DEADBAND = .5;
-static const float SPEED_REMOTE_FACTOR = 20.0;
+static const float SPEED_REMOTE_FACTOR = 400.0; // mm/s at full stick
 static const float ROT_REMOTE_FACTOR = 50.0;
 
+static const float DOWNLINK_BUDGET = 0.1; // Fraction of XBee channel time the droid->remote telemetry may use
+
 
 static const uint8_t SERVO_NECK         = 1;
 static const uint8_t SERVO_HEAD_PITCH   = 2;
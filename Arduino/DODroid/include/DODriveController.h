@@ -17,6 +17,7 @@ public:
   // These are used by the controller framework, do not call directly.
   virtual Result set(float value); 
   virtual float present();
+  virtual int saturation() { return saturation_; }
 
 protected:
   float goalVel_, goalRot_;
@@ -25,6 +26,25 @@ protected:
   float presentGoalVelL_, presentGoalVelR_;
   bb::ControlOutput &left_, &right_;
   unsigned long lastCycleUS_;
+  int saturation_;
+};
+
+// Speed or position of the droid, the mean of both wheels. Does not update the encoders, that is done once per
+// cycle in the droid's step(), because several loops read them.
+class DOWheelControlInput: public bb::ControlInput {
+public:
+  DOWheelControlInput(bb::Encoder& left, bb::Encoder& right, bb::Encoder::InputMode mode);
+
+  virtual Result update() { return RES_OK; }
+  virtual float present();
+
+  // Makes the present position 0. Positions are relative to this, so they stay small enough for fixed point.
+  void resetPosition();
+
+protected:
+  bb::Encoder &left_, &right_;
+  bb::Encoder::InputMode mode_;
+  float origin_;
 };
 
 #endif // DODRIVECONTROLLER_H
\ No newline at end of file
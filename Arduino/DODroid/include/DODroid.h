@@ -16,6 +16,7 @@ public:
     float speedKp, speedKi, speedKd;
     float posKp, posKi, posKd;
     float speedRemoteFactor, rotRemoteFactor;
+    float downlinkBudget;
   };
   static Params params_;
 
@@ -27,23 +28,45 @@ public:
 
   virtual void printStatus(ConsoleStream *stream);
   virtual Result fillAndSendStatePacket();
+  virtual Result sendDownlink();
 
   virtual Result incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet);
   virtual Result incomingConfigPacket(uint16_t station, PacketSource source, uint8_t rssi, const ConfigPacket& packet);
-  virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
-  virtual Result setParameterValue(const String& name, const String& stringVal);
+  virtual Result parametersChanged(const uint8_t *indices, size_t num);
 
   Result selfTest(ConsoleStream *stream = NULL);
 
 protected:
+  enum DriveLoop {
+    LOOP_BALANCE  = 0,
+    LOOP_SPEED    = 1,
+    LOOP_POSITION = 2
+  };
+
+  // The gains come first in parameterTable_
+  static const uint8_t NUM_GAIN_PARAMETERS = 9;
+
+  Result handleSelftestCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  void setDriveControlParameters();
+  static const ConsoleCommand commandTable_[];
+  static const ParameterDescription parameterTable_[];
+
   bb::DCMotor leftMotor_, rightMotor_;
   bb::Encoder leftEncoder_, rightEncoder_;
   
-  bb::PIDController* balanceController_;
+  // Position (every POS_LOOP_DIVIDER cycles) -> speed (every SPEED_LOOP_DIVIDER cycles) -> balance (every cycle)
+  bb::CascadedController* driveController_;
   DOIMUControlInput* balanceInput_;
+  DOWheelControlInput *speedInput_, *positionInput_;
   DODriveControlOutput* driveOutput_;
+  bool remoteDriving_;
+  bool autotuning_; // the autotuner drives the motors, not driveController_
   
   bool motorsOK_, servosOK_;
+
+  bb::DownlinkScheduler downlink_;
+  int downlinkSubsys_, downlinkBattery_, downlinkDrive_;
+  uint16_t leftRemoteStation_;
 };
 
 #endif
\ No newline at end of file
@@ -5,7 +5,6 @@
 
 #include <math.h>
 #include <Adafruit_ISM330DHCX.h>
-#include <MadgwickAHRS.h>
 
 #include "DOConfig.h"
 
@@ -55,7 +54,7 @@ public:
 private:  
   DOIMU();
 
-  Madgwick madgwick_;
+  bb::MadgwickFilter madgwick_;
   bool available_;
   Adafruit_ISM330DHCX imu_;
   Adafruit_Sensor *temp_, *accel_, *gyro_;
@@ -33,8 +33,6 @@ public:
 	virtual Result start(ConsoleStream *stream = NULL);
 	virtual Result stop(ConsoleStream *stream = NULL);
 	virtual Result step();
-  virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
-  Result handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream *stream);
 
   void setRequiredIds(const std::vector<uint8_t>& ids) { requiredIds_ = ids; }
 
@@ -64,6 +62,15 @@ public:
   uint32_t computeRawValue(float val, ValueType t=VALUE_DEGREE);
 
 protected:
+  Result handleMoveCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleSetVelCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleHomeCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleTorqueCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleInfoCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleRebootCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleCtrlTableCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  static const ConsoleCommand commandTable_[];
+
   DOServos();
   DynamixelShield dxl_;
 
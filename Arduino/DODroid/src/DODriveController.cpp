@@ -9,6 +9,7 @@ DODriveControlOutput::DODriveControlOutput(bb::ControlOutput& left, bb::ControlO
     presentGoalVelL_ = 0;
     presentGoalVelR_ = 0;
     lastCycleUS_ = micros();
+    saturation_ = 0;
 }
 
 bb::Result DODriveControlOutput::set(float value) {
@@ -17,6 +18,11 @@ bb::Result DODriveControlOutput::set(float value) {
   float l = goalVel_ + goalRot_ - value;
   float r = goalVel_ - goalRot_ - value;
 
+  // Motors take -255..255. The value is subtracted, so a wheel at the upper limit means the value can't go lower.
+  if(l >= 255.0f || r >= 255.0f) saturation_ = -1;
+  else if(l <= -255.0f || r <= -255.0f) saturation_ = 1;
+  else saturation_ = 0;
+
   resLeft = left_.set(l);
   resRight = right_.set(r);
 
@@ -43,4 +49,21 @@ void DODriveControlOutput::setGoalRotation(float goalRot) {
 
 void DODriveControlOutput::setDeadband(float deadband) {
   deadband_ = deadband;  
-}
\ No newline at end of file
+}
+
+DOWheelControlInput::DOWheelControlInput(bb::Encoder& left, bb::Encoder& right, bb::Encoder::InputMode mode):
+  left_(left),
+  right_(right),
+  mode_(mode),
+  origin_(0) {
+}
+
+float DOWheelControlInput::present() {
+  float value = (left_.present(mode_) + right_.present(mode_)) / 2.0f;
+  if(mode_ == bb::Encoder::INPUT_POSITION) value -= origin_;
+  return value;
+}
+
+void DOWheelControlInput::resetPosition() {
+  origin_ = (left_.presentPosition() + right_.presentPosition()) / 2.0f;
+}
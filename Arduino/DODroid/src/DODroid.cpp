@@ -16,7 +16,28 @@ DODroid::Params DODroid::params_ = {
   .posKi = POS_KI,
   .posKd = POS_KD,
   .speedRemoteFactor = SPEED_REMOTE_FACTOR,
-  .rotRemoteFactor = ROT_REMOTE_FACTOR
+  .rotRemoteFactor = ROT_REMOTE_FACTOR,
+  .downlinkBudget = DOWNLINK_BUDGET
+};
+
+const ConsoleCommand DODroid::commandTable_[] = {
+  {"selftest", "", BB_CONSOLE_HANDLER(DODroid, handleSelftestCommand), "selftest: Run self test"}
+};
+
+// Gains first, NUM_GAIN_PARAMETERS of them
+const ParameterDescription DODroid::parameterTable_[] = {
+  BB_PARAM_FLOAT("bal_kp", "Proportional constant for balance PID controller", params_.balKp, 0, INT_MAX),
+  BB_PARAM_FLOAT("bal_ki", "Integrative constant for balance PID controller", params_.balKi, 0, INT_MAX),
+  BB_PARAM_FLOAT("bal_kd", "Derivative constant for balance PID controller", params_.balKd, 0, INT_MAX),
+  BB_PARAM_FLOAT("speed_kp", "Proportional constant for speed PID controller", params_.speedKp, 0, INT_MAX),
+  BB_PARAM_FLOAT("speed_ki", "Integrative constant for speed PID controller", params_.speedKi, 0, INT_MAX),
+  BB_PARAM_FLOAT("speed_kd", "Derivative constant for speed PID controller", params_.speedKd, 0, INT_MAX),
+  BB_PARAM_FLOAT("pos_kp", "Proportional constant for position PID controller", params_.posKp, 0, INT_MAX),
+  BB_PARAM_FLOAT("pos_ki", "Integrative constant for position PID controller", params_.posKi, 0, INT_MAX),
+  BB_PARAM_FLOAT("pos_kd", "Derivative constant for position PID controller", params_.posKd, 0, INT_MAX),
+  BB_PARAM_FLOAT("speed_remote_factor", "Amplification factor for remote speed axis", params_.speedRemoteFactor, 0, 1000),
+  BB_PARAM_FLOAT("rot_remote_factor", "Amplification factor for remote rotation axis", params_.rotRemoteFactor, 0, 100),
+  BB_PARAM_FLOAT("downlink_budget", "Fraction of XBee channel time for telemetry to the left remote", params_.downlinkBudget, 0, 1)
 };
 
 DODroid::DODroid():
@@ -24,8 +45,12 @@ DODroid::DODroid():
   rightMotor_(P_RIGHT_PWMA, P_RIGHT_PWMB), 
   leftEncoder_(P_LEFT_ENCA, P_LEFT_ENCB, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS),
   rightEncoder_(P_RIGHT_ENCA, P_RIGHT_ENCB, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS),
+  remoteDriving_(false),
+  autotuning_(false),
   motorsOK_(false),
-  servosOK_(false)
+  servosOK_(false),
+  downlink_(DOWNLINK_BUDGET),
+  leftRemoteStation_(0)
 {
   pinMode(PULL_DOWN_A0, OUTPUT);
   digitalWrite(PULL_DOWN_A0, LOW);
@@ -33,29 +58,35 @@ DODroid::DODroid():
   name_ = "d-o";
 
   description_ = "D-O Main System";
-  help_ = "Available commands:\r\n"\
-"\tstatus\tPrint Status\r\n"\
-"\tselftest\tRun self test";
+  setCommands(commandTable_);
   started_ = false;
   operationStatus_ = RES_SUBSYS_NOT_STARTED;
+
+  downlinkDrive_ = downlink_.addItem(4);
+  downlinkSubsys_ = downlink_.addItem(2);
+  downlinkBattery_ = downlink_.addItem(1);
 }
 
 Result DODroid::initialize() {
-  addParameter("bal_kp", "Proportional constant for balance PID controller", params_.balKp, 0, INT_MAX);
-  addParameter("bal_ki", "Integrative constant for balance PID controller", params_.balKi, 0, INT_MAX);
-  addParameter("bal_kd", "Derivative constant for balance PID controller", params_.balKd, 0, INT_MAX);
-  addParameter("speed_kp", "Proportional constant for speed PID controller", params_.speedKp, 0, INT_MAX);
-  addParameter("speed_ki", "Integrative constant for speed PID controller", params_.speedKi, 0, INT_MAX);
-  addParameter("speed_kd", "Derivative constant for speed PID controller", params_.speedKd, 0, INT_MAX);
-  addParameter("pos_kp", "Proportional constant for position PID controller", params_.posKp, 0, INT_MAX);
-  addParameter("pos_ki", "Integrative constant for position PID controller", params_.posKi, 0, INT_MAX);
-  addParameter("pos_kd", "Derivative constant for position PID controller", params_.posKd, 0, INT_MAX);
-  addParameter("speed_remote_factor", "Amplification factor for remote speed axis", params_.speedRemoteFactor, 0, 100);
-  addParameter("rot_remote_factor", "Amplification factor for remote rotation axis", params_.rotRemoteFactor, 0, 100);
+  setParameters(parameterTable_);
 
   balanceInput_ = new DOIMUControlInput(DOIMUControlInput::IMU_PITCH);
+  speedInput_ = new DOWheelControlInput(leftEncoder_, rightEncoder_, bb::Encoder::INPUT_SPEED);
+  positionInput_ = new DOWheelControlInput(leftEncoder_, rightEncoder_, bb::Encoder::INPUT_POSITION);
   driveOutput_ = new DODriveControlOutput(leftMotor_, rightMotor_);
-  balanceController_ = new PIDController(*balanceInput_, *driveOutput_);
+
+  driveController_ = new CascadedController(*balanceInput_, *driveOutput_);
+  driveController_->addOuterLoop(*speedInput_, SPEED_LOOP_DIVIDER);
+  driveController_->addOuterLoop(*positionInput_, POS_LOOP_DIVIDER);
+  driveController_->loop(LOOP_SPEED).setControlBounds(-MAX_PITCH_GOAL, MAX_PITCH_GOAL);
+  driveController_->loop(LOOP_POSITION).setControlBounds(-MAX_SPEED_GOAL, MAX_SPEED_GOAL);
+
+  PIDAutotuner& autotuner = PIDAutotuner::autotuner;
+  autotuner.initialize();
+  autotuner.attach(*balanceInput_, *driveOutput_, this, "bal_kp", "bal_ki", "bal_kd");
+  autotuner.setParameter(autotuner.parameterIndex("amplitude"), AUTOTUNE_AMPLITUDE);
+  autotuner.setParameter(autotuner.parameterIndex("hysteresis"), AUTOTUNE_HYSTERESIS);
+  autotuner.setParameter(autotuner.parameterIndex("max_deviation"), AUTOTUNE_MAX_PITCH);
 
   return Subsystem::initialize();
 }
@@ -79,7 +110,13 @@ Result DODroid::start(ConsoleStream* stream) {
   rightEncoder_.setMode(bb::Encoder::INPUT_SPEED);
   rightEncoder_.setUnit(bb::Encoder::UNIT_MILLIMETERS);
 
-  balanceController_->setControlParameters(params_.balKp, params_.balKi, params_.balKd);
+  setDriveControlParameters();
+  // DOIMU::imu.begin() has set the cycle time
+  driveController_->setGoalRamp(LOOP_SPEED, SPEED_GOAL_RAMP * Runloop::runloop.cycleTimeSeconds());
+  positionInput_->resetPosition();
+  driveController_->setOutermostLoop(LOOP_POSITION);
+  driveController_->reset();
+  driveController_->setGoal(0);
 
   started_ = true;
   operationStatus_ = RES_OK;
@@ -105,11 +142,38 @@ Result DODroid::step() {
   }
   
   DOIMU::imu.update();
+  // Once per cycle here, because both the speed and the position loop read them
+  leftEncoder_.update();
+  rightEncoder_.update();
 
-  if(motorsOK_) {
-    balanceController_->update();
+  if(PIDAutotuner::autotuner.isStarted()) {
+    autotuning_ = true;
+    // The autotuner gives up beyond AUTOTUNE_MAX_PITCH too, but it may step after us and leave D-O without
+    // balance for a cycle. Check the pitch just read and take over in this cycle.
+    float r, p, h;
+    if(DOIMU::imu.getFilteredRPH(r, p, h) && fabs(p) > AUTOTUNE_MAX_PITCH) {
+      PIDAutotuner::autotuner.abort();
+      Console::console.printfBroadcast("Autotune: pitch %f beyond %f, balancing again\n", p, AUTOTUNE_MAX_PITCH);
+    }
+  }
+  if(autotuning_ && !PIDAutotuner::autotuner.isStarted()) {
+    // Back from autotuning, with whatever gains were committed meanwhile
+    autotuning_ = false;
+    positionInput_->resetPosition();
+    driveController_->setOutermostLoop(LOOP_POSITION);
+    driveController_->reset();
+    driveController_->setGoal(0);
+  }
+
+  if(motorsOK_ && !autotuning_) {
+    // Hold position once the remote lets go and the droid has slowed down
+    if(!remoteDriving_ && driveController_->outermostLoop() == LOOP_SPEED && fabs(speedInput_->present()) < POS_HOLD_SPEED) {
+      positionInput_->resetPosition();
+      driveController_->setOutermostLoop(LOOP_POSITION);
+    }
+    driveController_->update();
     float err, errI, errD, control;
-    balanceController_->getControlState(err, errI, errD, control);
+    driveController_->loop(LOOP_BALANCE).getControlState(err, errI, errD, control);
     //Console::console.printfBroadcast("Balance controller: %f %f %f %f\n", err, errI, errD, control);
   }
 
@@ -134,6 +198,10 @@ void DODroid::printStatus(ConsoleStream *stream) {
 
   stream->printf(", servos: %s", DOServos::servos.isStarted() ? "OK" : "not started");
 
+  stream->printf(", downlink: ");
+  if(leftRemoteStation_ != 0) stream->printf("to 0x%x, %lu frames, %.1f%% airtime", leftRemoteStation_, downlink_.framesSent(), downlink_.airtimeUsed()*100);
+  else stream->printf("no left remote");
+
   stream->printf(", motors: ");
   leftEncoder_.update();
   rightEncoder_.update();
@@ -144,12 +212,26 @@ void DODroid::printStatus(ConsoleStream *stream) {
 }
 
 Result DODroid::incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet) {
+  downlink_.noteControlTraffic();
+
   if(source == PACKET_SOURCE_LEFT_REMOTE) {
     //Console::console.printfBroadcast("Control packet from left remote\n");
+    leftRemoteStation_ = station;
     return RES_OK;
   } else if(source == PACKET_SOURCE_RIGHT_REMOTE) {
+    if(packet.button0 || packet.button1 || packet.button2 || packet.button3 || packet.button4) {
+      PIDAutotuner::autotuner.abort();
+    }
     //Console::console.printfBroadcast("Control packet from right remote: %.2f %.2f\n", packet.getAxis(0), packet.getAxis(1));
-    balanceController_->setGoal(params_.speedRemoteFactor*packet.getAxis(1));
+    // Drive on speed goals while the stick is off center, stop and hold position when it is back
+    float speed = params_.speedRemoteFactor*packet.getAxis(1);
+    remoteDriving_ = fabs(packet.getAxis(1)) >= 1.0f/AXIS_MAX;
+    if(remoteDriving_) {
+      driveController_->setOutermostLoop(LOOP_SPEED);
+      driveController_->setGoal(speed);
+    } else if(driveController_->outermostLoop() == LOOP_SPEED) {
+      driveController_->setGoal(0);
+    }
     driveOutput_->setGoalRotation(params_.rotRemoteFactor*packet.getAxis(0));
     return RES_OK;
   }
@@ -160,38 +242,90 @@ Result DODroid::incomingConfigPacket(uint16_t station, PacketSource source, uint
   return RES_OK;
 }
 
-Result DODroid::handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
-  if(words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
-
-  if(words.size() == 1 && words[0] == "selftest") {
-    Runloop::runloop.excuseOverrun();
-    if(stream) stream->printf("Running selftest.\n");
-    Result res = selfTest(stream);
-    if(stream) stream->printf("Selftest returns %s.\n", errorMessage(res));
-    return res;
+Result DODroid::handleSelftestCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+  (void)args;
+  Runloop::runloop.excuseOverrun();
+  if(stream) stream->printf("Running selftest.\n");
+  Result res = selfTest(stream);
+  if(stream) stream->printf("Selftest returns %s.\n", errorMessage(res));
+  return res;
+}
+// Once per set or committed transaction, so that the controller is only reset once for a new set of gains. Other
+// parameters leave the integrators alone.
+Result DODroid::parametersChanged(const uint8_t *indices, size_t num) {
+  bool gainsChanged = false;
+  for(size_t i=0; i<num; i++) {
+    if(indices[i] < NUM_GAIN_PARAMETERS) gainsChanged = true;
+  }
+  if(gainsChanged) {
+    setDriveControlParameters();
+    driveController_->reset();
   }
+  downlink_.setBudget(params_.downlinkBudget);
 
-  return bb::Subsystem::handleConsoleCommand(words, stream);
+  return RES_OK;
 }
 
-Result DODroid::setParameterValue(const String& name, const String& stringVal) {
-  Result retval = Subsystem::setParameterValue(name, stringVal);
-  if(retval != RES_OK) return retval;
+void DODroid::setDriveControlParameters() {
+  driveController_->loop(LOOP_BALANCE).setControlParameters(params_.balKp, params_.balKi, params_.balKd);
+  driveController_->loop(LOOP_SPEED).setControlParameters(params_.speedKp, params_.speedKi, params_.speedKd);
+  driveController_->loop(LOOP_POSITION).setControlParameters(params_.posKp, params_.posKi, params_.posKd);
+}
 
-  balanceController_->setControlParameters(params_.balKp, params_.balKi, params_.balKd);
-  balanceController_->reset();
+Result DODroid::sendDownlink() {
+  if(leftRemoteStation_ == 0) return RES_OK;
+
+  int item = downlink_.schedule();
+  if(item < 0) return RES_OK;
+
+  Packet packet;
+  memset(&packet, 0, sizeof(packet));
+  packet.type = PACKET_TYPE_STATE;
+  packet.source = PACKET_SOURCE_DROID;
+
+  StatePacket& state = packet.payload.state;
+  state.controlMode.driveControl = ControlMode::CONTROL_RC;
+  state.controlMode.domeControl = ControlMode::CONTROL_RC;
+  state.controlMode.armsControl = ControlMode::CONTROL_OFF;
+  state.controlMode.soundControl = ControlMode::CONTROL_OFF;
+
+  float voltage = DOBattStatus::batt.voltage();
+  if(!DOBattStatus::batt.available()) state.subsysStatus.battery = SubsysStatus::STATUS_ERROR;
+  else if(voltage > POWER_BATT_NONE && voltage < POWER_BATT_MIN) state.subsysStatus.battery = SubsysStatus::STATUS_CRITICAL;
+  else state.subsysStatus.battery = SubsysStatus::STATUS_OK;
+  state.subsysStatus.drive = motorsOK_ ? SubsysStatus::STATUS_OK : SubsysStatus::STATUS_ERROR;
+  state.subsysStatus.servos = servosOK_ ? SubsysStatus::STATUS_OK : 
+    (DOServos::servos.isStarted() ? SubsysStatus::STATUS_DEGRADED : SubsysStatus::STATUS_ERROR);
+  state.subsysStatus.comm = SubsysStatus::STATUS_OK;
+
+  if(item == downlinkBattery_) {
+    state.item = StatePacket::STATE_BATTERY;
+    state.data.battery.voltage = constrain(voltage * 100, 0, 65535);
+    state.data.battery.current = constrain(DOBattStatus::batt.current(), -32768, 32767);
+  } else if(item == downlinkDrive_) {
+    float r, p, h;
+    state.item = StatePacket::STATE_DRIVE;
+    state.data.drive.speed = constrain((leftEncoder_.presentSpeed() + rightEncoder_.presentSpeed()) / 2, -32768, 32767);
+    if(DOIMU::imu.getFilteredRPH(r, p, h)) state.data.drive.pitch = constrain(p * 100, -32768, 32767);
+  } else {
+    state.item = StatePacket::STATE_SUBSYS;
+  }
 
-  return RES_OK;
+  Result res = XBee::xbee.sendTo(leftRemoteStation_, packet, false);
+  if(res == RES_OK) downlink_.sent(item);
+  return res;
 }
 
 Result DODroid::fillAndSendStatePacket() {
-  LargeStatePacket p;
+  sendDownlink();
+
+  if(!TelemetryService::telemetry.wantsSample()) return RES_OK;
 
-  //if((Runloop::runloop.getSequenceNumber() % 4) != 0) return RES_OK;
+  LargeStatePacket p;
+  memset(&p, 0, sizeof(p)); // unused fields must stay constant for the delta encoding
 
   p.timestamp = Runloop::runloop.millisSinceStart() / 1000.0;
   p.droidType = DroidType::DROID_DO;
-  return RES_OK;
 
   strncpy(p.droidName, DROID_NAME, sizeof(p.droidName));
 
@@ -199,11 +333,11 @@ Result DODroid::fillAndSendStatePacket() {
 
   p.drive[0].errorState = ERROR_OK;
   p.drive[0].controlMode = 0;
-  p.drive[0].presentPWM = 0; balanceController_->present();
+  p.drive[0].presentPWM = 0; driveController_->loop(LOOP_BALANCE).present();
   p.drive[0].presentPos = leftEncoder_.presentPosition();
   p.drive[0].presentSpeed = leftEncoder_.presentSpeed();
   
-  balanceController_->getControlState(err, errI, errD, control);
+  driveController_->loop(LOOP_BALANCE).getControlState(err, errI, errD, control);
   p.drive[0].err = err;
   p.drive[0].errI = errI;
   p.drive[0].errD = errD;
@@ -220,9 +354,7 @@ Result DODroid::fillAndSendStatePacket() {
   p.battery[1].errorState = ERROR_NOT_PRESENT;
   p.battery[2].errorState = ERROR_NOT_PRESENT;
 
-  WifiServer::server.broadcastUDPPacket((const uint8_t*)&p, sizeof(p));
-
-  return RES_OK;
+  return TelemetryService::telemetry.publish(p);
 }
 
 Result DODroid::selfTest(ConsoleStream *stream) {
@@ -28,6 +28,26 @@ static const StrToCtrlTable strToCtrlTable_[] = {
 
 static const int strToCtrlTableLen_ = 8;
 
+#define CTRL_TABLE_COMMAND(name) \
+  {name, "i|i", BB_CONSOLE_HANDLER(DOServos, handleCtrlTableCommand), name " <servo> [<value>]: Get or set control table item"}
+
+const ConsoleCommand DOServos::commandTable_[] = {
+  CTRL_TABLE_COMMAND("current_limit"),
+  {"home",    "",   BB_CONSOLE_HANDLER(DOServos, handleHomeCommand),   "home: Home all servos, slowly"},
+  {"info",    "s",  BB_CONSOLE_HANDLER(DOServos, handleInfoCommand),   "info <servo>|all: Get info on <servo>"},
+  {"move",    "sf", BB_CONSOLE_HANDLER(DOServos, handleMoveCommand),   "move <servo>|all <angle>: <angle> in deg [0.0..360.0]"},
+  CTRL_TABLE_COMMAND("operating_mode"),
+  CTRL_TABLE_COMMAND("pos_d_gain"),
+  CTRL_TABLE_COMMAND("pos_i_gain"),
+  CTRL_TABLE_COMMAND("pos_p_gain"),
+  CTRL_TABLE_COMMAND("profile_acc"),
+  CTRL_TABLE_COMMAND("profile_vel"),
+  {"reboot",  "s",  BB_CONSOLE_HANDLER(DOServos, handleRebootCommand), "reboot <servo>|all: Reboot <servo>"},
+  {"set_vel", "sf", BB_CONSOLE_HANDLER(DOServos, handleSetVelCommand), "set_vel <servo>|all <val>: <val> in deg/s; 0 is infinite speed"},
+  {"torque",  "sb", BB_CONSOLE_HANDLER(DOServos, handleTorqueCommand), "torque <servo>|all on|off: Switch torque"},
+  CTRL_TABLE_COMMAND("vel_limit")
+};
+
 DOServoControlOutput::DOServoControlOutput(uint8_t sn, float offset) {
   sn_ = sn;
   offset_ = offset;
@@ -52,15 +72,8 @@ DOServos::DOServos() {
 Result DOServos::initialize() {
   name_ = "servos";
   description_ = "Dynamixel subsystem";
-  help_ = "Dynamixel Subsystem\r\n"
-          "Available commands:\r\n"
-          "\ttorque <servo>|all on|off           Switch torque.\r\n"
-          "\tmove <servo>|all <angle>            <angle>: deg [-180.0..180.0].\r\n"
-          "\tset_vel <servo>|all <val>           <val> in deg/s; 0 is infinite speed.\r\n"
-          "\thome                                Home all servos, slowly.\r\n"
-          "\tinfo <servo>                        Get info on <servo>.\r\n"
-          "\t<ctrltableitem> <servo> [<value>]   Get or set, options: vel_limit, current_limit, profile_acc.\r\n"
-          "\reboot <servo>|all                   Reboot <servo>";
+  help_ = "Dynamixel Subsystem";
+  setCommands(commandTable_);
 
   ctrlPresentPos_.addr = 0;
   ctrlPresentLoad_.addr = 0;
@@ -228,100 +241,88 @@ Result DOServos::step() {
   return RES_OK;
 }
 
-Result DOServos::handleConsoleCommand(const std::vector<String>& words, ConsoleStream* stream) {
+Result DOServos::handleMoveCommand(const ConsoleArgs& args, ConsoleStream* stream) {
   (void)stream;
-  if (words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
-
-  if (words[0] == "move") {
-    if (words.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    unsigned int id = words[1] == "all" ? ID_ALL : words[1].toInt();
-    float angle = words[2].toFloat();
-    if(angle < 0 || angle > 360.0) return RES_CMD_INVALID_ARGUMENT;
-    if(setGoal(id, angle)) return RES_OK;
-    return RES_CMD_INVALID_ARGUMENT;
-  }
-
-  else if (words[0] == "set_vel") {
-    if (words.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    unsigned int id = words[1] == "all" ? ID_ALL : words[1].toInt();
-    float vel = words[2].toFloat();
-    if(vel < 0) return RES_CMD_INVALID_ARGUMENT;
-    if(setProfileVelocity(id, vel)) return RES_OK;
-    return RES_CMD_INVALID_ARGUMENT;
-  }
+  unsigned int id = args[1] == "all" ? ID_ALL : args[1].toInt();
+  float angle = args[2].toFloat();
+  if(angle < 0 || angle > 360.0) return RES_CMD_INVALID_ARGUMENT;
+  if(setGoal(id, angle)) return RES_OK;
+  return RES_CMD_INVALID_ARGUMENT;
+}
 
-  else if (words[0] == "home") {
-    if (words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
+Result DOServos::handleSetVelCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  (void)stream;
+  unsigned int id = args[1] == "all" ? ID_ALL : args[1].toInt();
+  float vel = args[2].toFloat();
+  if(vel < 0) return RES_CMD_INVALID_ARGUMENT;
+  if(setProfileVelocity(id, vel)) return RES_OK;
+  return RES_CMD_INVALID_ARGUMENT;
+}
 
-    return home(SLOW_VEL, stream);
-  }
+Result DOServos::handleHomeCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  (void)args;
+  return home(SLOW_VEL, stream);
+}
 
-  else if (words[0] == "torque") {
-    if (words.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    uint8_t id;
-    if (words[1] == "all") id = ID_ALL;
-    else id = words[1].toInt();
-    return switchTorque(id, words[2] == "on" ? true : false);
-  }
+Result DOServos::handleTorqueCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  (void)stream;
+  uint8_t id;
+  if (args[1] == "all") id = ID_ALL;
+  else id = args[1].toInt();
+  return switchTorque(id, args[2].toBool());
+}
 
-  else if (words[0] == "info") {
-    Runloop::runloop.excuseOverrun();
+Result DOServos::handleInfoCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  Runloop::runloop.excuseOverrun();
 
-    if (words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    if(words[1] == "all") {
-      for(auto& s: servos_) printStatus(stream, s.id);
-      return RES_OK;
-    }
-    int id = words[1].toInt();
-    printStatus(stream, id);
+  if(args[1] == "all") {
+    for(auto& s: servos_) printStatus(stream, s.id);
     return RES_OK;
   }
+  int id = args[1].toInt();
+  printStatus(stream, id);
+  return RES_OK;
+}
 
-  else if (words[0] == "reboot") {
-    Runloop::runloop.excuseOverrun();
+Result DOServos::handleRebootCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  Runloop::runloop.excuseOverrun();
 
-    if (words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    if(words[1] == "all") {
-      for (auto& s : servos_) {
-        if (stream) {
-          stream->printf("Rebooting %d... ", s.id);
-        }
-        dxl_.reboot(s.id);
+  if(args[1] == "all") {
+    for (auto& s : servos_) {
+      if (stream) {
+        stream->printf("Rebooting %d... ", s.id);
       }
-    } else {
-      uint8_t id = words[1].toInt();
-      if(servoWithID(id) == NULL) return RES_CMD_INVALID_ARGUMENT;
-      dxl_.reboot(id);
+      dxl_.reboot(s.id);
     }
-
-    delay(1000);
-
-    return RES_OK;
+  } else {
+    uint8_t id = args[1].toInt();
+    if(servoWithID(id) == NULL) return RES_CMD_INVALID_ARGUMENT;
+    dxl_.reboot(id);
   }
 
-  else {
-    for(int i=0; i<strToCtrlTableLen_; i++) {
-      if(words[0] == strToCtrlTable_[i].str) {
-        return handleCtrlTableCommand(strToCtrlTable_[i].idx, words, stream);
-      }
-    }
-  }
+  delay(1000);
 
-  return bb::Subsystem::handleConsoleCommand(words, stream);
+  return RES_OK;
 }
 
-Result DOServos::handleCtrlTableCommand(ControlTableItem::ControlTableItemIndex idx, const std::vector<String>& words, ConsoleStream* stream) {
-  if (words.size() < 2 || words.size() > 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
-  int id = words[1].toInt();
-  if (words.size() == 2) {
+Result DOServos::handleCtrlTableCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+  int i;
+  for(i=0; i<strToCtrlTableLen_; i++) {
+    if(args[0] == strToCtrlTable_[i].str) break;
+  }
+  if(i == strToCtrlTableLen_) return RES_CMD_UNKNOWN_COMMAND;
+  ControlTableItem::ControlTableItemIndex idx = strToCtrlTable_[i].idx;
+
+  int id = args[1].toInt();
+  if (args.size() == 2) {
     int val = (int)dxl_.readControlTableItem(idx, id);
-    if(stream) stream->printf("%s=%d\n", words[0].c_str(), val);
+    if(stream) stream->printf("%s=%d\n", args[0].c_str(), val);
   } else {
-    int val = words[2].toInt();
-    if(stream) stream->printf("Setting %s (%d) to %d\n", words[0].c_str(), (int)idx, val);
+    int val = args[2].toInt();
+    if(stream) stream->printf("Setting %s (%d) to %d\n", args[0].c_str(), (int)idx, val);
     dxl_.writeControlTableItem(idx, id, val);
     val = (int)dxl_.readControlTableItem(idx, id);
-    if(stream) stream->printf("%s=%d\n", words[0].c_str(), val);
+    if(stream) stream->printf("%s=%d\n", args[0].c_str(), val);
   }
   return RES_OK;
 }
@@ -703,14 +704,14 @@ Result DOServos::syncReadInfo(ConsoleStream *stream) {
   recv_cnt = dxl_.syncRead(&srPresentInfos);
   if(recv_cnt != servos_.size()) {
     if(stream) stream->printf("Receiving position failed!\n");
-    else Console::console.printfBroadcast("Receiving position failed!\n");
+    else BB_LOG("Receiving position failed!\n");
     return RES_SUBSYS_HW_DEPENDENCY_MISSING;
   }
 
   recv_cnt = dxl_.syncRead(&srLoadInfos);
   if(recv_cnt != servos_.size()) {
     if(stream) stream->printf("Receiving initial load failed!\n");
-    else Console::console.printfBroadcast("Receiving initial load failed!\n");
+    else BB_LOG("Receiving initial load failed!\n");
     return RES_SUBSYS_HW_DEPENDENCY_MISSING;
   }
 
@@ -720,13 +721,13 @@ Result DOServos::syncReadInfo(ConsoleStream *stream) {
 Result DOServos::syncWriteInfo(ConsoleStream* stream) {
   if(dxl_.syncWrite(&swGoalInfos) == false) {
     if(stream) stream->printf("Sending servo position goal failed!\n");
-    else Console::console.printfBroadcast("Sending servo position goal failed!\n");
+    else BB_LOG("Sending servo position goal failed!\n");
     return RES_SUBSYS_COMM_ERROR;
   }
 
   if(dxl_.syncWrite(&swVelInfos) == false) {
     if(stream) stream->printf("Sending servo profile velocity failed!\n");
-    else Console::console.printfBroadcast("Sending servo profile velocity failed!\n");
+    else BB_LOG("Sending servo profile velocity failed!\n");
     return RES_SUBSYS_COMM_ERROR;
   }
 
@@ -39,8 +39,11 @@ void initializeSubsystems() {
   ConfigStorage::storage.initialize();
   Runloop::runloop.initialize();
   Console::console.initialize();
+  Log::log.initialize();
   WifiServer::server.initialize(WIFI_SSID, WIFI_WPA_KEY, WIFI_AP_MODE, DEFAULT_UDP_PORT, DEFAULT_TCP_PORT);
   WifiServer::server.setOTANameAndPassword("D-O", "OTA");
+  TelemetryService::telemetry.initialize();
+  CommandServer::server.initialize(COMMAND_UDP_PORT);
   uint16_t station = XBee::makeStationID(XBee::DROID_DIFF_UNSTABLE, BUILDER_ID, DROID_ID);
   XBee::xbee.initialize(DEFAULT_CHAN, DEFAULT_PAN, station, 115200, serialTXSerial);
   XBee::xbee.setDebugFlags((XBee::DebugFlags)(XBee::DEBUG_PROTOCOL|XBee::DEBUG_XBEE_COMM));
@@ -52,7 +55,10 @@ void initializeSubsystems() {
 
 void startSubsystems() {
   Console::console.start();
+  Log::log.start();
   WifiServer::server.start();
+  TelemetryService::telemetry.start();
+  CommandServer::server.start();
   XBee::xbee.addPacketReceiver(&DODroid::droid);
   XBee::xbee.start();
   XBee::xbee.setAPIMode(true);
@@ -0,0 +1,231 @@
+//
+// Host test and benchmark for bb::StateFeedback and bb::StateSpaceController. Checks u = u0 - K (x - r) against a
+// double reference, with goals and control offsets folded in when set and refolded when gains change, the clamp and
+// what saturation() reports, that Q16.16 stays within the rounding of its inputs of the exact result, and a
+// StateSpaceController<4,1> updating its inputs and setting its output. Then times an update in float and in
+// Q16.16. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include bench_state_space.cpp host/host.cpp ../src/*.cpp -o bench_state_space && ./bench_state_space
+//
+// Host timings only rank the variants; on the M0+ fixed point is the fast one, float goes through soft float. The
+// comparison with the PID cascade on the pendulum is in sim_cascade.cpp.
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <type_traits>
+
+using namespace bb;
+
+static const int ITERATIONS = 2000000;
+static const int SAMPLES = 1024;
+
+// D-O balance gains from lqr_gains.py, and a second control for heading to show NU > 1.
+static const float GAINS_4_1[1][4] = {{-57.3007f, -6.50517f, -1.50124f, -1.91568f}};
+static const float GAINS_6_2[2][6] = {{-57.3007f, -6.50517f, -1.50124f, -1.91568f, 0.0f, 0.0f},
+                                      {0.0f, 0.0f, 0.0f, 0.0f, -2.5f, -0.3f}};
+static const float RANGE[6] = {10.0f, 100.0f, 500.0f, 300.0f, 30.0f, 100.0f}; // deg, deg/s, mm/s, mm, deg, deg/s
+static const float GOALS[6] = {1.5f, 0.0f, 200.0f, 1000.0f, -20.0f, 0.0f};
+static const float OFFSETS[2] = {12.0f, -3.0f};
+static const float NO_GOALS[6] = {0, 0, 0, 0, 0, 0};
+
+static float states[SAMPLES][6];
+static unsigned int checksum;
+
+// u0 - K (x - r) in double, and a bound on how far Q16.16 may be from it: half an LSB for every gain, state, the
+// folded offset and the result, times what it is multiplied with, and float's rounding of the offset on top.
+template<int NX> static double reference(const float (&k)[NX], const float *x, const float *goal, float u0,
+	double *fixedBound) {
+	const double lsb = 1.0 / (1 << 17);
+	double u = u0, bound = 2*lsb, magnitude = fabs(u0);
+	for(int i=0; i<NX; i++) {
+		u -= double(k[i]) * (double(x[i]) - goal[i]);
+		bound += (fabs(k[i]) + fabs(x[i])) * lsb;
+		magnitude += fabs(k[i] * goal[i]);
+	}
+	if(fixedBound) *fixedBound = bound + magnitude * 1e-6;
+	return u;
+}
+
+// Every sample against the reference, with the gains set before or after the goals and offsets. The tolerance is
+// relative for float and the rounding bound for fixed point.
+template<int NX, int NU, typename T> static void checkFolding(const char *name, const float (&gains)[NU][NX],
+	bool gainsFirst) {
+	StateFeedback<NX, NU, T> fb;
+	if(gainsFirst) fb.setGains(gains);
+	for(int i=0; i<NX; i++) fb.setGoal(i, GOALS[i]);
+	for(int j=0; j<NU; j++) fb.setControlOffset(j, OFFSETS[j]);
+	if(!gainsFirst) fb.setGains(gains);
+
+	float maxErr = 0;
+	int bad = 0;
+	for(int s=0; s<SAMPLES; s++) {
+		T x[NX], u[NU];
+		for(int i=0; i<NX; i++) x[i] = T(states[s][i]);
+		fb.compute(x, u);
+		for(int j=0; j<NU; j++) {
+			float xf[NX];
+			for(int i=0; i<NX; i++) xf[i] = float(x[i]); // the state as T holds it, for float the same
+			double bound, expected = reference<NX>(gains[j], xf, GOALS, OFFSETS[j], &bound);
+			if(std::is_floating_point<T>::value) bound = 1e-5 * (1 + fabs(expected));
+			double err = fabs(float(u[j]) - expected);
+			if(err > bound) bad++;
+			if(err > maxErr) maxErr = err;
+		}
+	}
+	CHECK(bad == 0, "%s, %s set first: %d controls off the reference, up to %g", name, gainsFirst ? "gains" : "goals",
+		bad, maxErr);
+}
+
+template<typename T> static void checkClamp(const char *name) {
+	StateFeedback<4, 1, T> fb;
+	fb.setGains(GAINS_4_1);
+	fb.setControlBounds(0, -255, 255);
+	T x[4] = {T(0.5f), T(0.0f), T(0.0f), T(0.0f)}, u[1];
+
+	// -K x = 28.65, within the bounds
+	fb.compute(x, u);
+	CHECK(fabs(float(u[0]) - 28.65035f) < 1e-3f && fb.saturation(0) == 0, "%s: %g unclamped, saturation %d", name,
+		float(u[0]), fb.saturation(0));
+	x[0] = T(10.0f);
+	fb.compute(x, u);
+	CHECK(float(u[0]) == 255 && fb.saturation(0) == 1, "%s: %g at the upper bound, saturation %d", name,
+		float(u[0]), fb.saturation(0));
+	x[0] = T(-10.0f);
+	fb.compute(x, u);
+	CHECK(float(u[0]) == -255 && fb.saturation(0) == -1, "%s: %g at the lower bound, saturation %d", name,
+		float(u[0]), fb.saturation(0));
+	// A goal moves the clamp point with it: -10 degrees is half a degree off a -9.5 degree goal
+	fb.setGoal(0, -9.5f);
+	fb.compute(x, u);
+	CHECK(fabs(float(u[0]) + 28.65035f) < 1e-3f && fb.saturation(0) == 0, "%s: %g off the goal, saturation %d", name,
+		float(u[0]), fb.saturation(0));
+	// Unbounded, nothing is clamped or reported
+	fb.setGoal(0, 0);
+	fb.setControlUnbounded(0);
+	fb.compute(x, u);
+	CHECK(fabs(float(u[0]) + 573.007f) < 1e-2f && fb.saturation(0) == 0, "%s: %g unbounded, saturation %d", name,
+		float(u[0]), fb.saturation(0));
+	// Read back as set, not as rounded to T
+	CHECK(fb.gain(0, 1) == GAINS_4_1[0][1] && fb.goal(0) == 0 && fb.controlOffset(0) == 0, "%s: read back %g", name,
+		fb.gain(0, 1));
+}
+
+// Fakes for the controller: an input counting its updates, an output that can report a limit of its own
+struct FakeInput: public ControlInput {
+	float value = 0;
+	int updates = 0;
+	Result update() { updates++; return RES_OK; }
+	float present() { return value; }
+};
+
+struct FakeOutput: public ControlOutput {
+	float value = 0;
+	int sets = 0, limit = 0;
+	float present() { return value; }
+	Result set(float v) { value = v; sets++; return RES_OK; }
+	int saturation() { return limit; }
+};
+
+static void checkController() {
+	FakeInput pitch, rate, speed, pos;
+	FakeOutput out;
+	StateSpaceController<4, 1> c({&pitch, &rate, &speed, &pos}, {&out});
+	c.setGains(GAINS_4_1);
+	c.setControlBounds(0, -255, 255);
+
+	const float x[4] = {1.2f, -8.0f, 150.0f, -40.0f};
+	pitch.value = x[0]; rate.value = x[1]; speed.value = x[2]; pos.value = x[3];
+	c.update();
+	double bound, expected = reference<4>(GAINS_4_1[0], x, NO_GOALS, 0, &bound);
+	CHECK(pitch.updates == 1 && rate.updates == 1 && speed.updates == 1 && pos.updates == 1 && out.sets == 1,
+		"inputs updated %d/%d/%d/%d times, output set %d times", pitch.updates, rate.updates, speed.updates,
+		pos.updates, out.sets);
+	CHECK(fabs(out.value - expected) <= bound, "controller set %g, expected %g", out.value, expected);
+	CHECK(c.saturation(0) == 0, "saturation %d within bounds", c.saturation(0));
+
+	// A goal through the controller lands in the feedback
+	const float goal[4] = {0, 0, 100.0f, 20.0f};
+	c.setGoal(2, goal[2]);
+	c.setGoal(3, goal[3]);
+	c.update();
+	expected = reference<4>(GAINS_4_1[0], x, goal, 0, &bound);
+	CHECK(fabs(out.value - expected) <= bound && c.goal(3) == 20.0f, "controller with goals set %g, expected %g",
+		out.value, expected);
+
+	// Its own clamp first, then the output's
+	pitch.value = 20.0f;
+	c.update();
+	CHECK(out.value == 255 && c.saturation(0) == 1, "controller set %g, saturation %d", out.value, c.saturation(0));
+	out.limit = -1;
+	CHECK(c.saturation(0) == 1, "own clamp reported as %d with the output pinned the other way", c.saturation(0));
+	pitch.value = x[0];
+	c.update();
+	CHECK(c.saturation(0) == -1, "output's saturation reported as %d", c.saturation(0));
+	out.limit = 0;
+	CHECK(c.saturation(0) == 0, "saturation %d after the output came off its limit", c.saturation(0));
+}
+
+template<int NX, int NU, typename T> double bench(const float (&gains)[NU][NX], float *controls) {
+	StateFeedback<NX, NU, T> fb;
+	fb.setGains(gains);
+	for(int j=0; j<NU; j++) fb.setControlBounds(j, -255, 255);
+
+	static T x[SAMPLES][NX];
+	for(int s=0; s<SAMPLES; s++) for(int i=0; i<NX; i++) x[s][i] = T(states[s][i]);
+
+	T u[NU];
+	unsigned int check = 0;
+	auto start = std::chrono::steady_clock::now();
+	for(int n=0; n<ITERATIONS; n++) {
+		fb.compute(x[n % SAMPLES], u);
+		unsigned char bytes[sizeof(u)]; // checksum over the results keeps the loop from being optimized out
+		memcpy(bytes, u, sizeof(u));
+		check += bytes[0];
+	}
+	auto end = std::chrono::steady_clock::now();
+	checksum += check;
+
+	for(int s=0; s<SAMPLES; s++) {
+		fb.compute(x[s], u);
+		for(int j=0; j<NU; j++) controls[s*NU + j] = float(u[j]);
+	}
+	return std::chrono::duration<double, std::nano>(end - start).count() / ITERATIONS;
+}
+
+template<int NX, int NU> void run(const char *name, const float (&gains)[NU][NX]) {
+	for(bool gainsFirst: {true, false}) {
+		checkFolding<NX, NU, float>(name, gains, gainsFirst);
+		checkFolding<NX, NU, Q16_16>(name, gains, gainsFirst);
+	}
+
+	static float f[SAMPLES*NU], q[SAMPLES*NU];
+	double nsFloat = bench<NX, NU, float>(gains, f);
+	double nsFixed = bench<NX, NU, Q16_16>(gains, q);
+	float maxErr = 0;
+	for(int i=0; i<SAMPLES*NU; i++) {
+		float e = f[i] > q[i] ? f[i] - q[i] : q[i] - f[i];
+		if(e > maxErr) maxErr = e;
+	}
+	printf("%-5s float %6.2f ns  Q16.16 %6.2f ns  max |u_fixed - u_float| %.5f PWM\n", name, nsFloat, nsFixed, maxErr);
+	// Gains to 6 significant digits, states to 3 decimals: a thousandth of a PWM step is plenty
+	CHECK(maxErr < 1e-3f, "%s: Q16.16 up to %g PWM off float", name, maxErr);
+}
+
+int main() {
+	srand(1);
+	for(int s=0; s<SAMPLES; s++) {
+		for(int i=0; i<6; i++) states[s][i] = RANGE[i] * (2.0f*rand()/RAND_MAX - 1.0f) * 0.2f;
+	}
+	checkClamp<float>("float");
+	checkClamp<Q16_16>("Q16.16");
+	checkController();
+	run<4, 1>("4x1", GAINS_4_1);
+	run<6, 2>("6x2", GAINS_6_2);
+	printf("(checksum %u)\n", checksum);
+	return hostTestResult();
+}
@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+#
+# Loopback test for DroidGUI's CommandClient: starts test_command_server --serve on 127.0.0.1 and drives it with
+# the blocking helpers, a burst of pipelined requests and requests that must fail. Exits with 1 on any failure.
+#
+#   python3 check_command_client.py <path to test_command_server> [port]
+#
+# See test_command_server.cpp for how to build the server.
+#
+
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "..", "DroidGUI"))
+
+import CommandClient as cc
+
+failures = 0
+
+def check(cond, what):
+	global failures
+	if not cond:
+		failures += 1
+		print("FAIL: %s" % what)
+
+def expectError(fn, *args):
+	try:
+		fn(*args)
+	except cc.CommandError:
+		return True
+	return False
+
+def main():
+	if len(sys.argv) < 2:
+		print("Usage: %s <test_command_server> [port]" % sys.argv[0])
+		sys.exit(2)
+	port = int(sys.argv[2]) if len(sys.argv) > 2 else 21000 + os.getpid() % 1000
+	server = subprocess.Popen([sys.argv[1], "--serve", str(port)], stdout=subprocess.PIPE, text=True)
+	try:
+		server.stdout.readline() # bound and serving
+		client = cc.CommandClient("127.0.0.1", port)
+
+		print("ping %.2fms" % (client.ping() * 1000))
+		subsystems = client.subsystems()
+		check("cmdtest" in subsystems and len(subsystems) > 40, "subsystems: %s" % subsystems)
+		params = client.parameters("cmdtest")
+		check(params[:4] == [("gain", cc.PARAMETER_FLOAT), ("count", cc.PARAMETER_INT),
+			("enabled", cc.PARAMETER_BOOL), ("label", cc.PARAMETER_STRING)] and len(params) == 16,
+			"parameters: %s" % params)
+
+		client.set("cmdtest", "gain", 1.25)
+		check(client.get("cmdtest", "gain") == 1.25, "gain")
+		client.set("cmdtest", "enabled", True)
+		check(client.get("cmdtest", "enabled") is True, "enabled")
+		client.set("cmdtest", "label", "right")
+		check(client.get("cmdtest", "label") == "right", "label")
+		client.start("cmdtest")
+		check(client.status("cmdtest") == (True, cc.RES_OK), "status after start")
+		client.stop("cmdtest")
+		check(client.status("cmdtest")[0] is False, "status after stop")
+
+		check(expectError(client.set, "cmdtest", "count", 1000), "out of range count accepted")
+		check(expectError(client.get, "nosuch", "count"), "unknown subsystem accepted")
+		check(expectError(client.get, "cmdtest", "nosuch"), "unknown parameter accepted")
+
+		# A transaction: commit IDs count up, and waiting for a commit returns once it is applied
+		client.stage("cmdtest", "gain", 2.5)
+		client.stage("cmdtest", "count", 7)
+		first = client.commit()
+		check(client.commitStatus() == (first, cc.RES_OK), "commit status: %s" % (client.commitStatus(),))
+		check(client.get("cmdtest", "gain") == 2.5 and client.get("cmdtest", "count") == 7, "committed values")
+		client.stage("cmdtest", "count", 8)
+		check(client.commit(wait=False) == (first + 1) & 0xffff, "commit IDs don't count up")
+
+		# A slider: many sets in flight at once, each answered under its own ID, the last one wins
+		ids = [client.setAsync("cmdtest", "count", v) for v in range(50)]
+		check(client.wait(ids), "pipelined sets not all answered")
+		results = [client.response(id) for id in ids]
+		check(all(r is not None and r[0] == cc.OP_SET_PARAMETER and r[1] == cc.RES_OK for r in results),
+			"pipelined set results: %s" % results)
+		check(client.get("cmdtest", "count") == 49, "count after pipelined sets")
+	finally:
+		server.kill()
+		server.wait()
+
+	print("%d check(s) FAILED" % failures if failures else "all checks passed")
+	sys.exit(1 if failures else 0)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,47 @@
+#!/usr/bin/env python3
+#
+# Decodes the "log dump" output test_log wrote with DroidGUI's LogDecoder, using test_log.cpp as the source of
+# format strings, and compares the text with what snprintf() made of the same messages. Exits with 1 on any
+# difference.
+#
+#   python3 check_log.py <dir>
+#
+# See test_log.cpp for how to build and run test_log.
+#
+
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "..", "DroidGUI"))
+
+from LogDecoder import LogDecoder, buildDictionary
+
+def main():
+	if len(sys.argv) != 2:
+		print("Usage: %s <dir>" % sys.argv[0])
+		sys.exit(2)
+	directory = sys.argv[1]
+	decoder = LogDecoder(buildDictionary([os.path.join(HERE, "test_log.cpp")]))
+	with open(os.path.join(directory, "dump.txt")) as f:
+		messages = decoder.parseDump(f)
+	expected = open(os.path.join(directory, "expected.txt")).read().splitlines(True)
+	got = [text for (timestamp, text) in messages]
+
+	ok = len(got) == len(expected)
+	if not ok:
+		print("FAIL: %d messages decoded, %d expected" % (len(got), len(expected)))
+	wrong = [(n, g, e) for (n, (g, e)) in enumerate(zip(got, expected)) if g != e]
+	for (n, g, e) in wrong[:5]:
+		print("FAIL: message %d is %r, expected %r" % (n, g, e))
+	timestamps = [timestamp for (timestamp, text) in messages]
+	if timestamps != sorted(timestamps):
+		print("FAIL: timestamps out of order")
+		ok = False
+	ok = ok and not wrong
+	print("%d messages decoded, %d differ" % (len(got), len(wrong)))
+	print("log round trip ok" if ok else "FAILED")
+	sys.exit(0 if ok else 1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+#
+# Round trip of the schema descriptor through DroidGUI: fetches the schema from test_schema --serve with
+# CommandClient (Schema.fetch()), checks it is the one test_schema wrote, decodes the raw LargeStatePackets
+# test_schema wrote with Schema.unpackState() and compares every field with the encoder's values. It also
+# checks that TelemetryDecoder asks for this schema's ID before it has one. Exits with 1 on any failure.
+#
+#   python3 check_schema.py <path to test_schema> <dir> [port]
+#
+# See test_schema.cpp for how to build and run test_schema.
+#
+
+import os
+import struct
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "..", "DroidGUI"))
+
+from CommandClient import CommandClient
+from Schema import Schema
+from TelemetryDecoder import TelemetryDecoder
+from check_telemetry import records
+
+def f32(x):
+	return struct.unpack("<f", struct.pack("<f", x))[0]
+
+def toFixed(value, scale):
+	"""Same rounding as toFixedValue() in BBTelemetry.cpp, which works in float."""
+	f = f32(f32(value) * f32(scale))
+	return int(f - 0.5) if f < 0 else int(f + 0.5)
+
+def main():
+	if len(sys.argv) < 3:
+		print("Usage: %s <test_schema> <dir> [port]" % sys.argv[0])
+		sys.exit(2)
+	directory = sys.argv[2]
+	port = int(sys.argv[3]) if len(sys.argv) > 3 else 22000 + os.getpid() % 1000
+	ok = True
+
+	server = subprocess.Popen([sys.argv[1], "--serve", str(port)], stdout=subprocess.PIPE, text=True)
+	try:
+		server.stdout.readline() # bound and serving
+		schema = Schema.fetch(CommandClient("127.0.0.1", port))
+	finally:
+		server.kill()
+		server.wait()
+	written = open(os.path.join(directory, "schema.bin"), "rb").read()
+	if schema.blob != written:
+		print("FAIL: fetched schema 0x%04x (%d bytes) differs from schema.bin (%d bytes)" %
+			(schema.id, len(schema.blob), len(written)))
+		ok = False
+	print("schema 0x%04x: %d fields, %d packet tables, state size %d" % (schema.id, schema.numFields,
+		len(schema.packetTables), schema.stateSize))
+
+	expected = {}
+	data = open(os.path.join(directory, "expected.bin"), "rb").read()
+	size = 4 + 4 * schema.numFields
+	for i in range(0, len(data), size):
+		expected[struct.unpack_from("<I", data, i)[0]] = struct.unpack_from("<%di" % schema.numFields, data, i + 4)
+
+	raw = open(os.path.join(directory, "states.raw"), "rb").read()
+	packets = bad = 0
+	for i in range(0, len(raw), 4 + schema.stateSize):
+		sample = struct.unpack_from("<I", raw, i)[0]
+		values, name = schema.unpackState(raw[i+4:i+4+schema.stateSize])
+		packets += 1
+		if name != b"Generic D-O":
+			print("FAIL: sample %d: droid name %s" % (sample, name))
+			bad += 1
+		for n in range(schema.numFields):
+			got = toFixed(values[n], schema.scales[n])
+			if got != expected[sample][n]:
+				if bad < 5:
+					print("FAIL: sample %d: %s is %d, expected %d" % (sample, schema.telemetryFields[n][0], got,
+						expected[sample][n]))
+				bad += 1
+	print("%d raw packets, %d wrong values" % (packets, bad))
+	ok = ok and bad == 0 and packets > 0
+
+	# A decoder without a schema names the one it needs from the first keyframe
+	decoder = TelemetryDecoder()
+	for (sample, frame) in records(os.path.join(directory, "telemetry.bin")):
+		if decoder.decode(frame) is None and decoder.wantedSchemaID is not None:
+			break
+	if decoder.wantedSchemaID != schema.id:
+		print("FAIL: decoder wants schema %s" % decoder.wantedSchemaID)
+		ok = False
+
+	print("schema round trip ok" if ok else "FAILED")
+	sys.exit(0 if ok else 1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,93 @@
+#!/usr/bin/env python3
+#
+# Decodes the telemetry a host test wrote (see host/TelemetryDump.h) with DroidGUI's Schema and TelemetryDecoder,
+# and compares every decoded sample with the values the droid had. Exits with 1 on any mismatch.
+#
+#   python3 check_telemetry.py <dir> [stream ...]
+#
+# Without stream names, all streams in the directory are checked. Every frame must decode, except in streams
+# whose name starts with "lossy": there frames whose keyframe was lost are expected and only counted, but at
+# least one frame must decode.
+# Batch datagrams (see WifiServer::streamUDPPacket()) are split with DroidGUI's code; the frames in them are
+# matched to expected samples by the micros() the batch carries for each, so such tests key samples by micros().
+#
+
+import os
+import struct
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, "..", "..", "..", "DroidGUI"))
+
+from Schema import Schema
+from TelemetryDecoder import TelemetryDecoder
+from UDPHandler import splitBatch
+
+def records(path):
+	data = open(path, "rb").read()
+	i = 0
+	while i < len(data):
+		sample, length = struct.unpack_from("<IH", data, i)
+		for (timeUS, frame) in splitBatch(data[i+6:i+6+length]):
+			yield (sample if timeUS is None else timeUS), frame
+		i += 6 + length
+
+def value(packet, path):
+	o = packet
+	for step in path:
+		o = o[step] if isinstance(step, int) else getattr(o, step)
+	return o
+
+def check_stream(schema, expected, path):
+	decoder = TelemetryDecoder(schema)
+	frames = decoded = bad = 0
+	for (sample, frame) in records(path):
+		frames += 1
+		packet = decoder.decode(frame)
+		if packet is None:
+			continue
+		decoded += 1
+		mask = set(decoder.mask)
+		want = expected[sample]
+		for n in range(schema.numFields):
+			got = value(packet, schema.paths[n]) * schema.scales[n]
+			if n not in mask:
+				ok = got == 0
+			else:
+				ok = abs(got - want[n]) <= 1e-6 * max(1, abs(want[n]))
+			if not ok:
+				if bad < 5:
+					print("%s: sample %d, %s is %g, expected %g" % (os.path.basename(path), sample,
+						schema.telemetryFields[n][0], got, want[n] if n in mask else 0))
+				bad += 1
+	print("%s: %d frames, %d decoded, %d undecodable, %d wrong values, %.1f bytes per frame" %
+		(os.path.basename(path), frames, decoded, decoder.undecodable, bad, decoder.bytesPerSample()))
+	if os.path.basename(path).startswith("lossy"):
+		return bad == 0 and decoded > 0
+	return bad == 0 and decoded == frames
+
+def main():
+	if len(sys.argv) < 2:
+		print("Usage: %s <dir> [stream ...]" % sys.argv[0])
+		sys.exit(2)
+	directory = sys.argv[1]
+	schema = Schema(open(os.path.join(directory, "schema.bin"), "rb").read())
+	print("schema 0x%04x: %d fields, state size %d" % (schema.id, schema.numFields, schema.stateSize))
+
+	expected = {}
+	data = open(os.path.join(directory, "expected.bin"), "rb").read()
+	size = 4 + 4 * schema.numFields
+	for i in range(0, len(data), size):
+		sample = struct.unpack_from("<I", data, i)[0]
+		expected[sample] = struct.unpack_from("<%di" % schema.numFields, data, i + 4)
+
+	streams = sys.argv[2:] or sorted(f[:-4] for f in os.listdir(directory)
+		if f.endswith(".bin") and f not in ("schema.bin", "expected.bin"))
+	ok = True
+	for stream in streams:
+		ok = check_stream(schema, expected, os.path.join(directory, stream + ".bin")) and ok
+	print("all streams decode correctly" if ok else "FAILED")
+	sys.exit(0 if ok else 1)
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,321 @@
+#!/usr/bin/env python3
+#
+# Fits first and second order models to a recording made with bb::Capture, and reports rise time, overshoot,
+# settling time and bandwidth. Pure Python, so it runs anywhere without numpy.
+#
+# The recording comes from a file or stdin (the console output of "capture dump", anything around the CSV is
+# skipped), from a serial port (sends "capture dump" itself, needs pyserial), or over UDP ("capture dump <ip> <port>"
+# on the droid, --udp <port> here).
+#
+# The models, with dead time td, in deviations from the values before the excitation started:
+#
+#   first order    tau y' = K u(t - td) - y
+#   second order   y'' = wn^2 (K u(t - td) - y) - 2 zeta wn y'
+#
+# u is the setpoint for the closed loop (default), or the controller output for the plant alone (--open). The fit
+# simulates the model on the recorded u, so it works for any excitation, not only steps. Rise time, overshoot and
+# settling time are measured from the data if the excitation was a step, and always from the model's step response.
+#
+# A position loop's plant is an integrator, which neither model describes; fit position loops closed.
+#
+
+import argparse
+import math
+import socket
+import struct
+import sys
+
+MAGIC = 0xb8
+SAMPLE_FORMAT = "<Iffff"
+SAMPLE_SIZE = struct.calcsize(SAMPLE_FORMAT)
+COLUMNS = ("us", "setpoint", "input", "output", "error")
+
+def parse_csv(lines):
+	samples, inside = [], False
+	for line in lines:
+		line = line.strip()
+		if "# capture" in line:
+			samples, inside = [], True
+			continue
+		if not inside:
+			continue
+		if line.startswith("# end"):
+			break
+		try:
+			values = [float(v) for v in line.split(",")]
+		except ValueError:
+			continue
+		if len(values) == len(COLUMNS):
+			samples.append(values)
+	return samples
+
+def read_serial(device, baud, timeout):
+	import serial
+	port = serial.Serial(device, baud, timeout=timeout)
+	port.reset_input_buffer()
+	port.write(b"capture dump\n")
+	lines = []
+	while True:
+		line = port.readline().decode("ascii", "replace")
+		if line == "":
+			sys.exit("timeout reading from %s" % device)
+		lines.append(line)
+		if line.startswith("# end"):
+			return parse_csv(lines)
+
+def read_udp(port, timeout):
+	sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+	sock.bind(("", port))
+	sock.settimeout(timeout)
+	samples, total = {}, None
+	while total is None or len(samples) < total:
+		try:
+			data, _ = sock.recvfrom(2048)
+		except socket.timeout:
+			if total is None:
+				sys.exit("no capture datagrams received")
+			print("warning: %d of %d samples received" % (len(samples), total), file=sys.stderr)
+			break
+		if len(data) < 6 or data[0] != MAGIC:
+			continue
+		n, first, total = data[1], data[2] | data[3] << 8, data[4] | data[5] << 8
+		for i in range(n):
+			offset = 6 + i*SAMPLE_SIZE
+			samples[first + i] = list(struct.unpack_from(SAMPLE_FORMAT, data, offset))
+	return [samples[i] for i in sorted(samples)]
+
+def interpolate(t, u, tq, hint):
+	"""u at time tq, linear between samples. hint is the index to start searching from; returns (value, index)."""
+	if tq <= t[0]:
+		return u[0], 0
+	i = hint
+	while i + 1 < len(t) and t[i+1] <= tq:
+		i += 1
+	if i + 1 >= len(t):
+		return u[-1], i
+	return u[i] + (u[i+1] - u[i]) * (tq - t[i]) / (t[i+1] - t[i]), i
+
+def discretize(wn, zeta, dt):
+	"""Exact zero order hold step of the second order model with unit input: (y, y') -> P (y, y') + G."""
+	# exp() of [[0, 1, 0], [-wn^2, -2 zeta wn, wn^2], [0, 0, 0]] dt, by scaling and squaring a Taylor series
+	a = [[0.0, dt, 0.0], [-wn*wn*dt, -2*zeta*wn*dt, wn*wn*dt], [0.0, 0.0, 0.0]]
+	norm = max(sum(abs(v) for v in row) for row in a)
+	squarings = max(0, int(math.ceil(math.log2(norm))) + 1) if norm > 0.5 else 0
+	a = [[v / 2**squarings for v in row] for row in a]
+	e = [[float(i == j) for j in range(3)] for i in range(3)]
+	term = [row[:] for row in e]
+	for n in range(1, 12):
+		term = [[sum(term[i][k] * a[k][j] for k in range(3)) / n for j in range(3)] for i in range(3)]
+		e = [[e[i][j] + term[i][j] for j in range(3)] for i in range(3)]
+	for _ in range(squarings):
+		e = [[sum(e[i][k] * e[k][j] for k in range(3)) for j in range(3)] for i in range(3)]
+	return (e[0][0], e[0][1], e[1][0], e[1][1]), (e[0][2], e[1][2])
+
+def simulate(model, params, t, u):
+	if model == "first":
+		k, tau, td = params
+	else:
+		k, wn, zeta, td = params
+		steps = {}
+	y, v, out, hint = 0.0, 0.0, [0.0], 0
+	for i in range(1, len(t)):
+		dt = t[i] - t[i-1]
+		ud, hint = interpolate(t, u, t[i-1] - td, hint)
+		if model == "first":
+			y = k*ud + (y - k*ud) * math.exp(-dt / tau)
+		else:
+			key = round(dt, 6)
+			if key not in steps:
+				steps[key] = discretize(wn, zeta, dt)
+			(p00, p01, p10, p11), (g0, g1) = steps[key]
+			y, v = p00*y + p01*v + g0*k*ud, p10*y + p11*v + g1*k*ud
+		out.append(y)
+	return out
+
+def unpack(model, x):
+	"""Optimizer coordinates to model parameters without the gain. Time constants and damping stay positive via exp()."""
+	if model == "first":
+		return (math.exp(x[0]), abs(x[1]))
+	return (math.exp(x[0]), math.exp(x[1]), abs(x[2]))
+
+def nelder_mead(f, x0, steps, iterations=600, tolerance=1e-10):
+	n = len(x0)
+	simplex = [list(x0)] + [[x0[j] + (steps[j] if j == i else 0) for j in range(n)] for i in range(n)]
+	values = [f(x) for x in simplex]
+	for _ in range(iterations):
+		order = sorted(range(n+1), key=lambda i: values[i])
+		simplex, values = [simplex[i] for i in order], [values[i] for i in order]
+		if abs(values[-1] - values[0]) <= tolerance * (abs(values[0]) + tolerance):
+			break
+		centroid = [sum(p[j] for p in simplex[:-1]) / n for j in range(n)]
+		def towards(a, s):
+			return [centroid[j] + s*(a[j] - centroid[j]) for j in range(n)]
+		reflected = towards(simplex[-1], -1.0)
+		fr = f(reflected)
+		if fr < values[0]:
+			expanded = towards(simplex[-1], -2.0)
+			fe = f(expanded)
+			simplex[-1], values[-1] = (expanded, fe) if fe < fr else (reflected, fr)
+		elif fr < values[-2]:
+			simplex[-1], values[-1] = reflected, fr
+		else:
+			contracted = towards(simplex[-1], 0.5)
+			fc = f(contracted)
+			if fc < values[-1]:
+				simplex[-1], values[-1] = contracted, fc
+			else:
+				for i in range(1, n+1):
+					simplex[i] = [simplex[0][j] + 0.5*(simplex[i][j] - simplex[0][j]) for j in range(n)]
+					values[i] = f(simplex[i])
+	best = min(range(n+1), key=lambda i: values[i])
+	return simplex[best], values[best]
+
+def fit(model, t, u, y):
+	"""Returns parameters, fit in percent and the model response. The response is linear in K, so K is solved for in
+	closed form at every step of the search, which only looks at the dynamics. That keeps the search from getting
+	stuck where the response lags the excitation by a lot, as in a chirp."""
+	span = t[-1] - t[0]
+	dt = span / (len(t) - 1)
+	yy = sum(v*v for v in y)
+	def solve(x):
+		# Dynamics faster than the sample rate can't be told apart; keep them out of the search
+		if model == "second" and math.exp(x[0]) > math.pi / dt:
+			return None, float("inf")
+		try:
+			r = simulate(model, (1.0,) + unpack(model, x), t, u)
+		except (OverflowError, ValueError):
+			return None, float("inf")
+		rr = sum(v*v for v in r)
+		if not rr > 0 or math.isinf(rr):
+			return None, float("inf")
+		ry = sum(a*b for a, b in zip(r, y))
+		return ry / rr, yy - ry*ry/rr
+	best = None
+	for tau in (3*dt, 15*dt, 75*dt):
+		tau = min(tau, span/2)
+		if model == "first":
+			x0, steps = [math.log(tau), dt], [0.5, 2*dt]
+		else:
+			x0, steps = [math.log(2/tau), math.log(0.7), dt], [0.5, 0.5, 2*dt]
+		x, c = nelder_mead(lambda x: solve(x)[1], x0, steps)
+		if best is None or c < best[1]:
+			best = (x, c)
+	params = (solve(best[0])[0],) + unpack(model, best[0])
+	yhat = simulate(model, params, t, u)
+	mean = sum(y) / len(y)
+	den = math.sqrt(sum((v - mean)**2 for v in y)) or 1.0
+	return params, 100.0 * (1 - math.sqrt(max(0.0, best[1])) / den), yhat
+
+def step_metrics(t, y, t0, y0, y1, band=0.02):
+	"""Rise time 10-90%, overshoot in % and settling time into +-band of a step from y0 to y1 starting at t0."""
+	span = y1 - y0
+	if span == 0:
+		return None
+	rise10 = rise90 = None
+	peak, settled = 0.0, t0
+	for ti, yi in zip(t, y):
+		if ti < t0:
+			continue
+		e = (yi - y0) / span
+		if rise10 is None and e >= 0.1:
+			rise10 = ti
+		if rise90 is None and e >= 0.9:
+			rise90 = ti
+		peak = max(peak, e)
+		if abs(e - 1) > band:
+			settled = ti
+	rise = rise90 - rise10 if rise10 is not None and rise90 is not None else float("nan")
+	return rise, max(0.0, (peak - 1) * 100), settled - t0
+
+def bandwidth(model, params):
+	"""-3dB frequency in Hz. Dead time doesn't change the magnitude."""
+	if model == "first":
+		return 1 / (2*math.pi*params[1])
+	wn, z = params[1], params[2]
+	a = 1 - 2*z*z
+	return wn * math.sqrt(a + math.sqrt(a*a + 1)) / (2*math.pi)
+
+def slowest_pole(wn, zeta):
+	"""Decay rate of the slowest mode of the second order model."""
+	if zeta <= 1:
+		return zeta * wn
+	return wn * (zeta - math.sqrt(zeta*zeta - 1))
+
+def model_step(model, params, duration):
+	n = 2000
+	t = [duration * i / n for i in range(n+1)]
+	u = [0.0] + [1.0] * n
+	y = simulate(model, params, t, u)
+	return step_metrics(t, y, 0.0, 0.0, params[0])
+
+def main():
+	ap = argparse.ArgumentParser(description="Fit models to a bb::Capture recording")
+	ap.add_argument("file", nargs="?", default="-", help="console log with the CSV dump, - for stdin")
+	ap.add_argument("--serial", metavar="DEVICE", help="read by sending \"capture dump\" to this serial port")
+	ap.add_argument("--baud", type=int, default=200000, help="serial baud rate")
+	ap.add_argument("--udp", type=int, metavar="PORT", help="receive the datagrams of \"capture dump <ip> <port>\"")
+	ap.add_argument("--timeout", type=float, default=5.0, help="seconds to wait for serial or UDP data")
+	ap.add_argument("--open", action="store_true", help="fit input over output (the plant) instead of over setpoint")
+	ap.add_argument("--model", choices=("first", "second", "both"), default="both")
+	ap.add_argument("--band", type=float, default=2.0, help="settling band in percent")
+	ap.add_argument("--csv", metavar="FILE", help="write time, excitation, response and model responses here")
+	args = ap.parse_args()
+
+	if args.udp:
+		samples = read_udp(args.udp, args.timeout)
+	elif args.serial:
+		samples = read_serial(args.serial, args.baud, args.timeout)
+	else:
+		samples = parse_csv(sys.stdin if args.file == "-" else open(args.file))
+	if len(samples) < 10:
+		sys.exit("need at least 10 samples, got %d" % len(samples))
+
+	t = [s[0] / 1e6 for s in samples]
+	u = [s[3] if args.open else s[1] for s in samples]
+	y = [s[2] for s in samples]
+
+	# The excitation starts where u first leaves its initial value; everything before is the operating point.
+	start = next((i for i in range(len(u)) if abs(u[i] - u[0]) > 1e-6 * (abs(u[0]) + 1)), len(u) - 1)
+	u0 = u[0]
+	y0 = sum(y[:max(1, start)]) / max(1, start)
+	du = [v - u0 for v in u]
+	dy = [v - y0 for v in y]
+	rate = (len(t) - 1) / (t[-1] - t[0])
+	print("%d samples over %.3fs (%.1fHz), excitation from %.3fs, %s loop" %
+		(len(t), t[-1] - t[0], rate, t[start], "open" if args.open else "closed"))
+
+	# Step if u has exactly one level after the start
+	levels = set(round(v, 6) for v in u[start:])
+	if len(levels) == 1:
+		tail = max(1, len(y) // 10)
+		y1 = sum(y[-tail:]) / tail
+		m = step_metrics(t, y, t[start], y0, y1, args.band / 100)
+		if m is not None:
+			line = "measured step %g -> %g: rise %.3fs, overshoot %.1f%%, settling (%g%%) %.3fs" % \
+				(u0, u[start], m[0], m[1], args.band, m[2])
+			if not args.open:
+				line += ", steady state error %g" % (u[start] - y1)
+			print(line)
+
+	models = ("first", "second") if args.model == "both" else (args.model,)
+	fits = {}
+	for model in models:
+		params, quality, yhat = fit(model, t, du, dy)
+		fits[model] = yhat
+		settle = 8 * params[1] if model == "first" else 8 / slowest_pole(params[1], params[2])
+		m = model_step(model, params, settle + params[-1])
+		if model == "first":
+			desc = "K %.5g, tau %.4fs, td %.4fs" % params
+		else:
+			desc = "K %.5g, wn %.3frad/s, zeta %.3f, td %.4fs" % params
+		print("%-6s order: %s; fit %.1f%%, bandwidth %.2fHz, step rise %.3fs, overshoot %.1f%%, settling (%g%%) %.3fs" %
+			(model, desc, quality, bandwidth(model, params), m[0], m[1], args.band, m[2]))
+
+	if args.csv:
+		with open(args.csv, "w") as f:
+			f.write("t,u,y" + "".join("," + m for m in models) + "\n")
+			for i in range(len(t)):
+				f.write("%.6f,%g,%g" % (t[i], u[i], y[i]) + "".join(",%g" % (fits[m][i] + y0) for m in models) + "\n")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# Generates DroidGUI/PacketLayout.py from the field tables in include/BBPacketLayout.h and include/BBTelemetry.h,
+# and the enums in include/BBPacket.h. Run this from anywhere after changing the wire layout.
+#
+
+import os
+import re
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+LAYOUT_H = os.path.join(HERE, "..", "include", "BBPacketLayout.h")
+PACKET_H = os.path.join(HERE, "..", "include", "BBPacket.h")
+TELEMETRY_H = os.path.join(HERE, "..", "include", "BBTelemetry.h")
+OUTPUT = os.path.join(HERE, "..", "..", "..", "DroidGUI", "PacketLayout.py")
+
+def parse_tables(text):
+	tables = {}
+	for m in re.finditer(r"#define\s+BB_(\w+)_FIELDS\(F\)((?:.*\\\n)*.*)", text):
+		fields = re.findall(r"F\(([\w.]+),\s*(\d+),\s*(\d+),\s*(true|false)\)", m.group(2))
+		tables[m.group(1)] = [(name, int(o), int(w), s == "true") for (name, o, w, s) in fields]
+	return tables
+
+def parse_telemetry_fields(text):
+	"""Expands BB_TELEMETRY_FIELDS into a flat list of (name, scale), substituting the index of the sub-tables."""
+	subtables = {}
+	for m in re.finditer(r"#define\s+(BB_TELEMETRY_\w+_FIELDS)\(F, i\)((?:.*\\\n)*.*)", text):
+		subtables[m.group(1)] = re.findall(r"F\(([\w.\[\]]+),\s*(\d+)\)", m.group(2))
+	m = re.search(r"#define\s+BB_TELEMETRY_FIELDS\(F\)((?:.*\\\n)*.*)", text)
+	fields = []
+	for (name, scale, subtable, index) in re.findall(r"F\(([\w.\[\]]+),\s*(\d+)\)|(BB_TELEMETRY_\w+_FIELDS)\(F, (\d+)\)", m.group(1)):
+		if subtable:
+			fields += [(n.replace("[i]", "[%s]" % index), int(s)) for (n, s) in subtables[subtable]]
+		else:
+			fields.append((name, int(scale)))
+	return fields
+
+def parse_enum_values(text, prefix):
+	return [(name, int(value)) for (name, value) in re.findall(r"\b(%s\w+)\s*=\s*(\d+)" % prefix, text)]
+
+def main():
+	tables = parse_tables(open(LAYOUT_H).read())
+	packet_h = open(PACKET_H).read()
+	if not tables:
+		sys.exit("No field tables found in %s" % LAYOUT_H)
+
+	out = []
+	out.append("# Generated by Arduino/LibBB/extras/gen_packet_layout.py from BBPacketLayout.h - do not edit.")
+	out.append("")
+	out.append("PACKET_SIZE = 8")
+	out.append("")
+	for prefix in ("PACKET_TYPE_", "PACKET_SOURCE_", "STATE_", "CONFIG_"):
+		for (name, value) in parse_enum_values(packet_h, prefix):
+			out.append("%s = %d" % (name, value))
+		out.append("")
+	telemetry_h = open(TELEMETRY_H).read()
+	out.append("TELEMETRY_MAGIC = %s" % re.search(r"MAGIC = (\w+);", telemetry_h).group(1))
+	out.append("TELEMETRY_FLAG_KEYFRAME = %s" % re.search(r"FLAG_KEYFRAME = (\w+);", telemetry_h).group(1))
+	out.append("TELEMETRY_FIELDS = [")
+	for (name, scale) in parse_telemetry_fields(telemetry_h):
+		out.append("\t(\"%s\", %d)," % (name, scale))
+	out.append("]")
+	out.append("")
+	for (table, fields) in tables.items():
+		out.append("%s_FIELDS = [" % table)
+		for (name, offset, width, signed) in fields:
+			out.append("\t(\"%s\", %d, %d, %s)," % (name, offset, width, signed))
+		out.append("]")
+		out.append("")
+	out.append("TABLES = {")
+	for table in tables:
+		out.append("\t\"%s\": %s_FIELDS," % (table, table))
+	out.append("}")
+	out.append("")
+	out.append('''def get_field(buf, offset, width, signed):
+	value = (int.from_bytes(buf[:PACKET_SIZE], "little") >> offset) & ((1 << width) - 1)
+	if signed and value & (1 << (width - 1)):
+		value -= 1 << width
+	return value
+
+def decode_fields(buf, fields, into=None):
+	if into is None:
+		into = {}
+	for (name, offset, width, signed) in fields:
+		into[name] = get_field(buf, offset, width, signed)
+	return into
+
+def decode_packet(buf, tables=None):
+	"""Decodes one 8 byte realtime protocol packet into a dict with the header fields, and the payload fields
+	in a dict under "payload". tables maps table names to field lists, like the ones in a droid's schema; the
+	default is TABLES."""
+	if len(buf) < PACKET_SIZE:
+		raise ValueError("Packet too short (%d bytes, need %d)" % (len(buf), PACKET_SIZE))
+	if tables is None:
+		tables = TABLES
+	p = decode_fields(buf, tables["PACKET_HEADER"])
+	payload = {}
+	if p["type"] == PACKET_TYPE_CONTROL:
+		decode_fields(buf, tables["CONTROL_PACKET"], payload)
+	elif p["type"] == PACKET_TYPE_STATE:
+		decode_fields(buf, tables["STATE_PACKET"], payload)
+		if payload["item"] == STATE_BATTERY:
+			decode_fields(buf, tables["STATE_BATTERY"], payload)
+		elif payload["item"] == STATE_DRIVE:
+			decode_fields(buf, tables["STATE_DRIVE"], payload)
+	elif p["type"] == PACKET_TYPE_CONFIG:
+		decode_fields(buf, tables["CONFIG_PACKET"], payload)
+		if payload["type"] in (CONFIG_SET_LEFT_REMOTE_ID, CONFIG_SET_DROID_ID):
+			decode_fields(buf, tables["CONFIG_ID"], payload)
+		elif payload["type"] == CONFIG_SET_CONTROL_MODE:
+			decode_fields(buf, tables["CONFIG_CONTROL_MODE"], payload)
+		elif payload["type"] == CONFIG_SUPERFRAME_BEACON:
+			decode_fields(buf, tables["CONFIG_SUPERFRAME"], payload)
+	else:
+		decode_fields(buf, tables["PAIRING_PACKET"], payload)
+	p["payload"] = payload
+	return p''')
+	open(OUTPUT, "w").write("\n".join(out) + "\n")
+	print("Wrote %s" % os.path.normpath(OUTPUT))
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,122 @@
+//
+// Host stand-in for the Arduino core, just enough to build LibBB and the harnesses in extras/ on a PC. Time is
+// simulated: micros() returns hostMicros, delay() and delayMicroseconds() advance it, and so can the harness.
+//
+#if !defined(HOST_ARDUINO_H)
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+
+#define HEX 16
+#define DEC 10
+#define OUTPUT 1
+#define INPUT 0
+#define INPUT_PULLUP 2
+#define HIGH 1
+#define LOW 0
+
+typedef uint8_t byte;
+
+template<class T, class L, class H> auto constrain(T x, L l, H h) -> decltype(x+l+h) { return x<l ? l : (x>h ? h : x); }
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void pinMode(int pin, int mode);
+void digitalWrite(int pin, int value);
+int digitalRead(int pin);
+void analogWrite(int pin, int value);
+int analogRead(int pin);
+
+// Host only
+extern unsigned long hostMicros;
+extern int (*hostDigitalRead)(int pin);      // NULL reads HIGH
+extern void (*hostAnalogWrite)(int pin, int value);
+
+class String {
+public:
+	std::string s;
+	String(const char *c = ""): s(c ? c : "") {}
+	String(const std::string& x): s(x) {}
+	String(char c): s(1, c) {}
+	String(int v, int base = 10) { char b[40]; snprintf(b, 40, base == 16 ? "%x" : "%d", v); s = b; }
+	String(unsigned v, int base = 10) { char b[40]; snprintf(b, 40, base == 16 ? "%x" : "%u", v); s = b; }
+	String(long v, int base = 10) { char b[40]; snprintf(b, 40, base == 16 ? "%lx" : "%ld", v); s = b; }
+	String(unsigned long v, int base = 10) { char b[40]; snprintf(b, 40, base == 16 ? "%lx" : "%lu", v); s = b; }
+	String(float v, int d = 2) { char b[64]; snprintf(b, 64, "%.*f", d, v); s = b; }
+	String(double v, int d = 2) { char b[64]; snprintf(b, 64, "%.*f", d, v); s = b; }
+	bool reserve(unsigned n) { s.reserve(n); return true; }
+	const char* c_str() const { return s.c_str(); }
+	unsigned length() const { return s.size(); }
+	bool operator==(const String& o) const { return s == o.s; }
+	bool operator==(const char *o) const { return s == o; }
+	bool operator!=(const String& o) const { return s != o.s; }
+	bool operator!=(const char *o) const { return s != o; }
+	friend bool operator==(const char *a, const String& b) { return b.s == a; }
+	bool operator<(const String& o) const { return s < o.s; }
+	char operator[](unsigned i) const { return s[i]; }
+	char charAt(unsigned i) const { return s[i]; }
+	String& operator+=(const String& o) { s += o.s; return *this; }
+	String& operator+=(const char *o) { s += o; return *this; }
+	String& operator+=(char o) { s += o; return *this; }
+	String& operator+=(int o) { s += String(o).s; return *this; }
+	String& operator+=(float o) { s += String(o).s; return *this; }
+	friend String operator+(const String& a, const String& b) { return String(a.s + b.s); }
+	friend String operator+(const String& a, const char *b) { return String(a.s + b); }
+	friend String operator+(const String& a, int b) { return String(a.s + String(b).s); }
+	friend String operator+(const String& a, unsigned b) { return String(a.s + String(b).s); }
+	friend String operator+(const String& a, unsigned long b) { return String(a.s + String(b).s); }
+	friend String operator+(const String& a, float b) { return String(a.s + String(b).s); }
+	long toInt() const { return atol(s.c_str()); }
+	float toFloat() const { return atof(s.c_str()); }
+	void trim() {
+		size_t a = s.find_first_not_of(" \t\r\n"), b = s.find_last_not_of(" \t\r\n");
+		s = a == std::string::npos ? "" : s.substr(a, b - a + 1);
+	}
+	void remove(unsigned i) { if(i < s.size()) s.erase(i); }
+	void replace(const String& from, const String& to) {
+		if(from.s.empty()) return;
+		for(size_t p = s.find(from.s); p != std::string::npos; p = s.find(from.s, p + to.s.size())) s.replace(p, from.s.size(), to.s);
+	}
+	bool equals(const char *o) const { return s == o; }
+	String substring(unsigned a, unsigned b) const { return s.substr(a, b - a); }
+};
+namespace arduino { using ::String; }
+typedef String __FlashStringHelper;
+
+// Output goes nowhere; input is empty.
+class Stream {
+public:
+	virtual ~Stream() {}
+	virtual int available() { return 0; }
+	virtual int read() { return -1; }
+	virtual size_t write(uint8_t) { return 1; }
+	virtual size_t write(const uint8_t *, size_t n) { return n; }
+	size_t write(const char *c, size_t n) { return write((const uint8_t*)c, n); }
+	size_t write(const char *c) { return write((const uint8_t*)c, strlen(c)); }
+	size_t print(const String& s) { return write(s.c_str()); }
+	size_t print(const char *s) { return write(s); }
+	size_t print(int v, int base = 10) { return print(String(v, base)); }
+	size_t println(const char *s = "") { return print(s) + write("\r\n"); }
+	size_t println(const String& s) { return print(s) + write("\r\n"); }
+	size_t println(int v, int base = 10) { return print(v, base) + write("\r\n"); }
+	void flush() {}
+	virtual int availableForWrite() { return 64; }
+};
+
+class HardwareSerial: public Stream {
+public:
+	void begin(unsigned long) {}
+	void end() {}
+	operator bool() { return true; }
+};
+extern HardwareSerial Serial, Serial1;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,17 @@
+// Host stand-in for ArduinoOTA: does nothing.
+#if !defined(HOST_ARDUINOOTA_H)
+#define HOST_ARDUINOOTA_H
+
+#include <WiFiNINA.h>
+
+struct HostInternalStorage {};
+extern HostInternalStorage InternalStorage;
+
+struct HostArduinoOTA {
+	void begin(IPAddress, const char *, const char *, HostInternalStorage&) {}
+	void poll() {}
+	void end() {}
+};
+extern HostArduinoOTA ArduinoOTA;
+
+#endif // HOST_ARDUINOOTA_H
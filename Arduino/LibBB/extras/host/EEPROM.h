@@ -0,0 +1,19 @@
+// Host stand-in for the RP2040 / mbed EEPROM emulation: a RAM array, commit() counts sector writes.
+#if !defined(HOST_EEPROM_H)
+#define HOST_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+struct EEPROMClass {
+	uint8_t data[4096];
+	unsigned long commits = 0; // host only
+	void begin(int size) { (void)size; }
+	uint8_t read(int addr) { return data[addr]; }
+	void write(int addr, uint8_t value) { data[addr] = value; }
+	bool commit() { commits++; return true; }
+	uint8_t* getDataPtr() { return data; }
+};
+extern EEPROMClass EEPROM;
+
+#endif // HOST_EEPROM_H
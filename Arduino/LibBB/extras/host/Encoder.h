@@ -0,0 +1,18 @@
+// Host stand-in for the Encoder library. Counts come from hostEncoderRead(pin A), which the harness sets.
+#if !defined(HOST_ENCODER_H)
+#define HOST_ENCODER_H
+
+#include <stddef.h>
+
+extern long (*hostEncoderRead)(int pin);
+
+class Encoder {
+public:
+	Encoder(int a, int b): pin_(a) { (void)b; }
+	long read() { return hostEncoderRead != NULL ? hostEncoderRead(pin_) : 0; }
+	void write(long) {}
+protected:
+	int pin_;
+};
+
+#endif // HOST_ENCODER_H
@@ -0,0 +1,58 @@
+//
+// Host stand-in for FlashStorage, modelled on the SAMD NVM controller it drives: erase() clears 256 byte rows to
+// 0xff, and write() fills the 64 byte page buffer a word at a time and programs it into the page of the last word
+// written, PAGE_SIZE bytes per page write, like the real FlashClass::write(). A write that crosses a page boundary
+// therefore lands in the wrong page, as it does on the chip. Programming can only clear bits.
+//
+#if !defined(HOST_FLASHSTORAGE_H)
+#define HOST_FLASHSTORAGE_H
+
+#include <stdint.h>
+#include <string.h>
+
+class FlashClass {
+public:
+	static const uint32_t PAGE_SIZE = 64;
+	static const uint32_t ROW_SIZE = 256;
+
+	FlashClass(const void *flash_addr = 0, uint32_t size = 0): base_((uint8_t*)flash_addr), size_(size) {
+		if(base_ != 0) memset(base_, 0xff, size_);
+	}
+	void erase(const volatile void *flash_ptr, uint32_t size) {
+		uint8_t *p = (uint8_t*)flash_ptr;
+		uint32_t offset = (p - base_) / ROW_SIZE * ROW_SIZE;
+		for(uint32_t o = offset; o < (p - base_) + size; o += ROW_SIZE) memset(base_ + o, 0xff, ROW_SIZE);
+	}
+	void write(const volatile void *flash_ptr, const void *data, uint32_t size) {
+		size = (size + 3) / 4;
+		uint32_t dst = (const uint8_t*)flash_ptr - base_;
+		const uint8_t *src = (const uint8_t*)data;
+		while(size) {
+			uint8_t buffer[PAGE_SIZE];
+			memset(buffer, 0xff, PAGE_SIZE);
+			uint32_t last = dst;
+			for(uint32_t i=0; i<PAGE_SIZE/4 && size; i++) {
+				memcpy(buffer + dst % PAGE_SIZE, src, 4);
+				last = dst;
+				src += 4;
+				dst += 4;
+				size--;
+			}
+			uint8_t *page = base_ + last / PAGE_SIZE * PAGE_SIZE;
+			for(uint32_t i=0; i<PAGE_SIZE; i++) page[i] &= buffer[i];
+			pageWrites++;
+		}
+	}
+	void read(const volatile void *flash_ptr, void *data, uint32_t size) { memcpy(data, (const void*)flash_ptr, size); }
+
+	unsigned long pageWrites = 0; // host only
+protected:
+	uint8_t *base_;
+	uint32_t size_;
+};
+
+#define Flash(name, size) \
+	__attribute__((__aligned__(256))) static uint8_t _data##name[(size+255)/256*256]; \
+	FlashClass name(_data##name, (size+255)/256*256);
+
+#endif // HOST_FLASHSTORAGE_H
@@ -0,0 +1,45 @@
+//
+// Helpers shared by the host tests in extras/: a console stream backed by strings, and CHECK(), which reports a
+// failed condition and makes hostTestResult() return 1.
+//
+#if !defined(HOST_TEST_H)
+#define HOST_TEST_H
+
+#include <LibBB.h>
+#include <string>
+
+// Console stream that reads from in and appends everything written to out.
+struct StringConsoleStream: public bb::ConsoleStream {
+	std::string in, out;
+	size_t inPos = 0;
+	bool available() { return inPos < in.size(); }
+	char* readLine() {
+		while(inPos < in.size()) {
+			if(addToLine((uint8_t)in[inPos++])) return editor_.line();
+		}
+		return NULL;
+	}
+	// Writes out everything queued, regardless of time.
+	void drain() { flush(~0ul); }
+protected:
+	size_t writeNonBlocking(const uint8_t *buf, size_t len) { out.append((const char*)buf, len); return len; }
+};
+
+static int hostFailures = 0;
+
+#define CHECK(cond, ...) do { \
+	if(!(cond)) { \
+		hostFailures++; \
+		printf("FAIL %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+		printf(__VA_ARGS__); \
+		printf("\n"); \
+	} \
+} while(0)
+
+static inline int hostTestResult() {
+	if(hostFailures) printf("%d check(s) FAILED\n", hostFailures);
+	else printf("all checks passed\n");
+	return hostFailures ? 1 : 0;
+}
+
+#endif // HOST_TEST_H
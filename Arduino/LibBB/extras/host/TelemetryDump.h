@@ -0,0 +1,75 @@
+//
+// Writes what telemetry host tests produce into a directory for check_telemetry.py:
+//   schema.bin     the schema descriptor (Schema::read())
+//   expected.bin   per sample: uint32 sample index, TelemetryEncoder::NUM_FIELDS int32 fixed point values
+//   <stream>.bin   per frame or datagram: uint32 sample index, uint16 length, the bytes
+// All little endian. Tests take the directory as their argument and make a new temporary one without it.
+//
+#if !defined(HOST_TELEMETRYDUMP_H)
+#define HOST_TELEMETRYDUMP_H
+
+#include <LibBB.h>
+#include <map>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
+
+class TelemetryDump {
+public:
+	TelemetryDump(const std::string& dir): dir_(dir) {
+		mkdir(dir.c_str(), 0755);
+		FILE *f = open("schema.bin");
+		uint8_t buf[256];
+		for(size_t offset=0, n; (n = bb::Schema::read(offset, buf, sizeof(buf))) > 0; offset += n) fwrite(buf, n, 1, f);
+		expected_ = open("expected.bin");
+	}
+	// The directory given on the command line, or a new one under $TMPDIR (or /tmp) named after the test
+	static std::string directory(int argc, char **argv, const char *name) {
+		if(argc > 1) return argv[1];
+		const char *tmp = getenv("TMPDIR");
+		std::string dir = std::string(tmp != NULL ? tmp : "/tmp") + "/" + name + "-XXXXXX";
+		if(mkdtemp(&dir[0]) == NULL) {
+			perror(dir.c_str());
+			exit(1);
+		}
+		printf("Writing to %s\n", dir.c_str());
+		return dir;
+	}
+
+	~TelemetryDump() {
+		fclose(expected_);
+		for(auto& s: streams_) fclose(s.second);
+	}
+
+	void expect(uint32_t sample, const bb::LargeStatePacket& p) {
+		int32_t values[bb::TelemetryEncoder::NUM_FIELDS];
+		bb::TelemetryEncoder::toFixed(p, values);
+		fwrite(&sample, 4, 1, expected_);
+		fwrite(values, sizeof(values), 1, expected_);
+	}
+
+	void frame(const std::string& stream, uint32_t sample, const uint8_t *buf, size_t len) {
+		FILE *&f = streams_[stream];
+		if(f == NULL) f = open(stream + ".bin");
+		uint16_t l = len;
+		fwrite(&sample, 4, 1, f);
+		fwrite(&l, 2, 1, f);
+		fwrite(buf, len, 1, f);
+	}
+
+protected:
+	FILE* open(const std::string& name) {
+		FILE *f = fopen((dir_ + "/" + name).c_str(), "wb");
+		if(f == NULL) {
+			perror(name.c_str());
+			exit(1);
+		}
+		return f;
+	}
+
+	std::string dir_;
+	FILE *expected_;
+	std::map<std::string, FILE*> streams_;
+};
+
+#endif // HOST_TELEMETRYDUMP_H
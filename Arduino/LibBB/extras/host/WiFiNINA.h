@@ -0,0 +1,81 @@
+//
+// Host stand-in for WiFiNINA. WiFi reports a connection; datagrams sent via WiFiUDP go to hostUDPSink, if set.
+//
+#if !defined(HOST_WIFININA_H)
+#define HOST_WIFININA_H
+
+#include <Arduino.h>
+#include <vector>
+
+class IPAddress {
+public:
+	uint8_t b[4];
+	IPAddress() { memset(b, 0, 4); }
+	IPAddress(uint8_t a, uint8_t b1, uint8_t c, uint8_t d) { b[0] = a; b[1] = b1; b[2] = c; b[3] = d; }
+	uint8_t& operator[](int i) { return b[i]; }
+	uint8_t operator[](int i) const { return b[i]; }
+	bool operator==(const IPAddress& o) const { return memcmp(b, o.b, 4) == 0; }
+	bool fromString(const char *s) {
+		unsigned a, c, d, e;
+		if(sscanf(s, "%u.%u.%u.%u", &a, &c, &d, &e) != 4 || a > 255 || c > 255 || d > 255 || e > 255) return false;
+		b[0] = a; b[1] = c; b[2] = d; b[3] = e;
+		return true;
+	}
+};
+
+enum {
+	WL_NO_MODULE, WL_IDLE_STATUS, WL_NO_SSID_AVAIL, WL_SCAN_COMPLETED, WL_CONNECTED, WL_CONNECT_FAILED,
+	WL_CONNECTION_LOST, WL_DISCONNECTED, WL_AP_LISTENING, WL_AP_CONNECTED, WL_AP_FAILED
+};
+
+class WiFiClient: public Stream {
+public:
+	operator bool() { return false; }
+	int status() { return 0; }
+	void stop() {}
+	bool connected() { return false; }
+	IPAddress remoteIP() { return IPAddress(); }
+};
+
+class WiFiServer {
+public:
+	WiFiServer(int port = 0) { (void)port; }
+	void begin() {}
+	WiFiClient available() { return WiFiClient(); }
+};
+
+// Host only: receives every datagram sent. Returning false fails endPacket().
+extern bool (*hostUDPSink)(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len);
+
+class WiFiUDP: public Stream {
+public:
+	int beginPacket(IPAddress addr, uint16_t port) { addr_ = addr; port_ = port; packet_.clear(); return 1; }
+	int endPacket() { return hostUDPSink == NULL || hostUDPSink(addr_, port_, packet_.data(), packet_.size()) ? 1 : 0; }
+	size_t write(const uint8_t *d, size_t n) override { packet_.insert(packet_.end(), d, d + n); return n; }
+	size_t write(uint8_t c) override { packet_.push_back(c); return 1; }
+	int parsePacket() { return 0; }
+	int read(uint8_t *, size_t) { return 0; }
+	int read() override { return -1; }
+	IPAddress remoteIP() { return IPAddress(); }
+	uint16_t remotePort() { return 0; }
+	uint8_t begin(uint16_t) { return 1; }
+	void stop() {}
+	using Stream::write;
+protected:
+	IPAddress addr_;
+	uint16_t port_;
+	std::vector<uint8_t> packet_;
+};
+
+struct WiFiClass {
+	int status() { return WL_CONNECTED; }
+	void noLowPowerMode() {}
+	int beginAP(const char *, const char *) { return WL_AP_LISTENING; }
+	int begin(const char *, const char *) { return WL_CONNECTED; }
+	IPAddress localIP() { return IPAddress(192, 168, 4, 1); }
+	void macAddress(byte *mac) { memset(mac, 0, 6); }
+	void end() {}
+};
+extern WiFiClass WiFi;
+
+#endif // HOST_WIFININA_H
@@ -0,0 +1,88 @@
+//
+// Scripted XBee in API mode for host tests: frames queued with receive() are read by bb::XBee, and what it
+// transmits is parsed back into packets.
+//
+#if !defined(HOST_XBEERADIO_H)
+#define HOST_XBEERADIO_H
+
+#include <LibBB.h>
+#include <deque>
+#include <vector>
+
+// XBee API mode radio. Bytes written are parsed back into transmit requests.
+struct Radio: public HardwareSerial {
+	std::deque<uint8_t> rx;
+	std::vector<uint8_t> tx;
+	int available() { return rx.size(); }
+	int read() {
+		if(rx.empty()) return -1;
+		uint8_t c = rx.front();
+		rx.pop_front();
+		return c;
+	}
+	size_t write(uint8_t c) { tx.push_back(c); return 1; }
+	size_t write(const uint8_t *b, size_t n) { tx.insert(tx.end(), b, b+n); return n; }
+
+	void putEscaped(uint8_t c) {
+		if(c == 0x7d || c == 0x7e || c == 0x11 || c == 0x13) {
+			rx.push_back(0x7d);
+			rx.push_back(c ^ 0x20);
+		} else {
+			rx.push_back(c);
+		}
+	}
+	// Queues a received 16 bit address frame carrying payload, from source. A wrong checksum if corrupt is set.
+	void receive(uint16_t source, const uint8_t *payload, size_t length, bool corrupt = false) {
+		std::vector<uint8_t> data = {0x81, uint8_t(source >> 8), uint8_t(source & 0xff), 40, 0};
+		data.insert(data.end(), payload, payload + length);
+		uint8_t sum = 0;
+		rx.push_back(0x7e);
+		putEscaped(data.size() >> 8);
+		putEscaped(data.size() & 0xff);
+		for(uint8_t c: data) {
+			putEscaped(c);
+			sum += c;
+		}
+		putEscaped(0xff - sum + (corrupt ? 1 : 0));
+	}
+	void receive(uint16_t source, const bb::Packet& packet) {
+		uint8_t buf[bb::Packet::SIZE];
+		packet.encode(buf);
+		receive(source, buf, sizeof(buf));
+	}
+	// A transmit request as it goes on air: 16 bit destination, whether an ACK is requested, and the payload.
+	struct TxFrame {
+		uint16_t dest;
+		bool ack;
+		std::vector<uint8_t> payload;
+	};
+	// Unescapes tx and returns the transmit requests in it, clearing tx.
+	std::vector<TxFrame> transmittedFrames() {
+		std::vector<uint8_t> raw;
+		for(size_t i=0; i<tx.size(); i++) raw.push_back(tx[i] == 0x7d ? tx[++i] ^ 0x20 : tx[i]);
+		tx.clear();
+		std::vector<TxFrame> frames;
+		for(size_t i=0; i+3 < raw.size();) {
+			size_t len = (raw[i+1] << 8) | raw[i+2];
+			if(raw[i+3] == 0x10 && len >= 14 && i+3+len <= raw.size()) {
+				const uint8_t *f = &raw[i+3];
+				frames.push_back({uint16_t((f[10] << 8) | f[11]), f[13] == 0, std::vector<uint8_t>(f+14, f+len)});
+			}
+			i += len + 4;
+		}
+		return frames;
+	}
+	// Unescapes tx and returns the transmitted packets, clearing tx.
+	std::vector<bb::Packet> transmitted() {
+		std::vector<bb::Packet> packets;
+		for(const TxFrame& f: transmittedFrames()) {
+			if(f.payload.size() < bb::Packet::SIZE) continue;
+			bb::Packet p;
+			p.decode(f.payload.data());
+			packets.push_back(p);
+		}
+		return packets;
+	}
+};
+
+#endif // HOST_XBEERADIO_H
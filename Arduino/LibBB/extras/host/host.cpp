@@ -0,0 +1,32 @@
+// Definitions behind the host stand-ins in this directory.
+#include <Arduino.h>
+#include <WiFiNINA.h>
+#include <ArduinoOTA.h>
+#include <Encoder.h>
+#if !defined(ARDUINO_ARCH_SAMD)
+#include <EEPROM.h>
+#endif
+
+unsigned long hostMicros = 0;
+int (*hostDigitalRead)(int pin) = NULL;
+void (*hostAnalogWrite)(int pin, int value) = NULL;
+bool (*hostUDPSink)(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) = NULL;
+long (*hostEncoderRead)(int pin) = NULL;
+
+unsigned long millis() { return hostMicros / 1000; }
+unsigned long micros() { return hostMicros; }
+void delay(unsigned long ms) { hostMicros += ms * 1000; }
+void delayMicroseconds(unsigned int us) { hostMicros += us; }
+void pinMode(int, int) {}
+void digitalWrite(int, int) {}
+int digitalRead(int pin) { return hostDigitalRead != NULL ? hostDigitalRead(pin) : HIGH; }
+void analogWrite(int pin, int value) { if(hostAnalogWrite != NULL) hostAnalogWrite(pin, value); }
+int analogRead(int) { return 0; }
+
+HardwareSerial Serial, Serial1;
+WiFiClass WiFi;
+HostInternalStorage InternalStorage;
+HostArduinoOTA ArduinoOTA;
+#if !defined(ARDUINO_ARCH_SAMD)
+EEPROMClass EEPROM;
+#endif
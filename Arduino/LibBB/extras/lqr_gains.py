@@ -0,0 +1,145 @@
+#!/usr/bin/env python3
+#
+# Computes LQR gains for a wheeled inverted pendulum like D-O, for bb::StateSpaceController. Pure Python, so it runs
+# anywhere without numpy.
+#
+# State x = (pitch [deg], pitch rate [deg/s], speed [mm/s], position [mm]), pitch positive leaning forward, control
+# u = PWM driving forward, -255..255. The model, linearized around upright:
+#
+#   a = (vmax/255 u - v) / tau                        wheel acceleration, first order motor [mm/s^2]
+#   pitch'' = g/L pitch - 180/(1000 pi L) a           [deg/s^2]
+#
+# L is the length of the equivalent point mass pendulum, tau the motor's speed time constant under load and vmax the
+# speed at full PWM. The model is discretized for the control rate with zero order hold, and the gain comes from the
+# discrete Riccati equation. Prints K for u = -K x, the closed loop's spectral radius and a C++ initializer.
+#
+# If the output takes the negated control, as DODriveControlOutput does, use --negate.
+#
+
+import argparse
+import math
+import sys
+
+def matmul(a, b):
+	return [[sum(a[i][k]*b[k][j] for k in range(len(b))) for j in range(len(b[0]))] for i in range(len(a))]
+
+def matadd(a, b, s=1.0):
+	return [[a[i][j] + s*b[i][j] for j in range(len(a[0]))] for i in range(len(a))]
+
+def transpose(a):
+	return [list(r) for r in zip(*a)]
+
+def identity(n):
+	return [[1.0 if i == j else 0.0 for j in range(n)] for i in range(n)]
+
+def scale(a, s):
+	return [[s*v for v in r] for r in a]
+
+def inverse(a):
+	"""Gauss-Jordan with partial pivoting."""
+	n = len(a)
+	m = [list(a[i]) + identity(n)[i] for i in range(n)]
+	for c in range(n):
+		p = max(range(c, n), key=lambda r: abs(m[r][c]))
+		if abs(m[p][c]) < 1e-15:
+			raise ValueError("Singular matrix")
+		m[c], m[p] = m[p], m[c]
+		d = m[c][c]
+		m[c] = [v/d for v in m[c]]
+		for r in range(n):
+			if r != c and m[r][c] != 0:
+				f = m[r][c]
+				m[r] = [m[r][k] - f*m[c][k] for k in range(2*n)]
+	return [r[n:] for r in m]
+
+def norm(a):
+	return max(sum(abs(v) for v in r) for r in a)
+
+def expm(a):
+	"""Matrix exponential, Taylor series with scaling and squaring."""
+	s = max(0, int(math.ceil(math.log2(norm(a) + 1e-300))) + 1)
+	a = scale(a, 1.0 / 2**s)
+	result = identity(len(a))
+	term = identity(len(a))
+	for k in range(1, 20):
+		term = scale(matmul(term, a), 1.0/k)
+		result = matadd(result, term)
+	for _ in range(s):
+		result = matmul(result, result)
+	return result
+
+def discretize(a, b, dt):
+	"""Zero order hold, via the exponential of the augmented matrix [[A, B], [0, 0]]."""
+	n, m = len(a), len(b[0])
+	aug = [[0.0]*(n+m) for _ in range(n+m)]
+	for i in range(n):
+		for j in range(n):
+			aug[i][j] = a[i][j]*dt
+		for j in range(m):
+			aug[i][n+j] = b[i][j]*dt
+	e = expm(aug)
+	return [r[:n] for r in e[:n]], [r[n:] for r in e[:n]]
+
+def dlqr(a, b, q, r, iterations=100000, tolerance=1e-10):
+	"""Iterates the discrete Riccati equation to its fixed point. Returns K for u = -K x."""
+	p = q
+	at, bt = transpose(a), transpose(b)
+	for _ in range(iterations):
+		btp = matmul(bt, p)
+		k = matmul(inverse(matadd(r, matmul(btp, b))), matmul(btp, a))
+		pn = matadd(q, matadd(matmul(matmul(at, p), a), matmul(matmul(at, p), matmul(b, k)), -1.0))
+		if norm(matadd(pn, p, -1.0)) <= tolerance * max(1.0, norm(p)):
+			return k
+		p = pn
+	raise ValueError("Riccati iteration did not converge; is the model controllable?")
+
+def radius(a, steps=10):
+	"""Spectral radius from ||A^(2^steps)||^(1/2^steps), renormalizing as it squares."""
+	log_scale, m = 0.0, a
+	for _ in range(steps):
+		nm = norm(m)
+		if nm == 0:
+			return 0.0
+		m = scale(m, 1.0/nm)
+		log_scale = 2.0*(log_scale + math.log(nm))
+		m = matmul(m, m)
+	return math.exp((log_scale + math.log(max(norm(m), 1e-300))) / 2**steps)
+
+def main():
+	ap = argparse.ArgumentParser(description="LQR gains for a wheeled inverted pendulum")
+	ap.add_argument("--length", type=float, default=0.13, help="equivalent pendulum length [m]")
+	ap.add_argument("--tau", type=float, default=0.15, help="motor speed time constant [s]")
+	ap.add_argument("--vmax", type=float, default=2500.0, help="speed at full PWM [mm/s]")
+	ap.add_argument("--rate", type=float, default=104.0, help="control rate [Hz]")
+	ap.add_argument("--q", type=float, nargs=4, default=[1.0, 0.01, 0.002, 0.01], metavar=("PITCH", "RATE", "SPEED", "POS"),
+		help="state weights, per unit squared")
+	ap.add_argument("--r", type=float, default=0.0005, help="control weight, per PWM unit squared")
+	ap.add_argument("--negate", action="store_true", help="negate the gains, for outputs that take the negated control")
+	ap.add_argument("--name", default="LQR_GAINS", help="name of the C++ constant")
+	args = ap.parse_args()
+
+	g, L, tau, vmax = 9.81, args.length, args.tau, args.vmax
+	c = 180.0 / (1000.0 * math.pi * L)
+	bu = vmax / 255.0 / tau
+	a = [[0.0,      1.0, 0.0,       0.0],
+	     [g/L,      0.0, c/tau,     0.0],
+	     [0.0,      0.0, -1.0/tau,  0.0],
+	     [0.0,      0.0, 1.0,       0.0]]
+	b = [[0.0], [-c*bu], [bu], [0.0]]
+	ad, bd = discretize(a, b, 1.0/args.rate)
+
+	q = [[args.q[i] if i == j else 0.0 for j in range(4)] for i in range(4)]
+	k = dlqr(ad, bd, q, [[args.r]])
+	rho = radius(matadd(ad, matmul(bd, k), -1.0))
+
+	if args.negate:
+		k = scale(k, -1.0)
+	print("K (u = -K x; pitch, pitch rate, speed, position): " + " ".join("%.6g" % v for v in k[0]))
+	print("closed loop spectral radius %.4f (time constant of the slowest mode %.2fs)" %
+		(rho, -1.0 / (args.rate * math.log(rho)) if 0 < rho < 1 else float("inf")))
+	print("static const float %s[1][4] = {{%s}};" % (args.name, ", ".join("%.6gf" % v for v in k[0])))
+	if rho >= 1:
+		sys.exit("closed loop is unstable")
+
+if __name__ == "__main__":
+	main()
@@ -0,0 +1,318 @@
+//
+// Simulation of relay autotuning (bb::PIDAutotuner). A DC motor with stiction behind a bb::Encoder at 100Hz is
+// tuned on speed and on position, as DCMotorTest does, and every rule's gains are tried on a step of the goal. Then
+// D-O's pendulum is tuned on pitch, as DODroid does, and shoved past AUTOTUNE_MAX_PITCH so that the experiment
+// fails and the cascade has to take over again. Checks that start() leaves the input to its owner, that the
+// encoder never computes a speed from no time, that Tyreus-Luyben gains settle, and that D-O gets its balance loop
+// back in the cycle the pitch limit is crossed. Relay and drive settings come from DOConfig.h. Build and run from
+// this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include -I../../DODroid/include sim_autotune.cpp ../../DODroid/src/DODriveController.cpp host/host.cpp ../src/*.cpp -o sim_autotune && ./sim_autotune
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "DOConfig.h"
+#include "DODriveController.h"
+
+#include <random>
+
+using namespace bb;
+
+static const float MM_PER_TICK = WHEEL_CIRCUMFERENCE / WHEEL_TICKS_PER_TURN;
+static const unsigned long MOTOR_CYCLE_US = 10000;
+static const unsigned long DO_CYCLE_US = 1000000 / 104;
+
+static const char *RULE_NAMES[PIDAutotuner::NUM_RULES] = {"zn_p", "zn_pi", "zn_pid", "pessen", "some_overshoot",
+	"no_overshoot", "tyreus_luyben"};
+
+struct Motor {
+	double x = 0, v = 0, u = 0;
+	double vmax = 1000, tau = 0.08; // mm/s at 255, s
+	double stiction = 0;            // PWM below which it doesn't move
+
+	void step(double dt) {
+		const int n = 20;
+		double h = dt/n;
+		double ue = fabs(u) < stiction ? 0 : u - (u > 0 ? stiction : -stiction);
+		for(int i=0; i<n; i++) {
+			v += ((ue/(255.0-stiction)*vmax - v)/tau)*h;
+			x += v*h;
+		}
+	}
+};
+static Motor motor;
+static long motorTicks(int) { return lround(motor.x / MM_PER_TICK); }
+
+struct MotorOutput: public ControlOutput {
+	float last = 0;
+	float present() { return last; }
+	Result set(float s) {
+		last = constrain(s, -255.0f, 255.0f);
+		motor.u = last;
+		return RES_OK;
+	}
+};
+
+// Counts updates, and whether any left a speed that isn't a number
+struct CountingInput: public ControlInput {
+	bb::Encoder& enc;
+	int updates = 0;
+	bool nan = false;
+	CountingInput(bb::Encoder& e): enc(e) {}
+	Result update() {
+		updates++;
+		Result res = enc.update();
+		if(isnan(enc.presentSpeed()) || isnan(enc.presentPosition())) nan = true;
+		return res;
+	}
+	float present() { return enc.present(); }
+	float controlGain() { return enc.controlGain(); }
+};
+
+struct Response { double overshoot, settle; bool settled; };
+
+// Goal step from -> to at 1s, 6s in all. Settling band 5%.
+static Response stepResponse(bool position, float kp, float ki, float kd, float from, float to) {
+	motor = Motor{0, 0, 0, motor.vmax, motor.tau, motor.stiction};
+	hostMicros = 1;
+	hostEncoderRead = motorTicks;
+	bb::Encoder enc(1, 2, position ? bb::Encoder::INPUT_POSITION : bb::Encoder::INPUT_SPEED,
+		bb::Encoder::UNIT_MILLIMETERS);
+	enc.setMillimetersPerTick(MM_PER_TICK);
+	MotorOutput out;
+	PIDController pid(enc, out);
+	pid.setControlParameters(kp, ki, kd);
+	pid.setControlBounds(-255, 255);
+	pid.setGoal(from);
+	pid.reset();
+	Response r = {0, 0, true};
+	double lastOutside = 0;
+	for(double t=0; t<6; t += MOTOR_CYCLE_US/1e6) {
+		if(t >= 1) pid.setGoal(to);
+		motor.step(MOTOR_CYCLE_US/1e6);
+		hostMicros += MOTOR_CYCLE_US;
+		pid.update(); // updates the encoder
+		if(t < 1) continue;
+		double e = ((position ? motor.x : motor.v) - from) / (to - from);
+		r.overshoot = fmax(r.overshoot, (e - 1)*100);
+		if(fabs(e - 1) > 0.05) lastOutside = t - 1;
+	}
+	r.settle = lastOutside;
+	r.settled = r.settle < 4.9;
+	return r;
+}
+
+// As DCMotorTest: settle at the bias, update the input, start, then one autotuner step per cycle
+static void tuneMotor(bool position, double stiction) {
+	motor = Motor();
+	motor.stiction = stiction;
+	hostMicros = 1;
+	hostEncoderRead = motorTicks;
+	bb::Encoder enc(1, 2, position ? bb::Encoder::INPUT_POSITION : bb::Encoder::INPUT_SPEED,
+		bb::Encoder::UNIT_MILLIMETERS);
+	enc.setMillimetersPerTick(MM_PER_TICK);
+	CountingInput input(enc);
+	MotorOutput out;
+	float bias = position ? 0 : 300.0/motor.vmax*(255-stiction) + stiction;
+	out.set(bias);
+	for(int k=0; k<100; k++) {
+		motor.step(MOTOR_CYCLE_US/1e6);
+		hostMicros += MOTOR_CYCLE_US;
+		input.update();
+	}
+
+	PIDAutotuner& at = PIDAutotuner::autotuner;
+	at.attach(input, out);
+	at.setParameter(at.parameterIndex("amplitude"), 60.0f);
+	at.setParameter(at.parameterIndex("hysteresis"), 0.0f);
+	at.setParameter(at.parameterIndex("max_deviation"), 2000.0f);
+	at.setParameter(at.parameterIndex("bias"), bias);
+	at.setParameter(at.parameterIndex("offset"), position ? 0.0f : 300 - input.present());
+
+	motor.step(MOTOR_CYCLE_US/1e6);
+	hostMicros += MOTOR_CYCLE_US;
+	input.update();
+	int before = input.updates;
+	CHECK(at.start() == RES_OK, "autotuner didn't start");
+	CHECK(input.updates == before, "start() updated the input the owner had just updated");
+	int cycles = 0;
+	while(at.isStarted() && cycles < 10000) {
+		motor.step(MOTOR_CYCLE_US/1e6);
+		hostMicros += MOTOR_CYCLE_US;
+		at.step();
+		cycles++;
+	}
+	CHECK(!input.nan, "encoder speed went NaN");
+	printf("%s loop, stiction %.0f PWM: autotune %s after %.2fs, Ku %.4f, Tu %.3fs\n", position ? "Position" : "Speed",
+		stiction, at.state() == PIDAutotuner::STATE_DONE ? "done" : "FAILED", cycles*MOTOR_CYCLE_US/1e6,
+		at.ultimateGain(), at.ultimatePeriod());
+	CHECK(at.state() == PIDAutotuner::STATE_DONE, "%s autotune failed: %s", position ? "position" : "speed",
+		errorMessage(at.lastResult()));
+	if(at.state() != PIDAutotuner::STATE_DONE) return;
+
+	float from = position ? 0 : 100, to = position ? 100 : 400;
+	for(int rule=0; rule<PIDAutotuner::NUM_RULES; rule++) {
+		float kp, ki, kd;
+		at.gains(PIDAutotuner::Rule(rule), kp, ki, kd);
+		Response r = stepResponse(position, kp, ki, kd, from, to);
+		printf("  %-15s kp %8.5f ki %8.5f kd %8.5f: overshoot %5.1f%%, ", RULE_NAMES[rule], kp, ki, kd, r.overshoot);
+		if(r.settled) printf("settles in %.2fs\n", r.settle);
+		else printf("doesn't settle\n");
+		if(rule == PIDAutotuner::RULE_TYREUS_LUYBEN) {
+			CHECK(r.settled && r.overshoot < 15, "Tyreus-Luyben overshoots %g%%, settles in %gs", r.overshoot, r.settle);
+		}
+	}
+}
+
+// D-O: pendulum on a wheel, as in sim_cascade.cpp
+struct Pendulum {
+	double x = 0, v = 0, th = 0, om = 0;
+	double length = 0.13, vmax = 2500, tau = 0.15;
+	double u = 0, push = 0;
+
+	void step(double dt) {
+		const int n = 20;
+		double h = dt/n;
+		for(int i=0; i<n; i++) {
+			double a = (u/255.0*vmax - v)/tau;
+			double thr = th*M_PI/180;
+			om += ((9.81*sin(thr) - a/1000*cos(thr))/length*180/M_PI + push)*h;
+			th += om*h;
+			v += a*h;
+			x += v*h;
+		}
+	}
+};
+static Pendulum pendulum;
+
+struct WheelOutput: public ControlOutput {
+	float last = 0;
+	float present() { return last; }
+	Result set(float s) {
+		last = constrain(s, -255.0f, 255.0f);
+		pendulum.u = fabs(last) < 1 ? 0 : last;
+		return RES_OK;
+	}
+};
+
+struct PitchInput: public ControlInput {
+	LowPassFilter filter_;
+	std::mt19937 rng_{1};
+	std::normal_distribution<float> noise_{0, 0.05f};
+	PitchInput(): filter_(2.0f) {}
+	Result update() { return RES_OK; }
+	float present() { return filter_.filter(float(pendulum.th) + noise_(rng_)); }
+};
+
+struct Handback {
+	bool fell;
+	PIDAutotuner::State state;
+	int unbalancedCycles; // after the pitch limit was crossed, with neither autotuner nor cascade driving
+	double maxPitch;
+};
+
+// DODroid::step() and the autotuner's step, in the runloop's order or the other way round. checkPitch is DODroid's
+// own check of the pitch limit.
+static Handback tuneDO(bool autotunerFirst, bool checkPitch) {
+	pendulum = Pendulum();
+	hostMicros = 1;
+	hostEncoderRead = [](int) { return lround(pendulum.x / MM_PER_TICK); };
+	bb::Encoder left(1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS);
+	bb::Encoder right(1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS);
+	left.setMillimetersPerTick(MM_PER_TICK);
+	right.setMillimetersPerTick(MM_PER_TICK);
+	WheelOutput leftMotor, rightMotor;
+	PitchInput pitch;
+	DODriveControlOutput drive(leftMotor, rightMotor);
+	DOWheelControlInput speed(left, right, bb::Encoder::INPUT_SPEED), pos(left, right, bb::Encoder::INPUT_POSITION);
+	enum { LOOP_BALANCE = 0, LOOP_SPEED = 1, LOOP_POSITION = 2 };
+	CascadedController c(pitch, drive);
+	c.addOuterLoop(speed, SPEED_LOOP_DIVIDER);
+	c.addOuterLoop(pos, POS_LOOP_DIVIDER);
+	c.loop(LOOP_BALANCE).setControlParameters(BAL_KP, BAL_KI, BAL_KD);
+	c.loop(LOOP_SPEED).setControlParameters(SPEED_KP, SPEED_KI, SPEED_KD);
+	c.loop(LOOP_SPEED).setControlBounds(-MAX_PITCH_GOAL, MAX_PITCH_GOAL);
+	c.loop(LOOP_POSITION).setControlParameters(POS_KP, POS_KI, POS_KD);
+	c.loop(LOOP_POSITION).setControlBounds(-MAX_SPEED_GOAL, MAX_SPEED_GOAL);
+	pos.resetPosition();
+	c.setOutermostLoop(LOOP_POSITION);
+	c.reset();
+	c.setGoal(0);
+
+	PIDAutotuner& at = PIDAutotuner::autotuner;
+	at.attach(pitch, drive);
+	at.setParameter(at.parameterIndex("amplitude"), AUTOTUNE_AMPLITUDE);
+	at.setParameter(at.parameterIndex("hysteresis"), AUTOTUNE_HYSTERESIS);
+	at.setParameter(at.parameterIndex("max_deviation"), AUTOTUNE_MAX_PITCH);
+	at.setParameter(at.parameterIndex("bias"), 0.0f);
+	at.setParameter(at.parameterIndex("offset"), 0.0f);
+	at.setParameter(at.parameterIndex("timeout"), 30.0f);
+	at.setParameter(at.parameterIndex("cycles"), 20); // still going when shoved
+	at.start();
+
+	Handback hb = {false, PIDAutotuner::STATE_RUNNING, 0, 0};
+	bool autotuning = false, crossed = false;
+	for(int k=0; k<10*104; k++) {
+		double t = k * DO_CYCLE_US / 1e6;
+		// Shoved hard at 1s, once the limit cycle is going
+		pendulum.push = (t > 1 && t < 1.1) ? 1500 : 0;
+		pendulum.step(DO_CYCLE_US/1e6);
+		hostMicros += DO_CYCLE_US;
+		if(fabs(pendulum.th) > AUTOTUNE_MAX_PITCH) crossed = true;
+
+		if(autotunerFirst) at.step();
+		left.update();
+		right.update();
+		if(at.isStarted()) {
+			autotuning = true;
+			if(checkPitch && fabs(pendulum.th) > AUTOTUNE_MAX_PITCH) at.abort();
+		}
+		if(autotuning && !at.isStarted()) {
+			autotuning = false;
+			pos.resetPosition();
+			c.setOutermostLoop(LOOP_POSITION);
+			c.reset();
+			c.setGoal(0);
+		}
+		if(!autotuning) c.update();
+		if(crossed && autotuning) hb.unbalancedCycles++;
+		if(!autotunerFirst) at.step();
+
+		hb.maxPitch = fmax(hb.maxPitch, fabs(pendulum.th));
+		if(fabs(pendulum.th) > 45) {
+			hb.fell = true;
+			break;
+		}
+	}
+	hb.state = at.state();
+	return hb;
+}
+
+int main() {
+	PIDAutotuner::autotuner.initialize();
+
+	tuneMotor(false, 0);
+	tuneMotor(false, 12);
+	tuneMotor(true, 0);
+
+	printf("D-O relay on pitch, %.0f PWM, shoved past %.0fdeg:\n", AUTOTUNE_AMPLITUDE, AUTOTUNE_MAX_PITCH);
+	struct { bool autotunerFirst, checkPitch; const char *name; } orders[] = {
+		{true, false, "autotuner steps first, no check in DODroid"},
+		{false, false, "autotuner steps last, no check in DODroid"},
+		{true, true, "autotuner steps first, DODroid checks the pitch"},
+		{false, true, "autotuner steps last, DODroid checks the pitch"}
+	};
+	for(auto& o: orders) {
+		Handback hb = tuneDO(o.autotunerFirst, o.checkPitch);
+		printf("  %-48s %s, %d cycle(s) without balance after the limit, max pitch %.1fdeg\n", o.name,
+			hb.fell ? "fell" : "up", hb.unbalancedCycles, hb.maxPitch);
+		CHECK(hb.state != PIDAutotuner::STATE_RUNNING && hb.state != PIDAutotuner::STATE_DONE,
+			"experiment didn't stop at the limit (state %d)", hb.state);
+		if(o.checkPitch) {
+			CHECK(hb.unbalancedCycles == 0, "%s: %d cycles without balance", o.name, hb.unbalancedCycles);
+		}
+	}
+
+	return hostTestResult();
+}
@@ -0,0 +1,247 @@
+//
+// Simulation of system identification capture (bb::Capture): a DC motor behind a bb::Encoder and a PIDController at
+// 100Hz, as DCMotorTest runs it, recorded with step, chirp and PRBS excitation, closed loop and open loop. Checks
+// the excitation and the recorded samples, that the CSV dump is complete and spread over cycles, that a small
+// buffer or decimation end the recording early, and that a buffer larger than 65535 samples is only used up to
+// what the datagram header can count, with the UDP dump arriving whole. Given a directory, writes the CSV dumps
+// there for fit_response.py. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include sim_capture.cpp host/host.cpp ../src/*.cpp -o sim_capture && ./sim_capture /tmp/capture && python3 fit_response.py /tmp/capture/step.csv
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 10000;
+static const float MM_PER_TICK = 722.566310325652445f / (979.2f * (97.0f/18.0f));
+
+struct Motor {
+	double x = 0, v = 0, u = 0;
+	double vmax = 1000, tau = 0.08; // mm/s at full PWM, time constant s
+
+	void step(double dt) {
+		const int n = 20;
+		double h = dt/n;
+		for(int i=0; i<n; i++) {
+			double a = (u/255.0*vmax - v)/tau;
+			v += a*h;
+			x += v*h;
+		}
+	}
+};
+static Motor motor;
+
+struct SimMotor: public ControlOutput {
+	float last = 0;
+	float present() { return last; }
+	Result set(float s) {
+		last = constrain(s, -255.0f, 255.0f);
+		motor.u = last;
+		return RES_OK;
+	}
+};
+
+struct Excitation {
+	const char *signal, *name;
+	bool open;
+	float base, amplitude, pre, duration;
+	const char *extra1, *value1, *extra2, *value2;
+};
+
+struct Recording {
+	std::vector<CaptureSample> samples;
+	std::string csv;
+	int dumpSteps;
+	double recordNS;
+};
+
+// Settles at base, records until the capture ends it, and dumps to a console stream.
+static Recording record(const Excitation& e, CaptureSample *buffer, size_t size, int decimation = 1) {
+	Capture& c = Capture::capture;
+	c.initialize(buffer, size);
+	c.start();
+	c.setParameterValue("signal", e.signal);
+	c.setParameterValue("base", String(e.base).c_str());
+	c.setParameterValue("amplitude", String(e.amplitude).c_str());
+	c.setParameterValue("pre", String(e.pre).c_str());
+	c.setParameterValue("duration", String(e.duration).c_str());
+	c.setParameterValue("decimation", String(decimation).c_str());
+	if(e.extra1) c.setParameterValue(e.extra1, e.value1);
+	if(e.extra2) c.setParameterValue(e.extra2, e.value2);
+
+	motor = Motor();
+	hostEncoderRead = [](int) { return lround(motor.x / MM_PER_TICK); };
+	bb::Encoder enc(1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS);
+	enc.setMillimetersPerTick(MM_PER_TICK);
+	SimMotor out;
+	PIDController pid(enc, out);
+	pid.setControlParameters(0.131f, 0.953f, 0.0013f);
+	pid.setControlBounds(-255, 255);
+
+	auto cycle = [&](float sp) {
+		motor.step(CYCLE_US/1e6);
+		hostMicros += CYCLE_US;
+		if(e.open) {
+			out.set(sp);
+			enc.update();
+		} else {
+			pid.setGoal(sp);
+			pid.update();
+		}
+	};
+	for(int k=0; k<200; k++) cycle(e.base);
+
+	Recording r;
+	r.recordNS = 0;
+	long records = 0;
+	c.startRecording();
+	while(c.isRecording()) {
+		float sp = c.setpoint();
+		cycle(sp);
+		auto t0 = std::chrono::steady_clock::now();
+		c.record(sp, enc.present(), out.present());
+		r.recordNS += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+		records++;
+		c.step();
+	}
+	r.recordNS /= records;
+	r.samples.assign(c.samples(), c.samples() + c.numSamples());
+
+	// The console buffer takes a few lines per cycle, as on the droid
+	StringConsoleStream s;
+	c.startDump(&s);
+	for(r.dumpSteps = 0; c.isDumping() && r.dumpSteps < 100000; r.dumpSteps++) {
+		c.step();
+		s.drain();
+	}
+	s.drain();
+	r.csv = s.out;
+	return r;
+}
+
+// Lines between the header and "# end" that parse as five numbers, as fit_response.py reads them
+static size_t csvSamples(const std::string& csv, bool& ended) {
+	std::istringstream in(csv);
+	std::string line;
+	size_t n = 0;
+	bool inside = false;
+	ended = false;
+	while(std::getline(in, line)) {
+		if(line.find("# capture") != std::string::npos) inside = true;
+		else if(inside && line.rfind("# end", 0) == 0) ended = true;
+		else if(inside && !ended && std::count(line.begin(), line.end(), ',') == 4 && isdigit(line[0])) n++;
+	}
+	return n;
+}
+
+// Datagrams of "capture dump <ip> <port>", reassembled by index
+static std::vector<CaptureSample> received;
+static size_t receivedTotal;
+static bool receivedBad;
+
+static bool sink(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) {
+	(void)addr; (void)port;
+	if(len < Capture::DATAGRAM_HEADER_SIZE || data[0] != Capture::MAGIC) return true;
+	size_t n = data[1], index = data[2] | (data[3] << 8), total = data[4] | (data[5] << 8);
+	if(len != Capture::DATAGRAM_HEADER_SIZE + n*Capture::SAMPLE_SIZE || index != received.size()) receivedBad = true;
+	receivedTotal = total;
+	for(size_t i=0; i<n; i++) {
+		CaptureSample s;
+		memcpy(&s, data + Capture::DATAGRAM_HEADER_SIZE + i*Capture::SAMPLE_SIZE, Capture::SAMPLE_SIZE);
+		received.push_back(s);
+	}
+	return true;
+}
+
+static CaptureSample buffer[350];
+
+int main(int argc, char **argv) {
+	if(argc > 1) mkdir(argv[1], 0755);
+	const Excitation step = {"0", "step", false, 0, 500, 0.2f, 2, NULL, NULL, NULL, NULL};
+	const Excitation chirp = {"1", "chirp", false, 300, 200, 0.2f, 3, "f0", "0.5", "f1", "5"};
+	const Excitation prbs = {"2", "prbs", false, 300, 200, 0.2f, 3, "bit_ms", "50", NULL, NULL};
+	const Excitation open = {"0", "open", true, 0, 120, 0.2f, 2, NULL, NULL, NULL, NULL};
+
+	printf("Motor under PID at 100Hz, %lu sample buffer as in DCMotorTest:\n", (unsigned long)(sizeof(buffer)/sizeof(buffer[0])));
+	for(const Excitation& e: {step, chirp, prbs, open}) {
+		Recording r = record(e, buffer, sizeof(buffer)/sizeof(buffer[0]));
+		size_t expected = lround((e.pre + e.duration) * 1e6 / CYCLE_US);
+		bool ended;
+		size_t inCSV = csvSamples(r.csv, ended);
+		printf("  %-5s %zu samples, dumped in %d cycles, record() %.1fns on this host\n", e.name, r.samples.size(),
+			r.dumpSteps, r.recordNS);
+		CHECK(r.samples.size() + 1 >= expected && r.samples.size() <= expected, "%s: %zu samples, expected %zu",
+			e.name, r.samples.size(), expected);
+		CHECK(inCSV == r.samples.size() && ended, "%s: %zu samples in the CSV", e.name, inCSV);
+		CHECK(r.dumpSteps > 1, "%s: dumped in one cycle", e.name);
+
+		bool badSetpoint = false, badError = false, badTime = false;
+		int switches = 0;
+		for(size_t i=0; i<r.samples.size(); i++) {
+			const CaptureSample& s = r.samples[i];
+			// The setpoint was taken before the cycle the sample is stamped with
+			float t = (s.us - CYCLE_US) / 1e6f - e.pre;
+			if(s.error != s.setpoint - s.input) badError = true;
+			if(i > 0 && s.us - r.samples[i-1].us != CYCLE_US) badTime = true;
+			if(t < -1e-4f && s.setpoint != e.base) badSetpoint = true;
+			if(t >= 0 && fabs(s.setpoint - e.base) > e.amplitude + 1e-3f) badSetpoint = true;
+			if(e.name == prbs.name && t > 1e-4f && fabs(fabs(s.setpoint - e.base) - e.amplitude) > 1e-3f) badSetpoint = true;
+			if(i > 0 && (s.setpoint > e.base) != (r.samples[i-1].setpoint > e.base)) switches++;
+		}
+		CHECK(!badSetpoint && !badError && !badTime, "%s: setpoint %d, error %d, timing %d", e.name, badSetpoint,
+			badError, badTime);
+		// A 0.5 to 5Hz chirp over 3s goes through 8.25 periods
+		if(e.name == chirp.name) CHECK(switches >= 15 && switches <= 18, "chirp: %d crossings of base", switches);
+		if(e.name == step.name) {
+			float final = r.samples.back().input;
+			CHECK(fabs(final - e.base - e.amplitude) < 0.05f * e.amplitude, "closed loop step ends at %g", final);
+		}
+
+		if(argc > 1) {
+			std::string path = std::string(argv[1]) + "/" + e.name + ".csv";
+			std::ofstream f(path);
+			f << r.csv;
+			f.close();
+			CHECK(f.good(), "could not write %s", path.c_str());
+		}
+	}
+
+	// The buffer ends the recording before pre + duration, decimation spreads it
+	CaptureSample small[50];
+	Recording r = record(step, small, 50);
+	CHECK(r.samples.size() == 50 && r.samples.back().us < 1e6, "50 sample buffer: %zu samples", r.samples.size());
+	r = record(step, buffer, sizeof(buffer)/sizeof(buffer[0]), 3);
+	CHECK(r.samples.size() >= 73 && r.samples.size() <= 74 && r.samples[1].us - r.samples[0].us == 3*CYCLE_US,
+		"decimation 3: %zu samples", r.samples.size());
+
+	// A buffer beyond 16 bit indices is capped, and the UDP dump carries all of it
+	std::vector<CaptureSample> huge(70000);
+	const Excitation longStep = {"0", "long", false, 0, 500, 60, 600, NULL, NULL, NULL, NULL};
+	r = record(longStep, huge.data(), huge.size());
+	printf("70000 sample buffer, 66000 cycles: %zu samples recorded\n", r.samples.size());
+	CHECK(r.samples.size() == 65535, "%zu samples recorded into a 70000 sample buffer", r.samples.size());
+
+	hostUDPSink = sink;
+	WifiServer::server.initialize("sim", "simulation", true, 2000, 2001);
+	WifiServer::server.start();
+	Capture& c = Capture::capture;
+	CHECK(c.startDump(IPAddress(192, 168, 4, 2), 3000) == RES_OK, "UDP dump not started");
+	int steps = 0;
+	for(; c.isDumping() && steps < 100000; steps++) c.step();
+	printf("  dumped via UDP in %d cycles, %zu samples received\n", steps, received.size());
+	CHECK(!receivedBad && receivedTotal == 65535 && received.size() == 65535, "%zu of %zu samples received",
+		received.size(), receivedTotal);
+	CHECK(memcmp(received.data(), r.samples.data(), received.size() * sizeof(CaptureSample)) == 0,
+		"datagram samples differ from the recording");
+
+	return hostTestResult();
+}
@@ -0,0 +1,437 @@
+//
+// Simulation of D-O's drive cascade (bb::CascadedController with DODriveControlOutput and DOWheelControlInput):
+// a wheeled inverted pendulum driven through a first order motor, with encoder quantization, a noisy and biased
+// pitch and the 104Hz control cycle. Runs the balance loop alone as before the cascade, then the cascade keeping
+// station with a shove, driving to a goal 2m away, and driving on remote speed goals with the stick let go, ramped
+// and stepped. Runs the same scenarios under a StateSpaceController<4,1> with the LQR gains from lqr_gains.py for
+// comparison. Then checks that neither falls over a family of plants. Gains and limits come from DOConfig.h. Last,
+// times update() and counts the PID updates per cycle with the outer loops divided and undivided, and times the
+// state space controller. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include -I../../DODroid/include sim_cascade.cpp ../../DODroid/src/DODriveController.cpp host/host.cpp ../src/*.cpp -o sim_cascade && ./sim_cascade
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "DOConfig.h"
+#include "DODriveController.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace bb;
+
+static const float MM_PER_TICK = WHEEL_CIRCUMFERENCE / WHEEL_TICKS_PER_TURN;
+static const unsigned long CYCLE_US = 1000000 / 104;
+
+enum { LOOP_BALANCE = 0, LOOP_SPEED = 1, LOOP_POSITION = 2 };
+
+struct Plant {
+	double x = 0, v = 0;   // wheel position mm, speed mm/s
+	double th = 0, om = 0; // pitch deg, positive leaning forward, and its rate deg/s
+	double length = 0.13;  // equivalent pendulum length m
+	double vmax = 2500;    // mm/s at full PWM
+	double tau = 0.15;     // motor time constant s
+	double u = 0;          // PWM
+	double push = 0;       // external angular acceleration deg/s^2
+
+	void step(double dt) {
+		const int n = 20;
+		double h = dt/n;
+		for(int i=0; i<n; i++) {
+			double a = (u/255.0*vmax - v)/tau;
+			double thr = th*M_PI/180;
+			double alpha = (9.81*sin(thr) - a/1000*cos(thr))/length;
+			om += (alpha*180/M_PI + push)*h;
+			th += om*h;
+			v += a*h;
+			x += v*h;
+		}
+	}
+};
+static Plant nominal, plant;
+
+// Both wheels drive the same plant. Below 1 PWM the motor doesn't move.
+struct SimMotor: public ControlOutput {
+	float last = 0;
+	float present() { return last; }
+	Result set(float s) {
+		last = constrain(s, -255.0f, 255.0f);
+		plant.u = fabs(last) < 1 ? 0 : last;
+		return RES_OK;
+	}
+};
+
+// As DOIMUControlInput: pitch with noise and a bias, through the same LowPassFilter(2.0f). Its sample frequency
+// is never set, so it hardly filters.
+static std::mt19937 rng(1);
+struct SimPitchInput: public ControlInput {
+	LowPassFilter filter_;
+	float bias_ = 0;
+	std::normal_distribution<float> noise_{0, 0.05f};
+	SimPitchInput(float bias = 0): filter_(2.0f), bias_(bias) {}
+	Result update() { return RES_OK; }
+	float present() { return filter_.filter(float(plant.th) + bias_ + noise_(rng)); }
+};
+
+// The gyro's pitch rate, with noise. D-O doesn't take it as a control input yet; the state space controller needs it.
+struct SimPitchRateInput: public ControlInput {
+	std::normal_distribution<float> noise_{0, 0.5f};
+	Result update() { return RES_OK; }
+	float present() { return float(plant.om) + noise_(rng); }
+};
+
+enum Scenario {
+	STATION_KEEPING, // 1 degree IMU bias, shove at 10s
+	GOAL_2M,         // position goal 2m away at 2s
+	REMOTE_DRIVE     // 400mm/s from the remote between 2s and 6s
+};
+
+struct Run {
+	bool fell;
+	double maxDev, finalDev;  // from where it should be
+	double maxPitch, maxPWM;
+	double releaseKick;       // largest pitch goal change per cycle in the second after the stick is let go
+};
+
+// The cascade as DODroid sets it up, on the simulated plant. PID updates are counted from the outer loops' cycle
+// counters, which are back at 0 in a cycle the loop ran. The plant is reset before the encoders are made, the pitch
+// bias set before the controller reads the pitch for the first time.
+struct FreshPlant {
+	FreshPlant() {
+		plant = nominal;
+		plant.th = 0.5;
+		hostMicros = 1;
+		hostEncoderRead = [](int) { return lround(plant.x / MM_PER_TICK); };
+	}
+};
+
+struct Rig: public FreshPlant {
+	bb::Encoder left{1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS};
+	bb::Encoder right{1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS};
+	SimMotor leftMotor, rightMotor;
+	SimPitchInput pitch;
+	DODriveControlOutput drive{leftMotor, rightMotor};
+	DOWheelControlInput speed{left, right, bb::Encoder::INPUT_SPEED}, pos{left, right, bb::Encoder::INPUT_POSITION};
+	struct Probe: public CascadedController {
+		Probe(ControlInput& input, ControlOutput& output): CascadedController(input, output) {}
+		int pidUpdates() {
+			int n = 1;
+			for(int i=1; i<=outermost_; i++) {
+				if(loops_[i].count == 0) n++;
+			}
+			return n;
+		}
+	} c{pitch, drive};
+
+	Rig(bool cascade, float goalRamp, float pitchBias = 0, unsigned int speedDivider = SPEED_LOOP_DIVIDER,
+		unsigned int posDivider = POS_LOOP_DIVIDER): pitch(pitchBias) {
+		left.setMillimetersPerTick(MM_PER_TICK);
+		right.setMillimetersPerTick(MM_PER_TICK);
+		c.loop(LOOP_BALANCE).setControlParameters(BAL_KP, BAL_KI, BAL_KD);
+		if(cascade) {
+			c.addOuterLoop(speed, speedDivider);
+			c.addOuterLoop(pos, posDivider);
+			c.loop(LOOP_SPEED).setControlParameters(SPEED_KP, SPEED_KI, SPEED_KD);
+			c.loop(LOOP_SPEED).setControlBounds(-MAX_PITCH_GOAL, MAX_PITCH_GOAL);
+			c.loop(LOOP_POSITION).setControlParameters(POS_KP, POS_KI, POS_KD);
+			c.loop(LOOP_POSITION).setControlBounds(-MAX_SPEED_GOAL, MAX_SPEED_GOAL);
+			c.setGoalRamp(LOOP_SPEED, goalRamp * CYCLE_US / 1e6);
+			pos.resetPosition();
+			c.setOutermostLoop(LOOP_POSITION);
+		}
+		c.reset();
+		c.setGoal(0);
+	}
+};
+
+// LQR gains for the nominal plant from lqr_gains.py --negate, as DODriveControlOutput takes the negated control
+static const float LQR_GAINS[1][4] = {{57.3007f, 6.50517f, 1.50124f, 1.91568f}};
+enum { STATE_PITCH = 0, STATE_PITCH_RATE = 1, STATE_SPEED = 2, STATE_POSITION = 3 };
+
+// The same plant under a StateSpaceController<4,1> on pitch, pitch rate, speed and position instead of the cascade
+struct StateSpaceRig: public FreshPlant {
+	bb::Encoder left{1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS};
+	bb::Encoder right{1, 2, bb::Encoder::INPUT_SPEED, bb::Encoder::UNIT_MILLIMETERS};
+	SimMotor leftMotor, rightMotor;
+	SimPitchInput pitch;
+	SimPitchRateInput rate;
+	DODriveControlOutput drive{leftMotor, rightMotor};
+	DOWheelControlInput speed{left, right, bb::Encoder::INPUT_SPEED}, pos{left, right, bb::Encoder::INPUT_POSITION};
+	StateSpaceController<4, 1> c{{&pitch, &rate, &speed, &pos}, {&drive}};
+
+	StateSpaceRig(float pitchBias = 0): pitch(pitchBias) {
+		left.setMillimetersPerTick(MM_PER_TICK);
+		right.setMillimetersPerTick(MM_PER_TICK);
+		pos.resetPosition();
+		c.setGains(LQR_GAINS);
+		c.setControlBounds(0, -255, 255);
+	}
+};
+
+static Run run(bool cascade, Scenario scenario, float goalRamp = SPEED_GOAL_RAMP, double seconds = 30) {
+	Rig rig(cascade, goalRamp, scenario == STATION_KEEPING ? 1 : 0);
+	bb::Encoder &left = rig.left, &right = rig.right;
+	DOWheelControlInput &speed = rig.speed, &pos = rig.pos;
+	CascadedController& c = rig.c;
+
+	Run r = {false, 0, 0, 0, 0, 0};
+	bool holding = false;
+	double holdAt = 0;
+	float lastPitchGoal = 0;
+	for(unsigned long k=0; hostMicros < seconds*1e6; k++) {
+		double t = hostMicros/1e6;
+		plant.push = (scenario == STATION_KEEPING && t > 10 && t < 10.1) ? 300 : 0;
+		if(scenario == GOAL_2M && k == 208) c.setGoal(2000);
+		plant.step(CYCLE_US/1e6);
+		hostMicros += CYCLE_US;
+		left.update();
+		right.update();
+
+		// As DODroid: the remote drives the speed loop, the position loop holds once it's slow again
+		if(cascade && scenario == REMOTE_DRIVE) {
+			if(t > 2 && t < 6) {
+				c.setOutermostLoop(LOOP_SPEED);
+				c.setGoal(400);
+			} else if(c.outermostLoop() == LOOP_SPEED) {
+				c.setGoal(0);
+				if(fabs(speed.present()) < POS_HOLD_SPEED) {
+					pos.resetPosition();
+					c.setOutermostLoop(LOOP_POSITION);
+					holding = true;
+					holdAt = plant.x;
+				}
+			}
+		}
+		c.update();
+		if(fabs(plant.th) > 45) {
+			r.fell = true;
+			break;
+		}
+
+		double dev = plant.x;
+		if(scenario == GOAL_2M) dev = t < 2 ? 0 : plant.x - 2000;
+		if(scenario == REMOTE_DRIVE) dev = holding ? plant.x - holdAt : 0;
+		r.maxPitch = fmax(r.maxPitch, fabs(plant.th));
+		r.maxPWM = fmax(r.maxPWM, fabs(plant.u));
+		if(t > 2) r.maxDev = fmax(r.maxDev, scenario == GOAL_2M ? dev : fabs(dev));
+		r.finalDev = dev;
+		float pitchGoal = c.loop(LOOP_BALANCE).goal();
+		if(t > 6 && t < 7) r.releaseKick = fmax(r.releaseKick, fabs(pitchGoal - lastPitchGoal));
+		lastPitchGoal = pitchGoal;
+	}
+	return r;
+}
+
+// The same scenarios under the state space controller. There are no outer loops to hand goals to, so the goal
+// state is a reference moving along: speed ramped at SPEED_GOAL_RAMP up to the remote's speed goal, or up to
+// MAX_SPEED_GOAL and down again to stop at the position goal, with the position integrating it. A 2m position goal
+// set as a step would pin the control at full PWM and throw the droid over.
+static Run runStateSpace(Scenario scenario, double seconds = 30) {
+	StateSpaceRig rig(scenario == STATION_KEEPING ? 1 : 0);
+	StateSpaceController<4, 1>& c = rig.c;
+
+	Run r = {false, 0, 0, 0, 0, 0};
+	bool holding = false;
+	double holdAt = 0, refSpeed = 0, refPos = 0;
+	const double dt = CYCLE_US/1e6, dv = SPEED_GOAL_RAMP*dt;
+	for(unsigned long k=0; hostMicros < seconds*1e6; k++) {
+		double t = hostMicros/1e6;
+		plant.push = (scenario == STATION_KEEPING && t > 10 && t < 10.1) ? 300 : 0;
+		plant.step(dt);
+		hostMicros += CYCLE_US;
+		rig.left.update();
+		rig.right.update();
+
+		if(scenario == REMOTE_DRIVE || (scenario == GOAL_2M && k >= 208)) {
+			double target;
+			if(scenario == REMOTE_DRIVE) target = (t > 2 && t < 6) ? 400 : 0;
+			else target = fmin(MAX_SPEED_GOAL, sqrt(2*SPEED_GOAL_RAMP*fmax(0, 2000 - refPos)));
+			refSpeed += constrain(target - refSpeed, -dv, dv);
+			refPos += refSpeed*dt;
+			if(scenario == GOAL_2M && refPos >= 2000 - 1e-3) {
+				refPos = 2000;
+				refSpeed = 0;
+			}
+			c.setGoal(STATE_SPEED, refSpeed);
+			c.setGoal(STATE_POSITION, refPos);
+			if(scenario == REMOTE_DRIVE && t > 6 && !holding && refSpeed == 0 &&
+				fabs(rig.speed.present()) < POS_HOLD_SPEED) {
+				holding = true;
+				holdAt = plant.x;
+			}
+		}
+		c.update();
+		if(fabs(plant.th) > 45) {
+			r.fell = true;
+			break;
+		}
+
+		double dev = plant.x;
+		if(scenario == GOAL_2M) dev = t < 2 ? 0 : plant.x - 2000;
+		if(scenario == REMOTE_DRIVE) dev = holding ? plant.x - holdAt : 0;
+		r.maxPitch = fmax(r.maxPitch, fabs(plant.th));
+		r.maxPWM = fmax(r.maxPWM, fabs(plant.u));
+		if(t > 2) r.maxDev = fmax(r.maxDev, scenario == GOAL_2M ? dev : fabs(dev));
+		r.finalDev = dev;
+	}
+	return r;
+}
+
+struct Cost {
+	double ns, pidUpdates; // per cycle
+};
+
+// What CascadedController::update() costs per cycle on this host, holding station, in the best of 20 rounds.
+// The plant is stepped outside of the timing, as the IMU and encoders are read outside of it on the droid.
+static Cost cost(bool cascade, unsigned int speedDivider = 1, unsigned int posDivider = 1) {
+	Rig rig(cascade, SPEED_GOAL_RAMP, 0, speedDivider, posDivider);
+	const int N = 8000;
+	double best = 1e9;
+	long updates = 0;
+	for(int round=0; round<20; round++) {
+		double ns = 0;
+		for(int k=0; k<N; k++) {
+			plant.step(CYCLE_US/1e6);
+			hostMicros += CYCLE_US;
+			rig.left.update();
+			rig.right.update();
+			auto t0 = std::chrono::steady_clock::now();
+			rig.c.update();
+			ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+			if(round == 0) updates += rig.c.pidUpdates();
+		}
+		best = std::min(best, ns / N);
+	}
+	return {best, double(updates) / N};
+}
+
+// The same for the state space controller's update(), which replaces all three loops
+static double stateSpaceCost() {
+	StateSpaceRig rig;
+	const int N = 8000;
+	double best = 1e9;
+	for(int round=0; round<20; round++) {
+		double ns = 0;
+		for(int k=0; k<N; k++) {
+			plant.step(CYCLE_US/1e6);
+			hostMicros += CYCLE_US;
+			rig.left.update();
+			rig.right.update();
+			auto t0 = std::chrono::steady_clock::now();
+			rig.c.update();
+			ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+		}
+		best = std::min(best, ns / N);
+	}
+	return best;
+}
+
+// What the timer alone costs per measurement, included in the numbers from cost()
+static double timerNS() {
+	const int N = 8000;
+	double best = 1e9;
+	for(int round=0; round<20; round++) {
+		double ns = 0;
+		for(int k=0; k<N; k++) {
+			auto t0 = std::chrono::steady_clock::now();
+			ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+		}
+		best = std::min(best, ns / N);
+	}
+	return best;
+}
+
+int main() {
+	Run before = run(false, STATION_KEEPING);
+	Run r = run(true, STATION_KEEPING);
+	printf("Station keeping for 30s, 1deg IMU bias, shove at 10s:\n");
+	printf("  balance loop only: %s, %.1fmm off at the end\n", before.fell ? "fell" : "up", before.finalDev);
+	printf("  cascade:           %s, at most %.1fmm off, %.1fmm at the end, max pitch %.2fdeg, max PWM %.1f\n",
+		r.fell ? "fell" : "up", r.maxDev, r.finalDev, r.maxPitch, r.maxPWM);
+	CHECK(before.fell || fabs(before.finalDev) > 1000, "balance loop alone kept station");
+	CHECK(!r.fell && r.maxDev < 50 && fabs(r.finalDev) < 5, "cascade drifted %g mm", r.maxDev);
+
+	r = run(true, GOAL_2M);
+	printf("Position goal 2m away: %s, overshoot %.1fmm, %.1fmm off at the end, max pitch %.2fdeg\n",
+		r.fell ? "fell" : "up", r.maxDev, r.finalDev, r.maxPitch);
+	CHECK(!r.fell && r.maxDev < 50 && fabs(r.finalDev) < 5, "2m goal overshoot %g, %g off", r.maxDev, r.finalDev);
+
+	Run stepped = run(true, REMOTE_DRIVE, 0);
+	r = run(true, REMOTE_DRIVE);
+	printf("400mm/s from the remote for 4s, then let go:\n");
+	printf("  speed goal stepped to 0:         %s, drift after hold %.1fmm, largest pitch goal change per cycle %.2fdeg\n",
+		stepped.fell ? "fell" : "up", stepped.maxDev, stepped.releaseKick);
+	printf("  ramped at %.0fmm/s^2 (DOConfig): %s, drift after hold %.1fmm, largest pitch goal change per cycle %.2fdeg\n",
+		SPEED_GOAL_RAMP, r.fell ? "fell" : "up", r.maxDev, r.releaseKick);
+	CHECK(!r.fell && r.maxDev < 200, "drift after letting go %g", r.maxDev);
+	CHECK(r.releaseKick < stepped.releaseKick / 2, "ramp kicks %g, step %g", r.releaseKick, stepped.releaseKick);
+
+	// The state space controller on the same scenarios. Without an integrator it keeps station off by the pitch bias
+	// over the position gain, where the cascade's speed loop integrates the bias away.
+	const char *names[] = {"station keeping", "2m goal", "remote drive"};
+	printf("Cascade vs. LQR (lqr_gains.py) on pitch, pitch rate, speed and position:\n");
+	printf("                   max off  at the end  max pitch  max PWM\n");
+	for(Scenario s: {STATION_KEEPING, GOAL_2M, REMOTE_DRIVE}) {
+		Run c = run(true, s), l = runStateSpace(s);
+		printf("  %-15s  %6.1fmm  %8.1fmm  %7.2fdeg  %7.1f  cascade\n", names[s], c.maxDev, c.finalDev, c.maxPitch,
+			c.maxPWM);
+		printf("  %-15s  %6.1fmm  %8.1fmm  %7.2fdeg  %7.1f  LQR%s\n", "", l.maxDev, l.finalDev, l.maxPitch, l.maxPWM,
+			l.fell ? ", fell" : "");
+		CHECK(!l.fell, "LQR fell in %s", names[s]);
+		if(s == STATION_KEEPING) {
+			float offset = -LQR_GAINS[0][STATE_PITCH] / LQR_GAINS[0][STATE_POSITION];
+			CHECK(l.maxDev < 50 && fabs(l.finalDev - offset) < 5, "LQR station keeping %g mm off at the end, expected %g",
+				l.finalDev, offset);
+		}
+		if(s == GOAL_2M) CHECK(l.maxDev < 150 && fabs(l.finalDev) < 5, "LQR 2m goal overshoot %g, %g off", l.maxDev,
+			l.finalDev);
+		if(s == REMOTE_DRIVE) CHECK(l.maxDev < 200, "LQR drift after letting go %g", l.maxDev);
+	}
+
+	// A family of plants around the nominal one
+	int runs = 0, falls = 0, lqrFalls = 0;
+	for(double tau: {0.1, 0.15, 0.2}) {
+		for(double length: {0.1, 0.13, 0.18}) {
+			for(double vmax: {2000.0, 2500.0, 3000.0}) {
+				nominal.tau = tau;
+				nominal.length = length;
+				nominal.vmax = vmax;
+				for(Scenario s: {STATION_KEEPING, GOAL_2M, REMOTE_DRIVE}) {
+					runs++;
+					if(run(true, s).fell) {
+						falls++;
+						printf("  fell with tau %.2fs, length %.2fm, top speed %.0fmm/s, scenario %d\n", tau, length,
+							vmax, s);
+					}
+					if(runStateSpace(s).fell) {
+						lqrFalls++;
+						printf("  LQR fell with tau %.2fs, length %.2fm, top speed %.0fmm/s, scenario %d\n", tau, length,
+							vmax, s);
+					}
+				}
+			}
+		}
+	}
+	printf("%d of %d runs over tau 0.1-0.2s, length 0.1-0.18m, top speed 2000-3000mm/s fell, %d with LQR\n", falls,
+		runs, lqrFalls);
+	CHECK(falls == 0 && lqrFalls == 0, "%d runs fell, %d with LQR", falls, lqrFalls);
+	nominal = Plant();
+
+	// Per cycle cost of the cascade, with the outer loops divided as in DOConfig.h and with all loops every cycle
+	Cost balance = cost(false), divided = cost(true, SPEED_LOOP_DIVIDER, POS_LOOP_DIVIDER), full = cost(true);
+	double expected = 1 + 1.0/SPEED_LOOP_DIVIDER + 1.0/POS_LOOP_DIVIDER;
+	printf("update() per cycle on this host, including %.1fns for the timer:\n", timerNS());
+	printf("  balance loop only:        %5.1fns, %.3f PID updates\n", balance.ns, balance.pidUpdates);
+	printf("  dividers %u/%u:             %5.1fns, %.3f PID updates\n", SPEED_LOOP_DIVIDER, POS_LOOP_DIVIDER, divided.ns,
+		divided.pidUpdates);
+	printf("  all loops every cycle:    %5.1fns, %.3f PID updates\n", full.ns, full.pidUpdates);
+	printf("  state space controller:   %5.1fns\n", stateSpaceCost());
+	CHECK(balance.pidUpdates == 1 && full.pidUpdates == 3, "%g and %g PID updates per cycle, expected 1 and 3",
+		balance.pidUpdates, full.pidUpdates);
+	CHECK(fabs(divided.pidUpdates - expected) < 1e-3, "%g PID updates per cycle with dividers, expected %g",
+		divided.pidUpdates, expected);
+
+	return hostTestResult();
+}
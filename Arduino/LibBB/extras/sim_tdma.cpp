@@ -0,0 +1,439 @@
+//
+// Fleet simulation for the XBee TDMA slot scheduling (XBee::setTDMA()): 2 to 32 droid/remote pairs and a coordinator
+// share one channel, every node a bb::XBee on its own thread. Remotes send a ControlPacket to their droid every cycle
+// as RRemote does, droids send a StatePacket back every tenth cycle as DODroid does. Each node runs its 100Hz
+// runloop at its own phase, with its clock a few ppm off. The channel stands in for the XBee 802.15.4 MAC: the frame
+// goes over the UART at 115200bps, then unslotted CSMA-CA with the XBee's default backoff exponent of 0, and frames
+// that overlap on air are lost. The coordinator is on from the start, the others are switched on during the first
+// second. Unscheduled sending is compared with TDMA: slots derived from the station IDs, slots assigned with tdma_slot
+// one after the other, and assigned leaving every other slot free. Prints collisions per second, control updates per
+// second and the uplink latency: the age of the newest control a droid has at the start of its cycles, p50, p95 and
+// p99. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -pthread -DARDUINO_ARCH_SAMD -Ihost -I../include sim_tdma.cpp host/host.cpp ../src/*.cpp -o sim_tdma && ./sim_tdma
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/XBeeRadio.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <thread>
+
+using namespace bb;
+
+static const double CYCLE_US = Runloop::DEFAULT_CYCLETIME;
+static const double TICK_US = 100;               // resolution at which node threads are released
+static const double PROCESSING_US = 300;         // from the start of a cycle to the packets going to the UART
+static const double UART_US_PER_BYTE = 10e6 / 115200;
+static const double AIR_US_PER_BYTE = 32;        // 250kbps
+static const size_t AIR_OVERHEAD_BYTES = 17;     // PHY header, MAC header with 16 bit addresses, FCS
+static const double CCA_US = 128, TURNAROUND_US = 192, BACKOFF_PERIOD_US = 320;
+static const int MAX_CSMA_BACKOFFS = 4, MAX_BACKOFF_EXPONENT = 5;
+static const int STATE_EVERY = 10;
+static const double SECONDS = 12, POWER_ON_SECONDS = 1, WARMUP_SECONDS = 2;
+static const int MARKER_MOD = 512;               // control packets carry the cycle they were sent in, in axis0
+
+enum Mode { UNSCHEDULED, TDMA_DERIVED, TDMA_ASSIGNED, TDMA_SPACED };
+static const char *modeNames[] = {"unscheduled", "TDMA, derived slots", "TDMA, assigned slots", "TDMA, every other slot"};
+
+struct SimXBee: public XBee {
+	SimXBee(HardwareSerial *uart, uint16_t station) {
+		uart_ = uart;
+		apiMode_ = true;
+		params_.station = station;
+		operationStatus_ = RES_OK;
+	}
+	void setSlot(int slot) { tdmaSlotOverride_ = slot; }
+};
+
+struct Frame {
+	size_t src;
+	uint16_t dest;
+	std::vector<uint8_t> payload;
+	double uartDone, start, end;
+	int backoffs, exponent;
+	bool collided;
+};
+
+struct Node;
+
+// Records the newest control packet, the droid side of the uplink
+struct DroidReceiver: public PacketReceiver {
+	int lastMarker = -1;
+	Result incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet) {
+		(void)station; (void)source; (void)rssi;
+		lastMarker = packet.axis0;
+		return RES_OK;
+	}
+};
+
+struct Node {
+	enum Role { COORDINATOR, REMOTE, DROID } role;
+	uint16_t station, peer;
+	double phaseUS, ppm;
+	Radio radio;
+	SimXBee xbee;
+	DroidReceiver receiver;
+	std::mt19937 rng;
+
+	long cycle = 0;                                   // next cycle to run
+	long firstCycle;                                  // switched on
+	std::vector<double> sendUS;                       // remote: when the control of each cycle went to the UART
+	std::vector<long> newest;                         // droid: cycle of the newest control at the start of each cycle
+	std::vector<std::pair<double, Frame*>> inbox;     // received, available on the UART from .first on
+	std::deque<Frame*> outq;                          // waiting for the radio, the head is on its way
+	double uartFree = 0;
+
+	std::thread thread;
+	std::condition_variable cv;
+	bool go = false;
+
+	Node(Role r, uint16_t s, uint16_t p, std::mt19937& seed):
+		role(r), station(s), peer(p), xbee(&radio, s), rng(seed()) {
+		std::uniform_real_distribution<double> phase(0, CYCLE_US), drift(-50, 50);
+		phaseUS = phase(rng);
+		ppm = drift(rng);
+		firstCycle = r == COORDINATOR ? 0 : std::uniform_int_distribution<long>(0, POWER_ON_SECONDS * 1e6 / CYCLE_US)(rng);
+		if(role == DROID) xbee.addPacketReceiver(&receiver);
+	}
+	double startUS(long k) { return phaseUS + k * CYCLE_US * (1 + ppm * 1e-6); }
+
+	// One runloop cycle: XBee::step() first, then the droid or remote, as they are registered
+	void runCycle() {
+		if(cycle < firstCycle) return;
+		xbee.step();
+		if(role == REMOTE) {
+			Packet p(PACKET_TYPE_CONTROL, PACKET_SOURCE_LEFT_REMOTE);
+			p.payload.control.axis0 = cycle % MARKER_MOD;
+			xbee.sendTo(peer, p, false);
+			sendUS[cycle] = startUS(cycle) + PROCESSING_US;
+		} else if(role == DROID) {
+			newest[cycle] = receiver.lastMarker < 0 ? -1 : cycle - (cycle - receiver.lastMarker + MARKER_MOD) % MARKER_MOD;
+			if(cycle % STATE_EVERY == 0) {
+				Packet p(PACKET_TYPE_STATE, PACKET_SOURCE_DROID);
+				p.payload.state.item = StatePacket::STATE_DRIVE;
+				xbee.sendTo(peer, p, false);
+			}
+		}
+	}
+};
+
+// The threads run the nodes whose cycle starts in the present tick; everything else happens on the main thread
+// while they wait.
+struct Fleet {
+	std::vector<std::unique_ptr<Node>> nodes;
+	std::map<uint16_t, size_t> byStation;
+	std::mutex mutex;
+	std::condition_variable done;
+	int running = 0;
+	bool quit = false;
+	std::mt19937 rng;
+
+	struct Attempt {
+		double us;
+		size_t node;
+		bool operator<(const Attempt& o) const { return us > o.us; }
+	};
+	std::priority_queue<Attempt> attempts;
+	std::vector<Frame*> onAir;
+	unsigned long frames = 0, collided = 0, accessFailures = 0;
+	double warmupUS = WARMUP_SECONDS * 1e6;
+
+	Fleet(int pairs, Mode mode, unsigned seed): rng(seed) {
+		int slots = std::min(64, (mode == TDMA_SPACED ? 4 : 2)*pairs + 1);
+		if(mode != UNSCHEDULED) add(Node::COORDINATOR, XBee::makeStationID(XBee::REMOTE_RESERVED1, 0, 1), 0);
+		for(int i=0; i<pairs; i++) {
+			uint16_t droid = XBee::makeStationID(XBee::DROID_DIFF_UNSTABLE, i+1, 1);
+			uint16_t remote = XBee::makeStationID(XBee::REMOTE_BAVARIAN_L, i+1, 1);
+			add(Node::DROID, droid, remote);
+			add(Node::REMOTE, remote, droid);
+		}
+		int index = 0;
+		for(auto& n: nodes) {
+			if(mode == UNSCHEDULED) continue;
+			if(n->role == Node::COORDINATOR) {
+				n->xbee.setTDMA(true, true, slots);
+			} else {
+				if(mode == TDMA_DERIVED) n->xbee.setSlot(-1);
+				else n->xbee.setSlot(mode == TDMA_ASSIGNED ? 1 + index++ : 1 + 2 * index++);
+				n->xbee.setTDMA(true, false, slots);
+			}
+		}
+		long cycles = long(SECONDS * 1e6 / CYCLE_US) + 2;
+		for(auto& n: nodes) {
+			n->sendUS.assign(cycles, 0);
+			n->newest.assign(cycles, -1);
+			Node *np = n.get();
+			n->thread = std::thread([this, np]() { nodeThread(np); });
+		}
+	}
+
+	~Fleet() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		for(auto& n: nodes) n->cv.notify_one();
+		for(auto& n: nodes) n->thread.join();
+		for(Frame *f: onAir) delete f;
+		for(auto& n: nodes) {
+			for(auto& in: n->inbox) if(--refs[in.second] == 0) delete in.second;
+			for(Frame *f: n->outq) delete f;
+		}
+	}
+
+	void add(Node::Role role, uint16_t station, uint16_t peer) {
+		byStation[station] = nodes.size();
+		nodes.emplace_back(new Node(role, station, peer, rng));
+	}
+
+	void nodeThread(Node *n) {
+		std::unique_lock<std::mutex> lock(mutex);
+		while(true) {
+			n->cv.wait(lock, [&]() { return n->go || quit; });
+			if(quit) return;
+			lock.unlock();
+			n->runCycle();
+			lock.lock();
+			n->go = false;
+			if(--running == 0) done.notify_one();
+		}
+	}
+
+	// Runs the given nodes concurrently, all in the same cycle
+	void runNodes(const std::vector<Node*>& batch, long cycle) {
+		static_cast<RunloopProbe&>(Runloop::runloop).setSequenceNumber(cycle);
+		std::unique_lock<std::mutex> lock(mutex);
+		running = batch.size();
+		for(Node *n: batch) {
+			n->go = true;
+			n->cv.notify_one();
+		}
+		done.wait(lock, [&]() { return running == 0; });
+	}
+
+	struct RunloopProbe: public Runloop {
+		void setSequenceNumber(uint64_t n) { seqnum_ = n; }
+	};
+
+	// API transmit requests the node wrote this cycle go to its UART queue
+	void collect(size_t index, double writeUS) {
+		Node& n = *nodes[index];
+		std::vector<uint8_t> raw;
+		for(size_t i=0; i<n.radio.tx.size(); i++) raw.push_back(n.radio.tx[i] == 0x7d ? n.radio.tx[++i] ^ 0x20 : n.radio.tx[i]);
+		n.radio.tx.clear();
+		for(size_t i=0; i+3 < raw.size();) {
+			size_t len = (raw[i+1] << 8) | raw[i+2];
+			if(raw[i+3] == 0x10 && len > 14) {
+				Frame *f = new Frame;
+				f->src = index;
+				f->dest = (raw[i+3+10] << 8) | raw[i+3+11];
+				f->payload.assign(&raw[i+3+14], &raw[i+3+len]);
+				n.uartFree = std::max(n.uartFree, writeUS) + (len + 4) * UART_US_PER_BYTE;
+				f->uartDone = n.uartFree;
+				f->backoffs = f->exponent = 0;
+				f->collided = false;
+				n.outq.push_back(f);
+				if(n.outq.size() == 1) attempts.push({f->uartDone, index});
+			}
+			i += len + 4;
+		}
+	}
+
+	// The head of a node's queue is done, on air or dropped; the next one goes when the UART has it
+	void nextFrame(size_t index, double us) {
+		Node& n = *nodes[index];
+		n.outq.pop_front();
+		if(!n.outq.empty()) attempts.push({std::max(us, n.outq.front()->uartDone), index});
+	}
+
+	// Unslotted CSMA-CA, for every channel access before untilUS
+	void access(double untilUS) {
+		std::uniform_int_distribution<int> backoff(0, (1 << MAX_BACKOFF_EXPONENT) - 1);
+		while(!attempts.empty() && attempts.top().us < untilUS) {
+			Attempt a = attempts.top();
+			attempts.pop();
+			Frame *f = nodes[a.node]->outq.front();
+			bool busy = false;
+			for(Frame *g: onAir) busy = busy || (g->start < a.us + CCA_US/2 && g->end > a.us);
+			if(busy) {
+				if(++f->backoffs > MAX_CSMA_BACKOFFS) {
+					if(a.us >= warmupUS) accessFailures++;
+					delete f;
+					nextFrame(a.node, a.us + CCA_US);
+				} else {
+					f->exponent = std::min(f->exponent + 1, MAX_BACKOFF_EXPONENT);
+					attempts.push({a.us + CCA_US + (backoff(rng) % (1 << f->exponent)) * BACKOFF_PERIOD_US, a.node});
+				}
+				continue;
+			}
+			f->start = a.us + CCA_US + TURNAROUND_US;
+			f->end = f->start + (f->payload.size() + AIR_OVERHEAD_BYTES) * AIR_US_PER_BYTE;
+			for(Frame *g: onAir) {
+				if(g->end > f->start && g->start < f->end) {
+					if(!g->collided && g->start >= warmupUS) collided++;
+					if(!f->collided && f->start >= warmupUS) collided++;
+					g->collided = f->collided = true;
+				}
+			}
+			if(f->start >= warmupUS) frames++;
+			onAir.push_back(f);
+			nextFrame(a.node, f->end);
+		}
+	}
+
+	// Frames that ended before untilUS can't collide any more. Intact ones go to their receivers' UARTs.
+	std::map<Frame*, int> refs;
+	void land(double untilUS) {
+		for(size_t i=0; i<onAir.size();) {
+			Frame *f = onAir[i];
+			if(f->end > untilUS) {
+				i++;
+				continue;
+			}
+			onAir.erase(onAir.begin() + i);
+			int n = 0;
+			if(!f->collided) {
+				double avail = f->end + (f->payload.size() + 9) * UART_US_PER_BYTE;
+				for(size_t r=0; r<nodes.size(); r++) {
+					if(r == f->src || (f->dest != 0xffff && f->dest != nodes[r]->station)) continue;
+					nodes[r]->inbox.push_back({avail, f});
+					n++;
+				}
+			}
+			if(n == 0) delete f;
+			else refs[f] = n;
+		}
+	}
+
+	void deliver(Node& n, double startUS) {
+		for(size_t i=0; i<n.inbox.size();) {
+			if(n.inbox[i].first > startUS) {
+				i++;
+				continue;
+			}
+			Frame *f = n.inbox[i].second;
+			n.radio.receive(nodes[f->src]->station, f->payload.data(), f->payload.size());
+			if(--refs[f] == 0) {
+				refs.erase(f);
+				delete f;
+			}
+			n.inbox.erase(n.inbox.begin() + i);
+		}
+	}
+
+	void run() {
+		for(long tick=0; tick * TICK_US < SECONDS * 1e6; tick++) {
+			double t0 = tick * TICK_US, t1 = t0 + TICK_US;
+			access(t1);
+			land(t1);
+			// Nodes starting a cycle in this tick, batched by cycle number, as that is what the runloop shares
+			std::map<long, std::vector<Node*>> batches;
+			for(size_t i=0; i<nodes.size(); i++) {
+				Node& n = *nodes[i];
+				double s = n.startUS(n.cycle);
+				if(s >= t1) continue;
+				deliver(n, s);
+				batches[n.cycle].push_back(&n);
+			}
+			hostMicros = t0;
+			for(auto& b: batches) {
+				runNodes(b.second, b.first);
+				for(Node *n: b.second) {
+					collect(byStation[n->station], n->startUS(n->cycle) + PROCESSING_US);
+					n->cycle++;
+				}
+			}
+		}
+	}
+};
+
+struct Outcome {
+	double collisionsPerSecond, lossPercent, updatesPerSecond, p50, p95, p99;
+	unsigned long accessFailures;
+};
+
+static double percentile(std::vector<double>& v, double p) {
+	if(v.empty()) return NAN;
+	size_t i = std::min(v.size() - 1, size_t(p * v.size()));
+	std::nth_element(v.begin(), v.begin() + i, v.end());
+	return v[i];
+}
+
+static Outcome simulate(int pairs, Mode mode) {
+	Fleet fleet(pairs, mode, 1000 * pairs + mode);
+	fleet.run();
+
+	Outcome r;
+	double seconds = SECONDS - WARMUP_SECONDS;
+	r.collisionsPerSecond = fleet.collided / seconds;
+	r.lossPercent = fleet.frames ? 100.0 * fleet.collided / fleet.frames : 0;
+	r.accessFailures = fleet.accessFailures;
+	std::vector<double> ages;
+	unsigned long updates = 0;
+	for(auto& n: fleet.nodes) {
+		if(n->role != Node::DROID) continue;
+		Node& remote = *fleet.nodes[fleet.byStation[n->peer]];
+		long last = -1;
+		for(long k=0; k<n->cycle; k++) {
+			double s = n->startUS(k);
+			long c = n->newest[k];
+			if(s < fleet.warmupUS) {
+				last = c;
+				continue;
+			}
+			if(c != last) updates++;
+			last = c;
+			if(c >= 0) ages.push_back((s - remote.sendUS[c]) / 1000);
+			else ages.push_back(s / 1000); // nothing yet, as old as the run
+		}
+	}
+	r.updatesPerSecond = updates / seconds / pairs;
+	r.p50 = percentile(ages, 0.50);
+	r.p95 = percentile(ages, 0.95);
+	r.p99 = percentile(ages, 0.99);
+	return r;
+}
+
+int main() {
+	printf("%.0fs at %.0fHz after %.0fs warmup. Uplink latency is the age of a droid's newest control packet at the "
+		"start of its cycles, in ms.\n", SECONDS - WARMUP_SECONDS, 1e6 / CYCLE_US, WARMUP_SECONDS);
+	printf("pairs  %-22s collisions/s  lost%%  access fail  updates/s  p50     p95     p99\n", "");
+	std::map<std::pair<int, int>, Outcome> results;
+	for(int pairs: {2, 4, 8, 16, 32}) {
+		for(Mode mode: {UNSCHEDULED, TDMA_DERIVED, TDMA_ASSIGNED, TDMA_SPACED}) {
+			Outcome r = simulate(pairs, mode);
+			results[{pairs, mode}] = r;
+			printf("%5d  %-22s %12.1f  %5.1f  %11lu  %9.1f  %6.1f  %6.1f  %6.1f\n", pairs, modeNames[mode],
+				r.collisionsPerSecond, r.lossPercent, r.accessFailures, r.updatesPerSecond, r.p50, r.p95, r.p99);
+		}
+	}
+
+	// A station's slot is a cycle of its own runloop, which is up to a cycle off from its neighbours'. With a free slot
+	// in between nothing overlaps, as long as every station has a slot of its own.
+	for(int pairs: {2, 4, 8, 16}) {
+		const Outcome& spaced = results[{pairs, TDMA_SPACED}];
+		double superframeMS = (4*pairs + 1) * CYCLE_US / 1000;
+		CHECK(spaced.collisionsPerSecond == 0 && spaced.accessFailures == 0, "%d pairs, every other slot: %.1f "
+			"collisions/s, %lu access failures", pairs, spaced.collisionsPerSecond, spaced.accessFailures);
+		CHECK(spaced.updatesPerSecond >= 0.95 * 1000 / superframeMS, "%d pairs, every other slot: %.1f updates/s",
+			pairs, spaced.updatesPerSecond);
+		CHECK(spaced.p99 <= superframeMS + 3 * CYCLE_US / 1000, "%d pairs, every other slot: p99 %.1fms with a %.0fms "
+			"superframe", pairs, spaced.p99, superframeMS);
+	}
+	for(int pairs: {4, 8, 16}) {
+		const Outcome& off = results[{pairs, UNSCHEDULED}];
+		const Outcome& on = results[{pairs, TDMA_ASSIGNED}];
+		CHECK(on.collisionsPerSecond * 5 < off.collisionsPerSecond, "%d pairs: %.1f collisions/s with assigned slots, "
+			"%.1f unscheduled", pairs, on.collisionsPerSecond, off.collisionsPerSecond);
+	}
+
+	return hostTestResult();
+}
@@ -0,0 +1,193 @@
+//
+// Host test for biquad cascades (BBBiquad.h) and the encoder filters built on them. Checks low and high pass of
+// orders 2 to 6 against the analytic digital Butterworth response in float, Q16.16 and Q8.24, band pass and notch
+// at their center, a low cutoff in Q16.16, that a multi-channel cascade is bit-identical to single channel ones,
+// how close adaptive filters get to an exact design over the table range and under jitter, and that cutoffs
+// outside the table are rejected, by the cascade and by bb::Encoder, without touching the filter. Also measures
+// the encoder's case, one adaptive sample, against LowPassFilter on this host. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_biquad.cpp host/host.cpp ../src/*.cpp -o test_biquad && ./test_biquad
+//
+
+#include <LibBB.h>
+#include <BBBiquad.h>
+#include "host/HostTest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+using namespace bb;
+
+// Steady state gain at f with sample rate fs
+template<class F> static double gainAt(F& filt, double f, double fs) {
+	filt.reset();
+	int n = std::min(int(fs * 40 / std::min(f, 1.0)) + 4000, 200000);
+	double inE = 0, outE = 0;
+	for(int i=0; i<n; i++) {
+		float x = 10.0f * sinf(2*M_PI*f*i/fs);
+		float y = filt.filter(x);
+		if(i > n/2) {
+			inE += x*x;
+			outE += y*y;
+		}
+	}
+	return sqrt(outE/inE);
+}
+
+static double butterLP(double f, double fc, double fs, int n) {
+	return 1/sqrt(1 + pow(tan(M_PI*f/fs) / tan(M_PI*fc/fs), 2*n));
+}
+
+static double butterHP(double f, double fc, double fs, int n) {
+	return 1/sqrt(1 + pow(tan(M_PI*fc/fs) / tan(M_PI*f/fs), 2*n));
+}
+
+template<class T, int ORDER> static void responseTests(const char *tname, double tol) {
+	const double fs = 100, fc = 10;
+	double worstLP = 0, worstHP = 0;
+	for(double f: {0.5, 2.0, 5.0, 8.0, 10.0, 12.0, 20.0, 30.0, 45.0}) {
+		BiquadCascade<ORDER, 1, T> lp, hp;
+		lp.design(BIQUAD_LOWPASS, fc, fs);
+		hp.design(BIQUAD_HIGHPASS, fc, fs);
+		worstLP = std::max(worstLP, fabs(gainAt(lp, f, fs) - butterLP(f, fc, fs, ORDER)));
+		worstHP = std::max(worstHP, fabs(gainAt(hp, f, fs) - butterHP(f, fc, fs, ORDER)));
+	}
+	BiquadCascade<ORDER, 1, T> bp, notch;
+	bp.design(BIQUAD_BANDPASS, fc, fs, 2.0f);
+	notch.design(BIQUAD_NOTCH, fc, fs, 2.0f);
+	double bpc = gainAt(bp, fc, fs), bpf = gainAt(bp, 1.0, fs), nc = gainAt(notch, fc, fs), nf = gainAt(notch, 1.0, fs);
+	printf("  %-7s order %d: low pass max |gain error| %.5f, high pass %.5f; band pass %.4f at center, %.4f at 1Hz; "
+		"notch %.5f at center, %.4f at 1Hz\n", tname, ORDER, worstLP, worstHP, bpc, bpf, nc, nf);
+	CHECK(worstLP < tol && worstHP < tol, "%s order %d: low and high pass off by %g and %g", tname, ORDER, worstLP,
+		worstHP);
+	CHECK(fabs(bpc - 1) < tol && bpf < 0.2 && nc < 0.01 + tol && fabs(nf - 1) < 0.02 + tol,
+		"%s order %d: band pass or notch", tname, ORDER);
+}
+
+// Largest gain error at the cutoff against an exact design, over the table range
+template<int TABLE_SIZE> static double adaptiveError() {
+	double worst = 0;
+	for(unsigned long us = 2000; us <= 16000; us += 250) {
+		double fs = 1e6 / us;
+		BiquadCascade<2, 1, float> exact;
+		exact.design(BIQUAD_LOWPASS, 25, fs);
+		BiquadCascade<2, 1, float, TABLE_SIZE> adaptive;
+		adaptive.designAdaptive(BIQUAD_LOWPASS, 25, 2000, 16000);
+		adaptive.filter(0.0f, us);
+		worst = std::max(worst, fabs(gainAt(adaptive, 25, fs) - gainAt(exact, 25, fs)));
+	}
+	return worst;
+}
+
+static long encoderTicks = 0;
+
+template<class F> static double nsPerCall(F f, int n) {
+	auto t0 = std::chrono::steady_clock::now();
+	for(int i=0; i<n; i++) f(i);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+int main() {
+	printf("Against the analytic digital Butterworth (fc 10Hz, fs 100Hz), band pass and notch with Q 2:\n");
+	responseTests<float, 2>("float", 0.002);
+	responseTests<float, 4>("float", 0.002);
+	responseTests<float, 6>("float", 0.002);
+	responseTests<Q16_16, 2>("Q16.16", 0.01);
+	responseTests<Q16_16, 4>("Q16.16", 0.01);
+	responseTests<Q8_24, 4>("Q8.24", 0.002);
+
+	// A low cutoff is the hard case for quantized coefficients
+	BiquadCascade<2, 1, Q16_16> low;
+	low.design(BIQUAD_LOWPASS, 2, 104);
+	double g = gainAt(low, 0.2, 104), gc = gainAt(low, 2, 104);
+	printf("  Q16.16 2Hz at 104Hz: %.4f at 0.2Hz (ideal %.4f), %.4f at 2Hz (ideal 0.7071)\n", g,
+		butterLP(0.2, 2, 104, 2), gc);
+	CHECK(fabs(gc - M_SQRT1_2) < 0.01, "Q16.16 2Hz low pass has %g at cutoff", gc);
+
+	// Channels are independent and filter exactly like single channel cascades
+	BiquadCascade<4, 6, float> multi;
+	multi.design(BIQUAD_LOWPASS, 7, 100);
+	BiquadCascade<4, 1, float> single[6];
+	for(auto& s: single) s.design(BIQUAD_LOWPASS, 7, 100);
+	std::mt19937 rng(5);
+	std::normal_distribution<float> noise(0, 10);
+	double maxDiff = 0;
+	for(int i=0; i<5000; i++) {
+		float in[6], out[6];
+		for(int c=0; c<6; c++) in[c] = noise(rng) + c*3;
+		multi.filter(in, out);
+		for(int c=0; c<6; c++) maxDiff = std::max(maxDiff, (double)fabs(out[c] - single[c].filter(in[c])));
+	}
+	CHECK(maxDiff == 0, "6 channel cascade differs from single channel ones by up to %g", maxDiff);
+
+	// Adaptive: interpolated table against an exact design at every period
+	printf("Adaptive 25Hz low pass over 2-16ms, max |gain error| at cutoff: %.4f with 2 entries, %.4f with 4, "
+		"%.4f with 8, %.4f with 16, %.4f with 32\n", adaptiveError<2>(), adaptiveError<4>(), adaptiveError<8>(),
+		adaptiveError<16>(), adaptiveError<32>());
+	CHECK(adaptiveError<8>() < 0.01, "adaptive filter with the default table is off by %g", adaptiveError<8>());
+
+	// Jittered 100Hz: interpolated against redesigning every sample
+	BiquadCascade<2, 1, float> adaptive, exact;
+	adaptive.designAdaptive(BIQUAD_LOWPASS, 25, 2000, 16000);
+	std::uniform_int_distribution<int> jitter(-1500, 1500);
+	maxDiff = 0;
+	for(int i=0; i<10000; i++) {
+		unsigned long us = 10000 + jitter(rng);
+		exact.design(BIQUAD_LOWPASS, 25, 1e6f/us);
+		float x = 50*sinf(i*0.3f) + (i/500 % 2)*100;
+		maxDiff = std::max(maxDiff, (double)fabs(adaptive.filter(x, us) - exact.filter(x)));
+	}
+	printf("  jittered 10+-1.5ms, steps of 100 plus a sine of 50: max |interpolated - exact| %.4f\n", maxDiff);
+	CHECK(maxDiff < 0.5, "jittered adaptive filter off by %g", maxDiff);
+
+	// Cutoffs the table can't take are rejected and leave the filter as it was
+	const float bad[] = {0, -5, 31.25f, 40, NAN};
+	for(float co: bad) {
+		CHECK(!adaptive.designAdaptive(BIQUAD_LOWPASS, co, 2000, 16000), "adaptive cutoff %g accepted", co);
+	}
+	CHECK(!adaptive.designAdaptive(BIQUAD_LOWPASS, 25, 0, 16000) && !adaptive.designAdaptive(BIQUAD_LOWPASS, 25, 2000, 2004),
+		"bad period range accepted");
+	exact.design(BIQUAD_LOWPASS, 25, 100);
+	adaptive.reset();
+	exact.reset();
+	maxDiff = 0;
+	for(int i=0; i<1000; i++) {
+		float x = (i/100 % 2)*100;
+		maxDiff = std::max(maxDiff, (double)fabs(adaptive.filter(x, 10000) - exact.filter(x)));
+	}
+	CHECK(maxDiff < 0.1, "rejected designs changed the filter, off by %g", maxDiff);
+
+	// The encoder setters report the same, and keep the cutoff in effect
+	hostEncoderRead = [](int) { return encoderTicks; };
+	bb::Encoder enc(6, 7);
+	CHECK(enc.speedFilterCutoff() == 25 && enc.positionFilterCutoff() == 25, "encoder doesn't start at 25Hz");
+	CHECK(enc.setSpeedFilterCutoff(10) == RES_OK && enc.speedFilterCutoff() == 10, "speed cutoff 10Hz not taken");
+	CHECK(enc.setPositionFilterCutoff(30) == RES_OK && enc.positionFilterCutoff() == 30, "position cutoff 30Hz not taken");
+	for(float co: bad) {
+		CHECK(enc.setSpeedFilterCutoff(co) == RES_COMMON_OUT_OF_RANGE && enc.speedFilterCutoff() == 10,
+			"speed cutoff %g accepted", co);
+		CHECK(enc.setPositionFilterCutoff(co) == RES_COMMON_OUT_OF_RANGE && enc.positionFilterCutoff() == 30,
+			"position cutoff %g accepted", co);
+	}
+	// 1000 ticks/s for 2s, settles on the speed
+	for(int i=0; i<200; i++) {
+		hostMicros += 10000;
+		encoderTicks += 10;
+		enc.update();
+	}
+	CHECK(fabs(enc.presentSpeed() - 1000) < 1 && fabs(enc.presentPosition() - encoderTicks) < 20,
+		"encoder filters at %g ticks/s, %g ticks", enc.presentSpeed(), enc.presentPosition());
+
+	// The encoder's case on this host, one adaptive sample with the period varying a little
+	volatile float sink;
+	BasicLowPassFilter<float> lp(25, 100, true);
+	BiquadCascade<2, 1, float> bq;
+	bq.designAdaptive(BIQUAD_LOWPASS, 25, 2000, 16000);
+	double lpNS = nsPerCall([&](int i) { hostMicros += 10000 + (i&7)*10; sink = lp.filter(float(i&63)); }, 2000000);
+	double bqNS = nsPerCall([&](int i) { sink = bq.filter(float(i&63), 10000 + (i&7)*10); }, 2000000);
+	printf("One adaptive 25Hz sample: LowPassFilter %.1fns, BiquadCascade<2, 1, float> %.1fns on this host\n", lpNS,
+		bqNS);
+
+	return hostTestResult();
+}
@@ -0,0 +1,245 @@
+//
+// Host test for the binary command server (BBCommandServer.h). Sends requests straight to handleRequest(): every
+// opcode, wrong types, out of range values, unknown names, paged listings, every truncation of a request and a
+// batch of random garbage. With --serve <port> it instead answers real datagrams on 127.0.0.1, which
+// check_command_client.py uses to test DroidGUI's CommandClient over loopback. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_command_server.cpp host/host.cpp ../src/*.cpp -o test_command_server && ./test_command_server && python3 check_command_client.py ./test_command_server
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace bb;
+
+// A subsystem with one parameter of each type, and enough long parameter names to need more than one listing.
+class CmdTest: public Subsystem {
+public:
+	static CmdTest cmdtest;
+	CmdTest() {
+		name_ = "cmdtest";
+		description_ = "Command server test subsystem";
+		gain_ = 1.0;
+		count_ = 10;
+		enabled_ = false;
+		strcpy(label_, "none");
+		for(int& p: long_) p = 0;
+		setParameters(parameterTable_);
+	}
+	Result start(ConsoleStream *stream) { (void)stream; started_ = true; operationStatus_ = RES_OK; return RES_OK; }
+	Result stop(ConsoleStream *stream) { (void)stream; started_ = false; operationStatus_ = RES_SUBSYS_NOT_STARTED; return RES_OK; }
+	Result step() { return RES_OK; }
+
+	float gain_;
+	int count_;
+	bool enabled_;
+	char label_[16];
+	int long_[12];
+	static const ParameterDescription parameterTable_[16];
+};
+CmdTest CmdTest::cmdtest;
+
+#define LONG_PARAM(n) BB_PARAM_INT("a_rather_long_parameter_name_" #n, "", CmdTest::cmdtest.long_[n], 0, 1000)
+const ParameterDescription CmdTest::parameterTable_[16] = {
+	BB_PARAM_FLOAT("gain", "", CmdTest::cmdtest.gain_, 0, 10),
+	BB_PARAM_INT("count", "", CmdTest::cmdtest.count_, 0, 100),
+	BB_PARAM_BOOL("enabled", "", CmdTest::cmdtest.enabled_),
+	BB_PARAM_STRING("label", "", CmdTest::cmdtest.label_),
+	LONG_PARAM(0), LONG_PARAM(1), LONG_PARAM(2), LONG_PARAM(3), LONG_PARAM(4), LONG_PARAM(5),
+	LONG_PARAM(6), LONG_PARAM(7), LONG_PARAM(8), LONG_PARAM(9), LONG_PARAM(10), LONG_PARAM(11)
+};
+
+// Filler subsystems so that the subsystem list needs several pages, too
+class Filler: public Subsystem {
+public:
+	Filler(const std::string& name): n_(name) { name_ = n_.c_str(); }
+	Result start(ConsoleStream *stream) { (void)stream; return RES_OK; }
+	Result stop(ConsoleStream *stream) { (void)stream; return RES_OK; }
+	Result step() { return RES_OK; }
+protected:
+	std::string n_;
+};
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes str(const char *s) {
+	Bytes b(s, s + strlen(s));
+	b.insert(b.begin(), uint8_t(b.size()));
+	return b;
+}
+static Bytes operator+(Bytes a, const Bytes& b) { a.insert(a.end(), b.begin(), b.end()); return a; }
+static Bytes u32(uint32_t v) { return {uint8_t(v), uint8_t(v >> 8), uint8_t(v >> 16), uint8_t(v >> 24)}; }
+static Bytes intValue(int32_t v) { return Bytes{PARAMETER_INT} + u32(v); }
+static Bytes floatValue(float f) { uint32_t u; memcpy(&u, &f, 4); return Bytes{PARAMETER_FLOAT} + u32(u); }
+static Bytes boolValue(bool v) { return {PARAMETER_BOOL, v}; }
+static Bytes stringValue(const char *s) { return Bytes{PARAMETER_STRING} + str(s); }
+
+// Sends a request and returns the whole response, empty if there is none. The request is copied into a buffer of
+// exactly its size, so that reads past the end show up under a sanitizer.
+static Bytes request(uint8_t opcode, const Bytes& args, uint16_t id = 0x1234) {
+	Bytes req = Bytes{CommandServer::MAGIC, uint8_t(id), uint8_t(id >> 8), opcode} + args;
+	uint8_t *buf = new uint8_t[req.size()];
+	memcpy(buf, req.data(), req.size());
+	uint8_t response[CommandServer::MAX_DATAGRAM_SIZE];
+	size_t len = CommandServer::server.handleRequest(buf, req.size(), response);
+	delete[] buf;
+	return Bytes(response, response + len);
+}
+
+static Result result(const Bytes& response) { return response.size() > 4 ? (Result)response[4] : RES_CMD_FAILURE; }
+
+// Serves handleRequest() on a UDP socket until killed
+static int serve(int port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	printf("serving on 127.0.0.1:%d\n", port);
+	fflush(stdout);
+	while(true) {
+		uint8_t req[CommandServer::MAX_DATAGRAM_SIZE], response[CommandServer::MAX_DATAGRAM_SIZE];
+		sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		ssize_t len = recvfrom(fd, req, sizeof(req), 0, (sockaddr*)&from, &fromLen);
+		if(len <= 0) continue;
+		size_t responseLen = CommandServer::server.handleRequest(req, len, response);
+		if(responseLen > 0) sendto(fd, response, responseLen, 0, (sockaddr*)&from, fromLen);
+	}
+}
+
+int main(int argc, char **argv) {
+	CmdTest::cmdtest.initialize();
+	for(int i=0; i<40; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "filler_subsystem_%02d", i);
+		(new Filler(name))->initialize(); // stays registered
+	}
+
+	if(argc > 2 && !strcmp(argv[1], "--serve")) return serve(atoi(argv[2]));
+
+	// Header: request ID and opcode echoed, response flag set
+	Bytes r = request(CommandServer::OP_PING, {}, 0xbeef);
+	CHECK(r.size() == 5 && r[0] == CommandServer::MAGIC && r[1] == 0xef && r[2] == 0xbe, "ping response");
+	CHECK(r.size() == 5 && r[3] == (CommandServer::OP_PING | CommandServer::RESPONSE_FLAG) && r[4] == RES_OK,
+		"ping response");
+	uint8_t notMagic[] = {0xb4, 0, 0, CommandServer::OP_PING}, response[] = {CommandServer::MAGIC, 0, 0, 0x80};
+	uint8_t out[CommandServer::MAX_DATAGRAM_SIZE];
+	CHECK(CommandServer::server.handleRequest(notMagic, sizeof(notMagic), out) == 0, "answered a foreign datagram");
+	CHECK(CommandServer::server.handleRequest(response, sizeof(response), out) == 0, "answered a response");
+	CHECK(result(request(0x55, {})) == RES_CMD_UNKNOWN_COMMAND, "unknown opcode");
+
+	// Get and set each type
+	r = request(CommandServer::OP_GET_PARAMETER, str("cmdtest") + str("count"));
+	CHECK(result(r) == RES_OK && r.size() == 10 && r[5] == PARAMETER_INT && r[6] == 10, "get count");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("gain") + floatValue(2.5))) == RES_OK,
+		"set gain");
+	CHECK(CmdTest::cmdtest.gain_ == 2.5f, "gain is %g", CmdTest::cmdtest.gain_);
+	r = request(CommandServer::OP_GET_PARAMETER, str("cmdtest") + str("gain"));
+	float gain = 0;
+	if(r.size() == 10) memcpy(&gain, &r[6], 4);
+	CHECK(result(r) == RES_OK && r[5] == PARAMETER_FLOAT && gain == 2.5f, "get gain");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("gain") + intValue(3))) == RES_OK,
+		"int for a float parameter");
+	CHECK(CmdTest::cmdtest.gain_ == 3.0f, "gain is %g", CmdTest::cmdtest.gain_);
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("enabled") + boolValue(true))) == RES_OK,
+		"set enabled");
+	CHECK(CmdTest::cmdtest.enabled_, "enabled not set");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("label") + stringValue("left"))) == RES_OK,
+		"set label");
+	r = request(CommandServer::OP_GET_PARAMETER, str("cmdtest") + str("label"));
+	CHECK(result(r) == RES_OK && r == Bytes(r.begin(), r.begin() + 5) + Bytes{PARAMETER_STRING} + str("left"),
+		"get label");
+
+	// Rejected sets leave the value alone
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("count") + intValue(101))) != RES_OK,
+		"count out of range accepted");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("count") + boolValue(true))) != RES_OK,
+		"bool for an int parameter accepted");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER,
+		str("cmdtest") + str("label") + stringValue("much too long for it"))) != RES_OK, "long label accepted");
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, str("cmdtest") + str("count") + Bytes{9, 1, 2, 3, 4})) ==
+		RES_PARAM_INVALID_TYPE, "unknown value type");
+	CHECK(CmdTest::cmdtest.count_ == 10 && !strcmp(CmdTest::cmdtest.label_, "left"), "rejected set changed a value");
+	CHECK(result(request(CommandServer::OP_GET_PARAMETER, str("nosuch") + str("count"))) == RES_SUBSYS_NO_SUCH_SUBSYS,
+		"unknown subsystem");
+	CHECK(result(request(CommandServer::OP_GET_PARAMETER, str("cmdtest") + str("nosuch"))) ==
+		RES_PARAM_NO_SUCH_PARAMETER, "unknown parameter");
+
+	// Start, stop, status
+	CHECK(result(request(CommandServer::OP_START, str("cmdtest"))) == RES_OK, "start");
+	r = request(CommandServer::OP_STATUS, str("cmdtest"));
+	CHECK(r.size() == 7 && r[5] == 1 && r[6] == RES_OK, "status after start");
+	CHECK(result(request(CommandServer::OP_STOP, str("cmdtest"))) == RES_OK, "stop");
+	r = request(CommandServer::OP_STATUS, str("cmdtest"));
+	CHECK(r.size() == 7 && r[5] == 0 && r[6] == RES_SUBSYS_NOT_STARTED, "status after stop");
+
+	// Listings come in pages that together hold every name once, in order
+	std::vector<std::string> names;
+	for(int pages=0;; pages++) {
+		r = request(CommandServer::OP_LIST_SUBSYSTEMS, {uint8_t(names.size())});
+		CHECK(result(r) == RES_OK && r.size() <= CommandServer::MAX_DATAGRAM_SIZE, "list subsystems");
+		if(result(r) != RES_OK || r[5] == 0) {
+			CHECK(pages > 1, "subsystem list in %d page(s)", pages);
+			break;
+		}
+		for(size_t i=6, n=0; n<r[5]; n++, i += 1 + r[i]) names.push_back(std::string((char*)&r[i+1], r[i]));
+	}
+	const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+	CHECK(names.size() == subsys.size(), "%d of %d subsystems listed", (int)names.size(), (int)subsys.size());
+	for(size_t i=0; i<names.size() && i<subsys.size(); i++) CHECK(names[i] == subsys[i]->name(), "%s", names[i].c_str());
+
+	names.clear();
+	for(int pages=0;; pages++) {
+		r = request(CommandServer::OP_LIST_PARAMETERS, str("cmdtest") + Bytes{uint8_t(names.size())});
+		CHECK(result(r) == RES_OK, "list parameters");
+		if(result(r) != RES_OK || r[5] == 0) {
+			CHECK(pages > 1, "parameter list in %d page(s)", pages);
+			break;
+		}
+		for(size_t i=6, n=0; n<r[5]; n++, i += 2 + r[i]) {
+			names.push_back(std::string((char*)&r[i+1], r[i]));
+			CHECK(r[i+1+r[i]] == CmdTest::parameterTable_[names.size()-1].type, "type of %s", names.back().c_str());
+		}
+	}
+	CHECK(names.size() == CmdTest::cmdtest.numParameters(), "%d parameters listed", (int)names.size());
+	for(size_t i=0; i<names.size() && i<CmdTest::cmdtest.numParameters(); i++)
+		CHECK(names[i] == CmdTest::parameterTable_[i].name, "%s", names[i].c_str());
+
+	// Every truncation of a valid request is rejected without touching anything
+	Bytes full = str("cmdtest") + str("count") + intValue(42);
+	for(size_t len=0; len<full.size(); len++) {
+		Result res = result(request(CommandServer::OP_SET_PARAMETER, Bytes(full.begin(), full.begin() + len)));
+		CHECK(res == RES_CMD_INVALID_ARGUMENT_COUNT, "request cut to %d bytes: result %d", (int)len, res);
+	}
+	CHECK(CmdTest::cmdtest.count_ == 10, "truncated request set count to %d", CmdTest::cmdtest.count_);
+	CHECK(result(request(CommandServer::OP_SET_PARAMETER, full)) == RES_OK && CmdTest::cmdtest.count_ == 42, "full set");
+
+	// Garbage gets an answer that fits a datagram, or none
+	std::mt19937 rng(3);
+	for(int i=0; i<200000; i++) {
+		Bytes args(rng() % 40);
+		for(auto& b: args) b = rng();
+		if(rng() % 2) args = str(rng() % 2 ? "cmdtest" : "filler_subsystem_07") + args;
+		r = request(rng() % 16, args, i);
+		if(r.empty() || r.size() > CommandServer::MAX_DATAGRAM_SIZE || r[1] != uint8_t(i)) {
+			CHECK(false, "bad response of %d bytes to random request %d", (int)r.size(), i);
+			break;
+		}
+	}
+
+	return hostTestResult();
+}
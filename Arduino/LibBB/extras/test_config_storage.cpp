@@ -0,0 +1,519 @@
+//
+// Host test for configuration storage (BBConfigStorage.h, BBFlashDevice.h) on a RAM flash that can lose power
+// after any word it programs or erases. Checks that 20000 saves spread their erases over all pages, that a
+// background save does at most one flash operation per runloop cycle, and that after thousands of power cuts at
+// random points every block reads back as the last completed save or the one in flight, never torn or older.
+// Blocks are found by name whatever order they are reserved in, older layouts are migrated up to the current
+// version or left invalid, blocks nobody reserves are dropped once the runloop runs, and a full index is reported.
+// Built for the SAMD21 it also checks that the platform device splits writes at flash pages; built for the RP2040
+// it checks that the EEPROM device commits once per store() and that the EEPROM image of older firmware is
+// imported. Build and run from this directory, once for each:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_config_storage.cpp host/host.cpp ../src/*.cpp -o test_config_storage && ./test_config_storage
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_RP2040 -Ihost -I../include test_config_storage.cpp host/host.cpp ../src/*.cpp -o test_config_storage && ./test_config_storage
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#if !defined(ARDUINO_ARCH_SAMD)
+#include <EEPROM.h>
+#endif
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace bb;
+
+struct PowerCut {};
+
+// NOR flash in RAM that stays across simulated boots. After cutAfter more words programmed or erased, power fails
+// in the middle of the operation: a program leaves a prefix programmed, an erase a prefix erased and the rest
+// scrambled.
+struct RAMFlash: public FlashDevice {
+	std::vector<uint8_t>& mem;
+	std::vector<unsigned long> erases;
+	long cutAfter = -1;
+	unsigned long ops = 0;
+	std::mt19937 rng{1};
+
+	RAMFlash(std::vector<uint8_t>& m): mem(m), erases(m.size() / 256) {}
+	size_t size() { return mem.size(); }
+	size_t eraseSize() { return 256; }
+	bool cut() { return cutAfter >= 0 && cutAfter-- == 0; }
+	Result erase(size_t addr) {
+		ops++;
+		erases[addr / 256]++;
+		for(size_t i=0; i<256; i+=4) {
+			if(cut()) {
+				for(size_t j=i; j<256; j++) mem[addr+j] &= rng();
+				throw PowerCut();
+			}
+			memset(&mem[addr+i], 0xff, 4);
+		}
+		return RES_OK;
+	}
+	Result program(size_t addr, const uint8_t *data, size_t len) {
+		ops++;
+		CHECK(addr % 4 == 0 && len % 4 == 0, "misaligned program of %d bytes at %d", (int)len, (int)addr);
+		for(size_t i=0; i<len; i+=4) {
+			if(cut()) throw PowerCut();
+			for(int j=0; j<4; j++) mem[addr+i+j] &= data[i+j];
+		}
+		return RES_OK;
+	}
+	Result read(size_t addr, uint8_t *data, size_t len) { memcpy(data, &mem[addr], len); return RES_OK; }
+};
+
+// ConfigStorage::storage is the only instance in the firmware; the test boots a new one every time.
+struct Storage: public ConfigStorage {};
+
+// Makes store() queue the blocks for step(), as it does while the runloop runs
+struct RunloopProbe: public Runloop {
+	void setStarted(bool started) { started_ = started; }
+};
+
+// Blocks shaped like the XBee, WifiServer and Remote parameters. Each starts with a save counter and the rest is
+// derived from it, so torn or mixed contents show.
+static const size_t sizes[] = {36, 76, 6};
+static const char *names[] = {"xbee", "wifi", "remote"};
+
+static void fill(uint8_t *b, size_t n, uint32_t v) {
+	for(size_t i=0; i<n; i++) b[i] = (uint8_t)(v*31 + i*7 + (v >> 8));
+	memcpy(b, &v, n < 4 ? 2 : 4);
+}
+
+static bool intact(const uint8_t *b, size_t n, uint32_t& v) {
+	v = 0;
+	memcpy(&v, b, n < 4 ? 2 : 4);
+	uint8_t expected[256];
+	fill(expected, n, v);
+	return memcmp(b, expected, n) == 0;
+}
+
+static void reserve(Storage& s, ConfigStorage::HANDLE *h) {
+	for(int i=0; i<3; i++) h[i] = s.reserveBlock(names[i], 1, sizes[i]);
+}
+
+// Three generations of an XBee-like parameter block
+struct XBeeV1 { int chan, pan, station, bps; char name[20]; };
+struct XBeeV2 { int chan, pan, station, bps; char name[20]; int retries; };            // field added
+struct XBeeV3 { uint16_t pan, station; uint8_t chan, retries; char name[20]; int bps; }; // repacked
+
+static bool v1to2(const uint8_t *from, size_t, uint8_t *to) {
+	memcpy(to, from, sizeof(XBeeV1));
+	((XBeeV2*)to)->retries = 3;
+	return true;
+}
+
+static bool v2to3(const uint8_t *from, size_t, uint8_t *to) {
+	const XBeeV2 *a = (const XBeeV2*)from;
+	XBeeV3 *b = (XBeeV3*)to;
+	if(a->chan > 255) return false;
+	b->pan = a->pan;
+	b->station = a->station;
+	b->chan = a->chan;
+	b->retries = a->retries;
+	memcpy(b->name, a->name, sizeof(b->name));
+	b->bps = a->bps;
+	return true;
+}
+
+static const ConfigMigration toV2[] = {{1, sizeof(XBeeV2), v1to2}};
+static const ConfigMigration toV3[] = {{1, sizeof(XBeeV2), v1to2}, {2, sizeof(XBeeV3), v2to3}};
+static const ConfigMigration onlyV2toV3[] = {{2, sizeof(XBeeV3), v2to3}};
+
+static void setRunloopStarted(bool started) {
+	static_cast<RunloopProbe&>(Runloop::runloop).setStarted(started);
+}
+
+int main() {
+	std::vector<uint8_t> mem(CONFIG_FLASH_SIZE, 0xff);
+	uint8_t buf[256];
+
+	// Wear: 20000 saves, mostly of the Remote block as with menu changes, spread their erases over all pages
+	{
+		RAMFlash flash(mem);
+		Storage s;
+		CHECK(s.initialize(&flash), "mount failed");
+		ConfigStorage::HANDLE h[3];
+		reserve(s, h);
+		for(uint32_t v=1; v<=20000; v++) {
+			int b = v % 10 == 0 ? 1 : 2;
+			fill(buf, sizes[b], v);
+			s.writeBlock(h[b], buf);
+			s.store();
+		}
+		auto minmax = std::minmax_element(flash.erases.begin(), flash.erases.end());
+		CHECK(*minmax.second - *minmax.first <= 1, "erases per page between %lu and %lu", *minmax.first,
+			*minmax.second);
+		printf("wear: 20000 saves, %lu records, %lu page erases, %lu to %lu per page\n", s.recordsWritten(),
+			s.pagesErased(), *minmax.first, *minmax.second);
+	}
+
+	// Background saves while the runloop runs: at most one flash operation per step()
+	{
+		std::fill(mem.begin(), mem.end(), 0xff);
+		RAMFlash flash(mem);
+		Storage s;
+		s.initialize(&flash);
+		ConfigStorage::HANDLE h[3];
+		reserve(s, h);
+		setRunloopStarted(true);
+		unsigned long steps = 0, maxOps = 0;
+		for(uint32_t v=1; v<=2000; v++) {
+			for(int b=0; b<3; b++) {
+				fill(buf, sizes[b], v);
+				s.writeBlock(h[b], buf);
+			}
+			unsigned long before = flash.ops;
+			CHECK(s.store() == RES_OK && flash.ops == before, "store() wrote to flash while the runloop runs");
+			while(s.busy()) {
+				before = flash.ops;
+				s.step();
+				steps++;
+				maxOps = std::max(maxOps, flash.ops - before);
+			}
+		}
+		setRunloopStarted(false);
+		CHECK(maxOps == 1, "up to %lu flash operations in one step()", maxOps);
+		printf("background: 2000 saves of all blocks in %lu steps, at most %lu flash operation per step\n", steps,
+			maxOps);
+	}
+
+	// Power cuts at random points, while mounting, saving or compacting
+	{
+		std::fill(mem.begin(), mem.end(), 0xff);
+		std::mt19937 rng(42);
+		uint32_t saved[3] = {0, 0, 0}, inflight[3] = {0, 0, 0}, v = 0;
+		unsigned long boots = 0, saves = 0, cuts = 0, bad = 0, rollbacks = 0;
+		for(int round=0; round<5000; round++) {
+			RAMFlash flash(mem);
+			Storage s;
+			flash.cutAfter = rng() % 200;
+			boots++;
+			try {
+				s.initialize(&flash);
+				ConfigStorage::HANDLE h[3];
+				reserve(s, h);
+				for(int b=0; b<3; b++) {
+					uint32_t got = 0;
+					if(!s.blockIsValid(h[b])) {
+						if(saved[b] != 0) bad++;
+						continue;
+					}
+					s.readBlock(h[b], buf);
+					if(!intact(buf, sizes[b], got)) bad++;
+					else if(got != saved[b] && got != inflight[b]) (got < saved[b] ? rollbacks : bad)++;
+					saved[b] = inflight[b] = got;
+				}
+				for(int k=0; k<10; k++) { // 50000 saves in all, so the Remote block's 16 bit counter doesn't wrap
+					int b = rng() % 3;
+					v++;
+					fill(buf, sizes[b], v);
+					s.writeBlock(h[b], buf);
+					inflight[b] = v;
+					s.store();
+					saved[b] = v;
+					saves++;
+				}
+			} catch(PowerCut&) {
+				cuts++;
+			}
+		}
+		CHECK(bad == 0 && rollbacks == 0, "%lu blocks torn or lost, %lu rolled back past a completed save", bad,
+			rollbacks);
+		printf("power cuts: %lu boots, %lu saves, %lu cuts, %lu blocks torn or lost, %lu rolled back\n", boots, saves,
+			cuts, bad, rollbacks);
+	}
+
+	// Found by name in any order, and migrated from older layouts
+	{
+		std::vector<uint8_t> memA(CONFIG_FLASH_SIZE, 0xff);
+		XBeeV1 x1 = {12, 0x3332, 0x1234, 115200, "droid"};
+		uint8_t w[76];
+		fill(w, sizeof(w), 77);
+		{
+			RAMFlash flash(memA);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 1, sizeof(x1)), hw = s.reserveBlock("wifi", 1, sizeof(w));
+			CHECK(s.reserveBlock("wifi", 1, 4) == 0, "name reserved twice");
+			s.writeBlock(hx, (uint8_t*)&x1);
+			s.writeBlock(hw, w);
+			s.store();
+		}
+		{
+			std::vector<uint8_t> m = memA;
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE hi = s.reserveBlock("imu", 1, 12), hw = s.reserveBlock("wifi", 1, sizeof(w));
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 1, sizeof(x1));
+			XBeeV1 rx;
+			CHECK(!s.blockIsValid(hi) && s.blockIsValid(hx) && s.blockIsValid(hw), "new block valid or old ones lost");
+			CHECK(s.readBlock(hx, (uint8_t*)&rx) == RES_OK && !memcmp(&rx, &x1, sizeof(x1)) &&
+				s.readBlock(hw, buf) == RES_OK && !memcmp(buf, w, sizeof(w)), "reordered blocks read back wrong");
+		}
+		std::vector<uint8_t> memC = memA;
+		{
+			RAMFlash flash(memC);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 2, sizeof(XBeeV2), toV2);
+			s.reserveBlock("wifi", 1, sizeof(w));
+			XBeeV2 r;
+			s.readBlock(hx, (uint8_t*)&r);
+			CHECK(s.blockIsValid(hx) && r.chan == 12 && r.pan == 0x3332 && r.bps == 115200 && !strcmp(r.name, "droid") &&
+				r.retries == 3, "v1 to v2 migrated wrong");
+			CHECK(s.blocksMigrated() == 1 && s.busy(), "migrated block not queued for saving");
+			s.flush();
+		}
+		{
+			RAMFlash flash(memC);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 2, sizeof(XBeeV2));
+			XBeeV2 r;
+			s.readBlock(hx, (uint8_t*)&r);
+			CHECK(s.blockIsValid(hx) && r.retries == 3 && s.blocksMigrated() == 0, "v2 not saved after migrating");
+		}
+		for(int from=0; from<2; from++) {
+			std::vector<uint8_t> m = from == 0 ? memA : memC;
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			s.reserveBlock("wifi", 1, sizeof(w));
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 3, sizeof(XBeeV3), toV3);
+			XBeeV3 r;
+			s.readBlock(hx, (uint8_t*)&r);
+			CHECK(s.blockIsValid(hx) && r.chan == 12 && r.pan == 0x3332 && r.station == 0x1234 && r.bps == 115200 &&
+				r.retries == 3 && !strcmp(r.name, "droid"), "v%d to v3 migrated wrong", from + 1);
+		}
+
+		// No path from v1, a downgrade, a failing migration, and a size change without a version bump
+		{
+			std::vector<uint8_t> m = memA;
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			CHECK(!s.blockIsValid(s.reserveBlock("xbee", 3, sizeof(XBeeV3), onlyV2toV3)), "migrated without a path");
+		}
+		{
+			std::vector<uint8_t> m = memC;
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE hx = s.reserveBlock("xbee", 1, sizeof(XBeeV1)), hw = s.reserveBlock("wifi", 1, sizeof(w));
+			CHECK(!s.blockIsValid(hx) && s.blockIsValid(hw), "newer version loaded by older firmware");
+		}
+		{
+			std::vector<uint8_t> m = memA;
+			XBeeV1 bad = x1;
+			bad.chan = 300;
+			{
+				RAMFlash flash(m);
+				Storage s;
+				s.initialize(&flash);
+				ConfigStorage::HANDLE hb = s.reserveBlock("xbee", 1, sizeof(bad));
+				s.writeBlock(hb, (uint8_t*)&bad);
+				s.store();
+			}
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			CHECK(!s.blockIsValid(s.reserveBlock("xbee", 3, sizeof(XBeeV3), toV3)), "failed migration loaded");
+		}
+		{
+			std::vector<uint8_t> m = memA;
+			RAMFlash flash(m);
+			Storage s;
+			s.initialize(&flash);
+			CHECK(!s.blockIsValid(s.reserveBlock("xbee", 1, sizeof(XBeeV2))), "size change loaded without migration");
+		}
+	}
+
+	// Blocks nobody reserves are kept until the runloop runs, then compaction drops them
+	{
+		std::fill(mem.begin(), mem.end(), 0xff);
+		const size_t n = 200;
+		{
+			RAMFlash flash(mem);
+			Storage s;
+			s.initialize(&flash);
+			for(const char *name: {"old1", "old2"}) {
+				ConfigStorage::HANDLE h = s.reserveBlock(name, 1, n);
+				fill(buf, n, name[3]);
+				s.writeBlock(h, buf);
+			}
+			s.store();
+		}
+		uint32_t v = 0, saved = 0;
+		for(int boot=0; boot<2; boot++) {
+			RAMFlash flash(mem);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE h = s.reserveBlock("new", 1, n);
+			setRunloopStarted(boot == 1);
+			unsigned long failed = 0;
+			for(size_t k=0; k<4*flash.erases.size(); k++) {
+				fill(buf, n, ++v);
+				s.writeBlock(h, buf);
+				s.store();
+				if(s.flush() == RES_OK) {
+					saved = v;
+					continue;
+				}
+				// Three of these records take three pages, which only leaves room on more than four
+				failed++;
+				unsigned long ops = flash.ops;
+				CHECK(s.step() != RES_OK && flash.ops == ops, "full log still compacted");
+			}
+			CHECK(boot == 0 || failed == 0, "%lu saves failed while the runloop runs", failed);
+			setRunloopStarted(false);
+			printf("%s: %lu of %lu saves failed\n", boot == 0 ? "unreserved blocks kept" : "unreserved blocks dropped",
+				failed, 4*flash.erases.size());
+
+			// All three don't fit in four pages, so look at them in separate boots
+			uint32_t got;
+			Storage r;
+			r.initialize(&flash);
+			ConfigStorage::HANDLE hn = r.reserveBlock("new", 1, n);
+			CHECK(r.blockIsValid(hn) && r.readBlock(hn, buf) == RES_OK && intact(buf, n, got) && got == saved,
+				"reserved block lost");
+			Storage t;
+			t.initialize(&flash);
+			ConfigStorage::HANDLE h1 = t.reserveBlock("old1", 1, n), h2 = t.reserveBlock("old2", 1, n);
+			if(boot == 0) {
+				CHECK(t.blockIsValid(h1) && t.readBlock(h1, buf) == RES_OK && intact(buf, n, got) && got == '1' &&
+					t.blockIsValid(h2) && t.readBlock(h2, buf) == RES_OK && intact(buf, n, got) && got == '2',
+					"unreserved blocks dropped before the runloop started");
+			} else {
+				CHECK(!t.blockIsValid(h1) && !t.blockIsValid(h2), "unreserved blocks kept while the runloop runs");
+			}
+		}
+	}
+
+	// A full index is reported, and slots of dropped blocks are free again
+	{
+		std::fill(mem.begin(), mem.end(), 0xff);
+		Console::console.initialize();
+		Console::console.removeConsoleStream(Console::console.serialStream());
+		StringConsoleStream console;
+		Console::console.addConsoleStream(&console);
+		char name[16];
+		{
+			RAMFlash flash(mem);
+			Storage s;
+			s.initialize(&flash);
+			for(int i=0; i<CONFIG_MAX_BLOCKS-1; i++) {
+				snprintf(name, sizeof(name), "a%d", i);
+				ConfigStorage::HANDLE h = s.reserveBlock(name, 1, 4);
+				CHECK(h != 0, "block %d not reserved", i);
+				s.writeBlock(h, (uint8_t*)&i);
+			}
+			s.store();
+		}
+		{
+			RAMFlash flash(mem);
+			Storage s;
+			s.initialize(&flash);
+			CHECK(s.reserveBlock("b0", 1, 4) != 0, "last free index slot not used");
+			CHECK(s.reserveBlock("b1", 1, 4) == 0 && s.indexOverflows() == 1, "block reserved in a full index");
+			console.drain();
+			CHECK(console.out.find("index full") != std::string::npos && console.out.find("\"b1\"") != std::string::npos,
+				"full index not reported: \"%s\"", console.out.c_str());
+		}
+		{
+			RAMFlash flash(mem);
+			Storage s;
+			s.initialize(&flash);
+			ConfigStorage::HANDLE h = s.reserveBlock("a0", 1, 4);
+			setRunloopStarted(true);
+			// Enough saves to compact every page, at 15 records per page
+			for(size_t k=0; k<40*flash.erases.size(); k++) {
+				s.writeBlock(h, (uint8_t*)&k);
+				s.store();
+				s.flush();
+			}
+			setRunloopStarted(false);
+			for(int i=0; i<CONFIG_MAX_BLOCKS-2; i++) {
+				snprintf(name, sizeof(name), "c%d", i);
+				CHECK(s.reserveBlock(name, 1, 4) != 0, "index slots of dropped blocks not reused");
+			}
+			CHECK(s.indexOverflows() == 0, "index overflowed");
+		}
+		Console::console.removeConsoleStream(&console);
+	}
+
+#if defined(ARDUINO_ARCH_SAMD)
+	// The SAMD21 programs 64 byte pages; writes that cross one must land where they were meant to
+	{
+		FlashDevice *device = FlashDevice::platformDevice();
+		CHECK(device->erase(0) == RES_OK, "erase");
+		uint8_t data[100], back[100];
+		for(size_t i=0; i<sizeof(data); i++) data[i] = i + 1;
+		CHECK(device->program(40, data, 100) == RES_OK && device->read(40, back, 100) == RES_OK &&
+			!memcmp(data, back, 100), "100 bytes programmed across two page boundaries read back wrong");
+		CHECK(device->read(0, back, 40) == RES_OK && back[0] == 0xff && back[39] == 0xff,
+			"bytes before the write changed");
+	}
+#else
+	// The EEPROM device commits once per store(), however many records and pages it writes
+	{
+		memset(EEPROM.data, 0xff, sizeof(EEPROM.data));
+		Storage s;
+		CHECK(s.initialize(FlashDevice::platformDevice()), "mount failed");
+		ConfigStorage::HANDLE h[3];
+		reserve(s, h);
+		unsigned long storeCommits = 0;
+		for(uint32_t v=1; v<=200; v++) {
+			for(int b=0; b<3; b++) {
+				fill(buf, sizes[b], v);
+				s.writeBlock(h[b], buf);
+			}
+			unsigned long before = EEPROM.commits;
+			s.store();
+			storeCommits = std::max(storeCommits, EEPROM.commits - before);
+		}
+		CHECK(storeCommits == 1, "up to %lu EEPROM commits for one store()", storeCommits);
+		printf("EEPROM: %lu records and %lu page erases in %lu commits\n", s.recordsWritten(), s.pagesErased(),
+			EEPROM.commits);
+	}
+
+	// The EEPROM image of older firmware: blocks back to back in reserveBlock() order behind a marker byte
+	{
+		memset(EEPROM.data, 0, sizeof(EEPROM.data));
+		uint8_t xbee[36], remote[6];
+		fill(xbee, sizeof(xbee), 1234);
+		fill(remote, sizeof(remote), 56);
+		EEPROM.data[0] = 0xba;
+		memcpy(EEPROM.data + 1, xbee, sizeof(xbee));
+		EEPROM.data[37] = 0;      // wifi was never saved
+		EEPROM.data[37+77] = 0xba;
+		memcpy(EEPROM.data + 37+77+1, remote, sizeof(remote));
+		unsigned long commits = EEPROM.commits;
+		{
+			Storage s;
+			s.initialize(FlashDevice::platformDevice());
+			ConfigStorage::HANDLE h[3];
+			reserve(s, h);
+			CHECK(s.blockIsValid(h[0]) && !s.blockIsValid(h[1]) && s.blockIsValid(h[2]), "old blocks not imported");
+			CHECK(s.readBlock(h[0], buf) == RES_OK && !memcmp(buf, xbee, sizeof(xbee)), "xbee imported wrong");
+			CHECK(s.readBlock(h[2], buf) == RES_OK && !memcmp(buf, remote, sizeof(remote)), "remote imported wrong");
+			CHECK(EEPROM.commits == commits, "old image overwritten before the import was saved");
+			CHECK(s.flush() == RES_OK && EEPROM.commits == commits + 1, "import saved in %lu commits",
+				EEPROM.commits - commits);
+		}
+		Storage s;
+		s.initialize(FlashDevice::platformDevice());
+		ConfigStorage::HANDLE h[3];
+		reserve(s, h);
+		CHECK(s.blockIsValid(h[0]) && s.readBlock(h[0], buf) == RES_OK && !memcmp(buf, xbee, sizeof(xbee)) &&
+			!s.blockIsValid(h[1]) && s.blockIsValid(h[2]), "imported blocks not in the log after a reboot");
+		CHECK(s.blocksMigrated() == 0, "imported again after a reboot");
+	}
+#endif
+
+	return hostTestResult();
+}
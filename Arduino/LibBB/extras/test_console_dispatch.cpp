@@ -0,0 +1,133 @@
+//
+// Host test for console command dispatch (Console::tokenize(), ConsoleCommand tables). Checks tokenizing with
+// quotes, argument signatures, and that once the console has run each command once, parsing and dispatching
+// commands - valid, invalid, quoted, overlong, parameter get and set, help and status reports - performs no heap
+// allocation at all. Allocations are counted by replacing the global operator new. Build and run from this
+// directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_console_dispatch.cpp host/host.cpp ../src/*.cpp -o test_console_dispatch && ./test_console_dispatch
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <chrono>
+#include <new>
+#include <string>
+
+using namespace bb;
+
+static long allocations = 0;
+void* operator new(size_t n) { allocations++; return malloc(n); }
+void* operator new[](size_t n) { allocations++; return malloc(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+static const char *commands[] = {
+	"runloop running_status off\r",
+	"log status\r",
+	"bulk abort\r",
+	"xbee group\r",
+	"xbee tdma\r",
+	"  log   \"status\"  \r",
+	"console get output_budget\r",
+	"console set output_budget 2000\r",
+	"console set output_budget 999999\r",
+	"console set no_such_param 1\r",
+	"runloop set cycle_time 9615\r",
+	"stage console output_budget 1500\r",
+	"staged\r",
+	"abort\r",
+	"log dump 0x7fffffff\r",
+	"nosuch cmd\r",
+	"runloop running_status maybe\r",
+	"log\r",
+	"help\r",
+	"status\r",
+	"log help\r",
+	"a b c d e f g h i j k l m n o p q r s t u v w x y z\r",
+	"\"unterminated quote\r",
+	"\r"
+};
+
+// Types cmd and runs the console until the reply, including any report, is complete. The reply is left in s.out,
+// whose capacity is reserved up front so keeping it doesn't allocate.
+static void run(StringConsoleStream& s, const char *cmd) {
+	s.out.clear();
+	s.in = cmd;
+	s.inPos = 0;
+	for(int i=0; i<1000 && (i == 0 || Console::console.reportRunning(&s) || s.outputQueued() > 0); i++) {
+		Console::console.step();
+	}
+}
+
+// Tokenizes line into args, which point into a static buffer, and copies the words
+static size_t tokens(const char *line, ConsoleArg *args, std::string *words) {
+	static char buf[128];
+	strcpy(buf, line);
+	size_t n = 0;
+	if(Console::tokenize(buf, args, CONSOLE_MAX_ARGS, n) != RES_OK) return ~0;
+	for(size_t i=0; i<n; i++) words[i] = args[i].c_str();
+	return n;
+}
+
+// Registers the XBee subsystem without talking to a module
+struct XBeeProbe: public XBee {
+	Result initializeWithoutModule() { return Subsystem::initialize(); }
+};
+
+int main() {
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.start();
+	Log::log.initialize();
+	Log::log.start();
+	BulkTransfer::bulk.initialize();
+	Runloop::runloop.initialize();
+	static_cast<XBeeProbe&>(XBee::xbee).initializeWithoutModule();
+	StringConsoleStream s;
+	s.out.reserve(1 << 16);
+	Console::console.addConsoleStream(&s);
+
+	// Tokenizer
+	ConsoleArg args[CONSOLE_MAX_ARGS];
+	std::string w[CONSOLE_MAX_ARGS];
+	CHECK(tokens("  a  bc\td ", args, w) == 3 && w[0] == "a" && w[1] == "bc" && w[2] == "d", "plain words");
+	CHECK(tokens("set \"a b\" c", args, w) == 3 && w[1] == "a b" && w[2] == "c", "quoted word");
+	CHECK(tokens("x\"y z\"", args, w) == 2 && w[0] == "x" && w[1] == "y z", "quote right after a word");
+	CHECK(tokens("\"\"", args, w) == 1 && w[0] == "", "empty quotes");
+	CHECK(tokens("", args, w) == 0, "empty line");
+	CHECK(tokens("a b c d e f g h i j k l m n o p q r s t u v w x y z", args, w) == (size_t)~0, "too many words");
+	CHECK(tokens("0x10 -3 2.5 on", args, w) == 4 && args[0].isInt() && args[0].toInt() == 16 && args[1].toInt() == -3 &&
+		args[2].isFloat() && !args[2].isInt() && args[3].isBool(), "argument types");
+
+	// Signatures are checked before the handler runs
+	run(s, "runloop running_status\r");
+	CHECK(s.out.find(errorMessage(RES_CMD_INVALID_ARGUMENT_COUNT)) != std::string::npos, "missing argument accepted: %s",
+		s.out.c_str());
+	run(s, "runloop running_status maybe\r");
+	CHECK(s.out.find(errorMessage(RES_CMD_INVALID_ARGUMENT)) != std::string::npos, "bad bool accepted: %s",
+		s.out.c_str());
+
+	// Steady state: the first round may allocate (e.g. lazily built tables), the second must not
+	for(const char *cmd: commands) run(s, cmd);
+	long before = allocations;
+	size_t replyBytes = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for(const char *cmd: commands) {
+		long b = allocations;
+		run(s, cmd);
+		CHECK(allocations == b, "\"%.*s\" allocated %ld times", (int)strlen(cmd) - 1, cmd, allocations - b);
+		CHECK(s.out.size() > 2 && s.out.compare(s.out.size() - 2, 2, "> ") == 0, "no complete reply to \"%.*s\": %s",
+			(int)strlen(cmd) - 1, cmd, s.out.c_str());
+		replyBytes += s.out.size();
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	printf("%d commands in steady state: %d bytes of replies, %ld allocations, %.1fus per command on this host\n",
+		(int)(sizeof(commands)/sizeof(commands[0])), (int)replyBytes, allocations - before,
+		std::chrono::duration<double, std::micro>(t1 - t0).count() / (sizeof(commands)/sizeof(commands[0])));
+
+	return hostTestResult();
+}
@@ -0,0 +1,169 @@
+//
+// Host test for buffered console output (ConsoleStream in BBConsole.h). A throttled fake stream stands in for a
+// serial port or telnet client behind a small FIFO. Checks that:
+//  - broadcasts from the runloop never make a cycle wait longer than the output budget, however slow the client,
+//    and that what doesn't fit is dropped, counted and reported;
+//  - the reply to a command typed on a slow stream waits for room instead of being dropped, a running report
+//    isn't starved by broadcasts, and a stalled client costs the wait time once, not on every command;
+//  - everything that isn't dropped comes out intact and in order while the ring buffer wraps around.
+// Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_console_output.cpp host/host.cpp ../src/*.cpp -o test_console_output && ./test_console_output
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <random>
+#include <string>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 1000000 / 104;
+
+// Takes rate bytes/s through a 64 byte FIFO, or at most maxChunk bytes per call if rate is 0. Every call costs
+// 2us of simulated time, like asking a UART or WiFi module how much it takes.
+struct ThrottledStream: public ConsoleStream {
+	double rate, level = 0;
+	size_t maxChunk = 0;
+	unsigned long last = 0;
+	std::string in, out;
+	size_t inPos = 0;
+	ThrottledStream(double r, unsigned long waitUS) : rate(r) {
+		setOverflowPolicy(OVERFLOW_WAIT, waitUS);
+		setEcho(true);
+	}
+	bool available() { return inPos < in.size(); }
+	char* readLine() {
+		while(inPos < in.size()) {
+			if(addToLine((uint8_t)in[inPos++])) return editor_.line();
+		}
+		return NULL;
+	}
+	void type(const char *line) { in = line; inPos = 0; }
+protected:
+	size_t writeNonBlocking(const uint8_t *buf, size_t len) {
+		hostMicros += 2;
+		if(rate == 0) {
+			if(len > maxChunk) len = maxChunk;
+		} else {
+			level -= (hostMicros - last) * rate / 1e6;
+			if(level < 0) level = 0;
+			last = hostMicros;
+			size_t room = 64 - (size_t)level;
+			if(len > room) len = room;
+			level += len;
+		}
+		out.append((const char*)buf, len);
+		return len;
+	}
+};
+
+// Runs cycles of the runloop with a status broadcast in each, typing line into s at cycle typeAt. Returns the
+// longest cycle apart from the one that handled the typed line, whose duration goes into replyUS.
+static unsigned long run(ThrottledStream& s, int cycles, int typeAt, const char *line, unsigned long& replyUS) {
+	unsigned long longest = 0;
+	for(int c=0; c<cycles; c++) {
+		unsigned long start = hostMicros;
+		if(c == typeAt) s.type(line);
+		Console::console.printfBroadcast("cycle %6d: speed %8.3f, pos %8.3f, balance %7.3f, battery %6.2fV, %s\n", c,
+			c * 0.01, c * 0.1, c * 0.001, 15.2, "status ok");
+		Console::console.step();
+		unsigned long us = hostMicros - start;
+		if(c == typeAt) replyUS = us;
+		else if(us > longest) longest = us;
+		hostMicros = start + CYCLE_US;
+	}
+	return longest;
+}
+
+int main() {
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.start();
+	int budget = 1000;
+	Console::console.setParameterValue("output_budget", "1000");
+
+	// 1 kB/s, a telnet client on a bad link: output can't keep up with the broadcasts
+	ThrottledStream slow(1000, 20000);
+	Console::console.addConsoleStream(&slow);
+	unsigned long replyUS = 0;
+	unsigned long longest = run(slow, 1000, -1, "", replyUS);
+	CHECK(longest <= (unsigned long)budget + 10, "a cycle with only broadcasts took %luus", longest);
+	CHECK(slow.droppedBytes() > 0, "nothing dropped at 1 kB/s");
+	CHECK(slow.out.find(" bytes dropped]") != std::string::npos, "drops not reported");
+	printf("1 kB/s: longest cycle %luus, %lu bytes written, %lu dropped\n", longest, slow.writtenBytes(),
+		slow.droppedBytes());
+	Console::console.removeConsoleStream(&slow);
+
+	// 115200 baud: a command typed while the buffer is full of broadcasts still gets its full reply. "console
+	// status" is a report printed over several cycles, which the broadcasts must not starve.
+	ThrottledStream serial(11520, 20000);
+	Console::console.addConsoleStream(&serial);
+	longest = run(serial, 600, 300, "console status\r", replyUS);
+	CHECK(longest <= (unsigned long)budget + 10, "a cycle with only broadcasts took %luus", longest);
+	CHECK(serial.droppedBytes() > 0, "broadcasts were not dropped at 115200 baud");
+	size_t reply = serial.out.find("console: 1 streams\n\tStream 0: ");
+	CHECK(reply != std::string::npos, "reply to the command is missing");
+	CHECK(serial.out.find("OK.\n> ", reply) != std::string::npos, "report didn't finish");
+	printf("115200 baud: longest cycle %luus, the one with the reply %luus, %lu bytes dropped\n", longest, replyUS,
+		serial.droppedBytes());
+	Console::console.removeConsoleStream(&serial);
+
+	// A client that takes nothing: the first command waits, the next one doesn't
+	ThrottledStream stalled(0, 20000);
+	Console::console.addConsoleStream(&stalled);
+	run(stalled, 50, -1, "", replyUS);
+	unsigned long firstUS = 0, secondUS = 0;
+	run(stalled, 2, 1, "console status\r", firstUS);
+	run(stalled, 2, 1, "console status\r", secondUS);
+	CHECK(firstUS >= 20000 && firstUS < 3 * 20000, "first command on a stalled stream took %luus", firstUS);
+	CHECK(secondUS <= (unsigned long)budget + 10, "second command on a stalled stream took %luus", secondUS);
+	printf("stalled: first command %luus, second %luus\n", firstUS, secondUS);
+	Console::console.removeConsoleStream(&stalled);
+
+	// Random message sizes and partial writes: what comes out is whole messages in order, plus drop notes that
+	// add up to the dropped bytes
+	ThrottledStream partial(0, 0);
+	partial.setOverflowPolicy(ConsoleStream::OVERFLOW_DROP);
+	std::mt19937 rng(5);
+	std::vector<std::string> messages;
+	size_t droppedLen = 0;
+	for(int i=0; i<20000; i++) {
+		std::string body(rng() % 300, 'a' + i % 26);
+		char msg[400];
+		snprintf(msg, sizeof(msg), "<%06d:%s>\n", i, body.c_str());
+		unsigned long before = partial.droppedBytes();
+		if(rng() % 2) partial.printf("<%06d:%s>\n", i, body.c_str());
+		else partial.print(msg);
+		if(partial.droppedBytes() == before) messages.push_back(msg);
+		else droppedLen += strlen(msg);
+		partial.maxChunk = rng() % 200;
+		partial.flush(rng() % 3 == 0 ? 0 : 100);
+	}
+	partial.maxChunk = ~0;
+	partial.flush(~0ul);
+	std::string expected;
+	unsigned long reported = 0;
+	size_t pos = 0, next = 0;
+	while(pos < partial.out.size()) {
+		unsigned long n;
+		int len = 0;
+		if(sscanf(partial.out.c_str() + pos, "\n[%lu bytes dropped]\n%n", &n, &len) == 1 && len > 0) {
+			reported += n;
+			pos += len;
+		} else if(next < messages.size() && partial.out.compare(pos, messages[next].size(), messages[next]) == 0) {
+			pos += messages[next++].size();
+		} else {
+			CHECK(false, "garbled output at byte %d of %d", (int)pos, (int)partial.out.size());
+			break;
+		}
+	}
+	CHECK(next == messages.size(), "%d of %d messages came out", (int)next, (int)messages.size());
+	CHECK(reported == partial.droppedBytes() && droppedLen == partial.droppedBytes(),
+		"%lu bytes reported dropped, %lu counted, %d in dropped messages", reported, partial.droppedBytes(),
+		(int)droppedLen);
+	printf("partial writes: %d messages intact, %d dropped\n", (int)messages.size(), 20000 - (int)messages.size());
+
+	return hostTestResult();
+}
@@ -0,0 +1,220 @@
+//
+// Host test for console reports (Console::startReport()): "help", "status" and "<subsys> help" with 20 fake
+// subsystems, typed on a stream that takes 115200 baud through a 64 byte FIFO. Checks that every runloop cycle
+// generates at most about one chunk of the report and stays within the output budget, that the report comes out
+// the same as when printed in one go, that typing something interrupts it, and that the top level help lists
+// exactly the commands there are. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_console_report.cpp host/host.cpp ../src/*.cpp -o test_console_report && ./test_console_report
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <chrono>
+#include <string>
+#include <utility>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 1000000 / 104;
+
+// 11520 bytes/s through a 64 byte FIFO. Every call costs 2us of simulated time.
+struct SerialStream: public StringConsoleStream {
+	double level = 0;
+	unsigned long last = 0;
+	size_t generated = 0; // bytes put into the output buffer, whether written out yet or not
+	SerialStream() { setOverflowPolicy(OVERFLOW_WAIT, 20000); setEcho(true); }
+	size_t generatedBytes() { return generated + outputQueued(); }
+protected:
+	size_t writeNonBlocking(const uint8_t *buf, size_t len) {
+		hostMicros += 2;
+		level -= (hostMicros - last) * 11520 / 1e6;
+		if(level < 0) level = 0;
+		last = hostMicros;
+		size_t room = 64 - (size_t)level;
+		if(len > room) len = room;
+		level += len;
+		generated += len;
+		out.append((const char*)buf, len);
+		return len;
+	}
+};
+
+// Subsystems with eight parameters and a long status each
+template<int I> class Fake: public Subsystem {
+public:
+	static Fake fake;
+	Fake() {
+		snprintf(name__, sizeof(name__), "fake%02d", I);
+		name_ = name__;
+		description_ = "Fake subsystem for the report test";
+		help_ = "Does nothing, but has parameters and a long status.";
+		for(int j=0; j<4; j++) {
+			ints_[j] = j;
+			floats_[j] = j * 0.25;
+		}
+		setParameters(parameterTable_);
+	}
+	Result start(ConsoleStream*) { started_ = true; operationStatus_ = RES_OK; return RES_OK; }
+	Result stop(ConsoleStream*) { started_ = false; return RES_OK; }
+	Result step() { return RES_OK; }
+	void printStatus(ConsoleStream *stream) {
+		Subsystem::printStatus(stream);
+		stream->printf("\tcounters: %d %d %d %d, gains %f %f %f %f\n", ints_[0], ints_[1], ints_[2], ints_[3],
+			floats_[0], floats_[1], floats_[2], floats_[3]);
+	}
+
+	char name__[8];
+	int ints_[4];
+	float floats_[4];
+	static const ParameterDescription parameterTable_[8];
+};
+template<int I> Fake<I> Fake<I>::fake;
+template<int I> const ParameterDescription Fake<I>::parameterTable_[8] = {
+	BB_PARAM_INT("int_param_0", "An integer parameter", Fake<I>::fake.ints_[0], -100, 100),
+	BB_PARAM_INT("int_param_1", "An integer parameter", Fake<I>::fake.ints_[1], -100, 100),
+	BB_PARAM_INT("int_param_2", "An integer parameter", Fake<I>::fake.ints_[2], -100, 100),
+	BB_PARAM_INT("int_param_3", "An integer parameter", Fake<I>::fake.ints_[3], -100, 100),
+	BB_PARAM_FLOAT("float_param_0", "A float parameter", Fake<I>::fake.floats_[0], -1, 1),
+	BB_PARAM_FLOAT("float_param_1", "A float parameter", Fake<I>::fake.floats_[1], -1, 1),
+	BB_PARAM_FLOAT("float_param_2", "A float parameter", Fake<I>::fake.floats_[2], -1, 1),
+	BB_PARAM_FLOAT("float_param_3", "A float parameter", Fake<I>::fake.floats_[3], -1, 1)
+};
+
+template<int... I> static void initializeFakes(std::integer_sequence<int, I...>) {
+	(Fake<I>::fake.initialize(), ...);
+	(Fake<I>::fake.start(NULL), ...);
+}
+
+struct ConsoleProbe: public Console {
+	bool hasTopLevelCommand(const ConsoleArg& name) { return findCommand(commands_, numCommands_, name) != NULL; }
+	static bool hasStandardCommand(const ConsoleArg& name) {
+		return findCommand(standardCommands_, numStandardCommands_, name) != NULL;
+	}
+	size_t numTopLevelCommands() { return numCommands_; }
+	static size_t numStandardCommands() { return numStandardCommands_; }
+};
+
+struct Run {
+	int cycles;               // until the report was complete and written out
+	size_t maxChunk;          // most bytes generated in one cycle
+	unsigned long maxStepUS;  // longest Console::step() in simulated time
+	double maxStepHostUS;     // and on this host
+};
+
+// Types cmd and runs cycles until the reply is out. Hits return at cycle interruptAt.
+static Run run(SerialStream& s, const char *cmd, int interruptAt = -1) {
+	Run r = {0, 0, 0, 0};
+	s.out.clear();
+	s.in = cmd;
+	s.inPos = 0;
+	for(int c=0; c<2000; c++) {
+		if(c == interruptAt) {
+			s.in = "\r";
+			s.inPos = 0;
+		}
+		unsigned long start = hostMicros;
+		size_t before = s.generatedBytes();
+		auto t0 = std::chrono::steady_clock::now();
+		Console::console.step();
+		auto t1 = std::chrono::steady_clock::now();
+		// The cycle that reads the command starts the report, replies and echoes, so it doesn't count
+		if(c > 0) {
+			r.maxChunk = std::max(r.maxChunk, s.generatedBytes() - before);
+			r.maxStepUS = std::max(r.maxStepUS, hostMicros - start);
+			r.maxStepHostUS = std::max(r.maxStepHostUS, std::chrono::duration<double, std::micro>(t1 - t0).count());
+		}
+		hostMicros = start + CYCLE_US;
+		r.cycles = c + 1;
+		if(c > 0 && !Console::console.reportRunning(&s) && s.outputQueued() == 0 && !s.available()) break;
+	}
+	return r;
+}
+
+// Waits for room like a reply, so nothing is dropped however much is printed at once
+struct ReplyStream: public StringConsoleStream {
+	ReplyStream() { replying_ = true; }
+};
+
+// The echo of cmd and the reply as printed in one go
+static std::string synchronous(const char *cmd, void (*print)(ConsoleStream*)) {
+	ReplyStream s;
+	s.print(cmd);
+	s.print("\n\r");
+	print(&s);
+	s.print("OK.\n> ");
+	s.drain();
+	return s.out;
+}
+
+// Without the console's stream statistics, which change while the report is printed
+static std::string withoutStreamStatus(std::string s) {
+	size_t pos;
+	while((pos = s.find("\tStream ")) != std::string::npos) s.erase(pos, s.find('\n', pos) + 1 - pos);
+	return s;
+}
+
+static void check(const char *cmd, const Run& r, const std::string& out, const std::string& expected) {
+	// An item may start when the chunk is nearly full, and the longest one is a fake's status
+	const size_t maxChunk = CONSOLE_REPORT_CHUNK_SIZE + 160;
+	CHECK(withoutStreamStatus(out) == withoutStreamStatus(expected), "\"%s\" differs from the report printed in one go:\n%s\n---\n%s", cmd, out.c_str(),
+		expected.c_str());
+	CHECK(r.maxChunk <= maxChunk, "\"%s\" generated %d bytes in one cycle", cmd, (int)r.maxChunk);
+	CHECK(r.maxStepUS <= 1000 + 10, "\"%s\": a cycle took %luus", cmd, r.maxStepUS);
+	printf("%-12s %5d bytes over %3d cycles, at most %3d bytes and %4luus (%.1fus on this host) per cycle\n", cmd,
+		(int)out.size(), r.cycles, (int)r.maxChunk, r.maxStepUS, r.maxStepHostUS);
+}
+
+int main() {
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.start();
+	initializeFakes(std::make_integer_sequence<int, 20>());
+	SerialStream s;
+	Console::console.addConsoleStream(&s);
+
+	Run r = run(s, "status\r");
+	check("status", r, s.out, synchronous("status", [](ConsoleStream *c) { Console::console.printStatusAllSubsystems(c); }));
+	CHECK(s.out.find("fake19 (Fake subsystem for the report test): started, operational\n") != std::string::npos,
+		"status of the last fake is missing");
+
+	r = run(s, "help\r");
+	check("help", r, s.out, synchronous("help", [](ConsoleStream *c) { Console::console.printHelpAllSubsystems(c); }));
+
+	r = run(s, "fake07 help\r");
+	check("fake07 help", r, s.out, synchronous("fake07 help", [](ConsoleStream *c) { Fake<7>::fake.printHelp(c); }));
+	CHECK(s.out.find("\nfloat_param_3: 0.750000 [-1..1]: A float parameter\n") != std::string::npos, "last parameter missing: %s",
+		s.out.c_str());
+
+	// Typing something ends the report
+	r = run(s, "status\r", 5);
+	CHECK(s.out.find("\n[interrupted]\n> ") != std::string::npos, "report not interrupted");
+	CHECK(s.out.find("fake19") == std::string::npos, "report went on after it was interrupted");
+	CHECK(r.cycles < 20, "interrupted report took %d cycles", r.cycles);
+
+	// The top level help lists every top level command and every standard subsystem command, and nothing else
+	run(s, "help\r");
+	ConsoleProbe& probe = static_cast<ConsoleProbe&>(Console::console);
+	int topLevel = 0, standard = 0;
+	size_t pos = 0;
+	while((pos = s.out.find("\n\t", pos)) != std::string::npos) {
+		pos += 2;
+		bool subsys = s.out.compare(pos, 9, "<subsys> ") == 0;
+		if(subsys) pos += 9;
+		size_t end = s.out.find_first_of(" :", pos);
+		std::string name = s.out.substr(pos, end - pos);
+		ConsoleArg arg(name.c_str(), name.size());
+		if(subsys) {
+			standard++;
+			CHECK(ConsoleProbe::hasStandardCommand(arg), "help lists \"<subsys> %s\", which doesn't exist", name.c_str());
+		} else {
+			topLevel++;
+			CHECK(probe.hasTopLevelCommand(arg), "help lists \"%s\", which doesn't exist", name.c_str());
+		}
+	}
+	CHECK(topLevel == (int)probe.numTopLevelCommands() && standard == (int)ConsoleProbe::numStandardCommands(),
+		"help lists %d top level and %d subsystem commands", topLevel, standard);
+
+	return hostTestResult();
+}
@@ -0,0 +1,128 @@
+//
+// Host test for the droid->remote telemetry scheduler (BBDownlinkScheduler.h), with DODroid's three items at 100Hz
+// and several downlink_budget values. Control comes either from two remotes every cycle, seen when the droid
+// handles it at the start of its cycle as DODroid does, or every few cycles at a drifting phase, seen when it
+// arrives. Checks that the airtime stays within the budget and uses most of it, that no item is scheduled while
+// control is due, and that the items take turns by priority. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_downlink_scheduler.cpp host/host.cpp ../src/*.cpp -o test_downlink_scheduler && ./test_downlink_scheduler
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 10000;
+static const unsigned long CYCLES = 100000;
+static const uint8_t PRIORITIES[] = {4, 2, 1}; // drive, subsystems, battery as in DODroid
+static const int NUM_ITEMS = sizeof(PRIORITIES);
+
+struct Run {
+	float airtime;
+	unsigned long frames, skippedBudget, skippedControl;
+	unsigned long sentWhileDue; // items scheduled with a control packet due within the guard time
+	unsigned long sends[NUM_ITEMS], longestGap[NUM_ITEMS];
+};
+
+// Control every cycle from two remotes (handled at the start of the droid's cycle), or every periodCycles cycles
+// from one remote on a clock 300ppm slow with some jitter (noted when it arrives).
+static Run run(float budget, int periodCycles) {
+	std::mt19937 rng(periodCycles);
+	std::uniform_int_distribution<int> jitter(-200, 200);
+	const unsigned long guardUS = 3000, sendAtUS = 1500;
+
+	hostMicros = 1000000;
+	DownlinkScheduler s(budget);
+	s.setGuardTimeUS(guardUS);
+	for(uint8_t p: PRIORITIES) s.addItem(p);
+
+	Run r = {};
+	unsigned long lastSent[NUM_ITEMS] = {};
+	unsigned long start = hostMicros;
+	double period = periodCycles * CYCLE_US * 1.0003, nextControl = start + 3456;
+	for(unsigned long c=0; c<CYCLES; c++) {
+		unsigned long cycleStart = start + c*CYCLE_US;
+		if(periodCycles == 0) {
+			hostMicros = cycleStart + 200;
+			s.noteControlTraffic();
+			hostMicros = cycleStart + 250;
+			s.noteControlTraffic();
+		} else {
+			while(nextControl < cycleStart + sendAtUS) {
+				hostMicros = lround(nextControl) + jitter(rng);
+				s.noteControlTraffic();
+				nextControl += period;
+			}
+		}
+		if(c == 100) s.resetStats(); // past the first period estimates
+
+		hostMicros = cycleStart + sendAtUS;
+		int item = s.schedule();
+		if(item < 0 || c < 100) {
+			if(item >= 0) s.sent(item);
+			continue;
+		}
+		if(periodCycles != 0 && nextControl - hostMicros < guardUS - 500) r.sentWhileDue++;
+		s.sent(item);
+		if(lastSent[item] != 0) r.longestGap[item] = std::max(r.longestGap[item], c - lastSent[item]);
+		lastSent[item] = c;
+		r.sends[item]++;
+	}
+	hostMicros = start + CYCLES*CYCLE_US;
+	r.airtime = s.airtimeUsed();
+	r.frames = s.framesSent();
+	r.skippedBudget = s.skippedBudget();
+	r.skippedControl = s.skippedControl();
+	return r;
+}
+
+int main() {
+	const float frameShare = float(DownlinkScheduler::frameAirtimeUS(8)) / CYCLE_US; // one frame in every cycle
+
+	printf("budget  control     airtime  frames  skipped: budget  control  drive/subsys/battery  longest gaps\n");
+	for(float budget: {0.02f, 0.05f, 0.1f, 0.2f, 0.5f}) {
+		for(int periodCycles: {0, 4, 9}) {
+			Run r = run(budget, periodCycles);
+			char control[16];
+			if(periodCycles == 0) snprintf(control, sizeof(control), "every cycle");
+			else snprintf(control, sizeof(control), "1 in %d", periodCycles);
+			printf("%5.0f%%  %-11s %6.1f%%  %6lu  %15lu  %7lu  %6lu/%lu/%lu  %12lu/%lu/%lu\n", budget*100, control,
+				r.airtime*100, r.frames, r.skippedBudget, r.skippedControl, r.sends[0], r.sends[1], r.sends[2],
+				r.longestGap[0], r.longestGap[1], r.longestGap[2]);
+
+			// Budget: never above it, and all of it unless one frame per cycle or the control cycles limit it
+			float free = periodCycles == 0 ? 1.0f : 1.0f - 1.0f/periodCycles;
+			float reachable = std::min(budget, frameShare * free);
+			CHECK(r.airtime <= budget + 1e-4f, "%g budget, control %s: %.2f%% airtime", budget, control, r.airtime*100);
+			CHECK(r.airtime >= 0.9f * reachable, "%g budget, control %s: %.2f%% airtime of %.2f%% reachable", budget,
+				control, r.airtime*100, reachable*100);
+
+			// Control: nothing goes out while it is due; every cycle from the remotes leaves no cycle free of it,
+			// but the droid handles it at the start of the cycle and has the rest of the cycle to send
+			CHECK(r.sentWhileDue == 0, "%g budget, control %s: %lu items scheduled with control due", budget, control,
+				r.sentWhileDue);
+			if(periodCycles != 0 && budget * periodCycles > frameShare) {
+				CHECK(r.skippedControl > 0, "%g budget, control %s: no cycles skipped for control", budget, control);
+			}
+
+			// Priorities: every item goes out, more often the higher its priority, none waiting much longer than
+			// its share would have it
+			for(int i=0; i<NUM_ITEMS; i++) {
+				CHECK(r.sends[i] > 0, "%g budget, control %s: item %d never sent", budget, control, i);
+				if(i > 0) CHECK(r.sends[i] < r.sends[i-1], "%g budget, control %s: item %d sent %lu times, item %d %lu",
+					budget, control, i, r.sends[i], i-1, r.sends[i-1]);
+				if(r.sends[i] > 0) {
+					double meanGap = double(CYCLES - 100) / r.sends[i];
+					CHECK(r.longestGap[i] <= 3*meanGap, "%g budget, control %s: item %d waited %lu cycles, %.1f on "
+						"average", budget, control, i, r.longestGap[i], meanGap);
+				}
+			}
+		}
+	}
+
+	return hostTestResult();
+}
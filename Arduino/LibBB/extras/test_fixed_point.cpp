@@ -0,0 +1,387 @@
+//
+// Host test and benchmark for the fixed point control path (BBFixedPoint.h, BBMadgwick.h, BBControllers.h,
+// BBLowPassFilter.h). Runs the Madgwick filter over 60s of synthetic D-O motion at 104Hz against the Arduino
+// Madgwick library's math, the PID controller on a noisy first order plant and the low pass on noisy steps, in
+// float and in fixed point, and checks how far apart they end up. Also checks that acceleration in raw counts
+// works in Q8.24 and that fromMicros() saturates. Last, counts the operations per update with counting scalar
+// types and turns them into M0+ cycle estimates, from assumed soft float and fixed point costs that have not been
+// measured on hardware. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_fixed_point.cpp host/host.cpp ../src/*.cpp -o test_fixed_point && ./test_fixed_point
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace bb;
+
+// Operation counting scalar types, float and fixed point
+struct Ops {
+	long add = 0, mul = 0, div = 0, cmp = 0, conv = 0, sqrt = 0;
+};
+static Ops ops;
+
+struct CF {
+	float v;
+	CF(): v(0) {}
+	CF(int i): v(i) { ops.conv++; }
+	CF(float f): v(f) {}
+	CF(double d): v(float(d)) {}
+	explicit operator float() const { return v; }
+	friend CF operator+(CF a, CF b) { ops.add++; return CF(a.v + b.v); }
+	friend CF operator-(CF a, CF b) { ops.add++; return CF(a.v - b.v); }
+	friend CF operator*(CF a, CF b) { ops.mul++; return CF(a.v * b.v); }
+	friend CF operator/(CF a, CF b) { ops.div++; return CF(a.v / b.v); }
+	CF operator-() const { return CF(-v); } // a sign flip, free in soft float
+	CF& operator+=(CF b) { return *this = *this + b; }
+	CF& operator-=(CF b) { return *this = *this - b; }
+	CF& operator*=(CF b) { return *this = *this * b; }
+	CF& operator/=(CF b) { return *this = *this / b; }
+	friend bool operator<(CF a, CF b) { ops.cmp++; return a.v < b.v; }
+	friend bool operator>(CF a, CF b) { ops.cmp++; return a.v > b.v; }
+	friend bool operator<=(CF a, CF b) { ops.cmp++; return a.v <= b.v; }
+	friend bool operator>=(CF a, CF b) { ops.cmp++; return a.v >= b.v; }
+};
+
+template<int FRAC> struct CX {
+	Fixed<FRAC> v;
+	CX() {}
+	CX(int i): v(i) {}
+	CX(float f): v(f) { ops.conv++; }
+	CX(double d): v(d) { ops.conv++; }
+	CX(Fixed<FRAC> f): v(f) {}
+	explicit operator float() const { ops.conv++; return float(v); }
+	friend CX operator+(CX a, CX b) { ops.add++; return CX(a.v + b.v); }
+	friend CX operator-(CX a, CX b) { ops.add++; return CX(a.v - b.v); }
+	friend CX operator*(CX a, CX b) { ops.mul++; return CX(a.v * b.v); }
+	friend CX operator/(CX a, CX b) { ops.div++; return CX(a.v / b.v); }
+	CX operator-() const { ops.add++; return CX(-v); }
+	CX& operator+=(CX b) { return *this = *this + b; }
+	CX& operator-=(CX b) { return *this = *this - b; }
+	CX& operator*=(CX b) { return *this = *this * b; }
+	CX& operator/=(CX b) { return *this = *this / b; }
+	friend bool operator<(CX a, CX b) { ops.cmp++; return a.v < b.v; }
+	friend bool operator>(CX a, CX b) { ops.cmp++; return a.v > b.v; }
+	friend bool operator<=(CX a, CX b) { ops.cmp++; return a.v <= b.v; }
+	friend bool operator>=(CX a, CX b) { ops.cmp++; return a.v >= b.v; }
+};
+
+static void normalize(CF& a, CF& b, CF& c, CF& d) {
+	ops.sqrt++;
+	CF r = CF(1) / CF(sqrtf((a*a + b*b + c*c + d*d).v));
+	a *= r; b *= r; c *= r; d *= r;
+}
+template<int FRAC> void normalize(CX<FRAC>& a, CX<FRAC>& b, CX<FRAC>& c) {
+	ops.sqrt++;
+	ops.mul += 3;
+	bb::normalize(a.v, b.v, c.v);
+}
+template<int FRAC> void normalize(CX<FRAC>& a, CX<FRAC>& b, CX<FRAC>& c, CX<FRAC>& d) {
+	ops.sqrt++;
+	ops.mul += 4;
+	bb::normalize(a.v, b.v, c.v, d.v);
+}
+
+namespace bb {
+template<> struct MicrosToSeconds<CF> {
+	static CF convert(unsigned long us) { ops.conv++; ops.div++; return CF(us / 1e6f); }
+};
+template<int FRAC> struct MicrosToSeconds<CX<FRAC>> {
+	static CX<FRAC> convert(unsigned long us) { ops.mul++; return CX<FRAC>(Fixed<FRAC>::fromMicros(us)); }
+};
+};
+
+// The template definitions, for the counting types
+#include "../src/BBControllers.cpp"
+#include "../src/BBLowPassFilter.cpp"
+#include "../src/BBMadgwick.cpp"
+
+// The Arduino Madgwick library's updateIMU(), same math
+struct LibraryMadgwick {
+	float beta = 0.1f, q0 = 1, q1 = 0, q2 = 0, q3 = 0, invSampleFreq;
+
+	static float invSqrt(float x) {
+		float halfx = 0.5f * x, y = x;
+		int32_t i;
+		memcpy(&i, &y, 4);
+		i = 0x5f3759df - (i>>1);
+		memcpy(&y, &i, 4);
+		y = y * (1.5f - (halfx * y * y));
+		y = y * (1.5f - (halfx * y * y));
+		return y;
+	}
+	void begin(float f) { invSampleFreq = 1.0f / f; }
+	void updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+		gx *= 0.0174533f; gy *= 0.0174533f; gz *= 0.0174533f;
+		float qDot1 = 0.5f * (-q1 * gx - q2 * gy - q3 * gz);
+		float qDot2 = 0.5f * (q0 * gx + q2 * gz - q3 * gy);
+		float qDot3 = 0.5f * (q0 * gy - q1 * gz + q3 * gx);
+		float qDot4 = 0.5f * (q0 * gz + q1 * gy - q2 * gx);
+		if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+			float recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+			ax *= recipNorm; ay *= recipNorm; az *= recipNorm;
+			float _2q0 = 2.0f * q0, _2q1 = 2.0f * q1, _2q2 = 2.0f * q2, _2q3 = 2.0f * q3;
+			float _4q0 = 4.0f * q0, _4q1 = 4.0f * q1, _4q2 = 4.0f * q2, _8q1 = 8.0f * q1, _8q2 = 8.0f * q2;
+			float q0q0 = q0 * q0, q1q1 = q1 * q1, q2q2 = q2 * q2, q3q3 = q3 * q3;
+			float s0 = _4q0 * q2q2 + _2q2 * ax + _4q0 * q1q1 - _2q1 * ay;
+			float s1 = _4q1 * q3q3 - _2q3 * ax + 4.0f * q0q0 * q1 - _2q0 * ay - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * az;
+			float s2 = 4.0f * q0q0 * q2 + _2q0 * ax + _4q2 * q3q3 - _2q3 * ay - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * az;
+			float s3 = 4.0f * q1q1 * q3 - _2q1 * ax + 4.0f * q2q2 * q3 - _2q2 * ay;
+			recipNorm = invSqrt(s0 * s0 + s1 * s1 + s2 * s2 + s3 * s3);
+			s0 *= recipNorm; s1 *= recipNorm; s2 *= recipNorm; s3 *= recipNorm;
+			qDot1 -= beta * s0; qDot2 -= beta * s1; qDot3 -= beta * s2; qDot4 -= beta * s3;
+		}
+		q0 += qDot1 * invSampleFreq; q1 += qDot2 * invSampleFreq; q2 += qDot3 * invSampleFreq; q3 += qDot4 * invSampleFreq;
+		float recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+		q0 *= recipNorm; q1 *= recipNorm; q2 *= recipNorm; q3 *= recipNorm;
+	}
+	float getRoll() { return atan2f(q0*q1 + q2*q3, 0.5f - q1*q1 - q2*q2) * 57.29578f; }
+	float getPitch() { return asinf(-2.0f * (q1*q3 - q0*q2)) * 57.29578f; }
+	float getYaw() { return atan2f(q1*q2 + q0*q3, 0.5f - q2*q2 - q3*q3) * 57.29578f + 180.0f; }
+};
+
+// D-O wobbling and turning: gyro in deg/s with noise and bias, acceleration in g
+struct Sample {
+	float gx, gy, gz, ax, ay, az;
+};
+
+static std::vector<Sample> imuData() {
+	std::vector<Sample> d;
+	std::mt19937 rng(1);
+	std::normal_distribution<float> gyroNoise(0, 0.3f), accelNoise(0, 0.01f);
+	double r = 0, p = 0, h = 0;
+	for(int i=0; i<104*60; i++) {
+		double t = i / 104.0;
+		double dr = 20*cos(t*1.3), dp = 35*cos(t*2.1), dh = 15 + 40*sin(t*0.4);
+		r += dr/104;
+		p += dp/104;
+		h += dh/104;
+		double rr = r*M_PI/180, pr = p*M_PI/180;
+		d.push_back({float(dr + gyroNoise(rng) + 0.5), float(dp + gyroNoise(rng) - 0.3), float(dh + gyroNoise(rng) + 0.2),
+			float(-sin(pr) + accelNoise(rng)), float(sin(rr)*cos(pr) + accelNoise(rng)),
+			float(cos(rr)*cos(pr) + accelNoise(rng))});
+	}
+	return d;
+}
+
+static float angleDiff(float a, float b) {
+	return fabsf(fmodf(a - b + 540.0f, 360.0f) - 180.0f);
+}
+
+// Roll, pitch and heading after every update. Acceleration is multiplied by accelScale.
+template<typename M> std::vector<float> runMadgwick(const std::vector<Sample>& d, float accelScale = 1) {
+	M m;
+	std::vector<float> out;
+	m.begin(104);
+	for(auto& s: d) {
+		m.updateIMU(s.gx, s.gy, s.gz, s.ax*accelScale, s.ay*accelScale, s.az*accelScale);
+		out.push_back(m.getRoll());
+		out.push_back(m.getPitch());
+		out.push_back(m.getYaw());
+	}
+	return out;
+}
+
+// Largest angle difference per axis
+static void angleDiffs(const std::vector<float>& a, const std::vector<float>& b, float (&diffs)[3]) {
+	for(int k=0; k<3; k++) {
+		diffs[k] = 0;
+		for(size_t i=k; i<a.size(); i+=3) diffs[k] = std::max(diffs[k], angleDiff(a[i], b[i]));
+	}
+}
+
+struct Plant: public ControlInput, public ControlOutput {
+	float x = 0, u = 0;
+	Result update() { return RES_OK; }
+	float present() { return x; }
+	Result set(float v) { u = v; return RES_OK; }
+};
+
+// Control output over 30s of goal steps at 104Hz, with jitter
+template<typename T> std::vector<float> runPID() {
+	Plant plant;
+	hostMicros = 1;
+	BasicPIDController<T> pid(plant, plant);
+	pid.setControlParameters(2.5f, 1.2f, 0.05f);
+	pid.setIBounds(-50, 50);
+	pid.setControlBounds(-255, 255);
+	std::vector<float> out;
+	std::mt19937 rng(2);
+	std::normal_distribution<float> noise(0, 0.2f);
+	for(int i=0; i<104*30; i++) {
+		if(i % 300 == 0) pid.setGoal((i/300) % 2 ? -20.0f : 35.0f);
+		hostMicros += 9615 + (i%7)*50;
+		pid.update();
+		plant.x += (plant.u * 0.8f - plant.x * 0.5f) * 0.0096f + noise(rng);
+		out.push_back(plant.u);
+	}
+	return out;
+}
+
+template<typename T> std::vector<float> runLowPass(bool adaptive) {
+	hostMicros = 1;
+	BasicLowPassFilter<T> f(2.0f, 104.0f, adaptive);
+	std::vector<float> out;
+	std::mt19937 rng(3);
+	std::normal_distribution<float> noise(0, 1.5f);
+	for(int i=0; i<104*30; i++) {
+		hostMicros += 9615 + (i%5)*40;
+		out.push_back(f.filter(((i/200) % 2 ? 12.0f : -7.5f) + noise(rng)));
+	}
+	return out;
+}
+
+static float maxDiff(const std::vector<float>& a, const std::vector<float>& b) {
+	float d = 0;
+	for(size_t i=0; i<a.size(); i++) d = std::max(d, fabsf(a[i] - b[i]));
+	return d;
+}
+
+template<typename F> double nsPer(F f, int n) {
+	auto t0 = std::chrono::steady_clock::now();
+	for(int i=0; i<n; i++) f(i);
+	return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / n;
+}
+
+// Assumed M0+ cycles per operation: soft float from libgcc for ARMv6-M, fixed point with 64 bit products through
+// __aeabi_lmul and 64 bit quotients through __aeabi_ldivmod. Estimates, not measurements.
+struct Cost {
+	double add, mul, div, cmp, conv, sqrt;
+};
+static const Cost SOFT_FLOAT = {90, 110, 350, 40, 50, 550};
+static const Cost FIXED_POINT = {12, 40, 450, 4, 60, 520};
+
+static double cycles(const Ops& o, const Cost& c, int n) {
+	return (o.add*c.add + o.mul*c.mul + o.div*c.div + o.cmp*c.cmp + o.conv*c.conv + o.sqrt*c.sqrt) / n;
+}
+
+int main() {
+	// Madgwick against the library and against float
+	std::vector<Sample> d = imuData();
+	std::vector<float> library = runMadgwick<LibraryMadgwick>(d), f = runMadgwick<BasicMadgwickFilter<float>>(d);
+	std::vector<float> q24 = runMadgwick<BasicMadgwickFilter<Q8_24>>(d), q16 = runMadgwick<BasicMadgwickFilter<Q16_16>>(d);
+	float libDiff[3], q24Diff[3], q16Diff[3];
+	angleDiffs(library, f, libDiff);
+	angleDiffs(f, q24, q24Diff);
+	angleDiffs(f, q16, q16Diff);
+	printf("Madgwick, 60s at 104Hz, most degrees apart (roll, pitch, heading):\n");
+	printf("  library vs float %.4f %.4f %.4f\n", libDiff[0], libDiff[1], libDiff[2]);
+	printf("  float vs Q8.24   %.4f %.4f %.4f\n", q24Diff[0], q24Diff[1], q24Diff[2]);
+	printf("  float vs Q16.16  %.4f %.4f %.4f\n", q16Diff[0], q16Diff[1], q16Diff[2]);
+	for(int k=0; k<3; k++) {
+		CHECK(libDiff[k] < 0.01f, "float differs from the library by %f degrees on axis %d", libDiff[k], k);
+		CHECK(q24Diff[k] < 0.01f, "Q8.24 differs from float by %f degrees on axis %d", q24Diff[k], k);
+	}
+
+	// Acceleration in m/s^2 and in raw counts of a +-2g accelerometer, beyond Q8.24's range
+	for(float scale: {9.81f, 16384.0f}) {
+		std::vector<float> scaled = runMadgwick<BasicMadgwickFilter<Q8_24>>(d, scale);
+		float diffs[3];
+		angleDiffs(q24, scaled, diffs);
+		CHECK(diffs[0] < 0.01f && diffs[1] < 0.01f && diffs[2] < 0.01f, "acceleration times %g: %f %f %f degrees off",
+			scale, diffs[0], diffs[1], diffs[2]);
+	}
+
+	// PID and low pass
+	float pidDiff = maxDiff(runPID<float>(), runPID<Q16_16>());
+	float lpDiff = maxDiff(runLowPass<float>(false), runLowPass<Q16_16>(false));
+	float alpDiff = maxDiff(runLowPass<float>(true), runLowPass<Q16_16>(true));
+	printf("PID, 30s of goal steps on a noisy first order plant: Q16.16 at most %.4f%% of the output range off\n",
+		100*pidDiff/510);
+	printf("Low pass, 2Hz at 104Hz: Q16.16 at most %.3f%% of the range off, %.3f%% adaptive\n", 100*lpDiff/19.5f,
+		100*alpDiff/19.5f);
+	CHECK(pidDiff < 0.01f*510/100, "PID output %f off", pidDiff);
+	CHECK(lpDiff < 0.5f*19.5f/100 && alpDiff < 0.5f*19.5f/100, "low pass output %f and %f off", lpDiff, alpDiff);
+
+	// fromMicros() saturates instead of wrapping
+	CHECK(float(Q8_24::fromMicros(9615)) > 0.0096f && float(Q8_24::fromMicros(9615)) < 0.0097f, "9615us");
+	CHECK(fabsf(float(Q8_24::fromMicros(127000000)) - 127) < 1e-5f, "127s");
+	CHECK(Q8_24::fromMicros(128000000) == Q8_24::highest() && Q8_24::fromMicros(300000000) == Q8_24::highest() &&
+		Q8_24::fromMicros(4000000000ul) == Q8_24::highest() &&
+		Q8_24::fromMicros(~0ul) == Q8_24::highest(), "Q8.24 past 128s doesn't saturate");
+	CHECK(fabsf(float(Q16_16::fromMicros(4000000000ul)) - 4000) < 0.001f && Q16_16::fromMicros(~0ul) == Q16_16::highest(),
+		"Q16.16 from 4000s");
+
+	// Time on this host, which has an FPU, so this shows the overhead of fixed point, not the gain on the M0+
+	{
+		BasicMadgwickFilter<float> mf;
+		BasicMadgwickFilter<Q8_24> mq;
+		mf.begin(104);
+		mq.begin(104);
+		BasicLowPassFilter<float> lf(2, 104);
+		BasicLowPassFilter<Q16_16> lq(2, 104);
+		volatile float sink;
+		double nsMf = nsPer([&](int i) { auto& s = d[i % d.size()]; mf.updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az); }, 2000000);
+		double nsMq = nsPer([&](int i) { auto& s = d[i % d.size()]; mq.updateIMU(s.gx, s.gy, s.gz, s.ax, s.ay, s.az); }, 2000000);
+		double nsLf = nsPer([&](int i) { sink = lf.filter(float(i & 63)); }, 5000000);
+		double nsLq = nsPer([&](int i) { sink = lq.filter(float(i & 63)); }, 5000000);
+		(void)sink;
+		printf("On this host: Madgwick float %.1fns, Q8.24 %.1fns; low pass float %.1fns, Q16.16 %.1fns\n", nsMf, nsMq,
+			nsLf, nsLq);
+	}
+
+	// Operations per update and estimated M0+ cycles
+	const int N = 1000;
+	double madgwick[2], pid[2], lowPass[2], adaptive[2];
+	{
+		BasicMadgwickFilter<CF> m;
+		m.begin(104);
+		ops = Ops();
+		for(int i=0; i<N; i++) m.updateIMU(d[i].gx, d[i].gy, d[i].gz, d[i].ax, d[i].ay, d[i].az);
+		ops.mul += 3*N; // degrees to radians
+		madgwick[0] = cycles(ops, SOFT_FLOAT, N);
+	}
+	{
+		BasicMadgwickFilter<CX<24>> m;
+		m.begin(104);
+		ops = Ops();
+		for(int i=0; i<N; i++) m.updateIMU(d[i].gx, d[i].gy, d[i].gz, d[i].ax, d[i].ay, d[i].az);
+		madgwick[1] = cycles(ops, FIXED_POINT, N);
+		// The float parts: degrees to radians, and normalising the acceleration
+		Ops f;
+		f.mul = 3*N + 6*N;
+		f.add = 2*N;
+		f.div = N;
+		f.sqrt = N;
+		madgwick[1] += cycles(f, SOFT_FLOAT, N);
+	}
+	{
+		Plant p;
+		BasicPIDController<CF> pf(p, p);
+		BasicPIDController<CX<16>> pq(p, p);
+		pf.setIBounds(-50, 50);
+		pf.setControlBounds(-255, 255);
+		pq.setIBounds(-50, 50);
+		pq.setControlBounds(-255, 255);
+		ops = Ops();
+		for(int i=0; i<N; i++) { hostMicros += 9615; pf.update(); }
+		pid[0] = cycles(ops, SOFT_FLOAT, N);
+		ops = Ops();
+		for(int i=0; i<N; i++) { hostMicros += 9615; pq.update(); }
+		pid[1] = cycles(ops, FIXED_POINT, N);
+	}
+	for(int a=0; a<2; a++) {
+		double *result = a ? adaptive : lowPass;
+		BasicLowPassFilter<CF> lf(2, 104, a);
+		BasicLowPassFilter<CX<16>> lq(2, 104, a);
+		lf.filter(0);
+		lq.filter(0);
+		ops = Ops();
+		for(int i=0; i<N; i++) { hostMicros += 9615; lf.filter(float(i)); }
+		result[0] = cycles(ops, SOFT_FLOAT, N);
+		ops = Ops();
+		for(int i=0; i<N; i++) { hostMicros += 9615; lq.filter(float(i)); }
+		result[1] = cycles(ops, FIXED_POINT, N);
+	}
+	printf("Estimated M0+ cycles per update, soft float vs fixed point:\n");
+	printf("  Madgwick     %6.0f %6.0f\n", madgwick[0], madgwick[1]);
+	printf("  PID          %6.0f %6.0f\n", pid[0], pid[1]);
+	printf("  low pass     %6.0f %6.0f\n", lowPass[0], lowPass[1]);
+	printf("  adaptive LP  %6.0f %6.0f\n", adaptive[0], adaptive[1]);
+
+	return hostTestResult();
+}
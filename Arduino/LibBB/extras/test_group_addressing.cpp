@@ -0,0 +1,149 @@
+//
+// Host test for XBee group addressing: a remote sends one ControlPacket to a group, and the frame it transmits is
+// handed to droids with their own XBee and PacketReceiver. Some droids are in the group with different offset and
+// mirror transforms, some in another group only, some in both. Checks that the remote sends a single broadcast
+// frame however many droids there are, that members get the control with their own transform, and that the others
+// drop it. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_group_addressing.cpp host/host.cpp ../src/*.cpp -o test_group_addressing && ./test_group_addressing
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/XBeeRadio.h"
+
+#include <memory>
+#include <vector>
+
+using namespace bb;
+
+static const uint16_t REMOTE = XBee::makeStationID(XBee::REMOTE_BAVARIAN_L, 1, 1);
+static const uint16_t PARADE = XBee::makeGroupID(1, 1), OTHER = XBee::makeGroupID(1, 2);
+
+// An XBee of its own for every station, talking API mode to its own radio
+struct Station: public XBee {
+	Radio radio;
+	Station(uint16_t station) {
+		uart_ = &radio;
+		apiMode_ = true;
+		params_.station = station;
+		operationStatus_ = RES_OK;
+	}
+};
+
+struct Recorder: public PacketReceiver {
+	std::vector<ControlPacket> controls;
+	Result incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet) {
+		(void)station; (void)source; (void)rssi;
+		controls.push_back(packet);
+		return RES_OK;
+	}
+};
+
+struct Transform {
+	float offset[2];
+	bool mirror[2];
+};
+
+struct Droid {
+	std::unique_ptr<Station> xbee;
+	Recorder receiver;
+	bool member;
+	Transform transform; // for PARADE, on axes 0 and 1
+};
+
+static ControlPacket control(float a0, float a1) {
+	ControlPacket c;
+	memset(&c, 0, sizeof(c));
+	c.setAxis(0, a0);
+	c.setAxis(1, a1);
+	c.button2 = true;
+	return c;
+}
+
+int main() {
+	StringConsoleStream console;
+	Console::console.initialize();
+	Console::console.addConsoleStream(&console);
+	Console::console.start();
+
+	Station remote(REMOTE);
+	remote.setPacketSource(PACKET_SOURCE_LEFT_REMOTE);
+
+	for(int numDroids: {3, 6, 12}) {
+		std::vector<Droid> droids(numDroids);
+		for(int i=0; i<numDroids; i++) {
+			Droid& d = droids[i];
+			d.xbee.reset(new Station(XBee::makeStationID(XBee::DROID_DIFF_UNSTABLE, 1, i+1)));
+			d.xbee->addPacketReceiver(&d.receiver);
+			// Members with no transform, an offset, a mirror and both; non-members in another group or none;
+			// a member that is in the other group too, with a transform there that must not be used
+			d.member = i % 6 < 4 || i % 6 == 5;
+			d.transform = {{0, 0}, {false, false}};
+			if(i % 6 == 1) d.transform = {{0.25f, 0}, {false, false}};
+			if(i % 6 == 2) d.transform = {{0, 0}, {false, true}};
+			if(i % 6 == 3 || i % 6 == 5) d.transform = {{-0.5f, 0.1f}, {true, true}};
+			if(d.member) {
+				CHECK(d.xbee->joinGroup(PARADE) == RES_OK, "droid %d could not join", i);
+				for(uint8_t axis=0; axis<2; axis++) {
+					d.xbee->setGroupTransform(PARADE, axis, d.transform.offset[axis], d.transform.mirror[axis]);
+				}
+			}
+			if(i % 6 == 4 || i % 6 == 5) {
+				d.xbee->joinGroup(OTHER);
+				d.xbee->setGroupTransform(OTHER, 0, 0.9f, true);
+			}
+		}
+
+		// One frame on air for the whole group, broadcast without ACK, carrying the group ID
+		const float a0 = 0.4f, a1 = -0.3f;
+		Packet p(PACKET_TYPE_CONTROL, PACKET_SOURCE_LEFT_REMOTE);
+		p.payload.control = control(a0, a1);
+		CHECK(remote.sendTo(PARADE, p, true) == RES_OK, "sending to the group failed");
+		std::vector<Radio::TxFrame> frames = remote.radio.transmittedFrames();
+		CHECK(frames.size() == 1, "%d droids: %d frames sent, expected 1", numDroids, (int)frames.size());
+		if(frames.size() != 1) continue;
+		const Radio::TxFrame& f = frames[0];
+		CHECK(f.dest == 0xffff && !f.ack, "%d droids: sent to 0x%x, ack %d", numDroids, f.dest, f.ack);
+		CHECK(f.payload.size() == Packet::SIZE + 2 && ((f.payload[Packet::SIZE] << 8) | f.payload[Packet::SIZE+1]) ==
+			PARADE, "%d droids: %d byte frame without the group ID", numDroids, (int)f.payload.size());
+
+		// Every droid hears the broadcast
+		for(int i=0; i<numDroids; i++) {
+			Droid& d = droids[i];
+			d.xbee->radio.receive(REMOTE, f.payload.data(), f.payload.size());
+			CHECK(d.xbee->receiveAndHandleAPIMode() == RES_OK, "droid %d: handling the frame failed", i);
+			if(!d.member) {
+				CHECK(d.receiver.controls.empty(), "%d droids: non-member %d got the control", numDroids, i);
+				continue;
+			}
+			CHECK(d.receiver.controls.size() == 1, "%d droids: member %d got %d controls", numDroids, i,
+				(int)d.receiver.controls.size());
+			if(d.receiver.controls.empty()) continue;
+			const ControlPacket& c = d.receiver.controls[0];
+			float sent[2] = {p.payload.control.getAxis(0), p.payload.control.getAxis(1)};
+			for(int axis=0; axis<2; axis++) {
+				float expected = constrain((d.transform.mirror[axis] ? -sent[axis] : sent[axis]) +
+					d.transform.offset[axis], -1.0f, 1.0f);
+				CHECK(fabs(c.getAxis(axis) - expected) <= 1.0f/AXIS_MAX, "%d droids: member %d axis %d is %g, expected %g",
+					numDroids, i, axis, c.getAxis(axis), expected);
+			}
+			CHECK(c.axis2 == 0 && c.button2 && !c.button0, "%d droids: member %d got other fields changed", numDroids, i);
+		}
+	}
+
+	// Unicast control is left alone, even from a station that has a group transform
+	Station droid(XBee::makeStationID(XBee::DROID_DIFF_UNSTABLE, 1, 1));
+	Recorder receiver;
+	droid.addPacketReceiver(&receiver);
+	droid.joinGroup(PARADE);
+	droid.setGroupTransform(PARADE, 0, 0.5f, true);
+	Packet p(PACKET_TYPE_CONTROL, PACKET_SOURCE_LEFT_REMOTE);
+	p.payload.control = control(0.4f, 0);
+	droid.radio.receive(REMOTE, p);
+	droid.receiveAndHandleAPIMode();
+	CHECK(receiver.controls.size() == 1 && receiver.controls[0].axis0 == p.payload.control.axis0,
+		"unicast control transformed");
+
+	return hostTestResult();
+}
@@ -0,0 +1,243 @@
+//
+// Host test for the console line editor (BBLineEditor.h). Keystrokes go into a fake console stream with echo on,
+// and the echo is played back on a minimal terminal model that knows \r, \n, \b, CSI n D and CSI K. Checks that the
+// editor returns the right line, that the terminal shows it behind the prompt with the cursor where the editor has
+// it, and how many bytes of echo each edit costs - typing a character must cost one byte. Also checks that the
+// line being typed survives browsing the history, that broadcasts arriving while a line is typed are printed above
+// it and the line is redrawn, and telnet echo negotiation. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_line_editor.cpp host/host.cpp ../src/*.cpp -o test_line_editor && ./test_line_editor
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <string>
+#include <vector>
+
+using namespace bb;
+
+struct EchoStream: public StringConsoleStream {
+	EchoStream() { setEcho(true); setOverflowPolicy(OVERFLOW_DROP); }
+};
+
+// Rows of text and a cursor. \n goes to the start of the next row, as on a terminal translating LF to CR LF.
+struct Terminal {
+	std::vector<std::string> rows = {""};
+	size_t col = 0;
+
+	void feed(const std::string& s) {
+		for(size_t i=0; i<s.size(); i++) {
+			char c = s[i];
+			std::string& row = rows.back();
+			if(c == '\b') {
+				if(col > 0) col--;
+			} else if(c == '\r') {
+				col = 0;
+			} else if(c == '\n') {
+				rows.push_back("");
+				col = 0;
+			} else if(c == 0x1b && i+1 < s.size() && s[i+1] == '[') {
+				i += 2;
+				size_t n = 0;
+				while(i < s.size() && isdigit(s[i])) n = n*10 + s[i++] - '0';
+				if(i < s.size() && s[i] == 'D') col -= std::min(col, n ? n : 1);
+				else if(i < s.size() && s[i] == 'K' && col < row.size()) row.resize(col);
+			} else {
+				if(col < row.size()) row[col] = c;
+				else row += std::string(col - row.size(), ' ') + c;
+				col++;
+			}
+		}
+	}
+	// The row before the current one, without trailing blanks
+	std::string lastRow() {
+		if(rows.size() < 2) return "";
+		std::string r = rows[rows.size()-2];
+		while(!r.empty() && r.back() == ' ') r.pop_back();
+		return r;
+	}
+};
+
+// Feeds keys, plays the echo on t and returns the number of echo bytes. line gets the completed line, if any.
+static size_t type(EchoStream& s, Terminal& t, const std::string& keys, std::string *line = NULL) {
+	s.in = keys;
+	s.inPos = 0;
+	s.out.clear();
+	while(s.available()) {
+		char *l = s.readLine();
+		if(l != NULL && line != NULL) *line = l;
+	}
+	s.drain();
+	t.feed(s.out);
+	return s.out.size();
+}
+
+// Types keys, which end the line, and checks the line and what the terminal shows of it
+static size_t enter(EchoStream& s, Terminal& t, const std::string& keys, const char *expected) {
+	std::string line = "(none)";
+	t.feed("> ");
+	size_t bytes = type(s, t, keys, &line);
+	CHECK(line == expected, "line is \"%s\", expected \"%s\"", line.c_str(), expected);
+	CHECK(t.lastRow() == std::string("> ") + expected, "terminal shows \"%s\", expected \"> %s\"",
+		t.lastRow().c_str(), expected);
+	return bytes;
+}
+
+struct EditorProbe: public LineEditor {
+	size_t cursor() { return cursor_; }
+};
+
+// Checks that the terminal's current row shows the line being edited with the cursor where the editor has it
+static void checkScreen(EchoStream& s, Terminal& t, const char *what) {
+	LineEditor& e = s.lineEditor();
+	std::string shown = t.rows.back();
+	while(!shown.empty() && shown.back() == ' ') shown.pop_back();
+	std::string line = std::string("> ") + std::string(e.line(), e.length());
+	CHECK(shown == line, "%s: terminal shows \"%s\", editor has \"%s\"", what, shown.c_str(), line.c_str());
+	size_t cursor = 2 + static_cast<EditorProbe&>(e).cursor();
+	CHECK(t.col == cursor, "%s: cursor at %d, editor at %d", what, (int)t.col, (int)cursor);
+}
+
+int main() {
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.start();
+
+	// Typing costs one byte per character, plus the line end
+	{
+		EchoStream s;
+		Terminal t;
+		const char *cmd = "servos move all 180.0 ; runloop running_status off ; xbee tdma";
+		size_t bytes = enter(s, t, std::string(cmd) + "\r\n", cmd);
+		CHECK(bytes == strlen(cmd) + 1, "%d character command echoed as %d bytes", (int)strlen(cmd), (int)bytes);
+		printf("%d character command: %d bytes of echo\n", (int)strlen(cmd), (int)bytes);
+	}
+
+	// Edits
+	{
+		EchoStream s;
+		Terminal t;
+		size_t bytes = enter(s, t, "log dumq\b\bmp\r", "log dump");
+		CHECK(bytes == 8 + 2*3 + 2 + 1, "two backspaces cost %d bytes", (int)bytes - 11);
+		printf("backspace fix: %d bytes\n", (int)bytes);
+		bytes = enter(s, t, "log dmp\x1b[D\x1b[Du\r", "log dump");
+		printf("mid-line insert: %d bytes\n", (int)bytes);
+		enter(s, t, "runloop status\r", "runloop status");
+		bytes = enter(s, t, "\x1b[A\x1b[A\r", "log dump");
+		printf("history up twice: %d bytes\n", (int)bytes);
+		enter(s, t, "\x1b[A\x1b[A\x1b[B\x01\x1b[3~\x05 x\r", "og dump x");
+		enter(s, t, "abc def ghi\x1b[D\x1b[D\x1b[D\x15\x0bzz\r", "zz");
+		enter(s, t, "hello\x1b[H\x1b[4~!\x02\x02\x04\x06\x7f\r", "hell");
+		enter(s, t, "a long line to go back in\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x1b[D\x0c\r",
+			"a long line to go back in");
+	}
+
+	// The line being typed is history entry 0: browsing the history and coming back restores it
+	{
+		EchoStream s;
+		Terminal t;
+		enter(s, t, "log status\r", "log status");
+		enter(s, t, "runloop status\r", "runloop status");
+		t.feed("> ");
+		type(s, t, "xbee t");
+		type(s, t, "\x1b[A\x1b[A");
+		checkScreen(s, t, "history up");
+		CHECK(std::string(s.lineEditor().line(), s.lineEditor().length()) == "log status", "history up twice");
+		type(s, t, "\x1b[B\x1b[B");
+		checkScreen(s, t, "history back down");
+		std::string line;
+		type(s, t, "dma\r", &line);
+		CHECK(line == "xbee tdma", "line typed before browsing the history is \"%s\"", line.c_str());
+		CHECK(t.lastRow() == "> xbee tdma", "terminal shows \"%s\"", t.lastRow().c_str());
+		t.feed("> ");
+		type(s, t, "\x1b[A\x1b[B\r", &line);
+		CHECK(line == "", "draft survived the end of its line: \"%s\"", line.c_str());
+	}
+
+	// Overlong line and history overflow
+	{
+		EchoStream s;
+		Terminal t;
+		enter(s, t, std::string(300, 'x') + "\n", std::string(CONSOLE_LINE_SIZE-1, 'x').c_str());
+		for(int i=0; i<40; i++) {
+			char cmd[32];
+			snprintf(cmd, sizeof(cmd), "command number %d", i);
+			enter(s, t, std::string(cmd) + "\n", cmd);
+		}
+		std::string up;
+		for(int i=0; i<100; i++) up += "\x1b[A";
+		enter(s, t, up + "\r", "command number 26");
+	}
+
+	// Broadcasts while a line is typed go above it, and the line is drawn again
+	{
+		EchoStream s;
+		Terminal t;
+		Console::console.addConsoleStream(&s);
+		t.feed("> ");
+		type(s, t, "log du");
+		s.out.clear();
+		Console::console.printfBroadcast("cycle %d: speed %.1f\n", 1, 2.5);
+		s.drain();
+		t.feed(s.out);
+		CHECK(t.lastRow() == "cycle 1: speed 2.5", "broadcast shows as \"%s\"", t.lastRow().c_str());
+		checkScreen(s, t, "after a broadcast");
+		printf("broadcast while typing: %d bytes for a %d byte message\n", (int)s.out.size(),
+			(int)strlen("cycle 1: speed 2.5\n"));
+
+		type(s, t, "\x1b[D\x1b[D");
+		s.out.clear();
+		Console::console.printfBroadcast("cycle %d\n", 2);
+		s.drain();
+		t.feed(s.out);
+		CHECK(t.lastRow() == "cycle 2", "broadcast shows as \"%s\"", t.lastRow().c_str());
+		checkScreen(s, t, "after a broadcast with the cursor inside the line");
+		std::string line;
+		type(s, t, "\x05mp\r", &line);
+		CHECK(line == "log dump" && t.lastRow() == "> log dump", "line after broadcasts is \"%s\", shown as \"%s\"",
+			line.c_str(), t.lastRow().c_str());
+
+		// Without a line being typed, a broadcast is just the message
+		s.out.clear();
+		Console::console.printfBroadcast("cycle %d\n", 3);
+		s.drain();
+		CHECK(s.out == "cycle 3\n", "broadcast without a line typed is \"%s\"", s.out.c_str());
+
+		// A broadcast that doesn't fit is dropped as a whole, not just the message without the redraw
+		t.feed("> ");
+		type(s, t, "log du");
+		std::string filler(CONSOLE_OUTPUT_BUFFER_SIZE - 30, '.');
+		s.write(filler.c_str(), filler.size());
+		size_t queued = s.outputQueued();
+		unsigned long dropped = s.droppedBytes();
+		Console::console.printfBroadcast("a broadcast that is too long for what is left\n");
+		CHECK(s.outputQueued() == queued && s.droppedBytes() > dropped, "broadcast not dropped as a whole");
+		s.discardOutput();
+		Console::console.removeConsoleStream(&s);
+	}
+
+	// Telnet: no echo until the client sent DO ECHO, and no redraw around broadcasts either
+	{
+		EchoStream s;
+		s.lineEditor().setTelnet(true);
+		Terminal t;
+		std::string line;
+		size_t bytes = type(s, t, std::string("\xff\xfd\x03\xff\xfa\x1f\x00\x50\xff\xf0stat\r\n", 16), &line);
+		CHECK(line == "stat" && bytes == 0, "before DO ECHO: line \"%s\", %d bytes echoed", line.c_str(), (int)bytes);
+		Console::console.addConsoleStream(&s);
+		type(s, t, "log");
+		s.out.clear();
+		Console::console.printfBroadcast("cycle 4\n");
+		s.drain();
+		CHECK(s.out == "cycle 4\n", "broadcast to a telnet client that echoes itself is \"%s\"", s.out.c_str());
+		Console::console.removeConsoleStream(&s);
+		type(s, t, "\r");
+		bytes = type(s, t, "\xff\xfd\x01stat\r", &line);
+		CHECK(line == "stat" && bytes == 5, "after DO ECHO: line \"%s\", %d bytes echoed", line.c_str(), (int)bytes);
+		type(s, t, std::string("ab\r\0", 4), &line);
+		CHECK(line == "ab", "CR NUL: line \"%s\"", line.c_str());
+	}
+
+	return hostTestResult();
+}
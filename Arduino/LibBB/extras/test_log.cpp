@@ -0,0 +1,208 @@
+//
+// Host test for the binary log (BBLog.h). Logs messages with every argument type and writes the "log dump" output
+// and the same messages formatted with snprintf() to a directory, so check_log.py can decode the dump with
+// DroidGUI's LogDecoder and compare. Then fills the log until it wraps around many times and checks that reads
+// at any offset a client might send - stale, from the future, or inside a record - return whole records starting
+// at a record boundary, and that a dump of the full log goes out a bounded piece per cycle while logging goes on and
+// covers the log without gaps. Also compares the cost of BB_LOG() with Console::printfBroadcast() on this host. Build and
+// run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_log.cpp host/host.cpp ../src/*.cpp -o test_log && ./test_log /tmp/log && python3 check_log.py /tmp/log
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <sstream>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+using namespace bb;
+
+enum Mode { MODE_A = 3 };
+
+static std::string expected;
+
+static void expect(const char *fmt, ...) {
+	char buf[512];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	expected += buf;
+}
+
+// The records from tail to head, by offset
+static std::map<uint32_t, std::vector<uint8_t>> allRecords() {
+	std::map<uint32_t, std::vector<uint8_t>> records;
+	uint32_t offset = Log::log.firstOffset();
+	uint8_t buf[Log::MAX_RECORD_SIZE];
+	size_t len;
+	while((len = Log::log.read(offset, buf, sizeof(buf))) > 0) {
+		for(size_t pos=0; pos<len; pos += buf[pos]) records[offset + pos] = std::vector<uint8_t>(buf + pos, buf + pos + buf[pos]);
+		offset += len;
+	}
+	return records;
+}
+
+// Runs a console command that starts a report until the report is done, one runloop cycle per step. Returns the
+// output, with the number of cycles and the most output in one cycle.
+static std::string runReport(StringConsoleStream& console, const char *command, int& cycles, size_t& maxPerCycle,
+	void (*everyCycle)() = NULL) {
+	console.out.clear();
+	console.in = command;
+	console.inPos = 0;
+	cycles = 0;
+	maxPerCycle = 0;
+	do {
+		size_t before = console.out.size();
+		Console::console.step();
+		console.drain();
+		if(everyCycle != NULL) everyCycle();
+		maxPerCycle = std::max(maxPerCycle, console.out.size() - before);
+		cycles++;
+	} while(Console::console.reportRunning(&console) && cycles < 10000);
+	return console.out;
+}
+
+// The dump lines in out, by offset, and the offset it says to continue at
+static std::map<uint32_t, std::string> dumpLines(const std::string& out, uint32_t& next) {
+	std::map<uint32_t, std::string> lines;
+	std::istringstream in(out);
+	std::string line;
+	next = 0;
+	while(std::getline(in, line)) {
+		if(!line.empty() && line[0] == '\r') line.erase(0, 1);
+		unsigned long offset;
+		if(sscanf(line.c_str(), "next offset 0x%lx", &offset) == 1) next = offset;
+		else if(line.size() > 9 && line[8] == ':') lines[strtoul(line.substr(0, 8).c_str(), NULL, 16)] = line.substr(9);
+	}
+	return lines;
+}
+
+int main(int argc, char **argv) {
+	std::string dir;
+	if(argc > 1) {
+		dir = argv[1];
+		mkdir(dir.c_str(), 0755);
+	} else {
+		const char *tmp = getenv("TMPDIR");
+		dir = std::string(tmp != NULL ? tmp : "/tmp") + "/log-XXXXXX";
+		if(mkdtemp(&dir[0]) == NULL) {
+			perror(dir.c_str());
+			return 1;
+		}
+		printf("Writing to %s\n", dir.c_str());
+	}
+	StringConsoleStream console;
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.addConsoleStream(&console);
+	Console::console.start();
+	Log::log.initialize();
+	Log::log.start();
+
+	// Round trip through the dump and LogDecoder. Floats are stored as float, so pass floats to snprintf() too.
+	for(int i=0; i<8; i++) {
+		hostMicros += 1000;
+		BB_LOG("int %d uint %u hex 0x%x neg %d\n", i, 3u * i, 0xdead, -i);
+		expect("int %d uint %u hex 0x%x neg %d\n", i, 3u * i, 0xdead, -i);
+		BB_LOG("float %.3f double %g str %s String %s\n", 1.5f * i, (float)(2.25 * i), "abc", String("xyz"));
+		expect("float %.3f double %g str %s String %s\n", 1.5f * i, (float)(2.25 * i), "abc", "xyz");
+		BB_LOG("64bit %lld %llu char %c enum %d\n", -1234567890123LL * i, (unsigned long long)i << 40, 'A' + i, MODE_A);
+		expect("64bit %lld %llu char %c enum %d\n", -1234567890123LL * i, (unsigned long long)i << 40, 'A' + i, MODE_A);
+		BB_LOG("truncated %s|%5.1f%%\n", "0123456789012345678901234567890123456789", 99.5f);
+		expect("truncated %s|%5.1f%%\n", "01234567890123456789012345678901", 99.5f);
+		BB_LOG("no args\n");
+		expect("no args\n");
+	}
+	CHECK(Log::log.firstOffset() == 0, "the round trip part must not wrap, first offset is %u", Log::log.firstOffset());
+	int cycles;
+	size_t maxPerCycle;
+	runReport(console, "log dump\r", cycles, maxPerCycle);
+	// A chunk, plus the record line that went over it
+	const size_t maxChunk = CONSOLE_REPORT_CHUNK_SIZE + 2*Log::MAX_RECORD_SIZE + 16;
+	CHECK(cycles > 1 && maxPerCycle <= maxChunk, "dump in %d cycles, up to %zu bytes per cycle", cycles, maxPerCycle);
+	FILE *f = fopen((dir + "/dump.txt").c_str(), "w");
+	fwrite(console.out.data(), console.out.size(), 1, f);
+	fclose(f);
+	f = fopen((dir + "/expected.txt").c_str(), "w");
+	fwrite(expected.data(), expected.size(), 1, f);
+	fclose(f);
+
+	// Wrap around many times with records of varying length
+	for(int i=0; i<20000; i++) {
+		hostMicros += 7;
+		if(i % 3 == 0) BB_LOG("short %d\n", i);
+		else if(i % 3 == 1) BB_LOG("string %s %d\n", std::string(i % 33, 'x').c_str(), i);
+		else BB_LOG("three %d %f %u\n", i, i * 0.5f, (unsigned)i);
+	}
+	std::map<uint32_t, std::vector<uint8_t>> records = allRecords();
+	uint32_t tail = Log::log.firstOffset(), head = Log::log.endOffset();
+	CHECK(tail > 0 && head - tail <= LOG_BUFFER_SIZE && !records.empty() && records.begin()->first == tail,
+		"log didn't wrap: 0x%x-0x%x", tail, head);
+
+	// Every offset near the log: reads start at a record boundary, at or after the offset if it is in the log and
+	// at the oldest record otherwise, and return exactly the records stored there
+	int bad = 0;
+	uint8_t buf[300];
+	for(uint32_t requested=tail-300; requested!=head+300 && bad<5; requested++) {
+		uint32_t offset = requested;
+		size_t len = Log::log.read(offset, buf, sizeof(buf));
+		bool inLog = (int32_t)(requested - tail) >= 0 && (int32_t)(head - requested) >= 0;
+		auto start = records.lower_bound(requested);
+		uint32_t want = !inLog ? tail : start == records.end() ? head : start->first;
+		bool ok = offset == want && len <= sizeof(buf);
+		for(size_t pos=0; ok && pos<len; pos += buf[pos]) {
+			auto r = records.find(offset + pos);
+			ok = r != records.end() && pos + r->second.size() <= len &&
+				memcmp(buf + pos, r->second.data(), r->second.size()) == 0;
+		}
+		if(!ok) {
+			bad++;
+			CHECK(false, "read at 0x%x (log 0x%x-0x%x) started at 0x%x with %d bytes", requested, tail, head, offset,
+				(int)len);
+		}
+	}
+	printf("reads at %d offsets around 0x%x-0x%x, %d records in the log\n", (int)(head - tail + 600), tail, head,
+		(int)records.size());
+
+	// Dumping the full log while every cycle logs: the dump ends, a bounded piece per cycle, at the end the log had
+	// when it started. Lines run without gaps from the oldest record that was still there.
+	uint32_t dumpEnd = head, next;
+	std::string out = runReport(console, "log dump\r", cycles, maxPerCycle, []() { BB_LOG("meanwhile %d\n", 1); });
+	std::map<uint32_t, std::string> lines = dumpLines(out, next);
+	printf("dump of 0x%x-0x%x: %zu records in %d cycles, up to %zu bytes per cycle\n", tail, head, lines.size(), cycles,
+		maxPerCycle);
+	CHECK(cycles > 10 && maxPerCycle <= maxChunk, "dump in %d cycles, up to %zu bytes per cycle", cycles, maxPerCycle);
+	CHECK(next == dumpEnd && out.find("OK") != std::string::npos, "dump ended at 0x%x, log ended at 0x%x", next,
+		dumpEnd);
+	bool contiguous = !lines.empty() && lines.begin()->first >= tail;
+	for(auto l = lines.begin(); contiguous && l != lines.end(); l++) {
+		auto n = std::next(l);
+		contiguous = l->second.size() >= 2*Log::HEADER_SIZE &&
+			(n == lines.end() ? next : n->first) == l->first + l->second.size()/2;
+	}
+	CHECK(contiguous, "dump has gaps or short records");
+
+	// Cost on this host. The control loop cares about the ratio, the absolute numbers are much higher on SAMD.
+	const int N = 100000;
+	float x = 0.5;
+	auto t0 = std::chrono::steady_clock::now();
+	for(int i=0; i<N; i++) BB_LOG("Benchmark %d: %f\n", i, x * i);
+	auto t1 = std::chrono::steady_clock::now();
+	for(int i=0; i<N; i++) {
+		Console::console.printfBroadcast("Benchmark %d: %f\n", i, x * i);
+		if(i % 8 == 0) console.drain();
+	}
+	auto t2 = std::chrono::steady_clock::now();
+	double logNS = std::chrono::duration<double, std::nano>(t1 - t0).count() / N;
+	double printfNS = std::chrono::duration<double, std::nano>(t2 - t1).count() / N;
+	printf("BB_LOG() %.0fns per call, printfBroadcast() %.0fns per call\n", logNS, printfNS);
+	CHECK(logNS < printfNS, "BB_LOG() is not faster than printfBroadcast()");
+
+	return hostTestResult();
+}
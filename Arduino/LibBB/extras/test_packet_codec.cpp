@@ -0,0 +1,334 @@
+//
+// Host test for the realtime packet codec in BBPacketLayout.h against the packed bitfield structs it replaced:
+// random frames must decode and re-encode to what the old structs held in memory, and the transparent mode
+// frame and LargeStatePacket must keep their old sizes. Also times encoding and decoding through both, in ns per
+// packet. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_packet_codec.cpp host/host.cpp ../src/*.cpp -o test_packet_codec && ./test_packet_codec
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/XBeeRadio.h"
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace bb;
+
+// The packet structs as they were before the codec, sent over the air as raw memory
+namespace old {
+
+struct __attribute__ ((packed)) ControlPacket {
+	int16_t axis0  : 10;
+	int16_t axis1  : 10;
+	int16_t axis2  : 10;
+	int16_t axis3  : 10;
+	int16_t axis4  : 10;
+	bool button0   : 1;
+	bool button1   : 1;
+	bool button2   : 1;
+	bool button3   : 1;
+	bool button4   : 1;
+	bool event     : 1;
+};
+
+struct __attribute__ ((packed)) ControlMode {
+	bb::ControlMode::ControlType driveControl : 2;
+	bb::ControlMode::ControlType domeControl  : 2;
+	bb::ControlMode::ControlType armsControl  : 2;
+	bb::ControlMode::ControlType soundControl : 2;
+};
+
+struct __attribute__ ((packed)) SubsysStatus {
+	bb::SubsysStatus::StatusType battery : 2;
+	bb::SubsysStatus::StatusType drive   : 2;
+	bb::SubsysStatus::StatusType servos  : 2;
+	bb::SubsysStatus::StatusType comm    : 2;
+};
+
+struct __attribute__ ((packed)) StatePacket {
+	old::ControlMode controlMode;
+	old::SubsysStatus subsysStatus;
+	uint8_t item;
+	union {
+		struct __attribute__ ((packed)) {
+			uint16_t voltage;
+			int16_t current;
+		} battery;
+		struct __attribute__ ((packed)) {
+			int16_t speed;
+			int16_t pitch;
+		} drive;
+	} data;
+};
+
+struct __attribute__ ((packed)) ConfigPacket {
+	bb::ConfigPacket::ConfigType type;
+	union {
+		uint16_t id;
+		old::ControlMode controlMode;
+		struct {
+			uint8_t numSlots;
+			uint8_t beaconSeq;
+		} superframe;
+	} parameter;
+};
+
+struct Packet {
+	PacketType type     : 2;
+	PacketSource source : 2;
+	uint8_t seqnum      : 3;
+	uint8_t reserved    : 1;
+	union {
+		old::ControlPacket control;
+		old::StatePacket state;
+		old::ConfigPacket config;
+	} payload;
+};
+
+struct PacketFrame {
+	old::Packet packet;
+	uint8_t crc;
+};
+
+struct __attribute__ ((packed)) LargeStatePacket {
+	float timestamp;
+	uint8_t droidType;
+	char droidName[16];
+	DriveControlState drive[3];
+	IMUState imu[3];
+	old::ControlPacket lastControl[2];
+	ServoState servo[10];
+	BatteryState battery[3];
+};
+
+};
+
+// Gets a Packet in and out of a frame the old way, through the bitfield structs, to compare the codec's speed with
+static void legacyDecode(const uint8_t *raw, Packet& p) {
+	old::Packet o;
+	memcpy(&o, raw, sizeof(o));
+	p.type = o.type;
+	p.source = o.source;
+	p.seqnum = o.seqnum;
+	p.reserved = o.reserved;
+	switch(o.type) {
+	case PACKET_TYPE_CONTROL: {
+		const old::ControlPacket& oc = o.payload.control;
+		ControlPacket& c = p.payload.control;
+		c.axis0 = oc.axis0; c.axis1 = oc.axis1; c.axis2 = oc.axis2; c.axis3 = oc.axis3; c.axis4 = oc.axis4;
+		c.button0 = oc.button0; c.button1 = oc.button1; c.button2 = oc.button2; c.button3 = oc.button3;
+		c.button4 = oc.button4; c.event = oc.event;
+		break;
+	}
+	case PACKET_TYPE_STATE: {
+		const old::StatePacket& os = o.payload.state;
+		StatePacket& s = p.payload.state;
+		s.controlMode.driveControl = os.controlMode.driveControl;
+		s.controlMode.domeControl = os.controlMode.domeControl;
+		s.controlMode.armsControl = os.controlMode.armsControl;
+		s.controlMode.soundControl = os.controlMode.soundControl;
+		s.subsysStatus.battery = os.subsysStatus.battery;
+		s.subsysStatus.drive = os.subsysStatus.drive;
+		s.subsysStatus.servos = os.subsysStatus.servos;
+		s.subsysStatus.comm = os.subsysStatus.comm;
+		s.item = os.item;
+		s.data.drive.speed = os.data.drive.speed;
+		s.data.drive.pitch = os.data.drive.pitch;
+		break;
+	}
+	case PACKET_TYPE_CONFIG:
+		p.payload.config.type = o.payload.config.type;
+		p.payload.config.parameter.id = o.payload.config.parameter.id;
+		break;
+	default:
+		break;
+	}
+}
+
+static void legacyEncode(const Packet& p, uint8_t *raw) {
+	old::Packet o;
+	memset(&o, 0, sizeof(o));
+	o.type = p.type;
+	o.source = p.source;
+	o.seqnum = p.seqnum;
+	o.reserved = p.reserved;
+	switch(p.type) {
+	case PACKET_TYPE_CONTROL: {
+		const ControlPacket& c = p.payload.control;
+		old::ControlPacket& oc = o.payload.control;
+		oc.axis0 = c.axis0; oc.axis1 = c.axis1; oc.axis2 = c.axis2; oc.axis3 = c.axis3; oc.axis4 = c.axis4;
+		oc.button0 = c.button0; oc.button1 = c.button1; oc.button2 = c.button2; oc.button3 = c.button3;
+		oc.button4 = c.button4; oc.event = c.event;
+		break;
+	}
+	case PACKET_TYPE_STATE: {
+		const StatePacket& s = p.payload.state;
+		old::StatePacket& os = o.payload.state;
+		os.controlMode.driveControl = s.controlMode.driveControl;
+		os.controlMode.domeControl = s.controlMode.domeControl;
+		os.controlMode.armsControl = s.controlMode.armsControl;
+		os.controlMode.soundControl = s.controlMode.soundControl;
+		os.subsysStatus.battery = s.subsysStatus.battery;
+		os.subsysStatus.drive = s.subsysStatus.drive;
+		os.subsysStatus.servos = s.subsysStatus.servos;
+		os.subsysStatus.comm = s.subsysStatus.comm;
+		os.item = s.item;
+		os.data.drive.speed = s.data.drive.speed;
+		os.data.drive.pitch = s.data.drive.pitch;
+		break;
+	}
+	case PACKET_TYPE_CONFIG:
+		o.payload.config.type = p.payload.config.type;
+		o.payload.config.parameter.id = p.payload.config.parameter.id;
+		break;
+	default:
+		break;
+	}
+	memcpy(raw, &o, sizeof(o));
+}
+
+// ns per packet for fn(i) over count packets, best of a few rounds
+template<typename F> static double nsPerPacket(size_t count, F fn) {
+	double best = 1e9;
+	for(int round=0; round<5; round++) {
+		auto t0 = std::chrono::steady_clock::now();
+		for(size_t i=0; i<count; i++) fn(i);
+		double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count() / count;
+		best = std::min(best, ns);
+	}
+	return best;
+}
+
+int main() {
+	static_assert(sizeof(old::Packet) == Packet::SIZE, "old packet size");
+	CHECK(sizeof(old::PacketFrame) == XBee::TRANSPARENT_FRAME_SIZE, "transparent frame is %d bytes, used to be %d",
+		(int)XBee::TRANSPARENT_FRAME_SIZE, (int)sizeof(old::PacketFrame));
+	CHECK(sizeof(old::LargeStatePacket) == sizeof(LargeStatePacket), "LargeStatePacket is %d bytes, used to be %d",
+		(int)sizeof(LargeStatePacket), (int)sizeof(old::LargeStatePacket));
+	CHECK(offsetof(old::LargeStatePacket, servo) == offsetof(LargeStatePacket, servo),
+		"LargeStatePacket members after lastControl moved");
+
+	std::mt19937 rng(3);
+	int mismatches = 0;
+	for(int n=0; n<200000; n++) {
+		uint8_t raw[Packet::SIZE];
+		for(auto& b: raw) b = rng();
+		if((raw[0] & 3) == PACKET_TYPE_CONFIG) {
+			raw[1] &= 3; // the old config type was a 32 bit enum, only 0..3 are defined
+			raw[2] = raw[3] = raw[4] = 0;
+		}
+		old::Packet op;
+		memcpy(&op, raw, sizeof(op));
+
+		Packet np;
+		np.decode(raw);
+		uint8_t enc[Packet::SIZE];
+		np.encode(enc);
+		bool ok = np.type == op.type && np.source == op.source && np.seqnum == op.seqnum && np.reserved == op.reserved;
+
+		switch(op.type) {
+		case PACKET_TYPE_CONTROL: {
+			const old::ControlPacket& o = op.payload.control;
+			const ControlPacket& c = np.payload.control;
+			ok = ok && c.axis0 == o.axis0 && c.axis1 == o.axis1 && c.axis2 == o.axis2 && c.axis3 == o.axis3 &&
+				c.axis4 == o.axis4 && c.button0 == o.button0 && c.button4 == o.button4 && c.event == o.event;
+			ok = ok && memcmp(enc, raw, sizeof(raw)) == 0; // control packets use every bit
+			ok = ok && memcmp(enc + 1, &o, sizeof(o)) == 0; // what lastControl holds
+			break;
+		}
+		case PACKET_TYPE_STATE: {
+			const old::StatePacket& o = op.payload.state;
+			const StatePacket& s = np.payload.state;
+			ok = ok && s.controlMode.domeControl == o.controlMode.domeControl &&
+				s.subsysStatus.comm == o.subsysStatus.comm && s.item == o.item;
+			if(o.item == StatePacket::STATE_BATTERY) {
+				ok = ok && s.data.battery.voltage == o.data.battery.voltage &&
+					s.data.battery.current == o.data.battery.current;
+			} else if(o.item == StatePacket::STATE_DRIVE) {
+				ok = ok && s.data.drive.speed == o.data.drive.speed && s.data.drive.pitch == o.data.drive.pitch;
+			}
+			break;
+		}
+		case PACKET_TYPE_CONFIG: {
+			const old::ConfigPacket& o = op.payload.config;
+			const ConfigPacket& c = np.payload.config;
+			ok = ok && c.type == o.type;
+			if(c.type == ConfigPacket::CONFIG_SET_LEFT_REMOTE_ID || c.type == ConfigPacket::CONFIG_SET_DROID_ID) {
+				ok = ok && c.parameter.id == o.parameter.id;
+			} else if(c.type == ConfigPacket::CONFIG_SUPERFRAME_BEACON) {
+				ok = ok && c.parameter.superframe.numSlots == o.parameter.superframe.numSlots &&
+					c.parameter.superframe.beaconSeq == o.parameter.superframe.beaconSeq;
+			}
+			break;
+		}
+		default:
+			break;
+		}
+
+		Packet again;
+		again.decode(enc);
+		uint8_t enc2[Packet::SIZE];
+		again.encode(enc2);
+		ok = ok && memcmp(enc, enc2, sizeof(enc)) == 0;
+		if(!ok) mismatches++;
+	}
+	CHECK(mismatches == 0, "%d of 200000 random frames differ from the old structs", mismatches);
+
+	// Speed: the same random frames through the codec and through the bitfield structs. Both are checked against
+	// each other, which also keeps the compiler from dropping the work.
+	const size_t COUNT = 1 << 16;
+	std::vector<uint8_t> frames(COUNT * Packet::SIZE), codecOut(frames.size()), legacyOut(frames.size());
+	for(size_t i=0; i<frames.size(); i++) frames[i] = rng();
+	for(size_t i=0; i<COUNT; i++) {
+		uint8_t *raw = &frames[i*Packet::SIZE];
+		if((raw[0] & 3) == PACKET_TYPE_CONFIG) {
+			raw[1] &= 3;
+			raw[2] = raw[3] = raw[4] = 0;
+		}
+	}
+	std::vector<Packet> codecPackets(COUNT), legacyPackets(COUNT);
+	double codecDecodeNS = nsPerPacket(COUNT, [&](size_t i) { codecPackets[i].decode(&frames[i*Packet::SIZE]); });
+	double legacyDecodeNS = nsPerPacket(COUNT, [&](size_t i) { legacyDecode(&frames[i*Packet::SIZE], legacyPackets[i]); });
+	double codecEncodeNS = nsPerPacket(COUNT, [&](size_t i) { codecPackets[i].encode(&codecOut[i*Packet::SIZE]); });
+	double legacyEncodeNS = nsPerPacket(COUNT, [&](size_t i) {
+		legacyEncode(codecPackets[i], &legacyOut[i*Packet::SIZE]);
+	});
+	printf("%zu random packets, ns/packet on this host:\n", COUNT);
+	printf("  decode: codec %.2f, bitfield structs %.2f\n", codecDecodeNS, legacyDecodeNS);
+	printf("  encode: codec %.2f, bitfield structs %.2f\n", codecEncodeNS, legacyEncodeNS);
+	int differ = 0;
+	for(size_t i=0; i<COUNT; i++) {
+		if(codecPackets[i].type != PACKET_TYPE_CONTROL) continue;
+		uint8_t again[Packet::SIZE];
+		legacyPackets[i].encode(again);
+		if(memcmp(&codecOut[i*Packet::SIZE], &legacyOut[i*Packet::SIZE], Packet::SIZE) != 0 ||
+			memcmp(again, &frames[i*Packet::SIZE], Packet::SIZE) != 0) differ++;
+	}
+	CHECK(differ == 0, "%d control packets differ between the codec and the bitfield structs", differ);
+
+	// Transparent mode sends the packet, its CRC and padding up to the old frame size
+	struct XBeeProbe: public XBee {
+		void attach(HardwareSerial *uart) { uart_ = uart; apiMode_ = false; operationStatus_ = RES_OK; }
+	};
+	XBeeProbe& xbee = static_cast<XBeeProbe&>(XBee::xbee);
+	Radio radio;
+	xbee.attach(&radio);
+	Packet p(PACKET_TYPE_CONTROL, PACKET_SOURCE_LEFT_REMOTE);
+	p.payload.control.setAxis(0, 0.1); // transparent mode refuses high bits in bytes 0..6
+	p.payload.control.button2 = true;
+	CHECK(xbee.send(p) == RES_OK, "transparent send failed");
+	CHECK(radio.tx.size() == XBee::TRANSPARENT_FRAME_SIZE, "transparent frame is %d bytes", (int)radio.tx.size());
+	if(radio.tx.size() >= Packet::SIZE + 1) {
+		Packet q;
+		q.decode(radio.tx.data());
+		CHECK(q.payload.control.axis0 == p.payload.control.axis0 && q.payload.control.button2,
+			"transparent frame doesn't decode");
+		CHECK(radio.tx[Packet::SIZE] == q.calculateCRC(), "wrong CRC in transparent frame");
+	}
+
+	return hostTestResult();
+}
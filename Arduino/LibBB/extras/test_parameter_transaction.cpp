@@ -0,0 +1,301 @@
+//
+// Host test for parameter transactions (BBParameterTransaction.h). Three gains that must always be equal are
+// staged and committed every few runloop cycles from the console and over the command server, in the middle of a
+// cycle; no step() may ever see them differ, and each commit must give one parametersChanged() call. Also checks
+// that staging a string again reuses its space, that commit IDs and OP_COMMIT_STATUS report when a commit was
+// applied and whether a subsystem rejected it, that the console's "commit" replies only then, and that the XBee
+// sends channel, PAN and station to the module in one AT mode session per transaction. Build and run from this
+// directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_parameter_transaction.cpp host/host.cpp ../src/*.cpp -o test_parameter_transaction && ./test_parameter_transaction
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+using namespace bb;
+
+// Three gains that must always be equal, two strings, and a switch that makes parametersChanged() fail
+class Gains: public Subsystem {
+public:
+	static Gains gains;
+	Gains() {
+		name_ = "gains";
+		kp_ = ki_ = kd_ = 0;
+		strcpy(label_, "");
+		strcpy(note_, "");
+		reject_ = false;
+		setParameters(parameterTable_);
+	}
+	Result start(ConsoleStream*) { started_ = true; operationStatus_ = RES_OK; return RES_OK; }
+	Result stop(ConsoleStream*) { started_ = false; return RES_OK; }
+	Result step() {
+		cycles_++;
+		if(kp_ != ki_ || ki_ != kd_) partial_++;
+		return RES_OK;
+	}
+	Result parametersChanged(const uint8_t *indices, size_t num) {
+		(void)indices;
+		callbacks_++;
+		callbackParams_ += num;
+		return reject_ ? RES_PARAM_INVALID_VALUE : RES_OK;
+	}
+
+	float kp_, ki_, kd_;
+	char label_[16], note_[16];
+	bool reject_;
+	unsigned long cycles_ = 0, partial_ = 0, callbacks_ = 0, callbackParams_ = 0;
+	static const ParameterDescription parameterTable_[6];
+};
+Gains Gains::gains;
+
+const ParameterDescription Gains::parameterTable_[6] = {
+	BB_PARAM_FLOAT("kp", "", Gains::gains.kp_, 0, 1000),
+	BB_PARAM_FLOAT("ki", "", Gains::gains.ki_, 0, 1000),
+	BB_PARAM_FLOAT("kd", "", Gains::gains.kd_, 0, 1000),
+	BB_PARAM_STRING("label", "", Gains::gains.label_),
+	BB_PARAM_STRING("note", "", Gains::gains.note_),
+	BB_PARAM_BOOL("reject", "", Gains::gains.reject_)
+};
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes str(const char *s) {
+	Bytes b(s, s + strlen(s));
+	b.insert(b.begin(), uint8_t(b.size()));
+	return b;
+}
+static Bytes operator+(Bytes a, const Bytes& b) { a.insert(a.end(), b.begin(), b.end()); return a; }
+static Bytes floatValue(float f) { uint8_t u[4]; memcpy(u, &f, 4); return {PARAMETER_FLOAT, u[0], u[1], u[2], u[3]}; }
+static Bytes boolValue(bool v) { return {PARAMETER_BOOL, v}; }
+
+static ParameterValue stringValue(const char *s) {
+	ParameterValue v;
+	v.type = PARAMETER_STRING;
+	v.s = s;
+	return v;
+}
+
+static Bytes request(uint8_t opcode, const Bytes& args) {
+	Bytes req = Bytes{CommandServer::MAGIC, 0x34, 0x12, opcode} + args;
+	uint8_t response[CommandServer::MAX_DATAGRAM_SIZE];
+	size_t len = CommandServer::server.handleRequest(req.data(), req.size(), response);
+	return Bytes(response, response + len);
+}
+static Result result(const Bytes& response) { return response.size() > 4 ? (Result)response[4] : RES_CMD_FAILURE; }
+static uint16_t u16(const Bytes& response, size_t pos) {
+	return response.size() >= pos + 2 ? response[pos] | (response[pos+1] << 8) : 0xffff;
+}
+
+// Makes commits wait for ParameterTransaction::apply() as they do while the runloop runs
+struct RunloopProbe: public Runloop {
+	void setStarted(bool started) { started_ = started; }
+};
+
+// Stages the three gains and commits every fifth cycle, from the console or over the command server. It steps
+// after Gains, so from Gains' point of view that is in the middle of the cycle.
+struct Done {};
+class Driver: public Subsystem {
+public:
+	Driver() { name_ = "driver"; }
+	Result start(ConsoleStream*) { started_ = true; operationStatus_ = RES_OK; return RES_OK; }
+	Result stop(ConsoleStream*) { started_ = false; return RES_OK; }
+	Result step() {
+		if(++n_ > 3000) throw Done();
+		if(n_ % 5 || n_ > 2990) return RES_OK; // the last commit has time to be applied
+		float g = 1 + n_ % 999;
+		commits_++;
+		if(binary_) {
+			const char *names[] = {"kp", "ki", "kd"};
+			for(const char *name: names) {
+				if(result(request(CommandServer::OP_STAGE_PARAMETER, str("gains") + str(name) + floatValue(g))) != RES_OK) {
+					rejected_++;
+				}
+			}
+			if(result(request(CommandServer::OP_COMMIT_PARAMETERS, {})) != RES_OK) rejected_++;
+		} else {
+			char buf[128];
+			snprintf(buf, sizeof(buf), "stage gains kp %g\rstage gains ki %g\rstage gains kd %g\rcommit\r", g, g, g);
+			s_->in = buf;
+			s_->inPos = 0;
+		}
+		return RES_OK;
+	}
+
+	StringConsoleStream *s_ = NULL;
+	bool binary_ = false;
+	unsigned long n_ = 0, commits_ = 0, rejected_ = 0;
+};
+
+// An XBee in AT mode that answers everything with OK and counts "+++"
+struct ATRadio: public HardwareSerial {
+	std::deque<uint8_t> rx;
+	std::string line;
+	std::vector<std::string> commands;
+	int sessions = 0;
+	int available() { return rx.size(); }
+	int read() {
+		if(rx.empty()) return -1;
+		uint8_t c = rx.front();
+		rx.pop_front();
+		return c;
+	}
+	size_t write(uint8_t c) {
+		line += (char)c;
+		if(line == "+++" || c == '\r') {
+			if(line == "+++") sessions++;
+			else commands.push_back(line.substr(0, line.size() - 1));
+			line.clear();
+			rx.insert(rx.end(), {'O', 'K', '\r'});
+		}
+		return 1;
+	}
+	size_t write(const uint8_t *b, size_t n) { for(size_t i=0; i<n; i++) write(b[i]); return n; }
+};
+
+struct XBeeProbe: public XBee {
+	Result initializeWithoutModule(HardwareSerial *uart) { uart_ = uart; return Subsystem::initialize(); }
+	const char *channelPanStation() {
+		static char buf[32];
+		snprintf(buf, sizeof(buf), "%d %d %d", params_.chan, params_.pan, params_.station);
+		return buf;
+	}
+};
+
+// Runs the driver until it is done and checks what Gains saw
+static void runDriver(StringConsoleStream& s, bool binary) {
+	Gains& g = Gains::gains;
+	g.kp_ = g.ki_ = g.kd_ = 0;
+	g.cycles_ = g.partial_ = g.callbacks_ = g.callbackParams_ = 0;
+	static Driver d;
+	static bool registered = false;
+	if(!registered) registered = d.initialize() == RES_OK;
+	d.s_ = &s;
+	d.binary_ = binary;
+	d.n_ = d.commits_ = d.rejected_ = 0;
+	d.start(NULL);
+	try {
+		Runloop::runloop.start(NULL);
+	} catch(Done&) {
+	}
+	d.stop(NULL);
+	static_cast<RunloopProbe&>(Runloop::runloop).setStarted(false);
+
+	const char *how = binary ? "command server" : "console";
+	CHECK(g.partial_ == 0, "%s: %lu of %lu cycles saw a partial gain set", how, g.partial_, g.cycles_);
+	CHECK(g.callbacks_ == d.commits_ && g.callbackParams_ == 3 * d.commits_,
+		"%s: %lu parametersChanged() calls for %lu parameters after %lu commits", how, g.callbacks_, g.callbackParams_,
+		d.commits_);
+	CHECK(d.rejected_ == 0, "%s: %lu requests rejected", how, d.rejected_);
+	CHECK(binary || (s.out.find(errorMessage(RES_OK)) != std::string::npos && s.out.find("rror") == std::string::npos),
+		"%s: console says %s", how, s.out.c_str());
+	printf("%-14s %lu cycles, %lu commits, %lu saw a partial gain set\n", how, g.cycles_, d.commits_, g.partial_);
+}
+
+// Types line and steps the console cycles times
+static void type(StringConsoleStream& s, const char *line, int cycles = 1) {
+	s.in = line;
+	s.inPos = 0;
+	for(int i=0; i<cycles; i++) Console::console.step();
+	s.drain();
+}
+
+int main() {
+	Console::console.initialize();
+	Console::console.removeConsoleStream(Console::console.serialStream());
+	Console::console.start();
+	Gains::gains.initialize();
+	Gains::gains.start(NULL);
+	StringConsoleStream s;
+	Console::console.addConsoleStream(&s);
+	ParameterTransaction& tx = ParameterTransaction::transaction;
+	RunloopProbe& runloop = static_cast<RunloopProbe&>(Runloop::runloop);
+	Gains& g = Gains::gains;
+
+	// Staging a string again reuses its space, and the strings staged after it stay intact
+	int label = g.parameterIndex("label"), note = g.parameterIndex("note");
+	CHECK(tx.stage(&g, label, stringValue("first")) == RES_OK, "stage label");
+	CHECK(tx.stage(&g, note, stringValue("keep me")) == RES_OK, "stage note");
+	char value[16];
+	int failed = 0;
+	for(int i=0; i<1000; i++) {
+		snprintf(value, sizeof(value), "label %d", i);
+		if(tx.stage(&g, label, stringValue(value)) != RES_OK) failed++;
+	}
+	CHECK(failed == 0, "staging a string again failed %d of 1000 times", failed);
+	CHECK(tx.stage(&g, note, stringValue("kept")) == RES_OK, "stage note again");
+	CHECK(tx.commit() == RES_OK, "commit");
+	CHECK(!strcmp(g.label_, "label 999") && !strcmp(g.note_, "kept"), "label \"%s\", note \"%s\"", g.label_, g.note_);
+
+	// Binary commits are applied at the next cycle; OP_COMMIT_STATUS tells when and how
+	runloop.setStarted(true);
+	CHECK(result(request(CommandServer::OP_STAGE_PARAMETER, str("gains") + str("kp") + floatValue(5))) == RES_OK,
+		"stage kp");
+	Bytes r = request(CommandServer::OP_COMMIT_PARAMETERS, {});
+	uint16_t id = u16(r, 5);
+	CHECK(result(r) == RES_OK && r.size() == 7, "commit");
+	CHECK(result(request(CommandServer::OP_STAGE_PARAMETER, str("gains") + str("ki") + floatValue(5))) ==
+		RES_SUBSYS_WRONG_MODE, "staged while a commit is pending");
+	r = request(CommandServer::OP_COMMIT_STATUS, {});
+	CHECK(result(r) == RES_OK && r.size() == 8 && u16(r, 5) == (uint16_t)(id - 1), "commit reported applied before the cycle");
+	tx.apply();
+	r = request(CommandServer::OP_COMMIT_STATUS, {});
+	CHECK(r.size() == 8 && u16(r, 5) == id && r[7] == RES_OK && g.kp_ == 5, "commit %d not reported applied", id);
+
+	CHECK(result(request(CommandServer::OP_STAGE_PARAMETER, str("gains") + str("reject") + boolValue(true))) == RES_OK,
+		"stage reject");
+	r = request(CommandServer::OP_COMMIT_PARAMETERS, {});
+	CHECK(u16(r, 5) == (uint16_t)(id + 1), "commit IDs don't count up");
+	tx.apply();
+	r = request(CommandServer::OP_COMMIT_STATUS, {});
+	CHECK(r.size() == 8 && u16(r, 5) == (uint16_t)(id + 1) && r[7] == RES_PARAM_INVALID_VALUE,
+		"rejected commit reported as %s", r.size() == 8 ? errorMessage((Result)r[7]) : "nothing");
+
+	// The console's "commit" replies once the commit is applied, with what the subsystems said
+	type(s, "stage gains reject off\r");
+	s.out.clear();
+	type(s, "commit\r", 5);
+	CHECK(Console::console.reportRunning(&s) && s.out.find(errorMessage(RES_OK)) == std::string::npos,
+		"\"commit\" replied before the commit was applied: %s", s.out.c_str());
+	tx.apply();
+	type(s, "", 1);
+	CHECK(s.out.size() > 2 && s.out.find(errorMessage(RES_OK)) != std::string::npos &&
+		s.out.compare(s.out.size() - 2, 2, "> ") == 0, "\"commit\" after apply: %s", s.out.c_str());
+	type(s, "stage gains reject on\r");
+	s.out.clear();
+	type(s, "commit\r", 2);
+	tx.apply();
+	type(s, "", 1);
+	CHECK(s.out.find(errorMessage(RES_PARAM_INVALID_VALUE)) != std::string::npos, "rejected \"commit\": %s",
+		s.out.c_str());
+	g.reject_ = false;
+	runloop.setStarted(false);
+
+	// Commits in the middle of a cycle, from both sides
+	s.out.clear();
+	runDriver(s, false);
+	s.out.clear();
+	runDriver(s, true);
+
+	// The XBee applies channel, PAN and station changed together in one AT mode session
+	ATRadio radio;
+	XBeeProbe& xbee = static_cast<XBeeProbe&>(XBee::xbee);
+	xbee.initializeWithoutModule(&radio);
+	CHECK(tx.stageValue(&xbee, "channel", "14") == RES_OK && tx.stageValue(&xbee, "pan", "0x3332") == RES_OK &&
+		tx.stageValue(&xbee, "station", "0x101") == RES_OK, "staging XBee parameters failed");
+	CHECK(tx.commit() == RES_OK && tx.lastResult() == RES_OK, "XBee commit: %s", errorMessage(tx.lastResult()));
+	CHECK(radio.sessions == 1, "%d AT mode sessions for one transaction", radio.sessions);
+	CHECK(radio.commands == std::vector<std::string>({"ATCH=e", "ATID=3332", "ATMY=101", "ATCN"}),
+		"%d AT commands for one transaction", (int)radio.commands.size());
+	CHECK(!strcmp(xbee.channelPanStation(), "14 13106 257"), "XBee has %s", xbee.channelPanStation());
+	radio.sessions = 0;
+	radio.commands.clear();
+	CHECK(tx.stageValue(&xbee, "tdma_slots", "8") == RES_OK && tx.commit() == RES_OK, "TDMA commit");
+	CHECK(radio.sessions == 0, "TDMA parameters went to the module");
+
+	return hostTestResult();
+}
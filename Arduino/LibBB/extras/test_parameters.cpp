@@ -0,0 +1,171 @@
+//
+// Host test for parameter tables (BBParameter.h, Subsystem::setParameters()). A subsystem with 200 int and float
+// parameters plus a bool and a string checks that building the name index is the only allocation, that every
+// name is found at its index and near misses aren't, and that typed and string setters check type and range,
+// parse ints as decimal or hex but never octal, and report what changed. Also measures lookup and set on this
+// host. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_parameters.cpp host/host.cpp ../src/*.cpp -o test_parameters && ./test_parameters
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+
+#include <chrono>
+#include <new>
+#include <vector>
+
+using namespace bb;
+
+static long allocations = 0;
+void* operator new(size_t n) { allocations++; return malloc(n); }
+void* operator new[](size_t n) { allocations++; return malloc(n); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+class Big: public Subsystem {
+public:
+	static Big big;
+	Big() { name_ = "big"; }
+	Result start(ConsoleStream*) { return RES_OK; }
+	Result stop(ConsoleStream*) { return RES_OK; }
+	Result step() { return RES_OK; }
+	Result setup() { return setParameters(parameterTable_); }
+	Result parametersChanged(const uint8_t *indices, size_t num) {
+		changed_.assign(indices, indices + num);
+		return Subsystem::parametersChanged(indices, num);
+	}
+
+	int ints_[100];
+	float floats_[100];
+	bool enabled_;
+	char label_[8];
+	std::vector<uint8_t> changed_;
+	static const ParameterDescription parameterTable_[202];
+};
+Big Big::big;
+
+#define PAIR(i) \
+	BB_PARAM_INT("int_param_" #i, "An integer parameter", Big::big.ints_[i], -100000, 100000), \
+	BB_PARAM_FLOAT("float_param_" #i, "A float parameter", Big::big.floats_[i], -1000, 1000),
+#define TEN(t) PAIR(t##0) PAIR(t##1) PAIR(t##2) PAIR(t##3) PAIR(t##4) PAIR(t##5) PAIR(t##6) PAIR(t##7) PAIR(t##8) \
+	PAIR(t##9)
+const ParameterDescription Big::parameterTable_[202] = {
+	TEN() TEN(1) TEN(2) TEN(3) TEN(4) TEN(5) TEN(6) TEN(7) TEN(8) TEN(9)
+	BB_PARAM_BOOL("enabled", "A bool parameter", Big::big.enabled_),
+	BB_PARAM_STRING("label", "A string parameter", Big::big.label_)
+};
+
+static const size_t ENABLED = 200, LABEL = 201;
+
+// A subsystem with more parameters than the uint8_t indices in the name index and in parametersChanged() can take
+struct TooBig: public Subsystem {
+	Result start(ConsoleStream*) { return RES_OK; }
+	Result stop(ConsoleStream*) { return RES_OK; }
+	Result step() { return RES_OK; }
+	Result setup(const ParameterDescription *params, size_t num) { return setParameters(params, num); }
+};
+
+int main() {
+	Big& b = Big::big;
+
+	// Building the index is the only allocation
+	long before = allocations;
+	CHECK(b.setup() == RES_OK, "setParameters() failed");
+	CHECK(allocations - before == 1, "setParameters() allocated %ld times", allocations - before);
+	before = allocations;
+	CHECK(b.setup() == RES_OK && allocations == before, "setting the same size of table again allocated");
+	static ParameterDescription many[255];
+	TooBig tooBig;
+	CHECK(tooBig.setup(many, 255) == RES_COMMON_OUT_OF_RANGE, "255 parameters accepted");
+
+	// Every name at its index, no near misses
+	char name[32];
+	for(int i=0; i<100; i++) {
+		snprintf(name, sizeof(name), "int_param_%d", i);
+		CHECK(b.parameterIndex(name) == 2*i, "%s at %d", name, b.parameterIndex(name));
+		snprintf(name, sizeof(name), "float_param_%d", i);
+		CHECK(b.parameterIndex(name) == 2*i+1, "%s at %d", name, b.parameterIndex(name));
+	}
+	CHECK(b.parameterIndex("enabled") == (int)ENABLED && b.parameterIndex("label") == (int)LABEL, "bool or string");
+	const char *misses[] = {"int_param_100", "int_param_", "int_param_01", "INT_PARAM_1", "int_param_1 ", "", "label2",
+		"enable", "float_param_-1"};
+	for(const char *m: misses) CHECK(b.parameterIndex(m) == -1, "\"%s\" found at %d", m, b.parameterIndex(m));
+	CHECK(b.parameter(202) == NULL && b.parameter(201) != NULL, "parameter() range");
+
+	// String setters parse by type, check the range and leave the value alone on failure
+	struct { const char *name, *value; Result res; } sets[] = {
+		{"int_param_3", "42", RES_OK},
+		{"int_param_3", "-0x10", RES_OK},
+		{"int_param_3", "010", RES_OK},
+		{"int_param_3", "100001", RES_COMMON_OUT_OF_RANGE},
+		{"int_param_3", "4294967306", RES_PARAM_INVALID_VALUE},
+		{"int_param_3", "99999999999999999999999", RES_PARAM_INVALID_VALUE},
+		{"int_param_3", "1.5", RES_PARAM_INVALID_VALUE},
+		{"int_param_3", "", RES_PARAM_INVALID_VALUE},
+		{"int_param_3", "12abc", RES_PARAM_INVALID_VALUE},
+		{"float_param_3", "0.5", RES_OK},
+		{"float_param_3", "-1000", RES_OK},
+		{"float_param_3", "1000.5", RES_COMMON_OUT_OF_RANGE},
+		{"float_param_3", "nan", RES_COMMON_OUT_OF_RANGE},
+		{"float_param_3", "x", RES_PARAM_INVALID_VALUE},
+		{"enabled", "on", RES_OK},
+		{"enabled", "maybe", RES_PARAM_INVALID_VALUE},
+		{"label", "1234567", RES_OK},
+		{"label", "12345678", RES_COMMON_OUT_OF_RANGE},
+		{"nope", "1", RES_PARAM_NO_SUCH_PARAMETER}
+	};
+	for(auto& s: sets) {
+		Result res = b.setParameterValue(s.name, s.value);
+		CHECK(res == s.res, "setting %s to \"%s\": %s, expected %s", s.name, s.value, errorMessage(res),
+			errorMessage(s.res));
+	}
+	int i;
+	float f;
+	bool e;
+	const char *str;
+	CHECK(b.getParameter(6, i) == RES_OK && i == 10, "int_param_3 is %d, expected 10 from \"010\"", i);
+	CHECK(b.getParameter(7, f) == RES_OK && f == -1000, "float_param_3 is %g", f);
+	CHECK(b.getParameter(ENABLED, e) == RES_OK && e, "enabled not set");
+	CHECK(b.getParameter(LABEL, str) == RES_OK && !strcmp(str, "1234567"), "label is \"%s\"", str);
+	CHECK(b.changed_.size() == 1 && b.changed_[0] == LABEL, "parametersChanged() not told about the last set");
+
+	// Typed setters: an int can go into a float, nothing else crosses types
+	CHECK(b.setParameter(7, 3) == RES_OK && b.getParameter(7, f) == RES_OK && f == 3, "int into float parameter");
+	CHECK(b.setParameter(6, 0.5f) == RES_PARAM_INVALID_TYPE, "float into int parameter");
+	CHECK(b.setParameter(ENABLED, 1) == RES_PARAM_INVALID_TYPE, "int into bool parameter");
+	CHECK(b.setParameter(LABEL, (const char*)NULL) == RES_COMMON_OUT_OF_RANGE, "NULL string");
+	CHECK(b.setParameter(202, 1) == RES_PARAM_NO_SUCH_PARAMETER, "index past the table");
+	CHECK(b.getParameter(6, f) == RES_PARAM_INVALID_TYPE, "int read as float");
+	b.changed_.clear();
+	CHECK(b.setParameter(6, -5) == RES_OK && b.changed_.size() == 1 && b.changed_[0] == 6, "change not reported");
+	b.changed_.clear();
+	CHECK(b.setParameter(6, 200000) == RES_COMMON_OUT_OF_RANGE && b.changed_.empty(), "rejected value reported");
+
+	// Cost on this host: lookups and sets must not allocate
+	const int N = 200000;
+	char names[202][24];
+	for(int k=0; k<200; k++) snprintf(names[k], sizeof(names[k]), k % 2 ? "float_param_%d" : "int_param_%d", k/2);
+	before = allocations;
+	long sink = 0;
+	auto t0 = std::chrono::steady_clock::now();
+	for(int k=0; k<N; k++) sink += b.parameterIndex(names[k % 200]);
+	auto t1 = std::chrono::steady_clock::now();
+	for(int k=0; k<N; k++) b.setParameterValue(names[k % 200], k % 2 ? "0.5" : "42");
+	auto t2 = std::chrono::steady_clock::now();
+	for(int k=0; k<N; k++) {
+		if(k % 2) b.setParameter(k % 200, 0.5f);
+		else b.setParameter(k % 200, 42);
+	}
+	auto t3 = std::chrono::steady_clock::now();
+	CHECK(allocations == before, "lookups and sets allocated %ld times", allocations - before);
+	CHECK(sink == (long)N/200 * 199*200/2, "lookups found the wrong indices");
+	printf("200 parameters: lookup by name %.1fns, set from string %.1fns, typed set %.1fns on this host\n",
+		std::chrono::duration<double, std::nano>(t1 - t0).count() / N,
+		std::chrono::duration<double, std::nano>(t2 - t1).count() / N,
+		std::chrono::duration<double, std::nano>(t3 - t2).count() / N);
+
+	return hostTestResult();
+}
@@ -0,0 +1,181 @@
+//
+// Host test for the schema descriptor (BBSchema.h). Checks that the descriptor reads the same in any chunk size
+// and over OP_GET_SCHEMA, that its ID is the hash it claims, and that reading each field at its offset and type
+// from a raw LargeStatePacket gives what the telemetry encoder sends. It writes the schema, raw packets and
+// telemetry frames to a directory for check_schema.py, which fetches the schema from --serve mode with DroidGUI's
+// CommandClient and decodes both with DroidGUI's Schema. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_schema.cpp host/host.cpp ../src/*.cpp -o test_schema && ./test_schema /tmp/schema && python3 check_schema.py ./test_schema /tmp/schema && python3 check_telemetry.py /tmp/schema
+//
+// The raw packets go to states.raw (per sample: uint32 sample index, the LargeStatePacket), which
+// check_telemetry.py ignores.
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/TelemetryDump.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <random>
+#include <string>
+#include <sys/socket.h>
+#include <vector>
+
+using namespace bb;
+
+static std::vector<uint8_t> readSchema(size_t chunk) {
+	std::vector<uint8_t> blob;
+	uint8_t buf[256];
+	for(size_t n; (n = Schema::read(blob.size(), buf, chunk)) > 0; ) blob.insert(blob.end(), buf, buf + n);
+	return blob;
+}
+
+// The field's value as the encoder would send it, read the way a client does: at the descriptor's offset and type
+static bool fieldValue(const LargeStatePacket& p, const Schema::TelemetryField& f, int32_t& value) {
+	const uint8_t *m = (const uint8_t*)&p + f.offset;
+	float v;
+	switch(f.type) {
+	case (Schema::KIND_UNSIGNED << 4) | 1: v = *(const uint8_t*)m; break;
+	case (Schema::KIND_SIGNED << 4) | 1: v = *(const int8_t*)m; break;
+	case (Schema::KIND_UNSIGNED << 4) | 2: { uint16_t x; memcpy(&x, m, 2); v = x; break; }
+	case (Schema::KIND_SIGNED << 4) | 2: { int16_t x; memcpy(&x, m, 2); v = x; break; }
+	case (Schema::KIND_UNSIGNED << 4) | 4: { uint32_t x; memcpy(&x, m, 4); v = x; break; }
+	case (Schema::KIND_SIGNED << 4) | 4: { int32_t x; memcpy(&x, m, 4); v = x; break; }
+	case (Schema::KIND_FLOAT << 4) | 4: memcpy(&v, m, 4); break;
+	default: return false;
+	}
+	float f2 = v * f.scale;
+	value = (int32_t)(f2 < 0 ? f2 - 0.5f : f2 + 0.5f);
+	return true;
+}
+
+static int serve(int port) {
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if(fd < 0 || bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+		perror("bind");
+		return 1;
+	}
+	printf("serving on 127.0.0.1:%d\n", port);
+	fflush(stdout);
+	while(true) {
+		uint8_t req[CommandServer::MAX_DATAGRAM_SIZE], response[CommandServer::MAX_DATAGRAM_SIZE];
+		sockaddr_in from;
+		socklen_t fromLen = sizeof(from);
+		ssize_t len = recvfrom(fd, req, sizeof(req), 0, (sockaddr*)&from, &fromLen);
+		if(len <= 0) continue;
+		size_t responseLen = CommandServer::server.handleRequest(req, len, response);
+		if(responseLen > 0) sendto(fd, response, responseLen, 0, (sockaddr*)&from, fromLen);
+	}
+}
+
+int main(int argc, char **argv) {
+	if(argc > 2 && !strcmp(argv[1], "--serve")) return serve(atoi(argv[2]));
+
+	// Same bytes in any chunk size, and the ID is the folded FNV-1a hash of them
+	std::vector<uint8_t> blob = readSchema(256);
+	CHECK(blob.size() == Schema::size(), "read %d of %d bytes", (int)blob.size(), (int)Schema::size());
+	for(size_t chunk: {1, 7, 64, 251}) CHECK(readSchema(chunk) == blob, "chunks of %d differ", (int)chunk);
+	uint8_t dummy;
+	CHECK(Schema::read(blob.size(), &dummy, 1) == 0, "read past the end");
+	uint32_t h = 2166136261UL;
+	for(uint8_t b: blob) h = (h ^ b) * 16777619UL;
+	CHECK(Schema::id() == ((h >> 16) ^ (h & 0xffff)), "schema ID 0x%04x", Schema::id());
+	CHECK(blob[0] == Schema::VERSION, "version %d", blob[0]);
+
+	// Fields lie inside the packet, don't overlap, and have a type a client can read
+	std::vector<bool> used(sizeof(LargeStatePacket));
+	for(size_t i=0; i<TelemetryEncoder::NUM_FIELDS; i++) {
+		const Schema::TelemetryField& f = Schema::telemetryFields[i];
+		size_t size = f.type & 0xf;
+		CHECK(f.offset + size <= sizeof(LargeStatePacket), "%s outside the packet", f.name);
+		for(size_t b=f.offset; b<f.offset+size && b<used.size(); b++) {
+			if(used[b]) {
+				CHECK(false, "%s overlaps another field", f.name);
+				break;
+			}
+			used[b] = true;
+		}
+	}
+
+	// OP_GET_SCHEMA hands out the same bytes in datagram sized chunks
+	std::vector<uint8_t> fetched;
+	uint16_t schemaID = 0, schemaSize = 0;
+	for(int requests=0; requests<100; requests++) {
+		uint8_t req[] = {CommandServer::MAGIC, 1, 0, CommandServer::OP_GET_SCHEMA, uint8_t(fetched.size()),
+			uint8_t(fetched.size() >> 8)};
+		uint8_t r[CommandServer::MAX_DATAGRAM_SIZE];
+		size_t len = CommandServer::server.handleRequest(req, sizeof(req), r);
+		if(len < 9 || r[4] != RES_OK) {
+			CHECK(false, "OP_GET_SCHEMA at %d failed", (int)fetched.size());
+			break;
+		}
+		schemaID = r[5] | (r[6] << 8);
+		schemaSize = r[7] | (r[8] << 8);
+		if(len == 9) break;
+		fetched.insert(fetched.end(), r + 9, r + len);
+	}
+	CHECK(fetched == blob && schemaSize == blob.size() && schemaID == Schema::id(), "OP_GET_SCHEMA gave %d bytes",
+		(int)fetched.size());
+	uint8_t beyond[] = {CommandServer::MAGIC, 1, 0, CommandServer::OP_GET_SCHEMA, uint8_t(blob.size() + 1),
+		uint8_t((blob.size() + 1) >> 8)}, r[CommandServer::MAX_DATAGRAM_SIZE];
+	CHECK(CommandServer::server.handleRequest(beyond, sizeof(beyond), r) == 5 && r[4] == RES_COMMON_OUT_OF_RANGE,
+		"OP_GET_SCHEMA beyond the end");
+
+	// Random states: every field read via the descriptor matches the encoder's value
+	std::string dir = TelemetryDump::directory(argc, argv, "schema");
+	TelemetryDump dump(dir);
+	FILE *raw = fopen((dir + "/states.raw").c_str(), "wb");
+	std::mt19937 rng(7);
+	std::normal_distribution<float> n(0, 1);
+	LargeStatePacket p;
+	memset(&p, 0, sizeof(p));
+	strcpy(p.droidName, "Generic D-O");
+	TelemetryEncoder encoder(16);
+	uint8_t buf[TelemetryEncoder::MAX_FRAME_SIZE];
+	int mismatches = 0;
+	for(uint32_t i=0; i<2000; i++) {
+		p.timestamp = i / 104.0;
+		p.droidType = DROID_DO;
+		for(int k=0; k<3; k++) {
+			p.drive[k].errorState = (ErrorState)(rng() % 3);
+			p.drive[k].presentSpeed += n(rng);
+			p.drive[k].err = n(rng) * 10;
+			p.imu[k].r += 0.1 * n(rng);
+			p.imu[k].az = 1 + 0.01 * n(rng);
+			p.battery[k].current = rng() % 3000;
+		}
+		for(auto& c: p.lastControl) for(auto& b: c) b = rng();
+		for(auto& s: p.servo) s.present += n(rng);
+
+		int32_t values[TelemetryEncoder::NUM_FIELDS];
+		TelemetryEncoder::toFixed(p, values);
+		for(size_t f=0; f<TelemetryEncoder::NUM_FIELDS; f++) {
+			int32_t v;
+			if(!fieldValue(p, Schema::telemetryFields[f], v) || v != values[f]) {
+				if(mismatches++ < 5) CHECK(false, "%s reads %d via the schema, encoder has %d",
+					Schema::telemetryFields[f].name, v, values[f]);
+			}
+		}
+
+		size_t len = encoder.encode(p, buf);
+		if(buf[1] & TelemetryEncoder::FLAG_KEYFRAME) {
+			uint16_t frameID = buf[TelemetryEncoder::HEADER_SIZE] | (buf[TelemetryEncoder::HEADER_SIZE+1] << 8);
+			CHECK(frameID == Schema::id(), "keyframe carries schema 0x%04x", frameID);
+		}
+		dump.expect(i, p);
+		dump.frame("telemetry", i, buf, len);
+		fwrite(&i, 4, 1, raw);
+		fwrite(&p, sizeof(p), 1, raw);
+	}
+	fclose(raw);
+	printf("schema 0x%04x: %d bytes, %d fields, state size %d\n", Schema::id(), (int)blob.size(),
+		(int)TelemetryEncoder::NUM_FIELDS, (int)sizeof(LargeStatePacket));
+
+	return hostTestResult();
+}
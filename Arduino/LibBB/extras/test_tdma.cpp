@@ -0,0 +1,126 @@
+//
+// Host test for the XBee TDMA slot scheduling: slot assignment, holding packets back outside the own slot, the
+// full queue, collision detection and the beacon's source. The XBee talks API mode to a scripted radio that hands
+// it frames and records what it transmits. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_tdma.cpp host/host.cpp ../src/*.cpp -o test_tdma && ./test_tdma
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/XBeeRadio.h"
+
+#include <vector>
+
+using namespace bb;
+
+static const uint16_t COORDINATOR = 0x0101, OTHER = 0x0202, OWN = 0x1234;
+
+// Access to the state the test needs to set up directly
+struct XBeeProbe: public XBee {
+	void attach(HardwareSerial *uart, uint16_t station) { uart_ = uart; apiMode_ = true; params_.station = station; }
+	uint8_t pending() { return tdmaNumPending_; }
+	unsigned long dropped() { return tdmaDropped_; }
+	unsigned long collisions() { return tdmaCollisions_; }
+};
+struct RunloopProbe: public Runloop {
+	void setSequenceNumber(uint64_t n) { seqnum_ = n; }
+};
+
+static Packet statePacket(uint8_t marker) {
+	Packet p(PACKET_TYPE_STATE, PACKET_SOURCE_DROID);
+	p.payload.state.item = StatePacket::STATE_DRIVE;
+	p.payload.state.data.drive.speed = marker;
+	return p;
+}
+
+static Packet beacon(uint8_t numSlots, uint8_t seq) {
+	Packet p(PACKET_TYPE_CONFIG, PACKET_SOURCE_DROID);
+	p.payload.config.type = ConfigPacket::CONFIG_SUPERFRAME_BEACON;
+	p.payload.config.parameter.superframe.numSlots = numSlots;
+	p.payload.config.parameter.superframe.beaconSeq = seq;
+	return p;
+}
+
+int main() {
+	StringConsoleStream console;
+	Console::console.initialize();
+	Console::console.addConsoleStream(&console);
+	Console::console.start();
+
+	XBeeProbe& xbee = static_cast<XBeeProbe&>(XBee::xbee);
+	RunloopProbe& runloop = static_cast<RunloopProbe&>(Runloop::runloop);
+	Radio radio;
+	xbee.attach(&radio, OWN);
+
+	// Slots: overrides and derived slots stay clear of the coordinator's slot 0
+	for(int slots=2; slots<=64; slots++) {
+		xbee.setTDMA(true, false, slots);
+		for(int override=-1; override<=63; override++) {
+			xbee.setParameterValue("tdma_slot", String(override).c_str());
+			uint8_t s = xbee.tdmaSlot();
+			CHECK(s >= 1 && s < slots, "%d slots, tdma_slot %d gives slot %d", slots, override, s);
+		}
+		for(uint16_t id=0; id<0x800; id++) {
+			uint8_t s = XBee::slotFromStationID(id, slots);
+			CHECK(s >= 1 && s < slots, "%d slots, station 0x%x gives slot %d", slots, id, s);
+		}
+	}
+	xbee.setParameterValue("tdma_slot", "-1");
+	console.out.clear();
+	xbee.setTDMA(true, false, 8);
+	console.drain();
+	CHECK(console.out.find("derived from the station ID") != std::string::npos, "no warning about a derived slot");
+
+	// Sync to a beacon at cycle 0
+	runloop.setSequenceNumber(0);
+	radio.receive(COORDINATOR, beacon(8, 1));
+	xbee.receiveAndHandleAPIMode();
+	CHECK(xbee.isTDMASynced(), "not synced after a beacon");
+	uint8_t own = xbee.tdmaSlot();
+	uint8_t other = own == 1 ? 2 : 1;
+
+	// Outside the own slot nothing goes out; the oldest of too many queued packets is dropped
+	runloop.setSequenceNumber(8 + other);
+	for(int i=0; i<6; i++) xbee.sendTo(0x0001, statePacket(i), false);
+	CHECK(radio.transmitted().size() == 0, "packets sent outside the own slot");
+	CHECK(xbee.pending() == 4, "%d pending, expected 4", xbee.pending());
+	CHECK(xbee.dropped() == 2, "%lu dropped, expected 2", xbee.dropped());
+
+	runloop.setSequenceNumber(8 + own);
+	xbee.step();
+	std::vector<Packet> sent = radio.transmitted();
+	CHECK(sent.size() == 4, "%d sent in the own slot, expected 4", (int)sent.size());
+	for(size_t i=0; i<sent.size(); i++) {
+		CHECK(sent[i].payload.state.data.drive.speed == int(i) + 2, "packet %d is #%d, expected the newest four",
+			(int)i, sent[i].payload.state.data.drive.speed);
+	}
+
+	// Another station in our slot is a collision, the coordinator isn't
+	console.out.clear();
+	radio.receive(COORDINATOR, statePacket(0));
+	xbee.receiveAndHandleAPIMode();
+	CHECK(xbee.collisions() == 0, "coordinator counted as collision");
+	radio.receive(OTHER, statePacket(0));
+	radio.receive(OTHER, statePacket(0));
+	xbee.receiveAndHandleAPIMode();
+	console.drain();
+	CHECK(xbee.collisions() == 2, "%lu collisions, expected 2", xbee.collisions());
+	CHECK(console.out.find("is sending in our slot") != std::string::npos, "no collision warning");
+	CHECK(console.out.find("is sending in our slot") == console.out.rfind("is sending in our slot"),
+		"collision warned more than once");
+
+	// Beacons carry the configured source
+	xbee.setTDMA(true, true, 8);
+	xbee.setPacketSource(PACKET_SOURCE_RIGHT_REMOTE);
+	runloop.setSequenceNumber(16);
+	radio.tx.clear();
+	xbee.step();
+	sent = radio.transmitted();
+	CHECK(sent.size() == 1 && sent[0].type == PACKET_TYPE_CONFIG &&
+		sent[0].payload.config.type == ConfigPacket::CONFIG_SUPERFRAME_BEACON, "no beacon sent");
+	CHECK(sent.size() == 1 && sent[0].source == PACKET_SOURCE_RIGHT_REMOTE, "beacon source %d",
+		sent.size() ? sent[0].source : -1);
+
+	return hostTestResult();
+}
@@ -0,0 +1,90 @@
+//
+// Host test for the compact telemetry encoder (BBTelemetry.h). Encodes a random walk of droid states with field
+// mask changes, loses some frames on the way, and checks the frames here for size and keyframe spacing. It also
+// writes them to a directory so check_telemetry.py can decode them with DroidGUI's decoder and compare with the
+// expected values. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_telemetry.cpp host/host.cpp ../src/*.cpp -o test_telemetry && ./test_telemetry /tmp/telemetry && python3 check_telemetry.py /tmp/telemetry
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/TelemetryDump.h"
+
+#include <chrono>
+#include <random>
+
+using namespace bb;
+
+int main(int argc, char **argv) {
+	TelemetryDump dump(TelemetryDump::directory(argc, argv, "telemetry"));
+
+	std::mt19937 rng(7);
+	std::normal_distribution<float> n(0, 1);
+	LargeStatePacket p;
+	memset(&p, 0, sizeof(p));
+	strcpy(p.droidName, "Generic D-O");
+	p.droidType = DROID_DO;
+
+	TelemetryEncoder encoder(16);
+	uint8_t buf[TelemetryEncoder::MAX_FRAME_SIZE];
+	size_t bytes = 0, maxLen = 0;
+	unsigned int sinceKeyframe = 0, maxSinceKeyframe = 0;
+	const int SAMPLES = 3000;
+	for(int i=0; i<SAMPLES; i++) {
+		if(i == 500) { // only the first 40 fields
+			uint8_t mask[TelemetryEncoder::BITMAP_SIZE] = {0};
+			for(int f=0; f<40; f++) mask[f/8] |= 1 << (f%8);
+			encoder.setFieldMask(mask);
+			CHECK(encoder.keyframeDue(), "changing the mask doesn't force a keyframe");
+		}
+		if(i == 1000) encoder.setFieldMask(NULL);
+
+		p.timestamp = i / 104.0;
+		for(int k=0; k<3; k++) {
+			p.drive[k].errorState = (ErrorState)(rng() % 3);
+			p.drive[k].presentSpeed += n(rng);
+			p.drive[k].presentPos += p.drive[k].presentSpeed / 104;
+			p.drive[k].err = n(rng) * 10;
+			p.drive[k].control = n(rng);
+			p.imu[k].r += 0.1 * n(rng);
+			p.imu[k].dh = n(rng) * 100;
+			p.imu[k].az = 1 + 0.01 * n(rng);
+			p.battery[k].voltage = 12 + 0.1 * n(rng);
+			p.battery[k].current = rng() % 3000;
+		}
+		for(auto& c: p.lastControl) for(auto& b: c) b = rng();
+		for(auto& s: p.servo) {
+			s.present += n(rng);
+			s.load = n(rng) * 50;
+		}
+		if(i == 2000) p.imu[0].h = 1e12; // saturates
+
+		size_t len = encoder.encode(p, buf);
+		CHECK(len <= TelemetryEncoder::MAX_FRAME_SIZE, "frame of %d bytes", (int)len);
+		bytes += len;
+		if(len > maxLen) maxLen = len;
+		if(buf[1] & TelemetryEncoder::FLAG_KEYFRAME) sinceKeyframe = 0;
+		else if(++sinceKeyframe > maxSinceKeyframe) maxSinceKeyframe = sinceKeyframe;
+
+		dump.expect(i, p);
+		if(rng() % 20 != 0) dump.frame("lossy", i, buf, len); // 5% loss
+	}
+	CHECK(maxSinceKeyframe <= encoder.keyframeInterval(), "%u delta frames after a keyframe", maxSinceKeyframe);
+	CHECK(encoder.frames() == (unsigned long)SAMPLES, "%lu frames counted", encoder.frames());
+	printf("%d bytes raw, %.1f bytes per frame on average (%.1fx smaller), %d at most, %lu keyframes\n",
+		(int)sizeof(LargeStatePacket), (double)bytes/SAMPLES, sizeof(LargeStatePacket)*(double)SAMPLES/bytes,
+		(int)maxLen, encoder.keyframes());
+
+	auto t0 = std::chrono::steady_clock::now();
+	size_t sum = 0;
+	for(int i=0; i<200000; i++) {
+		p.imu[0].r += 0.01f;
+		sum += encoder.encode(p, buf);
+	}
+	auto t1 = std::chrono::steady_clock::now();
+	printf("encode: %.3f us per frame on this host (%d bytes)\n",
+		std::chrono::duration<double, std::micro>(t1-t0).count() / 200000, (int)(sum/200000));
+
+	return hostTestResult();
+}
@@ -0,0 +1,130 @@
+//
+// Host test for TelemetryService subscriptions: three clients subscribe to different channels at different rates,
+// one lets its lease run out. Checks that every subscriber gets one frame per period and no more (keyframes
+// included), and writes each subscriber's frames to a directory so check_telemetry.py can verify they all decode
+// with DroidGUI's decoder. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_telemetry_service.cpp host/host.cpp ../src/*.cpp -o test_telemetry_service && ./test_telemetry_service /tmp/telsub && python3 check_telemetry.py /tmp/telsub
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/TelemetryDump.h"
+
+#include <random>
+#include <vector>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 1000000 / 104;
+
+struct TestService: public TelemetryService {
+	TestService() {}
+};
+
+// Records what each subscriber (told apart by the last address byte) receives, in which cycle
+struct Transport: public TelemetryService::Transport {
+	TelemetryDump *dump;
+	TestService *service;
+	int cycle = 0;
+	unsigned long keyframes = 0;
+	int keyframeCycle = 0;
+	std::map<int, std::vector<int>> cycles;
+	bool sendTo(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) {
+		(void)port;
+		if(service->encoder().keyframes() != keyframes) { // encoded in this cycle
+			keyframes = service->encoder().keyframes();
+			keyframeCycle = cycle;
+		}
+		// A keyframe resent to a subscriber that missed it carries the sample it was encoded from
+		int sample = (data[1] & TelemetryEncoder::FLAG_KEYFRAME) ? keyframeCycle : cycle;
+		dump->frame("sub" + std::to_string(addr[3]), sample, data, len);
+		cycles[addr[3]].push_back(cycle);
+		return true;
+	}
+};
+
+static void request(TestService& service, int id, std::vector<uint8_t> channels, uint16_t rate, uint16_t lease) {
+	std::vector<uint8_t> buf = {TelemetryService::MAGIC, TelemetryService::REQUEST_SUBSCRIBE,
+		uint8_t(rate), uint8_t(rate >> 8), uint8_t(lease), uint8_t(lease >> 8), uint8_t(channels.size())};
+	buf.insert(buf.end(), channels.begin(), channels.end());
+	service.incomingUDPPacket(IPAddress(10, 0, 0, id), 3000, buf.data(), buf.size());
+}
+
+static std::vector<uint8_t> channels(std::initializer_list<std::pair<int, int>> ranges) {
+	std::vector<uint8_t> v;
+	for(auto& r: ranges) for(int i=0; i<r.second; i++) v.push_back(r.first + i);
+	return v;
+}
+
+// Number of frames in [from, to) cycles
+static int framesBetween(const std::vector<int>& cycles, int from, int to) {
+	int n = 0;
+	for(int c: cycles) if(c >= from && c < to) n++;
+	return n;
+}
+
+int main(int argc, char **argv) {
+	TelemetryDump dump(TelemetryDump::directory(argc, argv, "telsub"));
+	Runloop::runloop.setCycleTimeMicros(CYCLE_US);
+	TestService service;
+	Transport transport;
+	transport.dump = &dump;
+	transport.service = &service;
+	service.initialize(&transport);
+	service.start();
+
+	std::mt19937 rng(1);
+	std::normal_distribution<float> n(0, 1);
+	LargeStatePacket p;
+	memset(&p, 0, sizeof(p));
+	strcpy(p.droidName, "Generic D-O");
+
+	// timestamp is channel 0, drive[0] 2..11, imu[0] 32..41, battery[0] 118..120
+	std::vector<uint8_t> imu = channels({{0, 1}, {32, 10}}), battery = channels({{0, 1}, {118, 3}});
+	int collected = 0;
+	for(int c=0; c<3000; c++) {
+		transport.cycle = c;
+		hostMicros = (unsigned long)c * CYCLE_US;
+		if(c == 100 || (c > 100 && c % 200 == 0)) request(service, 1, imu, 0, 3000); // every cycle
+		if(c == 300 || (c > 300 && c < 2500 && c % 200 == 0)) request(service, 2, battery, 10, 3000);
+		if(c == 500) request(service, 3, channels({{2, 10}}), 50, 1000); // not renewed
+		service.step();
+
+		p.timestamp = c / 104.0;
+		p.imu[0].r += 0.05 * n(rng);
+		p.imu[0].az = 1 + 0.01 * n(rng);
+		p.battery[0].voltage = 15 + 0.01 * n(rng);
+		p.drive[0].presentSpeed += n(rng);
+		dump.expect(c, p);
+		if(service.wantsSample()) {
+			collected++;
+			service.publish(p);
+		}
+	}
+
+	for(auto& s: transport.cycles) {
+		for(size_t i=1; i<s.second.size(); i++) {
+			if(s.second[i] == s.second[i-1]) {
+				CHECK(false, "subscriber %d got two frames in cycle %d", s.first, s.second[i]);
+				break;
+			}
+		}
+	}
+	std::vector<int>& a = transport.cycles[1];
+	std::vector<int>& b = transport.cycles[2];
+	std::vector<int>& c = transport.cycles[3];
+	CHECK(framesBetween(a, 100, 3000) == 2900, "A got %d frames in 2900 cycles", framesBetween(a, 100, 3000));
+	// 10Hz at 104Hz runloop rate is every 10th cycle (see TelemetryService::isDue()). Keyframes must not add to
+	// that. The lease runs out 3000ms after the last renewal.
+	int bFrames = framesBetween(b, 300, 2500);
+	CHECK(bFrames >= 218 && bFrames <= 222, "B got %d frames in 2200 cycles at 10Hz", bFrames);
+	CHECK(framesBetween(b, 2400 + 313 + 2, 3000) == 0, "B still gets frames after its lease ran out");
+	int cFrames = framesBetween(c, 500, 3000);
+	CHECK(cFrames >= 50 && cFrames <= 54, "C got %d frames in its 1s lease at 50Hz", cFrames);
+	CHECK(service.numSubscribers() == 1, "%u subscribers at the end", service.numSubscribers());
+	printf("A %d, B %d, C %d frames, %d of 3000 samples collected\n", (int)a.size(), (int)b.size(), (int)c.size(),
+		collected);
+
+	return hostTestResult();
+}
@@ -0,0 +1,91 @@
+//
+// Host test for batched UDP telemetry (WifiServer::streamUDPPacket()): a subscriber takes every sample of a 104Hz
+// runloop with some timing jitter, once unbatched and once with batch_age 30ms. Checks the number of datagrams,
+// their size and how long a frame waits in a batch, and writes the datagrams to a directory so check_telemetry.py
+// can split the batches and decode the frames with DroidGUI's code. Build and run from this directory:
+//
+//   c++ -std=gnu++17 -O2 -DARDUINO_ARCH_SAMD -Ihost -I../include test_udp_batching.cpp host/host.cpp ../src/*.cpp -o test_udp_batching && ./test_udp_batching /tmp/batch && python3 check_telemetry.py /tmp/batch
+//
+
+#include <LibBB.h>
+#include "host/HostTest.h"
+#include "host/TelemetryDump.h"
+
+#include <random>
+
+using namespace bb;
+
+static const unsigned long CYCLE_US = 1000000 / 104;
+static const int SAMPLES = 1040;
+
+static TelemetryDump *dump;
+static std::string stream;
+static unsigned long datagrams, maxSize, maxWaitUS;
+
+// Batches carry the micros() of each frame, which is the sample key in expected.bin
+static bool sink(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) {
+	(void)addr; (void)port;
+	datagrams++;
+	if(len > maxSize) maxSize = len;
+	if(len >= 6 && data[0] == 0xb4) {
+		uint32_t firstUS = data[2] | (data[3] << 8) | (data[4] << 16) | ((uint32_t)data[5] << 24);
+		if(hostMicros - firstUS > maxWaitUS) maxWaitUS = hostMicros - firstUS;
+	}
+	dump->frame(stream, hostMicros, data, len);
+	return true;
+}
+
+static void run(int batchAgeMS, std::mt19937& rng) {
+	stream = "age" + std::to_string(batchAgeMS);
+	datagrams = maxSize = maxWaitUS = 0;
+	WifiServer::server.setParameterValue("batch_age", String(batchAgeMS).c_str());
+	// A run takes 10s, which is as long as a lease can be
+	std::vector<uint8_t> channels;
+	for(int i=0; i<12; i++) channels.push_back(i);
+	for(int i=32; i<42; i++) channels.push_back(i);
+	TelemetryService::telemetry.subscribe(IPAddress(10, 0, 0, 2), 3000, channels.data(), channels.size(), 0, 60000);
+
+	std::normal_distribution<float> n(0, 1);
+	LargeStatePacket p;
+	memset(&p, 0, sizeof(p));
+	strcpy(p.droidName, "Generic D-O");
+	unsigned long start = hostMicros;
+	for(int c=0; c<SAMPLES; c++) {
+		hostMicros = start + c * CYCLE_US + rng() % 300;
+		WifiServer::server.step();
+		TelemetryService::telemetry.step();
+		p.timestamp = c / 104.0;
+		p.imu[0].r += 0.05 * n(rng);
+		p.imu[0].az = 1 + 0.01 * n(rng);
+		p.drive[0].presentSpeed += n(rng);
+		p.drive[0].err = n(rng);
+		dump->expect(hostMicros, p);
+		if(TelemetryService::telemetry.wantsSample()) TelemetryService::telemetry.publish(p);
+	}
+	WifiServer::server.flushUDPStreams();
+	TelemetryService::telemetry.unsubscribe(IPAddress(10, 0, 0, 2), 3000); // the next run starts with a keyframe
+	hostMicros += 1000000; // keeps the next run's timestamps apart
+	printf("batch_age %d: %lu datagrams for %d samples, %lu bytes at most, frames wait %.1fms at most\n",
+		batchAgeMS, datagrams, SAMPLES, maxSize, maxWaitUS / 1000.0);
+}
+
+int main(int argc, char **argv) {
+	TelemetryDump d(TelemetryDump::directory(argc, argv, "batch"));
+	dump = &d;
+	hostUDPSink = sink;
+	Runloop::runloop.setCycleTimeMicros(CYCLE_US);
+	TelemetryService::telemetry.initialize();
+	TelemetryService::telemetry.start();
+
+	std::mt19937 rng(1);
+	run(0, rng);
+	CHECK(datagrams == SAMPLES, "%lu datagrams unbatched", datagrams);
+
+	run(30, rng);
+	// A batch holds the frames of 30ms, i.e. 3-4 cycles
+	CHECK(datagrams <= SAMPLES / 3 + 1 && datagrams >= SAMPLES / 4, "%lu datagrams with batch_age 30", datagrams);
+	CHECK(maxSize <= 512, "batch of %lu bytes", maxSize);
+	CHECK(maxWaitUS <= 30000 + CYCLE_US, "a frame waited %luus in a batch", maxWaitUS);
+
+	return hostTestResult();
+}
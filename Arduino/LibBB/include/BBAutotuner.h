@@ -0,0 +1,116 @@
+#if !defined(BBAUTOTUNER_H)
+#define BBAUTOTUNER_H
+
+#include <Arduino.h>
+#include "BBSubsystem.h"
+#include "BBControllers.h"
+
+namespace bb {
+
+//
+// PID AUTOTUNER
+//
+// Finds PID gains with a relay feedback experiment (Astrom-Hagglund). While running, the autotuner drives the
+// output itself, bias + amplitude when the input is below the setpoint and bias - amplitude when it is above, with
+// some hysteresis. Most loops settle into a limit cycle under that; its period is the ultimate period Tu, and from
+// its amplitude a the ultimate gain is Ku = 4 amplitude / (pi sqrt(a^2 - hysteresis^2)). A tuning rule turns Ku and
+// Tu into gains, which the autotuner can stage in the ParameterTransaction for review ("staged", then "commit" or
+// "abort" on the console).
+//
+// The sign convention is the PIDController's: a positive output must raise the input. Gains are divided by the
+// input's controlGain(), like the controller multiplies by it.
+//
+// It is a subsystem stepped by the runloop, one input sample and one relay decision per cycle, so the experiment
+// never blocks. "start" begins an experiment with the setpoint at the present input plus offset, "stop" aborts it.
+// start() takes the input as it is, so update it first if it isn't updated every cycle anyway.
+// While isStarted(), whoever owns the loop must not update its own controller on the same output. The experiment
+// also aborts, leaving the output at bias, when the input leaves setpoint +-max_deviation, when it takes longer than
+// timeout, or when the abort button (setAbortButton()) is pressed.
+//
+class PIDAutotuner: public Subsystem {
+public:
+	static PIDAutotuner autotuner;
+
+	enum Rule {
+		RULE_ZN_P           = 0, // Ziegler-Nichols P
+		RULE_ZN_PI          = 1, // Ziegler-Nichols PI
+		RULE_ZN_PID         = 2, // Ziegler-Nichols classic PID, fast but overshoots
+		RULE_PESSEN         = 3, // Pessen integral rule, faster still
+		RULE_SOME_OVERSHOOT = 4, // Ziegler-Nichols "some overshoot"
+		RULE_NO_OVERSHOOT   = 5, // Ziegler-Nichols "no overshoot"
+		RULE_TYREUS_LUYBEN  = 6  // Tyreus-Luyben PID, robust, slow integral
+	};
+	static const int NUM_RULES = 7;
+
+	enum State {
+		STATE_IDLE    = 0,
+		STATE_RUNNING = 1,
+		STATE_DONE    = 2,
+		STATE_ABORTED = 3, // by stop(), abort() or the abort button
+		STATE_FAILED  = 4  // safety limit, timeout or no usable limit cycle
+	};
+
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual void printStatus(ConsoleStream *stream);
+
+	// Sets the loop to tune. If owner is given, proposed gains are staged as its parameters kp, ki and kd.
+	void attach(ControlInput& input, ControlOutput& output, Subsystem *owner = NULL, const char *kp = NULL,
+		const char *ki = NULL, const char *kd = NULL);
+	// Pin of a button, to ground, that aborts the experiment. -1 for none.
+	void setAbortButton(int pin);
+	void abort();
+
+	State state() { return state_; }
+	// Why the last experiment failed, RES_OK if it didn't.
+	Result lastResult() { return lastResult_; }
+	// Ultimate gain and period of the last successful experiment.
+	float ultimateGain() { return ku_; }
+	float ultimatePeriod() { return tu_; }
+	// Gains from Ku and Tu according to rule. False if there is no result yet.
+	bool gains(Rule rule, float& kp, float& ki, float& kd);
+	// Stages the gains according to rule, or to the rule parameter, as the owner's parameters.
+	Result stageGains(Rule rule);
+	Result stageGains() { return stageGains(Rule(rule_)); }
+
+protected:
+	PIDAutotuner();
+
+	void finish(State state, Result res);
+
+	Result handleStageCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+	static const ParameterDescription parameterTable_[];
+
+	// Kp, Ti and Td as multiples of Ku, Tu and Tu. Ti 0 means no integral.
+	struct RuleFactors {
+		const char *name;
+		float kp, ti, td;
+	};
+	static const RuleFactors rules_[NUM_RULES];
+
+	// Parameters
+	float offset_, bias_, amplitude_, hysteresis_, maxDeviation_, timeout_;
+	int cycles_, rule_;
+	bool stage_;
+
+	ControlInput *input_;
+	ControlOutput *output_;
+	Subsystem *owner_;
+	const char *kpName_, *kiName_, *kdName_;
+	int abortPin_;
+
+	State state_;
+	Result lastResult_;
+	float setpoint_, inputMin_, inputMax_;
+	bool high_;
+	unsigned long startMS_, lastRiseUS_;
+	int rises_, periods_;
+	float periodSum_, periodMin_, periodMax_, amplitudeSum_;
+	float ku_, tu_;
+};
+
+};
+
+#endif // BBAUTOTUNER_H
@@ -0,0 +1,207 @@
+#if !defined(BBBIQUAD_H)
+#define BBBIQUAD_H
+
+#include <math.h>
+#include <BBFixedPoint.h>
+
+namespace bb {
+
+enum BiquadType {
+	BIQUAD_LOWPASS  = 0,
+	BIQUAD_HIGHPASS = 1,
+	BIQUAD_BANDPASS = 2,
+	BIQUAD_NOTCH    = 3
+};
+
+//
+// Cascade of ORDER/2 second order sections, filtering CHANNELS signals with the same response. Low and high pass
+// are Butterworth of the full order, band pass (0dB peak) and notch are ORDER/2 identical sections of quality q.
+// Sections come from the bilinear transform prewarped at the filter frequency, so the response at that frequency
+// is exact at any sample rate below twice of it.
+//
+// Filter state is kept structure-of-arrays, one array per delay element with the channels side by side, so one
+// sample of all channels is a tight loop per section that loads each coefficient once. Filtering runs in T, Direct
+// Form I, which is the forgiving form for fixed point.
+//
+// For sample periods that vary, designAdaptive() tabulates sine and cosine of the prewarped half angle over a range
+// of periods, and filter() with a period interpolates them and recomputes the sections: a few multiplications and
+// one division per section and sample, shared by all channels, instead of trigonometry. Both are smooth in the
+// period, so TABLE_SIZE entries keep the error small even close to the Nyquist frequency. Periods outside the
+// range are clamped.
+//
+template<int ORDER, int CHANNELS, typename T = ControlScalar, int TABLE_SIZE = 8> class BiquadCascade {
+public:
+	static_assert(ORDER >= 2 && ORDER % 2 == 0, "ORDER must be even");
+	static_assert(TABLE_SIZE >= 2, "TABLE_SIZE must be at least 2");
+	static const int SECTIONS = ORDER/2;
+
+	BiquadCascade() {
+		type_ = BIQUAD_LOWPASS;
+		table_ = NULL;
+		minUS_ = maxUS_ = 0;
+		for(int s=0; s<SECTIONS; s++) {
+			invQ_[s] = T(0);
+			sections_[s] = {T(1), T(0), T(0), T(0), T(0)}; // pass through
+		}
+		reset();
+	}
+	~BiquadCascade() { delete[] table_; }
+	BiquadCascade(const BiquadCascade&) = delete;
+	BiquadCascade& operator=(const BiquadCascade&) = delete;
+
+	// Returns false if frequency isn't below half the sample frequency.
+	bool design(BiquadType type, float frequency, float sampleFreq, float q = 0.70710678f) {
+		if(!(frequency > 0 && frequency < sampleFreq / 2)) return false;
+		setType(type, q);
+		float theta = float(M_PI) * frequency / sampleFreq;
+		computeSections(T(sinf(theta)), T(cosf(theta)));
+		delete[] table_;
+		table_ = NULL;
+		return true;
+	}
+
+	// Designs for sample periods from minUS to maxUS. Returns false if frequency isn't below half the lowest sample
+	// frequency.
+	bool designAdaptive(BiquadType type, float frequency, unsigned long minUS, unsigned long maxUS,
+		float q = 0.70710678f) {
+		if(minUS == 0 || maxUS < minUS + TABLE_SIZE || !(frequency > 0 && frequency < 0.5e6f / maxUS)) return false;
+		setType(type, q);
+		if(table_ == NULL) table_ = new T[2 * TABLE_SIZE];
+		for(int i=0; i<TABLE_SIZE; i++) {
+			float theta = float(M_PI) * frequency * 1e-6f * (minUS + float(maxUS - minUS) * i / (TABLE_SIZE - 1));
+			table_[2*i] = T(sinf(theta));
+			table_[2*i+1] = T(cosf(theta));
+		}
+		minUS_ = minUS;
+		maxUS_ = maxUS;
+		scale_ = uint32_t((uint64_t(TABLE_SIZE - 1) << 32) / (maxUS - minUS));
+		interpolate(minUS_ + (maxUS_ - minUS_)/2);
+		return true;
+	}
+
+	bool adaptive() { return table_ != NULL; }
+	// Clears the filter state, e.g. after a jump in the input.
+	void reset() {
+		for(int i=0; i<=SECTIONS; i++) {
+			for(int c=0; c<CHANNELS; c++) hist_[i][0][c] = hist_[i][1][c] = T(0);
+		}
+	}
+
+	// Filters one sample of every channel. in and out may be the same array.
+	void filter(const float *in, float *out) {
+		T x[CHANNELS];
+		for(int c=0; c<CHANNELS; c++) x[c] = T(in[c]);
+		process(x);
+		for(int c=0; c<CHANNELS; c++) out[c] = float(x[c]);
+	}
+
+	// Filters one sample of every channel, dtUS after the previous one. Only for adaptive filters.
+	void filter(const float *in, float *out, unsigned long dtUS) {
+		if(table_ != NULL) interpolate(dtUS);
+		filter(in, out);
+	}
+
+	float filter(float in) {
+		static_assert(CHANNELS == 1, "filter(float) is for single channel filters");
+		filter(&in, &in);
+		return in;
+	}
+
+	float filter(float in, unsigned long dtUS) {
+		static_assert(CHANNELS == 1, "filter(float) is for single channel filters");
+		filter(&in, &in, dtUS);
+		return in;
+	}
+
+	// Filters one sample of every channel in place, without conversion.
+	void process(T *x) {
+		for(int s=0; s<SECTIONS; s++) {
+			const Section& k = sections_[s];
+			T *x1 = hist_[s][0], *x2 = hist_[s][1];     // this section's input history
+			T *y1 = hist_[s+1][0], *y2 = hist_[s+1][1]; // its output history, the next section's input history
+			for(int c=0; c<CHANNELS; c++) {
+				T y = k.b0*x[c] + k.b1*x1[c] + k.b2*x2[c] - k.a1*y1[c] - k.a2*y2[c];
+				x2[c] = x1[c];
+				x1[c] = x[c];
+				x[c] = y;
+			}
+		}
+		T *y1 = hist_[SECTIONS][0], *y2 = hist_[SECTIONS][1];
+		for(int c=0; c<CHANNELS; c++) {
+			y2[c] = y1[c];
+			y1[c] = x[c];
+		}
+	}
+
+protected:
+	// y = b0 x + b1 x[n-1] + b2 x[n-2] - a1 y[n-1] - a2 y[n-2]
+	struct Section {
+		T b0, b1, b2, a1, a2;
+	};
+
+	void setType(BiquadType type, float q) {
+		type_ = type;
+		for(int s=0; s<SECTIONS; s++) {
+			// Butterworth: pole pair s of ORDER at angle pi(2s+1)/(2 ORDER) from the negative real axis
+			if(type == BIQUAD_LOWPASS || type == BIQUAD_HIGHPASS) q = 1.0f / (2.0f * cosf(float(M_PI) * (2*s + 1) / (2 * ORDER)));
+			invQ_[s] = T(1.0f / q);
+		}
+	}
+
+	// Sections from sine and cosine of the prewarped half angle pi*frequency/sampleFreq; the bilinear transform with
+	// K = sn/cs, multiplied through by cs^2 so no tangent is needed.
+	void computeSections(T sn, T cs) {
+		T ss = sn*sn, cc = cs*cs, sc = sn*cs;
+		for(int s=0; s<SECTIONS; s++) {
+			T scq = sc*invQ_[s];
+			T n = T(1) / (cc + scq + ss);
+			Section& k = sections_[s];
+			k.a1 = (ss - cc)*n; k.a1 += k.a1;
+			k.a2 = (cc - scq + ss)*n;
+			switch(type_) {
+			case BIQUAD_LOWPASS:
+				k.b0 = k.b2 = ss*n;
+				k.b1 = k.b0 + k.b0;
+				break;
+			case BIQUAD_HIGHPASS:
+				k.b0 = k.b2 = cc*n;
+				k.b1 = -(k.b0 + k.b0);
+				break;
+			case BIQUAD_BANDPASS:
+				k.b0 = scq*n;
+				k.b1 = T(0);
+				k.b2 = -k.b0;
+				break;
+			case BIQUAD_NOTCH:
+			default:
+				k.b0 = k.b2 = (cc + ss)*n;
+				k.b1 = k.a1;
+				break;
+			}
+		}
+	}
+
+	// Recomputes the sections for a sample period of dtUS from the table.
+	void interpolate(unsigned long dtUS) {
+		if(dtUS < minUS_) dtUS = minUS_;
+		if(dtUS > maxUS_) dtUS = maxUS_;
+		uint32_t pos = uint32_t((uint64_t(dtUS - minUS_) * scale_) >> 16); // table index in 16.16
+		int i = pos >> 16;
+		if(i >= TABLE_SIZE - 1) i = TABLE_SIZE - 2;
+		T w = T(int((pos - (uint32_t(i) << 16)) >> 4)) * T(1.0f / 4096);
+		const T *a = table_ + 2*i, *b = a + 2;
+		computeSections(a[0] + (b[0] - a[0])*w, a[1] + (b[1] - a[1])*w);
+	}
+
+	BiquadType type_;
+	T invQ_[SECTIONS];
+	Section sections_[SECTIONS];
+	T *table_;                      // sine and cosine for TABLE_SIZE periods, NULL if not adaptive
+	unsigned long minUS_, maxUS_;
+	uint32_t scale_;                // table steps per microsecond, 0.32
+	T hist_[SECTIONS+1][2][CHANNELS]; // [signal][delay][channel]; signal 0 is the input, s+1 the output of section s
+};
+
+};
+
+#endif // BBBIQUAD_H
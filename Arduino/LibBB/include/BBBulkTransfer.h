@@ -0,0 +1,175 @@
+#if !defined(BBBULKTRANSFER_H)
+#define BBBULKTRANSFER_H
+
+#include <Arduino.h>
+#include "BBSubsystem.h"
+#include "BBPacket.h"
+#include "BBDownlinkScheduler.h"
+#include "BBPacketLayout.h"
+
+namespace bb {
+
+//
+// BULK TRANSFER PROTOCOL
+//
+// Moves objects larger than a Packet (sound lists, animations, config blobs, telemetry captures) between
+// two stations. The sender offers the object (size, CRC32, tag), the receiver accepts by providing a buffer.
+// Data then goes out in chunks with a sliding window; the receiver acknowledges selectively (cumulative
+// chunk count plus a bitmap of the following 32 chunks), and unacknowledged chunks are resent after a
+// timeout. Once everything is in, the receiver checks the CRC32 over the whole object and answers DONE or ABORT.
+//
+// Sending is paced by a DownlinkScheduler so that bulk traffic stays within an airtime budget and keeps out
+// of the way of control packets.
+//
+
+struct BulkHeader {
+	static const size_t SIZE = 12; // on the wire, see BB_BULK_HEADER_FIELDS
+
+	uint8_t magic;     // BulkTransfer::MAGIC
+	uint8_t type;      // BulkTransfer::FrameType
+	uint8_t transfer;  // transfer ID, chosen by the sender
+	uint8_t window;    // OFFER: sender window size in chunks
+	uint16_t seq;      // DATA: chunk index; ACK: number of chunks received contiguously from the start
+	uint16_t count;    // total number of chunks in the object
+	uint32_t arg;      // OFFER: object size; ACK: bitmap of received chunks following seq; DONE/ABORT: result code
+
+	void encode(uint8_t buf[SIZE]) const;
+	void decode(const uint8_t buf[SIZE]);
+};
+
+// Wire layout of BulkHeader, F(member, bit offset, width, signed) as in BBPacketLayout.h. BitField only reaches
+// 64 bits into a frame, so arg has a table of its own, relative to byte 8.
+#define BB_BULK_HEADER_FIELDS(F) \
+	F(magic,     0,  8, false) \
+	F(type,      8,  8, false) \
+	F(transfer, 16,  8, false) \
+	F(window,   24,  8, false) \
+	F(seq,      32, 16, false) \
+	F(count,    48, 16, false)
+
+#define BB_BULK_HEADER_ARG_FIELDS(F) \
+	F(arg,       0, 32, false)
+
+class BulkTransfer: public Subsystem, public PacketReceiver, public FrameReceiver {
+public:
+	static BulkTransfer bulk;
+
+	static const uint8_t MAGIC = 0xb7;
+	static const size_t MAX_FRAME_SIZE = 100;
+	static const size_t CHUNK_SIZE = MAX_FRAME_SIZE - BulkHeader::SIZE;
+	static const uint8_t MAX_WINDOW = 32;
+	static const uint8_t TAG_TEST = 0xff; // test transfers - accepted without a buffer, contents are discarded
+
+	enum FrameType {
+		FRAME_OFFER = 0,
+		FRAME_DATA  = 1,
+		FRAME_ACK   = 2,
+		FRAME_DONE  = 3,
+		FRAME_ABORT = 4
+	};
+
+	// Transport for bulk frames. The default link sends via XBee.
+	class Link {
+	public:
+		virtual Result sendFrame(uint16_t dest, const uint8_t *data, size_t length) = 0;
+		virtual bool mayTransmit() { return true; } // return false if the channel must be kept free right now
+	};
+
+	class Delegate {
+	public:
+		// A peer offers an object. Return a buffer of at least size bytes to accept it, or NULL to refuse.
+		virtual uint8_t* bulkTransferOffered(uint16_t source, uint8_t tag, uint32_t size) = 0;
+		// An incoming transfer has ended, successfully (RES_OK) or not.
+		virtual void bulkTransferReceived(uint16_t source, uint8_t tag, uint8_t *buffer, uint32_t size, Result res) = 0;
+		// An outgoing transfer has ended, successfully (RES_OK) or not.
+		virtual void bulkTransferSent(uint16_t dest, uint8_t tag, Result res) { (void)dest; (void)tag; (void)res; }
+	};
+
+	static uint32_t crc32(const uint8_t *data, size_t length, uint32_t crc = 0);
+
+	virtual Result initialize(Link *link = NULL);
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual Result parameterChanged(const char *name);
+	virtual void printStatus(ConsoleStream *stream);
+
+	void setDelegate(Delegate *delegate) { delegate_ = delegate; }
+
+	// Starts sending data to dest. The data must stay valid until the transfer has ended. Only one outgoing
+	// and one incoming transfer can be active at a time.
+	Result send(uint16_t dest, uint8_t tag, const uint8_t *data, uint32_t size);
+	bool isSending() { return txState_ != TX_IDLE; }
+	bool isReceiving() { return rxActive_; }
+	Result abort();
+
+	virtual Result incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet);
+	virtual Result incomingFrame(uint16_t station, uint8_t rssi, const uint8_t *data, size_t length);
+
+protected:
+	BulkTransfer();
+
+	Result handleSendTestCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+	static const ParameterDescription parameterTable_[];
+
+	enum TxState {
+		TX_IDLE,
+		TX_OFFERING,
+		TX_SENDING
+	};
+
+	Result sendControlFrame(uint16_t dest, FrameType type, uint8_t transfer, uint16_t seq, uint16_t count, uint32_t arg);
+	Result sendOffer();
+	Result sendChunk(uint16_t chunk);
+	Result sendAck();
+	size_t chunkLength(uint32_t size, uint16_t chunk);
+	void finishSending(Result res);
+	void finishReceiving(Result res, bool notifyPeer);
+
+	void handleOffer(uint16_t source, const BulkHeader& header, const uint8_t *payload, size_t length);
+	void handleData(uint16_t source, const BulkHeader& header, const uint8_t *payload, size_t length);
+	void handleAck(const BulkHeader& header);
+
+	Link *link_;
+	Delegate *delegate_;
+	DownlinkScheduler scheduler_;
+
+	int window_, rtoMS_, timeoutMS_, framesPerStep_;
+	float budget_;
+
+	// Sender
+	TxState txState_;
+	uint16_t txDest_;
+	uint8_t txTransfer_, txTag_;
+	const uint8_t *txData_;
+	uint32_t txSize_, txCRC_;
+	uint16_t txCount_, txBase_, txNext_;
+	uint32_t txAcked_;                       // bit i: chunk txBase_+i has been acknowledged
+	unsigned long txSentMS_[MAX_WINDOW];     // indexed by chunk % MAX_WINDOW
+	unsigned long txOfferMS_, txLastHeardMS_, txStartMS_;
+
+	// Receiver
+	bool rxActive_, rxNeedsAck_;
+	uint16_t rxSource_;
+	uint8_t rxTransfer_, rxTag_, rxWindow_, rxUnacked_;
+	uint8_t *rxBuffer_;
+	uint32_t rxSize_, rxCRC_;
+	uint16_t rxCount_, rxBase_;
+	uint32_t rxReceived_;                    // bit i: chunk rxBase_+1+i has been received
+	unsigned long rxLastHeardMS_, rxStartMS_, rxLastAckMS_;
+	uint16_t rxDoneSource_;                  // last finished transfer, to repeat DONE/ABORT if that got lost
+	uint8_t rxDoneTransfer_;
+	Result rxDoneResult_;
+
+	// Statistics
+	unsigned long framesSent_, retransmits_, framesReceived_;
+	uint32_t lastSize_;
+	unsigned long lastDurationMS_;
+	Result lastResult_;
+};
+
+};
+
+#endif // BBBULKTRANSFER_H
@@ -0,0 +1,118 @@
+#if !defined(BBCAPTURE_H)
+#define BBCAPTURE_H
+
+#include <Arduino.h>
+#include "BBSubsystem.h"
+#include "BBWifiServer.h"
+
+namespace bb {
+
+// One recorded control cycle.
+struct CaptureSample {
+	uint32_t us;     // since the start of the recording
+	float setpoint;
+	float input;
+	float output;
+	float error;     // setpoint - input
+};
+
+//
+// SYSTEM IDENTIFICATION CAPTURE
+//
+// Records control cycles into a RAM buffer for offline analysis (see extras/fit_response.py), and generates the
+// excitation for them: a step, a linear chirp or a PRBS (pseudo random binary sequence) around base, amplitude
+// wide. While recording, the loop owner takes its goal from setpoint(), runs its controller, and hands the cycle
+// to record(). record() copies 20 bytes and nothing else, so the loop keeps its rate and timing; anything that
+// prints every cycle should stay quiet while isRecording() or isDumping().
+//
+// The buffer belongs to the owner (initialize()), so droids that never capture pay no RAM for it. At most 65535
+// samples of it are used, as datagrams count them in 16 bits.
+//
+// "record" starts a recording. It ends after pre + duration seconds, or earlier if the buffer is full. "dump" then
+// writes the samples to the console as CSV, "dump <ip> <port>" sends them as UDP datagrams. Both go out a few
+// samples per cycle, as much as the console buffer or MAX_DATAGRAMS_PER_STEP allow, so dumping doesn't hold up the
+// runloop either. The CSV starts with a "# capture" line and a header, and ends with "# end".
+//
+// Datagram layout (little endian):
+//   byte 0     Capture::MAGIC
+//   byte 1     number of samples n in this datagram
+//   bytes 2-3  index of the first sample
+//   bytes 4-5  total number of samples
+//   bytes 6..  n samples, each us (uint32) and setpoint, input, output, error (float)
+//
+class Capture: public Subsystem {
+public:
+	static Capture capture;
+
+	static const uint8_t MAGIC = 0xb8;
+	static const size_t SAMPLE_SIZE = 20;
+	static const size_t DATAGRAM_HEADER_SIZE = 6;
+	static const size_t SAMPLES_PER_DATAGRAM = 12;
+	static const unsigned int MAX_DATAGRAMS_PER_STEP = 2;
+
+	enum Signal {
+		SIGNAL_STEP     = 0, // base for pre seconds, then base + amplitude
+		SIGNAL_CHIRP    = 1, // base + amplitude sin(), frequency rising linearly from f0 to f1 over duration
+		SIGNAL_PRBS     = 2, // base +- amplitude, switching at random multiples of bit_ms
+		SIGNAL_EXTERNAL = 3  // setpoint() is always base; the owner excites the loop itself
+	};
+
+	template<size_t N> Result initialize(CaptureSample (&buffer)[N]) { return initialize(buffer, N); }
+	Result initialize(CaptureSample *buffer, size_t size);
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual void printStatus(ConsoleStream *stream);
+
+	Result startRecording();
+	void stopRecording();
+	bool isRecording() { return recording_; }
+
+	// Excitation for the present cycle. base when not recording.
+	float setpoint();
+	// Stores one cycle if recording, every decimation-th call.
+	void record(float setpoint, float input, float output);
+
+	Result startDump(ConsoleStream *stream);
+	Result startDump(const IPAddress& addr, uint16_t port);
+	void stopDump() { dumping_ = false; }
+	bool isDumping() { return dumping_; }
+
+	size_t numSamples() { return numSamples_; }
+	const CaptureSample* samples() { return buffer_; }
+
+protected:
+	Capture();
+
+	void dumpToStream();
+	void dumpToUDP();
+
+	Result handleRecordCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleDumpCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+	static const ParameterDescription parameterTable_[];
+
+	// Parameters
+	int signal_, bitMS_, decimation_;
+	float base_, amplitude_, pre_, duration_, f0_, f1_;
+
+	CaptureSample *buffer_;
+	size_t size_, numSamples_;
+
+	bool recording_;
+	unsigned long startUS_, endUS_;
+	int skip_;
+	uint16_t lfsr_;
+	unsigned long lfsrBit_;
+
+	bool dumping_, dumpUDP_, dumpHeader_;
+	size_t dumpIndex_;
+	ConsoleStream *dumpStream_;
+	IPAddress dumpAddr_;
+	uint16_t dumpPort_;
+};
+
+};
+
+#endif // BBCAPTURE_H
@@ -0,0 +1,114 @@
+#if !defined(BBCASCADEDCONTROLLER_H)
+#define BBCASCADEDCONTROLLER_H
+
+#include <BBError.h>
+#include <BBControllers.h>
+
+namespace bb {
+
+// Averages an input over the cycles between two updates of the loop reading it. The average is the decimation
+// filter for a loop that runs slower than its input is sampled; it costs one addition per sample.
+class DecimatingControlInput: public ControlInput {
+public:
+	DecimatingControlInput(ControlInput& input);
+
+	// Updates the input and adds its present value. Once per fast cycle.
+	void sample();
+	// Starts over, with the present value of the input as the average.
+	void reset();
+
+	// Closes the averaging window. Called by the loop reading the input.
+	virtual Result update();
+	virtual float present() { return average_; }
+	virtual float controlGain() { return input_.controlGain(); }
+
+protected:
+	ControlInput& input_;
+	float sum_, average_;
+	unsigned int num_;
+};
+
+//
+// Chain of PID loops. The innermost loop reads its input and drives the output on every update(). Every loop added
+// around it sets the goal of the loop inside it, runs only every divider-th update(), and reads its input averaged
+// over those cycles. So the slow outer loops cost little, and the CPU goes to the inner loop.
+//
+// The goal an outer loop sets is ramped to over its divider cycles instead of set as a step. A stepped goal would
+// go straight into the inner loop's D term once per outer cycle and make the output jerk at the outer loop's rate.
+//
+// Anti-windup works across the cascade through PIDController::saturation(): once a loop pins at its control
+// bounds, no loop outside of it integrates error towards that bound. Bound the outer loops' controls to what the
+// inner loops can follow, e.g. speed to the top speed.
+//
+// Loops can be switched off from the outside in, e.g. to drive on speed goals with the position loop off. Goals
+// then go to the outermost loop that is on. A loop that is switched on again holds its present input. Goals set
+// from the outside can be ramped too, with a rate limit per loop (setGoalRamp()), so that e.g. letting go of a
+// remote stick doesn't step the speed goal to 0.
+//
+class CascadedController {
+public:
+	static const int MAX_LOOPS = 4;
+
+	CascadedController(ControlInput& input, ControlOutput& output);
+	~CascadedController();
+	CascadedController(const CascadedController&) = delete;
+	CascadedController& operator=(const CascadedController&) = delete;
+
+	// Adds a loop around the outermost one, running every divider-th cycle. Returns its index (the innermost loop
+	// is 0), or -1 if there are MAX_LOOPS already. The new loop is on.
+	int addOuterLoop(ControlInput& input, unsigned int divider);
+
+	int numLoops() { return numLoops_; }
+	PIDController& loop(int i) { return *loops_[i].controller; }
+
+	// Runs loops 0 to i and switches the ones outside of it off.
+	void setOutermostLoop(int i);
+	int outermostLoop() { return outermost_; }
+
+	// Sets the goal of the outermost loop that is on. With a ramp set for that loop, its goal moves there over
+	// the following update()s.
+	void setGoal(float goal);
+	float goal() { return loops_[outermost_].target; }
+	// Moves loop i's goal by at most maxStep per update() while it is the outermost loop. 0, the default, sets
+	// goals as they come.
+	void setGoalRamp(int i, float maxStep);
+
+	// One cycle of the innermost loop; outer loops run when their turn has come.
+	void update();
+	// Resets all loops.
+	void reset();
+
+protected:
+	// Output of an outer loop. Moves the inner loop's goal to the value set in equal steps, one per step().
+	class GoalRamp: public ControlOutput {
+	public:
+		GoalRamp(PIDController& inner): inner_(inner) { reset(1); }
+		void reset(unsigned int steps);
+		void step();
+		virtual Result set(float value);
+		virtual float present() { return inner_.present(); }
+		virtual int saturation() { return inner_.saturation(); }
+	protected:
+		PIDController& inner_;
+		float goal_, target_, increment_;
+		unsigned int steps_, remaining_;
+	};
+
+	struct Loop {
+		DecimatingControlInput *input; // NULL for the innermost loop
+		GoalRamp *ramp;                // to the inner loop's goal, NULL for the innermost loop
+		PIDController *controller;
+		unsigned int divider, count;
+		float goal, target, maxStep;   // goals from the outside, while the loop is the outermost one
+	};
+
+	void resetLoop(int i);
+	void setLoopGoal(Loop& loop, float goal);
+
+	Loop loops_[MAX_LOOPS];
+	int numLoops_, outermost_;
+};
+
+};
+
+#endif // BBCASCADEDCONTROLLER_H
@@ -0,0 +1,105 @@
+#if !defined(BBCOMMANDSERVER_H)
+#define BBCOMMANDSERVER_H
+
+#include <Arduino.h>
+#include <WiFiNINA.h>
+#include "BBSubsystem.h"
+#include "BBParameterTransaction.h"
+
+#define DEFAULT_COMMAND_PORT 2000
+
+namespace bb {
+
+//
+// BINARY COMMAND PROTOCOL
+//
+// Compact request/response protocol over UDP for parameter access and subsystem control, for clients like GUI
+// tuning sliders that would otherwise have to drive the text console. One request per datagram, answered by one
+// response datagram carrying the same request ID, so clients can keep several requests in flight.
+//
+// Request:   MAGIC, request ID (uint16), Opcode, arguments
+// Response:  MAGIC, request ID (uint16), Opcode | RESPONSE_FLAG, Result (uint8), results
+//
+// Strings are a length byte followed by the characters, integers are little endian. Values are a ParameterType
+// byte followed by int32, float32, uint8 (bool) or a string.
+//
+//   OP_PING                                                 -> -
+//   OP_GET_PARAMETER   subsys, parameter                    -> value
+//   OP_SET_PARAMETER   subsys, parameter, value             -> -
+//   OP_START           subsys                               -> -
+//   OP_STOP            subsys                               -> -
+//   OP_STATUS          subsys                               -> started (uint8), operation status (uint8)
+//   OP_LIST_SUBSYSTEMS first index (uint8)                  -> count (uint8), names
+//   OP_LIST_PARAMETERS subsys, first index (uint8)          -> count (uint8), (name, type) pairs
+//   OP_GET_SCHEMA      offset (uint16)                      -> schema ID (uint16), size (uint16), descriptor bytes
+//   OP_GET_LOG         offset (uint32)                      -> offset (uint32), end offset (uint32), log records
+//   OP_STAGE_PARAMETER subsys, parameter, value             -> -
+//   OP_COMMIT_PARAMETERS                                    -> commit ID (uint16)
+//   OP_ABORT_PARAMETERS                                     -> -
+//   OP_COMMIT_STATUS                                        -> applied commit ID (uint16), its result (uint8)
+//
+// The list operations return as many entries as fit into a response; ask again with a higher first index for
+// the rest. An empty list means there are no more. Likewise OP_GET_SCHEMA returns the part of the schema
+// descriptor (see BBSchema.h) from offset on that fits, and OP_GET_LOG the whole log records (see BBLog.h) from
+// offset on that fit. Its offset result is where the records actually start, which is later than the requested
+// one if records were overwritten in between; the end offset tells the client whether there are more.
+//
+// OP_STAGE_PARAMETER, OP_COMMIT_PARAMETERS and OP_ABORT_PARAMETERS use the ParameterTransaction shared with the
+// console, so a commit applies everything staged by either side (see BBParameterTransaction.h). The reply to
+// OP_COMMIT_PARAMETERS only says the commit was accepted; it is applied at the start of the next runloop cycle.
+// OP_COMMIT_STATUS returns the ID of the last applied commit and the result of its parametersChanged() calls, so
+// a client polls it until the ID is the one its commit got (or later, if another client committed since).
+//
+
+class CommandServer: public Subsystem {
+public:
+	static CommandServer server;
+
+	static const uint8_t MAGIC = 0xb3;
+	static const uint8_t RESPONSE_FLAG = 0x80;
+	static const size_t HEADER_SIZE = 4;
+	static const size_t MAX_DATAGRAM_SIZE = 256;
+
+	enum Opcode {
+		OP_PING            = 0,
+		OP_GET_PARAMETER   = 1,
+		OP_SET_PARAMETER   = 2,
+		OP_START           = 3,
+		OP_STOP            = 4,
+		OP_STATUS          = 5,
+		OP_LIST_SUBSYSTEMS = 6,
+		OP_LIST_PARAMETERS = 7,
+		OP_GET_SCHEMA      = 8,
+		OP_GET_LOG         = 9,
+		OP_STAGE_PARAMETER   = 10,
+		OP_COMMIT_PARAMETERS = 11,
+		OP_ABORT_PARAMETERS  = 12,
+		OP_COMMIT_STATUS     = 13
+	};
+
+	virtual Result initialize(uint16_t port = DEFAULT_COMMAND_PORT);
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual Result parameterChanged(const char *name);
+	virtual void printStatus(ConsoleStream *stream);
+
+	// Handles one request and writes the response into response (at least MAX_DATAGRAM_SIZE bytes). Returns the
+	// response length, or 0 if the request is not for us and should not be answered.
+	size_t handleRequest(const uint8_t *request, size_t len, uint8_t *response);
+
+protected:
+	CommandServer();
+
+	static const ParameterDescription parameterTable_[];
+
+	Result execute(uint8_t opcode, const uint8_t *args, size_t argsLen, uint8_t *results, size_t& resultsLen);
+
+	WiFiUDP udp_;
+	int port_, maxRequestsPerStep_;
+	unsigned long requests_, errors_;
+};
+
+};
+
+#endif // BBCOMMANDSERVER_H
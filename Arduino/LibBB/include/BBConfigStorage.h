@@ -4,35 +4,180 @@
 #include <vector>
 
 #include "BBError.h"
+#include "BBFlashDevice.h"
+
+// Maximum number of configuration blocks, including blocks on flash that no current subsystem reserves. Must be a
+// power of two.
+#if !defined(CONFIG_MAX_BLOCKS)
+#define CONFIG_MAX_BLOCKS 32
+#endif
+
+// Bytes programmed per step() while writing a record in the background.
+#if !defined(CONFIG_WRITE_CHUNK)
+#define CONFIG_WRITE_CHUNK 64
+#endif
 
 namespace bb {
 
+// Upgrades a configuration block from layout version fromVersion to fromVersion+1, whose size is toSize. to is
+// zeroed. Returns false if the old contents can't be converted; the block is then invalid.
+struct ConfigMigration {
+	uint16_t fromVersion;
+	size_t toSize;
+	bool (*migrate)(const uint8_t *from, size_t fromSize, uint8_t *to);
+};
+
+//
+// CONFIGURATION STORAGE
+//
+// Log-structured store for configuration blocks. Every version of a block is appended to flash as a record, the
+// newest valid record of a block wins. Nothing is ever overwritten in place, so a power cut at any point leaves
+// the previous version readable.
+//
+// Flash is split into pages of one erase unit, each starting with a magic number and a sequence number. Pages are
+// filled in ring order, so erases are spread evenly over all pages. When the log needs a page and only one erased
+// page is left, the oldest page is compacted: its live records are copied to the head of the log, then it is
+// erased. That copy-before-erase order is what makes compaction power-fail safe.
+//
+// Record: block ID (uint32), data length (uint16), layout version (uint16), CRC32 over the header fields before it
+// and the data, then the data, padded to 4 bytes. Records with a bad CRC, e.g. cut off by a power failure, are
+// ignored.
+//
+// Blocks are identified by name (the ID is its hash), not by the order of reserveBlock() calls, so subsystems can
+// be added, removed or reordered without losing anybody's configuration. The mounted records are found through a
+// hashed index by ID. When the layout of a block changes, bump its version and pass reserveBlock() migrations
+// from the old versions; a stored block of an older version is run through them on load and saved in the new
+// layout. A block without a path to the current version, or from a newer version, is invalid.
+//
+// writeBlock() only copies into RAM, and store() only queues. The flash work is done in step(), called by the
+// runloop once per cycle, one record chunk or one page erase at a time, so saving never stalls the control loop.
+// readBlock() always returns the newest version, stored or not.
+//
+// Firmware from before this format kept the blocks back to back through the EEPROM library, in reserveBlock()
+// order, each behind a marker byte. If the device still holds that image (FlashDevice::legacySize()) and no log,
+// blocks reserved before the runloop starts are imported from it as layout version 1 and saved in the new format.
+// On the SAMD21 the old image is gone after the upload, so the first boot starts from defaults.
+//
+// Blocks on flash that nobody reserved are kept until the runloop starts, since their subsystem may just not have
+// reserved them yet. After that they belong to a subsystem that is gone, and compaction drops them. Until then they
+// take room that reserveBlock() doesn't count, so a save before the runloop starts can find the log full: once
+// every page has been compacted without making room, step() fails without touching flash, and the save stays
+// queued until the runloop starts and compaction may drop them.
+//
+// Every block ID, reserved or only on flash, takes one of CONFIG_MAX_BLOCKS index slots. If the index is full,
+// reserveBlock() fails with a message on the console, and records found while mounting that have no slot are
+// counted in indexOverflows().
+//
 class ConfigStorage {
 public:
 	typedef unsigned int HANDLE;
 
 	static ConfigStorage storage;
 
-	bool initialize();
-	HANDLE reserveBlock(size_t size);
+	// Mounts the store on device, or on FlashDevice::platformDevice() if device is NULL.
+	bool initialize(FlashDevice *device = NULL);
+	// Returns 0 if the block doesn't fit, if the index is full, or if name is taken (or has the same hash as one
+	// that is).
+	HANDLE reserveBlock(const char *name, uint16_t version, size_t size,
+		const ConfigMigration *migrations, size_t numMigrations);
+	HANDLE reserveBlock(const char *name, uint16_t version, size_t size) {
+		return reserveBlock(name, version, size, NULL, 0);
+	}
+	template<size_t N> HANDLE reserveBlock(const char *name, uint16_t version, size_t size,
+		const ConfigMigration (&migrations)[N]) {
+		return reserveBlock(name, version, size, migrations, N);
+	}
 	Result writeBlock(HANDLE, uint8_t* block);
 	Result readBlock(HANDLE, uint8_t* block);
 	bool blockIsValid(HANDLE);
+	// Queues every block written since the last store() for saving. If the runloop isn't running, saves right away.
 	Result store();
 
+	// Does at most one flash operation. Called by the runloop.
+	Result step();
+	// Calls step() until everything queued is on flash.
+	Result flush();
+	bool busy();
+
+	unsigned long recordsWritten() { return recordsWritten_; }
+	unsigned long pagesErased() { return pagesErased_; }
+	unsigned long blocksMigrated() { return blocksMigrated_; }
+	unsigned long indexOverflows() { return indexOverflows_; }
+
 protected:
 	ConfigStorage();
 
+	static const uint32_t PAGE_MAGIC = 0x32434242; // "BBC2"
+	static const uint32_t PAGE_ERASED = 0xffffffff;
+	static const size_t PAGE_HEADER_SIZE = 8;
+	static const size_t RECORD_HEADER_SIZE = 12;
+	static const size_t MAX_PAGES = CONFIG_FLASH_SIZE / 256;
+	static const uint8_t LEGACY_VALID = 0xba;
+	static const uint32_t NO_RECORD = 0xffffffff;
+
 	struct Block {
-		HANDLE handle;
+		uint32_t id;
+		uint16_t version;
 		size_t size;
+		uint8_t *data;
+		bool valid, dirty, queued;
+	};
+
+	// Newest record of a block on flash. addr 0 means the slot is free, NO_RECORD that a reserved block holds it but
+	// has no record yet.
+	struct IndexEntry {
+		uint32_t id;
+		uint32_t addr;
+		uint16_t len, version;
 	};
-	std::vector<Block> blocks_;
+
+	static size_t recordSize(size_t dataSize) { return (RECORD_HEADER_SIZE + dataSize + 3) & ~3; }
+
+	size_t numPages() { return device_->size() / pageSize_; }
+	void mount();
+	void scanPage(size_t page);
+	bool isErased(size_t addr, size_t len);
+	IndexEntry* findEntry(uint32_t id, bool create = false);
+	void removeEntry(IndexEntry *entry);
+	bool isKept(uint32_t id);
+	void loadBlock(Block& block, const ConfigMigration *migrations, size_t numMigrations);
+	void importLegacy(Block& block);
+	Result nextOperation();
+	int oldestPage();
+	int deadPage();
+	int nextErasedPage();
+	size_t numErasedPages();
+	Result openPage();
+	Result startAppend(size_t len);
+	Result continueAppend();
+	Result compactStep();
+
+	FlashDevice *device_;
+	size_t pageSize_;
+	std::vector<Block> blocks_; // blocks_[handle-1]
 	bool initialized_;
-	HANDLE nextHandle_;
-	size_t maxSize_;
+
+	uint32_t pageSeq_[MAX_PAGES];               // PAGE_ERASED if erased
+	IndexEntry index_[CONFIG_MAX_BLOCKS];       // open addressing by ID
+	uint32_t nextSeq_;
+	int head_;                                  // page being appended to, -1 if none
+	size_t headOffset_;
+
+	bool appending_;
+	uint8_t *record_;                           // record being appended, one page
+	size_t recordLen_, recordPos_;
+	uint32_t recordAddr_;
+	int compactPage_;                           // page being compacted, -1 if none
+	size_t compactOffset_;
+	size_t compactions_;                        // since a queued block was last written
+	bool full_;                                 // what compaction must keep doesn't leave room for a record
+
+	uint8_t *legacy_;                           // copy of the old EEPROM image until the runloop starts, or NULL
+	size_t legacySize_, legacyOffset_;
+
+	unsigned long recordsWritten_, pagesErased_, blocksMigrated_, indexOverflows_;
 };
 
 };
 
-#endif // BBCONFIGSTORAGE_H
\ No newline at end of file
+#endif // BBCONFIGSTORAGE_H
@@ -2,6 +2,7 @@
 #define BBCONSOLE_H
 
 #include "BBSubsystem.h"
+#include "BBLineEditor.h"
 
 #include <vector>
 #include <cstdarg>
@@ -11,31 +12,111 @@ namespace bb {
 
 class Subsystem;	
 
+#if !defined(CONSOLE_OUTPUT_BUFFER_SIZE)
+#define CONSOLE_OUTPUT_BUFFER_SIZE 1024
+#endif
+
+// Maximum number of bytes of help or status output generated per stream and runloop cycle.
+#if !defined(CONSOLE_REPORT_CHUNK_SIZE)
+#define CONSOLE_REPORT_CHUNK_SIZE 256
+#endif
+
+// Long console output that Console::step() generates a piece per cycle (see Console::startReport()).
+enum ConsoleReportType {
+	REPORT_NONE,
+	REPORT_HELP_ALL,
+	REPORT_STATUS_ALL,
+	REPORT_SUBSYS_HELP,
+	REPORT_SUBSYS,      // items from the subsystem's printReportItem()
+	REPORT_COMMIT       // prints nothing, but holds back the reply to "commit" until the commit is applied
+};
+
+//
+// Console output is formatted straight into a per-stream ring buffer and written out by Console::step() within a
+// time budget, so a slow client never holds up the runloop. If a message doesn't fit, it is dropped. Only the
+// echo of a stream's input and the replies to its own commands are treated differently if the stream's overflow
+// policy is OVERFLOW_WAIT: they first drain the buffer synchronously for up to the wait time, so that a user
+// doesn't lose the answer to what they typed. Broadcasts, log output and anything else printed from the runloop
+// never wait. A stream that ran into the wait timeout drops further messages without waiting until its buffer is
+// half empty again, so a stalled client costs the wait time once, not once per command. Dropped bytes are counted
+// and reported in the output as soon as there is room again.
+//
+// No heap is used. The buffer is a bip buffer: every message is contiguous, so vsnprintf() can format right into
+// it. Only if the message doesn't fit into the space that was tried first is it formatted a second time.
+//
 class ConsoleStream {
 public:
+	enum OverflowPolicy {
+		OVERFLOW_DROP,
+		OVERFLOW_WAIT
+	};
+
+	ConsoleStream();
+
 	virtual bool available() = 0;
-	virtual bool readStringUntil(unsigned char c, String& str) = 0;
+	// Reads available input into the stream's line editor. Returns the line (null terminated, without the line end)
+	// once it is complete, NULL before. The line can be modified and stays valid until the next call.
+	virtual char* readLine() = 0;
+
+	// Whether input is echoed by the line editor.
+	void setEcho(bool echo) { echo_ = echo; }
+	bool echo() { return echo_; }
+	LineEditor& lineEditor() { return editor_; }
+
+	void printf(const char* format, ...);
+	void vprintf(const char* format, va_list args);
+	void print(const char* str);
+	void write(const char* str, size_t len);
+	// Writes str, which should end with a newline, above the line the user is typing: the line is cleared, str
+	// written and the line printed again behind the prompt. Goes out or is dropped as a whole.
+	void writeAboveInput(const char* str, size_t len);
 
-	void printf(const char* format, ...) {
-		va_list args;
-		va_start(args, format);
-		vprintf(format, args);
-		va_end(args);
+	void printGreeting() {
+		print("Console ready. Type \"help\" for instructions.\n> ");
 	}
 
-	void vprintf(const char* format, va_list args) {
-		int len = vsnprintf(NULL, 0, format, args) + 1;
-		char *buf = new char[len];
-		vsnprintf(buf, len, format, args);
-		printfFinal(buf);
-		free(buf);
-	}
+	void setOverflowPolicy(OverflowPolicy policy, unsigned long waitUS = 0) { policy_ = policy; waitUS_ = waitUS; }
+	OverflowPolicy overflowPolicy() { return policy_; }
 
-	virtual void printfFinal(const char* str) = 0;
+	// Writes out buffered output until the buffer is empty, the client doesn't take more, or budgetUS have passed.
+	// Returns the number of bytes written.
+	size_t flush(unsigned long budgetUS);
+	void discardOutput();
 
-	void printGreeting() {
-		printfFinal("Console ready. Type \"help\" for instructions.\n> ");
-	}
+	size_t outputQueued() { return wrapped_ ? (end_ - head_) + tail_ : tail_ - head_; }
+	size_t outputSpace() { return CONSOLE_OUTPUT_BUFFER_SIZE - outputQueued(); }
+	unsigned long droppedBytes() { return droppedBytes_; }
+	unsigned long writtenBytes() { return writtenBytes_; }
+
+protected:
+	// Writes as much of buf as the underlying device takes without blocking. Returns the number of bytes taken.
+	virtual size_t writeNonBlocking(const uint8_t *buf, size_t len) = 0;
+
+	char* reserve(size_t len, size_t& avail);
+	char* contiguousSpace(size_t& avail);
+	void commit(size_t len);
+	bool leavesRoomForReport(size_t len);
+	void reportDropped();
+
+	// Feeds an input character to the line editor. Returns true if the line is complete.
+	bool addToLine(uint8_t c) { return editor_.input(c, echo_ ? this : NULL); }
+
+	char buf_[CONSOLE_OUTPUT_BUFFER_SIZE];
+	size_t head_, tail_, end_;
+	bool wrapped_, congested_;
+	bool replying_; // set by Console while it handles the stream's input; only then can output wait for room
+	OverflowPolicy policy_;
+	unsigned long waitUS_;
+	unsigned long droppedBytes_, unreportedDroppedBytes_, writtenBytes_;
+
+	LineEditor editor_;
+	bool echo_;
+
+	friend class Console;
+	ConsoleReportType reportType_;
+	Subsystem *reportSubsys_;
+	size_t reportItem_;
+	Result reportResult_;
 };
 
 class SerialConsoleStream: public ConsoleStream {
@@ -47,13 +128,13 @@ public:
 	unsigned long checkInterval() { return checkInterval_; }
 
 	virtual bool available();
-	virtual bool readStringUntil(unsigned char c, String& str);
+	virtual char* readLine();
 
-	virtual void printfFinal(const char* str);
 protected:
+	virtual size_t writeNonBlocking(const uint8_t *buf, size_t len);
+
 	HardwareSerial& ser_;
 	bool opened_;
-	String curStr_;
 	unsigned long checkInterval_, lastCheck_;
 };
 
@@ -70,25 +151,59 @@ public:
 	virtual Result start(ConsoleStream* stream = NULL);
 	virtual Result stop(ConsoleStream* stream = NULL);
 	virtual Result step();
+	virtual void printStatus(ConsoleStream *stream);
 	virtual void addConsoleStream(ConsoleStream* stream);
 	virtual void removeConsoleStream(ConsoleStream* stream);
 	ConsoleStream* serialStream() { return serialStream_; }
 
 	void handleStreamInput(ConsoleStream* stream);
-	Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream* stream);
+	// Top level commands, then "<subsys> <command>" for the subsystem's commands.
+	virtual Result handleConsoleCommand(const ConsoleArgs& args, ConsoleStream* stream);
+
+	// Splits line into words in place: separators are replaced by '\0' and the args point into line, so nothing is
+	// allocated. Double quotes group words with spaces into one. Fails if there are more than maxArgs words.
+	static Result tokenize(char *line, ConsoleArg *args, size_t maxArgs, size_t& numArgs);
 	
 	void printfBroadcast(const char* format, ...);
 	void printHelpAllSubsystems(ConsoleStream* stream);
 	void printStatusAllSubsystems(ConsoleStream* stream);
 
+	// Has step() generate a report for stream a chunk per cycle, so that long output doesn't hold up the runloop.
+	// New input on the stream cancels the report. When it is done, the result of the command that started it and
+	// the prompt are printed. If stream isn't one of the console's streams, the report is printed right away.
+	void startReport(ConsoleStream* stream, ConsoleReportType type, Subsystem* subsys = NULL);
+	bool reportRunning(ConsoleStream* stream) { return stream->reportType_ != REPORT_NONE; }
+	void cancelReport(ConsoleStream* stream);
+
 	void setFirstResponder(Subsystem* subsys);
 
 protected:
 	Console();
-	std::vector<String> split(const String& str);
+
+	Result handleHelpAllCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStatusAllCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStartAllCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStopAllCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStoreCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStageCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleCommitCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStagedCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+	static const ParameterDescription parameterTable_[];
+
+	// Print one piece of a report. Return false if there is nothing left.
+	bool printReportItem(ConsoleStream* stream, ConsoleReportType type, Subsystem* subsys, size_t item);
+	bool printHelpAllItem(ConsoleStream* stream, size_t item);
+	bool printStatusAllItem(ConsoleStream* stream, size_t item);
+	void continueReport(ConsoleStream* stream);
+	void handleStreamLine(ConsoleStream* stream, char* line);
+
 	ConsoleStream *serialStream_;
 	std::vector<ConsoleStream*> streams_;
 	Subsystem* firstResponder_;
+	int outputBudgetUS_;
+	size_t nextStreamToFlush_;
 };
 
 };
@@ -0,0 +1,91 @@
+#if !defined(BBCONSOLECOMMAND_H)
+#define BBCONSOLECOMMAND_H
+
+#include <Arduino.h>
+#include "BBError.h"
+
+// Maximum number of words in a console command, including the subsystem name.
+#if !defined(CONSOLE_MAX_ARGS)
+#define CONSOLE_MAX_ARGS 16
+#endif
+
+// Turns a member function of a Subsystem subclass into a ConsoleHandler for use in a ConsoleCommand table.
+#define BB_CONSOLE_HANDLER(cls, method) static_cast<bb::ConsoleHandler>(&cls::method)
+
+namespace bb {
+
+class Subsystem;
+class ConsoleStream;
+
+//
+// One word of a console command. Points into the line buffer the command was tokenized from (see
+// Console::tokenize()), so it is only valid while that line is; nothing is copied or allocated.
+//
+class ConsoleArg {
+public:
+	ConsoleArg(): str_(""), len_(0) {}
+	ConsoleArg(const char *str, size_t len): str_(str), len_(len) {}
+
+	const char* c_str() const { return str_; }
+	size_t length() const { return len_; }
+	char charAt(size_t i) const { return i < len_ ? str_[i] : 0; }
+
+	bool operator==(const char *str) const { return strcmp(str_, str) == 0; }
+	bool operator!=(const char *str) const { return strcmp(str_, str) != 0; }
+
+	// Decimal, or hex with a 0x prefix.
+	long toInt() const;
+	float toFloat() const { return atof(str_); }
+	// on/true/1 or off/false/0.
+	bool toBool() const { return *this == "on" || *this == "true" || *this == "1"; }
+
+	bool isInt() const;
+	bool isFloat() const;
+	bool isBool() const;
+
+protected:
+	const char *str_;
+	size_t len_;
+};
+
+//
+// The words of a console command. A view on an array of ConsoleArgs; shift() drops leading words without copying.
+// Indexing past the end yields an empty word.
+//
+class ConsoleArgs {
+public:
+	ConsoleArgs(): args_(NULL), num_(0) {}
+	ConsoleArgs(const ConsoleArg *args, size_t num): args_(args), num_(num) {}
+
+	size_t size() const { return num_; }
+	const ConsoleArg& operator[](size_t i) const { return i < num_ ? args_[i] : empty_; }
+	ConsoleArgs shift(size_t n = 1) const { return n < num_ ? ConsoleArgs(args_ + n, num_ - n) : ConsoleArgs(); }
+
+protected:
+	const ConsoleArg *args_;
+	size_t num_;
+	static const ConsoleArg empty_;
+};
+
+typedef Result (Subsystem::*ConsoleHandler)(const ConsoleArgs& args, ConsoleStream *stream);
+
+//
+// Entry in a subsystem's console command table (see Subsystem::setCommands()). Keep tables sorted by name - they
+// are searched by bisection.
+//
+// args describes the arguments after the command word, one character each: 'i' integer, 'f' float, 'b' boolean
+// (on|off|true|false|1|0), 's' any word. Arguments after a '|' are optional, a trailing '*' accepts any number of
+// further words. Counts and types are checked before the handler is called, so handlers can convert right away.
+// The handler gets all words, with the command itself in args[0]. help is the line "<subsys> help" prints for the
+// command, usage first.
+//
+struct ConsoleCommand {
+	const char *name;
+	const char *args;
+	ConsoleHandler handler;
+	const char *help;
+};
+
+};
+
+#endif // BBCONSOLECOMMAND_H
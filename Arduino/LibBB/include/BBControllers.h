@@ -3,11 +3,14 @@
 
 #include <sys/types.h>
 #include <BBError.h>
+#include <BBFixedPoint.h>
+#include <BBStateSpace.h>
 
 namespace bb {
 
 class ControlInput {
 public:
+  virtual ~ControlInput() {}
   virtual Result update() = 0;
   virtual float present() = 0;
   virtual float controlGain() { return 1.0f; }
@@ -15,13 +18,25 @@ public:
 
 class ControlOutput {
 public:
+  virtual ~ControlOutput() {}
   virtual float present() = 0;
   virtual Result set(float value) = 0;
+  // 1 if the output is pinned at its upper limit, -1 at its lower, 0 if not. Controllers feeding the output stop
+  // integrating towards a pinned limit.
+  virtual int saturation() { return 0; }
 };
 
-class PIDController: public ControlOutput {
+// PID controller computing in scalar type T (float or a Fixed). Goals, gains and bounds are given and returned as
+// float and converted once when set, so only update() runs in T. Use the PIDController typedef unless you need a
+// specific type.
+//
+// Anti-windup is conditional integration: error that would drive the control further into a bound is not
+// integrated, whether the bound is this controller's own or one further down the output chain (see saturation()).
+// That assumes non-negative gains. As a ControlOutput, the controller reports its own bound, or the one of its
+// output, so controllers cascaded into each other hold their integrators as soon as the innermost one pins.
+template<typename T> class BasicPIDController: public ControlOutput {
 public:
-  PIDController(ControlInput& input, ControlOutput& output);
+  BasicPIDController(ControlInput& input, ControlOutput& output);
 
   void reset(); // reset aggregated errors
   
@@ -29,10 +44,11 @@ public:
 
   void setGoal(const float& sp);
   void setCurrentAsGoal();
-  float goal() { return goal_; }
-  float error() { return lastErr_; }
+  float goal() { return float(goal_); }
+  float error() { return float(lastErr_); }
   virtual Result set(float value) { setGoal(value); return RES_OK; }
   virtual float present();
+  virtual int saturation() { return saturation_ != 0 ? saturation_ : output_.saturation(); }
 
   void setControlParameters(const float& kp, const float& ki, const float& kd);
   void getControlParameters(float& kp, float& ki, float& kd);
@@ -53,14 +69,60 @@ protected:
   ControlInput& input_;
   ControlOutput& output_;
 
-  float kp_, ki_, kd_;
-  float lastErr_, errI_, lastErrD_, lastControl_;
-  float iMin_, iMax_; bool iBounded_;
-  float controlMin_, controlMax_; bool controlBounded_;
-  float goal_;
+  T kp_, ki_, kd_;
+  T lastErr_, errI_, lastErrD_, lastControl_;
+  bool haveLastErr_;
+  T iMin_, iMax_; bool iBounded_;
+  T controlMin_, controlMax_; bool controlBounded_;
+  T goal_;
+  int saturation_;
   unsigned long lastCycleUS_;
 };
 
+typedef BasicPIDController<ControlScalar> PIDController;
+
+// State feedback controller reading NX inputs as its state and setting NU outputs, u = u0 - K (x - r) (see
+// StateFeedback). One update() replaces a whole stack of PID loops over the same signals, e.g. pitch, pitch rate,
+// speed and position for a balancing droid, and costs NU dot products. Inputs are updated by update() like the PID
+// controller does; pass the same input only once.
+//
+// There are no integrators, so nothing winds up. saturation() still reports clamped controls, and those of the
+// outputs, for controllers feeding into this one.
+template<int NX, int NU, typename T = ControlScalar> class BasicStateSpaceController {
+public:
+  BasicStateSpaceController(ControlInput* const (&inputs)[NX], ControlOutput* const (&outputs)[NU]) {
+    for(int i=0; i<NX; i++) inputs_[i] = inputs[i];
+    for(int j=0; j<NU; j++) outputs_[j] = outputs[j];
+  }
+
+  void update() {
+    T x[NX], u[NU];
+    for(int i=0; i<NX; i++) {
+      inputs_[i]->update();
+      x[i] = T(inputs_[i]->present());
+    }
+    feedback_.compute(x, u);
+    for(int j=0; j<NU; j++) outputs_[j]->set(float(u[j]));
+  }
+
+  void setGains(const float (&k)[NU][NX]) { feedback_.setGains(k); }
+  void setGoal(int state, float goal) { feedback_.setGoal(state, goal); }
+  float goal(int state) { return feedback_.goal(state); }
+  void setControlBounds(int control, float min, float max) { feedback_.setControlBounds(control, min, max); }
+  int saturation(int control) {
+    int sat = feedback_.saturation(control);
+    return sat != 0 ? sat : outputs_[control]->saturation();
+  }
+  StateFeedback<NX, NU, T>& feedback() { return feedback_; }
+
+protected:
+  ControlInput* inputs_[NX];
+  ControlOutput* outputs_[NU];
+  StateFeedback<NX, NU, T> feedback_;
+};
+
+template<int NX, int NU> using StateSpaceController = BasicStateSpaceController<NX, NU, ControlScalar>;
+
 
 };
 
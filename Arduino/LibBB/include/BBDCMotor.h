@@ -12,8 +12,6 @@
 
 namespace bb {
 
-class LowPassFilter; // forward declaration
-
 class DCMotor: public ControlOutput {
 public:
   static const uint8_t PIN_OFF = 255;
@@ -0,0 +1,70 @@
+#if !defined(BBDOWNLINKSCHEDULER_H)
+#define BBDOWNLINKSCHEDULER_H
+
+#include <Arduino.h>
+
+namespace bb {
+
+// Decides which low-priority telemetry item (if any) may go out over a shared radio channel in the current
+// cycle. Sending is limited by an airtime budget (fraction of channel time, enforced via a token bucket),
+// and cycles in which control traffic is expected are skipped. Among the items, the one with the highest
+// priority * cycles-since-last-sent wins, so high-priority items go out more often but nothing starves.
+class DownlinkScheduler {
+public:
+	static const uint8_t MAX_ITEMS = 8;
+
+	// Estimated on-air time for one 802.15.4 frame (250kbps) with 16bit addressing, including PHY and MAC
+	// overhead, turnaround and average CSMA backoff.
+	static unsigned long frameAirtimeUS(size_t payloadBytes) {
+		return (6 + 9 + 2 + payloadBytes) * 32 + 192 + 1120;
+	}
+
+	DownlinkScheduler(float budget = 0.1, unsigned long airtimeUS = DownlinkScheduler::frameAirtimeUS(8));
+
+	// Returns the item index, or -1 if there are no free slots.
+	int addItem(uint8_t priority);
+
+	// Fraction of channel time (0..1) the downlink may use.
+	void setBudget(float budget);
+	float budget() { return budget_; }
+
+	// Call whenever a control packet is received. Used to predict when the next one will arrive. Packets within
+	// the guard time of the previous one count as one.
+	void noteControlTraffic();
+	// Returns true if the next control packet is expected within the guard time, or one is overdue by less than
+	// that, i.e. we should keep the channel free.
+	bool controlTrafficExpected();
+	void setGuardTimeUS(unsigned long guard) { guardUS_ = guard; }
+
+	// Returns the item to send in this cycle, or -1 if nothing should be sent. Call sent() after sending.
+	int schedule();
+	void sent(int item);
+
+	float airtimeUsed(); // fraction of channel time used since the last resetStats()
+	unsigned long framesSent() { return framesSent_; }
+	unsigned long skippedBudget() { return skippedBudget_; }
+	unsigned long skippedControl() { return skippedControl_; }
+	void resetStats();
+
+protected:
+	struct Item {
+		uint8_t priority;
+		uint16_t age;
+	};
+	Item items_[MAX_ITEMS];
+	uint8_t numItems_;
+
+	float budget_;
+	unsigned long frameAirtimeUS_;
+	float creditUS_;
+	unsigned long lastRefillUS_;
+
+	unsigned long lastControlUS_, controlPeriodUS_, guardUS_;
+
+	unsigned long framesSent_, skippedBudget_, skippedControl_;
+	unsigned long statsStartUS_;
+};
+
+};
+
+#endif // BBDOWNLINKSCHEDULER_H
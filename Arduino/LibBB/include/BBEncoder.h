@@ -5,7 +5,7 @@
 
 #include <Encoder.h>
 #include <BBControllers.h>
-#include <BBLowPassFilter.h>
+#include <BBBiquad.h>
 #include <limits.h>
 #include <math.h>
 
@@ -34,11 +34,12 @@ public:
   virtual float presentSpeed(bool raw = false);
   virtual Result update();
 
+  // Cutoffs must be above 0 and below 31Hz. Others return RES_COMMON_OUT_OF_RANGE and keep the previous cutoff.
   float speedFilterCutoff();
-  void setSpeedFilterCutoff(float co);
+  Result setSpeedFilterCutoff(float co);
 
   float positionFilterCutoff();
-  void setPositionFilterCutoff(float co);
+  Result setPositionFilterCutoff(float co);
 
   void setMillimetersPerTick(float mmPT) { mmPT_ = mmPT; }
 
@@ -48,7 +49,10 @@ protected:
   InputMode mode_;
   Unit unit_;
   ::Encoder enc_; // FIXME -- since this requires SAMD, possibly replace by own encoder handling?
-  bb::LowPassFilter filtSpeed_, filtPos_;
+  // Float, ticks exceed the range of fixed point. Coefficients come from a table over 2-16ms cycles, so cutoffs
+  // must stay below 31Hz. Two single channel cascades, since position and speed have cutoffs of their own.
+  bb::BiquadCascade<2, 1, float> filtSpeed_, filtPos_;
+  float speedCutoff_, posCutoff_;
 
   float mmPT_;
   long lastCycleTicks_;
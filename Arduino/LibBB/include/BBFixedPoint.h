@@ -0,0 +1,152 @@
+#if !defined(BBFIXEDPOINT_H)
+#define BBFIXEDPOINT_H
+
+#include <stdint.h>
+#include <math.h>
+
+// Scalar type for the control classes (PIDController, LowPassFilter, MadgwickFilter). The SAMD21 has no FPU, so
+// it uses fixed point there; define CONTROL_FIXED_POINT to 0 or 1 to override.
+#if !defined(CONTROL_FIXED_POINT)
+#if defined(ARDUINO_ARCH_SAMD)
+#define CONTROL_FIXED_POINT 1
+#else
+#define CONTROL_FIXED_POINT 0
+#endif
+#endif
+
+namespace bb {
+
+//
+// Signed fixed point number with FRAC fractional bits in an int32_t. Q16.16 (Fixed<16>) covers +-32767 with a
+// resolution of 1.5e-5, Q8.24 (Fixed<24>) +-127 with 6e-8.
+//
+// All arithmetic saturates instead of wrapping, division by zero included, so a controller that runs out of range
+// pins at the limit rather than flipping sign. Products and quotients are computed in 64 bits and rounded.
+// Converting from and to float costs a soft float operation on the M0+; do it at the edges, not in inner loops.
+//
+template<int FRAC> class Fixed {
+public:
+	static const int32_t ONE = int32_t(1) << FRAC;
+
+	Fixed(): raw_(0) {}
+	Fixed(int i): raw_(saturate(int64_t(i) * ONE)) {}
+	Fixed(float f): raw_(fromFloat(f)) {}
+	Fixed(double d): raw_(fromFloat(float(d))) {}
+
+	static Fixed fromRaw(int32_t raw) { Fixed f; f.raw_ = raw; return f; }
+	static Fixed highest() { return fromRaw(INT32_MAX); }
+	static Fixed lowest() { return fromRaw(INT32_MIN); }
+
+	// us * 1e-6 without a division: multiplies by 2^(FRAC+32)/1e6 and drops 32 bits. Saturates from 2^(31-FRAC)
+	// seconds on, 128s at FRAC 24, before the product would overflow.
+	static Fixed fromMicros(unsigned long us) {
+		static const uint64_t scale = ((uint64_t(1) << (FRAC + 32)) + 500000) / 1000000;
+		static const uint64_t limit = (uint64_t(1) << (31 - FRAC)) * 1000000;
+		if(us >= limit) return highest();
+		return fromRaw(saturate(int64_t((uint64_t(us) * scale) >> 32)));
+	}
+
+	int32_t raw() const { return raw_; }
+	explicit operator float() const { return raw_ * (1.0f / ONE); }
+	explicit operator int() const { return raw_ >> FRAC; }
+
+	friend Fixed operator+(Fixed a, Fixed b) { return fromRaw(saturate(int64_t(a.raw_) + b.raw_)); }
+	friend Fixed operator-(Fixed a, Fixed b) { return fromRaw(saturate(int64_t(a.raw_) - b.raw_)); }
+	friend Fixed operator*(Fixed a, Fixed b) {
+		return fromRaw(saturate((int64_t(a.raw_) * b.raw_ + (int64_t(1) << (FRAC-1))) >> FRAC));
+	}
+	friend Fixed operator/(Fixed a, Fixed b) {
+		if(b.raw_ == 0) return a.raw_ < 0 ? lowest() : highest();
+		int64_t n = int64_t(a.raw_) * ONE;
+		int64_t half = (n < 0) == (b.raw_ < 0) ? b.raw_ / 2 : -(b.raw_ / 2);
+		return fromRaw(saturate((n + half) / b.raw_));
+	}
+	Fixed operator-() const { return fromRaw(saturate(-int64_t(raw_))); }
+
+	Fixed& operator+=(Fixed b) { return *this = *this + b; }
+	Fixed& operator-=(Fixed b) { return *this = *this - b; }
+	Fixed& operator*=(Fixed b) { return *this = *this * b; }
+	Fixed& operator/=(Fixed b) { return *this = *this / b; }
+
+	friend bool operator==(Fixed a, Fixed b) { return a.raw_ == b.raw_; }
+	friend bool operator!=(Fixed a, Fixed b) { return a.raw_ != b.raw_; }
+	friend bool operator<(Fixed a, Fixed b) { return a.raw_ < b.raw_; }
+	friend bool operator>(Fixed a, Fixed b) { return a.raw_ > b.raw_; }
+	friend bool operator<=(Fixed a, Fixed b) { return a.raw_ <= b.raw_; }
+	friend bool operator>=(Fixed a, Fixed b) { return a.raw_ >= b.raw_; }
+
+	static int32_t saturate(int64_t v) {
+		if(v > INT32_MAX) return INT32_MAX;
+		if(v < INT32_MIN) return INT32_MIN;
+		return int32_t(v);
+	}
+
+protected:
+	static int32_t fromFloat(float f) {
+		f *= float(ONE);
+		if(f >= 2147483520.0f) return INT32_MAX; // largest float below 2^31
+		if(f <= -2147483648.0f) return INT32_MIN;
+		return int32_t(f < 0 ? f - 0.5f : f + 0.5f);
+	}
+
+	int32_t raw_;
+};
+
+typedef Fixed<16> Q16_16;
+typedef Fixed<24> Q8_24;
+
+#if CONTROL_FIXED_POINT
+typedef Q16_16 ControlScalar; // PID and low pass: degrees, mm/s and such, up to +-32767
+typedef Q8_24 FusionScalar;   // Orientation fusion: quaternion components and rad/s, where resolution matters
+#else
+typedef float ControlScalar;
+typedef float FusionScalar;
+#endif
+
+// 1/sqrt(sq) = y * 2^-(30+halfExp), y in [2^30, 2^31] returned. Newton iteration on the normalized mantissa, integer
+// only. sq must not be 0.
+uint32_t fixedInvSqrt(uint64_t sq, int& halfExp);
+
+// Scales (a, b, c) and (a, b, c, d) to unit length. The fixed point versions sum the squares in 64 bits and never
+// form 1/|v| as a Fixed, so they neither overflow nor saturate on short vectors, as long as the components stay
+// within half the type's range. A zero vector stays zero.
+inline void normalize(float& a, float& b, float& c) {
+	float recipNorm = 1.0f / sqrtf(a*a + b*b + c*c);
+	a *= recipNorm; b *= recipNorm; c *= recipNorm;
+}
+inline void normalize(float& a, float& b, float& c, float& d) {
+	float recipNorm = 1.0f / sqrtf(a*a + b*b + c*c + d*d);
+	a *= recipNorm; b *= recipNorm; c *= recipNorm; d *= recipNorm;
+}
+template<int FRAC> void normalize(Fixed<FRAC> *v, int num) {
+	uint64_t sq = 0;
+	for(int i=0; i<num; i++) sq += uint64_t(int64_t(v[i].raw()) * v[i].raw());
+	if(sq == 0) return;
+	int halfExp;
+	int64_t y = fixedInvSqrt(sq, halfExp);
+	int shift = 30 + halfExp - FRAC;
+	for(int i=0; i<num; i++) v[i] = Fixed<FRAC>::fromRaw(int32_t((v[i].raw() * y + (int64_t(1) << (shift-1))) >> shift));
+}
+template<int FRAC> void normalize(Fixed<FRAC>& a, Fixed<FRAC>& b, Fixed<FRAC>& c) {
+	Fixed<FRAC> v[3] = {a, b, c};
+	normalize(v, 3);
+	a = v[0]; b = v[1]; c = v[2];
+}
+template<int FRAC> void normalize(Fixed<FRAC>& a, Fixed<FRAC>& b, Fixed<FRAC>& c, Fixed<FRAC>& d) {
+	Fixed<FRAC> v[4] = {a, b, c, d};
+	normalize(v, 4);
+	a = v[0]; b = v[1]; c = v[2]; d = v[3];
+}
+
+// Seconds from a microsecond interval. Fixed point types get there without float.
+template<typename T> struct MicrosToSeconds {
+	static T convert(unsigned long us) { return T(us / 1e6f); }
+};
+template<int FRAC> struct MicrosToSeconds<Fixed<FRAC>> {
+	static Fixed<FRAC> convert(unsigned long us) { return Fixed<FRAC>::fromMicros(us); }
+};
+template<typename T> T secondsFromMicros(unsigned long us) { return MicrosToSeconds<T>::convert(us); }
+
+};
+
+#endif // BBFIXEDPOINT_H
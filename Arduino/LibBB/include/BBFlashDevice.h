@@ -0,0 +1,80 @@
+#if !defined(BBFLASHDEVICE_H)
+#define BBFLASHDEVICE_H
+
+#include <Arduino.h>
+#include "BBError.h"
+
+// Bytes of flash used for configuration storage. Must be a multiple of the device's erase size.
+#if !defined(CONFIG_FLASH_SIZE)
+#if defined(ARDUINO_ARCH_SAMD)
+#define CONFIG_FLASH_SIZE 4096
+#else
+#define CONFIG_FLASH_SIZE 1024
+#endif
+#endif
+
+namespace bb {
+
+//
+// Raw NOR flash as used by ConfigStorage. Erasing sets a whole erase unit to 0xff; programming can only clear
+// bits, so a byte can be programmed once between erases. Addresses are relative to the start of the device.
+// Program addresses and lengths are multiples of 4.
+//
+// Implement this on top of a file or RAM to run ConfigStorage on a host.
+//
+class FlashDevice {
+public:
+	virtual size_t size() = 0;
+	virtual size_t eraseSize() = 0;
+	virtual Result erase(size_t addr) = 0;
+	virtual Result program(size_t addr, const uint8_t *data, size_t len) = 0;
+	virtual Result read(size_t addr, uint8_t *data, size_t len) = 0;
+	// Makes everything erased and programmed so far persistent, for devices that buffer it. ConfigStorage calls this
+	// when it has nothing more to write, i.e. once per store().
+	virtual Result sync() { return RES_OK; }
+	// Bytes at the start of the device that firmware from before ConfigStorage's log format used as its EEPROM
+	// image, 0 if that data doesn't survive a firmware update here. ConfigStorage imports it (see BBConfigStorage.h).
+	virtual size_t legacySize() { return 0; }
+	virtual ~FlashDevice() {}
+
+	// The device ConfigStorage uses if it isn't given one.
+	static FlashDevice* platformDevice();
+};
+
+#if defined(ARDUINO_ARCH_SAMD)
+// CONFIG_FLASH_SIZE bytes of the SAMD21 program flash, erased in 256 byte rows and programmed in 64 byte pages.
+// Older firmware kept its configuration in FlashAsEEPROM's own flash array, which uploading new firmware erases,
+// so there is nothing to import.
+class SAMDFlashDevice: public FlashDevice {
+public:
+	static const size_t PAGE_SIZE = 64;
+
+	virtual size_t size() { return CONFIG_FLASH_SIZE; }
+	virtual size_t eraseSize() { return 256; }
+	virtual Result erase(size_t addr);
+	virtual Result program(size_t addr, const uint8_t *data, size_t len);
+	virtual Result read(size_t addr, uint8_t *data, size_t len);
+};
+#else
+// Flash semantics on top of the EEPROM library, for cores that don't give us the flash directly. Erasing and
+// programming only change the library's RAM copy; sync() commits it, so a store() rewrites the EEPROM sector once
+// however many records and pages it touched. Older firmware used the first 1024 bytes of the same EEPROM.
+class EEPROMFlashDevice: public FlashDevice {
+public:
+	EEPROMFlashDevice();
+	virtual size_t size() { return CONFIG_FLASH_SIZE; }
+	virtual size_t eraseSize() { return 256; }
+	virtual Result erase(size_t addr);
+	virtual Result program(size_t addr, const uint8_t *data, size_t len);
+	virtual Result read(size_t addr, uint8_t *data, size_t len);
+	virtual Result sync();
+	virtual size_t legacySize() { return CONFIG_FLASH_SIZE < 1024 ? CONFIG_FLASH_SIZE : 1024; }
+protected:
+	void begin();
+	bool begun_, dirty_;
+};
+#endif
+
+};
+
+#endif // BBFLASHDEVICE_H
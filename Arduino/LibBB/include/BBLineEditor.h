@@ -0,0 +1,98 @@
+#if !defined(BBLINEEDITOR_H)
+#define BBLINEEDITOR_H
+
+#include <Arduino.h>
+
+// Maximum length of a console input line. Longer lines are cut off.
+#if !defined(CONSOLE_LINE_SIZE)
+#define CONSOLE_LINE_SIZE 128
+#endif
+
+// Bytes of command history kept per console stream. Oldest lines are dropped first.
+#if !defined(CONSOLE_HISTORY_SIZE)
+#define CONSOLE_HISTORY_SIZE 256
+#endif
+
+namespace bb {
+
+class ConsoleStream;
+
+//
+// Edits a console input line one character at a time. Echo only describes the change - typing at the end of the
+// line echoes the character, backspace echoes "\b \b", and only edits in the middle of the line rewrite the rest
+// of it - so a command costs about as many bytes of output as it has characters.
+//
+// Understood: printable characters, backspace/DEL, Ctrl-A/Ctrl-E and Home/End, cursor left/right, Delete,
+// Ctrl-K (kill to end of line), Ctrl-U (kill to start of line), Ctrl-L (redraw), up/down and Ctrl-P/Ctrl-N for
+// the history. CR, LF and CR LF all end a line. Other control characters are ignored. The line being typed is
+// kept when the history is browsed, and comes back as the entry after the newest one.
+//
+// In telnet mode, telnet commands are filtered out of the input, and the editor only echoes once the client has
+// agreed to let the server echo (see telnetNegotiation()).
+//
+class LineEditor {
+public:
+	LineEditor();
+
+	// Feeds one input character. Echo is written to echo unless that is NULL. Returns true when a line is complete;
+	// line() returns it until the next call.
+	bool input(uint8_t c, ConsoleStream *echo);
+
+	char* line() { return line_; }
+	size_t length() { return len_; }
+	void reset();
+
+	// Clears the current line on the terminal and prints it again behind prompt, e.g. after other output.
+	void redraw(ConsoleStream *echo, const char *prompt = "> ");
+	// Formats what redraw() prints into buf. Returns the length, or 0 if it doesn't fit into size bytes.
+	size_t formatRedraw(char *buf, size_t size, const char *prompt = "> ");
+	// Whether input is echoed at all. A telnet client echoes locally until it has agreed to let us echo.
+	bool echoes() { return !telnet_ || telnetEcho_; }
+
+	void setTelnet(bool telnet) { telnet_ = telnet; telnetEcho_ = false; }
+	// Bytes to send to a telnet client at connection start: we echo, and we want characters, not lines.
+	static const uint8_t* telnetNegotiation(size_t& len);
+
+protected:
+	enum State {
+		STATE_NORMAL,
+		STATE_ESC,       // got ESC
+		STATE_CSI,       // got ESC [ or ESC O, collecting parameter
+		STATE_IAC,       // got telnet IAC
+		STATE_IAC_OPT,   // got IAC WILL/WONT/DO/DONT, waiting for option
+		STATE_IAC_SB,    // inside subnegotiation
+		STATE_IAC_SB_IAC // got IAC inside subnegotiation
+	};
+
+	bool inputNormal(uint8_t c, ConsoleStream *echo);
+	void inputCSI(uint8_t c, ConsoleStream *echo);
+	void inputTelnet(uint8_t c);
+
+	void insert(char c, ConsoleStream *echo);
+	void erase(size_t from, size_t n, ConsoleStream *echo);
+	void moveTo(size_t pos, ConsoleStream *echo);
+	void replace(const char *str, ConsoleStream *echo);
+	void addToHistory();
+	void historyUp(ConsoleStream *echo);
+	void historyDown(ConsoleStream *echo);
+
+	static void cursorLeft(size_t n, ConsoleStream *echo);
+	static size_t formatCursorLeft(size_t n, char *buf, size_t size);
+
+	char line_[CONSOLE_LINE_SIZE];
+	size_t len_, cursor_;
+
+	// Null terminated lines, oldest first. historyLen_ is the used size, historyPos_ the offset of the line being
+	// shown, or historyLen_ if none is. draft_ is the line that was being typed when browsing started.
+	char history_[CONSOLE_HISTORY_SIZE];
+	size_t historyLen_, historyPos_;
+	char draft_[CONSOLE_LINE_SIZE];
+
+	State state_;
+	uint8_t csiParam_, telnetVerb_;
+	bool lastWasCR_, telnet_, telnetEcho_;
+};
+
+};
+
+#endif // BBLINEEDITOR_H
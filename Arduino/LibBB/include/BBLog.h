@@ -0,0 +1,137 @@
+#if !defined(BBLOG_H)
+#define BBLOG_H
+
+#include <Arduino.h>
+#include <type_traits>
+#include "BBSubsystem.h"
+
+// Size of the log ring buffer in bytes. Must be a power of two.
+#if !defined(LOG_BUFFER_SIZE)
+#define LOG_BUFFER_SIZE 2048
+#endif
+
+// Logs a message without formatting it on the droid. fmt must be a string literal; it is hashed at compile time
+// and only the hash, a timestamp and the raw arguments are stored. Arguments can be integers, enums, floats,
+// doubles (stored as float), C strings and Strings (both truncated to Log::MAX_STRING_SIZE).
+#define BB_LOG(fmt, ...) \
+	bb::Log::log.write(std::integral_constant<uint32_t, bb::Log::formatID(fmt)>::value, ##__VA_ARGS__)
+
+namespace bb {
+
+//
+// BINARY LOG
+//
+// Deferred formatting log for code that cannot afford printf, like the control loop. Log sites write a
+// record with the format string's ID and the binary arguments into a ring buffer; the host turns records back
+// into text by looking the IDs up in a dictionary built from the BB_LOG() calls in the source (see
+// DroidGUI/LogDecoder.py). When the buffer is full the oldest records are overwritten, so logging never blocks
+// and never fails.
+//
+// Records are read by absolute byte offset, so any number of readers can follow the log independently and
+// rereading after a lost response is harmless. Readers are CommandServer::OP_GET_LOG and the "dump" console
+// command.
+//
+// Record layout (little endian):
+//   byte 0     record length including this byte
+//   bytes 1-4  format ID (32 bit FNV-1a hash of the format string)
+//   bytes 5-8  timestamp in micros()
+//   bytes 9..  arguments, each an ArgType byte followed by int32/uint32/float32, int64/uint64, or a length byte
+//              and the characters for strings
+//
+
+class Log: public Subsystem {
+public:
+	static Log log;
+
+	static const size_t HEADER_SIZE = 9;
+	static const size_t MAX_RECORD_SIZE = 255;
+	static const size_t MAX_STRING_SIZE = 32;
+
+	enum ArgType {
+		ARG_INT32  = 0,
+		ARG_UINT32 = 1,
+		ARG_FLOAT  = 2,
+		ARG_STRING = 3,
+		ARG_INT64  = 4,
+		ARG_UINT64 = 5
+	};
+
+	static constexpr uint32_t formatID(const char *fmt, uint32_t hash = 2166136261UL) {
+		return *fmt == 0 ? hash : formatID(fmt + 1, (uint32_t)((hash ^ (uint8_t)*fmt) * 16777619U));
+	}
+
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual void printStatus(ConsoleStream *stream);
+	virtual bool printReportItem(ConsoleStream *stream, size_t item);
+
+	template<typename... Args> void write(uint32_t id, Args... args) {
+		uint8_t record[MAX_RECORD_SIZE];
+		size_t len = HEADER_SIZE;
+		packArgs(record, len, args...);
+		append(id, record, len);
+	}
+
+	// Copies as many whole records as fit into buf, starting at offset. If offset has already been overwritten
+	// (or is from a previous boot), copying starts at the oldest record and offset is moved there; an offset inside
+	// a record is moved to the start of the next one. Returns the number of bytes copied; the next read should
+	// start at offset plus that.
+	size_t read(uint32_t& offset, uint8_t *buf, size_t maxlen);
+
+	// Absolute offsets of the oldest record and of the end of the log.
+	uint32_t firstOffset() { return tail_; }
+	uint32_t endOffset() { return head_; }
+
+protected:
+	Log();
+
+	void append(uint32_t id, uint8_t *record, size_t len);
+
+	static void packValue(uint8_t *buf, size_t& len, uint8_t type, uint64_t v, size_t size) {
+		if(len + 1 + size > MAX_RECORD_SIZE) return;
+		buf[len++] = type;
+		for(size_t i=0; i<size; i++) buf[len++] = (v >> (8*i)) & 0xff;
+	}
+	static void packArg(uint8_t *buf, size_t& len, const char *s) {
+		size_t n = strnlen(s, MAX_STRING_SIZE);
+		if(len + 2 + n > MAX_RECORD_SIZE) return;
+		buf[len++] = ARG_STRING;
+		buf[len++] = n;
+		memcpy(buf + len, s, n);
+		len += n;
+	}
+	static void packArg(uint8_t *buf, size_t& len, const String& s) { packArg(buf, len, s.c_str()); }
+	static void packArg(uint8_t *buf, size_t& len, float f) {
+		uint32_t u;
+		memcpy(&u, &f, sizeof(u));
+		packValue(buf, len, ARG_FLOAT, u, 4);
+	}
+	static void packArg(uint8_t *buf, size_t& len, double d) { packArg(buf, len, (float)d); }
+	template<typename T>
+	static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+	packArg(uint8_t *buf, size_t& len, T v) {
+		if(sizeof(T) > 4) packValue(buf, len, std::is_signed<T>::value ? ARG_INT64 : ARG_UINT64, (uint64_t)v, 8);
+		else packValue(buf, len, std::is_signed<T>::value ? ARG_INT32 : ARG_UINT32, (uint32_t)v, 4);
+	}
+
+	static void packArgs(uint8_t *buf, size_t& len) { (void)buf; (void)len; }
+	template<typename T, typename... Rest> static void packArgs(uint8_t *buf, size_t& len, T v, Rest... rest) {
+		packArg(buf, len, v);
+		packArgs(buf, len, rest...);
+	}
+
+	Result handleDumpCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleBenchmarkCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+
+	uint8_t buf_[LOG_BUFFER_SIZE];
+	uint32_t head_, tail_, lastReadEnd_;
+	unsigned long records_, overwritten_;
+	ConsoleStream *dumpStream_;
+	uint32_t dumpOffset_, dumpEnd_;
+};
+
+};
+
+#endif // BBLOG_H
@@ -1,14 +1,19 @@
 #if !defined(BBFILTER_H)
 #define BBFILTER_H
 
+#include <BBFixedPoint.h>
+
 namespace bb {
 
 // Taken from the tutorial and example code of the EXCELLENT Curio Res (https://www.youtube.com/@curiores111, 
 // https://github.com/curiores/ArduinoTutorials/blob/main/BasicFilters/ArduinoImplementations/LowPass/LowPass2.0/LowPass2.0.ino)
 // This realizes a 2nd order Butterworth low pass filter with configurable cutoff frequency.
-class LowPassFilter {
+//
+// Filtering and the adaptive coefficient recompute run in scalar type T (float or a Fixed); settings are given
+// as float. Use the LowPassFilter typedef unless you need a specific type.
+template<typename T> class BasicLowPassFilter {
 public:
-	LowPassFilter(float cutoff=100.0, float sampleFreq=0.1, bool adaptive=false);
+	BasicLowPassFilter(float cutoff=100.0, float sampleFreq=0.1, bool adaptive=false);
 
 	float cutoff() { return cutoff_; }
 	void setCutoff(float cutoff);
@@ -21,20 +26,21 @@ public:
 
 	float filter(float xn);
 protected:
-	void computeBase();
 	void computeCoefficients();
-	float a_[2], b_[3];
-	float omega0_;
-	float dt_;
+	T a_[2], b_[3];
+	T omega0_;
+	T dt_;
 	bool adapt_;
-	float tn1_ = 0;
-	float x_[3], y_[3];
+	unsigned long lastUS_;
+	T x_[3], y_[3];
 
 	float cutoff_, sampleFreq_;
 
 	bool needsRecalc_;
 };
 
+typedef BasicLowPassFilter<ControlScalar> LowPassFilter;
+
 }
 
-#endif // BBFILTER_H
\ No newline at end of file
+#endif // BBFILTER_H
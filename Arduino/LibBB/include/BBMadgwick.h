@@ -0,0 +1,43 @@
+#if !defined(BBMADGWICK_H)
+#define BBMADGWICK_H
+
+#include <BBFixedPoint.h>
+
+namespace bb {
+
+//
+// Madgwick's gradient descent orientation filter for a 6 axis IMU, after the reference implementation in the
+// Arduino Madgwick library, with the same interface: gyro in degrees per second, acceleration in any unit, angles
+// in degrees, heading from 0 to 360.
+//
+// The update runs in scalar type T. Quaternion increments at 100Hz are in the 1e-5 range, below the resolution of
+// Q16.16, so use Q8.24 for fixed point (the MadgwickFilter typedef does). Angles are computed in float, once per
+// update and only when asked for.
+//
+template<typename T> class BasicMadgwickFilter {
+public:
+	BasicMadgwickFilter();
+
+	void begin(float sampleFrequency);
+	void setBeta(float beta) { beta_ = T(beta); }
+	void updateIMU(float gx, float gy, float gz, float ax, float ay, float az);
+
+	float getRoll() { computeAngles(); return roll_ * 57.29578f; }
+	float getPitch() { computeAngles(); return pitch_ * 57.29578f; }
+	float getYaw() { computeAngles(); return yaw_ * 57.29578f + 180.0f; }
+
+protected:
+	void computeAngles();
+
+	T beta_;
+	T invSampleFreq_;
+	T q0_, q1_, q2_, q3_;
+	float roll_, pitch_, yaw_;
+	bool anglesComputed_;
+};
+
+typedef BasicMadgwickFilter<FusionScalar> MadgwickFilter;
+
+};
+
+#endif // BBMADGWICK_H
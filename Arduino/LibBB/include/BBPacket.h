@@ -3,6 +3,7 @@
 
 #include <BBError.h>
 #include <BBRunloop.h>
+#include <BBPacketLayout.h>
 
 namespace bb {
 
@@ -11,31 +12,26 @@ namespace bb {
 //
 // See https://github.com/bjoerngiesler/Droids/wiki/10-Remote-Control for documentation
 //
-
-struct __attribute__ ((packed)) ControlPacket {
+// The structs below are the in-memory representation. They are not sent as they are - Packet::encode() and
+// Packet::decode() convert to and from the wire format defined in BBPacketLayout.h, independent of compiler and
+// architecture.
+//
 
 #define AXIS_MAX 511
 
-	int16_t axis0  : 10; // bit 0..9
-	int16_t axis1  : 10; // bit 10..19
-	int16_t axis2  : 10; // bit 20..29
-	int16_t axis3  : 10; // bit 30..39
-	int16_t axis4  : 10; // bit 40..49
-	bool button0    : 1;  // bit 50
-	bool button1    : 1;  // bit 51
-	bool button2    : 1;  // bit 52
-	bool button3    : 1;  // bit 53
-	bool button4    : 1;  // bit 54
-	bool event      : 1;  // bit 55
+struct ControlPacket {
+	int16_t axis0, axis1, axis2, axis3, axis4; // -AXIS_MAX..AXIS_MAX, 10 bits on the wire
+	bool button0, button1, button2, button3, button4;
+	bool event;
 
 	void setAxis(uint8_t num, float value) {
 		value = constrain(value, -1.0, 1.0);
 		switch(num) {
-		case 0: axis0 = value*AXIS_MAX; 
-		case 1: axis1 = value*AXIS_MAX; 
-		case 2: axis2 = value*AXIS_MAX; 
-		case 3: axis3 = value*AXIS_MAX; 
-		case 4: axis4 = value*AXIS_MAX;
+		case 0: axis0 = value*AXIS_MAX; break;
+		case 1: axis1 = value*AXIS_MAX; break;
+		case 2: axis2 = value*AXIS_MAX; break;
+		case 3: axis3 = value*AXIS_MAX; break;
+		case 4: axis4 = value*AXIS_MAX; break;
 		default: break;
 		}
 	}
@@ -51,9 +47,9 @@ struct __attribute__ ((packed)) ControlPacket {
 		}
 		return 0.0;
 	}
-};     // 8 bytes long, maximum should be <=10
+};
 
-struct __attribute__ ((packed)) ControlMode {
+struct ControlMode {
 	enum ControlType {
 		CONTROL_OFF		 	 = 0,
 		CONTROL_RC			 = 1,
@@ -61,45 +57,67 @@ struct __attribute__ ((packed)) ControlMode {
 		CONTROL_AUTOMATIC	 = 3
 	};
 
-	ControlType driveControl : 2;
-	ControlType domeControl	 : 2;
-	ControlType armsControl	 : 2;
-	ControlType soundControl : 2;
+	ControlType driveControl;
+	ControlType domeControl;
+	ControlType armsControl;
+	ControlType soundControl;
 };
 
-struct __attribute__ ((packed)) SubsysStatus {
+struct SubsysStatus {
 	enum StatusType {
 		STATUS_OK		= 0,
 		STATUS_DEGRADED	= 1,
 		STATUS_ERROR	= 2,
 		STATUS_CRITICAL	= 3
 	};
-	StatusType battery 	: 2;
-	StatusType drive 	: 2;
-	StatusType servos   : 2;
-	StatusType comm		: 2;
+	StatusType battery;
+	StatusType drive;
+	StatusType servos;
+	StatusType comm;
 };
 
-struct __attribute__ ((packed)) StatePacket {
+struct StatePacket {
+	enum StateItem {
+		STATE_SUBSYS  = 0, // only control mode and subsystem status are valid
+		STATE_BATTERY = 1,
+		STATE_DRIVE   = 2
+	};
+
 	ControlMode controlMode;
 	SubsysStatus subsysStatus;
-};
-
-struct __attribute__ ((packed)) ConfigPacket {
+	uint8_t item; // StateItem, tells which member of data is valid
+	union {
+		struct {
+			uint16_t voltage; // in units of 10mV
+			int16_t current;  // in mA
+		} battery;
+		struct {
+			int16_t speed;    // in mm/s
+			int16_t pitch;    // in units of 0.01 degrees
+		} drive;
+	} data;
+};
+
+struct ConfigPacket {
 	enum ConfigType {
 		CONFIG_SET_LEFT_REMOTE_ID = 0,
 		CONFIG_SET_DROID_ID       = 1,
-		CONFIG_SET_CONTROL_MODE   = 2
+		CONFIG_SET_CONTROL_MODE   = 2,
+		CONFIG_SUPERFRAME_BEACON  = 3  // broadcast by the TDMA coordinator at the start of every superframe
 	};
 
 	ConfigType type;
 	union {
 		uint16_t id;
 		ControlMode controlMode;
+		struct {
+			uint8_t numSlots;   // superframe length in runloop cycles, slot 0 belongs to the coordinator
+			uint8_t beaconSeq;  // running beacon count, lets stations detect missed beacons
+		} superframe;
 	} parameter;
 };
 
-struct __attribute__ ((packed)) PairingPacket {
+struct PairingPacket {
 	uint8_t dummy;
 };
 
@@ -118,10 +136,12 @@ enum PacketSource {
 };
 
 struct Packet {
-	PacketType type     : 2;
-	PacketSource source : 2;
-	uint8_t seqnum      : 3; // automatically set by Runloop
-	uint8_t reserved    : 1; 
+	static const size_t SIZE = 8; // on the wire
+
+	PacketType type;
+	PacketSource source;
+	uint8_t seqnum;   // automatically set by Runloop
+	uint8_t reserved; 
 
 	union {
 		ControlPacket control;
@@ -131,21 +151,20 @@ struct Packet {
 	} payload;
 
 	Packet(PacketType t, PacketSource s) {
+		memset(this, 0, sizeof(Packet));
 		type = t;
 		source = s;
 		seqnum = bb::Runloop::runloop.getSequenceNumber()%8;
 	}
 	Packet() {}
-	uint8_t calculateCRC();
+
+	void encode(uint8_t buf[SIZE]) const;
+	void decode(const uint8_t buf[SIZE]);
+	uint8_t calculateCRC() const;
 };
 
 static const uint8_t MAX_SEQUENCE_NUMBER = 8;
 
-struct PacketFrame {
-	Packet packet;
-	uint8_t crc;
-};
-
 class PacketReceiver { 
 public:
 	virtual Result incomingPacket(uint16_t station, uint8_t rssi, const Packet& packet);
@@ -155,6 +174,14 @@ public:
 	virtual Result incomingPairingPacket(uint16_t station, PacketSource source, uint8_t rssi, const PairingPacket& packet);
 };
 
+// Receives frames that are not Packets (e.g. bulk transfer chunks). Frames are at least MIN_FRAME_SIZE bytes long
+// so they can never be mistaken for a Packet.
+class FrameReceiver {
+public:
+	static const size_t MIN_FRAME_SIZE = 12;
+	virtual Result incomingFrame(uint16_t station, uint8_t rssi, const uint8_t *data, size_t length) = 0;
+};
+
 /*
  * STATE / DIAGNOSTICS PROTOCOL
  *
@@ -200,7 +227,7 @@ struct __attribute__ ((packed)) LargeStatePacket {
 
 	DriveControlState drive[3];
 	IMUState imu[3];
-	ControlPacket lastControl[2];
+	uint8_t lastControl[2][Packet::SIZE-1]; // ControlPackets as encoded in a Packet, without the header byte
 	ServoState servo[10];
 	BatteryState battery[3];
 };
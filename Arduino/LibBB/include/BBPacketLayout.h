@@ -0,0 +1,140 @@
+#if !defined(BBPACKETLAYOUT_H)
+#define BBPACKETLAYOUT_H
+
+#include <stdint.h>
+#include <type_traits>
+
+//
+// WIRE LAYOUT OF THE REALTIME PROTOCOL
+//
+// Every Packet goes over the air as Packet::SIZE (8) bytes. Bit n of the frame is bit n%8 of byte n/8, multi-byte
+// fields are little endian. This is the layout GCC used to produce for the old bitfield structs on all our
+// (little endian) targets, so old and new firmware can talk to each other.
+//
+// Each table entry is F(member, bit offset, width, signed). The tables are also parsed by
+// extras/gen_packet_layout.py to generate the Python decoder in DroidGUI/PacketLayout.py - rerun it after changing
+// anything here.
+//
+
+#define BB_PACKET_HEADER_FIELDS(F) \
+	F(type,                      0,  2, false) \
+	F(source,                    2,  2, false) \
+	F(seqnum,                    4,  3, false) \
+	F(reserved,                  7,  1, false)
+
+#define BB_CONTROL_PACKET_FIELDS(F) \
+	F(axis0,                     8, 10, true)  \
+	F(axis1,                    18, 10, true)  \
+	F(axis2,                    28, 10, true)  \
+	F(axis3,                    38, 10, true)  \
+	F(axis4,                    48, 10, true)  \
+	F(button0,                  58,  1, false) \
+	F(button1,                  59,  1, false) \
+	F(button2,                  60,  1, false) \
+	F(button3,                  61,  1, false) \
+	F(button4,                  62,  1, false) \
+	F(event,                    63,  1, false)
+
+#define BB_STATE_PACKET_FIELDS(F) \
+	F(controlMode.driveControl,  8,  2, false) \
+	F(controlMode.domeControl,  10,  2, false) \
+	F(controlMode.armsControl,  12,  2, false) \
+	F(controlMode.soundControl, 14,  2, false) \
+	F(subsysStatus.battery,     16,  2, false) \
+	F(subsysStatus.drive,       18,  2, false) \
+	F(subsysStatus.servos,      20,  2, false) \
+	F(subsysStatus.comm,        22,  2, false) \
+	F(item,                     24,  8, false)
+
+#define BB_STATE_BATTERY_FIELDS(F) \
+	F(data.battery.voltage,     32, 16, false) \
+	F(data.battery.current,     48, 16, true)
+
+#define BB_STATE_DRIVE_FIELDS(F) \
+	F(data.drive.speed,         32, 16, true)  \
+	F(data.drive.pitch,         48, 16, true)
+
+// The config type used to be a 32 bit enum, so the parameter starts at bit 40. Bits 16..39 are always 0.
+#define BB_CONFIG_PACKET_FIELDS(F) \
+	F(type,                      8,  8, false)
+
+#define BB_CONFIG_ID_FIELDS(F) \
+	F(parameter.id,             40, 16, false)
+
+#define BB_CONFIG_CONTROL_MODE_FIELDS(F) \
+	F(parameter.controlMode.driveControl, 40, 2, false) \
+	F(parameter.controlMode.domeControl,  42, 2, false) \
+	F(parameter.controlMode.armsControl,  44, 2, false) \
+	F(parameter.controlMode.soundControl, 46, 2, false)
+
+#define BB_CONFIG_SUPERFRAME_FIELDS(F) \
+	F(parameter.superframe.numSlots,  40, 8, false) \
+	F(parameter.superframe.beaconSeq, 48, 8, false)
+
+#define BB_PAIRING_PACKET_FIELDS(F) \
+	F(dummy,                     8,  8, false)
+
+// All of the above, for the schema descriptor (see BBSchema.h). Add new tables here too.
+#define BB_PACKET_TABLES(T) \
+	T(PACKET_HEADER) \
+	T(CONTROL_PACKET) \
+	T(STATE_PACKET) \
+	T(STATE_BATTERY) \
+	T(STATE_DRIVE) \
+	T(CONFIG_PACKET) \
+	T(CONFIG_ID) \
+	T(CONFIG_CONTROL_MODE) \
+	T(CONFIG_SUPERFRAME) \
+	T(PAIRING_PACKET)
+
+namespace bb {
+
+// One field of the wire format. All positions are compile time constants, so get() and set() fold down to a few
+// shifts and masks on the bytes actually touched.
+template<unsigned OFFSET, unsigned WIDTH, bool SIGNED = false>
+struct BitField {
+	static_assert(WIDTH >= 1 && WIDTH <= 32, "field width must be 1..32 bits");
+	static_assert(OFFSET + WIDTH <= 64, "field does not fit into the packet");
+
+	static constexpr unsigned FIRST_BYTE = OFFSET / 8;
+	static constexpr unsigned SHIFT = OFFSET % 8;
+	static constexpr unsigned NUM_BYTES = (SHIFT + WIDTH + 7) / 8;
+	static constexpr uint32_t VALUE_MASK = (WIDTH == 32) ? 0xffffffffUL : ((1UL << (WIDTH % 32)) - 1);
+	static constexpr uint64_t MASK = (uint64_t)VALUE_MASK << OFFSET;
+
+	typedef typename std::conditional<(NUM_BYTES > 4), uint64_t, uint32_t>::type Word;
+
+	static inline int32_t get(const uint8_t *buf) {
+		Word w = 0;
+		for(unsigned i=0; i<NUM_BYTES; i++) w |= (Word)buf[FIRST_BYTE + i] << (8*i);
+		uint32_t v = (uint32_t)(w >> SHIFT) & VALUE_MASK;
+		if(SIGNED && WIDTH < 32 && (v >> (WIDTH - 1)) & 1) v |= ~VALUE_MASK; // sign extend
+		return (int32_t)v;
+	}
+
+	static inline void set(uint8_t *buf, uint32_t value) {
+		Word w = (Word)(value & VALUE_MASK) << SHIFT;
+		Word m = (Word)VALUE_MASK << SHIFT;
+		for(unsigned i=0; i<NUM_BYTES; i++) {
+			buf[FIRST_BYTE + i] = (buf[FIRST_BYTE + i] & ~(uint8_t)(m >> (8*i))) | (uint8_t)(w >> (8*i));
+		}
+	}
+};
+
+constexpr unsigned popcount64(uint64_t v) {
+	return v == 0 ? 0 : (unsigned)(v & 1) + popcount64(v >> 1);
+}
+
+};
+
+// Table helpers. BB_ENCODE_FIELD / BB_DECODE_FIELD expect the struct being coded in "obj" and the frame in "buf".
+#define BB_ENCODE_FIELD(member, offset, width, sgn) bb::BitField<offset, width, sgn>::set(buf, obj.member);
+#define BB_DECODE_FIELD(member, offset, width, sgn) obj.member = (decltype(obj.member))bb::BitField<offset, width, sgn>::get(buf);
+#define BB_FIELD_MASK(member, offset, width, sgn) | bb::BitField<offset, width, sgn>::MASK
+#define BB_FIELD_WIDTH(member, offset, width, sgn) + width
+
+// Fails compilation if any two fields in the given table(s) overlap.
+#define BB_CHECK_LAYOUT(TABLE, what) \
+	static_assert(bb::popcount64(0 TABLE(BB_FIELD_MASK)) == 0 TABLE(BB_FIELD_WIDTH), what " fields overlap");
+
+#endif // BBPACKETLAYOUT_H
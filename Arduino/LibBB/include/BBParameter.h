@@ -0,0 +1,57 @@
+#if !defined(BBPARAMETER_H)
+#define BBPARAMETER_H
+
+#include <Arduino.h>
+#include <limits.h>
+
+// Parameter table entries, see ParameterDescription. var must have static storage, e.g. a member of a subsystem
+// singleton, so that the entry is a constant and the table can stay in flash.
+#define BB_PARAM_INT(name, help, var, min, max) \
+	{name, help, bb::PARAMETER_INT, static_cast<int*>(&(var)), (float)(min), (float)(max)}
+#define BB_PARAM_FLOAT(name, help, var, min, max) \
+	{name, help, bb::PARAMETER_FLOAT, static_cast<float*>(&(var)), (float)(min), (float)(max)}
+#define BB_PARAM_BOOL(name, help, var) \
+	{name, help, bb::PARAMETER_BOOL, static_cast<bool*>(&(var)), 0, 1}
+// var is a char array; values are limited to its size minus the terminator.
+#define BB_PARAM_STRING(name, help, var) \
+	{name, help, bb::PARAMETER_STRING, static_cast<char*>(var), 0, (float)(sizeof(var) - 1)}
+
+namespace bb {
+
+enum ParameterType {
+	PARAMETER_INT    = 0,
+	PARAMETER_FLOAT  = 1,
+	PARAMETER_STRING = 2,
+	PARAMETER_BOOL   = 3
+};
+
+//
+// Entry in a subsystem's parameter table (see Subsystem::setParameters()). Tables are static const, so names, help
+// texts and limits live in flash; the only RAM a parameter costs is its variable and two bytes of the subsystem's
+// name index. Use the BB_PARAM_* macros to fill tables.
+//
+// value points to an int, float or bool, or to a char array for strings. min and max are the allowed range for
+// ints and floats (INT_MIN/INT_MAX meaning unlimited), max is the maximum length for strings.
+//
+struct ParameterDescription {
+	const char *name;
+	const char *help;
+	ParameterType type;
+	void *value;
+	float min, max;
+};
+
+// A typed parameter value, e.g. one staged in a ParameterTransaction. Strings are not copied.
+struct ParameterValue {
+	ParameterType type;
+	union {
+		int i;
+		float f;
+		bool b;
+		const char *s;
+	};
+};
+
+};
+
+#endif // BBPARAMETER_H
@@ -0,0 +1,85 @@
+#if !defined(BBPARAMETERTRANSACTION_H)
+#define BBPARAMETERTRANSACTION_H
+
+#include <Arduino.h>
+#include "BBSubsystem.h"
+
+// Maximum number of parameters staged in one transaction.
+#if !defined(PARAMETER_TRANSACTION_SIZE)
+#define PARAMETER_TRANSACTION_SIZE 16
+#endif
+
+// Bytes for copies of staged string values, including terminators.
+#if !defined(PARAMETER_TRANSACTION_STRING_SIZE)
+#define PARAMETER_TRANSACTION_STRING_SIZE 128
+#endif
+
+namespace bb {
+
+//
+// PARAMETER TRANSACTIONS
+//
+// Changes several parameters at once, e.g. all gains of a controller. Values are checked when they are staged,
+// so a commit cannot fail halfway. A commit is applied by the runloop at the start of the next cycle, before any
+// subsystem's step(): all values are stored first, then every affected subsystem gets one parametersChanged()
+// call for all of its parameters. No step() ever sees only part of the set.
+//
+// There is one transaction, shared by the console ("stage", "commit", "abort", "staged") and the command server
+// (OP_STAGE_PARAMETER, OP_COMMIT_PARAMETERS, OP_ABORT_PARAMETERS). Staging the same parameter again replaces the
+// staged value. Nothing can be staged between a commit and the cycle that applies it.
+//
+// Whether a commit worked is only known once it is applied, when the subsystems' parametersChanged() have run.
+// Every commit gets an ID for that: the console's "commit" replies once its commit is applied, and command server
+// clients ask with OP_COMMIT_STATUS.
+//
+class ParameterTransaction {
+public:
+	static ParameterTransaction transaction;
+
+	Result stage(Subsystem *subsys, size_t index, ParameterValue value);
+	// Parses value like Subsystem::setParameterValue() does.
+	Result stageValue(Subsystem *subsys, const char *name, const char *value);
+
+	// Marks the staged parameters to be applied at the next cycle boundary. If the runloop isn't running yet,
+	// they are applied right away. On success, id is the commit's ID (see isApplied()).
+	Result commit(uint16_t& id);
+	Result commit() { uint16_t id; return commit(id); }
+	// Drops all staged parameters. Fails if they are already committed.
+	Result abort();
+
+	// Called by the runloop at the start of each cycle. Applies committed parameters, if any.
+	void apply();
+
+	size_t numStaged() { return numStaged_; }
+	bool isCommitted() { return committed_; }
+	// Whether commit id has been applied. IDs wrap around, so this holds for the last 32767 commits.
+	bool isApplied(uint16_t id) { return (int16_t)(appliedID_ - id) >= 0; }
+	// ID and result of the last applied commit. The result is the first of its parametersChanged() calls that
+	// wasn't RES_OK.
+	uint16_t lastAppliedID() { return appliedID_; }
+	Result lastResult() { return lastResult_; }
+	void printStaged(ConsoleStream *stream);
+
+protected:
+	ParameterTransaction();
+
+	struct Entry {
+		Subsystem *subsys;
+		uint8_t index;
+		ParameterValue value;
+	};
+
+	void removeString(const char *str);
+
+	Entry entries_[PARAMETER_TRANSACTION_SIZE];
+	size_t numStaged_;
+	char strings_[PARAMETER_TRANSACTION_STRING_SIZE];
+	size_t stringsLen_;
+	bool committed_;
+	uint16_t commitID_, appliedID_;
+	Result lastResult_;
+};
+
+};
+
+#endif // BBPARAMETERTRANSACTION_H
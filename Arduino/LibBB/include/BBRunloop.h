@@ -18,8 +18,6 @@ public:
 	virtual Result stop(ConsoleStream* stream = NULL);
 	virtual Result step();
 
-	virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
-
 	uint64_t getSequenceNumber() { return seqnum_; }
 
 	void setCycleTimeMicros(unsigned int microseconds); // not milli, micro.
@@ -49,9 +47,14 @@ protected:
 	};
 
 	std::vector<TimedCallback> timedCallbacks_;
+	std::vector<unsigned long> stepTimes_;
 
 
 	Runloop();
+
+	Result handleRunningStatusCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+
 	bool running_;
 	uint64_t seqnum_;
 	uint64_t cycleTime_;
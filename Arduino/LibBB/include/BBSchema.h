@@ -0,0 +1,87 @@
+#if !defined(BBSCHEMA_H)
+#define BBSCHEMA_H
+
+#include <Arduino.h>
+#include <type_traits>
+#include "BBPacket.h"
+#include "BBPacketLayout.h"
+
+namespace bb {
+
+//
+// SCHEMA DESCRIPTOR
+//
+// Describes the state and telemetry layout (BB_TELEMETRY_FIELDS in BBTelemetry.h) and the realtime packet layout
+// (BB_PACKET_TABLES in BBPacketLayout.h) so that clients can build their decoders at runtime instead of
+// hardcoding struct formats. The tables are built at compile time from the same X-macros the encoders use, types
+// and offsets come from the compiler, so the descriptor cannot drift from what is actually sent. Clients fetch it
+// with CommandServer::OP_GET_SCHEMA; telemetry keyframes carry the schema ID so clients notice when it changes.
+//
+// Descriptor layout (little endian, strings are a length byte followed by the characters):
+//   VERSION (uint8)
+//   sizeof(LargeStatePacket) (uint16), droidName offset (uint16), droidName size (uint8)
+//   number of telemetry fields (uint8), then per field in channel order:
+//     name, FieldType (uint8), byte offset in LargeStatePacket (uint16), scale (float32)
+//   number of packet tables (uint8), then per table:
+//     name, number of fields (uint8), then per field: name, bit offset, width, signed (uint8 each)
+//
+// The schema ID is a 16 bit FNV-1a hash of the descriptor.
+//
+
+class Schema {
+public:
+	static const uint8_t VERSION = 1;
+
+	// FieldType is (kind << 4) | size in bytes.
+	enum FieldKind {
+		KIND_UNSIGNED = 0,
+		KIND_SIGNED   = 1,
+		KIND_FLOAT    = 2
+	};
+
+	struct TelemetryField {
+		const char *name;
+		uint8_t type;
+		uint16_t offset;
+		float scale;
+	};
+
+	struct PacketField {
+		const char *name;
+		uint8_t offset, width;
+		bool isSigned;
+	};
+
+	struct PacketTable {
+		const char *name;
+		const PacketField *fields;
+		uint8_t numFields;
+	};
+
+	static const TelemetryField telemetryFields[];
+	static const PacketTable packetTables[];
+	static const size_t NUM_PACKET_TABLES;
+
+	static uint16_t id();
+	static size_t size();
+
+	// Copies up to len bytes of the descriptor, starting at offset, into buf. Returns the number of bytes copied.
+	// The descriptor is generated on the fly, so this needs no RAM beyond buf.
+	static size_t read(size_t offset, uint8_t *buf, size_t len);
+};
+
+template<typename T, bool IS_ENUM = std::is_enum<T>::value>
+struct SchemaFieldType {
+	static const uint8_t value = ((std::is_floating_point<T>::value ? Schema::KIND_FLOAT :
+	                               std::is_signed<T>::value ? Schema::KIND_SIGNED : Schema::KIND_UNSIGNED) << 4) | sizeof(T);
+};
+
+// Enums go over the wire with whatever size the compiler gave them.
+template<typename T>
+struct SchemaFieldType<T, true> {
+	static const uint8_t value = SchemaFieldType<typename std::underlying_type<T>::type>::value;
+};
+
+};
+
+#endif // BBSCHEMA_H
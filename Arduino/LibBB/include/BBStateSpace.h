@@ -0,0 +1,112 @@
+#if !defined(BBSTATESPACE_H)
+#define BBSTATESPACE_H
+
+#include <BBFixedPoint.h>
+
+namespace bb {
+
+// Dot products of N elements, unrolled at compile time so there is no loop counter or indexing left at runtime.
+template<int N> struct Unrolled {
+	template<typename T> static T dot(const T *a, const T *b) { return Unrolled<N-1>::dot(a, b) + a[N-1]*b[N-1]; }
+	template<int FRAC> static int64_t rawDot(const Fixed<FRAC> *a, const Fixed<FRAC> *b) {
+		return Unrolled<N-1>::rawDot(a, b) + int64_t(a[N-1].raw()) * b[N-1].raw();
+	}
+};
+template<> struct Unrolled<1> {
+	template<typename T> static T dot(const T *a, const T *b) { return a[0]*b[0]; }
+	template<int FRAC> static int64_t rawDot(const Fixed<FRAC> *a, const Fixed<FRAC> *b) {
+		return int64_t(a[0].raw()) * b[0].raw();
+	}
+};
+
+template<int N, typename T> inline T dotProduct(const T *a, const T *b) { return Unrolled<N>::dot(a, b); }
+// Fixed point accumulates the exact products in 64 bits and rounds and saturates once, which is both cheaper and
+// more precise than N Fixed multiplications. Each product must stay below 2^63/N in raw units.
+template<int N, int FRAC> inline Fixed<FRAC> dotProduct(const Fixed<FRAC> *a, const Fixed<FRAC> *b) {
+	return Fixed<FRAC>::fromRaw(Fixed<FRAC>::saturate((Unrolled<N>::rawDot(a, b) + (int64_t(1) << (FRAC-1))) >> FRAC));
+}
+
+//
+// Linear state feedback u = u0 - K (x - r) for NX states and NU controls, computed in T. K is NU x NX and comes
+// from offline design, e.g. LQR (see extras/lqr_gains.py); r is the goal state, u0 the control at the goal.
+// Everything is fixed size, nothing is allocated.
+//
+// u0 + K r changes only when a goal or gain does, so it is folded into one offset per control when set. An update is
+// then NU dot products of length NX and NU clamps; no division, unlike a PID with its dt.
+//
+// Gains, goals and bounds are given as float and converted once when set.
+//
+template<int NX, int NU, typename T = ControlScalar> class StateFeedback {
+public:
+	static const int STATES = NX;
+	static const int CONTROLS = NU;
+
+	StateFeedback() {
+		for(int j=0; j<NU; j++) {
+			for(int i=0; i<NX; i++) k_[j][i] = 0.0f;
+			u0_[j] = 0.0f;
+			min_[j] = max_[j] = T(0);
+			bounded_[j] = false;
+			saturation_[j] = 0;
+		}
+		for(int i=0; i<NX; i++) goal_[i] = 0.0f;
+		computeOffsets();
+	}
+
+	void setGains(const float (&k)[NU][NX]) {
+		for(int j=0; j<NU; j++) for(int i=0; i<NX; i++) k_[j][i] = k[j][i];
+		computeOffsets();
+	}
+	void setGain(int control, int state, float k) { k_[control][state] = k; computeOffsets(); }
+	float gain(int control, int state) { return k_[control][state]; }
+
+	void setGoal(int state, float goal) { goal_[state] = goal; computeOffsets(); }
+	float goal(int state) { return goal_[state]; }
+
+	void setControlOffset(int control, float u0) { u0_[control] = u0; computeOffsets(); }
+	float controlOffset(int control) { return u0_[control]; }
+
+	void setControlBounds(int control, float min, float max) {
+		min_[control] = T(min); max_[control] = T(max);
+		bounded_[control] = true;
+	}
+	void setControlUnbounded(int control) { bounded_[control] = false; }
+
+	// 1 if the control was clamped at its upper bound by the last compute(), -1 at the lower, 0 if not.
+	int saturation(int control) { return saturation_[control]; }
+
+	// Controls u from state x.
+	void compute(const T *x, T *u) {
+		for(int j=0; j<NU; j++) {
+			T v = offset_[j] - dotProduct<NX>(kT_[j], x);
+			saturation_[j] = 0;
+			if(bounded_[j]) {
+				if(v >= max_[j]) { v = max_[j]; saturation_[j] = 1; }
+				else if(v <= min_[j]) { v = min_[j]; saturation_[j] = -1; }
+			}
+			u[j] = v;
+		}
+	}
+
+protected:
+	void computeOffsets() {
+		for(int j=0; j<NU; j++) {
+			float offset = u0_[j];
+			for(int i=0; i<NX; i++) {
+				kT_[j][i] = T(k_[j][i]);
+				offset += k_[j][i] * goal_[i];
+			}
+			offset_[j] = T(offset);
+		}
+	}
+
+	float k_[NU][NX], goal_[NX], u0_[NU]; // as set, for reading back without rounding
+	T kT_[NU][NX], offset_[NU];            // what compute() works with; offset is u0 + K r
+	T min_[NU], max_[NU];
+	bool bounded_[NU];
+	int saturation_[NU];
+};
+
+};
+
+#endif // BBSTATESPACE_H
@@ -7,6 +7,13 @@
 #include <vector>
 #include "BBError.h"
 #include "BBConfigStorage.h"
+#include "BBConsoleCommand.h"
+#include "BBParameter.h"
+
+// Size of the subsystem name index, must be a power of two and larger than the number of subsystems.
+#if !defined(SUBSYSTEM_INDEX_SIZE)
+#define SUBSYSTEM_INDEX_SIZE 64
+#endif
 
 namespace bb {
 
@@ -17,12 +24,18 @@ class SubsystemManager {
 public:
 	static SubsystemManager manager;
 	Result registerSubsystem(Subsystem* subsys);
-	Subsystem* subsystemWithName(const String& name);
+	Subsystem* subsystemWithName(const char* name);
+	Subsystem* subsystemWithName(const String& name) { return subsystemWithName(name.c_str()); }
 	const std::vector<Subsystem*>& subsystems();
 
+	// 32 bit FNV-1a, used for the subsystem and parameter name indices.
+	static uint32_t hash(const char *name);
+
 protected:
 	SubsystemManager();
+
 	std::vector<Subsystem*> subsys_;
+	Subsystem* index_[SUBSYSTEM_INDEX_SIZE]; // open addressing by name hash, so lookups don't scale with subsys_
 };
 
 class Subsystem {
@@ -30,7 +43,10 @@ public:
 	virtual const char* name() { return name_; }
 	virtual const char* description() { return description_; }
 	virtual const char* help() { return help_; }
-	virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
+	// Looks args[0] up in the subsystem's command table (see setCommands()), then in the standard commands (help,
+	// status, start, stop, get, set), checks the arguments and calls the handler. Override only for commands that
+	// can't go into a table, and call this for everything else.
+	virtual Result handleConsoleCommand(const ConsoleArgs& args, ConsoleStream *stream);
 
 	virtual Result initialize() { operationStatus_ = RES_SUBSYS_NOT_STARTED; return registerWithManager(); };
 	virtual Result start(ConsoleStream *stream) = 0;
@@ -43,134 +59,87 @@ public:
 
 	virtual void printStatus(ConsoleStream *stream);
 	virtual void printHelp(ConsoleStream *stream);
+	// Prints piece number item of the help text (description, commands, parameters one at a time). Returns false if
+	// there is no such piece. Used by the console to print help over several cycles.
+	virtual bool printHelpItem(ConsoleStream *stream, size_t item);
+	// Prints piece number item of a report the subsystem started with Console::startReport(stream, REPORT_SUBSYS,
+	// this). Returns false if there is nothing left. The default has nothing to report.
+	virtual bool printReportItem(ConsoleStream *stream, size_t item);
 	virtual void printParameters(ConsoleStream *stream);
 
-	virtual Result addParameter(const String& name, const String& help, int& param, int min = INT_MIN, int max = INT_MAX);
-	virtual Result addParameter(const String& name, const String& help, float& param, float min = INT_MIN, float max = INT_MAX);
-	virtual Result addParameter(const String& name, const String& help, String& param, int maxlen = 0);
-	virtual Result addParameter(const String& name, const String& help, bool& val);
-
-	virtual Result setParameterValue(const String& name, const String& stringVal);
-	virtual void parameterChangedCallback(const String& name) {} // override if you want to do something if the parameter was changed
+	size_t numParameters() { return numParameters_; }
+	const ParameterDescription* parameter(size_t index) { return index < numParameters_ ? &parameters_[index] : NULL; }
+	// Index of the parameter called name, or -1 if there is none. Hashed, so independent of the number of parameters.
+	int parameterIndex(const char *name);
+
+	// Typed access without String conversion. Setters check type and range and then call parameterChanged().
+	// An int can be set on a float parameter; everything else has to match.
+	Result setParameter(size_t index, int value);
+	Result setParameter(size_t index, float value);
+	Result setParameter(size_t index, bool value);
+	Result setParameter(size_t index, const char *value);
+	Result setParameter(size_t index, ParameterValue value);
+	Result getParameter(size_t index, int& value);
+	Result getParameter(size_t index, float& value);
+	Result getParameter(size_t index, bool& value);
+	Result getParameter(size_t index, const char*& value);
+
+	// For the console. Parses value according to the parameter type (ints in decimal or 0x hex, bools as
+	// true/false, on/off, yes/no or 1/0).
+	Result setParameterValue(const char *name, const char *value);
+	void printParameter(ConsoleStream *stream, size_t index);
+
+	// Check value against type and limits of parameter index without storing it. An int value for a float
+	// parameter is converted. parseParameter() does the same for a string as given to setParameterValue().
+	Result checkParameter(size_t index, ParameterValue& value);
+	Result parseParameter(size_t index, const char *str, ParameterValue& value);
+
+	// Called after a parameter has been set through any of the above. Override to apply the new value. The value
+	// has already been stored; a result other than RES_OK is passed on to whoever set it.
+	virtual Result parameterChanged(const char *name) { (void)name; return RES_OK; }
+	// Called once after parameters indices[0..num-1] have been set together, either by one of the setters above
+	// (num is 1) or by a committed ParameterTransaction. The default calls parameterChanged() for each. Override
+	// this instead if the parameters only make sense as a set, like the gains of a controller.
+	virtual Result parametersChanged(const uint8_t *indices, size_t num);
 
 protected:
-	class Parameter {
-	public:
-		virtual Result fromString(const String& str) = 0;
-		virtual String toString() const = 0;
-		virtual String description() const = 0;
-		virtual const String& name() const { return name_; }
-		virtual const void print(ConsoleStream* stream);
-	protected:
-		String name_;
-	};
-
-	virtual Parameter* findParameter(const String& name);
-
-	class IntParameter: public Parameter {
-	public:
-		IntParameter(const String& name, int& val, String help, int min=INT_MIN, int max=INT_MAX): 
-			val_(val), help_(help), min_(min), max_(max) {name_ = name;}
-		virtual Result fromString(const String& str) {
-			int v = str.toInt();
-			if(v<min_ || v>max_) return RES_COMMON_OUT_OF_RANGE;
-			val_ = v;
-			return RES_OK;
-		}
-		virtual String toString() const { return String(val_); }
-		virtual String description() const { 
-			String str = toString() + " [";
-			if(min_==INT_MAX) str+="-inf"; else str+=min_;
-			str += "..";
-			if(max_==INT_MAX) str+="inf"; else str+=max_;
-			str += "]";
-			if(help_.length() != 0) str = str + ": " + help_; 
-			return str;
-		}
-	protected:
-		int& val_;
-		String help_;
-		int min_, max_;
-	};
-
-	class FloatParameter: public Parameter {
-	public:
-		FloatParameter(const String& name, float& val, String help, float min=INT_MIN, float max=INT_MAX): 
-			val_(val), help_(help), min_(min), max_(max) {name_ = name;}
-		virtual Result fromString(const String& str) {
-			float v = str.toFloat();
-			if(v<min_ || v>max_) return RES_COMMON_OUT_OF_RANGE;
-			val_ = v;
-			return RES_OK;
-		}
-		virtual String toString() const { return String(val_, 10); }
-		virtual String description() const { 
-			String str = toString() + " [";
-			if(min_==INT_MAX) str+="-inf"; else str+=min_;
-			str += "..";
-			if(max_==INT_MAX) str+="inf"; else str+=max_;
-			str += "]";
-			if(help_.length() != 0) str = str + ": " + help_; 
-			return str;
-		}
-	protected:
-		float& val_;
-		String help_;
-		float min_, max_;
-	};
-
-	class StringParameter: public Parameter {
-	public:
-		StringParameter(const String& name, String& val, String help, int maxlen=0): val_(val), help_(help), maxlen_(maxlen) {name_ = name;}
-		virtual Result fromString(const String& str) { 
-			if(maxlen_ > 0 && str.length() <= maxlen_) {
-				val_ = str; 
-				return RES_OK; 
-			} 
-			return RES_COMMON_OUT_OF_RANGE;
-		}
-		virtual String toString() const { return val_; }
-		virtual String description() const { 
-			String str = toString();
-			if(maxlen_ != 0) str = str + " (max length " + maxlen_ + ")";
-			if(help_.length() != 0) str = str + ": " + help_; 
-			return str;
-		}
-	protected:
-		String& val_;
-		String help_;
-		unsigned int maxlen_;
-	};	
-
-	class BoolParameter: public Parameter {
-	public:
-		BoolParameter(const String& name, bool& val, String help): val_(val), help_(help) {name_ = name;}
-		virtual Result fromString(const String& str) { 
-			if(str == "true" || str == "yes" || str == "1") {
-				val_ = true;
-				return RES_OK;
-			} else if(str == "false" || str == "no" || str == "0") {
-				val_ = false;
-				return RES_OK;
-			}
-			return RES_COMMON_OUT_OF_RANGE;
-		}
-		virtual String toString() const { return val_ ? "true" : "false"; }
-		virtual String description() const { 
-			String str = toString();
-			if(help_.length() != 0) str = str + ": " + help_; 
-			return str;
-		}
-	protected:
-		bool& val_;
-		String help_;
-	};
-
-	std::vector<Parameter*> parameters_;
+	// Sets the subsystem's console command table. The table must stay valid (usually a static const member).
+	template<size_t N> void setCommands(const ConsoleCommand (&commands)[N]) { commands_ = commands; numCommands_ = N; }
+
+	static const ConsoleCommand* findCommand(const ConsoleCommand *commands, size_t num, const ConsoleArg& name);
+	static Result checkArguments(const char *signature, const ConsoleArgs& args);
+	Result runCommand(const ConsoleCommand& command, const ConsoleArgs& args, ConsoleStream *stream);
+
+	Result handleHelpCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStatusCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStartCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleStopCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleGetCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleSetCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand standardCommands_[];
+	static const size_t numStandardCommands_;
+
+	// Sets the subsystem's parameter table. The table must stay valid (usually a static const member), and names
+	// must be unique. Builds the name index, which is the only heap used for parameters.
+	template<size_t N> Result setParameters(const ParameterDescription (&params)[N]) { return setParameters(params, N); }
+	Result setParameters(const ParameterDescription *params, size_t num);
+
+	friend class ParameterTransaction;
+	// Stores a checked value without calling parametersChanged().
+	void storeParameter(size_t index, const ParameterValue& value);
+
 	bool started_;
 	Result operationStatus_;
 	const char *name_, *description_, *help_;
-	Subsystem(): started_(false), operationStatus_(RES_SUBSYS_NOT_INITIALIZED), name_(""), description_(""), help_("") {}
+	const ConsoleCommand *commands_;
+	size_t numCommands_;
+	const ParameterDescription *parameters_;
+	size_t numParameters_;
+	uint8_t *parameterIndex_; // open addressing by name hash, entries are parameter index + 1
+	size_t parameterIndexMask_;
+	Subsystem(): started_(false), operationStatus_(RES_SUBSYS_NOT_INITIALIZED), name_(""), description_(""), help_(""),
+		commands_(NULL), numCommands_(0), parameters_(NULL), numParameters_(0), parameterIndex_(NULL),
+		parameterIndexMask_(0) {}
 	virtual ~Subsystem() { }
 };
 
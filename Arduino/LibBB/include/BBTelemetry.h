@@ -0,0 +1,164 @@
+#if !defined(BBTELEMETRY_H)
+#define BBTELEMETRY_H
+
+#include <Arduino.h>
+#include "BBPacket.h"
+
+//
+// COMPACT TELEMETRY FORMAT
+//
+// Replaces sending LargeStatePacket as raw floats. Every field of the LargeStatePacket is converted to a fixed
+// point integer (value * scale, rounded). Only the fields in the encoder's field mask are sent (see
+// TelemetryService for how the mask is built from client subscriptions). A keyframe carries the schema ID (see
+// BBSchema.h), the droid name, the field mask and all masked fields as zigzag varints; the frames in between carry a bitmap of the fields that
+// differ from the last keyframe, followed by the zigzag varint deltas of those fields. Deltas are taken against
+// the keyframe, not the previous frame, so a lost UDP packet only loses that one sample; a lost keyframe is
+// recovered at the next one.
+//
+// Frame layout:
+//   byte 0     TelemetryEncoder::MAGIC
+//   byte 1     flags (FLAG_KEYFRAME)
+//   byte 2     sequence number of this frame
+//   byte 3     sequence number of the keyframe the deltas refer to (== byte 2 for keyframes)
+//   byte 4     number of fields, lets the decoder detect a mismatched table
+//   keyframe:  schema ID (uint16), name length, name, field mask bitmap, the masked fields as zigzag varints
+//   delta:     change bitmap, then the changed fields' deltas
+// Bitmaps are (fields+7)/8 bytes long, field n is bit n%8 of byte n/8.
+//
+// Each table entry is F(member, scale), in LargeStatePacket member order. A field's position in the table is its
+// stable channel ID, so only ever append to the end (i.e. to LargeStatePacket). Clients get names and scales from
+// the schema descriptor at runtime; extras/gen_packet_layout.py also parses the tables for the channel names
+// DroidGUI subscribes to before it knows a droid's schema - rerun it after changing anything here.
+//
+
+#define BB_TELEMETRY_DRIVE_FIELDS(F, i) \
+	F(drive[i].errorState,     1) \
+	F(drive[i].controlMode,    1) \
+	F(drive[i].presentPWM,  1000) \
+	F(drive[i].presentSpeed,  10) \
+	F(drive[i].presentPos,    10) \
+	F(drive[i].goal,         100) \
+	F(drive[i].err,          100) \
+	F(drive[i].errI,         100) \
+	F(drive[i].errD,         100) \
+	F(drive[i].control,     1000)
+
+#define BB_TELEMETRY_IMU_FIELDS(F, i) \
+	F(imu[i].errorState,       1) \
+	F(imu[i].r,              100) \
+	F(imu[i].p,              100) \
+	F(imu[i].h,              100) \
+	F(imu[i].dr,             100) \
+	F(imu[i].dp,             100) \
+	F(imu[i].dh,             100) \
+	F(imu[i].ax,            1000) \
+	F(imu[i].ay,            1000) \
+	F(imu[i].az,            1000)
+
+#define BB_TELEMETRY_CONTROL_FIELDS(F, i) \
+	F(lastControl[i][0],       1) \
+	F(lastControl[i][1],       1) \
+	F(lastControl[i][2],       1) \
+	F(lastControl[i][3],       1) \
+	F(lastControl[i][4],       1) \
+	F(lastControl[i][5],       1) \
+	F(lastControl[i][6],       1)
+
+#define BB_TELEMETRY_SERVO_FIELDS(F, i) \
+	F(servo[i].errorState,     1) \
+	F(servo[i].goal,          10) \
+	F(servo[i].present,       10) \
+	F(servo[i].load,          10)
+
+#define BB_TELEMETRY_BATTERY_FIELDS(F, i) \
+	F(battery[i].errorState,   1) \
+	F(battery[i].voltage,    100) \
+	F(battery[i].current,      1)
+
+#define BB_TELEMETRY_FIELDS(F) \
+	F(timestamp,            1000) \
+	F(droidType,               1) \
+	BB_TELEMETRY_DRIVE_FIELDS(F, 0) \
+	BB_TELEMETRY_DRIVE_FIELDS(F, 1) \
+	BB_TELEMETRY_DRIVE_FIELDS(F, 2) \
+	BB_TELEMETRY_IMU_FIELDS(F, 0) \
+	BB_TELEMETRY_IMU_FIELDS(F, 1) \
+	BB_TELEMETRY_IMU_FIELDS(F, 2) \
+	BB_TELEMETRY_CONTROL_FIELDS(F, 0) \
+	BB_TELEMETRY_CONTROL_FIELDS(F, 1) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 0) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 1) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 2) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 3) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 4) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 5) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 6) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 7) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 8) \
+	BB_TELEMETRY_SERVO_FIELDS(F, 9) \
+	BB_TELEMETRY_BATTERY_FIELDS(F, 0) \
+	BB_TELEMETRY_BATTERY_FIELDS(F, 1) \
+	BB_TELEMETRY_BATTERY_FIELDS(F, 2)
+
+#define BB_TELEMETRY_COUNT_FIELD(member, scale) + 1
+
+namespace bb {
+
+class TelemetryEncoder {
+public:
+	static const uint8_t MAGIC = 0xb5;
+	static const uint8_t FLAG_KEYFRAME = 0x01;
+	static const size_t NUM_FIELDS = 0 BB_TELEMETRY_FIELDS(BB_TELEMETRY_COUNT_FIELD);
+	static const size_t HEADER_SIZE = 5;
+	static const size_t BITMAP_SIZE = (NUM_FIELDS + 7) / 8;
+	static const size_t NAME_SIZE = sizeof(((LargeStatePacket*)0)->droidName);
+	static const size_t MAX_VARINT_SIZE = 5;
+	static const size_t MAX_FRAME_SIZE = HEADER_SIZE + 2 + 1 + NAME_SIZE + BITMAP_SIZE + NUM_FIELDS * MAX_VARINT_SIZE;
+
+	TelemetryEncoder(unsigned int keyframeInterval = 32);
+
+	// At most keyframeInterval delta frames follow a keyframe.
+	void setKeyframeInterval(unsigned int interval) { keyframeInterval_ = interval; }
+	unsigned int keyframeInterval() { return keyframeInterval_; }
+	void forceKeyframe() { needKeyframe_ = true; }
+
+	// Selects the fields to send, as a BITMAP_SIZE byte bitmap. NULL selects all fields. Changing the mask
+	// forces a keyframe.
+	void setFieldMask(const uint8_t *mask);
+	const uint8_t* fieldMask() { return mask_; }
+	static bool isFieldSet(const uint8_t *bitmap, size_t field) { return (bitmap[field/8] >> (field%8)) & 1; }
+
+	// Returns true if the next frame will be a keyframe.
+	bool keyframeDue() { return needKeyframe_ || sinceKeyframe_ >= keyframeInterval_; }
+
+	// Encodes sample into buf, which must hold at least MAX_FRAME_SIZE bytes. Returns the frame length.
+	size_t encode(const LargeStatePacket& sample, uint8_t *buf);
+
+	// Encodes the current keyframe again, unchanged, for a client that missed it. Only the droid name is taken
+	// from sample. Returns the frame length, 0 if there is no keyframe yet.
+	size_t encodeLastKeyframe(const LargeStatePacket& sample, uint8_t *buf);
+
+	// Converts sample into its fixed point representation, in table order. values must hold NUM_FIELDS entries.
+	static void toFixed(const LargeStatePacket& sample, int32_t *values);
+
+	unsigned long frames() { return frames_; }
+	unsigned long keyframes() { return keyframes_; }
+	unsigned long bytes() { return bytes_; }
+
+protected:
+	size_t encodeKeyframe(const LargeStatePacket& sample, const int32_t *values, uint8_t *buf);
+	size_t writeKeyframe(const LargeStatePacket& sample, uint8_t *buf);
+	size_t encodeDelta(const int32_t *values, uint8_t *buf);
+
+	int32_t keyframe_[NUM_FIELDS];
+	uint8_t mask_[BITMAP_SIZE];
+	unsigned int keyframeInterval_, sinceKeyframe_;
+	bool needKeyframe_;
+	uint8_t seqnum_, keyframeSeqnum_;
+	size_t keyframeSize_;
+	unsigned long frames_, keyframes_, bytes_;
+};
+
+};
+
+#endif // BBTELEMETRY_H
@@ -0,0 +1,99 @@
+#if !defined(BBTELEMETRYSERVICE_H)
+#define BBTELEMETRYSERVICE_H
+
+#include <Arduino.h>
+#include "BBSubsystem.h"
+#include "BBWifiServer.h"
+#include "BBTelemetry.h"
+
+namespace bb {
+
+//
+// TELEMETRY SUBSCRIPTIONS
+//
+// Clients ask for the telemetry channels they need (channel ID = field index in BB_TELEMETRY_FIELDS) by sending
+// a subscription request to the droid's UDP port. Every published sample is encoded once with the union of all
+// live subscriptions as field mask and sent to each subscriber whose rate is due. A subscriber that hasn't got
+// the current keyframe yet gets it, re-encoded, instead of its next scheduled frame, so keyframes never make
+// every subscriber send at once and slow subscribers can still always decode. Subscriptions expire after their
+// lease unless renewed. With no subscribers nothing is encoded or sent.
+//
+// Request layout (little endian):
+//   byte 0     TelemetryService::MAGIC
+//   byte 1     RequestType
+//   bytes 2-3  rate in Hz, 0 for every sample
+//   bytes 4-5  lease in ms, capped by the max_lease parameter
+//   byte 6     number of channels n
+//   bytes 7..  n channel IDs
+//
+
+class TelemetryService: public Subsystem, public UDPReceiver {
+public:
+	static TelemetryService telemetry;
+
+	static const uint8_t MAGIC = 0xb6;
+	static const uint8_t MAX_SUBSCRIBERS = 4;
+	static const size_t REQUEST_HEADER_SIZE = 7;
+
+	enum RequestType {
+		REQUEST_SUBSCRIBE   = 0,
+		REQUEST_UNSUBSCRIBE = 1
+	};
+
+	// Transport for telemetry frames. The default transport sends via WifiServer, batching frames per subscriber
+	// (see WifiServer::streamUDPPacket()).
+	class Transport {
+	public:
+		virtual bool sendTo(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) = 0;
+	};
+
+	virtual Result initialize(Transport *transport = NULL);
+	virtual Result start(ConsoleStream *stream = NULL);
+	virtual Result stop(ConsoleStream *stream = NULL);
+	virtual Result step();
+	virtual Result parameterChanged(const char *name);
+	virtual void printStatus(ConsoleStream *stream);
+
+	virtual void incomingUDPPacket(const IPAddress& remoteIP, uint16_t remotePort, const uint8_t *data, size_t len);
+
+	// Creates or renews a subscription. Channels not in the table are ignored.
+	Result subscribe(const IPAddress& addr, uint16_t port, const uint8_t *channels, size_t numChannels,
+	                 unsigned int rateHz, unsigned int leaseMS);
+	Result unsubscribe(const IPAddress& addr, uint16_t port);
+	unsigned int numSubscribers();
+
+	// Returns true if publish() would send anything right now. Use this to skip collecting the sample.
+	bool wantsSample();
+	Result publish(const LargeStatePacket& sample);
+
+	TelemetryEncoder& encoder() { return encoder_; }
+
+protected:
+	TelemetryService();
+
+	static const ParameterDescription parameterTable_[];
+
+	struct Subscriber {
+		bool active;
+		IPAddress addr;
+		uint16_t port;
+		uint8_t mask[TelemetryEncoder::BITMAP_SIZE];
+		unsigned long periodUS, lastSentUS, expiresMS;
+		unsigned long framesSent;
+		unsigned long keyframe; // TelemetryEncoder::keyframes() count of the last keyframe sent to it
+	};
+
+	Subscriber* findSubscriber(const IPAddress& addr, uint16_t port);
+	bool isDue(const Subscriber& s, unsigned long nowUS);
+	void updateMask();
+
+	Transport *transport_;
+	TelemetryEncoder encoder_;
+	Subscriber subscribers_[MAX_SUBSCRIBERS];
+	int maxLeaseMS_, keyframeInterval_;
+	unsigned long requests_, rejected_, resyncs_;
+};
+
+};
+
+#endif // BBTELEMETRYSERVICE_H
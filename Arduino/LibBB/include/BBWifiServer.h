@@ -3,6 +3,7 @@
 
 #include <Arduino.h>
 #include <WiFiNINA.h>
+#include <vector>
 #include "BBSubsystem.h"
 #include "BBConfigStorage.h"
 #include "BBConsole.h"
@@ -21,12 +22,22 @@ public:
 	WifiConsoleStream();
 	void setClient(const WiFiClient& client);
 	virtual bool available();
-	virtual bool readStringUntil(unsigned char c, String& str);
-	virtual void printfFinal(const char* str);
+	virtual char* readLine();
 protected:
+	// WiFiNINA writes block until the module has taken the data, so hand it small pieces.
+	static const size_t MAX_WRITE_SIZE = 128;
+
+	virtual size_t writeNonBlocking(const uint8_t *buf, size_t len);
+
 	WiFiClient client_;
 };
 
+// Receives UDP packets arriving at the server's UDP port (parameter remote_port).
+class UDPReceiver {
+public:
+	virtual void incomingUDPPacket(const IPAddress& remoteIP, uint16_t remotePort, const uint8_t *data, size_t len) = 0;
+};
+
 class WifiServer: public Subsystem {
 public:
 	static WifiServer server;
@@ -41,7 +52,7 @@ public:
 
 	virtual void printStatus(ConsoleStream *stream);
 
-	virtual Result setParameterValue(const String& name, const String& value);
+	virtual Result parameterChanged(const char *name);
 
 	bool tryToStartAP(const String& ssid, const String& key);
 	bool isAPStarted();
@@ -50,11 +61,55 @@ public:
 
 	bool broadcastUDPPacket(const uint8_t* packet, size_t len);
 	bool sendUDPPacket(const IPAddress& addr, const uint8_t* packet, size_t len);
+	bool sendUDPPacket(const IPAddress& addr, uint16_t port, const uint8_t* packet, size_t len);
+
+	// Batched sending for high rate streams. Datagrams queued for the same destination are collected, each with
+	// its micros() timestamp, into one batch datagram that goes out when it is full (parameter batch_size) or its
+	// oldest datagram is batch_age ms old. Every datagram costs a WiFiNINA SPI transaction, so this is a lot cheaper
+	// than sending each one. batch_age 0 sends everything right away.
+	//
+	// Batch layout: BATCH_MAGIC, number of datagrams, micros() of the first datagram (uint32, little endian), then
+	// for every datagram its time offset to the first in us and its length (both varints) and the datagram itself.
+	bool streamUDPPacket(const IPAddress& addr, uint16_t port, const uint8_t* packet, size_t len);
+	void flushUDPStreams();
+
+	Result addUDPReceiver(UDPReceiver *receiver);
+	Result removeUDPReceiver(UDPReceiver *receiver);
 
 protected:
 	WifiServer();
 
-	unsigned int readDataIfAvailable(uint8_t* buf, unsigned int maxsize, IPAddress& remoteIP);
+	static const ParameterDescription parameterTable_[];
+
+	static const unsigned int MAX_UDP_PACKET_SIZE = 256;
+	static const unsigned int MAX_UDP_PACKETS_PER_STEP = 4;
+
+	static const uint8_t BATCH_MAGIC = 0xb4;
+	static const unsigned int BATCH_HEADER_SIZE = 6;
+	static const unsigned int MAX_BATCH_SIZE = 512;
+	static const unsigned int MAX_UDP_STREAMS = 4;
+
+	struct UDPStream {
+		bool used;
+		IPAddress addr;
+		uint16_t port;
+		uint8_t buf[MAX_BATCH_SIZE];
+		size_t len;
+		unsigned long firstUS, firstMS, lastUsedMS;
+	};
+
+	UDPStream* findUDPStream(const IPAddress& addr, uint16_t port);
+	bool flushUDPStream(UDPStream& stream);
+
+	UDPStream streams_[MAX_UDP_STREAMS];
+	int batchSize_, batchAgeMS_;
+	unsigned long udpTransactions_, udpBytes_, udpStreamed_;
+	unsigned long udpStatsMS_, udpTransactionsPerSec_, udpBytesPerSec_, udpStreamedPerSec_;
+	unsigned long udpLastTransactions_, udpLastBytes_, udpLastStreamed_;
+
+	unsigned int readDataIfAvailable(uint8_t* buf, unsigned int maxsize, IPAddress& remoteIP, uint16_t& remotePort);
+
+	std::vector<UDPReceiver*> udpReceivers_;
 
 	WiFiUDP udp_;
 	WiFiServer tcp_;
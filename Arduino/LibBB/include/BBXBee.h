@@ -11,6 +11,8 @@
 #define DEFAULT_PAN     0x3332
 
 #define DEFAULT_BPS     9600
+
+#define DEFAULT_TDMA_SLOTS 8
 	
 namespace bb {
 
@@ -33,7 +35,7 @@ public:
 		DROID_HOLONOMOUS    = 4,
 		DROID_4LEG_WALKING  = 5,
 		DROID_2LEG_WALKING  = 6,
-		DROID_RESERVED      = 7
+		DROID_GROUP         = 7  // not a real droid - used for group IDs
 	};
 
 	enum RemoteType {
@@ -68,18 +70,32 @@ public:
 	static uint8_t stationIDFromId(uint16_t id) {
 		return id&0x7;
 	}
+	static uint16_t makeGroupID(uint8_t builderid, uint8_t groupid) {
+		return makeStationID(DROID_GROUP, builderid, groupid);
+	}
+	static bool isGroupID(uint16_t id) {
+		return stationTypeFromId(id) == STATION_DROID && droidTypeFromId(id) == DROID_GROUP;
+	}
+
+	// Derives a TDMA slot in 1..numSlots-1 from a station ID (slot 0 is the coordinator's beacon slot).
+	static uint8_t slotFromStationID(uint16_t id, uint8_t numSlots) {
+		if(numSlots < 2) return 0;
+		uint16_t h = id * 0x9e37;
+		h ^= h >> 7;
+		return 1 + (h % (numSlots-1));
+	}
 
 
 	virtual Result start(ConsoleStream *stream = NULL);
 	virtual Result stop(ConsoleStream *stream = NULL);
 	virtual Result step();
-	virtual Result parameterValue(const String& name, String& value);
-	virtual Result setParameterValue(const String& name, const String& value);
+	virtual Result parametersChanged(const uint8_t *indices, size_t num);
 	virtual Result initialize(uint8_t chan, uint16_t pan, uint16_t station, uint32_t bps, HardwareSerial *uart=&Serial1);
-	virtual Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
 
 	Result addPacketReceiver(PacketReceiver *receiver);
 	Result removePacketReceiver(PacketReceiver *receiver);
+	Result addFrameReceiver(FrameReceiver *receiver);
+	Result removeFrameReceiver(FrameReceiver *receiver);
 
 	void setChannel(uint8_t chan) { params_.chan = chan; }
 	void setPAN(uint16_t pan) { params_.pan = pan; }
@@ -108,8 +124,42 @@ public:
 
 	Result send(const String& str);
 	Result send(const uint8_t *bytes, size_t size);
+	// Transparent mode: Packet::SIZE bytes of packet, its CRC, and zero padding.
+	static const size_t TRANSPARENT_FRAME_SIZE = 12;
 	Result send(const Packet& packet);
 	Result sendTo(uint16_t dest, const Packet& packet, bool ack);
+
+	// Sends a raw frame of FrameReceiver::MIN_FRAME_SIZE..MAX_FRAME_SIZE bytes, bypassing TDMA queueing.
+	static const size_t MAX_FRAME_SIZE = 100;
+	Result sendFrameTo(uint16_t dest, const uint8_t *data, size_t length, bool ack);
+
+	// Beacon-synchronized slot scheduling (TDMA). The coordinator broadcasts a superframe beacon every
+	// numSlots runloop cycles. Once synced, every other station only transmits in the cycle belonging to
+	// its slot; packets sent outside of it are held back (control packets: latest one wins). Without a
+	// beacon for TDMA_SYNC_TIMEOUT_SUPERFRAMES superframes, stations fall back to sending immediately.
+	// If the queue of held back packets is full, the oldest one is dropped. A station that hears another
+	// one (other than the coordinator) in its own slot counts a collision and warns once.
+	// Slots are cycles of each station's own runloop, so neighbouring slots can overlap by up to a cycle;
+	// leaving every other slot free (tdma_slot 1, 3, 5, ...) avoids that. See extras/sim_tdma.cpp.
+	Result setTDMA(bool enabled, bool coordinator = false, uint8_t numSlots = DEFAULT_TDMA_SLOTS);
+	bool isTDMAEnabled() { return tdma_; }
+	bool isTDMACoordinator() { return tdmaCoordinator_; }
+	bool isTDMASynced();
+	uint8_t tdmaSlot();
+	bool isOwnSlot();
+	void printTDMAStatus(ConsoleStream *stream);
+	// Source of the packets the XBee sends on its own behalf (beacons). Default PACKET_SOURCE_DROID.
+	void setPacketSource(PacketSource source) { packetSource_ = source; }
+
+	// Group addressing. Packets sent to a group ID (see makeGroupID()) go out as one broadcast frame that
+	// carries the group ID; only stations that joined the group accept it. Control packets received via a
+	// group get this station's per-axis transform applied (mirror first, then offset) before dispatch.
+	Result joinGroup(uint16_t group);
+	Result leaveGroup(uint16_t group);
+	bool isInGroup(uint16_t group) { return groupMembership(group) != NULL; }
+	Result setGroupTransform(uint16_t group, uint8_t axis, float offset, bool mirror);
+	void printGroupStatus(ConsoleStream *stream);
+
 	bool available();
 	String receive();
 	Result receiveAndHandlePacket();
@@ -124,6 +174,16 @@ public:
 	void setDebugFlags(DebugFlags);
 
 protected:
+	Result handleSendCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleSendControlPacketCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleSendAPIPacketCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleContinuousCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleTDMACommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleGroupCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	Result handleAPIModeCommand(const ConsoleArgs& args, ConsoleStream *stream);
+	static const ConsoleCommand commandTable_[];
+	static const ParameterDescription parameterTable_[];
+
 	XBee();
 	virtual ~XBee();
 
@@ -144,9 +204,48 @@ protected:
 	XBeeParams params_;
 	ConfigStorage::HANDLE paramsHandle_;
 	std::vector<PacketReceiver*> receivers_;
+	std::vector<FrameReceiver*> frameReceivers_;
 
 	bool sendContinuous_;
 	int continuous_;
+
+	static const uint8_t TDMA_MAX_PENDING = 4;
+	static const uint8_t TDMA_SYNC_TIMEOUT_SUPERFRAMES = 4;
+	struct PendingPacket {
+		uint16_t dest;
+		bool ack;
+		Packet packet;
+	};
+	bool tdma_, tdmaCoordinator_;
+	int tdmaSlots_, tdmaSlotOverride_;
+	bool tdmaSynced_;
+	uint64_t tdmaBeaconCycle_;
+	uint8_t tdmaBeaconSeq_;
+	PendingPacket tdmaPending_[TDMA_MAX_PENDING];
+	uint8_t tdmaNumPending_;
+	unsigned long tdmaDeferred_, tdmaDropped_, tdmaMissedBeacons_, tdmaCollisions_;
+	uint16_t tdmaCoordinatorStation_;
+	bool tdmaCollisionWarned_;
+	PacketSource packetSource_;
+
+	static const uint8_t MAX_GROUPS = 4;
+	static const uint8_t GROUP_AXES = 5;
+	struct GroupMembership {
+		uint16_t group;
+		float offset[GROUP_AXES];
+		bool mirror[GROUP_AXES];
+	};
+	GroupMembership groups_[MAX_GROUPS];
+	uint8_t numGroups_;
+	unsigned long groupPacketsReceived_;
+
+	GroupMembership* groupMembership(uint16_t group);
+	void applyGroupTransform(const GroupMembership& membership, ControlPacket& control);
+
+	Result sendBeacon();
+	Result transmitTo(uint16_t dest, const Packet& packet, bool ack);
+	Result transmitFrameTo(uint16_t dest, const uint8_t *data, size_t length, bool ack);
+	Result flushPending();
 	uint8_t packetBuf_[255];
 	size_t packetBufPos_;
 
@@ -222,6 +321,7 @@ protected:
 
 	Result send(const APIFrame& frame);
 	Result receive(APIFrame& frame);
+	Result handleAPIFrame(const APIFrame& frame);
 };
 
 };
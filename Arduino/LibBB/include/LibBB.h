@@ -5,14 +5,32 @@
 // Written 2022-2023 by Björn Giesler <bjoern@giesler.de>
 
 #include "BBSubsystem.h"
+#include "BBParameter.h"
+#include "BBParameterTransaction.h"
 #include "BBXBee.h"
 #include "BBWifiServer.h"
 #include "BBConsole.h"
+#include "BBLineEditor.h"
+#include "BBLog.h"
 #include "BBRunloop.h"
 #include "BBConfigStorage.h"
+#include "BBFlashDevice.h"
+#include "BBFixedPoint.h"
+#include "BBStateSpace.h"
 #include "BBControllers.h"
+#include "BBCascadedController.h"
+#include "BBAutotuner.h"
+#include "BBCapture.h"
 #include "BBLowPassFilter.h"
+#include "BBBiquad.h"
+#include "BBMadgwick.h"
 #include "BBDCMotor.h"
+#include "BBDownlinkScheduler.h"
+#include "BBBulkTransfer.h"
+#include "BBTelemetry.h"
+#include "BBSchema.h"
+#include "BBTelemetryService.h"
+#include "BBCommandServer.h"
 #if defined(ARDUINO_ARCH_SAMD)
 #include "BBEncoder.h"
 #endif
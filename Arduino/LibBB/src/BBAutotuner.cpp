@@ -0,0 +1,270 @@
+#include <math.h>
+
+#include "BBAutotuner.h"
+#include "BBConsole.h"
+#include "BBParameterTransaction.h"
+
+bb::PIDAutotuner bb::PIDAutotuner::autotuner;
+
+const bb::PIDAutotuner::RuleFactors bb::PIDAutotuner::rules_[NUM_RULES] = {
+	{"zn_p",           0.5f,        0.0f,        0.0f},
+	{"zn_pi",          0.45f,       1.0f/1.2f,   0.0f},
+	{"zn_pid",         0.6f,        0.5f,        0.125f},
+	{"pessen",         0.7f,        0.4f,        0.15f},
+	{"some_overshoot", 0.33f,       0.5f,        1.0f/3.0f},
+	{"no_overshoot",   0.2f,        0.5f,        1.0f/3.0f},
+	{"tyreus_luyben",  1.0f/2.2f,   2.2f,        1.0f/6.3f}
+};
+
+const bb::ParameterDescription bb::PIDAutotuner::parameterTable_[] = {
+	BB_PARAM_FLOAT("offset", "Setpoint relative to the input at start", autotuner.offset_, INT_MIN, INT_MAX),
+	BB_PARAM_FLOAT("bias", "Output at the center of the relay", autotuner.bias_, INT_MIN, INT_MAX),
+	BB_PARAM_FLOAT("amplitude", "Relay amplitude around bias, in output units", autotuner.amplitude_, 0, INT_MAX),
+	BB_PARAM_FLOAT("hysteresis", "Relay hysteresis, in input units", autotuner.hysteresis_, 0, INT_MAX),
+	BB_PARAM_FLOAT("max_deviation", "Abort if the input gets further than this from the setpoint",
+		autotuner.maxDeviation_, 0, INT_MAX),
+	BB_PARAM_FLOAT("timeout", "Abort after this many seconds", autotuner.timeout_, 1, 600),
+	BB_PARAM_INT("cycles", "Number of limit cycle periods to average", autotuner.cycles_, 1, 20),
+	BB_PARAM_INT("rule", "0: ZN P, 1: ZN PI, 2: ZN PID, 3: Pessen, 4: some overshoot, 5: no overshoot, "
+		"6: Tyreus-Luyben", autotuner.rule_, 0, NUM_RULES-1),
+	BB_PARAM_BOOL("stage", "Stage the gains for review when done", autotuner.stage_)
+};
+
+const bb::ConsoleCommand bb::PIDAutotuner::commandTable_[] = {
+	{"stage", "|i", BB_CONSOLE_HANDLER(PIDAutotuner, handleStageCommand),
+		"stage [rule]: Stage the gains of the last experiment, according to rule or the rule parameter"}
+};
+
+bb::PIDAutotuner::PIDAutotuner() {
+	name_ = "autotune";
+	description_ = "Relay feedback PID autotuner";
+	help_ = "Runs a relay feedback experiment on the attached loop and proposes PID gains from it.\r\n" \
+	"\"start\" begins, \"stop\" aborts, \"status\" shows the result for every rule. Gains are staged for review\r\n" \
+	"(\"staged\", then \"commit\" or \"abort\").";
+
+	offset_ = 0;
+	bias_ = 0;
+	amplitude_ = 50;
+	hysteresis_ = 0;
+	maxDeviation_ = 1000;
+	timeout_ = 30;
+	cycles_ = 4;
+	rule_ = RULE_TYREUS_LUYBEN;
+	stage_ = true;
+
+	input_ = NULL;
+	output_ = NULL;
+	owner_ = NULL;
+	kpName_ = kiName_ = kdName_ = NULL;
+	abortPin_ = -1;
+
+	state_ = STATE_IDLE;
+	lastResult_ = RES_OK;
+	ku_ = tu_ = 0;
+
+	setCommands(commandTable_);
+	setParameters(parameterTable_);
+}
+
+void bb::PIDAutotuner::attach(ControlInput& input, ControlOutput& output, Subsystem *owner, const char *kp,
+	const char *ki, const char *kd) {
+	if(started_) abort();
+	input_ = &input;
+	output_ = &output;
+	owner_ = owner;
+	kpName_ = kp;
+	kiName_ = ki;
+	kdName_ = kd;
+}
+
+void bb::PIDAutotuner::setAbortButton(int pin) {
+	abortPin_ = pin;
+	if(pin >= 0) pinMode(pin, INPUT_PULLUP);
+}
+
+bb::Result bb::PIDAutotuner::start(ConsoleStream *stream) {
+	(void)stream;
+	if(input_ == NULL || output_ == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+	if(started_) return RES_SUBSYS_ALREADY_STARTED;
+
+	// The owner has updated the input this cycle. A second update in the same cycle would see no time pass.
+	float in = input_->present();
+	setpoint_ = in + offset_;
+	inputMin_ = inputMax_ = in;
+	high_ = in < setpoint_;
+	output_->set(high_ ? bias_ + amplitude_ : bias_ - amplitude_);
+
+	rises_ = periods_ = 0;
+	periodSum_ = amplitudeSum_ = 0;
+	periodMin_ = periodMax_ = 0;
+	ku_ = tu_ = 0;
+	startMS_ = millis();
+	lastRiseUS_ = micros();
+
+	state_ = STATE_RUNNING;
+	lastResult_ = RES_OK;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::PIDAutotuner::stop(ConsoleStream *stream) {
+	(void)stream;
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	abort();
+	return RES_OK;
+}
+
+void bb::PIDAutotuner::abort() {
+	if(state_ == STATE_RUNNING) finish(STATE_ABORTED, RES_OK);
+}
+
+bb::Result bb::PIDAutotuner::step() {
+	if(state_ != STATE_RUNNING) return RES_OK;
+
+	if(abortPin_ >= 0 && digitalRead(abortPin_) == LOW) {
+		finish(STATE_ABORTED, RES_OK);
+		return RES_OK;
+	}
+
+	input_->update();
+	float in = input_->present();
+	if(fabs(in - setpoint_) > maxDeviation_) {
+		finish(STATE_FAILED, RES_COMMON_OUT_OF_RANGE);
+		return RES_OK;
+	}
+	if(millis() - startMS_ > (unsigned long)(timeout_ * 1000)) {
+		finish(STATE_FAILED, RES_COMM_TIMEOUT);
+		return RES_OK;
+	}
+	if(in < inputMin_) inputMin_ = in;
+	if(in > inputMax_) inputMax_ = in;
+
+	if(high_ && in > setpoint_ + hysteresis_) {
+		high_ = false;
+	} else if(!high_ && in < setpoint_ - hysteresis_) {
+		// One period ends and the next begins with every switch to high. The first period is the relay pulling
+		// the loop into its limit cycle, so it isn't counted.
+		high_ = true;
+		unsigned long us = micros();
+		if(rises_ >= 2) {
+			float period = (us - lastRiseUS_) / 1e6f;
+			if(periods_ == 0 || period < periodMin_) periodMin_ = period;
+			if(periods_ == 0 || period > periodMax_) periodMax_ = period;
+			periodSum_ += period;
+			amplitudeSum_ += (inputMax_ - inputMin_) / 2;
+			periods_++;
+		}
+		rises_++;
+		lastRiseUS_ = us;
+		inputMin_ = inputMax_ = in;
+
+		if(periods_ >= cycles_) {
+			if(periodMax_ > 1.5f * periodMin_) {
+				// Not a steady limit cycle yet, try again until timeout
+				periods_ = 0;
+				periodSum_ = amplitudeSum_ = 0;
+			} else {
+				float a = amplitudeSum_ / periods_;
+				if(a <= hysteresis_) {
+					finish(STATE_FAILED, RES_CMD_FAILURE);
+					return RES_OK;
+				}
+				ku_ = 4 * amplitude_ / (float(M_PI) * sqrtf(a*a - hysteresis_*hysteresis_));
+				tu_ = periodSum_ / periods_;
+				finish(STATE_DONE, RES_OK);
+				return RES_OK;
+			}
+		}
+	}
+
+	output_->set(high_ ? bias_ + amplitude_ : bias_ - amplitude_);
+	return RES_OK;
+}
+
+void bb::PIDAutotuner::finish(State state, Result res) {
+	output_->set(bias_);
+	state_ = state;
+	lastResult_ = res;
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+
+	if(state == STATE_DONE) {
+		float kp, ki, kd;
+		gains(Rule(rule_), kp, ki, kd);
+		Console::console.printfBroadcast("Autotune done: Ku %f, Tu %fs; %s gains kp %f ki %f kd %f\n", ku_, tu_,
+			rules_[rule_].name, kp, ki, kd);
+		if(stage_ && owner_ != NULL) {
+			Result r = stageGains();
+			if(r == RES_OK) Console::console.printfBroadcast("Gains staged, \"commit\" to apply them\n");
+			else Console::console.printfBroadcast("Staging gains failed: %s\n", errorMessage(r));
+		}
+	} else if(state == STATE_ABORTED) {
+		Console::console.printfBroadcast("Autotune aborted\n");
+	} else {
+		Console::console.printfBroadcast("Autotune failed: %s\n", errorMessage(res));
+	}
+}
+
+bool bb::PIDAutotuner::gains(Rule rule, float& kp, float& ki, float& kd) {
+	if(ku_ <= 0 || tu_ <= 0 || rule < 0 || rule >= NUM_RULES) return false;
+	const RuleFactors& f = rules_[rule];
+	kp = f.kp * ku_;
+	ki = f.ti > 0 ? kp / (f.ti * tu_) : 0;
+	kd = kp * f.td * tu_;
+
+	float gain = input_ != NULL ? input_->controlGain() : 1.0f;
+	if(gain != 0) {
+		kp /= gain;
+		ki /= gain;
+		kd /= gain;
+	}
+	return true;
+}
+
+bb::Result bb::PIDAutotuner::stageGains(Rule rule) {
+	if(owner_ == NULL) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+	float values[3];
+	if(!gains(rule, values[0], values[1], values[2])) return RES_SUBSYS_NOT_OPERATIONAL;
+
+	const char *names[3] = {kpName_, kiName_, kdName_};
+	for(int i=0; i<3; i++) {
+		if(names[i] == NULL) continue;
+		int index = owner_->parameterIndex(names[i]);
+		if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+		ParameterValue v;
+		v.type = PARAMETER_FLOAT;
+		v.f = values[i];
+		Result res = ParameterTransaction::transaction.stage(owner_, index, v);
+		if(res != RES_OK) return res;
+	}
+	return RES_OK;
+}
+
+bb::Result bb::PIDAutotuner::handleStageCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	int rule = args.size() == 2 ? args[1].toInt() : rule_;
+	if(rule < 0 || rule >= NUM_RULES) return RES_CMD_INVALID_ARGUMENT;
+	return stageGains(Rule(rule));
+}
+
+void bb::PIDAutotuner::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	static const char *states[] = {"idle", "running", "done", "aborted", "failed"};
+	stream->printf("%s: %s", name(), states[state_]);
+	if(state_ == STATE_RUNNING) {
+		stream->printf(", setpoint %f, %d periods measured\n", setpoint_, periods_);
+		return;
+	}
+	if(state_ == STATE_FAILED) stream->printf(" (%s)", errorMessage(lastResult_));
+	if(ku_ <= 0) {
+		stream->printf("\n");
+		return;
+	}
+	stream->printf(", Ku %f, Tu %fs\n", ku_, tu_);
+	for(int i=0; i<NUM_RULES; i++) {
+		float kp, ki, kd;
+		gains(Rule(i), kp, ki, kd);
+		stream->printf("%c %d %-15s kp %f ki %f kd %f\n", i == rule_ ? '*' : ' ', i, rules_[i].name, kp, ki, kd);
+	}
+}
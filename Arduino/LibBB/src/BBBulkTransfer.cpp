@@ -0,0 +1,479 @@
+#include "BBBulkTransfer.h"
+#include "BBXBee.h"
+#include "BBConsole.h"
+
+bb::BulkTransfer bb::BulkTransfer::bulk;
+
+BB_CHECK_LAYOUT(BB_BULK_HEADER_FIELDS, "Bulk header");
+
+void bb::BulkHeader::encode(uint8_t buf[SIZE]) const {
+	const BulkHeader& obj = *this;
+	BB_BULK_HEADER_FIELDS(BB_ENCODE_FIELD)
+	buf += 8;
+	BB_BULK_HEADER_ARG_FIELDS(BB_ENCODE_FIELD)
+}
+
+void bb::BulkHeader::decode(const uint8_t buf[SIZE]) {
+	BulkHeader& obj = *this;
+	BB_BULK_HEADER_FIELDS(BB_DECODE_FIELD)
+	buf += 8;
+	BB_BULK_HEADER_ARG_FIELDS(BB_DECODE_FIELD)
+}
+
+const bb::ParameterDescription bb::BulkTransfer::parameterTable_[] = {
+	BB_PARAM_INT("window", "Sliding window size in chunks", bulk.window_, 1, MAX_WINDOW),
+	BB_PARAM_INT("rto", "Retransmission timeout in ms", bulk.rtoMS_, 10, 2000),
+	BB_PARAM_INT("timeout", "Abort transfer if nothing is heard from the peer for this many ms", bulk.timeoutMS_,
+		100, 60000),
+	BB_PARAM_INT("frames_per_step", "Maximum number of frames sent per runloop cycle", bulk.framesPerStep_, 1, 8),
+	BB_PARAM_FLOAT("budget", "Fraction of channel time bulk transfers may use", bulk.budget_, 0, 1)
+};
+
+const bb::ConsoleCommand bb::BulkTransfer::commandTable_[] = {
+	{"abort",     "",   BB_CONSOLE_HANDLER(BulkTransfer, handleAbortCommand),    "abort: Abort running transfers"},
+	{"send_test", "ii", BB_CONSOLE_HANDLER(BulkTransfer, handleSendTestCommand),
+		"send_test <dest> <size>: Send <size> bytes of test data to station <dest>"}
+};
+
+class XBeeBulkLink: public bb::BulkTransfer::Link {
+public:
+	virtual bb::Result sendFrame(uint16_t dest, const uint8_t *data, size_t length) {
+		return bb::XBee::xbee.sendFrameTo(dest, data, length, false);
+	}
+	virtual bool mayTransmit() {
+		bb::XBee& xbee = bb::XBee::xbee;
+		if(!xbee.isTDMAEnabled() || xbee.isTDMACoordinator() || !xbee.isTDMASynced()) return true;
+		return xbee.isOwnSlot();
+	}
+};
+
+static XBeeBulkLink xbeeLink;
+
+uint32_t bb::BulkTransfer::crc32(const uint8_t *data, size_t length, uint32_t crc) {
+	// Bitwise CRC32 (IEEE 802.3, reflected) - slower than a table but saves 1k of flash.
+	crc = ~crc;
+	while(length--) {
+		crc ^= *data++;
+		for(int i=0; i<8; i++) crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+	}
+	return ~crc;
+}
+
+bb::BulkTransfer::BulkTransfer():
+	scheduler_(0.5, DownlinkScheduler::frameAirtimeUS(MAX_FRAME_SIZE)) {
+	name_ = "bulk";
+	description_ = "Chunked bulk transfer over the packet link";
+	help_ = "Transfers objects larger than a packet with a sliding window and selective acknowledgement.\r\n";
+	setCommands(commandTable_);
+
+	link_ = NULL;
+	delegate_ = NULL;
+	window_ = 8;
+	rtoMS_ = 80;
+	timeoutMS_ = 2000;
+	framesPerStep_ = 2;
+	budget_ = 0.5;
+
+	txState_ = TX_IDLE;
+	txTransfer_ = 0;
+	rxActive_ = false;
+	rxNeedsAck_ = false;
+	rxDoneSource_ = 0;
+	rxDoneTransfer_ = 0;
+	rxDoneResult_ = RES_OK;
+
+	framesSent_ = 0;
+	retransmits_ = 0;
+	framesReceived_ = 0;
+	lastSize_ = 0;
+	lastDurationMS_ = 0;
+	lastResult_ = RES_OK;
+
+	scheduler_.addItem(1);
+	setParameters(parameterTable_);
+}
+
+bb::Result bb::BulkTransfer::initialize(Link *link) {
+	link_ = (link != NULL) ? link : &xbeeLink;
+	txTransfer_ = micros() & 0xff; // so a rebooted sender doesn't reuse the ID of the last transfer
+	XBee::xbee.addPacketReceiver(this);
+	XBee::xbee.addFrameReceiver(this);
+	return Subsystem::initialize();
+}
+
+bb::Result bb::BulkTransfer::start(ConsoleStream *stream) {
+	(void)stream;
+	if(link_ == NULL) return RES_SUBSYS_NOT_INITIALIZED;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::stop(ConsoleStream *stream) {
+	(void)stream;
+	abort();
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::step() {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	unsigned long now = millis();
+
+	if(rxActive_) {
+		if(now - rxLastHeardMS_ > (unsigned long)timeoutMS_) {
+			finishReceiving(RES_COMM_TIMEOUT, true);
+		} else {
+			if(rxUnacked_ > 0 && now - rxLastAckMS_ >= (unsigned long)rtoMS_/2) rxNeedsAck_ = true;
+			if(rxNeedsAck_) sendAck();
+		}
+	}
+
+	if(txState_ == TX_IDLE) return RES_OK;
+	if(now - txLastHeardMS_ > (unsigned long)timeoutMS_) {
+		finishSending(RES_COMM_TIMEOUT);
+		return RES_OK;
+	}
+	if(!link_->mayTransmit()) return RES_OK;
+
+	for(int i=0; i<framesPerStep_; i++) {
+		int chunk = -1;
+
+		if(txState_ == TX_OFFERING) {
+			if(now - txOfferMS_ < (unsigned long)rtoMS_) break;
+		} else {
+			// Retransmissions first, then new chunks as far as the window allows.
+			for(uint16_t c=txBase_; c<txNext_; c++) {
+				if(txAcked_ & (1UL << (c-txBase_))) continue;
+				if(now - txSentMS_[c % MAX_WINDOW] >= (unsigned long)rtoMS_) {
+					chunk = c;
+					break;
+				}
+			}
+			if(chunk < 0 && txNext_ < txCount_ && txNext_ - txBase_ < window_) chunk = txNext_;
+			// Everything acknowledged but no DONE yet - poke the receiver with the last chunk.
+			if(chunk < 0 && txBase_ >= txCount_ && now - txSentMS_[(txCount_-1) % MAX_WINDOW] >= (unsigned long)rtoMS_) {
+				chunk = txCount_-1;
+			}
+			if(chunk < 0) break;
+		}
+
+		if(scheduler_.schedule() < 0) break;
+
+		Result res = (txState_ == TX_OFFERING) ? sendOffer() : sendChunk(chunk);
+		if(res != RES_OK) break;
+		scheduler_.sent(0);
+
+		if(txState_ == TX_OFFERING) {
+			txOfferMS_ = now;
+		} else {
+			if(chunk == txNext_) txNext_++;
+			else retransmits_++;
+			txSentMS_[chunk % MAX_WINDOW] = now;
+		}
+	}
+
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::handleSendTestCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	long size = args[2].toInt();
+	if(size <= 0) return RES_CMD_INVALID_ARGUMENT;
+	return send(args[1].toInt(), TAG_TEST, NULL, size);
+}
+
+bb::Result bb::BulkTransfer::handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
+	return abort();
+}
+
+bb::Result bb::BulkTransfer::parameterChanged(const char *name) {
+	(void)name;
+	scheduler_.setBudget(budget_);
+	return RES_OK;
+}
+
+void bb::BulkTransfer::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+
+	stream->printf("%s: ", name());
+	if(txState_ != TX_IDLE) stream->printf("sending %lu bytes to 0x%x (%u of %u chunks acked)", txSize_, txDest_, txBase_, txCount_);
+	else stream->printf("not sending");
+	if(rxActive_) stream->printf(", receiving %lu bytes from 0x%x (%u of %u chunks)", rxSize_, rxSource_, rxBase_, rxCount_);
+	else stream->printf(", not receiving");
+	stream->printf(", %lu frames sent, %lu retransmits, %lu frames received", framesSent_, retransmits_, framesReceived_);
+	if(lastDurationMS_ > 0) {
+		stream->printf(", last transfer %lu bytes in %lums (%.0f bytes/s): %s", lastSize_, lastDurationMS_,
+			lastSize_ * 1000.0 / lastDurationMS_, errorMessage(lastResult_));
+	}
+	stream->printf("\n");
+}
+
+bb::Result bb::BulkTransfer::send(uint16_t dest, uint8_t tag, const uint8_t *data, uint32_t size) {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	if(txState_ != TX_IDLE) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	if(size == 0 || (size + CHUNK_SIZE - 1) / CHUNK_SIZE > 0xffff) return RES_PARAM_INVALID_VALUE;
+	if(data == NULL && tag != TAG_TEST) return RES_PARAM_INVALID_VALUE;
+
+	unsigned long now = millis();
+
+	txDest_ = dest;
+	txTag_ = tag;
+	txData_ = data;
+	txSize_ = size;
+	txCRC_ = (data != NULL) ? crc32(data, size) : 0;
+	txTransfer_++;
+	txCount_ = (size + CHUNK_SIZE - 1) / CHUNK_SIZE;
+	txBase_ = 0;
+	txNext_ = 0;
+	txAcked_ = 0;
+	txOfferMS_ = now - rtoMS_; // offer right away
+	txLastHeardMS_ = now;
+	txStartMS_ = now;
+	txState_ = TX_OFFERING;
+
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::abort() {
+	if(txState_ != TX_IDLE) {
+		sendControlFrame(txDest_, FRAME_ABORT, txTransfer_, 0, txCount_, RES_CMD_FAILURE);
+		finishSending(RES_CMD_FAILURE);
+	}
+	if(rxActive_) {
+		finishReceiving(RES_CMD_FAILURE, true);
+	}
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::incomingControlPacket(uint16_t station, PacketSource source, uint8_t rssi, const ControlPacket& packet) {
+	(void)station; (void)source; (void)rssi; (void)packet;
+	scheduler_.noteControlTraffic();
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::incomingFrame(uint16_t station, uint8_t rssi, const uint8_t *data, size_t length) {
+	(void)rssi;
+	if(length < BulkHeader::SIZE) return RES_PACKET_TOO_SHORT;
+
+	BulkHeader header;
+	header.decode(data);
+	if(header.magic != MAGIC) return RES_PACKET_INVALID_PACKET;
+	framesReceived_++;
+
+	const uint8_t *payload = data + BulkHeader::SIZE;
+	length -= BulkHeader::SIZE;
+
+	bool isTx = txState_ != TX_IDLE && station == txDest_ && header.transfer == txTransfer_;
+	bool isRx = rxActive_ && station == rxSource_ && header.transfer == rxTransfer_;
+
+	switch(header.type) {
+	case FRAME_OFFER:
+		handleOffer(station, header, payload, length);
+		break;
+	case FRAME_DATA:
+		handleData(station, header, payload, length);
+		break;
+	case FRAME_ACK:
+		if(isTx) handleAck(header);
+		break;
+	case FRAME_DONE:
+		if(isTx) finishSending(RES_OK);
+		break;
+	case FRAME_ABORT:
+		if(isTx) finishSending(header.arg != RES_OK ? (Result)header.arg : RES_CMD_FAILURE);
+		else if(isRx) finishReceiving(header.arg != RES_OK ? (Result)header.arg : RES_CMD_FAILURE, false);
+		break;
+	default:
+		return RES_PACKET_INVALID_PACKET;
+	}
+
+	return RES_OK;
+}
+
+bb::Result bb::BulkTransfer::sendControlFrame(uint16_t dest, FrameType type, uint8_t transfer, uint16_t seq, uint16_t count, uint32_t arg) {
+	uint8_t buf[BulkHeader::SIZE];
+	BulkHeader header = { MAGIC, (uint8_t)type, transfer, (uint8_t)window_, seq, count, arg };
+	header.encode(buf);
+	framesSent_++;
+	return link_->sendFrame(dest, buf, sizeof(buf));
+}
+
+bb::Result bb::BulkTransfer::sendOffer() {
+	uint8_t buf[BulkHeader::SIZE + 5];
+	BulkHeader header = { MAGIC, FRAME_OFFER, txTransfer_, (uint8_t)window_, 0, txCount_, txSize_ };
+
+	header.encode(buf);
+	BitField<0, 32>::set(buf + BulkHeader::SIZE, txCRC_);
+	buf[BulkHeader::SIZE + 4] = txTag_;
+
+	framesSent_++;
+	return link_->sendFrame(txDest_, buf, sizeof(buf));
+}
+
+bb::Result bb::BulkTransfer::sendChunk(uint16_t chunk) {
+	uint8_t buf[MAX_FRAME_SIZE];
+	BulkHeader header = { MAGIC, FRAME_DATA, txTransfer_, (uint8_t)window_, chunk, txCount_, 0 };
+	size_t length = chunkLength(txSize_, chunk);
+	uint32_t offset = (uint32_t)chunk * CHUNK_SIZE;
+
+	header.encode(buf);
+	if(txData_ != NULL) {
+		memcpy(buf + BulkHeader::SIZE, txData_ + offset, length);
+	} else {
+		for(size_t i=0; i<length; i++) buf[BulkHeader::SIZE + i] = (offset + i) & 0xff; // test pattern
+	}
+
+	framesSent_++;
+	return link_->sendFrame(txDest_, buf, BulkHeader::SIZE + length);
+}
+
+bb::Result bb::BulkTransfer::sendAck() {
+	rxNeedsAck_ = false;
+	rxUnacked_ = 0;
+	rxLastAckMS_ = millis();
+	return sendControlFrame(rxSource_, FRAME_ACK, rxTransfer_, rxBase_, rxCount_, rxReceived_);
+}
+
+size_t bb::BulkTransfer::chunkLength(uint32_t size, uint16_t chunk) {
+	uint32_t offset = (uint32_t)chunk * CHUNK_SIZE;
+	if(offset >= size) return 0;
+	return (size - offset < CHUNK_SIZE) ? size - offset : CHUNK_SIZE;
+}
+
+void bb::BulkTransfer::finishSending(Result res) {
+	txState_ = TX_IDLE;
+	lastSize_ = txSize_;
+	lastDurationMS_ = millis() - txStartMS_ + 1;
+	lastResult_ = res;
+	if(delegate_ != NULL) delegate_->bulkTransferSent(txDest_, txTag_, res);
+}
+
+void bb::BulkTransfer::finishReceiving(Result res, bool notifyPeer) {
+	if(notifyPeer) {
+		sendControlFrame(rxSource_, res == RES_OK ? FRAME_DONE : FRAME_ABORT, rxTransfer_, rxBase_, rxCount_, res);
+	}
+
+	rxActive_ = false;
+	rxDoneSource_ = rxSource_;
+	rxDoneTransfer_ = rxTransfer_;
+	rxDoneResult_ = res;
+
+	lastSize_ = rxSize_;
+	lastDurationMS_ = millis() - rxStartMS_ + 1;
+	lastResult_ = res;
+	if(delegate_ != NULL && rxTag_ != TAG_TEST) delegate_->bulkTransferReceived(rxSource_, rxTag_, rxBuffer_, rxSize_, res);
+}
+
+void bb::BulkTransfer::handleOffer(uint16_t source, const BulkHeader& header, const uint8_t *payload, size_t length) {
+	if(length < 5) return;
+
+	if(rxActive_) {
+		if(source == rxSource_ && header.transfer == rxTransfer_) {
+			rxNeedsAck_ = true; // our acceptance got lost
+		} else {
+			sendControlFrame(source, FRAME_ABORT, header.transfer, 0, header.count, RES_SUBSYS_RESOURCE_NOT_AVAILABLE);
+		}
+		return;
+	}
+
+	uint32_t size = header.arg;
+	if(size == 0 || header.count != (size + CHUNK_SIZE - 1) / CHUNK_SIZE) {
+		sendControlFrame(source, FRAME_ABORT, header.transfer, 0, header.count, RES_PACKET_INVALID_PACKET);
+		return;
+	}
+
+	uint8_t tag = payload[4];
+	uint8_t *buffer = (delegate_ != NULL && tag != TAG_TEST) ? delegate_->bulkTransferOffered(source, tag, size) : NULL;
+	if(buffer == NULL && tag != TAG_TEST) {
+		sendControlFrame(source, FRAME_ABORT, header.transfer, 0, header.count, RES_SUBSYS_RESOURCE_NOT_AVAILABLE);
+		return;
+	}
+
+	unsigned long now = millis();
+
+	rxActive_ = true;
+	rxSource_ = source;
+	rxTransfer_ = header.transfer;
+	rxTag_ = tag;
+	rxBuffer_ = buffer;
+	rxSize_ = size;
+	rxCRC_ = BitField<0, 32>::get(payload);
+	rxCount_ = header.count;
+	rxWindow_ = (header.window > 0) ? header.window : 1;
+	rxBase_ = 0;
+	rxReceived_ = 0;
+	rxUnacked_ = 0;
+	rxLastHeardMS_ = now;
+	rxStartMS_ = now;
+
+	sendAck(); // an ACK for chunk 0 tells the sender we've accepted
+}
+
+void bb::BulkTransfer::handleData(uint16_t source, const BulkHeader& header, const uint8_t *payload, size_t length) {
+	if(!rxActive_ || source != rxSource_ || header.transfer != rxTransfer_) {
+		// Sender is still waiting for the outcome of a transfer we have finished - repeat it.
+		if(source == rxDoneSource_ && header.transfer == rxDoneTransfer_) {
+			sendControlFrame(source, rxDoneResult_ == RES_OK ? FRAME_DONE : FRAME_ABORT, header.transfer, header.count, header.count, rxDoneResult_);
+		}
+		return;
+	}
+
+	rxLastHeardMS_ = millis();
+
+	uint16_t chunk = header.seq;
+	if(chunk >= rxCount_ || length != chunkLength(rxSize_, chunk)) return;
+
+	if(chunk < rxBase_) { // duplicate - our ACK got lost
+		rxNeedsAck_ = true;
+		return;
+	}
+
+	uint16_t offset = chunk - rxBase_;
+	if(offset > 32) return; // too far ahead to keep track of
+	if(offset > 0 && (rxReceived_ & (1UL << (offset-1)))) {
+		rxNeedsAck_ = true;
+		return;
+	}
+
+	if(rxBuffer_ != NULL) memcpy(rxBuffer_ + (uint32_t)chunk * CHUNK_SIZE, payload, length);
+
+	if(offset == 0) {
+		bool next;
+		do {
+			rxBase_++;
+			next = rxReceived_ & 1;
+			rxReceived_ >>= 1;
+		} while(next);
+	} else {
+		rxReceived_ |= 1UL << (offset-1);
+		rxNeedsAck_ = true; // gap - tell the sender right away
+	}
+
+	rxUnacked_++;
+	if(rxUnacked_ >= (rxWindow_+1)/2) rxNeedsAck_ = true;
+
+	if(rxBase_ >= rxCount_) {
+		Result res = RES_OK;
+		if(rxBuffer_ != NULL && crc32(rxBuffer_, rxSize_) != rxCRC_) res = RES_PACKET_INVALID_PACKET;
+		sendAck();
+		finishReceiving(res, true);
+	}
+}
+
+void bb::BulkTransfer::handleAck(const BulkHeader& header) {
+	txLastHeardMS_ = millis();
+	if(txState_ == TX_OFFERING) txState_ = TX_SENDING;
+
+	uint16_t seq = header.seq;
+	if(seq < txBase_ || seq > txCount_) return; // stale or bogus
+
+	uint16_t advance = seq - txBase_;
+	txAcked_ = (advance >= 32) ? 0 : (txAcked_ >> advance);
+	txBase_ = seq;
+	txAcked_ |= header.arg << 1; // bit i of the ACK bitmap is chunk seq+1+i
+	if(txNext_ < txBase_) txNext_ = txBase_;
+}
@@ -0,0 +1,263 @@
+#include <math.h>
+
+#include "BBCapture.h"
+#include "BBConsole.h"
+
+bb::Capture bb::Capture::capture;
+
+const bb::ParameterDescription bb::Capture::parameterTable_[] = {
+	BB_PARAM_INT("signal", "Excitation: 0: step, 1: chirp, 2: PRBS, 3: external", capture.signal_, 0, 3),
+	BB_PARAM_FLOAT("base", "Setpoint before the step, center of chirp and PRBS", capture.base_, INT_MIN, INT_MAX),
+	BB_PARAM_FLOAT("amplitude", "Step height, chirp and PRBS amplitude", capture.amplitude_, INT_MIN, INT_MAX),
+	BB_PARAM_FLOAT("pre", "Seconds recorded at base before the excitation starts", capture.pre_, 0, 60),
+	BB_PARAM_FLOAT("duration", "Seconds of excitation", capture.duration_, 0, 600),
+	BB_PARAM_FLOAT("f0", "Chirp start frequency in Hz", capture.f0_, 0, 1000),
+	BB_PARAM_FLOAT("f1", "Chirp end frequency in Hz", capture.f1_, 0, 1000),
+	BB_PARAM_INT("bit_ms", "PRBS bit length in ms", capture.bitMS_, 1, 10000),
+	BB_PARAM_INT("decimation", "Record every n-th cycle", capture.decimation_, 1, 1000)
+};
+
+const bb::ConsoleCommand bb::Capture::commandTable_[] = {
+	{"record", "", BB_CONSOLE_HANDLER(Capture, handleRecordCommand), "record: Start a recording with the configured excitation"},
+	{"dump",   "|si", BB_CONSOLE_HANDLER(Capture, handleDumpCommand),
+		"dump [<ip> <port>]: Write the recording to this console as CSV, or send it to <ip>:<port> via UDP"},
+	{"abort",  "", BB_CONSOLE_HANDLER(Capture, handleAbortCommand), "abort: Abort recording and dumping"}
+};
+
+bb::Capture::Capture() {
+	name_ = "capture";
+	description_ = "Control loop capture for system identification";
+	help_ = "Records setpoint, input, output and error of a control loop at full rate into RAM, with step, chirp or\r\n" \
+	"PRBS excitation, for dumping afterwards. See extras/fit_response.py for the analysis.\r\n";
+
+	signal_ = SIGNAL_STEP;
+	base_ = 0;
+	amplitude_ = 100;
+	pre_ = 0.2;
+	duration_ = 2;
+	f0_ = 0.5;
+	f1_ = 20;
+	bitMS_ = 20;
+	decimation_ = 1;
+
+	buffer_ = NULL;
+	size_ = numSamples_ = 0;
+	recording_ = false;
+	dumping_ = false;
+	dumpStream_ = NULL;
+
+	setCommands(commandTable_);
+	setParameters(parameterTable_);
+}
+
+bb::Result bb::Capture::initialize(CaptureSample *buffer, size_t size) {
+	buffer_ = buffer;
+	// Datagrams carry sample indices in 16 bits
+	size_ = size > 65535 ? 65535 : size;
+	numSamples_ = 0;
+	return Subsystem::initialize();
+}
+
+bb::Result bb::Capture::start(ConsoleStream *stream) {
+	(void)stream;
+	if(buffer_ == NULL || size_ == 0) return RES_SUBSYS_NOT_INITIALIZED;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::Capture::stop(ConsoleStream *stream) {
+	(void)stream;
+	stopRecording();
+	stopDump();
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+	return RES_OK;
+}
+
+bb::Result bb::Capture::step() {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+
+	// Ends the recording even if the owner has stopped calling record()
+	if(recording_ && micros() - startUS_ >= endUS_) stopRecording();
+
+	if(dumping_) {
+		if(dumpUDP_) dumpToUDP();
+		else dumpToStream();
+	}
+	return RES_OK;
+}
+
+bb::Result bb::Capture::startRecording() {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	stopDump();
+	numSamples_ = 0;
+	skip_ = 0;
+	lfsr_ = 0xace1;
+	lfsrBit_ = 0;
+	endUS_ = (unsigned long)((pre_ + duration_) * 1e6f);
+	startUS_ = micros();
+	recording_ = true;
+	return RES_OK;
+}
+
+void bb::Capture::stopRecording() {
+	recording_ = false;
+}
+
+float bb::Capture::setpoint() {
+	if(!recording_) return base_;
+	float t = (micros() - startUS_) / 1e6f - pre_;
+	if(t < 0 || t >= duration_) return base_;
+
+	switch(signal_) {
+	case SIGNAL_STEP:
+		return base_ + amplitude_;
+
+	case SIGNAL_CHIRP: {
+		// Phase is the integral of the frequency, f0 + (f1-f0) t/duration
+		float phase = 2 * float(M_PI) * (f0_ * t + (f1_ - f0_) * t * t / (2 * duration_));
+		return base_ + amplitude_ * sinf(phase);
+	}
+
+	case SIGNAL_PRBS: {
+		// 16 bit Galois LFSR, maximum length (65535 bits), advanced once per bit_ms
+		unsigned long bit = (unsigned long)(t * 1000) / bitMS_;
+		while(lfsrBit_ < bit) {
+			lfsr_ = (lfsr_ >> 1) ^ ((0 - (lfsr_ & 1)) & 0xb400);
+			lfsrBit_++;
+		}
+		return (lfsr_ & 1) ? base_ + amplitude_ : base_ - amplitude_;
+	}
+
+	default:
+		return base_;
+	}
+}
+
+void bb::Capture::record(float setpoint, float input, float output) {
+	if(!recording_) return;
+	if(++skip_ < decimation_) return;
+	skip_ = 0;
+
+	unsigned long us = micros() - startUS_;
+	if(us >= endUS_) {
+		recording_ = false;
+		return;
+	}
+
+	CaptureSample& s = buffer_[numSamples_++];
+	s.us = us;
+	s.setpoint = setpoint;
+	s.input = input;
+	s.output = output;
+	s.error = setpoint - input;
+
+	if(numSamples_ >= size_) recording_ = false;
+}
+
+bb::Result bb::Capture::startDump(ConsoleStream *stream) {
+	if(stream == NULL) return RES_CMD_INVALID_ARGUMENT;
+	if(recording_) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	dumpStream_ = stream;
+	dumpUDP_ = false;
+	dumpHeader_ = true;
+	dumpIndex_ = 0;
+	dumping_ = true;
+	return RES_OK;
+}
+
+bb::Result bb::Capture::startDump(const IPAddress& addr, uint16_t port) {
+	if(recording_) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	if(!WifiServer::server.isStarted()) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+	dumpAddr_ = addr;
+	dumpPort_ = port;
+	dumpUDP_ = true;
+	dumpIndex_ = 0;
+	dumping_ = true;
+	return RES_OK;
+}
+
+void bb::Capture::dumpToStream() {
+	// As many lines as fit into the console buffer without dropping, the rest in the next cycles
+	static const size_t MAX_LINE = 96;
+	if(dumpHeader_) {
+		// Here rather than in startDump(), so that it comes after the console's reply to "dump"
+		static const char *signals[] = {"step", "chirp", "prbs", "external"};
+		dumpStream_->printf("# capture: %s, %lu samples\n", signals[signal_], (unsigned long)numSamples_);
+		dumpStream_->printf("us,setpoint,input,output,error\n");
+		dumpHeader_ = false;
+	}
+	while(dumpIndex_ < numSamples_ && dumpStream_->outputSpace() >= MAX_LINE) {
+		const CaptureSample& s = buffer_[dumpIndex_++];
+		dumpStream_->printf("%lu,%f,%f,%f,%f\n", (unsigned long)s.us, s.setpoint, s.input, s.output, s.error);
+	}
+	if(dumpIndex_ >= numSamples_ && dumpStream_->outputSpace() >= MAX_LINE) {
+		dumpStream_->printf("# end\n");
+		dumping_ = false;
+	}
+}
+
+void bb::Capture::dumpToUDP() {
+	uint8_t buf[DATAGRAM_HEADER_SIZE + SAMPLES_PER_DATAGRAM * SAMPLE_SIZE];
+	for(unsigned int i=0; i<MAX_DATAGRAMS_PER_STEP && dumpIndex_ < numSamples_; i++) {
+		size_t n = numSamples_ - dumpIndex_;
+		if(n > SAMPLES_PER_DATAGRAM) n = SAMPLES_PER_DATAGRAM;
+		buf[0] = MAGIC;
+		buf[1] = n;
+		buf[2] = dumpIndex_ & 0xff;
+		buf[3] = (dumpIndex_ >> 8) & 0xff;
+		buf[4] = numSamples_ & 0xff;
+		buf[5] = (numSamples_ >> 8) & 0xff;
+		uint8_t *p = buf + DATAGRAM_HEADER_SIZE;
+		for(size_t j=0; j<n; j++) {
+			const CaptureSample& s = buffer_[dumpIndex_ + j];
+			memcpy(p, &s.us, 4);
+			memcpy(p+4, &s.setpoint, 4);
+			memcpy(p+8, &s.input, 4);
+			memcpy(p+12, &s.output, 4);
+			memcpy(p+16, &s.error, 4);
+			p += SAMPLE_SIZE;
+		}
+		if(!WifiServer::server.sendUDPPacket(dumpAddr_, dumpPort_, buf, p - buf)) {
+			dumping_ = false;
+			return;
+		}
+		dumpIndex_ += n;
+	}
+	if(dumpIndex_ >= numSamples_) dumping_ = false;
+}
+
+bb::Result bb::Capture::handleRecordCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
+	return startRecording();
+}
+
+bb::Result bb::Capture::handleDumpCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	if(args.size() == 1) return startDump(stream);
+	if(args.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
+	IPAddress addr;
+	if(!addr.fromString(args[1].c_str())) return RES_CMD_INVALID_ARGUMENT;
+	long port = args[2].toInt();
+	if(port <= 0 || port > 0xffff) return RES_CMD_INVALID_ARGUMENT;
+	return startDump(addr, port);
+}
+
+bb::Result bb::Capture::handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
+	stopRecording();
+	stopDump();
+	return RES_OK;
+}
+
+void bb::Capture::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	stream->printf("%s: ", name());
+	if(recording_) stream->printf("recording, %lu of %lu samples", (unsigned long)numSamples_, (unsigned long)size_);
+	else stream->printf("%lu of %lu samples recorded", (unsigned long)numSamples_, (unsigned long)size_);
+	if(dumping_) stream->printf(", dumping (%lu sent)", (unsigned long)dumpIndex_);
+	stream->printf("\n");
+}
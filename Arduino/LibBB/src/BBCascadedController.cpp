@@ -0,0 +1,147 @@
+#include <BBCascadedController.h>
+
+bb::DecimatingControlInput::DecimatingControlInput(ControlInput& input): input_(input) {
+	reset();
+}
+
+void bb::DecimatingControlInput::sample() {
+	input_.update();
+	sum_ += input_.present();
+	num_++;
+}
+
+void bb::DecimatingControlInput::reset() {
+	sum_ = 0;
+	num_ = 0;
+	average_ = input_.present();
+}
+
+bb::Result bb::DecimatingControlInput::update() {
+	if(num_ == 0) return RES_OK; // nothing sampled, keep the last average
+	average_ = sum_ / num_;
+	sum_ = 0;
+	num_ = 0;
+	return RES_OK;
+}
+
+bb::CascadedController::CascadedController(ControlInput& input, ControlOutput& output) {
+	loops_[0].input = NULL;
+	loops_[0].ramp = NULL;
+	loops_[0].controller = new PIDController(input, output);
+	loops_[0].divider = 1;
+	loops_[0].count = 0;
+	loops_[0].maxStep = 0;
+	setLoopGoal(loops_[0], loops_[0].controller->goal());
+	numLoops_ = 1;
+	outermost_ = 0;
+}
+
+bb::CascadedController::~CascadedController() {
+	// outside in, every controller references the one inside it
+	for(int i=numLoops_-1; i>=0; i--) {
+		delete loops_[i].controller;
+		delete loops_[i].ramp;
+		delete loops_[i].input;
+	}
+}
+
+int bb::CascadedController::addOuterLoop(ControlInput& input, unsigned int divider) {
+	if(numLoops_ >= MAX_LOOPS) return -1;
+	Loop& loop = loops_[numLoops_];
+	loop.input = new DecimatingControlInput(input);
+	loop.ramp = new GoalRamp(*loops_[numLoops_-1].controller);
+	loop.controller = new PIDController(*loop.input, *loop.ramp);
+	loop.divider = divider > 0 ? divider : 1;
+	loop.maxStep = 0;
+	resetLoop(numLoops_);
+	outermost_ = numLoops_;
+	return numLoops_++;
+}
+
+void bb::CascadedController::setOutermostLoop(int i) {
+	if(i < 0 || i >= numLoops_) return;
+	for(int j=outermost_+1; j<=i; j++) resetLoop(j);
+	// A loop that becomes the outermost one keeps the goal it was last given from outside
+	if(i < outermost_) setLoopGoal(loops_[i], loops_[i].controller->goal());
+	outermost_ = i;
+}
+
+void bb::CascadedController::setGoal(float goal) {
+	Loop& loop = loops_[outermost_];
+	if(loop.maxStep > 0) loop.target = goal;
+	else setLoopGoal(loop, goal);
+}
+
+void bb::CascadedController::setGoalRamp(int i, float maxStep) {
+	if(i < 0 || i >= numLoops_) return;
+	loops_[i].maxStep = maxStep;
+}
+
+void bb::CascadedController::update() {
+	Loop& outer = loops_[outermost_];
+	if(outer.goal != outer.target) {
+		float diff = outer.target - outer.goal;
+		if(outer.maxStep > 0 && diff > outer.maxStep) outer.goal += outer.maxStep;
+		else if(outer.maxStep > 0 && diff < -outer.maxStep) outer.goal -= outer.maxStep;
+		else outer.goal = outer.target;
+		outer.controller->setGoal(outer.goal);
+	}
+
+	for(int i=1; i<=outermost_; i++) loops_[i].input->sample();
+
+	// Outside in, so that every loop runs on the goal set in the same cycle
+	for(int i=outermost_; i>0; i--) {
+		Loop& loop = loops_[i];
+		if(++loop.count >= loop.divider) {
+			loop.count = 0;
+			loop.controller->update();
+		}
+		loop.ramp->step();
+	}
+	loops_[0].controller->update();
+}
+
+void bb::CascadedController::reset() {
+	for(int i=0; i<numLoops_; i++) {
+		loops_[i].controller->reset();
+		if(loops_[i].input != NULL) loops_[i].input->reset();
+		if(loops_[i].ramp != NULL) loops_[i].ramp->reset(loops_[i].divider);
+		loops_[i].count = loops_[i].divider - 1; // run on the next update()
+	}
+}
+
+// Starts loop i over on its present input, so that it holds where it is.
+void bb::CascadedController::resetLoop(int i) {
+	Loop& loop = loops_[i];
+	if(loop.input != NULL) loop.input->reset();
+	if(loop.ramp != NULL) loop.ramp->reset(loop.divider);
+	loop.controller->reset();
+	setLoopGoal(loop, loop.controller->present());
+	loop.count = loop.divider - 1; // run on the next update()
+}
+
+void bb::CascadedController::setLoopGoal(Loop& loop, float goal) {
+	loop.goal = loop.target = goal;
+	loop.controller->setGoal(goal);
+}
+
+void bb::CascadedController::GoalRamp::reset(unsigned int steps) {
+	goal_ = inner_.goal();
+	increment_ = 0;
+	steps_ = steps;
+	remaining_ = 0;
+}
+
+void bb::CascadedController::GoalRamp::step() {
+	if(remaining_ == 0) return;
+	goal_ += increment_;
+	if(--remaining_ == 0) goal_ = target_;
+	inner_.setGoal(goal_);
+}
+
+bb::Result bb::CascadedController::GoalRamp::set(float value) {
+	target_ = value;
+	increment_ = (value - goal_) / steps_;
+	remaining_ = steps_;
+	return RES_OK;
+}
@@ -0,0 +1,359 @@
+#include "BBCommandServer.h"
+#include "BBWifiServer.h"
+#include "BBSchema.h"
+#include "BBLog.h"
+
+bb::CommandServer bb::CommandServer::server;
+
+const bb::ParameterDescription bb::CommandServer::parameterTable_[] = {
+	BB_PARAM_INT("port", "UDP port to listen on", server.port_, 1, 65535),
+	BB_PARAM_INT("requests_per_step", "Maximum number of requests handled per runloop cycle", server.maxRequestsPerStep_,
+		1, 16)
+};
+
+// Reads and writes the argument/result encoding, see BBCommandServer.h. All reads are bounds checked; once a read
+// fails, ok() stays false.
+class CommandReader {
+public:
+	CommandReader(const uint8_t *buf, size_t len): buf_(buf), len_(len), pos_(0), ok_(true) {}
+	bool ok() { return ok_; }
+	uint8_t u8() {
+		if(pos_ + 1 > len_) { ok_ = false; return 0; }
+		return buf_[pos_++];
+	}
+	uint32_t u32() {
+		if(pos_ + 4 > len_) { ok_ = false; return 0; }
+		uint32_t v = buf_[pos_] | (buf_[pos_+1] << 8) | ((uint32_t)buf_[pos_+2] << 16) | ((uint32_t)buf_[pos_+3] << 24);
+		pos_ += 4;
+		return v;
+	}
+	String str() {
+		size_t n = u8();
+		if(!ok_ || pos_ + n > len_) { ok_ = false; return String(); }
+		String s;
+		s.reserve(n);
+		for(size_t i=0; i<n; i++) s += (char)buf_[pos_+i];
+		pos_ += n;
+		return s;
+	}
+	// A type byte and the value. Strings are read into str, which value then points to. Returns false on an
+	// unknown type, too, with ok() still true.
+	bool value(bb::ParameterValue& v, String& str) {
+		uint8_t type = u8();
+		switch(type) {
+		case bb::PARAMETER_INT:
+			v.i = (int32_t)u32();
+			break;
+		case bb::PARAMETER_FLOAT: {
+			uint32_t u = u32();
+			memcpy(&v.f, &u, sizeof(v.f));
+			break;
+		}
+		case bb::PARAMETER_BOOL:
+			v.b = u8() != 0;
+			break;
+		case bb::PARAMETER_STRING:
+			str = this->str();
+			v.s = str.c_str();
+			break;
+		default:
+			return false;
+		}
+		v.type = (bb::ParameterType)type;
+		return ok_;
+	}
+protected:
+	const uint8_t *buf_;
+	size_t len_, pos_;
+	bool ok_;
+};
+
+class CommandWriter {
+public:
+	CommandWriter(uint8_t *buf, size_t maxlen): buf_(buf), maxlen_(maxlen), len_(0) {}
+	size_t length() { return len_; }
+	size_t space() { return maxlen_ - len_; }
+	uint8_t* end() { return buf_ + len_; }
+	void advance(size_t n) { len_ += n; }
+	bool u8(uint8_t v) {
+		if(len_ + 1 > maxlen_) return false;
+		buf_[len_++] = v;
+		return true;
+	}
+	bool u32(uint32_t v) {
+		if(len_ + 4 > maxlen_) return false;
+		for(int i=0; i<4; i++) buf_[len_++] = (v >> (8*i)) & 0xff;
+		return true;
+	}
+	bool str(const String& s) {
+		if(s.length() > 255 || len_ + 1 + s.length() > maxlen_) return false;
+		buf_[len_++] = s.length();
+		memcpy(buf_ + len_, s.c_str(), s.length());
+		len_ += s.length();
+		return true;
+	}
+protected:
+	uint8_t *buf_;
+	size_t maxlen_, len_;
+};
+
+bb::CommandServer::CommandServer() {
+	name_ = "command";
+	description_ = "Binary UDP command server";
+	help_ = "Answers binary parameter get/set, start/stop and status requests on a UDP port. See BBCommandServer.h\r\n" \
+	"for the protocol and DroidGUI/CommandClient.py for a client.";
+
+	port_ = DEFAULT_COMMAND_PORT;
+	maxRequestsPerStep_ = 4;
+	requests_ = errors_ = 0;
+	setParameters(parameterTable_);
+}
+
+bb::Result bb::CommandServer::initialize(uint16_t port) {
+	port_ = port;
+	return Subsystem::initialize();
+}
+
+bb::Result bb::CommandServer::start(ConsoleStream *stream) {
+	(void)stream;
+	if(!WifiServer::server.isStarted()) return RES_SUBSYS_HW_DEPENDENCY_MISSING;
+	if(udp_.begin(port_) == 0) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::CommandServer::stop(ConsoleStream *stream) {
+	(void)stream;
+	udp_.stop();
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+	return RES_OK;
+}
+
+bb::Result bb::CommandServer::step() {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+
+	uint8_t request[MAX_DATAGRAM_SIZE], response[MAX_DATAGRAM_SIZE];
+	for(int i=0; i<maxRequestsPerStep_; i++) {
+		int len = udp_.parsePacket();
+		if(len <= 0) break;
+		if(len > (int)sizeof(request)) continue; // dropped by the next parsePacket()
+		if(udp_.read(request, len) != len) continue;
+
+		size_t responseLen = handleRequest(request, len, response);
+		if(responseLen == 0) continue;
+		// Reply from our own socket so that the response comes from the port the request went to.
+		if(udp_.beginPacket(udp_.remoteIP(), udp_.remotePort()) == 0) continue;
+		udp_.write(response, responseLen);
+		udp_.endPacket();
+	}
+
+	return RES_OK;
+}
+
+bb::Result bb::CommandServer::parameterChanged(const char *name) {
+	if(!strcmp(name, "port") && started_) {
+		udp_.stop();
+		udp_.begin(port_);
+	}
+	return RES_OK;
+}
+
+void bb::CommandServer::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	stream->printf("%s: %s on port %d, %lu requests, %lu failed\n", name(), started_ ? "listening" : "not started", port_,
+		requests_, errors_);
+}
+
+size_t bb::CommandServer::handleRequest(const uint8_t *request, size_t len, uint8_t *response) {
+	if(len < HEADER_SIZE || request[0] != MAGIC || (request[3] & RESPONSE_FLAG)) return 0;
+	requests_++;
+
+	response[0] = MAGIC;
+	response[1] = request[1];
+	response[2] = request[2];
+	response[3] = request[3] | RESPONSE_FLAG;
+
+	size_t resultsLen = 0;
+	Result res = execute(request[3], request + HEADER_SIZE, len - HEADER_SIZE, response + HEADER_SIZE + 1, resultsLen);
+	if(res != RES_OK) {
+		errors_++;
+		resultsLen = 0;
+	}
+	response[HEADER_SIZE] = res;
+
+	return HEADER_SIZE + 1 + resultsLen;
+}
+
+bb::Result bb::CommandServer::execute(uint8_t opcode, const uint8_t *args, size_t argsLen, uint8_t *results, size_t& resultsLen) {
+	CommandReader in(args, argsLen);
+	CommandWriter out(results, MAX_DATAGRAM_SIZE - HEADER_SIZE - 1);
+	Result res = RES_OK;
+
+	switch(opcode) {
+	case OP_PING:
+		break;
+
+	case OP_LIST_SUBSYSTEMS: {
+		uint8_t first = in.u8();
+		if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		const std::vector<Subsystem*>& subsys = SubsystemManager::manager.subsystems();
+		uint8_t count = 0;
+		out.u8(0);
+		for(size_t i=first; i<subsys.size(); i++) {
+			if(!out.str(subsys[i]->name())) break;
+			count++;
+		}
+		results[0] = count;
+		break;
+	}
+
+	case OP_GET_SCHEMA: {
+		size_t offset = in.u8();
+		offset |= in.u8() << 8;
+		if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		if(offset > Schema::size()) return RES_COMMON_OUT_OF_RANGE;
+		out.u8(Schema::id() & 0xff);
+		out.u8(Schema::id() >> 8);
+		out.u8(Schema::size() & 0xff);
+		out.u8(Schema::size() >> 8);
+		out.advance(Schema::read(offset, out.end(), out.space()));
+		break;
+	}
+
+	case OP_GET_LOG: {
+		uint32_t offset = in.u32();
+		if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		out.u32(0);
+		out.u32(Log::log.endOffset());
+		out.advance(Log::log.read(offset, out.end(), out.space()));
+		for(int i=0; i<4; i++) results[i] = (offset >> (8*i)) & 0xff;
+		break;
+	}
+
+	case OP_COMMIT_PARAMETERS: {
+		uint16_t id = 0;
+		res = ParameterTransaction::transaction.commit(id);
+		out.u8(id & 0xff);
+		out.u8(id >> 8);
+		break;
+	}
+
+	case OP_COMMIT_STATUS: {
+		ParameterTransaction& transaction = ParameterTransaction::transaction;
+		out.u8(transaction.lastAppliedID() & 0xff);
+		out.u8(transaction.lastAppliedID() >> 8);
+		out.u8(transaction.lastResult());
+		break;
+	}
+
+	case OP_ABORT_PARAMETERS:
+		res = ParameterTransaction::transaction.abort();
+		break;
+
+	case OP_GET_PARAMETER:
+	case OP_SET_PARAMETER:
+	case OP_START:
+	case OP_STOP:
+	case OP_STATUS:
+	case OP_LIST_PARAMETERS:
+	case OP_STAGE_PARAMETER: {
+		String subsysName = in.str();
+		if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		Subsystem *subsys = SubsystemManager::manager.subsystemWithName(subsysName);
+		if(subsys == NULL) return RES_SUBSYS_NO_SUCH_SUBSYS;
+
+		switch(opcode) {
+		case OP_GET_PARAMETER: {
+			String name = in.str();
+			if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+			int index = subsys->parameterIndex(name.c_str());
+			if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+			ParameterType type = subsys->parameter(index)->type;
+			out.u8(type);
+			switch(type) {
+			case PARAMETER_INT: {
+				int v = 0;
+				subsys->getParameter(index, v);
+				out.u32((uint32_t)v);
+				break;
+			}
+			case PARAMETER_FLOAT: {
+				float f = 0;
+				subsys->getParameter(index, f);
+				uint32_t u;
+				memcpy(&u, &f, sizeof(u));
+				out.u32(u);
+				break;
+			}
+			case PARAMETER_BOOL: {
+				bool v = false;
+				subsys->getParameter(index, v);
+				out.u8(v);
+				break;
+			}
+			default: {
+				const char *v = "";
+				subsys->getParameter(index, v);
+				if(!out.str(v)) return RES_PACKET_TOO_LONG;
+				break;
+			}
+			}
+			break;
+		}
+
+		case OP_SET_PARAMETER:
+		case OP_STAGE_PARAMETER: {
+			// Typed setters check range and call parametersChanged(), same as a "set" from the console.
+			String name = in.str(), str;
+			ParameterValue value;
+			if(!in.value(value, str)) return in.ok() ? RES_PARAM_INVALID_TYPE : RES_CMD_INVALID_ARGUMENT_COUNT;
+			int index = subsys->parameterIndex(name.c_str());
+			if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+			if(opcode == OP_SET_PARAMETER) res = subsys->setParameter(index, value);
+			else res = ParameterTransaction::transaction.stage(subsys, index, value);
+			break;
+		}
+
+		case OP_START:
+			res = subsys->start(NULL);
+			break;
+
+		case OP_STOP:
+			res = subsys->stop(NULL);
+			break;
+
+		case OP_STATUS:
+			out.u8(subsys->isStarted());
+			out.u8(subsys->operationStatus());
+			break;
+
+		case OP_LIST_PARAMETERS: {
+			uint8_t first = in.u8();
+			if(!in.ok()) return RES_CMD_INVALID_ARGUMENT_COUNT;
+			uint8_t count = 0;
+			out.u8(0);
+			for(size_t i=first; i<subsys->numParameters(); i++) {
+				const ParameterDescription *p = subsys->parameter(i);
+				if(out.space() < strlen(p->name) + 2 || !out.str(p->name)) break;
+				out.u8(p->type);
+				count++;
+			}
+			results[0] = count;
+			break;
+		}
+
+		default:
+			return RES_CMD_UNKNOWN_COMMAND;
+		}
+		break;
+	}
+
+	default:
+		return RES_CMD_UNKNOWN_COMMAND;
+	}
+
+	resultsLen = out.length();
+	return res;
+}
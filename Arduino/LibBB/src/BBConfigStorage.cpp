@@ -1,100 +1,510 @@
 #include "BBConfigStorage.h"
+#include "BBBulkTransfer.h"
+#include "BBConsole.h"
+#include "BBRunloop.h"
+#include "BBSubsystem.h"
 
-#if defined(ARDUINO_ARCH_RP2040)
-#include <EEPROM.h>
-static const size_t MAXSIZE=1024;
-#elif defined(ARDUINO_ARCH_SAMD)
-#include <FlashAsEEPROM.h>
-static const size_t MAXSIZE=EEPROM_EMULATION_SIZE;
-#else
-#error Unsupported architecture
-#endif
-
+static_assert((CONFIG_MAX_BLOCKS & (CONFIG_MAX_BLOCKS - 1)) == 0, "CONFIG_MAX_BLOCKS must be a power of two");
 
 bb::ConfigStorage bb::ConfigStorage::storage;
 
-bb::ConfigStorage::HANDLE bb::ConfigStorage::reserveBlock(size_t size) {
-	if(!initialized_) {
-		Serial.println("Not initialized, returning 0.");
-		return 0;
+static void put16(uint8_t *buf, uint16_t v) {
+	buf[0] = v & 0xff;
+	buf[1] = v >> 8;
+}
+
+static void put32(uint8_t *buf, uint32_t v) {
+	for(int i=0; i<4; i++) buf[i] = (v >> (8*i)) & 0xff;
+}
+
+static uint16_t get16(const uint8_t *buf) {
+	return buf[0] | (buf[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *buf) {
+	return buf[0] | (buf[1] << 8) | ((uint32_t)buf[2] << 16) | ((uint32_t)buf[3] << 24);
+}
+
+bb::ConfigStorage::ConfigStorage() {
+	initialized_ = false;
+	device_ = NULL;
+	pageSize_ = 0;
+	record_ = NULL;
+	appending_ = false;
+	compactPage_ = -1;
+	compactions_ = 0;
+	full_ = false;
+	head_ = -1;
+	legacy_ = NULL;
+	legacySize_ = legacyOffset_ = 0;
+	recordsWritten_ = pagesErased_ = blocksMigrated_ = indexOverflows_ = 0;
+}
+
+bool bb::ConfigStorage::initialize(FlashDevice *device) {
+	if(initialized_) return true;
+
+	device_ = (device != NULL) ? device : FlashDevice::platformDevice();
+	pageSize_ = device_->eraseSize();
+	if(numPages() < 3 || numPages() > MAX_PAGES) return false;
+	record_ = new uint8_t[pageSize_];
+
+	mount();
+	initialized_ = true;
+	return true;
+}
+
+bool bb::ConfigStorage::isErased(size_t addr, size_t len) {
+	uint8_t buf[32];
+	while(len > 0) {
+		size_t n = len < sizeof(buf) ? len : sizeof(buf);
+		device_->read(addr, buf, n);
+		for(size_t i=0; i<n; i++) if(buf[i] != 0xff) return false;
+		addr += n;
+		len -= n;
+	}
+	return true;
+}
+
+void bb::ConfigStorage::mount() {
+	memset(index_, 0, sizeof(index_));
+	head_ = -1;
+	headOffset_ = 0;
+	nextSeq_ = 1;
+
+	uint8_t header[PAGE_HEADER_SIZE];
+	bool found = false;
+	for(size_t p=0; p<numPages(); p++) {
+		device_->read(p*pageSize_, header, sizeof(header));
+		if(get32(header) == PAGE_MAGIC && get32(header+4) != PAGE_ERASED) {
+			pageSeq_[p] = get32(header+4);
+			found = true;
+		} else {
+			pageSeq_[p] = PAGE_ERASED;
+		}
+	}
+
+	// No log, but something written: the EEPROM image of older firmware, if the device keeps it. reserveBlock()
+	// imports from the copy.
+	size_t legacySize = device_->legacySize();
+	if(!found && legacySize > 0 && !isErased(0, legacySize)) {
+		legacy_ = new uint8_t[legacySize];
+		device_->read(0, legacy_, legacySize);
+		legacySize_ = legacySize;
+		legacyOffset_ = 0;
+	}
+
+	for(size_t p=0; p<numPages(); p++) {
+		// Erased, or an erase or header write was cut short. Nothing in here can be live.
+		if(pageSeq_[p] == PAGE_ERASED && !isErased(p*pageSize_, pageSize_)) {
+			device_->erase(p*pageSize_);
+			pagesErased_++;
+		}
 	}
 
-	if(nextHandle_ + 1 + size > maxSize_) {
-		Serial.println("Size too large");
+	// Replay oldest first, so that newer records replace older ones. The last page replayed is the head.
+	uint32_t last = 0;
+	while(true) {
+		int next = -1;
+		for(size_t p=0; p<numPages(); p++) {
+			if(pageSeq_[p] == PAGE_ERASED || pageSeq_[p] <= last) continue;
+			if(next < 0 || pageSeq_[p] < pageSeq_[next]) next = p;
+		}
+		if(next < 0) break;
+		scanPage(next);
+		last = pageSeq_[next];
+		head_ = next;
+		nextSeq_ = last + 1;
+	}
+}
+
+void bb::ConfigStorage::scanPage(size_t page) {
+	size_t base = page * pageSize_;
+	size_t offset = PAGE_HEADER_SIZE;
+	uint8_t header[RECORD_HEADER_SIZE];
+
+	while(offset + RECORD_HEADER_SIZE <= pageSize_) {
+		device_->read(base + offset, header, sizeof(header));
+		if(get32(header) == 0xffffffff && get32(header+4) == 0xffffffff) break;
+
+		uint16_t len = get16(header+4);
+		if(offset + recordSize(len) > pageSize_) {
+			offset = pageSize_; // header is garbage, can't find the next record
+			break;
+		}
+		device_->read(base + offset + RECORD_HEADER_SIZE, record_, len);
+		uint32_t crc = BulkTransfer::crc32(header, 8);
+		crc = BulkTransfer::crc32(record_, len, crc);
+		if(crc == get32(header+8)) {
+			IndexEntry *entry = findEntry(get32(header), true);
+			if(entry != NULL) {
+				entry->addr = base + offset;
+				entry->len = len;
+				entry->version = get16(header+6);
+			} else {
+				indexOverflows_++;
+			}
+		}
+		offset += recordSize(len);
+	}
+
+	// Appending is only safe if the rest of the page is untouched; a cut off record write may have left bytes behind.
+	if(offset < pageSize_ && !isErased(base + offset, pageSize_ - offset)) offset = pageSize_;
+	headOffset_ = offset;
+}
+
+bb::ConfigStorage::IndexEntry* bb::ConfigStorage::findEntry(uint32_t id, bool create) {
+	for(size_t i=0, slot = id & (CONFIG_MAX_BLOCKS-1); i<CONFIG_MAX_BLOCKS; i++, slot = (slot + 1) & (CONFIG_MAX_BLOCKS-1)) {
+		if(index_[slot].addr == 0) {
+			if(!create) return NULL;
+			index_[slot].id = id;
+			return &index_[slot];
+		}
+		if(index_[slot].id == id) return &index_[slot];
+	}
+	return NULL;
+}
+
+// Open addressing: the other entries go in again, so that lookups still find those that probed past this one.
+void bb::ConfigStorage::removeEntry(IndexEntry *entry) {
+	IndexEntry entries[CONFIG_MAX_BLOCKS];
+	entry->addr = 0;
+	memcpy(entries, index_, sizeof(index_));
+	memset(index_, 0, sizeof(index_));
+	for(auto& e: entries) {
+		if(e.addr == 0) continue;
+		*findEntry(e.id, true) = e;
+	}
+}
+
+// Whether compaction has to keep the records of block id. See the class comment on blocks nobody reserved.
+bool bb::ConfigStorage::isKept(uint32_t id) {
+	if(!Runloop::runloop.isStarted()) return true;
+	for(auto& block: blocks_) if(block.id == id) return true;
+	return false;
+}
+
+bb::ConfigStorage::HANDLE bb::ConfigStorage::reserveBlock(const char *name, uint16_t version, size_t size,
+	const ConfigMigration *migrations, size_t numMigrations) {
+	if(!initialized_) return 0;
+	if(blocks_.size() + 1 >= CONFIG_MAX_BLOCKS) return 0;
+	if(recordSize(size) > pageSize_ - PAGE_HEADER_SIZE) return 0;
+
+	uint32_t id = SubsystemManager::hash(name);
+	for(auto& block: blocks_) if(block.id == id) return 0;
+
+	// Compaction needs two pages of slack: the head, and the spare that live records are copied into.
+	size_t total = recordSize(size);
+	for(auto& block: blocks_) total += recordSize(block.size);
+	if(total > (numPages() - 2) * (pageSize_ - PAGE_HEADER_SIZE)) return 0;
+
+	// Hold an index slot from now on, so the block's records can always be found.
+	IndexEntry *entry = findEntry(id, true);
+	if(entry == NULL) {
+		indexOverflows_++;
+		Console::console.printfBroadcast("Config storage index full (%d blocks), can't store \"%s\"\n",
+			CONFIG_MAX_BLOCKS, name);
 		return 0;
 	}
+	if(entry->addr == 0) entry->addr = NO_RECORD;
 
-	Block block = {nextHandle_+1, size};
+	Block block = {id, version, size, new uint8_t[size], false, false, false};
+	memset(block.data, 0, size);
+	loadBlock(block, migrations, numMigrations);
+	if(legacy_ != NULL) importLegacy(block);
 	blocks_.push_back(block);
-	nextHandle_ = nextHandle_ + size + 1;
 
-	return block.handle;
+	return blocks_.size();
+}
+
+void bb::ConfigStorage::loadBlock(Block& block, const ConfigMigration *migrations, size_t numMigrations) {
+	IndexEntry *entry = findEntry(block.id);
+	if(entry == NULL || entry->addr == NO_RECORD) return;
+
+	if(entry->version == block.version) {
+		if(entry->len != block.size) return;
+		device_->read(entry->addr + RECORD_HEADER_SIZE, block.data, block.size);
+		block.valid = true;
+		return;
+	}
+	if(entry->version > block.version) return;
+
+	// Walk the migrations up to the current version. Only happens once per block and firmware update.
+	size_t size = entry->len;
+	uint8_t *data = new uint8_t[size];
+	device_->read(entry->addr + RECORD_HEADER_SIZE, data, size);
+	uint16_t version = entry->version;
+	while(version < block.version) {
+		const ConfigMigration *migration = NULL;
+		for(size_t i=0; i<numMigrations; i++) {
+			if(migrations[i].fromVersion == version) migration = &migrations[i];
+		}
+		if(migration == NULL) break;
+
+		uint8_t *to = new uint8_t[migration->toSize];
+		memset(to, 0, migration->toSize);
+		bool ok = migration->migrate(data, size, to);
+		delete[] data;
+		data = to;
+		size = migration->toSize;
+		if(!ok) break;
+		version++;
+	}
+
+	if(version == block.version && size == block.size) {
+		memcpy(block.data, data, size);
+		block.valid = true;
+		block.queued = true; // save in the new layout, so this doesn't run again
+		blocksMigrated_++;
+	}
+	delete[] data;
+}
+
+// Old layout: blocks back to back in reserveBlock() order, each behind a LEGACY_VALID byte if it was ever written.
+// Their layout then is version 1; for a later version the old size isn't known, and neither where the next block
+// starts, so importing stops there.
+void bb::ConfigStorage::importLegacy(Block& block) {
+	if(block.version != 1) {
+		delete[] legacy_;
+		legacy_ = NULL;
+		return;
+	}
+	size_t offset = legacyOffset_;
+	legacyOffset_ += block.size + 1;
+	if(legacyOffset_ > legacySize_ || legacy_[offset] != LEGACY_VALID) return;
+
+	memcpy(block.data, legacy_ + offset + 1, block.size);
+	block.valid = true;
+	block.queued = true;
+	blocksMigrated_++;
 }
 
 bb::Result bb::ConfigStorage::writeBlock(HANDLE handle, uint8_t* data) {
-	if(!initialized_) return RES_CONFIG_INVALID_HANDLE;
-	for(auto block: blocks_) {
-  		if(block.handle == handle) {
-  			size_t size = block.size;
-  			Serial.print("Storing "); Serial.print(size); Serial.print(" bytes of data at address "); Serial.println(handle, HEX);
-  			for(size_t i=0; i<size; i++) {
-  				Serial.print(handle+i);
-  				Serial.print(".");
-  				EEPROM.write(handle+i, data[i]);	
-  			} 
-  			Serial.println("Marking as valid");
-  			EEPROM.write(handle-1, 0xba);
-  			Serial.println("Done.");
-  			return RES_OK;
-  		}
-  	}
-  	return RES_CONFIG_INVALID_HANDLE;
+	if(!initialized_ || handle == 0 || handle > blocks_.size()) return RES_CONFIG_INVALID_HANDLE;
+	Block& block = blocks_[handle-1];
+	memcpy(block.data, data, block.size);
+	block.valid = true;
+	block.dirty = true;
+	return RES_OK;
 }
 
 bb::Result bb::ConfigStorage::readBlock(HANDLE handle, uint8_t* data) {
-	if(!initialized_) return RES_CONFIG_INVALID_HANDLE;
-	for(auto block: blocks_) {
-  		if(block.handle == handle) {
-  			size_t size = block.size;
-  			for(size_t i=0; i<size; i++) {
-  				data[i] = EEPROM.read(handle+i);
-  			} 
-  			return RES_OK;
-  		}
-  	}
-  	return RES_CONFIG_INVALID_HANDLE;
+	if(!initialized_ || handle == 0 || handle > blocks_.size()) return RES_CONFIG_INVALID_HANDLE;
+	memcpy(data, blocks_[handle-1].data, blocks_[handle-1].size);
+	return RES_OK;
 }
 
 bool bb::ConfigStorage::blockIsValid(HANDLE handle) {
-	if(handle == 0 || !initialized_) return false;
+	if(!initialized_ || handle == 0 || handle > blocks_.size()) return false;
+	return blocks_[handle-1].valid;
+}
+
+bb::Result bb::ConfigStorage::store() {
+	if(!initialized_) return RES_SUBSYS_NOT_INITIALIZED;
 	for(auto& block: blocks_) {
-  		if(block.handle == handle) {
-  			if(EEPROM.read(handle-1) == 0xba) return true;
-  			else return false;
-		} 
+		if(!block.dirty) continue;
+		block.queued = true;
+		block.dirty = false;
 	}
-  	return false;
+	if(!Runloop::runloop.isStarted()) return flush();
+	return RES_OK;
 }
 
-bool bb::ConfigStorage::initialize() {
-	if(initialized_) return true;
+bool bb::ConfigStorage::busy() {
+	if(appending_ || compactPage_ >= 0) return true;
+	for(auto& block: blocks_) if(block.queued) return true;
+	return false;
+}
+
+bb::Result bb::ConfigStorage::flush() {
+	while(busy()) {
+		Result res = step();
+		if(res != RES_OK) return res;
+	}
+	return RES_OK;
+}
 
-#if defined(ARDUINO_NANO_RP2040_CONNECT)
-	EEPROM.begin(MAXSIZE);
-#endif
-	maxSize_ = MAXSIZE;
+int bb::ConfigStorage::oldestPage() {
+	int oldest = -1;
+	for(size_t p=0; p<numPages(); p++) {
+		if(pageSeq_[p] == PAGE_ERASED || (int)p == head_) continue;
+		if(oldest < 0 || pageSeq_[p] < pageSeq_[oldest]) oldest = p;
+	}
+	return oldest;
+}
 
-	nextHandle_ = 0;
-	initialized_ = true;
-	return true;
+// A page without live records. The head counts if it is closed, e.g. after a cut off record write.
+int bb::ConfigStorage::deadPage() {
+	for(size_t p=0; p<numPages(); p++) {
+		if(pageSeq_[p] == PAGE_ERASED || ((int)p == head_ && headOffset_ < pageSize_)) continue;
+		bool live = false;
+		for(size_t i=0; i<CONFIG_MAX_BLOCKS && !live; i++) {
+			live = index_[i].addr != 0 && index_[i].addr / pageSize_ == p && isKept(index_[i].id);
+		}
+		if(!live) return p;
+	}
+	return -1;
 }
 
-bb::Result bb::ConfigStorage::store() {
-	if(!initialized_) return RES_SUBSYS_NOT_INITIALIZED;
-	EEPROM.commit();
+int bb::ConfigStorage::nextErasedPage() {
+	for(size_t i=1; i<=numPages(); i++) {
+		size_t p = (head_ + i) % numPages();
+		if(pageSeq_[p] == PAGE_ERASED) return p;
+	}
+	return -1;
+}
+
+size_t bb::ConfigStorage::numErasedPages() {
+	size_t num = 0;
+	for(size_t p=0; p<numPages(); p++) if(pageSeq_[p] == PAGE_ERASED) num++;
+	return num;
+}
+
+bb::Result bb::ConfigStorage::openPage() {
+	int page = nextErasedPage();
+	if(page < 0) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+
+	uint32_t header[PAGE_HEADER_SIZE/4]; // word aligned for the flash controller
+	put32((uint8_t*)header, PAGE_MAGIC);
+	put32((uint8_t*)header + 4, nextSeq_);
+	Result res = device_->program(page*pageSize_, (uint8_t*)header, sizeof(header));
+	if(res != RES_OK) return res;
+
+	pageSeq_[page] = nextSeq_++;
+	head_ = page;
+	headOffset_ = PAGE_HEADER_SIZE;
 	return RES_OK;
 }
 
-bb::ConfigStorage::ConfigStorage() {
-	initialized_ = false;
+bb::Result bb::ConfigStorage::startAppend(size_t len) {
+	recordLen_ = len;
+	recordPos_ = 0;
+	recordAddr_ = head_*pageSize_ + headOffset_;
+	headOffset_ += len;
+	appending_ = true;
+	return continueAppend();
+}
+
+bb::Result bb::ConfigStorage::continueAppend() {
+	size_t n = recordLen_ - recordPos_;
+	if(n > CONFIG_WRITE_CHUNK) n = CONFIG_WRITE_CHUNK;
+	Result res = device_->program(recordAddr_ + recordPos_, record_ + recordPos_, n);
+	if(res != RES_OK) {
+		appending_ = false;
+		return res;
+	}
+
+	recordPos_ += n;
+	if(recordPos_ == recordLen_) {
+		IndexEntry *entry = findEntry(get32(record_), true);
+		if(entry != NULL) {
+			entry->addr = recordAddr_;
+			entry->len = get16(record_+4);
+			entry->version = get16(record_+6);
+		}
+		recordsWritten_++;
+		appending_ = false;
+	}
+	return RES_OK;
+}
+
+bb::Result bb::ConfigStorage::compactStep() {
+	size_t base = compactPage_ * pageSize_;
+	uint8_t header[RECORD_HEADER_SIZE];
+
+	while(compactOffset_ + RECORD_HEADER_SIZE <= pageSize_) {
+		uint32_t addr = base + compactOffset_;
+		device_->read(addr, header, sizeof(header));
+		if(get32(header) == 0xffffffff && get32(header+4) == 0xffffffff) break;
+		size_t size = recordSize(get16(header+4));
+		if(compactOffset_ + size > pageSize_) break;
+
+		IndexEntry *entry = findEntry(get32(header));
+		if(entry == NULL || entry->addr != addr) {
+			compactOffset_ += size;
+			continue;
+		}
+		if(!isKept(entry->id)) {
+			removeEntry(entry);
+			compactOffset_ += size;
+			continue;
+		}
+
+		// Live - copy it to the head, opening the spare page if needed, and look at this record again next time.
+		if(head_ < 0 || headOffset_ + size > pageSize_) return openPage();
+		device_->read(addr, record_, size);
+		compactOffset_ += size;
+		return startAppend(size);
+	}
+
+	// Everything live is elsewhere now.
+	pageSeq_[compactPage_] = PAGE_ERASED;
+	Result res = device_->erase(base);
+	pagesErased_++;
+	compactPage_ = -1;
+	return res;
+}
+
+bb::Result bb::ConfigStorage::step() {
+	if(!initialized_) return RES_SUBSYS_NOT_INITIALIZED;
+	if(legacy_ != NULL && Runloop::runloop.isStarted()) {
+		// Every block is reserved by now
+		delete[] legacy_;
+		legacy_ = NULL;
+	}
+
+	Result res = nextOperation();
+	if(res == RES_OK && !busy()) res = device_->sync();
+	return res;
+}
+
+bb::Result bb::ConfigStorage::nextOperation() {
+	if(appending_) return continueAppend();
+	if(compactPage_ >= 0) return compactStep();
+	if(full_) {
+		// Only dropping blocks nobody reserved can make room
+		if(!Runloop::runloop.isStarted()) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+		full_ = false;
+		compactions_ = 0;
+	}
+
+	HANDLE handle = 0;
+	for(size_t i=0; i<blocks_.size(); i++) {
+		if(blocks_[i].queued) {
+			handle = i+1;
+			break;
+		}
+	}
+	if(handle == 0) return RES_OK;
+	Block& block = blocks_[handle-1];
+	size_t size = recordSize(block.size);
+
+	if(head_ >= 0 && headOffset_ + size <= pageSize_) {
+		// Copy, so that writeBlock() can be called while this is being written.
+		memset(record_, 0xff, size);
+		put32(record_, block.id);
+		put16(record_+4, block.size);
+		put16(record_+6, block.version);
+		memcpy(record_ + RECORD_HEADER_SIZE, block.data, block.size);
+		uint32_t crc = BulkTransfer::crc32(record_, 8);
+		put32(record_+8, BulkTransfer::crc32(block.data, block.size, crc));
+		block.queued = false;
+		compactions_ = 0;
+		return startAppend(size);
+	}
+
+	// Keep one erased page as the spare for compaction. If a power cut during compaction used it up, a page with
+	// nothing live, which needs no spare, gets it back.
+	size_t erased = numErasedPages();
+	if(erased >= 2) return openPage();
+	// Every page compacted once, and still no room
+	if(compactions_ > numPages()) {
+		full_ = true;
+		return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	}
+	compactions_++;
+	compactPage_ = erased == 0 ? deadPage() : -1;
+	if(compactPage_ < 0) compactPage_ = oldestPage();
+	if(compactPage_ < 0) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+	compactOffset_ = PAGE_HEADER_SIZE;
+	return compactStep();
 }
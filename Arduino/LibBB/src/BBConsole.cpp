@@ -1,11 +1,192 @@
 #include "BBConsole.h"
 #include "BBConfigStorage.h"
 #include "BBRunloop.h"
+#include "BBParameterTransaction.h"
 #include <cstdarg>
 
 bb::Console bb::Console::console;
 
-bb::SerialConsoleStream::SerialConsoleStream(HardwareSerial& ser): ser_(ser), opened_(false), curStr_("") {
+bb::ConsoleStream::ConsoleStream() {
+	head_ = tail_ = end_ = 0;
+	wrapped_ = congested_ = replying_ = false;
+	policy_ = OVERFLOW_WAIT;
+	waitUS_ = 5000;
+	droppedBytes_ = unreportedDroppedBytes_ = writtenBytes_ = 0;
+	echo_ = false;
+	reportType_ = REPORT_NONE;
+	reportSubsys_ = NULL;
+	reportItem_ = 0;
+	reportResult_ = RES_OK;
+}
+
+void bb::ConsoleStream::printf(const char* format, ...) {
+	va_list args;
+	va_start(args, format);
+	vprintf(format, args);
+	va_end(args);
+}
+
+void bb::ConsoleStream::vprintf(const char* format, va_list args) {
+	reportDropped();
+
+	// Try to format right into the buffer
+	size_t avail;
+	char *buf = contiguousSpace(avail);
+	va_list args2;
+	va_copy(args2, args);
+	int len = vsnprintf(buf, avail, format, args2);
+	va_end(args2);
+	if(len < 0) return;
+	if((size_t)len < avail && leavesRoomForReport(len)) {
+		commit(len);
+		return;
+	}
+
+	// Didn't fit - now that we know the length, find (or make) room and format again
+	buf = reserve(len+1, avail);
+	if(buf == NULL) {
+		droppedBytes_ += len;
+		unreportedDroppedBytes_ += len;
+		return;
+	}
+	vsnprintf(buf, len+1, format, args);
+	commit(len);
+}
+
+void bb::ConsoleStream::print(const char* str) {
+	write(str, strlen(str));
+}
+
+void bb::ConsoleStream::write(const char* str, size_t len) {
+	reportDropped();
+	size_t avail;
+	char *buf = reserve(len, avail);
+	if(buf == NULL) {
+		droppedBytes_ += len;
+		unreportedDroppedBytes_ += len;
+		return;
+	}
+	memcpy(buf, str, len);
+	commit(len);
+}
+
+void bb::ConsoleStream::writeAboveInput(const char* str, size_t len) {
+	if(!echo_ || !editor_.echoes() || editor_.length() == 0) {
+		write(str, len);
+		return;
+	}
+
+	static const char clear[] = "\r\x1b[K";
+	char redraw[CONSOLE_LINE_SIZE + 32];
+	size_t redrawLen = editor_.formatRedraw(redraw, sizeof(redraw));
+	size_t total = sizeof(clear) - 1 + len + redrawLen;
+
+	reportDropped();
+	size_t avail;
+	char *buf = reserve(total, avail);
+	if(buf == NULL) {
+		droppedBytes_ += len;
+		unreportedDroppedBytes_ += len;
+		return;
+	}
+	memcpy(buf, clear, sizeof(clear) - 1);
+	memcpy(buf + sizeof(clear) - 1, str, len);
+	memcpy(buf + sizeof(clear) - 1 + len, redraw, redrawLen);
+	commit(total);
+}
+
+size_t bb::ConsoleStream::flush(unsigned long budgetUS) {
+	unsigned long start = micros();
+	size_t total = 0;
+
+	while(outputQueued() > 0) {
+		size_t chunk = (wrapped_ ? end_ : tail_) - head_;
+		size_t n = writeNonBlocking((const uint8_t*)buf_ + head_, chunk);
+		head_ += n;
+		total += n;
+		if(wrapped_ && head_ == end_) {
+			head_ = 0;
+			wrapped_ = false;
+		}
+		if(!wrapped_ && head_ == tail_) head_ = tail_ = 0;
+		if(n < chunk || micros() - start >= budgetUS) break;
+	}
+
+	writtenBytes_ += total;
+	if(congested_ && outputQueued() <= CONSOLE_OUTPUT_BUFFER_SIZE/2) congested_ = false;
+	if(total > 0) reportDropped();
+	return total;
+}
+
+void bb::ConsoleStream::discardOutput() {
+	head_ = tail_ = end_ = 0;
+	wrapped_ = congested_ = false;
+	unreportedDroppedBytes_ = 0;
+}
+
+// Returns the space the next message goes into without wrapping around.
+char* bb::ConsoleStream::contiguousSpace(size_t& avail) {
+	if(wrapped_) {
+		avail = head_ - tail_;
+	} else {
+		if(head_ == tail_) head_ = tail_ = 0;
+		avail = CONSOLE_OUTPUT_BUFFER_SIZE - tail_;
+	}
+	return buf_ + tail_;
+}
+
+// Returns contiguous room for len bytes, wrapping around if necessary and applying the overflow policy if there is
+// none. Returns NULL if the message has to be dropped.
+char* bb::ConsoleStream::reserve(size_t len, size_t& avail) {
+	if(len > CONSOLE_OUTPUT_BUFFER_SIZE || !leavesRoomForReport(len)) return NULL;
+
+	unsigned long start = micros();
+	while(true) {
+		char *buf = contiguousSpace(avail);
+		if(avail >= len) return buf;
+		if(!wrapped_ && head_ >= len) {
+			end_ = tail_;
+			tail_ = 0;
+			wrapped_ = true;
+			avail = head_;
+			return buf_;
+		}
+
+		if(policy_ == OVERFLOW_DROP || !replying_ || congested_) return NULL;
+		if(micros() - start >= waitUS_) {
+			congested_ = true;
+			return NULL;
+		}
+		flush(waitUS_ - (micros() - start));
+	}
+}
+
+// Output other than replies must leave room for the next chunk of a running report. Otherwise a stream that can
+// only just keep up with broadcasts never has enough space for the report to continue.
+bool bb::ConsoleStream::leavesRoomForReport(size_t len) {
+	return replying_ || reportType_ == REPORT_NONE || outputSpace() >= len + CONSOLE_REPORT_CHUNK_SIZE;
+}
+
+void bb::ConsoleStream::commit(size_t len) {
+	tail_ += len;
+}
+
+void bb::ConsoleStream::reportDropped() {
+	if(unreportedDroppedBytes_ == 0) return;
+
+	char msg[40];
+	int len = snprintf(msg, sizeof(msg), "\n[%lu bytes dropped]\n", unreportedDroppedBytes_);
+	size_t avail;
+	char *buf = contiguousSpace(avail);
+	if(len < 0 || avail < (size_t)len) return;
+	memcpy(buf, msg, len);
+	commit(len);
+	unreportedDroppedBytes_ = 0;
+}
+
+bb::SerialConsoleStream::SerialConsoleStream(HardwareSerial& ser): ser_(ser), opened_(false) {
+	setOverflowPolicy(OVERFLOW_WAIT, 20000);
+	setEcho(true);
 	lastCheck_ = micros();
 	checkInterval_ = 1000000;
 	if(ser_) {
@@ -36,38 +217,50 @@ bool bb::SerialConsoleStream::available() {
 	return ser_.available();
 }
 
-bool bb::SerialConsoleStream::readStringUntil(unsigned char c, String& str) { 
-	if(!opened_) return false;
-
-	unsigned char input = ser_.read();
-
-	if(input == '\b') {
-		if(curStr_.length() > 0) curStr_.remove(curStr_.length()-1);
-		ser_.print(String("\r> ") + curStr_ + " \b");
-	} else {
-		curStr_ += (char)input;
-		ser_.print(String("\r> ") + curStr_);
-	}
+char* bb::SerialConsoleStream::readLine() {
+	if(!opened_) return NULL;
 
-	ser_.flush();
-	str = curStr_;
-	if(input == c) {
-		curStr_ = "";
-		return true;
+	while(ser_.available()) {
+		if(addToLine(ser_.read())) return editor_.line();
 	}
-
-	return false;
+	return NULL;
 }
 
-void bb::SerialConsoleStream::printfFinal(const char* buf) {
-	ser_.print(buf);
+size_t bb::SerialConsoleStream::writeNonBlocking(const uint8_t *buf, size_t len) {
+	if(!opened_) return len; // nobody listening
+	size_t avail = ser_.availableForWrite();
+	if(len > avail) len = avail;
+	if(len == 0) return 0;
+	return ser_.write(buf, len);
 }
 
+const bb::ConsoleCommand bb::Console::commandTable_[] = {
+	{"abort",  "", BB_CONSOLE_HANDLER(Console, handleAbortCommand),     "abort: Drop all staged parameter changes"},
+	{"commit", "", BB_CONSOLE_HANDLER(Console, handleCommitCommand),
+		"commit: Apply all staged parameter changes together at the next cycle"},
+	{"help",   "", BB_CONSOLE_HANDLER(Console, handleHelpAllCommand),   "help: Print this help"},
+	{"stage",  "sss", BB_CONSOLE_HANDLER(Console, handleStageCommand),
+		"stage <subsys> <param> <value>: Stage a parameter change for the next commit"},
+	{"staged", "", BB_CONSOLE_HANDLER(Console, handleStagedCommand),    "staged: Print staged parameter changes"},
+	{"start",  "", BB_CONSOLE_HANDLER(Console, handleStartAllCommand),  "start: Start all stopped subsystems"},
+	{"status", "", BB_CONSOLE_HANDLER(Console, handleStatusAllCommand), "status: Print status of all subsystems"},
+	{"stop",   "", BB_CONSOLE_HANDLER(Console, handleStopAllCommand),   "stop: Stop all started subsystems"},
+	{"store",  "", BB_CONSOLE_HANDLER(Console, handleStoreCommand),     "store: Store all parameters to flash"}
+};
+
+const bb::ParameterDescription bb::Console::parameterTable_[] = {
+	BB_PARAM_INT("output_budget", "Time in us per cycle to spend writing console output", console.outputBudgetUS_, 0, 100000)
+};
+
 bb::Console::Console() {
 	name_ = "console";
 	description_ = "Console interaction facility";
 	help_ = "No help available";
 	firstResponder_ = this;
+	outputBudgetUS_ = 1000;
+	nextStreamToFlush_ = 0;
+	setCommands(commandTable_);
+	setParameters(parameterTable_);
 }
 
 bb::Result bb::Console::start(ConsoleStream *stream) {
@@ -88,11 +281,31 @@ bb::Result bb::Console::step() {
 
 	for(size_t i=0; i<streams_.size(); i++) {
 		handleStreamInput(streams_[i]);
+		continueReport(streams_[i]);
 	}
 
+	// Take turns at who goes first, so one slow stream can't starve the others
+	unsigned long start = micros();
+	for(size_t i=0; i<streams_.size(); i++) {
+		unsigned long elapsed = micros() - start;
+		if(elapsed >= (unsigned long)outputBudgetUS_) break;
+		streams_[(nextStreamToFlush_ + i) % streams_.size()]->flush(outputBudgetUS_ - elapsed);
+	}
+	nextStreamToFlush_++;
+
 	return RES_OK;
 }
 
+void bb::Console::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	stream->printf("%s: %d streams\n", name(), (int)streams_.size());
+	for(size_t i=0; i<streams_.size(); i++) {
+		ConsoleStream *s = streams_[i];
+		stream->printf("\tStream %d: %d bytes queued, %lu written, %lu dropped, %s\n", (int)i, (int)s->outputQueued(),
+			s->writtenBytes(), s->droppedBytes(), s->overflowPolicy() == ConsoleStream::OVERFLOW_DROP ? "drop" : "wait");
+	}
+}
+
 void bb::Console::addConsoleStream(ConsoleStream* stream) {
 	for(size_t i=0; i<streams_.size(); i++) {
 		if(streams_[i] == stream) return; // already have this
@@ -112,95 +325,157 @@ void bb::Console::removeConsoleStream(ConsoleStream* stream) {
 void bb::Console::handleStreamInput(ConsoleStream* stream) {
 	if(stream->available() == 0) return;
 
-	String str;
-	if(stream->readStringUntil('\n', str) == false) return;
+	stream->replying_ = true;
+	// Typing interrupts long output
+	cancelReport(stream);
 
-	stream->printf("\r");
-	str.trim();
-	std::vector<String> words = split(str);
+	char *line = stream->readLine();
+	if(line != NULL) handleStreamLine(stream, line);
+	stream->replying_ = false;
+}
 
-	if(words.size() == 0) {
+void bb::Console::handleStreamLine(ConsoleStream* stream, char* line) {
+	stream->printf("\r");
+	ConsoleArg args[CONSOLE_MAX_ARGS];
+	size_t numArgs;
+	Result res = tokenize(line, args, CONSOLE_MAX_ARGS, numArgs);
+	if(res == RES_OK && numArgs == 0) {
 		stream->printf("> ");
 		return;
 	}
 
-	stream->printf(errorMessage(firstResponder_->handleConsoleCommand(words, stream)));
+	if(res == RES_OK) res = firstResponder_->handleConsoleCommand(ConsoleArgs(args, numArgs), stream);
+	if(reportRunning(stream)) {
+		stream->reportResult_ = res; // printed when the report is done
+		return;
+	}
+	stream->printf(errorMessage(res));
 	stream->printf("\n> ");
 }
 
-bb::Result bb::Console::handleConsoleCommand(const std::vector<String>& words, ConsoleStream* stream) {
-
-	if(words[0] == "help") {
-		bb::Runloop::runloop.excuseOverrun();
-		if(words.size() != 1) {
-			return RES_CMD_INVALID_ARGUMENT_COUNT;
-		}
+bb::Result bb::Console::handleConsoleCommand(const ConsoleArgs& args, ConsoleStream* stream) {
+	if(args.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
 
-		printHelpAllSubsystems(stream);
-		return RES_OK;
-	} 
+	const ConsoleCommand *command = findCommand(commands_, numCommands_, args[0]);
+	if(command != NULL) return runCommand(*command, args, stream);
 
-	else if(words[0] == "status") {
-		bb::Runloop::runloop.excuseOverrun();
-		if(words.size() != 1) {
-			return RES_CMD_INVALID_ARGUMENT_COUNT;
-		}
+	Subsystem *subsys = SubsystemManager::manager.subsystemWithName(args[0].c_str());
+	if(subsys == NULL) return RES_CMD_UNKNOWN_COMMAND;
+	return subsys->handleConsoleCommand(args.shift(), stream);
+}
 
-		printStatusAllSubsystems(stream);
-		return RES_OK;
-	} 
+bb::Result bb::Console::handleHelpAllCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	startReport(stream, REPORT_HELP_ALL);
+	return RES_OK;
+}
 
-	else if(words[0] == "start") {
-		bb::Runloop::runloop.excuseOverrun();
-		if(words.size() != 1) {
-			return RES_CMD_INVALID_ARGUMENT_COUNT;
-		} 
+bb::Result bb::Console::handleStatusAllCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	startReport(stream, REPORT_STATUS_ALL);
+	return RES_OK;
+}
 
-		stream->printf("Starting all stopped subsystems\n");
-		for(auto& s: SubsystemManager::manager.subsystems()) {
-			if(!s->isStarted()) {
-				stream->printf("Starting %s... ", s->name());
-				stream->printf(errorMessage(s->start(stream)));
-				stream->printf("\n");
-			}
+bb::Result bb::Console::handleStartAllCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	bb::Runloop::runloop.excuseOverrun();
+	stream->printf("Starting all stopped subsystems\n");
+	for(auto& s: SubsystemManager::manager.subsystems()) {
+		if(!s->isStarted()) {
+			stream->printf("Starting %s... ", s->name());
+			stream->printf(errorMessage(s->start(stream)));
+			stream->printf("\n");
 		}
-		return RES_OK;
 	}
-		
-	else if(words[0] == "stop") {
-		bb::Runloop::runloop.excuseOverrun();
-		if(words.size() != 1) {
-			return RES_CMD_INVALID_ARGUMENT_COUNT;
-		}
+	return RES_OK;
+}
 
-		stream->printf("Stopping all running subsystems\n");
-		std::vector<Subsystem*> subsystems = SubsystemManager::manager.subsystems();
-		for(auto& s: SubsystemManager::manager.subsystems()) {
-			if(s->isStarted()) {
-				stream->printf("Stopping %s... ", s->name());
-				stream->printf(errorMessage(s->stop(stream)));
-				stream->printf("\n");
-			}
+bb::Result bb::Console::handleStopAllCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	bb::Runloop::runloop.excuseOverrun();
+	stream->printf("Stopping all running subsystems\n");
+	for(auto& s: SubsystemManager::manager.subsystems()) {
+		if(s->isStarted()) {
+			stream->printf("Stopping %s... ", s->name());
+			stream->printf(errorMessage(s->stop(stream)));
+			stream->printf("\n");
 		}
-		return RES_OK;
 	}
+	return RES_OK;
+}
 
-	else if(words[0] == "store") {
-		return ConfigStorage::storage.store();
-	} 
+bb::Result bb::Console::handleStoreCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
+	return ConfigStorage::storage.store();
+}
 
-	else {
-		Subsystem *subsys = SubsystemManager::manager.subsystemWithName(words[0]);
-		if(subsys == NULL) {
-			return RES_CMD_UNKNOWN_COMMAND;
-		} else {
-			std::vector<String> wordsminusone = words;
-			wordsminusone.erase(wordsminusone.begin());
-			stream->printf(errorMessage(subsys->handleConsoleCommand(wordsminusone, stream)));
-			stream->printf("\n");
+bb::Result bb::Console::handleStageCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	Subsystem *subsys = SubsystemManager::manager.subsystemWithName(args[1].c_str());
+	if(subsys == NULL) return RES_SUBSYS_NO_SUCH_SUBSYS;
+	return ParameterTransaction::transaction.stageValue(subsys, args[2].c_str(), args[3].c_str());
+}
+
+// Replies with the result of the subsystems' parametersChanged(), once the runloop has applied the commit
+bb::Result bb::Console::handleCommitCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	ParameterTransaction& transaction = ParameterTransaction::transaction;
+	uint16_t id;
+	Result res = transaction.commit(id);
+	if(res != RES_OK) return res;
+	if(transaction.isApplied(id)) return transaction.lastResult();
+	startReport(stream, REPORT_COMMIT);
+	if(stream != NULL) stream->reportItem_ = id;
+	return RES_OK;
+}
+
+bb::Result bb::Console::handleAbortCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
+	return ParameterTransaction::transaction.abort();
+}
+
+bb::Result bb::Console::handleStagedCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	ParameterTransaction::transaction.printStaged(stream);
+	return RES_OK;
+}
+
+static bool isSeparator(char c) {
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+bb::Result bb::Console::tokenize(char *line, ConsoleArg *args, size_t maxArgs, size_t& numArgs) {
+	numArgs = 0;
+	bool quoted = false;
+	char *p = line;
+
+	while(*p != '\0') {
+		if(!quoted && isSeparator(*p)) {
+			p++;
+			continue;
+		}
+		if(!quoted && *p == '"') {
+			quoted = true;
+			p++;
+			continue;
 		}
-		return RES_OK;
+
+		char *start = p;
+		while(*p != '\0' && (quoted ? *p != '"' : !isSeparator(*p) && *p != '"')) p++;
+		char *end = p;
+
+		// A quote ends a quoted word, or starts one right after an unquoted word
+		if(*p == '"') quoted = !quoted;
+		if(*p != '\0') p++;
+		*end = '\0';
+
+		if(numArgs == maxArgs) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		args[numArgs++] = ConsoleArg(start, end - start);
 	}
+
+	return RES_OK;
 }
 
 #define PRINTF_MAXLEN 254
@@ -209,83 +484,117 @@ void bb::Console::printfBroadcast(const char* format, ...) {
 
 	va_list args;
 	va_start(args, format);
-	int len = vsnprintf(NULL, 0, format, args)+1;
-	if(len > PRINTF_MAXLEN) len = PRINTF_MAXLEN;
-	memset(str, 0, len);
-	vsnprintf(str, len, format, args);
+	int len = vsnprintf(str, sizeof(str), format, args);
 	va_end(args);
+	if(len < 0) return;
+	if(len > PRINTF_MAXLEN) len = PRINTF_MAXLEN;
 	for(auto& s: streams_) {
-		s->printf(str);
+		s->writeAboveInput(str, len);
 	}
 }
 
 void bb::Console::printHelpAllSubsystems(ConsoleStream* stream) {
-	stream->printf("The following commands are available on top level:\n");
-	stream->printf("    help                    Print this help text (use '<subsys> help' for help on individual subsystem)\n"); 
-	stream->printf("    status                  Print status on all subsystems (use '<subsys> status' for help on individual subsystem)\n");
-	stream->printf("    start                   Start all stopped subsystems (use '<subsys> start' to start individual subsystem)\n");
-	stream->printf("    stop                    Stop all started subsystems (use '<subsys> stop' to stop individual subsystem)\n");
-	stream->printf("    restart                 Restart (stop, then start) all started subsystems\n");
-	stream->printf("    store                   Store all parameters oto flash\n");
-	stream->printf("The following standard commands are supported by all subsystems:\n");
-	stream->printf("    <subsys> help\n");
-	stream->printf("    <subsys> status\n");
-	stream->printf("    <subsys> start\n");
-	stream->printf("    <subsys> stop\n");
-	stream->printf("    <subsys> restart\n");
-	stream->printf("Please use '<subsys> help' for additional commands supported by individual subsystems.\n");
+	for(size_t item=0; printHelpAllItem(stream, item); item++);
 }
 
 void bb::Console::printStatusAllSubsystems(ConsoleStream* stream) {
-	stream->printf("System status:\n");
-	const std::vector<Subsystem*> subsystems = SubsystemManager::manager.subsystems();
-	for(auto& s: subsystems) s->printStatus(stream);
-}
-
-std::vector<String> bb::Console::split(const String& str) {
-  std::vector<String> words;
-  unsigned int start = 0, end = 0;
-  bool quotes = false;
-
-  while(end < str.length()) {
-    if(quotes == true) {
-      if(str[end] != '"') {
-        end++;
-        if(end == str.length()) {
-          String substr = str.substring(start, end);
-          if(substr.length()) words.push_back(substr);
-        }
-      } else if(end >= start) {
-        quotes = false;
-        String substr = str.substring(start, end);
-        if(substr.length()) words.push_back(substr);
-        start = end+1;
-        end = end+1;
-      }
-    } else {
-      if(str[end] == '"') {
-        quotes = true;
-        start++;
-        end++;
-        continue;
-      }
-  
-      if(str[end] != ' ') {
-        end++;
-        if(end == str.length()) {
-          String substr = str.substring(start, end);
-          if(substr.length()) words.push_back(substr);
-        }
-      } else if(end >= start) {
-        String substr = str.substring(start, end);
-        if(substr.length()) words.push_back(substr);
-        start = end+1;
-        end = end+1;
-      } 
-    }
-  }
-
-  return words;
+	for(size_t item=0; printStatusAllItem(stream, item); item++);
+}
+
+// The top level commands and the standard subsystem commands, from the command tables
+bool bb::Console::printHelpAllItem(ConsoleStream* stream, size_t item) {
+	static const size_t numTopLevel = sizeof(commandTable_)/sizeof(commandTable_[0]);
+
+	if(item < numTopLevel) {
+		if(item == 0) stream->printf("Commands on top level:\n");
+		stream->printf("\t%s\n", commandTable_[item].help);
+		return true;
+	}
+	item -= numTopLevel;
+
+	if(item < numStandardCommands_) {
+		if(item == 0) stream->printf("Commands supported by all subsystems:\n");
+		stream->printf("\t<subsys> %s\n", standardCommands_[item].help);
+		return true;
+	}
+	item -= numStandardCommands_;
+
+	if(item == 0) {
+		stream->printf("Use \"<subsys> help\" for the additional commands and the parameters of a subsystem.\n");
+		return true;
+	}
+	return false;
+}
+
+bool bb::Console::printStatusAllItem(ConsoleStream* stream, size_t item) {
+	if(item == 0) {
+		stream->printf("System status:\n");
+		return true;
+	}
+	const std::vector<Subsystem*>& subsystems = SubsystemManager::manager.subsystems();
+	if(item > subsystems.size()) return false;
+	subsystems[item-1]->printStatus(stream);
+	return true;
+}
+
+bool bb::Console::printReportItem(ConsoleStream* stream, ConsoleReportType type, Subsystem* subsys, size_t item) {
+	switch(type) {
+	case REPORT_HELP_ALL:
+		return printHelpAllItem(stream, item);
+	case REPORT_STATUS_ALL:
+		return printStatusAllItem(stream, item);
+	case REPORT_SUBSYS_HELP:
+		return subsys != NULL && subsys->printHelpItem(stream, item);
+	case REPORT_SUBSYS:
+		return subsys != NULL && subsys->printReportItem(stream, item);
+	default:
+		return false;
+	}
+}
+
+void bb::Console::startReport(ConsoleStream* stream, ConsoleReportType type, Subsystem* subsys) {
+	bool ours = false;
+	for(auto& s: streams_) {
+		if(s == stream) ours = true;
+	}
+	if(!ours) {
+		for(size_t item=0; printReportItem(stream, type, subsys, item); item++);
+		return;
+	}
+
+	stream->reportType_ = type;
+	stream->reportSubsys_ = subsys;
+	stream->reportItem_ = 0;
+	stream->reportResult_ = RES_OK;
+}
+
+void bb::Console::cancelReport(ConsoleStream* stream) {
+	if(!reportRunning(stream)) return;
+	stream->reportType_ = REPORT_NONE;
+	stream->printf("\n[interrupted]\n> ");
+}
+
+// Prints report items until CONSOLE_REPORT_CHUNK_SIZE bytes have been generated, or until the output buffer is too
+// full to take another chunk without waiting.
+void bb::Console::continueReport(ConsoleStream* stream) {
+	if(!reportRunning(stream)) return;
+	if(stream->reportType_ == REPORT_COMMIT) {
+		ParameterTransaction& transaction = ParameterTransaction::transaction;
+		if(!transaction.isApplied(stream->reportItem_)) return;
+		if(transaction.lastAppliedID() == stream->reportItem_) stream->reportResult_ = transaction.lastResult();
+	}
+
+	stream->replying_ = true;
+	size_t limit = stream->outputQueued() + CONSOLE_REPORT_CHUNK_SIZE;
+	while(stream->outputQueued() < limit && stream->outputSpace() >= CONSOLE_REPORT_CHUNK_SIZE) {
+		if(!printReportItem(stream, stream->reportType_, stream->reportSubsys_, stream->reportItem_++)) {
+			stream->reportType_ = REPORT_NONE;
+			stream->printf(errorMessage(stream->reportResult_));
+			stream->printf("\n> ");
+			break;
+		}
+	}
+	stream->replying_ = false;
 }
 
 void bb::Console::setFirstResponder(Subsystem* subsys) {
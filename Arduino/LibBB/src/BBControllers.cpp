@@ -6,7 +6,7 @@
 
 using namespace bb;
 
-bb::PIDController::PIDController(ControlInput& input, ControlOutput& output): input_(input), output_(output) {
+template<typename T> bb::BasicPIDController<T>::BasicPIDController(ControlInput& input, ControlOutput& output): input_(input), output_(output) {
   setControlParameters(0.0f, 0.0f, 0.0f);
   setIUnbounded();
   setControlUnbounded();
@@ -15,12 +15,14 @@ bb::PIDController::PIDController(ControlInput& input, ControlOutput& output): in
   reset();
 }
 
-void bb::PIDController::reset() {
-  lastErr_ = errI_ = lastErrD_ = lastControl_ = 0.0f;
+template<typename T> void bb::BasicPIDController<T>::reset() {
+  lastErr_ = errI_ = lastErrD_ = lastControl_ = T(0);
+  haveLastErr_ = false;
+  saturation_ = 0;
   lastCycleUS_ = micros();
 }
 
-void bb::PIDController::update(void) {
+template<typename T> void bb::BasicPIDController<T>::update(void) {
   unsigned long us = micros();
   unsigned long timediffUS;
   if (us < lastCycleUS_) {
@@ -32,84 +34,99 @@ void bb::PIDController::update(void) {
 
   input_.update();
 
-  float dt = timediffUS / 1e6; 
+  T dt = secondsFromMicros<T>(timediffUS);
 
   //bb::Runloop::runloop.excuseOverrun();
 
-  float err = goal_ - input_.present();
+  T err = goal_ - T(input_.present());
 
-  errI_ += err * dt;
+  int sat = saturation(); // as of the last cycle
+  if(!(sat > 0 && err > T(0)) && !(sat < 0 && err < T(0))) {
+    errI_ += err * dt;
+  }
   if(iBounded_) {
     errI_ = constrain(errI_, iMin_, iMax_);
   }
 
-  lastErrD_ = (err - lastErr_)/dt;
+  // Nothing to differentiate against right after reset(), and no time passed if reset() was in the same cycle
+  if(haveLastErr_ && timediffUS > 0) lastErrD_ = (err - lastErr_)/dt;
+  else lastErrD_ = T(0);
   lastErr_ = err;
+  haveLastErr_ = true;
 
   lastControl_ = kp_ * lastErr_ + ki_ * errI_ + kd_ * lastErrD_;
-  lastControl_ *= input_.controlGain();
+  lastControl_ *= T(input_.controlGain());
 
+  saturation_ = 0;
   if(controlBounded_) {
-    lastControl_ = constrain(lastControl_, controlMin_, controlMax_);
+    if(lastControl_ >= controlMax_) {
+      lastControl_ = controlMax_;
+      saturation_ = 1;
+    } else if(lastControl_ <= controlMin_) {
+      lastControl_ = controlMin_;
+      saturation_ = -1;
+    }
   }
 
   //Console::console.printlnBroadcast(String("Control: Goal:") + goal_ + " Cur In:" + input_.present() + " Cur Out:" + output_.present() + " Err:" + err + " ErrI:" + errI_ + " ErrD:" + lastErrD_ + " Control:" + lastControl_);
 
-  setControlOutput(lastControl_);
+  setControlOutput(float(lastControl_));
 }
   
-void bb::PIDController::setGoal(const float& sp) {
-  goal_ = sp;
+template<typename T> void bb::BasicPIDController<T>::setGoal(const float& sp) {
+  goal_ = T(sp);
 }
 
-float bb::PIDController::present() {
+template<typename T> float bb::BasicPIDController<T>::present() {
   return input_.present();
 }
 
-void bb::PIDController::setControlParameters(const float& kp, const float& ki, const float& kd) {
-  kp_ = kp;
-  ki_ = ki;
-  kd_ = kd;
+template<typename T> void bb::BasicPIDController<T>::setControlParameters(const float& kp, const float& ki, const float& kd) {
+  kp_ = T(kp);
+  ki_ = T(ki);
+  kd_ = T(kd);
 }
   
-void bb::PIDController::getControlParameters(float& kp, float& ki, float& kd) {
-  kp = kp_;
-  ki = ki_;
-  kd = kd_;
+template<typename T> void bb::BasicPIDController<T>::getControlParameters(float& kp, float& ki, float& kd) {
+  kp = float(kp_);
+  ki = float(ki_);
+  kd = float(kd_);
 }
   
-void bb::PIDController::getControlState(float& err, float& errI, float& errD, float& control) {
-  err = lastErr_;
-  errI = errI_;
-  errD = lastErrD_;
-  control = lastControl_;
+template<typename T> void bb::BasicPIDController<T>::getControlState(float& err, float& errI, float& errD, float& control) {
+  err = float(lastErr_);
+  errI = float(errI_);
+  errD = float(lastErrD_);
+  control = float(lastControl_);
 }
 
-void bb::PIDController::setIBounds(float iMin, float iMax) {
+template<typename T> void bb::BasicPIDController<T>::setIBounds(float iMin, float iMax) {
   iBounded_ = true;
-  iMin_ = iMin; iMax_ = iMax;
+  iMin_ = T(iMin); iMax_ = T(iMax);
 }
 
-void bb::PIDController::setIUnbounded() {
-  iMin_ = iMax_ = 0.0f;
+template<typename T> void bb::BasicPIDController<T>::setIUnbounded() {
+  iMin_ = iMax_ = T(0);
   iBounded_ = false;
 }
   
-bool bb::PIDController::isIBounded() {
+template<typename T> bool bb::BasicPIDController<T>::isIBounded() {
   return iBounded_;
 }
 
-void bb::PIDController::setControlBounds(float controlMin, float controlMax) {
+template<typename T> void bb::BasicPIDController<T>::setControlBounds(float controlMin, float controlMax) {
   controlBounded_ = true;
-  controlMin_ = controlMin; controlMax_ = controlMax;
+  controlMin_ = T(controlMin); controlMax_ = T(controlMax);
 }
 
-void bb::PIDController::setControlUnbounded() {
-  controlMin_ = controlMax_ = 0.0f;
+template<typename T> void bb::BasicPIDController<T>::setControlUnbounded() {
+  controlMin_ = controlMax_ = T(0);
   controlBounded_ = false;
 }
   
-bool bb::PIDController::isControlBounded() {
+template<typename T> bool bb::BasicPIDController<T>::isControlBounded() {
   return controlBounded_;
 }
 
+template class bb::BasicPIDController<float>;
+template class bb::BasicPIDController<bb::Q16_16>;
@@ -0,0 +1,95 @@
+#include "BBDownlinkScheduler.h"
+
+bb::DownlinkScheduler::DownlinkScheduler(float budget, unsigned long airtimeUS) {
+	numItems_ = 0;
+	budget_ = constrain(budget, 0.0f, 1.0f);
+	frameAirtimeUS_ = airtimeUS;
+	creditUS_ = 0;
+	lastRefillUS_ = micros();
+	lastControlUS_ = 0;
+	controlPeriodUS_ = 0;
+	guardUS_ = 3000;
+	resetStats();
+}
+
+int bb::DownlinkScheduler::addItem(uint8_t priority) {
+	if(numItems_ >= MAX_ITEMS) return -1;
+	items_[numItems_].priority = priority;
+	items_[numItems_].age = 0;
+	return numItems_++;
+}
+
+void bb::DownlinkScheduler::setBudget(float budget) {
+	budget_ = constrain(budget, 0.0f, 1.0f);
+}
+
+void bb::DownlinkScheduler::noteControlTraffic() {
+	unsigned long us = micros();
+	if(lastControlUS_ != 0) {
+		unsigned long period = us - lastControlUS_;
+		if(period < guardUS_) return; // same burst, e.g. both remotes handled in one cycle
+		if(controlPeriodUS_ == 0) controlPeriodUS_ = period;
+		else controlPeriodUS_ = (7*controlPeriodUS_ + period) / 8;
+	}
+	lastControlUS_ = us;
+}
+
+bool bb::DownlinkScheduler::controlTrafficExpected() {
+	if(lastControlUS_ == 0 || controlPeriodUS_ == 0) return false;
+	unsigned long sinceLast = micros() - lastControlUS_;
+	if(sinceLast > 4*controlPeriodUS_) return false; // control traffic has stopped
+	// The last packet is off the air already, so only the next one counts until it is late
+	if(sinceLast < controlPeriodUS_) return controlPeriodUS_ - sinceLast < guardUS_;
+	unsigned long phase = sinceLast % controlPeriodUS_;
+	return phase < guardUS_ || controlPeriodUS_ - phase < guardUS_;
+}
+
+int bb::DownlinkScheduler::schedule() {
+	unsigned long us = micros();
+	creditUS_ += budget_ * (us - lastRefillUS_);
+	lastRefillUS_ = us;
+	if(creditUS_ > 2*frameAirtimeUS_) creditUS_ = 2*frameAirtimeUS_; // allow small bursts only
+
+	for(uint8_t i=0; i<numItems_; i++) {
+		if(items_[i].age < 0xffff) items_[i].age++;
+	}
+
+	if(numItems_ == 0) return -1;
+	if(creditUS_ < frameAirtimeUS_) {
+		skippedBudget_++;
+		return -1;
+	}
+	if(controlTrafficExpected()) {
+		skippedControl_++;
+		return -1;
+	}
+
+	int best = 0;
+	uint32_t bestScore = 0;
+	for(uint8_t i=0; i<numItems_; i++) {
+		uint32_t score = (uint32_t)items_[i].priority * items_[i].age;
+		if(score > bestScore) {
+			best = i;
+			bestScore = score;
+		}
+	}
+	return best;
+}
+
+void bb::DownlinkScheduler::sent(int item) {
+	if(item < 0 || item >= numItems_) return;
+	items_[item].age = 0;
+	creditUS_ -= frameAirtimeUS_;
+	framesSent_++;
+}
+
+float bb::DownlinkScheduler::airtimeUsed() {
+	unsigned long elapsed = micros() - statsStartUS_;
+	if(elapsed == 0) return 0;
+	return (float)framesSent_ * frameAirtimeUS_ / elapsed;
+}
+
+void bb::DownlinkScheduler::resetStats() {
+	framesSent_ = skippedBudget_ = skippedControl_ = 0;
+	statsStartUS_ = micros();
+}
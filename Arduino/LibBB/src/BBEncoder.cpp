@@ -3,15 +3,20 @@
 #include <BBEncoder.h>
 #include <BBConsole.h>
 
+static const unsigned long FILTER_MIN_US = 2000, FILTER_MAX_US = 16000;
+
 bb::Encoder::Encoder(uint8_t pin_enc_a, uint8_t pin_enc_b, InputMode mode, Unit unit): 
-  enc_(pin_enc_a, pin_enc_b),
-  filtSpeed_(25, 100, true), 
-  filtPos_(25, 100, true) {
+  enc_(pin_enc_a, pin_enc_b) {
+  speedCutoff_ = posCutoff_ = 0;
+  setSpeedFilterCutoff(25);
+  setPositionFilterCutoff(25);
   mode_ = mode;
   unit_ = unit;
   mmPT_ = 1.0;
   lastCycleUS_ = micros();
-  presentPos_ = enc_.read();
+  presentPos_ = presentPosFiltered_ = enc_.read();
+  lastCycleTicks_ = 0;
+  presentSpeed_ = presentSpeedFiltered_ = 0;
 }
 
 void bb::Encoder::setMode(Encoder::InputMode mode) {
@@ -26,7 +31,6 @@ bb::Result bb::Encoder::update() {
   unsigned long ticks = enc_.read();
   lastCycleTicks_ = ticks - presentPos_; // FIXME compensate for wrap?
   presentPos_ = ticks;
-  presentPosFiltered_ = filtPos_.filter(presentPos_);
 
   unsigned long us = micros();
   unsigned long dt;
@@ -37,8 +41,9 @@ bb::Result bb::Encoder::update() {
   }
   lastCycleUS_ = us;
 
+  presentPosFiltered_ = filtPos_.filter(presentPos_, dt);
   presentSpeed_ = ((double)lastCycleTicks_ / (double)dt)*1e6;
-  presentSpeedFiltered_ = filtSpeed_.filter(presentSpeed_);
+  presentSpeedFiltered_ = filtSpeed_.filter(presentSpeed_, dt);
 
   return RES_OK;
 }
@@ -77,19 +82,23 @@ float bb::Encoder::presentSpeed(bool raw) {
 
 
 float bb::Encoder::speedFilterCutoff() {
-  return filtSpeed_.cutoff();
+  return speedCutoff_;
 }
   
-void bb::Encoder::setSpeedFilterCutoff(float co) {
-  filtSpeed_.setCutoff(co);
+bb::Result bb::Encoder::setSpeedFilterCutoff(float co) {
+  if(!filtSpeed_.designAdaptive(BIQUAD_LOWPASS, co, FILTER_MIN_US, FILTER_MAX_US)) return RES_COMMON_OUT_OF_RANGE;
+  speedCutoff_ = co;
+  return RES_OK;
 }
 
 float  bb::Encoder::positionFilterCutoff() {
-  return filtPos_.cutoff();
+  return posCutoff_;
 }
 
-void bb::Encoder::setPositionFilterCutoff(float co) {
-  filtPos_.setCutoff(co);
+bb::Result bb::Encoder::setPositionFilterCutoff(float co) {
+  if(!filtPos_.designAdaptive(BIQUAD_LOWPASS, co, FILTER_MIN_US, FILTER_MAX_US)) return RES_COMMON_OUT_OF_RANGE;
+  posCutoff_ = co;
+  return RES_OK;
 }
 
 
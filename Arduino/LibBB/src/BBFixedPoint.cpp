@@ -0,0 +1,20 @@
+#include "BBFixedPoint.h"
+
+uint32_t bb::fixedInvSqrt(uint64_t sq, int& halfExp) {
+	// Normalize to u = sq * 2^-n in [0.25, 1) with n even, so that 1/sqrt(sq) = 1/sqrt(u) * 2^(-n/2).
+	int n = 64 - __builtin_clzll(sq);
+	n = (n + 1) & ~1;
+	uint32_t u = n >= 32 ? uint32_t(sq >> (n - 32)) : uint32_t(sq << (32 - n)); // Q0.32
+
+	// y = 1/sqrt(u) in Q2.30, seeded with the chord from (0.25, 2) to (1, 1). Four Newton steps take the seed's 18%
+	// error below 1e-9.
+	uint64_t y = 2505397589u - ((uint64_t(u) * 0x55555556u) >> 32); // 7/3 - 4/3 u
+	for(int i=0; i<4; i++) {
+		uint64_t y2 = (y * y) >> 30;
+		uint64_t uy2 = (uint64_t(u) * y2) >> 32;
+		y = (y * ((uint64_t(3) << 30) - uy2)) >> 31;
+	}
+
+	halfExp = n/2;
+	return uint32_t(y);
+}
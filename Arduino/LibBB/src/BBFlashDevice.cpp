@@ -0,0 +1,90 @@
+#include "BBFlashDevice.h"
+
+#if defined(ARDUINO_ARCH_SAMD)
+#include <FlashStorage.h>
+
+Flash(configFlash, CONFIG_FLASH_SIZE);
+static const uint8_t *configFlashStart = _dataconfigFlash;
+
+bb::FlashDevice* bb::FlashDevice::platformDevice() {
+	static SAMDFlashDevice device;
+	return &device;
+}
+
+bb::Result bb::SAMDFlashDevice::erase(size_t addr) {
+	if(addr % eraseSize() != 0 || addr >= size()) return RES_COMMON_OUT_OF_RANGE;
+	configFlash.erase(configFlashStart + addr, eraseSize());
+	return RES_OK;
+}
+
+bb::Result bb::SAMDFlashDevice::program(size_t addr, const uint8_t *data, size_t len) {
+	if(addr % 4 != 0 || len % 4 != 0 || addr + len > size()) return RES_COMMON_OUT_OF_RANGE;
+	// FlashClass::write() programs the page buffer into the page of the last word it got, so one write must not
+	// cross a page boundary.
+	while(len > 0) {
+		size_t n = PAGE_SIZE - addr % PAGE_SIZE;
+		if(n > len) n = len;
+		configFlash.write(configFlashStart + addr, data, n);
+		addr += n;
+		data += n;
+		len -= n;
+	}
+	return RES_OK;
+}
+
+bb::Result bb::SAMDFlashDevice::read(size_t addr, uint8_t *data, size_t len) {
+	if(addr + len > size()) return RES_COMMON_OUT_OF_RANGE;
+	memcpy(data, configFlashStart + addr, len); // memory mapped
+	return RES_OK;
+}
+
+#else
+#include <EEPROM.h>
+
+bb::FlashDevice* bb::FlashDevice::platformDevice() {
+	static EEPROMFlashDevice device;
+	return &device;
+}
+
+bb::EEPROMFlashDevice::EEPROMFlashDevice() {
+	begun_ = false;
+	dirty_ = false;
+}
+
+void bb::EEPROMFlashDevice::begin() {
+	if(begun_) return;
+	EEPROM.begin(size());
+	begun_ = true;
+}
+
+bb::Result bb::EEPROMFlashDevice::erase(size_t addr) {
+	if(addr % eraseSize() != 0 || addr >= size()) return RES_COMMON_OUT_OF_RANGE;
+	begin();
+	for(size_t i=0; i<eraseSize(); i++) EEPROM.write(addr+i, 0xff);
+	dirty_ = true;
+	return RES_OK;
+}
+
+bb::Result bb::EEPROMFlashDevice::program(size_t addr, const uint8_t *data, size_t len) {
+	if(addr % 4 != 0 || len % 4 != 0 || addr + len > size()) return RES_COMMON_OUT_OF_RANGE;
+	begin();
+	for(size_t i=0; i<len; i++) EEPROM.write(addr+i, EEPROM.read(addr+i) & data[i]);
+	dirty_ = true;
+	return RES_OK;
+}
+
+bb::Result bb::EEPROMFlashDevice::read(size_t addr, uint8_t *data, size_t len) {
+	if(addr + len > size()) return RES_COMMON_OUT_OF_RANGE;
+	begin();
+	for(size_t i=0; i<len; i++) data[i] = EEPROM.read(addr+i);
+	return RES_OK;
+}
+
+bb::Result bb::EEPROMFlashDevice::sync() {
+	if(!dirty_) return RES_OK;
+	if(!EEPROM.commit()) return RES_SUBSYS_COMM_ERROR;
+	dirty_ = false;
+	return RES_OK;
+}
+
+#endif
@@ -0,0 +1,315 @@
+#include "BBLineEditor.h"
+#include "BBConsole.h"
+
+static const uint8_t TELNET_IAC = 255;
+static const uint8_t TELNET_DONT = 254;
+static const uint8_t TELNET_DO = 253;
+static const uint8_t TELNET_WILL = 251;
+static const uint8_t TELNET_SB = 250;
+static const uint8_t TELNET_SE = 240;
+static const uint8_t TELNET_OPT_ECHO = 1;
+static const uint8_t TELNET_OPT_SGA = 3;
+
+bb::LineEditor::LineEditor() {
+	historyLen_ = historyPos_ = 0;
+	telnet_ = telnetEcho_ = false;
+	reset();
+}
+
+void bb::LineEditor::reset() {
+	len_ = cursor_ = 0;
+	line_[0] = draft_[0] = '\0';
+	historyPos_ = historyLen_;
+	state_ = STATE_NORMAL;
+	csiParam_ = 0;
+	lastWasCR_ = false;
+}
+
+const uint8_t* bb::LineEditor::telnetNegotiation(size_t& len) {
+	static const uint8_t negotiation[] = {
+		TELNET_IAC, TELNET_WILL, TELNET_OPT_ECHO,
+		TELNET_IAC, TELNET_WILL, TELNET_OPT_SGA
+	};
+	len = sizeof(negotiation);
+	return negotiation;
+}
+
+bool bb::LineEditor::input(uint8_t c, ConsoleStream *echo) {
+	if(telnet_) {
+		if(state_ >= STATE_IAC || (c == TELNET_IAC && state_ == STATE_NORMAL)) {
+			inputTelnet(c);
+			return false;
+		}
+		if(!telnetEcho_) echo = NULL;
+	}
+
+	switch(state_) {
+	case STATE_ESC:
+		if(c == '[' || c == 'O') {
+			state_ = STATE_CSI;
+			csiParam_ = 0;
+		} else {
+			state_ = STATE_NORMAL;
+		}
+		return false;
+
+	case STATE_CSI:
+		inputCSI(c, echo);
+		return false;
+
+	default:
+		return inputNormal(c, echo);
+	}
+}
+
+bool bb::LineEditor::inputNormal(uint8_t c, ConsoleStream *echo) {
+	if(c == '\n' && lastWasCR_) {
+		lastWasCR_ = false;
+		return false;
+	}
+	lastWasCR_ = (c == '\r');
+
+	if(c == '\r' || c == '\n') {
+		line_[len_] = '\0';
+		addToHistory();
+		if(echo) echo->print("\n");
+		len_ = cursor_ = 0;
+		draft_[0] = '\0';
+		historyPos_ = historyLen_;
+		return true;
+	}
+
+	switch(c) {
+	case '\b':
+	case 0x7f:
+		if(cursor_ > 0) erase(cursor_-1, 1, echo);
+		break;
+	case 0x01: // Ctrl-A
+		moveTo(0, echo);
+		break;
+	case 0x02: // Ctrl-B
+		if(cursor_ > 0) moveTo(cursor_-1, echo);
+		break;
+	case 0x04: // Ctrl-D
+		if(cursor_ < len_) erase(cursor_, 1, echo);
+		break;
+	case 0x05: // Ctrl-E
+		moveTo(len_, echo);
+		break;
+	case 0x06: // Ctrl-F
+		if(cursor_ < len_) moveTo(cursor_+1, echo);
+		break;
+	case 0x0b: // Ctrl-K
+		erase(cursor_, len_-cursor_, echo);
+		break;
+	case 0x0c: // Ctrl-L
+		redraw(echo);
+		break;
+	case 0x0e: // Ctrl-N
+		historyDown(echo);
+		break;
+	case 0x10: // Ctrl-P
+		historyUp(echo);
+		break;
+	case 0x15: // Ctrl-U
+		erase(0, cursor_, echo);
+		break;
+	case 0x1b:
+		state_ = STATE_ESC;
+		break;
+	default:
+		if(c >= 0x20 && c < 0x7f) insert(c, echo);
+		break;
+	}
+	return false;
+}
+
+void bb::LineEditor::inputCSI(uint8_t c, ConsoleStream *echo) {
+	if(c >= '0' && c <= '9') {
+		if(csiParam_ < 100) csiParam_ = csiParam_*10 + (c - '0');
+		return;
+	}
+	if(c == ';') return;
+
+	state_ = STATE_NORMAL;
+	switch(c) {
+	case 'A':
+		historyUp(echo);
+		break;
+	case 'B':
+		historyDown(echo);
+		break;
+	case 'C':
+		if(cursor_ < len_) moveTo(cursor_+1, echo);
+		break;
+	case 'D':
+		if(cursor_ > 0) moveTo(cursor_-1, echo);
+		break;
+	case 'H':
+		moveTo(0, echo);
+		break;
+	case 'F':
+		moveTo(len_, echo);
+		break;
+	case '~':
+		if(csiParam_ == 1 || csiParam_ == 7) moveTo(0, echo);
+		else if(csiParam_ == 4 || csiParam_ == 8) moveTo(len_, echo);
+		else if(csiParam_ == 3 && cursor_ < len_) erase(cursor_, 1, echo);
+		break;
+	default:
+		break;
+	}
+}
+
+void bb::LineEditor::inputTelnet(uint8_t c) {
+	switch(state_) {
+	case STATE_NORMAL:
+		state_ = STATE_IAC;
+		break;
+	case STATE_IAC:
+		if(c >= TELNET_WILL && c <= TELNET_DONT) {
+			telnetVerb_ = c;
+			state_ = STATE_IAC_OPT;
+		} else if(c == TELNET_SB) {
+			state_ = STATE_IAC_SB;
+		} else {
+			state_ = STATE_NORMAL; // two byte command, or an escaped 0xff, which we don't take as input
+		}
+		break;
+	case STATE_IAC_OPT:
+		if(c == TELNET_OPT_ECHO) {
+			if(telnetVerb_ == TELNET_DO) telnetEcho_ = true;
+			else if(telnetVerb_ == TELNET_DONT) telnetEcho_ = false;
+		}
+		state_ = STATE_NORMAL;
+		break;
+	case STATE_IAC_SB:
+		if(c == TELNET_IAC) state_ = STATE_IAC_SB_IAC;
+		break;
+	case STATE_IAC_SB_IAC:
+		state_ = (c == TELNET_SE) ? STATE_NORMAL : STATE_IAC_SB;
+		break;
+	default:
+		state_ = STATE_NORMAL;
+		break;
+	}
+}
+
+void bb::LineEditor::cursorLeft(size_t n, ConsoleStream *echo) {
+	if(echo == NULL || n == 0) return;
+	char buf[12];
+	echo->write(buf, formatCursorLeft(n, buf, sizeof(buf)));
+}
+
+// Backspaces for short moves, CSI n D for longer ones. Returns the length, or 0 if it doesn't fit.
+size_t bb::LineEditor::formatCursorLeft(size_t n, char *buf, size_t size) {
+	if(n <= 4) {
+		if(n > size) return 0;
+		memcpy(buf, "\b\b\b\b", n);
+		return n;
+	}
+	int len = snprintf(buf, size, "\x1b[%uD", (unsigned)n);
+	return (len < 0 || (size_t)len >= size) ? 0 : len;
+}
+
+void bb::LineEditor::insert(char c, ConsoleStream *echo) {
+	if(len_ >= CONSOLE_LINE_SIZE - 1) return;
+	memmove(line_ + cursor_ + 1, line_ + cursor_, len_ - cursor_);
+	line_[cursor_] = c;
+	len_++;
+	if(echo) echo->write(line_ + cursor_, len_ - cursor_);
+	cursor_++;
+	cursorLeft(len_ - cursor_, echo);
+}
+
+// Removes n characters at from, and leaves the cursor there. The cursor must be at or behind from.
+void bb::LineEditor::erase(size_t from, size_t n, ConsoleStream *echo) {
+	if(n == 0) return;
+	memmove(line_ + from, line_ + from + n, len_ - from - n);
+	len_ -= n;
+
+	if(echo) {
+		cursorLeft(cursor_ - from, echo);
+		echo->write(line_ + from, len_ - from);
+		if(n < 3) {
+			echo->write("  ", n);
+			cursorLeft(len_ - from + n, echo);
+		} else {
+			echo->print("\x1b[K");
+			cursorLeft(len_ - from, echo);
+		}
+	}
+	cursor_ = from;
+}
+
+void bb::LineEditor::moveTo(size_t pos, ConsoleStream *echo) {
+	if(pos < cursor_) cursorLeft(cursor_ - pos, echo);
+	else if(pos > cursor_ && echo) echo->write(line_ + cursor_, pos - cursor_);
+	cursor_ = pos;
+}
+
+// Replaces the line with str, rewriting only from the first character that differs.
+void bb::LineEditor::replace(const char *str, ConsoleStream *echo) {
+	size_t newLen = strlen(str);
+	if(newLen > CONSOLE_LINE_SIZE - 1) newLen = CONSOLE_LINE_SIZE - 1;
+	size_t same = 0;
+	while(same < newLen && same < len_ && line_[same] == str[same]) same++;
+
+	moveTo(same, echo);
+	memcpy(line_ + same, str + same, newLen - same);
+	if(echo) {
+		echo->write(line_ + same, newLen - same);
+		if(newLen < len_) echo->print("\x1b[K");
+	}
+	len_ = cursor_ = newLen;
+}
+
+void bb::LineEditor::redraw(ConsoleStream *echo, const char *prompt) {
+	if(echo == NULL) return;
+	char buf[CONSOLE_LINE_SIZE + 32];
+	echo->write(buf, formatRedraw(buf, sizeof(buf), prompt));
+}
+
+size_t bb::LineEditor::formatRedraw(char *buf, size_t size, const char *prompt) {
+	int len = snprintf(buf, size, "\r%s%.*s\x1b[K", prompt, (int)len_, line_);
+	if(len < 0 || (size_t)len >= size) return 0;
+	if(cursor_ == len_) return len;
+	size_t left = formatCursorLeft(len_ - cursor_, buf + len, size - len);
+	return left == 0 ? 0 : len + left;
+}
+
+void bb::LineEditor::addToHistory() {
+	if(len_ == 0 || len_ + 1 > CONSOLE_HISTORY_SIZE) return;
+
+	if(historyLen_ > 0) {
+		size_t last = historyLen_ - 1;
+		while(last > 0 && history_[last-1] != '\0') last--;
+		if(strcmp(history_ + last, line_) == 0) return;
+	}
+
+	while(historyLen_ + len_ + 1 > CONSOLE_HISTORY_SIZE) {
+		size_t oldest = strlen(history_) + 1;
+		memmove(history_, history_ + oldest, historyLen_ - oldest);
+		historyLen_ -= oldest;
+	}
+	memcpy(history_ + historyLen_, line_, len_ + 1);
+	historyLen_ += len_ + 1;
+}
+
+void bb::LineEditor::historyUp(ConsoleStream *echo) {
+	if(historyPos_ == 0) return;
+	if(historyPos_ == historyLen_) {
+		memcpy(draft_, line_, len_);
+		draft_[len_] = '\0';
+	}
+	size_t pos = historyPos_ - 1;
+	while(pos > 0 && history_[pos-1] != '\0') pos--;
+	historyPos_ = pos;
+	replace(history_ + pos, echo);
+}
+
+void bb::LineEditor::historyDown(ConsoleStream *echo) {
+	if(historyPos_ >= historyLen_) return;
+	historyPos_ += strlen(history_ + historyPos_) + 1;
+	replace(historyPos_ < historyLen_ ? history_ + historyPos_ : draft_, echo);
+}
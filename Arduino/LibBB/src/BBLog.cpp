@@ -0,0 +1,162 @@
+#include "BBLog.h"
+#include "BBConsole.h"
+#include "BBRunloop.h"
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE - 1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+static_assert(LOG_BUFFER_SIZE >= bb::Log::MAX_RECORD_SIZE, "LOG_BUFFER_SIZE must hold at least one record");
+
+static const uint32_t LOG_MASK = LOG_BUFFER_SIZE - 1;
+
+bb::Log bb::Log::log;
+
+const bb::ConsoleCommand bb::Log::commandTable_[] = {
+	{"benchmark", "|i", BB_CONSOLE_HANDLER(Log, handleBenchmarkCommand),
+		"benchmark [n]: Compare the cost of n BB_LOG() calls with n printfBroadcast() calls"},
+	{"dump",      "|i", BB_CONSOLE_HANDLER(Log, handleDumpCommand),
+		"dump [offset]: Print the records from offset on as hex, one record per line"}
+};
+
+bb::Log::Log() {
+	name_ = "log";
+	description_ = "Binary deferred formatting log";
+	help_ = "Keeps the most recent BB_LOG() messages in binary form. Decode them on the host with\r\n" \
+	"DroidGUI/LogDecoder.py, over the command server or from the output of \"dump\".";
+
+	head_ = tail_ = lastReadEnd_ = 0;
+	records_ = overwritten_ = 0;
+	dumpStream_ = NULL;
+	dumpOffset_ = dumpEnd_ = 0;
+	setCommands(commandTable_);
+}
+
+bb::Result bb::Log::start(ConsoleStream *stream) {
+	(void)stream;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::Log::stop(ConsoleStream *stream) {
+	(void)stream;
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+	return RES_OK;
+}
+
+bb::Result bb::Log::step() {
+	return RES_OK;
+}
+
+void bb::Log::append(uint32_t id, uint8_t *record, size_t len) {
+	uint32_t t = micros();
+	record[0] = len;
+	for(int i=0; i<4; i++) {
+		record[1+i] = (id >> (8*i)) & 0xff;
+		record[5+i] = (t >> (8*i)) & 0xff;
+	}
+
+	// Make room by dropping the oldest records
+	while(head_ + len - tail_ > LOG_BUFFER_SIZE) {
+		tail_ += buf_[tail_ & LOG_MASK];
+		overwritten_++;
+	}
+
+	size_t pos = head_ & LOG_MASK;
+	size_t first = (pos + len > LOG_BUFFER_SIZE) ? LOG_BUFFER_SIZE - pos : len;
+	memcpy(buf_ + pos, record, first);
+	memcpy(buf_, record + first, len - first);
+	head_ += len;
+	records_++;
+}
+
+size_t bb::Log::read(uint32_t& offset, uint8_t *buf, size_t maxlen) {
+	if((int32_t)(offset - tail_) < 0 || (int32_t)(head_ - offset) < 0) {
+		offset = tail_;
+	} else if(offset != head_ && offset != lastReadEnd_) {
+		// Offsets come from clients and may point into a record. Walk the records to the next boundary, unless
+		// offset is where the last read stopped, which is the common case and known to be one.
+		uint32_t pos = tail_;
+		while((int32_t)(offset - pos) > 0) pos += buf_[pos & LOG_MASK];
+		offset = pos;
+	}
+
+	size_t len = 0;
+	uint32_t pos = offset;
+	while(pos != head_) {
+		size_t recordLen = buf_[pos & LOG_MASK];
+		if(len + recordLen > maxlen) break;
+		for(size_t i=0; i<recordLen; i++) buf[len++] = buf_[(pos + i) & LOG_MASK];
+		pos += recordLen;
+	}
+	lastReadEnd_ = pos;
+	return len;
+}
+
+// The dump is a console report, a record per item, so that a full log goes out over several cycles. It ends at the
+// end of the log as it was when the command came in, so that it finishes even while new records keep coming.
+bb::Result bb::Log::handleDumpCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(stream == NULL) return RES_OK;
+
+	// One dump at a time; a new one takes over from the one running on another stream
+	if(dumpStream_ != NULL && dumpStream_ != stream && Console::console.reportRunning(dumpStream_)) {
+		Console::console.cancelReport(dumpStream_);
+	}
+	dumpOffset_ = args.size() == 2 ? args[1].toInt() : tail_;
+	read(dumpOffset_, NULL, 0); // only moves the offset to a record boundary
+	dumpEnd_ = head_;
+	dumpStream_ = stream;
+	Console::console.startReport(stream, REPORT_SUBSYS, this);
+	return RES_OK;
+}
+
+bool bb::Log::printReportItem(ConsoleStream *stream, size_t item) {
+	(void)item;
+	if(stream != dumpStream_) return false;
+
+	if((int32_t)(dumpOffset_ - tail_) < 0) dumpOffset_ = tail_; // overwritten while dumping
+	if((int32_t)(dumpEnd_ - dumpOffset_) <= 0) {
+		stream->printf("next offset 0x%lx\n", (unsigned long)dumpOffset_);
+		dumpStream_ = NULL;
+		return true;
+	}
+
+	static const char hex[] = "0123456789abcdef";
+	char line[2*MAX_RECORD_SIZE + 1];
+	size_t len = buf_[dumpOffset_ & LOG_MASK];
+	for(size_t i=0; i<len; i++) {
+		uint8_t b = buf_[(dumpOffset_ + i) & LOG_MASK];
+		line[2*i] = hex[b >> 4];
+		line[2*i+1] = hex[b & 0xf];
+	}
+	line[2*len] = 0;
+	stream->printf("%08lx:%s\n", (unsigned long)dumpOffset_, line);
+	dumpOffset_ += len;
+	return true;
+}
+
+bb::Result bb::Log::handleBenchmarkCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	long iterations = args.size() == 2 ? args[1].toInt() : 10;
+	if(iterations <= 0 || iterations > 100) return RES_CMD_INVALID_ARGUMENT;
+	float f = 0.5;
+
+	unsigned long us = micros();
+	for(long i=0; i<iterations; i++) BB_LOG("Benchmark %d: %f\n", i, f*i);
+	unsigned long logUS = micros() - us;
+
+	us = micros();
+	for(long i=0; i<iterations; i++) Console::console.printfBroadcast("Benchmark %d: %f\n", i, f*i);
+	unsigned long printfUS = micros() - us;
+
+	if(stream != NULL) {
+		stream->printf("%ld calls: BB_LOG() %.2fus/call, printfBroadcast() %.2fus/call\n", iterations,
+			(float)logUS / iterations, (float)printfUS / iterations);
+	}
+	Runloop::runloop.excuseOverrun();
+	return RES_OK;
+}
+
+void bb::Log::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	stream->printf("%s: %lu records logged, %lu overwritten, %lu bytes in buffer (offsets 0x%lx-0x%lx)\n", name(),
+		records_, overwritten_, (unsigned long)(head_ - tail_), (unsigned long)tail_, (unsigned long)head_);
+}
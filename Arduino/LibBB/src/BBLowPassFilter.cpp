@@ -1,69 +1,64 @@
 #include <BBLowPassFilter.h>
 #include <Arduino.h>
 
-bb::LowPassFilter::LowPassFilter(float cutoff, float sampleFreq, bool adaptive) {
-	cutoff_ = cutoff;
-	sampleFreq_ = sampleFreq;
+template<typename T> bb::BasicLowPassFilter<T>::BasicLowPassFilter(float cutoff, float sampleFreq, bool adaptive) {
     adapt_ = adaptive;
-
-    needsRecalc_ = true;
-
-    dt_ = 1.0/sampleFreq_;
-    tn1_ = -dt_;
     for(int k = 0; k < 3; k++){
-        x_[k] = 0;
-        y_[k] = 0;        
+        x_[k] = T(0);
+        y_[k] = T(0);
     }
+    setCutoff(cutoff);
+    setSampleFrequency(sampleFreq);
     computeCoefficients();
 }
 
-void bb::LowPassFilter::setCutoff(float cutoff) {
+template<typename T> void bb::BasicLowPassFilter<T>::setCutoff(float cutoff) {
 	cutoff_ = cutoff;
+	omega0_ = T(6.28318530718f*cutoff_);
 	needsRecalc_ = true;
 }
 
-void bb::LowPassFilter::setSampleFrequency(float sampleFreq) {
+template<typename T> void bb::BasicLowPassFilter<T>::setSampleFrequency(float sampleFreq) {
 	sampleFreq_ = sampleFreq;
-    dt_ = 1.0/sampleFreq_;
-    tn1_ = -dt_;
+    dt_ = T(1.0f/sampleFreq_);
+    lastUS_ = 0;
 	needsRecalc_ = true;
 }
 
-void bb::LowPassFilter::setAdaptive(bool adaptive) {
+template<typename T> void bb::BasicLowPassFilter<T>::setAdaptive(bool adaptive) {
 	adapt_ = adaptive;
 	needsRecalc_ = true;
 }
 
 
-void bb::LowPassFilter::computeCoefficients() {
-	omega0_ = 6.28318530718*cutoff_;
-
+template<typename T> void bb::BasicLowPassFilter<T>::computeCoefficients() {
 	if(adapt_){
-        float t = micros()/1.0e6;
-        dt_ = t - tn1_;
-        tn1_ = t;
+        // The first sample after (re)configuration uses the nominal sample frequency
+        unsigned long us = micros();
+        if(lastUS_ != 0) dt_ = secondsFromMicros<T>(us - lastUS_);
+        lastUS_ = us;
 	}
       
-	float alpha = omega0_*dt_;
-    float alphaSq = alpha*alpha;
-    float beta[] = {1, sqrt(2), 1};
-    float D = alphaSq*beta[0] + 2*alpha*beta[1] + 4*beta[2];
-    b_[0] = alphaSq/D;
-    b_[1] = 2*b_[0];
+	// beta = {1, sqrt(2), 1}; one division, shared by all coefficients
+	T alpha = omega0_*dt_;
+    T alphaSq = alpha*alpha;
+    T invD = T(1) / (alphaSq + T(2.82842712f)*alpha + T(4));
+    b_[0] = alphaSq*invD;
+    b_[1] = b_[0] + b_[0];
     b_[2] = b_[0];
-    a_[0] = -(2*alphaSq*beta[0] - 8*beta[2])/D;
-    a_[1] = -(beta[0]*alphaSq - 2*beta[1]*alpha + 4*beta[2])/D;      
+    a_[0] = (T(8) - alphaSq - alphaSq)*invD;
+    a_[1] = -(alphaSq - T(2.82842712f)*alpha + T(4))*invD;
 }
 
-float bb::LowPassFilter::filter(float xn) {
+template<typename T> float bb::BasicLowPassFilter<T>::filter(float xn) {
 	// Provide me with the current raw value: x
 	// I will give you the current filtered value: y
 	if(adapt_ || needsRecalc_){
 		computeCoefficients(); // Update coefficients if necessary   
 		needsRecalc_ = false;   
 	}
-	y_[0] = 0;
-	x_[0] = xn;
+	y_[0] = T(0);
+	x_[0] = T(xn);
 	// Compute the filtered values
 	for(int k = 0; k < 2; k++){
 		y_[0] += a_[k]*y_[k+1] + b_[k]*x_[k];
@@ -77,5 +72,8 @@ float bb::LowPassFilter::filter(float xn) {
 	}
 
 	// Return the filtered value    
-	return y_[0];
+	return float(y_[0]);
 }
+
+template class bb::BasicLowPassFilter<float>;
+template class bb::BasicLowPassFilter<bb::Q16_16>;
@@ -0,0 +1,72 @@
+#include "BBMadgwick.h"
+
+template<typename T> bb::BasicMadgwickFilter<T>::BasicMadgwickFilter() {
+	beta_ = T(0.1f);
+	q0_ = T(1); q1_ = q2_ = q3_ = T(0);
+	invSampleFreq_ = T(1.0f / 512.0f);
+	anglesComputed_ = false;
+}
+
+template<typename T> void bb::BasicMadgwickFilter<T>::begin(float sampleFrequency) {
+	invSampleFreq_ = T(1.0f / sampleFrequency);
+}
+
+template<typename T> void bb::BasicMadgwickFilter<T>::updateIMU(float gx, float gy, float gz, float ax, float ay, float az) {
+	const T half(0.5f);
+
+	// Degrees to radians before conversion, 2000dps doesn't fit into Q8.24
+	T wx(gx * 0.0174533f), wy(gy * 0.0174533f), wz(gz * 0.0174533f);
+
+	// Rate of change of quaternion from gyroscope
+	T qDot1 = half * (-q1_ * wx - q2_ * wy - q3_ * wz);
+	T qDot2 = half * (q0_ * wx + q2_ * wz - q3_ * wy);
+	T qDot3 = half * (q0_ * wy - q1_ * wz + q3_ * wx);
+	T qDot4 = half * (q0_ * wz + q1_ * wy - q2_ * wx);
+
+	// Corrective step, only if the accelerometer measurement is valid (avoids NaN in normalisation)
+	if(!((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+		// Normalise in float: raw counts or m/s^2 don't fit into Q8.24, the unit vector does
+		normalize(ax, ay, az);
+		T x(ax), y(ay), z(az);
+
+		// Auxiliary variables; multiples by addition, which is cheaper than a multiplication in fixed point
+		T _2q0 = q0_ + q0_, _2q1 = q1_ + q1_, _2q2 = q2_ + q2_, _2q3 = q3_ + q3_;
+		T _4q0 = _2q0 + _2q0, _4q1 = _2q1 + _2q1, _4q2 = _2q2 + _2q2, _4q3 = _2q3 + _2q3;
+		T _8q1 = _4q1 + _4q1, _8q2 = _4q2 + _4q2;
+		T q0q0 = q0_ * q0_, q1q1 = q1_ * q1_, q2q2 = q2_ * q2_, q3q3 = q3_ * q3_;
+
+		// Gradient descent corrective step
+		T s0 = _4q0 * q2q2 + _2q2 * x + _4q0 * q1q1 - _2q1 * y;
+		T s1 = _4q1 * q3q3 - _2q3 * x + _4q1 * q0q0 - _2q0 * y - _4q1 + _8q1 * q1q1 + _8q1 * q2q2 + _4q1 * z;
+		T s2 = _4q2 * q0q0 + _2q0 * x + _4q2 * q3q3 - _2q3 * y - _4q2 + _8q2 * q1q1 + _8q2 * q2q2 + _4q2 * z;
+		T s3 = (q1q1 + q2q2) * _4q3 - _2q1 * x - _2q2 * y;
+		normalize(s0, s1, s2, s3);
+
+		qDot1 -= beta_ * s0;
+		qDot2 -= beta_ * s1;
+		qDot3 -= beta_ * s2;
+		qDot4 -= beta_ * s3;
+	}
+
+	// Integrate rate of change of quaternion to yield quaternion, and normalise
+	q0_ += qDot1 * invSampleFreq_;
+	q1_ += qDot2 * invSampleFreq_;
+	q2_ += qDot3 * invSampleFreq_;
+	q3_ += qDot4 * invSampleFreq_;
+
+	normalize(q0_, q1_, q2_, q3_);
+	anglesComputed_ = false;
+}
+
+template<typename T> void bb::BasicMadgwickFilter<T>::computeAngles() {
+	if(anglesComputed_) return;
+	float q0 = float(q0_), q1 = float(q1_), q2 = float(q2_), q3 = float(q3_);
+	roll_ = atan2f(q0*q1 + q2*q3, 0.5f - q1*q1 - q2*q2);
+	pitch_ = asinf(-2.0f * (q1*q3 - q0*q2));
+	yaw_ = atan2f(q1*q2 + q0*q3, 0.5f - q2*q2 - q3*q3);
+	anglesComputed_ = true;
+}
+
+template class bb::BasicMadgwickFilter<float>;
+template class bb::BasicMadgwickFilter<bb::Q16_16>;
+template class bb::BasicMadgwickFilter<bb::Q8_24>;
@@ -43,8 +43,110 @@ static uint8_t calcCRC7(const uint8_t *buffer, size_t len) {
 	return crc;
 }
 
-uint8_t bb::Packet::calculateCRC() {
-	return calcCRC7((const uint8_t*)this, sizeof(Packet));
+#define BB_CONTROL_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_CONTROL_PACKET_FIELDS(F)
+#define BB_STATE_BATTERY_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_STATE_PACKET_FIELDS(F) BB_STATE_BATTERY_FIELDS(F)
+#define BB_STATE_DRIVE_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_STATE_PACKET_FIELDS(F) BB_STATE_DRIVE_FIELDS(F)
+#define BB_CONFIG_ID_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_CONFIG_PACKET_FIELDS(F) BB_CONFIG_ID_FIELDS(F)
+#define BB_CONFIG_CONTROL_MODE_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_CONFIG_PACKET_FIELDS(F) BB_CONFIG_CONTROL_MODE_FIELDS(F)
+#define BB_CONFIG_SUPERFRAME_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_CONFIG_PACKET_FIELDS(F) BB_CONFIG_SUPERFRAME_FIELDS(F)
+#define BB_PAIRING_WIRE(F) BB_PACKET_HEADER_FIELDS(F) BB_PAIRING_PACKET_FIELDS(F)
+
+BB_CHECK_LAYOUT(BB_CONTROL_WIRE, "Control packet");
+BB_CHECK_LAYOUT(BB_STATE_BATTERY_WIRE, "Battery state packet");
+BB_CHECK_LAYOUT(BB_STATE_DRIVE_WIRE, "Drive state packet");
+BB_CHECK_LAYOUT(BB_CONFIG_ID_WIRE, "ID config packet");
+BB_CHECK_LAYOUT(BB_CONFIG_CONTROL_MODE_WIRE, "Control mode config packet");
+BB_CHECK_LAYOUT(BB_CONFIG_SUPERFRAME_WIRE, "Superframe config packet");
+BB_CHECK_LAYOUT(BB_PAIRING_WIRE, "Pairing packet");
+
+static void encodeControl(const bb::ControlPacket& obj, uint8_t *buf) {
+	BB_CONTROL_PACKET_FIELDS(BB_ENCODE_FIELD)
+}
+
+static void decodeControl(bb::ControlPacket& obj, const uint8_t *buf) {
+	BB_CONTROL_PACKET_FIELDS(BB_DECODE_FIELD)
+}
+
+static void encodeState(const bb::StatePacket& obj, uint8_t *buf) {
+	BB_STATE_PACKET_FIELDS(BB_ENCODE_FIELD)
+	switch(obj.item) {
+	case bb::StatePacket::STATE_BATTERY: BB_STATE_BATTERY_FIELDS(BB_ENCODE_FIELD) break;
+	case bb::StatePacket::STATE_DRIVE: BB_STATE_DRIVE_FIELDS(BB_ENCODE_FIELD) break;
+	default: break;
+	}
+}
+
+static void decodeState(bb::StatePacket& obj, const uint8_t *buf) {
+	BB_STATE_PACKET_FIELDS(BB_DECODE_FIELD)
+	switch(obj.item) {
+	case bb::StatePacket::STATE_BATTERY: BB_STATE_BATTERY_FIELDS(BB_DECODE_FIELD) break;
+	case bb::StatePacket::STATE_DRIVE: BB_STATE_DRIVE_FIELDS(BB_DECODE_FIELD) break;
+	default: break;
+	}
+}
+
+static void encodeConfig(const bb::ConfigPacket& obj, uint8_t *buf) {
+	BB_CONFIG_PACKET_FIELDS(BB_ENCODE_FIELD)
+	switch(obj.type) {
+	case bb::ConfigPacket::CONFIG_SET_LEFT_REMOTE_ID:
+	case bb::ConfigPacket::CONFIG_SET_DROID_ID: BB_CONFIG_ID_FIELDS(BB_ENCODE_FIELD) break;
+	case bb::ConfigPacket::CONFIG_SET_CONTROL_MODE: BB_CONFIG_CONTROL_MODE_FIELDS(BB_ENCODE_FIELD) break;
+	case bb::ConfigPacket::CONFIG_SUPERFRAME_BEACON: BB_CONFIG_SUPERFRAME_FIELDS(BB_ENCODE_FIELD) break;
+	default: break;
+	}
+}
+
+static void decodeConfig(bb::ConfigPacket& obj, const uint8_t *buf) {
+	BB_CONFIG_PACKET_FIELDS(BB_DECODE_FIELD)
+	switch(obj.type) {
+	case bb::ConfigPacket::CONFIG_SET_LEFT_REMOTE_ID:
+	case bb::ConfigPacket::CONFIG_SET_DROID_ID: BB_CONFIG_ID_FIELDS(BB_DECODE_FIELD) break;
+	case bb::ConfigPacket::CONFIG_SET_CONTROL_MODE: BB_CONFIG_CONTROL_MODE_FIELDS(BB_DECODE_FIELD) break;
+	case bb::ConfigPacket::CONFIG_SUPERFRAME_BEACON: BB_CONFIG_SUPERFRAME_FIELDS(BB_DECODE_FIELD) break;
+	default: break;
+	}
+}
+
+void bb::Packet::encode(uint8_t buf[SIZE]) const {
+	const Packet& obj = *this;
+	memset(buf, 0, SIZE);
+	BB_PACKET_HEADER_FIELDS(BB_ENCODE_FIELD)
+
+	switch(type) {
+	case PACKET_TYPE_CONTROL: encodeControl(payload.control, buf); break;
+	case PACKET_TYPE_STATE: encodeState(payload.state, buf); break;
+	case PACKET_TYPE_CONFIG: encodeConfig(payload.config, buf); break;
+	case PACKET_TYPE_PAIRING: 
+	default: {
+		const PairingPacket& obj = payload.pairing;
+		BB_PAIRING_PACKET_FIELDS(BB_ENCODE_FIELD)
+		break;
+	}
+	}
+}
+
+void bb::Packet::decode(const uint8_t buf[SIZE]) {
+	Packet& obj = *this;
+	memset(this, 0, sizeof(Packet));
+	BB_PACKET_HEADER_FIELDS(BB_DECODE_FIELD)
+
+	switch(type) {
+	case PACKET_TYPE_CONTROL: decodeControl(payload.control, buf); break;
+	case PACKET_TYPE_STATE: decodeState(payload.state, buf); break;
+	case PACKET_TYPE_CONFIG: decodeConfig(payload.config, buf); break;
+	case PACKET_TYPE_PAIRING: 
+	default: {
+		PairingPacket& obj = payload.pairing;
+		BB_PAIRING_PACKET_FIELDS(BB_DECODE_FIELD)
+		break;
+	}
+	}
+}
+
+uint8_t bb::Packet::calculateCRC() const {
+	uint8_t buf[SIZE];
+	encode(buf);
+	return calcCRC7(buf, SIZE);
 }
 
 bb::Result bb::PacketReceiver::incomingPacket(uint16_t station, uint8_t rssi, const Packet& packet) {
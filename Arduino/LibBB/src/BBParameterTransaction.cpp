@@ -0,0 +1,129 @@
+#include "BBParameterTransaction.h"
+#include "BBConsole.h"
+#include "BBRunloop.h"
+
+bb::ParameterTransaction bb::ParameterTransaction::transaction;
+
+bb::ParameterTransaction::ParameterTransaction() {
+	numStaged_ = 0;
+	stringsLen_ = 0;
+	committed_ = false;
+	commitID_ = appliedID_ = 0;
+	lastResult_ = RES_OK;
+}
+
+bb::Result bb::ParameterTransaction::stage(Subsystem *subsys, size_t index, ParameterValue value) {
+	if(committed_) return RES_SUBSYS_WRONG_MODE;
+	Result res = subsys->checkParameter(index, value);
+	if(res != RES_OK) return res;
+
+	size_t i;
+	for(i=0; i<numStaged_; i++) {
+		if(entries_[i].subsys == subsys && entries_[i].index == index) break;
+	}
+	if(i == PARAMETER_TRANSACTION_SIZE) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+
+	if(value.type == PARAMETER_STRING) {
+		// The string staged before for this parameter makes room, if there is one
+		size_t len = strlen(value.s) + 1, released = 0;
+		if(i < numStaged_) released = strlen(entries_[i].value.s) + 1;
+		if(stringsLen_ - released + len > PARAMETER_TRANSACTION_STRING_SIZE) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+		if(i < numStaged_) removeString(entries_[i].value.s);
+		memcpy(strings_ + stringsLen_, value.s, len);
+		value.s = strings_ + stringsLen_;
+		stringsLen_ += len;
+	}
+
+	entries_[i].subsys = subsys;
+	entries_[i].index = index;
+	entries_[i].value = value;
+	if(i == numStaged_) numStaged_++;
+	return RES_OK;
+}
+
+bb::Result bb::ParameterTransaction::stageValue(Subsystem *subsys, const char *name, const char *value) {
+	int index = subsys->parameterIndex(name);
+	if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+	ParameterValue v;
+	Result res = subsys->parseParameter(index, value, v);
+	if(res != RES_OK) return res;
+	return stage(subsys, index, v);
+}
+
+// Takes str out of strings_, moving the strings behind it down
+void bb::ParameterTransaction::removeString(const char *str) {
+	size_t offset = str - strings_, len = strlen(str) + 1;
+	memmove(strings_ + offset, strings_ + offset + len, stringsLen_ - offset - len);
+	stringsLen_ -= len;
+	for(size_t i=0; i<numStaged_; i++) {
+		Entry& e = entries_[i];
+		if(e.value.type == PARAMETER_STRING && e.value.s > str) e.value.s -= len;
+	}
+}
+
+bb::Result bb::ParameterTransaction::commit(uint16_t& id) {
+	if(committed_) return RES_SUBSYS_WRONG_MODE;
+	committed_ = true;
+	id = ++commitID_;
+	if(!Runloop::runloop.isStarted()) apply();
+	return RES_OK;
+}
+
+bb::Result bb::ParameterTransaction::abort() {
+	if(committed_) return RES_SUBSYS_WRONG_MODE;
+	numStaged_ = 0;
+	stringsLen_ = 0;
+	return RES_OK;
+}
+
+void bb::ParameterTransaction::apply() {
+	if(!committed_) return;
+
+	for(size_t i=0; i<numStaged_; i++) entries_[i].subsys->storeParameter(entries_[i].index, entries_[i].value);
+
+	// One parametersChanged() per subsystem, in staging order
+	lastResult_ = RES_OK;
+	uint8_t indices[PARAMETER_TRANSACTION_SIZE];
+	for(size_t i=0; i<numStaged_; i++) {
+		Subsystem *subsys = entries_[i].subsys;
+		if(subsys == NULL) continue;
+		size_t num = 0;
+		for(size_t j=i; j<numStaged_; j++) {
+			if(entries_[j].subsys != subsys) continue;
+			indices[num++] = entries_[j].index;
+			entries_[j].subsys = NULL;
+		}
+		Result res = subsys->parametersChanged(indices, num);
+		if(lastResult_ == RES_OK) lastResult_ = res;
+	}
+
+	numStaged_ = 0;
+	stringsLen_ = 0;
+	appliedID_ = commitID_;
+	committed_ = false;
+}
+
+void bb::ParameterTransaction::printStaged(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	if(numStaged_ == 0) stream->printf("Nothing staged.\n");
+	for(size_t i=0; i<numStaged_; i++) {
+		const Entry& e = entries_[i];
+		stream->printf("%s %s = ", e.subsys->name(), e.subsys->parameter(e.index)->name);
+		switch(e.value.type) {
+		case PARAMETER_INT:
+			stream->printf("%d\n", e.value.i);
+			break;
+		case PARAMETER_FLOAT:
+			stream->printf("%f\n", e.value.f);
+			break;
+		case PARAMETER_BOOL:
+			stream->printf(e.value.b ? "true\n" : "false\n");
+			break;
+		default:
+			stream->printf("\"%s\"\n", e.value.s);
+			break;
+		}
+	}
+	if(committed_) stream->printf("Committed, applied at the next cycle.\n");
+	stream->printf("Last commit: %s\n", errorMessage(lastResult_));
+}
@@ -2,18 +2,26 @@
 #include <limits.h>
 #include "BBRunloop.h"
 #include "BBConsole.h"
+#include "BBLog.h"
+#include "BBParameterTransaction.h"
+#include "BBConfigStorage.h"
 
 bb::Runloop bb::Runloop::runloop;
 
+const bb::ConsoleCommand bb::Runloop::commandTable_[] = {
+	{"running_status", "b", BB_CONSOLE_HANDLER(Runloop, handleRunningStatusCommand),
+		"running_status on|off: Print running status on timing"}
+};
+
 bb::Runloop::Runloop() {
 	name_ = "runloop";
 	description_ = "Main runloop";
 	help_ = "Started once after all subsystems are added. Its start() only returns if stop() is called.\n"\
-"Commands:\n"\
-"\trunning_status [on|off]: Print running status on timing";
+"Cycle overruns are reported in the binary log (see BBLog.h).";
 	cycleTime_ = DEFAULT_CYCLETIME;
 	runningStatus_ = false;
 	excuseOverrun_ = false;
+	setCommands(commandTable_);
 }
 
 bb::Result bb::Runloop::start(ConsoleStream* stream) {
@@ -28,7 +36,10 @@ bb::Result bb::Runloop::start(ConsoleStream* stream) {
 		unsigned long micros_start_loop = micros();
 		seqnum_++;
 
-		// First of all run any timed callbacks...
+		// First of all apply committed parameter changes, so that all of this cycle sees the same values...
+		ParameterTransaction::transaction.apply();
+
+		// ...then run any timed callbacks...
 		uint64_t m = millis();
 		for(std::vector<TimedCallback>::iterator iter = timedCallbacks_.begin(); iter != timedCallbacks_.end(); iter++) {
 			if(iter->triggerMS < m) { // FIXME there is highly likely an integer wrap in here...?
@@ -39,21 +50,23 @@ bb::Result bb::Runloop::start(ConsoleStream* stream) {
 		}
 
 		// ...then run step() on all subsystems...
-		std::vector<String> timingInfo;
-
 		std::vector<Subsystem*> subsys = SubsystemManager::manager.subsystems();
-		for(auto& s: subsys) {
+		stepTimes_.resize(subsys.size());
+		for(size_t i=0; i<subsys.size(); i++) {
+			Subsystem *s = subsys[i];
 			unsigned long us = micros();
 			if(s->isStarted() && s->operationStatus() == RES_OK) {
 				//Console::console.printfBroadcast("Calling step() in %s...", s->name());
 				s->step();
 				//Console::console.printfBroadcast("done.\n");
 			}
-			String str = String(s->name())  + ": " + (micros()-us) + "us ";
-			timingInfo.push_back(str);
-			if(runningStatus_) Console::console.printfBroadcast(str.c_str());
+			stepTimes_[i] = micros()-us;
+			if(runningStatus_) Console::console.printfBroadcast("%s: %luus ", s->name(), stepTimes_[i]);
 		}
 
+		// ...do a bit of pending flash work...
+		ConfigStorage::storage.step();
+
 		// ...find out how long we took...
 		unsigned long micros_end_loop = micros();
 		unsigned long looptime;
@@ -61,18 +74,15 @@ bb::Result bb::Runloop::start(ConsoleStream* stream) {
 			looptime = micros_end_loop - micros_start_loop;
 		else
 			looptime = ULONG_MAX - micros_start_loop + micros_end_loop;
-		if(runningStatus_) Console::console.printfBroadcast("Total: %dus", looptime);
+		if(runningStatus_) Console::console.printfBroadcast("Total: %luus\n", looptime);
 
 		// ...and bicker if we overran the allotted time.
 		if(looptime <= cycleTime_) {
 			delayMicroseconds(cycleTime_-looptime);
 		} else if(excuseOverrun_ == false) {
-			Console::console.printfBroadcast("%dus spent in loop: ", looptime);
-			for(auto& t: timingInfo) {
-				Console::console.printfBroadcast(t.c_str());
-				Console::console.printfBroadcast(" ");
-			}
-			Console::console.printfBroadcast("\n");
+			// Logged rather than printed - formatting this costs more than the overrun itself on small MCUs.
+			BB_LOG("%luus spent in loop\n", looptime);
+			for(size_t i=0; i<subsys.size(); i++) BB_LOG("  %s: %luus\n", subsys[i]->name(), stepTimes_[i]);
 		}
 
 		excuseOverrun_ = false;
@@ -93,14 +103,10 @@ bb::Result bb::Runloop::step() {
 	return RES_OK;
 }
 
-bb::Result bb::Runloop::handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
-	if(words[0] == "running_status") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		runningStatus_ = words[1] == "on" ? true : false;
-		return RES_OK;
-	}
-
-	return bb::Subsystem::handleConsoleCommand(words, stream);;
+bb::Result bb::Runloop::handleRunningStatusCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	runningStatus_ = args[1].toBool();
+	return RES_OK;
 }
 
 void bb::Runloop::setCycleTimeMicros(unsigned int t) {
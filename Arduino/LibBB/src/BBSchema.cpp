@@ -0,0 +1,118 @@
+#include "BBSchema.h"
+#include "BBTelemetry.h"
+
+#include <stddef.h>
+
+#define BB_SCHEMA_MEMBER_TYPE(member) std::remove_reference<decltype(((bb::LargeStatePacket*)0)->member)>::type
+#define BB_SCHEMA_TELEMETRY_FIELD(member, scale) \
+	{ #member, bb::SchemaFieldType<BB_SCHEMA_MEMBER_TYPE(member)>::value, offsetof(bb::LargeStatePacket, member), scale },
+
+const bb::Schema::TelemetryField bb::Schema::telemetryFields[] = {
+	BB_TELEMETRY_FIELDS(BB_SCHEMA_TELEMETRY_FIELD)
+};
+
+static_assert(sizeof(bb::Schema::telemetryFields) / sizeof(bb::Schema::telemetryFields[0]) == bb::TelemetryEncoder::NUM_FIELDS,
+              "schema and telemetry encoder disagree on the number of fields");
+
+#define BB_SCHEMA_PACKET_FIELD(member, offset, width, sgn) { #member, offset, width, sgn },
+#define BB_SCHEMA_PACKET_FIELDS(table) \
+	static const bb::Schema::PacketField table##_fields[] = { BB_##table##_FIELDS(BB_SCHEMA_PACKET_FIELD) };
+#define BB_SCHEMA_PACKET_TABLE(table) { #table, table##_fields, sizeof(table##_fields) / sizeof(table##_fields[0]) },
+
+BB_PACKET_TABLES(BB_SCHEMA_PACKET_FIELDS)
+
+const bb::Schema::PacketTable bb::Schema::packetTables[] = {
+	BB_PACKET_TABLES(BB_SCHEMA_PACKET_TABLE)
+};
+
+const size_t bb::Schema::NUM_PACKET_TABLES = sizeof(bb::Schema::packetTables) / sizeof(bb::Schema::packetTables[0]);
+
+// Walks the descriptor byte by byte, copying the bytes inside the requested window and hashing all of them.
+class DescriptorWriter {
+public:
+	DescriptorWriter(size_t offset = 0, uint8_t *buf = NULL, size_t len = 0):
+		pos_(0), offset_(offset), buf_(buf), len_(len), hash_(2166136261UL) {}
+
+	void u8(uint8_t b) {
+		if(buf_ != NULL && pos_ >= offset_ && pos_ < offset_ + len_) buf_[pos_ - offset_] = b;
+		hash_ = (hash_ ^ b) * 16777619UL;
+		pos_++;
+	}
+	void u16(uint16_t v) { u8(v & 0xff); u8(v >> 8); }
+	void u32(uint32_t v) { u16(v & 0xffff); u16(v >> 16); }
+	void str(const char *s) {
+		size_t n = strlen(s);
+		u8(n);
+		for(size_t i=0; i<n; i++) u8(s[i]);
+	}
+
+	size_t pos() { return pos_; }
+	uint16_t hash() { return (hash_ >> 16) ^ (hash_ & 0xffff); }
+
+protected:
+	size_t pos_, offset_;
+	uint8_t *buf_;
+	size_t len_;
+	uint32_t hash_;
+};
+
+static void writeDescriptor(DescriptorWriter& w) {
+	w.u8(bb::Schema::VERSION);
+	w.u16(sizeof(bb::LargeStatePacket));
+	w.u16(offsetof(bb::LargeStatePacket, droidName));
+	w.u8(sizeof(((bb::LargeStatePacket*)0)->droidName));
+
+	w.u8(bb::TelemetryEncoder::NUM_FIELDS);
+	for(size_t i=0; i<bb::TelemetryEncoder::NUM_FIELDS; i++) {
+		const bb::Schema::TelemetryField& f = bb::Schema::telemetryFields[i];
+		uint32_t scale;
+		memcpy(&scale, &f.scale, sizeof(scale));
+		w.str(f.name);
+		w.u8(f.type);
+		w.u16(f.offset);
+		w.u32(scale);
+	}
+
+	w.u8(bb::Schema::NUM_PACKET_TABLES);
+	for(size_t i=0; i<bb::Schema::NUM_PACKET_TABLES; i++) {
+		const bb::Schema::PacketTable& t = bb::Schema::packetTables[i];
+		w.str(t.name);
+		w.u8(t.numFields);
+		for(size_t j=0; j<t.numFields; j++) {
+			w.str(t.fields[j].name);
+			w.u8(t.fields[j].offset);
+			w.u8(t.fields[j].width);
+			w.u8(t.fields[j].isSigned);
+		}
+	}
+}
+
+uint16_t bb::Schema::id() {
+	static bool computed = false;
+	static uint16_t id;
+	if(!computed) {
+		DescriptorWriter w;
+		writeDescriptor(w);
+		id = w.hash();
+		computed = true;
+	}
+	return id;
+}
+
+size_t bb::Schema::size() {
+	static size_t size = 0;
+	if(size == 0) {
+		DescriptorWriter w;
+		writeDescriptor(w);
+		size = w.pos();
+	}
+	return size;
+}
+
+size_t bb::Schema::read(size_t offset, uint8_t *buf, size_t len) {
+	if(offset >= size()) return 0;
+	if(len > size() - offset) len = size() - offset;
+	DescriptorWriter w(offset, buf, len);
+	writeDescriptor(w);
+	return len;
+}
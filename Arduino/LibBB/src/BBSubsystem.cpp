@@ -1,87 +1,173 @@
 #include "BBSubsystem.h"
 #include "BBConsole.h"	
+#include <errno.h>
 
-#if defined(ARDUINO_ARCH_RP2040)
-#include <EEPROM.h>
-#elif defined(ARDUINO_ARCH_MBED_NANO)
-#include <FlashAsEEPROM.h>
-#endif
+static_assert((SUBSYSTEM_INDEX_SIZE & (SUBSYSTEM_INDEX_SIZE - 1)) == 0, "SUBSYSTEM_INDEX_SIZE must be a power of two");
 
 bb::SubsystemManager bb::SubsystemManager::manager;
 	
 bb::Result bb::SubsystemManager::registerSubsystem(Subsystem* subsys) {
 	if(subsystemWithName(subsys->name()) != NULL) return RES_SUBSYS_ALREADY_REGISTERED; // already have this
+	if(subsys_.size() >= SUBSYSTEM_INDEX_SIZE - 1) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+
+	size_t i = hash(subsys->name());
+	while(index_[i & (SUBSYSTEM_INDEX_SIZE-1)] != NULL) i++;
+	index_[i & (SUBSYSTEM_INDEX_SIZE-1)] = subsys;
 	subsys_.push_back(subsys);
 	return RES_OK;
 }
 	
-bb::Subsystem* bb::SubsystemManager::subsystemWithName(const String& name) {
-	for(size_t i=0; i<subsys_.size(); i++) {
-		if(subsys_[i]->name() == name) return subsys_[i];
+bb::Subsystem* bb::SubsystemManager::subsystemWithName(const char* name) {
+	for(size_t i = hash(name); index_[i & (SUBSYSTEM_INDEX_SIZE-1)] != NULL; i++) {
+		Subsystem *s = index_[i & (SUBSYSTEM_INDEX_SIZE-1)];
+		if(strcmp(s->name(), name) == 0) return s;
 	}
 	return NULL;
 }
 
+uint32_t bb::SubsystemManager::hash(const char *name) {
+	uint32_t h = 2166136261UL;
+	for(; *name; name++) h = (h ^ (uint8_t)*name) * 16777619UL;
+	return h;
+}
+
 const std::vector<bb::Subsystem*>& bb::SubsystemManager::subsystems() {
 	return subsys_;
 }
 
 
 bb::SubsystemManager::SubsystemManager() {
+	for(auto& s: index_) s = NULL;
 }
 
-bb::Result bb::Subsystem::handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
-	if(words[0] == "help") {
-		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		printHelp(stream);
-		return RES_OK;
-	} 
-
-	else if(words[0] == "status") {
-		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		printStatus(stream);
-		return RES_OK;
-	} 
-
-	else if(words[0] == "start") {
-		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		if(isStarted()) stream->printf("%s is already running.", name());
-		else {
-			stream->printf("Starting %s...", name());
-			stream->printf(errorMessage(start(stream)));
-			stream->printf("\n");
-		}
-		return RES_OK;
-	} 
-
-	else if(words[0] == "stop") {
-		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		if(!isStarted()) stream->printf("%s is not running.", name());
-		else {
-			stream->printf("Stopping %s...", name());
-			stream->printf(errorMessage(stop(stream)));
-			stream->printf("\n");
-		}
-		return RES_OK;
-	} 
-
-	else if(words[0] == "get") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		for(auto& p: parameters_) {
-			if(p->name() == words[1]) {
-				p->print(stream);
-				return RES_OK;
-			}
+const bb::ConsoleArg bb::ConsoleArgs::empty_;
+
+long bb::ConsoleArg::toInt() const {
+	const char *s = str_;
+	if(*s == '-' || *s == '+') s++;
+	if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) return strtol(str_, NULL, 16);
+	return strtol(str_, NULL, 10);
+}
+
+bool bb::ConsoleArg::isInt() const {
+	if(len_ == 0) return false;
+	char *end;
+	const char *s = str_;
+	if(*s == '-' || *s == '+') s++;
+	if(s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) strtol(str_, &end, 16);
+	else strtol(str_, &end, 10);
+	return *end == 0;
+}
+
+bool bb::ConsoleArg::isFloat() const {
+	if(len_ == 0) return false;
+	char *end;
+	strtod(str_, &end);
+	return *end == 0;
+}
+
+bool bb::ConsoleArg::isBool() const {
+	return toBool() || *this == "off" || *this == "false" || *this == "0";
+}
+
+const bb::ConsoleCommand bb::Subsystem::standardCommands_[] = {
+	{"get",    "s",  BB_CONSOLE_HANDLER(Subsystem, handleGetCommand),    "get <param>: Print parameter value"},
+	{"help",   "",   BB_CONSOLE_HANDLER(Subsystem, handleHelpCommand),   "help: Print this help"},
+	{"set",    "ss", BB_CONSOLE_HANDLER(Subsystem, handleSetCommand),    "set <param> <value>: Set parameter value"},
+	{"start",  "",   BB_CONSOLE_HANDLER(Subsystem, handleStartCommand),  "start: Start the subsystem"},
+	{"status", "",   BB_CONSOLE_HANDLER(Subsystem, handleStatusCommand), "status: Print status"},
+	{"stop",   "",   BB_CONSOLE_HANDLER(Subsystem, handleStopCommand),   "stop: Stop the subsystem"}
+};
+const size_t bb::Subsystem::numStandardCommands_ = sizeof(standardCommands_)/sizeof(standardCommands_[0]);
+
+const bb::ConsoleCommand* bb::Subsystem::findCommand(const ConsoleCommand *commands, size_t num, const ConsoleArg& name) {
+	size_t lo = 0, hi = num;
+	while(lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		int cmp = strcmp(name.c_str(), commands[mid].name);
+		if(cmp == 0) return &commands[mid];
+		if(cmp < 0) hi = mid;
+		else lo = mid + 1;
+	}
+	return NULL;
+}
+
+bb::Result bb::Subsystem::checkArguments(const char *signature, const ConsoleArgs& args) {
+	bool optional = false;
+	size_t i = 1;
+	for(const char *c = signature; *c; c++) {
+		if(*c == '|') {
+			optional = true;
+			continue;
 		}
-		return RES_PARAM_NO_SUCH_PARAMETER;
+		if(*c == '*') return RES_OK;
+		if(i >= args.size()) return optional ? RES_OK : RES_CMD_INVALID_ARGUMENT_COUNT;
+		const ConsoleArg& arg = args[i++];
+		if((*c == 'i' && !arg.isInt()) || (*c == 'f' && !arg.isFloat()) || (*c == 'b' && !arg.isBool()))
+			return RES_CMD_INVALID_ARGUMENT;
+	}
+	return i == args.size() ? RES_OK : RES_CMD_INVALID_ARGUMENT_COUNT;
+}
+
+bb::Result bb::Subsystem::runCommand(const ConsoleCommand& command, const ConsoleArgs& args, ConsoleStream *stream) {
+	Result res = checkArguments(command.args, args);
+	if(res != RES_OK) return res;
+	return (this->*command.handler)(args, stream);
+}
+
+bb::Result bb::Subsystem::handleConsoleCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(args.size() == 0) return RES_CMD_INVALID_ARGUMENT_COUNT;
+
+	const ConsoleCommand *command = findCommand(commands_, numCommands_, args[0]);
+	if(command == NULL) command = findCommand(standardCommands_, numStandardCommands_, args[0]);
+	if(command == NULL) return RES_CMD_UNKNOWN_COMMAND;
+	return runCommand(*command, args, stream);
+}
+
+bb::Result bb::Subsystem::handleHelpCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	if(stream != NULL) Console::console.startReport(stream, REPORT_SUBSYS_HELP, this);
+	return RES_OK;
+}
+
+bb::Result bb::Subsystem::handleStatusCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	printStatus(stream);
+	return RES_OK;
+}
+
+bb::Result bb::Subsystem::handleStartCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	if(isStarted()) stream->printf("%s is already running.", name());
+	else {
+		stream->printf("Starting %s...", name());
+		stream->printf(errorMessage(start(stream)));
+		stream->printf("\n");
 	}
+	return RES_OK;
+}
 
-	else if(words[0] == "set") {
-		if(words.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		return setParameterValue(words[1], words[2]);
+bb::Result bb::Subsystem::handleStopCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	if(!isStarted()) stream->printf("%s is not running.", name());
+	else {
+		stream->printf("Stopping %s...", name());
+		stream->printf(errorMessage(stop(stream)));
+		stream->printf("\n");
 	}
+	return RES_OK;
+}
 
-	return RES_CMD_UNKNOWN_COMMAND;
+bb::Result bb::Subsystem::handleGetCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	int index = parameterIndex(args[1].c_str());
+	if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+	printParameter(stream, index);
+	return RES_OK;
+}
+
+bb::Result bb::Subsystem::handleSetCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	return setParameterValue(args[1].c_str(), args[2].c_str());
 }
 
 void bb::Subsystem::printStatus(ConsoleStream* stream) {
@@ -103,63 +189,277 @@ void bb::Subsystem::printStatus(ConsoleStream* stream) {
 }
 
 void bb::Subsystem::printHelp(ConsoleStream* stream) {
-	stream->printf(help());
-	if(parameters_.size()) {
-		stream->printf("Parameters:\n");
-		printParameters(stream);
-	} else {
-		stream->printf("No parameters.\n");
+	for(size_t item=0; printHelpItem(stream, item); item++);
+}
+
+bool bb::Subsystem::printHelpItem(ConsoleStream* stream, size_t item) {
+	if(item == 0) {
+		stream->printf(help());
+		size_t len = strlen(help());
+		if(len > 0 && help()[len-1] != '\n') stream->printf("\n");
+		return true;
+	}
+	item--;
+
+	if(item < numCommands_) {
+		if(item == 0) stream->printf("Commands:\n");
+		stream->printf("\t%s\n", commands_[item].help);
+		return true;
 	}
+	item -= numCommands_;
+
+	if(numParameters_ == 0) {
+		if(item == 0) stream->printf("No parameters.\n");
+		return item == 0;
+	}
+	if(item < numParameters_) {
+		if(item == 0) stream->printf("Parameters:\n");
+		printParameter(stream, item);
+		return true;
+	}
+	return false;
+}
+
+bool bb::Subsystem::printReportItem(ConsoleStream* stream, size_t item) {
+	(void)stream;
+	(void)item;
+	return false;
 }
 
 void bb::Subsystem::printParameters(ConsoleStream* stream) {
-	for(auto &p: parameters_) {
-		p->print(stream);
-	}	
+	for(size_t i=0; i<numParameters_; i++) printParameter(stream, i);
 }
 
+bb::Result bb::Subsystem::setParameters(const ParameterDescription *params, size_t num) {
+	if(num > 254) return RES_COMMON_OUT_OF_RANGE;
 
-bb::Subsystem::Parameter* bb::Subsystem::findParameter(const String& name) {
-	for(auto p: parameters_) {
-		if(p->name() == name) return p;
+	size_t size = 4;
+	while(size < 2*num) size *= 2;
+	if(size != parameterIndexMask_ + 1) {
+		delete[] parameterIndex_;
+		parameterIndex_ = new uint8_t[size];
+		parameterIndexMask_ = size - 1;
 	}
-	return NULL;
+	memset(parameterIndex_, 0, size);
+	parameters_ = params;
+	numParameters_ = num;
+
+	for(size_t i=0; i<num; i++) {
+		if(parameterIndex(params[i].name) >= 0) {
+			numParameters_ = i;
+			return RES_COMMON_DUPLICATE_IN_LIST;
+		}
+		size_t slot = SubsystemManager::hash(params[i].name) & parameterIndexMask_;
+		while(parameterIndex_[slot] != 0) slot = (slot + 1) & parameterIndexMask_;
+		parameterIndex_[slot] = i + 1;
+	}
+	return RES_OK;
 }
 
+int bb::Subsystem::parameterIndex(const char *name) {
+	if(parameterIndex_ == NULL) return -1;
+	for(size_t slot = SubsystemManager::hash(name) & parameterIndexMask_; parameterIndex_[slot] != 0;
+		slot = (slot + 1) & parameterIndexMask_) {
+		size_t index = parameterIndex_[slot] - 1;
+		if(strcmp(parameters_[index].name, name) == 0) return index;
+	}
+	return -1;
+}
 
-bb::Result bb::Subsystem::addParameter(const String& name, const String& help, int& val, int min, int max) {
-	if(findParameter(name) != NULL) return RES_COMMON_DUPLICATE_IN_LIST;
-	parameters_.push_back(new IntParameter(name, val, help, min, max));
+bb::Result bb::Subsystem::checkParameter(size_t index, ParameterValue& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
+	const ParameterDescription& p = parameters_[index];
+	if(p.type == PARAMETER_FLOAT && value.type == PARAMETER_INT) {
+		value.type = PARAMETER_FLOAT;
+		value.f = value.i;
+	}
+	if(p.type != value.type) return RES_PARAM_INVALID_TYPE;
+
+	switch(p.type) {
+	case PARAMETER_INT:
+		if(value.i < p.min || value.i > p.max) return RES_COMMON_OUT_OF_RANGE;
+		break;
+	case PARAMETER_FLOAT:
+		if(!(value.f >= p.min && value.f <= p.max)) return RES_COMMON_OUT_OF_RANGE; // also catches NaN
+		break;
+	case PARAMETER_STRING:
+		if(value.s == NULL || strlen(value.s) > p.max) return RES_COMMON_OUT_OF_RANGE;
+		break;
+	default:
+		break;
+	}
 	return RES_OK;
 }
 
-bb::Result bb::Subsystem::addParameter(const String& name, const String& help, float& val, float min, float max) {
-	if(findParameter(name) != NULL) return RES_COMMON_DUPLICATE_IN_LIST;
-	parameters_.push_back(new FloatParameter(name, val, help, min, max));
+void bb::Subsystem::storeParameter(size_t index, const ParameterValue& value) {
+	const ParameterDescription& p = parameters_[index];
+	switch(p.type) {
+	case PARAMETER_INT:
+		*(int*)p.value = value.i;
+		break;
+	case PARAMETER_FLOAT:
+		*(float*)p.value = value.f;
+		break;
+	case PARAMETER_BOOL:
+		*(bool*)p.value = value.b;
+		break;
+	default:
+		memcpy(p.value, value.s, strlen(value.s) + 1);
+		break;
+	}
+}
+
+bb::Result bb::Subsystem::setParameter(size_t index, ParameterValue value) {
+	Result res = checkParameter(index, value);
+	if(res != RES_OK) return res;
+	storeParameter(index, value);
+	uint8_t i = index;
+	return parametersChanged(&i, 1);
+}
+
+bb::Result bb::Subsystem::parametersChanged(const uint8_t *indices, size_t num) {
+	Result res = RES_OK;
+	for(size_t i=0; i<num; i++) {
+		Result r = parameterChanged(parameters_[indices[i]].name);
+		if(res == RES_OK) res = r;
+	}
+	return res;
+}
+
+bb::Result bb::Subsystem::setParameter(size_t index, int value) {
+	ParameterValue v;
+	v.type = PARAMETER_INT;
+	v.i = value;
+	return setParameter(index, v);
+}
+
+bb::Result bb::Subsystem::setParameter(size_t index, float value) {
+	ParameterValue v;
+	v.type = PARAMETER_FLOAT;
+	v.f = value;
+	return setParameter(index, v);
+}
+
+bb::Result bb::Subsystem::setParameter(size_t index, bool value) {
+	ParameterValue v;
+	v.type = PARAMETER_BOOL;
+	v.b = value;
+	return setParameter(index, v);
+}
+
+bb::Result bb::Subsystem::setParameter(size_t index, const char *value) {
+	ParameterValue v;
+	v.type = PARAMETER_STRING;
+	v.s = value;
+	return setParameter(index, v);
+}
+
+bb::Result bb::Subsystem::getParameter(size_t index, int& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
+	if(parameters_[index].type != PARAMETER_INT) return RES_PARAM_INVALID_TYPE;
+	value = *(int*)parameters_[index].value;
+	return RES_OK;
+}
+
+bb::Result bb::Subsystem::getParameter(size_t index, float& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
+	if(parameters_[index].type != PARAMETER_FLOAT) return RES_PARAM_INVALID_TYPE;
+	value = *(float*)parameters_[index].value;
 	return RES_OK;
 }
 
-bb::Result bb::Subsystem::addParameter(const String& name, const String& help, String& val, int maxlen) {
-	if(findParameter(name) != NULL) return RES_COMMON_DUPLICATE_IN_LIST;
-	parameters_.push_back(new StringParameter(name, val, help, maxlen));
+bb::Result bb::Subsystem::getParameter(size_t index, bool& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
+	if(parameters_[index].type != PARAMETER_BOOL) return RES_PARAM_INVALID_TYPE;
+	value = *(bool*)parameters_[index].value;
 	return RES_OK;
 }
 
-bb::Result bb::Subsystem::addParameter(const String& name, const String& help, bool& val) {
-	if(findParameter(name) != NULL) return RES_COMMON_DUPLICATE_IN_LIST;
-	parameters_.push_back(new BoolParameter(name, val, help));
-	return RES_OK;	
+bb::Result bb::Subsystem::getParameter(size_t index, const char*& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
+	if(parameters_[index].type != PARAMETER_STRING) return RES_PARAM_INVALID_TYPE;
+	value = (const char*)parameters_[index].value;
+	return RES_OK;
 }
 
+bb::Result bb::Subsystem::parseParameter(size_t index, const char *str, ParameterValue& value) {
+	if(index >= numParameters_) return RES_PARAM_NO_SUCH_PARAMETER;
 
-bb::Result bb::Subsystem::setParameterValue(const String& name, const String& stringval) {
-	Parameter* p = findParameter(name);
-	if(p == NULL) return RES_PARAM_NO_SUCH_PARAMETER;
-	bb::Result retval = p->fromString(stringval);
-	return retval;
+	char *end;
+	value.type = parameters_[index].type;
+	switch(value.type) {
+	case PARAMETER_INT: {
+		// Decimal or 0x hex, but not octal: "010" is 10
+		const char *digits = (*str == '-' || *str == '+') ? str + 1 : str;
+		bool hex = digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X');
+		errno = 0;
+		long l = strtol(str, &end, hex ? 16 : 10);
+		if(end == str || *end != '\0' || errno == ERANGE || l < INT_MIN || l > INT_MAX) return RES_PARAM_INVALID_VALUE;
+		value.i = l;
+		break;
+	}
+	case PARAMETER_FLOAT:
+		value.f = strtod(str, &end);
+		if(end == str || *end != '\0') return RES_PARAM_INVALID_VALUE;
+		break;
+	case PARAMETER_BOOL:
+		if(!strcmp(str, "true") || !strcmp(str, "on") || !strcmp(str, "yes") || !strcmp(str, "1")) {
+			value.b = true;
+		} else if(!strcmp(str, "false") || !strcmp(str, "off") || !strcmp(str, "no") || !strcmp(str, "0")) {
+			value.b = false;
+		} else {
+			return RES_PARAM_INVALID_VALUE;
+		}
+		break;
+	default:
+		value.s = str;
+		break;
+	}
+	return checkParameter(index, value);
 }
 
-const void bb::Subsystem::Parameter::print(ConsoleStream* stream) {
-	if(stream) stream->printf("%s: %s\n", name_.c_str(), description().c_str());
+bb::Result bb::Subsystem::setParameterValue(const char *name, const char *value) {
+	int index = parameterIndex(name);
+	if(index < 0) return RES_PARAM_NO_SUCH_PARAMETER;
+
+	ParameterValue v;
+	Result res = parseParameter(index, value, v);
+	if(res != RES_OK) return res;
+	storeParameter(index, v);
+	uint8_t i = index;
+	return parametersChanged(&i, 1);
+}
+
+static void printLimit(bb::ConsoleStream *stream, float limit, bool isInt) {
+	if(limit <= (float)INT_MIN) stream->printf("-inf");
+	else if(limit >= (float)INT_MAX) stream->printf("inf");
+	else if(isInt) stream->printf("%ld", (long)limit);
+	else stream->printf("%g", limit);
+}
+
+void bb::Subsystem::printParameter(ConsoleStream* stream, size_t index) {
+	if(stream == NULL || index >= numParameters_) return;
+	const ParameterDescription& p = parameters_[index];
+
+	stream->printf("%s: ", p.name);
+	switch(p.type) {
+	case PARAMETER_INT:
+	case PARAMETER_FLOAT:
+		if(p.type == PARAMETER_INT) stream->printf("%d [", *(int*)p.value);
+		else stream->printf("%f [", *(float*)p.value);
+		printLimit(stream, p.min, p.type == PARAMETER_INT);
+		stream->printf("..");
+		printLimit(stream, p.max, p.type == PARAMETER_INT);
+		stream->printf("]");
+		break;
+	case PARAMETER_BOOL:
+		stream->printf(*(bool*)p.value ? "true" : "false");
+		break;
+	default:
+		stream->printf("%s (max length %d)", (const char*)p.value, (int)p.max);
+		break;
+	}
+	if(p.help != NULL && p.help[0] != '\0') stream->printf(": %s", p.help);
+	stream->printf("\n");
 }
 
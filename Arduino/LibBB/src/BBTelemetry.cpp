@@ -0,0 +1,136 @@
+#include "BBTelemetry.h"
+#include "BBSchema.h"
+
+static_assert(bb::TelemetryEncoder::NUM_FIELDS <= 255, "too many telemetry fields for the frame header");
+
+static inline int32_t toFixedValue(float value, float scale) {
+	float f = value * scale;
+	if(f != f) return 0; // NaN
+	if(f >= 2147483520.0f) return INT32_MAX;
+	if(f <= -2147483520.0f) return INT32_MIN;
+	return (int32_t)(f < 0 ? f - 0.5f : f + 0.5f);
+}
+
+static inline size_t putVarint(uint8_t *buf, int32_t value) {
+	uint32_t v = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31); // zigzag
+	size_t len = 0;
+	while(v >= 0x80) {
+		buf[len++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	buf[len++] = (uint8_t)v;
+	return len;
+}
+
+bb::TelemetryEncoder::TelemetryEncoder(unsigned int keyframeInterval) {
+	keyframeInterval_ = keyframeInterval;
+	sinceKeyframe_ = 0;
+	needKeyframe_ = true;
+	seqnum_ = keyframeSeqnum_ = 0;
+	keyframeSize_ = 0;
+	frames_ = keyframes_ = bytes_ = 0;
+	memset(keyframe_, 0, sizeof(keyframe_));
+	memset(mask_, 0, sizeof(mask_));
+	setFieldMask(NULL);
+}
+
+void bb::TelemetryEncoder::setFieldMask(const uint8_t *mask) {
+	uint8_t m[BITMAP_SIZE];
+	if(mask == NULL) {
+		memset(m, 0xff, BITMAP_SIZE);
+		if(NUM_FIELDS % 8) m[BITMAP_SIZE-1] = (1 << (NUM_FIELDS % 8)) - 1;
+	} else {
+		memcpy(m, mask, BITMAP_SIZE);
+	}
+	if(memcmp(m, mask_, BITMAP_SIZE) == 0) return;
+	memcpy(mask_, m, BITMAP_SIZE);
+	needKeyframe_ = true;
+}
+
+void bb::TelemetryEncoder::toFixed(const LargeStatePacket& sample, int32_t *values) {
+	size_t n = 0;
+#define BB_TELEMETRY_TO_FIXED(member, scale) values[n++] = toFixedValue(sample.member, scale);
+	BB_TELEMETRY_FIELDS(BB_TELEMETRY_TO_FIXED)
+#undef BB_TELEMETRY_TO_FIXED
+}
+
+size_t bb::TelemetryEncoder::encode(const LargeStatePacket& sample, uint8_t *buf) {
+	int32_t values[NUM_FIELDS];
+	toFixed(sample, values);
+
+	size_t len = 0;
+	if(!keyframeDue()) {
+		len = encodeDelta(values, buf);
+		// Once the delta is as large as a keyframe, the keyframe is the better reference for what follows.
+		if(len >= keyframeSize_) len = 0;
+	}
+	if(len == 0) len = encodeKeyframe(sample, values, buf);
+	else sinceKeyframe_++;
+
+	seqnum_++;
+	frames_++;
+	bytes_ += len;
+	return len;
+}
+
+size_t bb::TelemetryEncoder::encodeKeyframe(const LargeStatePacket& sample, const int32_t *values, uint8_t *buf) {
+	memcpy(keyframe_, values, sizeof(keyframe_));
+	keyframeSeqnum_ = seqnum_;
+	keyframeSize_ = writeKeyframe(sample, buf);
+	sinceKeyframe_ = 0;
+	needKeyframe_ = false;
+	keyframes_++;
+	return keyframeSize_;
+}
+
+size_t bb::TelemetryEncoder::encodeLastKeyframe(const LargeStatePacket& sample, uint8_t *buf) {
+	if(keyframes_ == 0) return 0;
+	return writeKeyframe(sample, buf);
+}
+
+size_t bb::TelemetryEncoder::writeKeyframe(const LargeStatePacket& sample, uint8_t *buf) {
+	buf[0] = MAGIC;
+	buf[1] = FLAG_KEYFRAME;
+	buf[2] = keyframeSeqnum_;
+	buf[3] = keyframeSeqnum_;
+	buf[4] = NUM_FIELDS;
+
+	size_t len = HEADER_SIZE;
+	uint16_t schemaID = Schema::id();
+	buf[len++] = schemaID & 0xff;
+	buf[len++] = schemaID >> 8;
+
+	size_t nameLen = strnlen(sample.droidName, NAME_SIZE);
+	buf[len++] = nameLen;
+	memcpy(buf+len, sample.droidName, nameLen);
+	len += nameLen;
+
+	memcpy(buf+len, mask_, BITMAP_SIZE);
+	len += BITMAP_SIZE;
+
+	for(size_t i=0; i<NUM_FIELDS; i++) {
+		if(isFieldSet(mask_, i)) len += putVarint(buf+len, keyframe_[i]);
+	}
+
+	return len;
+}
+
+size_t bb::TelemetryEncoder::encodeDelta(const int32_t *values, uint8_t *buf) {
+	buf[0] = MAGIC;
+	buf[1] = 0;
+	buf[2] = seqnum_;
+	buf[3] = keyframeSeqnum_;
+	buf[4] = NUM_FIELDS;
+
+	uint8_t *bitmap = buf + HEADER_SIZE;
+	memset(bitmap, 0, BITMAP_SIZE);
+	size_t len = HEADER_SIZE + BITMAP_SIZE;
+
+	for(size_t i=0; i<NUM_FIELDS; i++) {
+		if(!isFieldSet(mask_, i) || values[i] == keyframe_[i]) continue;
+		bitmap[i/8] |= 1 << (i%8);
+		len += putVarint(buf+len, (int32_t)((uint32_t)values[i] - (uint32_t)keyframe_[i])); // wraps, decoder wraps back
+	}
+
+	return len;
+}
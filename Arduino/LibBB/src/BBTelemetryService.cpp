@@ -0,0 +1,232 @@
+#include "BBTelemetryService.h"
+#include "BBRunloop.h"
+
+bb::TelemetryService bb::TelemetryService::telemetry;
+
+const bb::ParameterDescription bb::TelemetryService::parameterTable_[] = {
+	BB_PARAM_INT("max_lease", "Maximum subscription lease in ms", telemetry.maxLeaseMS_, 100, 60000),
+	BB_PARAM_INT("keyframe_interval", "Send a keyframe at least every this many frames", telemetry.keyframeInterval_,
+		1, 1000)
+};
+
+class WifiTelemetryTransport: public bb::TelemetryService::Transport {
+public:
+	virtual bool sendTo(const IPAddress& addr, uint16_t port, const uint8_t *data, size_t len) {
+		return bb::WifiServer::server.streamUDPPacket(addr, port, data, len);
+	}
+};
+
+static WifiTelemetryTransport wifiTransport;
+
+bb::TelemetryService::TelemetryService() {
+	name_ = "telemetry";
+	description_ = "Subscription based telemetry over UDP";
+	help_ = "Sends compact telemetry to clients that have subscribed to it via UDP. Channels are the fields of\r\n" \
+	"BB_TELEMETRY_FIELDS in BBTelemetry.h, in table order.";
+
+	transport_ = NULL;
+	maxLeaseMS_ = 10000;
+	keyframeInterval_ = encoder_.keyframeInterval();
+	requests_ = rejected_ = resyncs_ = 0;
+	for(auto& s: subscribers_) s.active = false;
+	setParameters(parameterTable_);
+}
+
+bb::Result bb::TelemetryService::initialize(Transport *transport) {
+	transport_ = (transport != NULL) ? transport : &wifiTransport;
+	if(transport == NULL) WifiServer::server.addUDPReceiver(this);
+	return Subsystem::initialize();
+}
+
+bb::Result bb::TelemetryService::start(ConsoleStream *stream) {
+	(void)stream;
+	if(transport_ == NULL) return RES_SUBSYS_NOT_INITIALIZED;
+	started_ = true;
+	operationStatus_ = RES_OK;
+	return RES_OK;
+}
+
+bb::Result bb::TelemetryService::stop(ConsoleStream *stream) {
+	(void)stream;
+	for(auto& s: subscribers_) s.active = false;
+	updateMask();
+	started_ = false;
+	operationStatus_ = RES_SUBSYS_NOT_STARTED;
+	return RES_OK;
+}
+
+bb::Result bb::TelemetryService::step() {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+
+	unsigned long now = millis();
+	bool expired = false;
+	for(auto& s: subscribers_) {
+		if(s.active && (long)(now - s.expiresMS) >= 0) {
+			s.active = false;
+			expired = true;
+		}
+	}
+	if(expired) updateMask();
+
+	return RES_OK;
+}
+
+bb::Result bb::TelemetryService::parameterChanged(const char *name) {
+	(void)name;
+	encoder_.setKeyframeInterval(keyframeInterval_);
+	return RES_OK;
+}
+
+void bb::TelemetryService::printStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+
+	stream->printf("%s: %u subscribers, %lu frames (%lu keyframes), ", name(), numSubscribers(), encoder_.frames(),
+		encoder_.keyframes());
+	if(encoder_.frames() > 0) stream->printf("%.1f bytes/frame, ", (float)encoder_.bytes() / encoder_.frames());
+	stream->printf("%lu keyframe resyncs, %lu requests (%lu rejected)\n", resyncs_, requests_, rejected_);
+
+	unsigned long now = millis();
+	for(auto& s: subscribers_) {
+		if(!s.active) continue;
+		unsigned int channels = 0;
+		for(size_t i=0; i<TelemetryEncoder::NUM_FIELDS; i++) if(TelemetryEncoder::isFieldSet(s.mask, i)) channels++;
+		stream->printf("\t%d.%d.%d.%d:%u: %u channels at %.1fHz, %lu frames, lease %lums\n", s.addr[0], s.addr[1],
+			s.addr[2], s.addr[3], s.port, channels, s.periodUS ? 1e6 / s.periodUS : 0.0, s.framesSent, s.expiresMS - now);
+	}
+}
+
+void bb::TelemetryService::incomingUDPPacket(const IPAddress& remoteIP, uint16_t remotePort, const uint8_t *data, size_t len) {
+	if(len < REQUEST_HEADER_SIZE || data[0] != MAGIC) return;
+	requests_++;
+
+	Result res;
+	if(data[1] == REQUEST_SUBSCRIBE) {
+		unsigned int rate = data[2] | (data[3] << 8);
+		unsigned int lease = data[4] | (data[5] << 8);
+		size_t numChannels = data[6];
+		if(len < REQUEST_HEADER_SIZE + numChannels) res = RES_PARAM_INVALID_VALUE;
+		else res = subscribe(remoteIP, remotePort, data + REQUEST_HEADER_SIZE, numChannels, rate, lease);
+	} else if(data[1] == REQUEST_UNSUBSCRIBE) {
+		res = unsubscribe(remoteIP, remotePort);
+	} else {
+		res = RES_PARAM_INVALID_VALUE;
+	}
+
+	if(res != RES_OK) rejected_++;
+}
+
+bb::Result bb::TelemetryService::subscribe(const IPAddress& addr, uint16_t port, const uint8_t *channels, size_t numChannels,
+                                           unsigned int rateHz, unsigned int leaseMS) {
+	if(!started_) return RES_SUBSYS_NOT_STARTED;
+	if(numChannels == 0 || leaseMS == 0) return RES_PARAM_INVALID_VALUE;
+
+	Subscriber *s = findSubscriber(addr, port);
+	bool isNew = (s == NULL);
+	if(isNew) {
+		for(auto& candidate: subscribers_) {
+			if(!candidate.active) {
+				s = &candidate;
+				break;
+			}
+		}
+		if(s == NULL) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
+		s->addr = addr;
+		s->port = port;
+		s->framesSent = 0;
+	}
+
+	memset(s->mask, 0, sizeof(s->mask));
+	for(size_t i=0; i<numChannels; i++) {
+		if(channels[i] < TelemetryEncoder::NUM_FIELDS) s->mask[channels[i]/8] |= 1 << (channels[i]%8);
+	}
+	s->periodUS = (rateHz != 0) ? 1000000UL / rateHz : 0;
+	if(isNew) s->lastSentUS = micros() - s->periodUS; // due right away
+	s->expiresMS = millis() + (leaseMS < (unsigned int)maxLeaseMS_ ? leaseMS : maxLeaseMS_);
+	s->active = true;
+
+	if(isNew) s->keyframe = 0; // needs one; encoder_.keyframes() is never 0 once a frame has been sent
+	updateMask();
+
+	return RES_OK;
+}
+
+bb::Result bb::TelemetryService::unsubscribe(const IPAddress& addr, uint16_t port) {
+	Subscriber *s = findSubscriber(addr, port);
+	if(s == NULL) return RES_COMMON_NOT_IN_LIST;
+	s->active = false;
+	updateMask();
+	return RES_OK;
+}
+
+unsigned int bb::TelemetryService::numSubscribers() {
+	unsigned int num = 0;
+	for(auto& s: subscribers_) if(s.active) num++;
+	return num;
+}
+
+bool bb::TelemetryService::wantsSample() {
+	if(!started_) return false;
+	unsigned long now = micros();
+	for(auto& s: subscribers_) if(s.active && isDue(s, now)) return true;
+	return false;
+}
+
+bb::Result bb::TelemetryService::publish(const LargeStatePacket& sample) {
+	if(!wantsSample()) return RES_OK;
+
+	uint8_t buf[TelemetryEncoder::MAX_FRAME_SIZE];
+	unsigned long now = micros();
+	size_t len = encoder_.encode(sample, buf);
+	unsigned long keyframe = encoder_.keyframes();
+	bool isKeyframe = (buf[1] & TelemetryEncoder::FLAG_KEYFRAME) != 0;
+
+	// Subscribers that have the current keyframe, or get it now, get this frame. The others need the keyframe
+	// first; it takes the place of this frame, so every subscriber still gets one frame per period.
+	bool resync = false;
+	for(auto& s: subscribers_) {
+		if(!s.active || !isDue(s, now)) continue;
+		if(!isKeyframe && s.keyframe != keyframe) {
+			resync = true;
+			continue;
+		}
+		transport_->sendTo(s.addr, s.port, buf, len);
+		s.keyframe = keyframe;
+		s.lastSentUS = now;
+		s.framesSent++;
+	}
+	if(!resync) return RES_OK;
+
+	len = encoder_.encodeLastKeyframe(sample, buf);
+	for(auto& s: subscribers_) {
+		if(!s.active || !isDue(s, now) || s.keyframe == keyframe) continue;
+		transport_->sendTo(s.addr, s.port, buf, len);
+		s.keyframe = keyframe;
+		s.lastSentUS = now;
+		s.framesSent++;
+		resyncs_++;
+	}
+
+	return RES_OK;
+}
+
+bb::TelemetryService::Subscriber* bb::TelemetryService::findSubscriber(const IPAddress& addr, uint16_t port) {
+	for(auto& s: subscribers_) {
+		if(s.active && s.addr == addr && s.port == port) return &s;
+	}
+	return NULL;
+}
+
+bool bb::TelemetryService::isDue(const Subscriber& s, unsigned long nowUS) {
+	// Half a cycle of slack, so a rate that matches the runloop rate doesn't alias down to every other cycle.
+	return (nowUS - s.lastSentUS) + Runloop::runloop.cycleTimeMicros()/2 >= s.periodUS;
+}
+
+void bb::TelemetryService::updateMask() {
+	uint8_t mask[TelemetryEncoder::BITMAP_SIZE];
+	memset(mask, 0, sizeof(mask));
+	for(auto& s: subscribers_) {
+		if(!s.active) continue;
+		for(size_t i=0; i<sizeof(mask); i++) mask[i] |= s.mask[i];
+	}
+	encoder_.setFieldMask(mask);
+}
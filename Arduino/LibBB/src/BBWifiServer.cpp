@@ -1,5 +1,6 @@
 #include <BBWifiServer.h>
 #include <BBRunloop.h>
+#include <BBLog.h>
 #if !defined(ARDUINO_PICO_VERSION_STR)
 #include <ArduinoOTA.h>
 #endif
@@ -10,11 +11,35 @@ String IPAddressToString(const IPAddress& addr) {
 
 bb::WifiServer bb::WifiServer::server;
 
+const bb::ParameterDescription bb::WifiServer::parameterTable_[] = {
+	BB_PARAM_STRING("ssid", "SSID", server.params_.ssid),
+	BB_PARAM_STRING("wpa_key", "WPA Key", server.params_.wpaKey),
+	BB_PARAM_BOOL("ap", "Access Point Mode", server.params_.ap),
+	BB_PARAM_INT("terminal_port", "TCP port to use for terminal access", server.params_.tcpPort, 0, 65535),
+	BB_PARAM_INT("remote_port", "UDP port to use for remote packet publishing", server.params_.udpPort, 0, 65535),
+	BB_PARAM_INT("batch_size", "Maximum size of a batched UDP datagram", server.batchSize_, 64, MAX_BATCH_SIZE),
+	BB_PARAM_INT("batch_age", "Send batched UDP datagrams after this many ms (0 disables batching)", server.batchAgeMS_,
+		0, 1000)
+};
+
 bb::WifiConsoleStream::WifiConsoleStream() {
+	setOverflowPolicy(OVERFLOW_WAIT, 2000);
+	setEcho(true);
 }
 
 void bb::WifiConsoleStream::setClient(const WiFiClient& client) {
 	client_ = client;
+	discardOutput(); // whatever was left was meant for the previous client
+	reportType_ = REPORT_NONE;
+
+	// Ask the telnet client to send characters as they are typed and leave the echo to us. Until it agrees, the
+	// line editor doesn't echo, so clients that keep editing lines locally still work.
+	editor_.reset();
+	editor_.setTelnet(true);
+	size_t len;
+	const uint8_t *negotiation = LineEditor::telnetNegotiation(len);
+	write((const char*)negotiation, len);
+
 	printGreeting();
 }
 
@@ -26,41 +51,37 @@ bool bb::WifiConsoleStream::available() {
 	}
 }
 
-bool bb::WifiConsoleStream::readStringUntil(unsigned char c, String& str) {
-	int timeout = 0;
-	while(true) {
-		if(client_.available()) {
-			unsigned char data = client_.read();
-			str += (char)data;
-			if(data == c) return true;
-		} else {
-			delay(1);
-			timeout++;
-			if(timeout >= 2) return false;
-		}
+char* bb::WifiConsoleStream::readLine() {
+	while(client_.available()) {
+		if(addToLine(client_.read())) return editor_.line();
 	}
+	return NULL;
 }
 
-void bb::WifiConsoleStream::printfFinal(const char* str) {
-	client_.print(str);
+size_t bb::WifiConsoleStream::writeNonBlocking(const uint8_t *buf, size_t len) {
+	if(!client_.connected()) return len; // nobody listening
+	if(len > MAX_WRITE_SIZE) len = MAX_WRITE_SIZE;
+	return client_.write(buf, len);
 }
 
 bb::WifiServer::WifiServer(): tcp_(DEFAULT_TCP_PORT) {
 	name_ = "wifi";
 	help_ = "Creates an AP or joins a network. Starts a shell on TCP.\r\nSSID and WPA Key replacements: $MAC - Mac address";
 	description_ = "Wifi comm module (uninitialized)";
-	
-	addParameter("ssid", "SSID", ssid_);
-	addParameter("wpa_key", "WPA Key", wpaKey_);
-	addParameter("ap", "Access Point Mode", params_.ap);
-	addParameter("terminal_port", "TCP port to use for terminal access", params_.tcpPort, 0, 32767);
-	addParameter("remote_port", "UDP port to use for remote packet publishing", params_.udpPort, 0, 32767);
+	setParameters(parameterTable_);
+
+	batchSize_ = MAX_BATCH_SIZE;
+	batchAgeMS_ = 30;
+	for(auto& s: streams_) s.used = false;
+	udpTransactions_ = udpBytes_ = udpStreamed_ = 0;
+	udpStatsMS_ = udpTransactionsPerSec_ = udpBytesPerSec_ = udpStreamedPerSec_ = 0;
+	udpLastTransactions_ = udpLastBytes_ = udpLastStreamed_ = 0;
 }
 
 bb::Result bb::WifiServer::initialize(const String& ssid, const String& wpakey, bool apmode, uint16_t udpPort, uint16_t tcpPort) {
 	if(operationStatus_ != RES_SUBSYS_NOT_INITIALIZED) return RES_SUBSYS_ALREADY_INITIALIZED;
 
-	paramsHandle_ = ConfigStorage::storage.reserveBlock(sizeof(params_));
+	paramsHandle_ = ConfigStorage::storage.reserveBlock("wifi", 1, sizeof(params_));
 	if(ConfigStorage::storage.blockIsValid(paramsHandle_)) {
 		ConfigStorage::storage.readBlock(paramsHandle_, (uint8_t*)&params_);
 	} else {
@@ -158,6 +179,7 @@ bb::Result bb::WifiServer::stop(ConsoleStream* stream) {
 	client.stop();
 	bb::Console::console.removeConsoleStream(&consoleStream_);
 
+	for(auto& s: streams_) s.used = false;
 	udp_.stop();
 #if !defined(ARDUINO_PICO_VERSION_STR)
 	ArduinoOTA.end();
@@ -203,37 +225,56 @@ bb::Result bb::WifiServer::step() {
 		Console::console.addConsoleStream(&consoleStream_);
 	}
 
+	unsigned long now = millis();
+	for(auto& s: streams_) {
+		if(s.used && s.len > 0 && now - s.firstMS >= (unsigned long)batchAgeMS_) flushUDPStream(s);
+	}
+	if(now - udpStatsMS_ >= 1000) {
+		udpTransactionsPerSec_ = (udpTransactions_ - udpLastTransactions_) * 1000 / (now - udpStatsMS_);
+		udpBytesPerSec_ = (udpBytes_ - udpLastBytes_) * 1000 / (now - udpStatsMS_);
+		udpStreamedPerSec_ = (udpStreamed_ - udpLastStreamed_) * 1000 / (now - udpStatsMS_);
+		udpLastTransactions_ = udpTransactions_;
+		udpLastBytes_ = udpBytes_;
+		udpLastStreamed_ = udpStreamed_;
+		udpStatsMS_ = now;
+	}
+
+	if(udpReceivers_.size() != 0) {
+		uint8_t buf[MAX_UDP_PACKET_SIZE];
+		IPAddress remoteIP;
+		uint16_t remotePort;
+		for(unsigned int i=0; i<MAX_UDP_PACKETS_PER_STEP; i++) {
+			unsigned int len = readDataIfAvailable(buf, sizeof(buf), remoteIP, remotePort);
+			if(len == 0) break;
+			for(auto r: udpReceivers_) r->incomingUDPPacket(remoteIP, remotePort, buf, len);
+		}
+	}
+
 	return RES_OK;
 }
 
-bb::Result bb::WifiServer::setParameterValue(const String& name, const String& value) {
-	Result res = RES_PARAM_NO_SUCH_PARAMETER;
-
-	if(name == "ssid") { 
-		strncpy(params_.ssid, value.c_str(), MAX_STRLEN);
-		res = RES_OK;
-	} else if(name == "wpa_key") {
-		strncpy(params_.wpaKey, value.c_str(), MAX_STRLEN);
-		res = RES_OK;
-	} else if(name == "ap") {
-		if(value == "1") { params_.ap = true; res = RES_OK; }
-		else if(value == "0") { params_.ap = false; res = RES_OK; }
-		else res = RES_PARAM_INVALID_TYPE;
-	} else if(name == "terminal_port") {
-		int v = value.toInt();
-		if(v < 0 || v > 65536) return RES_PARAM_INVALID_VALUE;
-		params_.tcpPort = v;
-		res = RES_OK;
-	} else if(name == "remote_port") {
-		int v = value.toInt();
-		if(v < 0 || v > 65536) return RES_PARAM_INVALID_VALUE;
-		params_.udpPort = v;
-		res = RES_OK;
-	} 
+bb::Result bb::WifiServer::addUDPReceiver(UDPReceiver *receiver) {
+	for(size_t i=0; i<udpReceivers_.size(); i++)
+		if(udpReceivers_[i] == receiver)
+			return RES_COMMON_DUPLICATE_IN_LIST;
+	udpReceivers_.push_back(receiver);
+	return RES_OK;
+}
 
-	if(res == RES_OK) ConfigStorage::storage.writeBlock(paramsHandle_, (uint8_t*)&params_);
+bb::Result bb::WifiServer::removeUDPReceiver(UDPReceiver *receiver) {
+	for(size_t i=0; i<udpReceivers_.size(); i++)
+		if(udpReceivers_[i] == receiver) {
+			udpReceivers_.erase(udpReceivers_.begin()+i);
+			return RES_OK;
+		}
+	return RES_COMMON_NOT_IN_LIST;
+}
 
-	return res;
+bb::Result bb::WifiServer::parameterChanged(const char *name) {
+	if(strcmp(name, "batch_size") && strcmp(name, "batch_age")) {
+		ConfigStorage::storage.writeBlock(paramsHandle_, (uint8_t*)&params_);
+	}
+	return RES_OK;
 }
 
 bb::Result bb::WifiServer::operationStatus() {
@@ -257,23 +298,28 @@ bool bb::WifiServer::broadcastUDPPacket(const uint8_t* packet, size_t len) {
 }
 
 bool bb::WifiServer::sendUDPPacket(const IPAddress& addr, const uint8_t* packet, size_t len) {
+	return sendUDPPacket(addr, params_.udpPort, packet, len);
+}
+
+bool bb::WifiServer::sendUDPPacket(const IPAddress& addr, uint16_t port, const uint8_t* packet, size_t len) {
 	static unsigned int failures = 0;
 
 	if(WiFi.status() != WL_CONNECTED && WiFi.status() != WL_AP_CONNECTED) return false;
-	if(udp_.beginPacket(addr, params_.udpPort) == false) {
-		Console::console.printfBroadcast("beginPacket() failed!\n");
+	if(udp_.beginPacket(addr, port) == false) {
+		BB_LOG("beginPacket() failed!\n");
 		return false;
 	}
 
 	if(udp_.write(packet, len) != len) {
-		Console::console.printfBroadcast("write() failed\n");
+		BB_LOG("write() failed\n");
 		return false;
 	}
 
+	udpTransactions_++;
 	if(udp_.endPacket() == false) {
 		failures++;
 		if(failures > 10) {
-			Console::console.printfBroadcast("endPacket() failed %d times in a row!\n", failures);
+			BB_LOG("endPacket() failed %u times in a row!\n", failures);
 			failures = 0;
 		}
 
@@ -281,15 +327,98 @@ bool bb::WifiServer::sendUDPPacket(const IPAddress& addr, const uint8_t* packet,
 	}
 
 	failures = 0;
+	udpBytes_ += len;
+	return true;
+}
+
+static inline size_t putVarint(uint8_t *buf, uint32_t v) {
+	size_t len = 0;
+	while(v >= 0x80) {
+		buf[len++] = (uint8_t)(v | 0x80);
+		v >>= 7;
+	}
+	buf[len++] = (uint8_t)v;
+	return len;
+}
+
+bool bb::WifiServer::streamUDPPacket(const IPAddress& addr, uint16_t port, const uint8_t* packet, size_t len) {
+	unsigned long us = micros(), ms = millis();
+	udpStreamed_++;
+
+	if(batchAgeMS_ == 0 || len + BATCH_HEADER_SIZE + 6 > (size_t)batchSize_) return sendUDPPacket(addr, port, packet, len);
+
+	UDPStream *s = findUDPStream(addr, port);
+	if(s == NULL) {
+		// Take over the least recently used stream
+		s = &streams_[0];
+		for(auto& candidate: streams_) {
+			if(!candidate.used) {
+				s = &candidate;
+				break;
+			}
+			if(candidate.lastUsedMS - s->lastUsedMS > 0x80000000UL) s = &candidate;
+		}
+		if(s->used && s->len > 0) flushUDPStream(*s);
+		s->used = true;
+		s->addr = addr;
+		s->port = port;
+		s->len = 0;
+	}
+	s->lastUsedMS = ms;
+
+	// 3 bytes of time offset cover 2s, more than any batch age, plus 2 bytes of length
+	if(s->len > 0 && (s->len + 3 + 2 + len > (size_t)batchSize_ || s->buf[1] == 0xff || us - s->firstUS >= (1UL<<21))) {
+		flushUDPStream(*s);
+	}
+
+	if(s->len == 0) {
+		s->buf[0] = BATCH_MAGIC;
+		s->buf[1] = 0;
+		s->buf[2] = us & 0xff;
+		s->buf[3] = (us >> 8) & 0xff;
+		s->buf[4] = (us >> 16) & 0xff;
+		s->buf[5] = (us >> 24) & 0xff;
+		s->len = BATCH_HEADER_SIZE;
+		s->firstUS = us;
+		s->firstMS = ms;
+	}
+
+	s->len += putVarint(s->buf + s->len, us - s->firstUS);
+	s->len += putVarint(s->buf + s->len, len);
+	memcpy(s->buf + s->len, packet, len);
+	s->len += len;
+	s->buf[1]++;
+
+	if(ms - s->firstMS >= (unsigned long)batchAgeMS_) return flushUDPStream(*s);
 	return true;
 }
 
+void bb::WifiServer::flushUDPStreams() {
+	for(auto& s: streams_) {
+		if(s.used && s.len > 0) flushUDPStream(s);
+	}
+}
 
-unsigned int bb::WifiServer::readDataIfAvailable(uint8_t *buf, unsigned int maxsize, IPAddress& remoteIP) {
+bb::WifiServer::UDPStream* bb::WifiServer::findUDPStream(const IPAddress& addr, uint16_t port) {
+	for(auto& s: streams_) {
+		if(s.used && s.addr == addr && s.port == port) return &s;
+	}
+	return NULL;
+}
+
+bool bb::WifiServer::flushUDPStream(UDPStream& stream) {
+	bool retval = sendUDPPacket(stream.addr, stream.port, stream.buf, stream.len);
+	stream.len = 0;
+	return retval;
+}
+
+
+unsigned int bb::WifiServer::readDataIfAvailable(uint8_t *buf, unsigned int maxsize, IPAddress& remoteIP, uint16_t& remotePort) {
 	unsigned int len = udp_.parsePacket();
 	if(!len) return 0;
 	remoteIP = udp_.remoteIP();
-	if(len > maxsize) return len;
+	remotePort = udp_.remotePort();
+	if(len > maxsize) return 0; // too large, dropped by the next parsePacket()
 	if((unsigned int)(udp_.read(buf, maxsize)) != len) { 
 		Serial.print("Huh? Differing sizes?!\n"); 
 		return 0;
@@ -352,5 +481,8 @@ void bb::WifiServer::printStatus(ConsoleStream *stream) {
 		stream->printf(", client %d.%d.%d.%d connected", ip[0], ip[1], ip[2], ip[3]);
 	}
 
+	stream->printf(", UDP: %lu datagrams/s (%lu queued/s), %lu bytes/s", udpTransactionsPerSec_, udpStreamedPerSec_,
+		udpBytesPerSec_);
+
 	stream->printf(".\n");
 }
\ No newline at end of file
@@ -6,9 +6,36 @@
 #include "BBError.h"
 #include "BBConsole.h"
 #include "BBRunloop.h"
+#include "BBLog.h"
 
 bb::XBee bb::XBee::xbee;
 
+const bb::ConsoleCommand bb::XBee::commandTable_[] = {
+	{"api_mode",            "b",    BB_CONSOLE_HANDLER(XBee, handleAPIModeCommand),      "api_mode on|off: Enter / leave API mode"},
+	{"continuous",          "b",    BB_CONSOLE_HANDLER(XBee, handleContinuousCommand),
+		"continuous on|off: Start or stop sending a continuous stream of numbers (or zero command packets when in packet mode)"},
+	{"group",               "|s*",  BB_CONSOLE_HANDLER(XBee, handleGroupCommand),
+		"group [join|leave <group>]: Show group memberships, or join / leave a group\r\n" \
+		"\tgroup transform <group> <axis> <offset> [mirror]: Set transform for control axis received via group"},
+	{"send",                "s",    BB_CONSOLE_HANDLER(XBee, handleSendCommand),         "send <string>: Send string"},
+	{"send_api_packet",     "i",    BB_CONSOLE_HANDLER(XBee, handleSendAPIPacketCommand),
+		"send_api_packet <dest>: Send zero control packet to destination"},
+	{"send_control_packet", "",     BB_CONSOLE_HANDLER(XBee, handleSendControlPacketCommand), "send_control_packet: Send zero control packet"},
+	{"tdma",                "|s",   BB_CONSOLE_HANDLER(XBee, handleTDMACommand),
+		"tdma [on|off|coordinator]: Show TDMA status, or enable slot scheduling as station or coordinator"}
+};
+
+const bb::ParameterDescription bb::XBee::parameterTable_[] = {
+	BB_PARAM_INT("channel", "Communication channel (between 11 and 26, usually 12)", xbee.params_.chan, 11, 26),
+	BB_PARAM_INT("pan", "Personal Area Network ID (16bit, 65535 is broadcast)", xbee.params_.pan, 0, 65535),
+	BB_PARAM_INT("station", "Station ID (MY) for this device (16bit)", xbee.params_.station, 0, 65535),
+	BB_PARAM_INT("bps", "Communication bps rate", xbee.params_.bps, 0, 200000),
+	BB_PARAM_INT("tdma_slots", "Number of slots (runloop cycles) per TDMA superframe, set by the coordinator",
+		xbee.tdmaSlots_, 2, 64),
+	BB_PARAM_INT("tdma_slot", "Fixed TDMA slot 1..tdma_slots-1 for this station (-1 derives it from the station ID)",
+		xbee.tdmaSlotOverride_, -1, 63)
+};
+
 static std::vector<int> baudRatesToTry = { 115200, 9600, 19200, 28800, 38400, 57600, 76800 }; // start with 115200, then try 9600
 
 bb::XBee::XBee() {
@@ -22,20 +49,32 @@ bb::XBee::XBee() {
 	memset(packetBuf_, 0, sizeof(packetBuf_));
 	packetBufPos_ = 0;
 	apiMode_ = false;
+	sendContinuous_ = false;
+	continuous_ = 0;
+	tdma_ = false;
+	tdmaCoordinator_ = false;
+	tdmaSlots_ = DEFAULT_TDMA_SLOTS;
+	tdmaSlotOverride_ = -1;
+	tdmaSynced_ = false;
+	tdmaBeaconCycle_ = 0;
+	tdmaBeaconSeq_ = 0;
+	tdmaNumPending_ = 0;
+	tdmaDeferred_ = 0;
+	tdmaMissedBeacons_ = 0;
+	tdmaDropped_ = 0;
+	tdmaCollisions_ = 0;
+	tdmaCoordinatorStation_ = 0;
+	tdmaCollisionWarned_ = false;
+	packetSource_ = PACKET_SOURCE_DROID;
+	numGroups_ = 0;
+	groupPacketsReceived_ = 0;
 
 	name_ = "xbee";
 	description_ = "Communication via XBee 802.5.14";
-	help_ = "In order for communication to work, the PAN and channel numbers must be identical.\r\n" \
-	"Available commands:\r\n" \
-	"\tcontinuous on|off:  Start or stop sending a continuous stream of numbers (or zero command packets when in packet mode)\r\n"\
-	"\tpacket_mode on|off: Switch to packet mode\r\n" \
-	"\tapi_mode on|off: Enter / leave API mode\r\n" \
-	"\tsend_api_packet <dest>: Send zero control packet to destination\r\n";
+	help_ = "In order for communication to work, the PAN and channel numbers must be identical.\r\n";
+	setCommands(commandTable_);
 
-	addParameter("channel", "Communication channel (between 11 and 26, usually 12)", params_.chan, 11, 26);
-	addParameter("pan", "Personal Area Network ID (16bit, 65535 is broadcast)", params_.pan, 0, 65535);
-	addParameter("station", "Station ID (MY) for this device (16bit)", params_.station, 0, 65535);
-	addParameter("bps", "Communication bps rate", params_.bps, 0, 200000);
+	setParameters(parameterTable_);
 }
 
 bb::XBee::~XBee() {
@@ -44,7 +83,7 @@ bb::XBee::~XBee() {
 bb::Result bb::XBee::initialize(uint8_t chan, uint16_t pan, uint16_t station, uint32_t bps, HardwareSerial *uart) {
 	if(operationStatus_ != RES_SUBSYS_NOT_INITIALIZED) return RES_SUBSYS_ALREADY_INITIALIZED;
 
-	paramsHandle_ = ConfigStorage::storage.reserveBlock(sizeof(params_));
+	paramsHandle_ = ConfigStorage::storage.reserveBlock("xbee", 1, sizeof(params_));
 	if(ConfigStorage::storage.blockIsValid(paramsHandle_)) {
 		Console::console.printfBroadcast("XBee: Storage block is valid\n");
 		ConfigStorage::storage.readBlock(paramsHandle_, (uint8_t*)&params_);
@@ -202,112 +241,119 @@ bb::Result bb::XBee::step() {
 		send(str);			
 	}
 
-	return RES_OK;
-}
-
-bb::Result bb::XBee::parameterValue(const String& name, String& value) {
-	if(name == "channel") { 
-		value = String(params_.chan); return RES_OK; 
-	} else if(name == "pan") {
-		value = String(params_.pan); return RES_OK;
-	} else if(name == "station") {
-		value = String(params_.station); return RES_OK;
-	} else if(name == "bps") {
-		value = String(params_.bps); return RES_OK;
-	} 
+	if(tdma_) {
+		if(tdmaCoordinator_) {
+			if(Runloop::runloop.getSequenceNumber() % tdmaSlots_ == 0) sendBeacon();
+		} else if(tdmaSynced_ && isTDMASynced() == false) {
+			Console::console.printfBroadcast("TDMA: lost beacon, falling back to unscheduled sending.\n");
+			tdmaSynced_ = false;
+			tdmaMissedBeacons_++;
+		}
+		if(tdmaNumPending_ > 0 && (isOwnSlot() || !isTDMASynced())) {
+			flushPending();
+		}
+	}
 
-	return RES_PARAM_NO_SUCH_PARAMETER;
+	return RES_OK;
 }
 
-bb::Result bb::XBee::setParameterValue(const String& name, const String& value) {
-	Result res = RES_PARAM_NO_SUCH_PARAMETER;
-
-	if(name == "channel") { 
-		params_.chan = value.toInt();
-		res = setConnectionInfo(params_.chan, params_.pan, params_.station, false);
-	} else if(name == "pan") {
-		params_.pan = value.toInt();
-		res = setConnectionInfo(params_.chan, params_.pan, params_.station, false);
-	} else if(name == "station") {
-		params_.station = value.toInt();
-		res = setConnectionInfo(params_.chan, params_.pan, params_.station, false);
-	} else if(name == "bps") {
-		params_.bps = value.toInt();
-		res = RES_OK;
+// Channel, PAN and station go to the module in one AT mode session, however many of them changed together
+bb::Result bb::XBee::parametersChanged(const uint8_t *indices, size_t num) {
+	bool connection = false, store = false;
+	for(size_t i=0; i<num; i++) {
+		const char *name = parameter(indices[i])->name;
+		if(!strcmp(name, "channel") || !strcmp(name, "pan") || !strcmp(name, "station")) {
+			connection = store = true;
+		} else if(!strcmp(name, "bps")) {
+			store = true;
+		} // TDMA parameters are not stored
 	}
 
-	if(res == RES_OK) {
+	Result res = RES_OK;
+	if(connection) res = setConnectionInfo(params_.chan, params_.pan, params_.station, false);
+	if(res == RES_OK && store) {
 		ConfigStorage::storage.writeBlock(paramsHandle_, (uint8_t*)&params_);
 	}
 
 	return res;
 }
 
-bb::Result bb::XBee::handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
-	if(words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
-	
-	if(words[0] == "send") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		return send(words[1]);
-	} 
+bb::Result bb::XBee::handleSendCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	return send(args[1].c_str());
+}
 
-	else if(words[0] == "send_control_packet") {
-		if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT;
+bb::Result bb::XBee::handleSendControlPacketCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)args;
+	(void)stream;
 
-		Packet packet;
-		memset(&packet, 0, sizeof(packet));
-		packet.type = PACKET_TYPE_CONTROL;
-		packet.source = PACKET_SOURCE_TEST_ONLY;
+	Packet packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.type = PACKET_TYPE_CONTROL;
+	packet.source = PACKET_SOURCE_TEST_ONLY;
 
-		return send(packet);
-	} 
+	return send(packet);
+}
 
-	else if(words[0] == "send_api_packet") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT;
-		if(!apiMode_) {
-			Console::console.printfBroadcast("Must be in API mode to do this.\n");
-			return RES_SUBSYS_WRONG_MODE;
-		}
+bb::Result bb::XBee::handleSendAPIPacketCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(!apiMode_) {
+		if(stream) stream->printf("Must be in API mode to do this.\n");
+		return RES_SUBSYS_WRONG_MODE;
+	}
 
-		uint16_t dest = words[1].toInt();
+	uint16_t dest = args[1].toInt();
 
-		Packet packet;
-		memset(&packet, 0, sizeof(packet));
-		packet.type = PACKET_TYPE_CONTROL;
-		packet.source = PACKET_SOURCE_TEST_ONLY;
+	Packet packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.type = PACKET_TYPE_CONTROL;
+	packet.source = PACKET_SOURCE_TEST_ONLY;
 
-		return sendTo(dest, packet, true);
-	} 
-	else if(words[0] == "continuous") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		else {
-			if(words[1] == "on" || words[1] == "true") {
-				sendContinuous_ = true;
-				continuous_ = 0;
-				return RES_OK;
-			}
-			else if(words[1] == "off" || words[1] == "false") {
-				sendContinuous_ = false;
-				return RES_OK;
-			}
-			else return RES_CMD_INVALID_ARGUMENT;	
-		}
-	} 
+	return sendTo(dest, packet, true);
+}
 
-	else if(words[0] == "api_mode") {
-		if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-		else {
-			if(words[1] == "on" || words[1] == "true") {
-				return setAPIMode(true);
-			}
-			else if(words[1] == "off" || words[1] == "false") {
-				return setAPIMode(false);
-			}
-			else return RES_CMD_INVALID_ARGUMENT;	
-		}		
+bb::Result bb::XBee::handleContinuousCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	sendContinuous_ = args[1].toBool();
+	if(sendContinuous_) continuous_ = 0;
+	return RES_OK;
+}
+
+bb::Result bb::XBee::handleTDMACommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(args.size() == 1) {
+		printTDMAStatus(stream);
+		return RES_OK;
+	}
+	if(args[1] == "coordinator") return setTDMA(true, true, tdmaSlots_);
+	if(!args[1].isBool()) return RES_CMD_INVALID_ARGUMENT;
+	if(args[1].toBool()) return setTDMA(true, false, tdmaSlots_);
+	return setTDMA(false);
+}
+
+bb::Result bb::XBee::handleGroupCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	if(args.size() == 1) {
+		printGroupStatus(stream);
+		return RES_OK;
 	}
+	if(args.size() < 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
+	if(!args[2].isInt()) return RES_CMD_INVALID_ARGUMENT;
+	uint16_t group = args[2].toInt();
+	if(args[1] == "join") {
+		if(args.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		return joinGroup(group);
+	} else if(args[1] == "leave") {
+		if(args.size() != 3) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		return leaveGroup(group);
+	} else if(args[1] == "transform") {
+		if(args.size() != 5 && args.size() != 6) return RES_CMD_INVALID_ARGUMENT_COUNT;
+		bool mirror = args.size() == 6 && (args[5] == "mirror" || args[5] == "true");
+		return setGroupTransform(group, args[3].toInt(), args[4].toFloat(), mirror);
+	}
+	return RES_CMD_INVALID_ARGUMENT;
+}
 
-	return bb::Subsystem::handleConsoleCommand(words, stream);
+bb::Result bb::XBee::handleAPIModeCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+	(void)stream;
+	return setAPIMode(args[1].toBool());
 }
 
 bb::Result bb::XBee::setAPIMode(bool onoff) {
@@ -347,6 +393,23 @@ bb::Result bb::XBee::addPacketReceiver(PacketReceiver *receiver) {
 	return RES_OK;
 }
 
+bb::Result bb::XBee::addFrameReceiver(FrameReceiver *receiver) {
+	for(size_t i=0; i<frameReceivers_.size(); i++)
+		if(frameReceivers_[i] == receiver)
+			return RES_COMMON_DUPLICATE_IN_LIST;
+	frameReceivers_.push_back(receiver);
+	return RES_OK;
+}
+
+bb::Result bb::XBee::removeFrameReceiver(FrameReceiver *receiver) {
+	for(size_t i=0; i<frameReceivers_.size(); i++)
+		if(frameReceivers_[i] == receiver) {
+			frameReceivers_.erase(frameReceivers_.begin()+i);
+			return RES_OK;
+		}
+	return RES_COMMON_NOT_IN_LIST;
+}
+
 bb::Result bb::XBee::removePacketReceiver(PacketReceiver *receiver) {
 	for(size_t i=0; i<receivers_.size(); i++)
 		if(receivers_[i] == receiver) {
@@ -643,28 +706,80 @@ bb::Result bb::XBee::send(const bb::Packet& packet) {
 	if(operationStatus_ != RES_OK) return RES_SUBSYS_NOT_OPERATIONAL;
 	if(isInATMode()) leaveATMode();
 
-	bb::PacketFrame frame;
-	frame.packet = packet;
+	bb::Packet p = packet;
+	p.seqnum = Runloop::runloop.getSequenceNumber() % MAX_SEQUENCE_NUMBER;
 
-	uint8_t *buf = (uint8_t*)&frame.packet;
-	for(size_t i=0; i<sizeof(frame.packet)-1; i++) {
+	// Packet followed by CRC, padded to the 12 bytes the old in-memory PacketFrame took up, which is what
+	// transparent mode receivers read.
+	uint8_t buf[TRANSPARENT_FRAME_SIZE] = {0};
+	p.encode(buf);
+	for(size_t i=0; i<Packet::SIZE-1; i++) {
 		if(buf[i] & 0x80) {
 			Console::console.printfBroadcast("ERROR: Byte %d of packet has highbit set! Not sending.\n", i);
 			return RES_PACKET_INVALID_PACKET;
 		}
 	}
+	buf[Packet::SIZE] = p.calculateCRC();
 
-	frame.packet.seqnum = Runloop::runloop.getSequenceNumber() % MAX_SEQUENCE_NUMBER;
-	frame.crc = frame.packet.calculateCRC();
-
-	uart_->write((uint8_t*)&frame, sizeof(frame));
+	uart_->write(buf, sizeof(buf));
 	uart_->flush();
 
 	return RES_OK;
 }
 
 bb::Result bb::XBee::sendTo(uint16_t dest, const bb::Packet& packet, bool ack) {
-	uint8_t buf[14+sizeof(packet)];
+	if(!tdma_ || tdmaCoordinator_ || !isTDMASynced() || isOwnSlot()) {
+		return transmitTo(dest, packet, ack);
+	}
+
+	// Outside of our slot - hold the packet back. For control packets only the latest one per destination
+	// is of any use, so replace an older one if we have it.
+	if(packet.type == PACKET_TYPE_CONTROL) {
+		for(uint8_t i=0; i<tdmaNumPending_; i++) {
+			if(tdmaPending_[i].dest == dest && tdmaPending_[i].packet.type == PACKET_TYPE_CONTROL) {
+				tdmaPending_[i].packet = packet;
+				tdmaPending_[i].ack = ack;
+				tdmaDeferred_++;
+				return RES_OK;
+			}
+		}
+	}
+	if(tdmaNumPending_ >= TDMA_MAX_PENDING) {
+		// Queue full - sending now would hit someone else's slot, so the oldest packet goes instead
+		memmove(&tdmaPending_[0], &tdmaPending_[1], (TDMA_MAX_PENDING-1) * sizeof(PendingPacket));
+		tdmaNumPending_--;
+		tdmaDropped_++;
+	}
+	tdmaPending_[tdmaNumPending_].dest = dest;
+	tdmaPending_[tdmaNumPending_].ack = ack;
+	tdmaPending_[tdmaNumPending_].packet = packet;
+	tdmaNumPending_++;
+	tdmaDeferred_++;
+	return RES_OK;
+}
+
+bb::Result bb::XBee::transmitTo(uint16_t dest, const bb::Packet& packet, bool ack) {
+	uint8_t buf[Packet::SIZE+2];
+	size_t length = Packet::SIZE;
+
+	packet.encode(buf);
+	if(isGroupID(dest)) { // groups are broadcast, the group ID goes after the packet
+		buf[length++] = (dest >> 8) & 0xff;
+		buf[length++] = dest & 0xff;
+		return transmitFrameTo(0xffff, buf, length, false);
+	}
+
+	return transmitFrameTo(dest, buf, length, ack);
+}
+
+bb::Result bb::XBee::sendFrameTo(uint16_t dest, const uint8_t *data, size_t length, bool ack) {
+	if(length < FrameReceiver::MIN_FRAME_SIZE) return RES_PACKET_TOO_SHORT;
+	if(length > MAX_FRAME_SIZE) return RES_PACKET_TOO_LONG;
+	return transmitFrameTo(dest, data, length, ack);
+}
+
+bb::Result bb::XBee::transmitFrameTo(uint16_t dest, const uint8_t *data, size_t length, bool ack) {
+	uint8_t buf[14+MAX_FRAME_SIZE];
 
 	buf[0] = 0x10; // transmit request
 	buf[1] = 0x0;  // no response frame
@@ -678,12 +793,141 @@ bb::Result bb::XBee::sendTo(uint16_t dest, const bb::Packet& packet, bool ack) {
 		buf[13] = 0;						// Use default value of TO
 	}
 
-	memcpy(&(buf[14]), &packet, sizeof(packet));
+	memcpy(&(buf[14]), data, length);
 	
-	APIFrame frame(buf, 14+sizeof(packet));
+	APIFrame frame(buf, 14+length);
 	return send(frame);
 }
 	
+bb::Result bb::XBee::setTDMA(bool enabled, bool coordinator, uint8_t numSlots) {
+	if(enabled && numSlots < 2) return RES_PARAM_INVALID_VALUE;
+	if(!enabled && tdmaNumPending_ > 0) flushPending();
+
+	tdma_ = enabled;
+	tdmaCoordinator_ = enabled && coordinator;
+	tdmaSlots_ = numSlots;
+	tdmaSynced_ = false;
+	tdmaNumPending_ = 0;
+	tdmaCollisionWarned_ = false;
+	if(tdma_ && !tdmaCoordinator_ && tdmaSlotOverride_ <= 0) {
+		Console::console.printfBroadcast("TDMA: slot %d derived from the station ID, stations can end up sharing it. "
+			"Set tdma_slot to make it unique.\n", tdmaSlot());
+	}
+	return RES_OK;
+}
+
+bool bb::XBee::isTDMASynced() {
+	if(!tdma_) return false;
+	if(tdmaCoordinator_) return true;
+	if(!tdmaSynced_) return false;
+	return Runloop::runloop.getSequenceNumber() - tdmaBeaconCycle_ < (uint64_t)TDMA_SYNC_TIMEOUT_SUPERFRAMES * tdmaSlots_;
+}
+
+uint8_t bb::XBee::tdmaSlot() {
+	if(tdmaCoordinator_) return 0;
+	if(tdmaSlotOverride_ > 0) return 1 + (tdmaSlotOverride_ - 1) % (tdmaSlots_ - 1);
+	return slotFromStationID(params_.station, tdmaSlots_);
+}
+
+bool bb::XBee::isOwnSlot() {
+	if(!isTDMASynced()) return false;
+	uint8_t current = (Runloop::runloop.getSequenceNumber() - tdmaBeaconCycle_) % tdmaSlots_;
+	return current == tdmaSlot();
+}
+
+void bb::XBee::printTDMAStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	if(!tdma_) {
+		stream->printf("TDMA off.\n");
+		return;
+	}
+	stream->printf("TDMA %s, %d slots, own slot %d%s, %s, %d pending, %lu deferred, %lu dropped, %lu beacons missed, "
+		"%lu collisions.\n", tdmaCoordinator_ ? "coordinator" : "station", tdmaSlots_, tdmaSlot(),
+		!tdmaCoordinator_ && tdmaSlotOverride_ <= 0 ? " (from station ID)" : "", isTDMASynced() ? "synced" : "not synced",
+		tdmaNumPending_, tdmaDeferred_, tdmaDropped_, tdmaMissedBeacons_, tdmaCollisions_);
+}
+
+bb::Result bb::XBee::sendBeacon() {
+	Packet packet;
+	memset(&packet, 0, sizeof(packet));
+	packet.type = PACKET_TYPE_CONFIG;
+	packet.source = packetSource_;
+	packet.payload.config.type = ConfigPacket::CONFIG_SUPERFRAME_BEACON;
+	packet.payload.config.parameter.superframe.numSlots = tdmaSlots_;
+	packet.payload.config.parameter.superframe.beaconSeq = tdmaBeaconSeq_++;
+	return transmitTo(0xffff, packet, false);
+}
+
+bb::Result bb::XBee::flushPending() {
+	Result res = RES_OK;
+	for(uint8_t i=0; i<tdmaNumPending_; i++) {
+		Result r = transmitTo(tdmaPending_[i].dest, tdmaPending_[i].packet, tdmaPending_[i].ack);
+		if(r != RES_OK) res = r;
+	}
+	tdmaNumPending_ = 0;
+	return res;
+}
+
+bb::Result bb::XBee::joinGroup(uint16_t group) {
+	if(!isGroupID(group)) return RES_PARAM_INVALID_VALUE;
+	if(groupMembership(group) != NULL) return RES_OK;
+	if(numGroups_ >= MAX_GROUPS) return RES_PARAM_INVALID_VALUE;
+
+	GroupMembership& m = groups_[numGroups_++];
+	m.group = group;
+	for(uint8_t i=0; i<GROUP_AXES; i++) {
+		m.offset[i] = 0;
+		m.mirror[i] = false;
+	}
+	return RES_OK;
+}
+
+bb::Result bb::XBee::leaveGroup(uint16_t group) {
+	GroupMembership *m = groupMembership(group);
+	if(m == NULL) return RES_PARAM_INVALID_VALUE;
+	*m = groups_[--numGroups_];
+	return RES_OK;
+}
+
+bb::Result bb::XBee::setGroupTransform(uint16_t group, uint8_t axis, float offset, bool mirror) {
+	GroupMembership *m = groupMembership(group);
+	if(m == NULL || axis >= GROUP_AXES) return RES_PARAM_INVALID_VALUE;
+	m->offset[axis] = offset;
+	m->mirror[axis] = mirror;
+	return RES_OK;
+}
+
+void bb::XBee::printGroupStatus(ConsoleStream *stream) {
+	if(stream == NULL) return;
+	if(numGroups_ == 0) {
+		stream->printf("Not a member of any group.\n");
+		return;
+	}
+	for(uint8_t i=0; i<numGroups_; i++) {
+		stream->printf("Group 0x%x:", groups_[i].group);
+		for(uint8_t j=0; j<GROUP_AXES; j++) {
+			stream->printf(" axis%d %s%+.2f", j, groups_[i].mirror[j] ? "-x" : "x", groups_[i].offset[j]);
+		}
+		stream->printf("\n");
+	}
+	stream->printf("%lu group packets received.\n", groupPacketsReceived_);
+}
+
+bb::XBee::GroupMembership* bb::XBee::groupMembership(uint16_t group) {
+	for(uint8_t i=0; i<numGroups_; i++) {
+		if(groups_[i].group == group) return &groups_[i];
+	}
+	return NULL;
+}
+
+void bb::XBee::applyGroupTransform(const GroupMembership& membership, ControlPacket& control) {
+	for(uint8_t i=0; i<GROUP_AXES; i++) {
+		float value = control.getAxis(i);
+		if(membership.mirror[i]) value = -value;
+		control.setAxis(i, value + membership.offset[i]);
+	}
+}
+
 bool bb::XBee::available() {
 	if(operationStatus_ != RES_OK) return false;
 	if(isInATMode()) leaveATMode();
@@ -709,13 +953,23 @@ bb::Result bb::XBee::receiveAndHandleAPIMode() {
 
 	APIFrame frame;
 
-	Result retval;
+	Result first = RES_OK;
 
+	// Handle every frame that is waiting - with bulk transfers there is usually more than one per cycle. A bad
+	// frame doesn't stop the others from being handled; the first error is returned at the end.
 	while(uart_->available()) {
-		retval = receive(frame);
-		if(retval != RES_OK) return retval;
+		Result retval = receive(frame);
+		if(retval == RES_OK) retval = handleAPIFrame(frame);
+		if(retval != RES_OK) {
+			BB_LOG("XBee: dropped received frame: %s\n", errorMessage(retval));
+			if(first == RES_OK) first = retval;
+		}
 	}
 
+	return first;
+}
+
+bb::Result bb::XBee::handleAPIFrame(const APIFrame& frame) {
 #if 0
 	Console::console.printfBroadcast("Received packet of length %d: ", frame.length());
 	for(uint16_t i=0; i<frame.length(); i++) {
@@ -725,8 +979,17 @@ bb::Result bb::XBee::receiveAndHandleAPIMode() {
 #endif
 
 	if(frame.data()[0] == 0x81) { // 16bit address frame
-		if(frame.length() != sizeof(bb::Packet) + 5) {
-			Console::console.printfBroadcast("Invalid API Mode packet size %d (expected %d)\n", frame.length(), sizeof(bb::Packet) + 5);
+		if(frame.length() >= FrameReceiver::MIN_FRAME_SIZE + 5) {
+			uint16_t source = (frame.data()[1] << 8) | frame.data()[2];
+			for(auto& r: frameReceivers_) {
+				r->incomingFrame(source, frame.data()[3], &(frame.data()[5]), frame.length()-5);
+			}
+			return RES_OK;
+		}
+
+		bool grouped = frame.length() == Packet::SIZE + 7;
+		if(frame.length() != Packet::SIZE + 5 && !grouped) {
+			Console::console.printfBroadcast("Invalid API Mode packet size %d (expected %d)\n", frame.length(), Packet::SIZE + 5);
 			return RES_SUBSYS_COMM_ERROR;
 		}
 		uint16_t source = (frame.data()[1] << 8) | frame.data()[2];
@@ -734,7 +997,39 @@ bb::Result bb::XBee::receiveAndHandleAPIMode() {
 		uint8_t options = frame.data()[4];
 
 		bb::Packet packet;
-		memcpy(&packet, &(frame.data()[5]), sizeof(packet));
+		packet.decode(&(frame.data()[5]));
+
+		if(packet.type == PACKET_TYPE_CONFIG && packet.payload.config.type == ConfigPacket::CONFIG_SUPERFRAME_BEACON) {
+			if(tdma_ && !tdmaCoordinator_) {
+				uint8_t numSlots = packet.payload.config.parameter.superframe.numSlots;
+				if(numSlots < 2) return RES_PACKET_INVALID_PACKET;
+				if(tdmaSynced_) tdmaMissedBeacons_ += (uint8_t)(packet.payload.config.parameter.superframe.beaconSeq - tdmaBeaconSeq_ - 1);
+				tdmaSlots_ = numSlots;
+				tdmaBeaconSeq_ = packet.payload.config.parameter.superframe.beaconSeq;
+				tdmaBeaconCycle_ = Runloop::runloop.getSequenceNumber();
+				tdmaCoordinatorStation_ = source;
+				tdmaSynced_ = true;
+			}
+			return RES_OK; // beacons are consumed here and never reach the receivers
+		}
+
+		// Only the coordinator sends outside of the slots. Anyone else heard in our own slot is sharing it.
+		if(isOwnSlot() && !tdmaCoordinator_ && source != tdmaCoordinatorStation_) {
+			tdmaCollisions_++;
+			if(!tdmaCollisionWarned_) {
+				Console::console.printfBroadcast("TDMA: station 0x%x is sending in our slot %d. Set tdma_slot to make "
+					"it unique.\n", source, tdmaSlot());
+				tdmaCollisionWarned_ = true;
+			}
+		}
+
+		if(grouped) {
+			uint16_t group = (frame.data()[5+Packet::SIZE] << 8) | frame.data()[6+Packet::SIZE];
+			GroupMembership *m = groupMembership(group);
+			if(m == NULL) return RES_OK; // not for us
+			groupPacketsReceived_++;
+			if(packet.type == PACKET_TYPE_CONTROL) applyGroupTransform(*m, packet.payload.control);
+		}
 
 //		Console::console.printfBroadcast("Sending packet from 0x%x (RSSI %d, options 0x%x) to receivers.\n", source, rssi, options);
 
@@ -878,7 +1173,7 @@ static uint8_t *allocBlock(uint32_t size, const char *loc="unknown") {
 }
 
 static void freeBlock(uint8_t *block, uint32_t size, const char *loc="unknown") {
-	delete block;
+	delete[] block;
 	total -= size;
 #if defined(MEMDEBUG)
 	bb::Console::console.printfBroadcast("Deleted block 0x%x, size %d, total %d from \"%s\"\n", block, size, total, loc);
@@ -5,13 +5,17 @@ RRemote RRemote::remote;
 RRemote::RemoteParams RRemote::params_;
 bb::ConfigStorage::HANDLE RRemote::paramsHandle_;
 
+const ConsoleCommand RRemote::commandTable_[] = {
+  {"running_status", "b", BB_CONSOLE_HANDLER(RRemote, handleRunningStatusCommand), "running_status on|off: Continuously prints status"},
+  {"select_droid",   "i", BB_CONSOLE_HANDLER(RRemote, handleSelectDroidCommand),
+    "select_droid <id>: Control droid (or droid group) with this station ID"}
+};
+
 RRemote::RRemote(): statusPixels_(2, P_NEOPIXEL, NEO_GRB+NEO_KHZ800) {
   name_ = "remote";
   description_ = "Main subsystem for the BB8 remote";
-  help_ = "Main subsystem for the BB8 remote"\
-"Available commands:\r\n"\
-"\tstatus                 Prints current status (buttons, axes, etc.)\r\n"\
-"\trunning_status on|off  Continuously prints status";
+  help_ = "Main subsystem for the BB8 remote. \"status\" prints buttons, axes, etc.";
+  setCommands(commandTable_);
 
   started_ = false;
   onInitScreen_ = true;
@@ -20,6 +24,10 @@ RRemote::RRemote(): statusPixels_(2, P_NEOPIXEL, NEO_GRB+NEO_KHZ800) {
   memset(&lastPacketSent_, 0, sizeof(Packet));
 
 #if defined(LEFT_REMOTE)
+  memset(&lastPacketFromDroid_, 0, sizeof(Packet));
+  memset(&droidStatus_, 0, sizeof(droidStatus_));
+  droidVoltage_ = 0; droidCurrent_ = 0; droidSpeed_ = 0; droidPitch_ = 0;
+
   params_.leftID = XBee::makeStationID(XBee::REMOTE_BAVARIAN_L, BUILDER_ID, REMOTE_ID);
   params_.rightID = 0;
   params_.droidID = 0;
@@ -34,7 +42,7 @@ Result RRemote::initialize() {
   if(!RemoteInput::input.begin()) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
   if(!IMUFilter::imu.begin()) return RES_SUBSYS_RESOURCE_NOT_AVAILABLE;
 
-  paramsHandle_ = ConfigStorage::storage.reserveBlock(sizeof(params_));
+  paramsHandle_ = ConfigStorage::storage.reserveBlock("remote", 1, sizeof(params_));
 	if(ConfigStorage::storage.blockIsValid(paramsHandle_)) {
     Console::console.printfBroadcast("Remote: Storage block 0x%x is valid.\n", paramsHandle_);
     ConfigStorage::storage.readBlock(paramsHandle_, (uint8_t*)&params_);
@@ -295,31 +303,49 @@ bb::Result RRemote::fillAndSend() {
   return res;
 }
 
-Result RRemote::handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
-  if(words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
-  if(words[0] == "status") {
-    if(words.size() != 1) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    printStatus(stream);
-    stream->printf("\n");
-    return RES_OK;
-  } else if(words[0] == "running_status") {
-    if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
-    if(words[1] == "on" || words[1] == "true") {
-      runningStatus_ = true;
-      return RES_OK;
-    } else if(words[1] == "off" || words[1] == "false") {
-      runningStatus_ = false;
-      return RES_OK;
-    }
-    return RES_CMD_INVALID_ARGUMENT;
-  }
-  return RES_CMD_UNKNOWN_COMMAND;
-} 
+Result RRemote::handleRunningStatusCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+  (void)stream;
+  runningStatus_ = args[1].toBool();
+  return RES_OK;
+}
+
+Result RRemote::handleSelectDroidCommand(const ConsoleArgs& args, ConsoleStream *stream) {
+  (void)stream;
+#if defined(LEFT_REMOTE)
+  selectDroid(args[1].toInt());
+  return RES_OK;
+#else
+  (void)args;
+  return RES_SUBSYS_WRONG_MODE;
+#endif
+}
 
 Result RRemote::incomingPacket(uint16_t source, uint8_t rssi, const Packet& packet) {
 #if defined(LEFT_REMOTE)
-  if(source == params_.droidID && params_.droidID != 0) {
-    Console::console.printfBroadcast("Packet from droid!\n");
+  bool fromDroid = source == params_.droidID ||
+    (XBee::isGroupID(params_.droidID) && XBee::stationTypeFromId(source) == XBee::STATION_DROID);
+  if(fromDroid && params_.droidID != 0) {
+    if(packet.type != PACKET_TYPE_STATE) {
+      Console::console.printfBroadcast("Unknown packet type %d from droid!\n", packet.type);
+      return RES_SUBSYS_COMM_ERROR;
+    }
+
+    const StatePacket& state = packet.payload.state;
+    lastPacketFromDroid_ = packet;
+    droidStatus_ = state.subsysStatus;
+    if(state.item == StatePacket::STATE_BATTERY) {
+      droidVoltage_ = state.data.battery.voltage / 100.0;
+      droidCurrent_ = state.data.battery.current;
+    } else if(state.item == StatePacket::STATE_DRIVE) {
+      droidSpeed_ = state.data.drive.speed;
+      droidPitch_ = state.data.drive.pitch / 100.0;
+      if(currentDrawable_ == graphs_) {
+        // speed in m/s, pitch in quarter circles, then battery/drive/servo status
+        graphs_->plotAxisData(RGraphs::BOTTOM, droidSpeed_/1000.0, droidPitch_/90.0, 
+                              droidStatus_.battery/3.0, droidStatus_.drive/3.0, droidStatus_.servos/3.0);
+        graphs_->advanceCursor(RGraphs::BOTTOM);
+      }
+    }
     return RES_OK;
   } else if(source == params_.rightID && params_.rightID != 0) {
     if(packet.type == PACKET_TYPE_CONTROL) {
@@ -397,5 +423,15 @@ void RRemote::printStatus(ConsoleStream *stream) {
 
   if(stream != NULL) stream->printf(buf);
   else Console::console.printfBroadcast(buf);
+
+#if defined(LEFT_REMOTE)
+  if(params_.droidID != 0) {
+    sprintf(buf, "Droid: Batt%6.2fV %6.0fmA Speed%7.1fmm/s Pitch%7.2fd Status B%dD%dS%dC%d\n",
+      droidVoltage_, droidCurrent_, droidSpeed_, droidPitch_,
+      droidStatus_.battery, droidStatus_.drive, droidStatus_.servos, droidStatus_.comm);
+    if(stream != NULL) stream->printf(buf);
+    else Console::console.printfBroadcast(buf);
+  }
+#endif
 }
 
@@ -27,7 +27,6 @@ public:
   Result start(ConsoleStream *stream = NULL);
   Result stop(ConsoleStream *stream = NULL);
   Result step();
-  Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream);
   Result incomingPacket(uint16_t source, uint8_t rssi, const Packet& packet);
   Result fillAndSend();
   void printStatus(ConsoleStream *stream = NULL);
@@ -45,6 +44,10 @@ public:
 protected:
   RRemote();
 
+  Result handleRunningStatusCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  Result handleSelectDroidCommand(const ConsoleArgs& args, ConsoleStream *stream);
+  static const ConsoleCommand commandTable_[];
+
   bool runningStatus_;
   Adafruit_NeoPixel statusPixels_;
   bool onInitScreen_;
@@ -58,6 +61,8 @@ protected:
 
 #if defined(LEFT_REMOTE)
   Packet lastPacketFromDroid_, lastPacketFromRightRemote_;
+  SubsysStatus droidStatus_;
+  float droidVoltage_, droidCurrent_, droidSpeed_, droidPitch_;
 #endif
 
   float deltaR_, deltaP_, deltaH_;
@@ -52,8 +52,10 @@ void setup() {
 #if defined(LEFT_REMOTE)
   RDisplay::display.start();
   XBee::xbee.setName("LeftRemote");
+  XBee::xbee.setPacketSource(PACKET_SOURCE_LEFT_REMOTE);
 #else
   XBee::xbee.setName("RightRemote");
+  XBee::xbee.setPacketSource(PACKET_SOURCE_RIGHT_REMOTE);
 #endif
   WifiServer::server.start();
   XBee::xbee.start();
@@ -9,7 +9,7 @@ static const uint8_t PIN_DISABLE = 255;
 
 #define DIRECTIONPIN_MOTOR_DRIVER
 //#define DUALPWM_MOTOR_DRIVER
-#if defined(USE_DIRECTIONPIN_MOTOR_DRIVER)
+#if defined(DIRECTIONPIN_MOTOR_DRIVER)
 static const uint8_t PIN_DIR_A_1   = 2;
 static const uint8_t PIN_DIR_B_1   = 3;
 static const uint8_t PIN_DIR_PWM_1 = 19;
@@ -17,7 +17,7 @@ static const uint8_t PIN_ENABLE_1  = 20;
 static const uint8_t PIN_DIR_A_2   = PIN_DISABLE;
 static const uint8_t PIN_DIR_B_2   = PIN_DISABLE;
 static const uint8_t PIN_DIR_PWM_2 = PIN_DISABLE;
-static const uint8_t PIN_ENABLE_2  = PIN_DISABLE
+static const uint8_t PIN_ENABLE_2  = PIN_DISABLE;
 DCMotor motor[2] = {
   DCMotor(PIN_DIR_A_1, PIN_DIR_B_1, PIN_DIR_PWM_1, PIN_ENABLE_1), 
   DCMotor(PIN_DIR_A_2, PIN_DIR_B_2, PIN_DIR_PWM_2, PIN_ENABLE_2)
@@ -45,6 +45,9 @@ static const uint8_t PIN_ENC_B_2 = PIN_DISABLE;
 
 bb::Encoder input[2] = {bb::Encoder(PIN_ENC_A_1, PIN_ENC_B_1), bb::Encoder(PIN_ENC_A_2, PIN_ENC_B_2)};
 
+// Button to ground that aborts autotuning, -1 for none
+static const int PIN_ABORT = -1;
+
 // STEP 3
 // Compile and upload and connect via serial monitor!
 
@@ -52,6 +55,13 @@ bb::Encoder input[2] = {bb::Encoder(PIN_ENC_A_1, PIN_ENC_B_1), bb::Encoder(PIN_E
 
 PIDController control[2] = {PIDController(input[0], motor[0]), PIDController(input[1], motor[1])};
 
+// Capture buffer, 20 bytes per cycle. 350 samples take 7KB of the SAMD21's 32KB and hold 3.5s at 100Hz, enough for
+// the default 0.2s pre and 2s duration. Define CAPTURE_SAMPLES before this point (or with -D) for more or less.
+#if !defined(CAPTURE_SAMPLES)
+#define CAPTURE_SAMPLES 350
+#endif
+CaptureSample captureBuffer[CAPTURE_SAMPLES];
+
 const uint8_t MOTOR_0_FLAG = 1;
 const uint8_t MOTOR_1_FLAG = 2;
 int useMotor = 0;
@@ -72,8 +82,11 @@ const uint8_t UNIT_TICKS = 1;
 const uint8_t UNIT_FAKE = 2;
 int unit = 1;
 
+// Encoder filter coefficients are tabulated for 2-16ms
+int cycleTime = 10000;
+
 #define DROID_DO
-#define DROID_BB8
+//#define DROID_BB8
 
 #if defined(DROID_DO)
 // Values for D-O. This gives about 0.14mm per tick.
@@ -97,6 +110,23 @@ float posCutoff = 25;
 
 static const float MM_PER_TICK = WHEEL_CIRCUMFERENCE / WHEEL_TICKS_PER_TURN;
 
+static const ParameterDescription parameterTable[] = {
+  BB_PARAM_INT("useMotor", "0: none, 1: motor 0, 2: motor 1, 3: both", useMotor, 0, 3),
+  BB_PARAM_INT("mode", "0: PWM, 1: speed, 2: position", mode, 0, 2),
+  BB_PARAM_INT("outputMode", "0: output for Arduino Serial Plotter , 1: output for Curio Res Serial Analyzer", outputMode, 0, 1),
+  BB_PARAM_INT("unit", "0: millimeters, 1: ticks, 2: 'fake' (goal is in ticks, but converted to mm)", unit, 0, 2),
+  BB_PARAM_FLOAT("speedKp", "P constant for speed control", speedKp, 0, INT_MAX),
+  BB_PARAM_FLOAT("speedKi", "I constant for speed control", speedKi, 0, INT_MAX),
+  BB_PARAM_FLOAT("speedKd", "D constant for speed control", speedKd, 0, INT_MAX),
+  BB_PARAM_FLOAT("posKp", "P constant for position control", posKp, 0, INT_MAX),
+  BB_PARAM_FLOAT("posKi", "I constant for position control", posKi, 0, INT_MAX),
+  BB_PARAM_FLOAT("posKd", "D constant for position control", posKd, 0, INT_MAX),
+  BB_PARAM_FLOAT("goal", "PWM, speed, or position goal", goal, INT_MIN, INT_MAX),
+  BB_PARAM_FLOAT("speedCutoff", "Cutoff frequency for speed filter (Hz)", speedCutoff, 0, 30),
+  BB_PARAM_FLOAT("posCutoff", "Cutoff frequency for position filter (Hz)", posCutoff, 0, 30),
+  BB_PARAM_INT("cycleTime", "Control cycle in microseconds", cycleTime, 2000, 16000)
+};
+
 class DCMotorTest: public bb::Subsystem {
 public:
   Result initialize() {
@@ -111,30 +141,34 @@ public:
 "    stop                     Stop the test\n"\
 "    add_goal <delta>         Add <delta> to current goal\n"\
 "    reset                    Reset controllers\n"\
+"    autotune                 Find gains for the present mode (speed or position) with a relay experiment\n"\
+"                             around the goal, on the first motor in useMotor. See \"autotune help\".\n"\
+"    capture record           Record the first motor in useMotor at full rate under step, chirp or PRBS\n"\
+"                             excitation (\"capture help\"); \"capture dump\" prints it as CSV for\n"\
+"                             LibBB/extras/fit_response.py.\n"\
 "While the test is running, information about controller state will be output in a format suited for\n"\
 "the Arduino serial plotter. While it is running, you can either enter \"stop\" to stop the test, or\n"\
 "enter numerical setpoints.\n";
 
-    addParameter("useMotor", "0: none, 1: motor 0, 2: motor 1, 3: both", useMotor, 0, 3);
-    addParameter("mode", "0: PWM, 1: speed, 2: position", mode, 0, 2);
-    addParameter("outputMode", "0: output for Arduino Serial Plotter , 1: output for Curio Res Serial Analyzer", outputMode, 0, 1);
-    addParameter("unit", "0: millimeters, 1: ticks, 2: 'fake' (goal is in ticks, but converted to mm)", unit, 0, 2);
-    addParameter("speedKp", "P constant for speed control", speedKp);
-    addParameter("speedKi", "I constant for speed control", speedKi);
-    addParameter("speedKd", "D constant for speed control", speedKd);
-    addParameter("posKp", "P constant for position control", posKp);
-    addParameter("posKi", "I constant for position control", posKi);
-    addParameter("posKd", "D constant for position control", posKd);
-    addParameter("goal", "PWM, speed, or position goat", goal);
-    addParameter("speedCutoff", "Cutoff frequency for speed filter (Hz)", speedCutoff);
-    addParameter("posCutoff", "Cutoff frequency for position filter (Hz)", posCutoff);
+    setParameters(parameterTable);
+    PIDAutotuner::autotuner.initialize();
+    PIDAutotuner::autotuner.setAbortButton(PIN_ABORT);
+    Capture::capture.initialize(captureBuffer);
 
     input[0].setMillimetersPerTick(WHEEL_CIRCUMFERENCE / WHEEL_TICKS_PER_TURN);
     input[1].setMillimetersPerTick(WHEEL_CIRCUMFERENCE / WHEEL_TICKS_PER_TURN);
+    applyFilterCutoffs();
 
     return Subsystem::initialize();    
   }
 
+  // A cutoff the encoder filters can't take is rejected, and the parameter goes back to the one in effect.
+  Result parametersChanged(const uint8_t *indices, size_t num) {
+    Result res = applyFilterCutoffs();
+    if(res != RES_OK) return res;
+    return Subsystem::parametersChanged(indices, num);
+  }
+
   Result start(ConsoleStream *stream) {
     started_ = true;
     operationStatus_ = RES_OK;
@@ -146,6 +180,7 @@ public:
   }
   
   Result stop(ConsoleStream *stream) {
+    PIDAutotuner::autotuner.abort();
     started_ = false;
     operationStatus_ = RES_SUBSYS_NOT_STARTED;
     motor[0].set(0);
@@ -156,100 +191,116 @@ public:
   }
 
   Result step() {
-    for(int i=0; i<2; i++) {
-      input[i].setSpeedFilterCutoff(speedCutoff);
-      input[i].setPositionFilterCutoff(posCutoff);
+    // Autotuning drives the motor itself. Once it's done, start over with clean controller state.
+    if(tuneMotor_ >= 0 && !PIDAutotuner::autotuner.isStarted()) {
+      control[tuneMotor_].reset();
+      tuneMotor_ = -1;
     }
 
-    if(outputMode == OUTPUT_SERIALPLOTTER) {
-      Console::console.printBroadcast(String("Goal:") + goal);
-    } else {
-      Console::console.printBroadcast(String(goal));
+    Runloop::runloop.setCycleTimeMicros(cycleTime);
+
+    // While capturing, the goal comes from the capture's excitation, and nothing is printed per cycle so that the
+    // loop keeps its timing. The first motor in use is recorded.
+    Capture& capture = Capture::capture;
+    bool quiet = capture.isRecording() || capture.isDumping();
+    float setpoint = capture.isRecording() ? capture.setpoint() : goal;
+    int recorded = (useMotor & 1) ? 0 : 1;
+
+    if(!quiet) {
+      if(outputMode == OUTPUT_SERIALPLOTTER) Console::console.printfBroadcast("Goal:%f", setpoint);
+      else Console::console.printfBroadcast("%f", setpoint);
     }
 
     if(mode == MODE_PWM) {
-      float g = constrain(goal, -255.0, 255.0);
+      float g = constrain(setpoint, -255.0, 255.0);
       for(int i=0; i<2; i++) {
         if(useMotor & 1<<i) {
           motor[i].set(g);
+          input[i].setUnit(unit == UNIT_TICKS ? bb::Encoder::UNIT_TICKS : bb::Encoder::UNIT_MILLIMETERS);
           input[i].update();
+          if(i == recorded) capture.record(g, input[i].present(bb::Encoder::INPUT_SPEED), g);
 
+          if(quiet) continue;
           if(outputMode == OUTPUT_SERIALPLOTTER)
-            Console::console.printBroadcast(String(",RawEnc") + i + ":" + input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit));
+            Console::console.printfBroadcast(",RawEnc%d:%f", i, input[i].present(bb::Encoder::INPUT_SPEED));
           else {
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit, true)));
-            Console::console.printBroadcast(" ");
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit, false)));
-            Console::console.printBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_SPEED, true));
+            Console::console.printfBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_SPEED, false));
+            Console::console.printfBroadcast(" ");
           }
         }
       }
-      Console::console.printlnBroadcast();
+      if(!quiet) Console::console.printfBroadcast("\n");
     } 
     
     else if(mode == MODE_SPEED) {
       for(int i=0; i<2; i++) {
-        float g = goal;
+        float g = setpoint;
 
         input[i].setMode(bb::Encoder::INPUT_SPEED);
         if(unit == UNIT_MM) input[i].setUnit(bb::Encoder::UNIT_MILLIMETERS);
         else if(unit == UNIT_TICKS) input[i].setUnit(bb::Encoder::UNIT_TICKS);
         else if(unit == UNIT_FAKE) {
           input[i].setUnit(bb::Encoder::UNIT_MILLIMETERS);
-          g = goal * MM_PER_TICK;
+          g = setpoint * MM_PER_TICK;
         }
 
         control[i].setControlParameters(speedKp, speedKi, speedKd);
         control[i].setGoal(g);
         
         if(useMotor & 1<<i) {
-          control[i].update();
+          if(!tuning(i)) control[i].update();
+          if(i == recorded) capture.record(g, input[i].present(), motor[i].present());
 
+          if(quiet) continue;
           if(outputMode == OUTPUT_SERIALPLOTTER) {
-            Console::console.printBroadcast(String(",Speed") + i + ":" + input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit));
+            Console::console.printfBroadcast(",Speed%d:%f", i, input[i].present(bb::Encoder::INPUT_SPEED));
           } else {
-            Console::console.printBroadcast(" ");
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit, true)));
-            Console::console.printBroadcast(" ");
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_SPEED, (bb::Encoder::Unit)unit)));
+            Console::console.printfBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_SPEED, true));
+            Console::console.printfBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_SPEED));
           }
         }
       }
-      Console::console.printlnBroadcast();
+      if(!quiet) Console::console.printfBroadcast("\n");
     } 
     
     else if(mode == MODE_POSITION) {
-      if(outputMode == OUTPUT_SERIALPLOTTER)
-        Console::console.printBroadcast(String("Goal:") + goal);
+      if(!quiet && outputMode == OUTPUT_SERIALPLOTTER)
+        Console::console.printfBroadcast("Goal:%f", setpoint);
       for(int i=0; i<2; i++) {
         input[i].setMode(bb::Encoder::INPUT_POSITION);
-        input[i].setUnit((bb::Encoder::Unit)unit);
+        input[i].setUnit(unit == UNIT_TICKS ? bb::Encoder::UNIT_TICKS : bb::Encoder::UNIT_MILLIMETERS);
         control[i].setControlParameters(posKp, posKi, posKd);
-        control[i].setGoal(goal);
+        control[i].setGoal(setpoint);
         if(useMotor & 1<<i) {
+          if(!tuning(i)) control[i].update();
+          if(i == recorded) capture.record(setpoint, input[i].present(), motor[i].present());
 
-          control[i].update();
+          if(quiet) continue;
           if(outputMode == OUTPUT_SERIALPLOTTER) {
-            Console::console.printBroadcast(String(",Pos:") + input[i].present(bb::Encoder::INPUT_POSITION, (bb::Encoder::Unit)unit, true));
+            Console::console.printfBroadcast(",Pos:%f", input[i].present(bb::Encoder::INPUT_POSITION, true));
           } else {
-            Console::console.printBroadcast(" ");
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_POSITION, (bb::Encoder::Unit)unit, true)));
-            Console::console.printBroadcast(" ");
-            Console::console.printBroadcast(String(input[i].present(bb::Encoder::INPUT_POSITION, (bb::Encoder::Unit)unit)));
+            Console::console.printfBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_POSITION, true));
+            Console::console.printfBroadcast(" ");
+            Console::console.printfBroadcast("%f", input[i].present(bb::Encoder::INPUT_POSITION));
           }
         } 
       }
-      Console::console.printlnBroadcast();
+      if(!quiet) Console::console.printfBroadcast("\n");
     }
 
     return RES_OK;
   }
   
-  Result handleConsoleCommand(const std::vector<String>& words, ConsoleStream *stream) {
+  Result handleConsoleCommand(const ConsoleArgs& words, ConsoleStream *stream) {
     if(words.size() == 0) return RES_CMD_UNKNOWN_COMMAND;
 
     if(words[0] == "help") {
-      stream->println(help_);
+      stream->printf("%s\n", help_);
       printParameters(stream);
       return RES_OK;
     }
@@ -269,6 +320,10 @@ public:
       return RES_OK;
     }
 
+    if(words[0] == "autotune" && words.size() == 1) {
+      return startAutotune(stream);
+    }
+
     if(words[0] == "add") {
       if(words.size() != 2) return RES_CMD_INVALID_ARGUMENT_COUNT;
       goal += words[1].toFloat();
@@ -291,7 +346,47 @@ public:
       }
     }
 
-    return Subsystem::handleConsoleCommand(words, stream);
+    // Everything else, including "autotune <command>", "staged" and "commit", as if typed into the console
+    Result res = Subsystem::handleConsoleCommand(words, stream);
+    if(res == RES_CMD_UNKNOWN_COMMAND) res = Console::console.handleConsoleCommand(words, stream);
+    return res;
+  }
+
+protected:
+  int tuneMotor_ = -1;
+
+  bool tuning(int i) { return i == tuneMotor_ && PIDAutotuner::autotuner.isStarted(); }
+
+  Result applyFilterCutoffs() {
+    Result res = RES_OK;
+    for(int i=0; i<2; i++) {
+      if(input[i].setSpeedFilterCutoff(speedCutoff) != RES_OK) res = RES_COMMON_OUT_OF_RANGE;
+      if(input[i].setPositionFilterCutoff(posCutoff) != RES_OK) res = RES_COMMON_OUT_OF_RANGE;
+    }
+    speedCutoff = input[0].speedFilterCutoff();
+    posCutoff = input[0].positionFilterCutoff();
+    return res;
+  }
+
+  // Relay experiment around the goal and the present PWM, on the first motor in use. The proposed gains are staged
+  // as speedK* or posK*, "staged" shows and "commit" applies them.
+  Result startAutotune(ConsoleStream *stream) {
+    if(!isStarted()) return RES_SUBSYS_NOT_STARTED;
+    if(mode == MODE_PWM) return RES_CMD_INVALID_ARGUMENT;
+    int i = (useMotor & 1) ? 0 : 1;
+    if(!(useMotor & 1<<i)) return RES_CMD_INVALID_ARGUMENT;
+
+    PIDAutotuner& at = PIDAutotuner::autotuner;
+    if(mode == MODE_SPEED) at.attach(input[i], motor[i], this, "speedKp", "speedKi", "speedKd");
+    else at.attach(input[i], motor[i], this, "posKp", "posKi", "posKd");
+    input[i].update();
+    float g = (mode == MODE_SPEED && unit == UNIT_FAKE) ? goal * MM_PER_TICK : goal;
+    at.setParameter(at.parameterIndex("offset"), g - input[i].present());
+    at.setParameter(at.parameterIndex("bias"), motor[i].present());
+
+    Result res = at.start(stream);
+    if(res == RES_OK) tuneMotor_ = i;
+    return res;
   }
 };
 
@@ -306,8 +401,9 @@ void setup() {
 
   Console::console.initialize(200000);
   Runloop::runloop.initialize();
-  Runloop::runloop.setCycleTime(10000);
+  Runloop::runloop.setCycleTimeMicros(cycleTime);
   sut.initialize();
+  Capture::capture.start();
 
   Console::console.setFirstResponder(&sut);
   Console::console.start();
@@ -0,0 +1,290 @@
+import socket
+import struct
+import sys
+import time
+
+# Client for the droid's binary command server (see BBCommandServer.h for the protocol).
+
+COMMAND_PORTNUM = 2000
+
+MAGIC = 0xb3
+RESPONSE_FLAG = 0x80
+
+OP_PING = 0
+OP_GET_PARAMETER = 1
+OP_SET_PARAMETER = 2
+OP_START = 3
+OP_STOP = 4
+OP_STATUS = 5
+OP_LIST_SUBSYSTEMS = 6
+OP_LIST_PARAMETERS = 7
+OP_GET_SCHEMA = 8
+OP_GET_LOG = 9
+OP_STAGE_PARAMETER = 10
+OP_COMMIT_PARAMETERS = 11
+OP_ABORT_PARAMETERS = 12
+OP_COMMIT_STATUS = 13
+
+PARAMETER_INT = 0
+PARAMETER_FLOAT = 1
+PARAMETER_STRING = 2
+PARAMETER_BOOL = 3
+
+RES_OK = 0
+
+def packString(s):
+	b = s.encode()
+	if len(b) > 255:
+		raise ValueError("String too long: %s" % s)
+	return bytes([len(b)]) + b
+
+def unpackString(buf, i):
+	n = buf[i]
+	return buf[i+1:i+1+n].decode(errors='replace'), i+1+n
+
+def packValue(value, type=None):
+	if type is None:
+		if isinstance(value, bool): type = PARAMETER_BOOL
+		elif isinstance(value, int): type = PARAMETER_INT
+		elif isinstance(value, float): type = PARAMETER_FLOAT
+		else: type = PARAMETER_STRING
+	if type == PARAMETER_INT:
+		return struct.pack("<Bi", type, int(value))
+	if type == PARAMETER_FLOAT:
+		return struct.pack("<Bf", type, float(value))
+	if type == PARAMETER_BOOL:
+		return struct.pack("<BB", type, 1 if value else 0)
+	return bytes([PARAMETER_STRING]) + packString(str(value))
+
+def unpackValue(buf, i):
+	type = buf[i]
+	i += 1
+	if type == PARAMETER_INT:
+		return struct.unpack_from("<i", buf, i)[0], i+4
+	if type == PARAMETER_FLOAT:
+		return struct.unpack_from("<f", buf, i)[0], i+4
+	if type == PARAMETER_BOOL:
+		return buf[i] != 0, i+1
+	return unpackString(buf, i)
+
+class CommandError(Exception):
+	def __init__(self, opcode, result):
+		Exception.__init__(self, "Opcode %d failed with result %d" % (opcode, result))
+		self.opcode = opcode
+		self.result = result
+
+class CommandClient:
+	"""Sends requests to the command server and matches responses by request ID. send() returns the ID right
+	away so several requests can be in flight; poll() collects responses. The blocking helpers (get(), set()
+	etc.) retransmit on timeout."""
+
+	def __init__(self, host, port=COMMAND_PORTNUM, timeout=0.2, retries=3):
+		self.addr = (host, port)
+		self.timeout = timeout
+		self.retries = retries
+		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+		self.sock.setblocking(0)
+		self.nextID = 0
+		self.pending = {}   # id -> (opcode, request, sent time)
+		self.responses = {} # id -> (opcode, result, payload)
+
+	def send(self, opcode, payload=b''):
+		id = self.nextID
+		self.nextID = (self.nextID + 1) & 0xffff
+		request = struct.pack("<BHB", MAGIC, id, opcode) + payload
+		self.sock.sendto(request, self.addr)
+		self.pending[id] = (opcode, request, time.time())
+		return id
+
+	def poll(self):
+		"""Reads all available responses. Returns the list of request IDs that were answered."""
+		answered = []
+		while True:
+			try:
+				data, addr = self.sock.recvfrom(1024)
+			except BlockingIOError:
+				break
+			if len(data) < 5 or data[0] != MAGIC or not data[3] & RESPONSE_FLAG:
+				continue
+			id = struct.unpack_from("<H", data, 1)[0]
+			if id not in self.pending:
+				continue # duplicate response to a retransmitted request
+			del self.pending[id]
+			self.responses[id] = (data[3] & ~RESPONSE_FLAG, data[4], data[5:])
+			answered.append(id)
+		return answered
+
+	def response(self, id):
+		"""Returns (opcode, result, payload) for an answered request and forgets it, or None."""
+		return self.responses.pop(id, None)
+
+	def retransmit(self):
+		"""Resends all requests that have been pending longer than the timeout."""
+		now = time.time()
+		for id, (opcode, request, sent) in list(self.pending.items()):
+			if now - sent > self.timeout:
+				self.sock.sendto(request, self.addr)
+				self.pending[id] = (opcode, request, now)
+
+	def wait(self, ids):
+		"""Waits until all given requests are answered, retransmitting as needed. Returns False on timeout; the
+		unanswered requests are then forgotten."""
+		ids = list(ids)
+		deadline = time.time() + self.timeout * (self.retries + 1)
+		while time.time() < deadline:
+			self.poll()
+			if all(id in self.responses for id in ids):
+				return True
+			self.retransmit()
+			time.sleep(0.002)
+		for id in ids:
+			self.pending.pop(id, None)
+		return False
+
+	def request(self, opcode, payload=b''):
+		"""Sends a request and waits for its response. Returns the payload, raises CommandError on failure and
+		TimeoutError if the droid doesn't answer."""
+		id = self.send(opcode, payload)
+		if not self.wait((id,)):
+			raise TimeoutError("No response to opcode %d from %s:%d" % (opcode, self.addr[0], self.addr[1]))
+		opcode, result, payload = self.responses.pop(id)
+		if result != RES_OK:
+			raise CommandError(opcode, result)
+		return payload
+
+	def ping(self):
+		start = time.time()
+		self.request(OP_PING)
+		return time.time() - start
+
+	def get(self, subsys, param):
+		return unpackValue(self.request(OP_GET_PARAMETER, packString(subsys) + packString(param)), 0)[0]
+
+	def set(self, subsys, param, value, type=None):
+		self.request(OP_SET_PARAMETER, packString(subsys) + packString(param) + packValue(value, type))
+
+	def setAsync(self, subsys, param, value, type=None):
+		"""Like set(), but doesn't wait. Use poll() and response() to check the result."""
+		return self.send(OP_SET_PARAMETER, packString(subsys) + packString(param) + packValue(value, type))
+
+	def stage(self, subsys, param, value, type=None):
+		"""Stages a change for the next commit(). The value is checked now, but only applied by commit()."""
+		self.request(OP_STAGE_PARAMETER, packString(subsys) + packString(param) + packValue(value, type))
+
+	def commit(self, wait=True):
+		"""Applies all staged changes together at the start of the droid's next cycle. Returns the commit ID. With
+		wait, waits until the droid has applied the commit and raises CommandError if a subsystem rejected it."""
+		id = struct.unpack("<H", self.request(OP_COMMIT_PARAMETERS))[0]
+		if not wait:
+			return id
+		deadline = time.time() + self.timeout * (self.retries + 1)
+		while time.time() < deadline:
+			applied, result = self.commitStatus()
+			if (applied - id) & 0xffff < 0x8000:
+				# A later commit by another client hides our result; it was accepted at least
+				if applied == id and result != RES_OK:
+					raise CommandError(OP_COMMIT_PARAMETERS, result)
+				return id
+			time.sleep(0.002)
+		raise TimeoutError("Commit %d not applied by %s:%d" % (id, self.addr[0], self.addr[1]))
+
+	def commitStatus(self):
+		"""Returns (ID, result) of the last commit the droid applied."""
+		payload = self.request(OP_COMMIT_STATUS)
+		return struct.unpack_from("<H", payload, 0)[0], payload[2]
+
+	def abort(self):
+		self.request(OP_ABORT_PARAMETERS)
+
+	def setMany(self, subsys, values):
+		"""Sets several parameters of subsys atomically. values is a dict of name: value."""
+		try:
+			for param, value in values.items():
+				self.stage(subsys, param, value)
+		except CommandError:
+			self.abort()
+			raise
+		self.commit()
+
+	def start(self, subsys):
+		self.request(OP_START, packString(subsys))
+
+	def stop(self, subsys):
+		self.request(OP_STOP, packString(subsys))
+
+	def status(self, subsys):
+		"""Returns (started, operation status)."""
+		payload = self.request(OP_STATUS, packString(subsys))
+		return payload[0] != 0, payload[1]
+
+	def subsystems(self):
+		names = []
+		while True:
+			payload = self.request(OP_LIST_SUBSYSTEMS, bytes([len(names)]))
+			if payload[0] == 0:
+				return names
+			i = 1
+			for n in range(payload[0]):
+				name, i = unpackString(payload, i)
+				names.append(name)
+
+	def parameters(self, subsys):
+		"""Returns a list of (name, type)."""
+		params = []
+		while True:
+			payload = self.request(OP_LIST_PARAMETERS, packString(subsys) + bytes([len(params)]))
+			if payload[0] == 0:
+				return params
+			i = 1
+			for n in range(payload[0]):
+				name, i = unpackString(payload, i)
+				params.append((name, payload[i]))
+				i += 1
+
+def parseValue(s):
+	for conv in (int, float):
+		try:
+			return conv(s)
+		except ValueError:
+			pass
+	if s in ("true", "false"):
+		return s == "true"
+	return s
+
+if __name__ == "__main__":
+	if len(sys.argv) < 3:
+		print("Usage: %s host command [args]" % sys.argv[0])
+		print("Commands: ping | list [subsys] | get subsys param | set subsys param value |")
+		print("          setmany subsys param=value... | start subsys | stop subsys | status subsys")
+		sys.exit(1)
+
+	client = CommandClient(sys.argv[1])
+	cmd, args = sys.argv[2], sys.argv[3:]
+	try:
+		if cmd == "ping":
+			print("%.1fms" % (client.ping() * 1000))
+		elif cmd == "list" and len(args) == 0:
+			for name in client.subsystems():
+				print(name)
+		elif cmd == "list":
+			for name, type in client.parameters(args[0]):
+				print("%s (%s)" % (name, ["int", "float", "string", "bool"][type]))
+		elif cmd == "get":
+			print(client.get(args[0], args[1]))
+		elif cmd == "set":
+			client.set(args[0], args[1], parseValue(args[2]))
+		elif cmd == "setmany":
+			client.setMany(args[0], {k: parseValue(v) for k, v in (a.split("=", 1) for a in args[1:])})
+		elif cmd == "start":
+			client.start(args[0])
+		elif cmd == "stop":
+			client.stop(args[0])
+		elif cmd == "status":
+			started, status = client.status(args[0])
+			print("%s, status %d" % ("started" if started else "stopped", status))
+		else:
+			print("Unknown command %s" % cmd)
+			sys.exit(1)
+	except (CommandError, TimeoutError) as e:
+		print(e)
+		sys.exit(1)
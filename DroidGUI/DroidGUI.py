@@ -1,6 +1,6 @@
 #!/usr/bin/env python3
 
-from UDPHandler import UDPHandler
+from UDPHandler import UDPHandler, telemetryChannels
 from RemoteHandler import RemoteHandler
 from Utilities import vectorToAngles
 import dearpygui.dearpygui as dpg
@@ -13,6 +13,7 @@ class BB8DearPyGui:
 	def __init__(self):
 		self.handler = UDPHandler()
 		self.handler.setNewDroidDiscoveredCB(self.newDroidDiscoveredCallback)
+		self.handler.subscribe(telemetryChannels(("timestamp", "droidType", "drive[", "imu[", "battery[")))
 		self.remote = RemoteHandler()
 		self.lastSeqnum = None
 		self.droppedFrames = 0
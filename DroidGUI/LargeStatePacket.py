@@ -1,85 +1,58 @@
-import struct
+import PacketLayout
 
-class DriveControlState:
-	PACK_FORMAT = "2B8f"
-	def __init__(self, t):
-		(self.errorState, self.controlMode, self.presentPWM, self.presentSpeed, self.presentPos,
-			self.goal, self.err, self.errI, self.errD, self.control) = t
-	@classmethod
-	def numValues(cls):
-		return 10
-class IMUState:
-	PACK_FORMAT = "B9f"
-	def __init__(self, t):
-		(self.errorState, self.r, self.p, self.h, self.dr, self.dp, self.dh, self.ax, self.ay, self.az) = t
-	@classmethod
-	def numValues(cls):
-		return 10
-class CommandPacket:
-	PACK_FORMAT = "8B"
-	def __init__(self, t):
-		self.t = t # FIXME later
-	@classmethod
-	def numValues(cls):
-		return 8
-class ServoState:
-	PACK_FORMAT = "B3f"
-	def __init__(self, t):
-		(self.errorState, self.goal, self.present, self.load) = t
-	@classmethod
-	def numValues(cls):
-		return 4
-class BatteryState:
-	PACK_FORMAT = "B2f"
-	def __init__(self, t):
-		(self.errorState, self.voltage, self.current) = t
-		self.current = self.current / 1000
-	@classmethod
-	def numValues(cls):
-		return 3
+class Record:
+	pass
+
+def setPath(obj, path, value):
+	"""Sets e.g. obj.drive[0].err for the path ["drive", 0, "err"], creating lists and records on the way."""
+	for (step, nextStep) in zip(path, path[1:]):
+		if isinstance(step, int):
+			while len(obj) <= step:
+				obj.append(None)
+			child = obj[step]
+		else:
+			child = getattr(obj, step, None)
+		if child is None:
+			child = [] if isinstance(nextStep, int) else Record()
+			if isinstance(step, int):
+				obj[step] = child
+			else:
+				setattr(obj, step, child)
+		obj = child
+	step = path[-1]
+	if isinstance(step, int):
+		while len(obj) <= step:
+			obj.append(None)
+		obj[step] = value
+	else:
+		setattr(obj, step, value)
 
 class LargeStatePacket:
-	def __init__(self, packet):
-		PACK_FORMAT = ("<fB16s" + 
-			3*DriveControlState.PACK_FORMAT + 
-			3*IMUState.PACK_FORMAT +  
-			2*CommandPacket.PACK_FORMAT + 
-			10*ServoState.PACK_FORMAT + 
-			3*BatteryState.PACK_FORMAT)
-		try:
-			t = struct.unpack(PACK_FORMAT, packet)
-		except struct.error:
-			print("Got a buffer of size %d, expect %d" % (len(packet), struct.calcsize(PACK_FORMAT)))
-			return
+	"""One droid state sample. The attributes follow the C++ LargeStatePacket members as named in the droid's
+	schema (see Schema.py), e.g. packet.drive[0].presentSpeed or packet.imu[1].r."""
+
+	@classmethod
+	def fromValues(cls, schema, values, name):
+		"""Builds a packet from values in channel order, e.g. as produced by TelemetryDecoder."""
+		packet = cls()
+		packet.droidName = name
+		for (path, value) in zip(schema.paths, values):
+			setPath(packet, path, value)
 
-		self.timestamp, self.droidType, self.droidName = t[0:3]
-		i = 3
-		self.drive = []
-		self.drive.append(DriveControlState(t[i:i+DriveControlState.numValues()]))
-		i += DriveControlState.numValues()
-		self.drive.append(DriveControlState(t[i:i+DriveControlState.numValues()]))
-		i += DriveControlState.numValues()
-		self.drive.append(DriveControlState(t[i:i+DriveControlState.numValues()]))
-		i += DriveControlState.numValues()
-		self.imu = []
-		self.imu.append(IMUState(t[i:i+IMUState.numValues()]))
-		i += IMUState.numValues()
-		self.imu.append(IMUState(t[i:i+IMUState.numValues()]))
-		i += IMUState.numValues()
-		self.imu.append(IMUState(t[i:i+IMUState.numValues()]))
-		i += IMUState.numValues()
-		self.cmd = []
-		self.cmd.append(CommandPacket(t[i:i+CommandPacket.numValues()]))
-		i += CommandPacket.numValues()
-		self.cmd.append(CommandPacket(t[i:i+CommandPacket.numValues()]))
-		i += CommandPacket.numValues()
-		self.servos = []
-		for j in range(10):
-			self.servos.append(ServoState(t[i:i+ServoState.numValues()]))
-			i += ServoState.numValues()		
-		self.batt = []
-		self.batt.append(BatteryState(t[i:i+BatteryState.numValues()]))
-		i += BatteryState.numValues()		
-		self.batt.append(BatteryState(t[i:i+BatteryState.numValues()]))
-		i += BatteryState.numValues()		
-		self.batt.append(BatteryState(t[i:i+BatteryState.numValues()]))
+		# Shorthands used by the GUI
+		packet.servos = getattr(packet, "servo", [])
+		packet.batt = []
+		for b in getattr(packet, "battery", []):
+			r = Record()
+			r.errorState, r.voltage, r.current = b.errorState, b.voltage, b.current / 1000 # mA -> A
+			packet.batt.append(r)
+		# lastControl holds control packets without their header byte
+		packet.cmd = [PacketLayout.decode_packet(bytes([PacketLayout.PACKET_TYPE_CONTROL]) + bytes(c), schema.packetTables)
+			for c in getattr(packet, "lastControl", [])]
+		return packet
+
+	@classmethod
+	def fromBuffer(cls, schema, buf):
+		"""Decodes a raw LargeStatePacket as sent by firmware without compact telemetry."""
+		values, name = schema.unpackState(buf)
+		return cls.fromValues(schema, values, name)
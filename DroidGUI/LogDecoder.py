@@ -0,0 +1,198 @@
+# Decoder for the droid's binary log (see Arduino/LibBB/include/BBLog.h). The droid only sends format string IDs;
+# the format strings themselves come from scanning the BB_LOG() calls in the firmware source.
+
+import os
+import re
+import struct
+import sys
+import time
+
+import CommandClient
+
+HEADER_SIZE = 9
+MAX_STRING_SIZE = 32
+
+ARG_INT32 = 0
+ARG_UINT32 = 1
+ARG_FLOAT = 2
+ARG_STRING = 3
+ARG_INT64 = 4
+ARG_UINT64 = 5
+
+ARG_FORMATS = { ARG_INT32: "<i", ARG_UINT32: "<I", ARG_FLOAT: "<f", ARG_INT64: "<q", ARG_UINT64: "<Q" }
+
+SOURCE_SUFFIXES = (".cpp", ".h", ".ino")
+DEFAULT_SOURCE_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "Arduino")
+
+LOG_CALL = re.compile(rb'\bBB_LOG\s*\(\s*((?:"(?:[^"\\\n]|\\.)*"\s*)+)')
+STRING_LITERAL = re.compile(rb'"((?:[^"\\\n]|\\.)*)"')
+C_ESCAPE = re.compile(rb'\\(x[0-9a-fA-F]+|[0-7]{1,3}|.)')
+C_ESCAPES = { b"n": b"\n", b"t": b"\t", b"r": b"\r", b"0": b"\0", b"a": b"\a", b"b": b"\b", b"f": b"\f",
+              b"v": b"\v", b"\\": b"\\", b'"': b'"', b"'": b"'", b"?": b"?" }
+CONVERSION = re.compile(r'%([-+ #0]*)(\d+)?(\.\d+)?(hh|h|ll|l|j|z|t|L)?([diouxXeEfFgGcsp%])')
+
+def formatID(fmt):
+	"""32 bit FNV-1a over the bytes of the format string, like Log::formatID()."""
+	h = 2166136261
+	for b in fmt:
+		h = ((h ^ b) * 16777619) & 0xffffffff
+	return h
+
+def unescape(literal):
+	def replace(m):
+		e = m.group(1)
+		if e[0:1] == b"x":
+			return bytes([int(e[1:], 16) & 0xff])
+		if e[0:1].isdigit():
+			return bytes([int(e, 8) & 0xff])
+		return C_ESCAPES.get(e, e)
+	return C_ESCAPE.sub(replace, literal)
+
+def buildDictionary(paths):
+	"""Returns {format ID: format string} for all BB_LOG() calls in the source files under paths."""
+	dictionary = {}
+	for path in paths:
+		files = [path]
+		if os.path.isdir(path):
+			files = [os.path.join(d, f) for (d, dirs, fs) in os.walk(path) for f in fs if f.endswith(SOURCE_SUFFIXES)]
+		for filename in files:
+			with open(filename, "rb") as f:
+				source = f.read()
+			for m in LOG_CALL.finditer(source):
+				fmt = b"".join(unescape(s) for s in STRING_LITERAL.findall(m.group(1)))
+				id = formatID(fmt)
+				text = fmt.decode(errors="replace")
+				if dictionary.get(id, text) != text:
+					print("Warning: format ID 0x%08x collision between %r and %r" % (id, dictionary[id], text), file=sys.stderr)
+				dictionary[id] = text
+	return dictionary
+
+def decodeRecord(record):
+	"""Returns (format ID, timestamp in us, arguments) for one record."""
+	id, timestamp = struct.unpack_from("<II", record, 1)
+	args = []
+	i = HEADER_SIZE
+	while i < len(record):
+		type = record[i]
+		i += 1
+		if type == ARG_STRING:
+			n = record[i]
+			args.append(record[i+1:i+1+n].decode(errors="replace"))
+			i += 1 + n
+		elif type in ARG_FORMATS:
+			fmt = ARG_FORMATS[type]
+			args.append(struct.unpack_from(fmt, record, i)[0])
+			i += struct.calcsize(fmt)
+		else:
+			break # unknown argument type, can't go on
+	return id, timestamp, args
+
+def splitRecords(buf):
+	"""Yields the records in a buffer of consecutive records."""
+	i = 0
+	while i < len(buf) and buf[i] >= HEADER_SIZE and i + buf[i] <= len(buf):
+		yield buf[i:i+buf[i]]
+		i += buf[i]
+
+def formatArg(spec, flags, width, precision, conv, arg):
+	if conv == "c" and isinstance(arg, int):
+		return ("%" + flags + width + "s") % chr(arg & 0xff)
+	if conv == "p":
+		conv, flags = "x", flags + "#"
+	if conv in "ouxX" and isinstance(arg, int) and arg < 0:
+		arg &= 0xffffffff
+	if conv in "diouxXc" and isinstance(arg, float):
+		arg = int(arg)
+	if conv in "eEfFgG" and isinstance(arg, str):
+		conv = "s"
+	try:
+		return ("%" + flags + width + precision + conv) % arg
+	except (TypeError, ValueError):
+		return "<%s?>" % spec
+
+def formatMessage(fmt, args):
+	"""printf for the subset of conversions BB_LOG() supports. Missing arguments show as <%x?>."""
+	args = list(args)
+	def replace(m):
+		flags, width, precision, length, conv = (g or "" for g in m.groups())
+		if conv == "%":
+			return "%"
+		if len(args) == 0:
+			return "<%s?>" % m.group(0)
+		return formatArg(m.group(0), flags, width, precision, conv, args.pop(0))
+	return CONVERSION.sub(replace, fmt)
+
+class LogDecoder:
+	def __init__(self, dictionary):
+		self.dictionary = dictionary
+		self.offset = 0
+
+	def decode(self, record):
+		"""Returns (timestamp in us, text) for one record."""
+		id, timestamp, args = decodeRecord(record)
+		fmt = self.dictionary.get(id)
+		if fmt is None:
+			return timestamp, "<unknown format 0x%08x> %s\n" % (id, " ".join(str(a) for a in args))
+		return timestamp, formatMessage(fmt, args)
+
+	def fetch(self, client):
+		"""Reads the records written since the last fetch via a CommandClient. Returns (lost bytes, [(timestamp,
+		text)]); lost bytes is nonzero if records were overwritten before we got to them."""
+		messages, lost = [], 0
+		while True:
+			payload = client.request(CommandClient.OP_GET_LOG, struct.pack("<I", self.offset))
+			offset, end = struct.unpack_from("<II", payload, 0)
+			if offset != self.offset and self.offset != 0:
+				lost += (offset - self.offset) & 0xffffffff
+			records = payload[8:]
+			messages += [self.decode(r) for r in splitRecords(records)]
+			self.offset = (offset + len(records)) & 0xffffffff
+			if len(records) == 0 or self.offset == end:
+				return lost, messages
+
+	def parseDump(self, lines):
+		"""Decodes the output of the "log dump" console command."""
+		messages = []
+		for line in lines:
+			m = re.match(r"\s*([0-9a-fA-F]{8}):([0-9a-fA-F]+)\s*$", line)
+			if m:
+				messages += [self.decode(r) for r in splitRecords(bytes.fromhex(m.group(2)))]
+		return messages
+
+def printMessages(messages):
+	for (timestamp, text) in messages:
+		sys.stdout.write("%10.6f %s" % (timestamp / 1e6, text if text.endswith("\n") else text + "\n"))
+
+if __name__ == "__main__":
+	args = sys.argv[1:]
+	sources = []
+	while len(args) >= 2 and args[0] == "-s":
+		sources.append(args[1])
+		args = args[2:]
+	if len(args) != 1:
+		print("Usage: %s [-s sourcedir]... host | dumpfile | -" % sys.argv[0])
+		print("Follows the droid's binary log via the command server, or decodes saved \"log dump\" output.")
+		print("Format strings are taken from the BB_LOG() calls under the source dirs (default %s)." %
+			os.path.normpath(DEFAULT_SOURCE_DIR))
+		sys.exit(1)
+
+	decoder = LogDecoder(buildDictionary(sources or [DEFAULT_SOURCE_DIR]))
+	if args[0] == "-":
+		printMessages(decoder.parseDump(sys.stdin))
+	elif os.path.isfile(args[0]):
+		with open(args[0]) as f:
+			printMessages(decoder.parseDump(f))
+	else:
+		client = CommandClient.CommandClient(args[0])
+		try:
+			while True:
+				lost, messages = decoder.fetch(client)
+				if lost:
+					print("[%d bytes of log lost]" % lost)
+				printMessages(messages)
+				time.sleep(0.1)
+		except KeyboardInterrupt:
+			pass
+		except (CommandClient.CommandError, TimeoutError) as e:
+			print(e)
+			sys.exit(1)
@@ -0,0 +1,276 @@
+# Generated by Arduino/LibBB/extras/gen_packet_layout.py from BBPacketLayout.h - do not edit.
+
+PACKET_SIZE = 8
+
+PACKET_TYPE_CONTROL = 0
+PACKET_TYPE_STATE = 1
+PACKET_TYPE_CONFIG = 2
+PACKET_TYPE_PAIRING = 3
+
+PACKET_SOURCE_LEFT_REMOTE = 0
+PACKET_SOURCE_RIGHT_REMOTE = 1
+PACKET_SOURCE_DROID = 2
+PACKET_SOURCE_TEST_ONLY = 3
+
+STATE_SUBSYS = 0
+STATE_BATTERY = 1
+STATE_DRIVE = 2
+
+CONFIG_SET_LEFT_REMOTE_ID = 0
+CONFIG_SET_DROID_ID = 1
+CONFIG_SET_CONTROL_MODE = 2
+CONFIG_SUPERFRAME_BEACON = 3
+
+TELEMETRY_MAGIC = 0xb5
+TELEMETRY_FLAG_KEYFRAME = 0x01
+TELEMETRY_FIELDS = [
+	("timestamp", 1000),
+	("droidType", 1),
+	("drive[0].errorState", 1),
+	("drive[0].controlMode", 1),
+	("drive[0].presentPWM", 1000),
+	("drive[0].presentSpeed", 10),
+	("drive[0].presentPos", 10),
+	("drive[0].goal", 100),
+	("drive[0].err", 100),
+	("drive[0].errI", 100),
+	("drive[0].errD", 100),
+	("drive[0].control", 1000),
+	("drive[1].errorState", 1),
+	("drive[1].controlMode", 1),
+	("drive[1].presentPWM", 1000),
+	("drive[1].presentSpeed", 10),
+	("drive[1].presentPos", 10),
+	("drive[1].goal", 100),
+	("drive[1].err", 100),
+	("drive[1].errI", 100),
+	("drive[1].errD", 100),
+	("drive[1].control", 1000),
+	("drive[2].errorState", 1),
+	("drive[2].controlMode", 1),
+	("drive[2].presentPWM", 1000),
+	("drive[2].presentSpeed", 10),
+	("drive[2].presentPos", 10),
+	("drive[2].goal", 100),
+	("drive[2].err", 100),
+	("drive[2].errI", 100),
+	("drive[2].errD", 100),
+	("drive[2].control", 1000),
+	("imu[0].errorState", 1),
+	("imu[0].r", 100),
+	("imu[0].p", 100),
+	("imu[0].h", 100),
+	("imu[0].dr", 100),
+	("imu[0].dp", 100),
+	("imu[0].dh", 100),
+	("imu[0].ax", 1000),
+	("imu[0].ay", 1000),
+	("imu[0].az", 1000),
+	("imu[1].errorState", 1),
+	("imu[1].r", 100),
+	("imu[1].p", 100),
+	("imu[1].h", 100),
+	("imu[1].dr", 100),
+	("imu[1].dp", 100),
+	("imu[1].dh", 100),
+	("imu[1].ax", 1000),
+	("imu[1].ay", 1000),
+	("imu[1].az", 1000),
+	("imu[2].errorState", 1),
+	("imu[2].r", 100),
+	("imu[2].p", 100),
+	("imu[2].h", 100),
+	("imu[2].dr", 100),
+	("imu[2].dp", 100),
+	("imu[2].dh", 100),
+	("imu[2].ax", 1000),
+	("imu[2].ay", 1000),
+	("imu[2].az", 1000),
+	("lastControl[0][0]", 1),
+	("lastControl[0][1]", 1),
+	("lastControl[0][2]", 1),
+	("lastControl[0][3]", 1),
+	("lastControl[0][4]", 1),
+	("lastControl[0][5]", 1),
+	("lastControl[0][6]", 1),
+	("lastControl[1][0]", 1),
+	("lastControl[1][1]", 1),
+	("lastControl[1][2]", 1),
+	("lastControl[1][3]", 1),
+	("lastControl[1][4]", 1),
+	("lastControl[1][5]", 1),
+	("lastControl[1][6]", 1),
+	("servo[0].errorState", 1),
+	("servo[0].goal", 10),
+	("servo[0].present", 10),
+	("servo[0].load", 10),
+	("servo[1].errorState", 1),
+	("servo[1].goal", 10),
+	("servo[1].present", 10),
+	("servo[1].load", 10),
+	("servo[2].errorState", 1),
+	("servo[2].goal", 10),
+	("servo[2].present", 10),
+	("servo[2].load", 10),
+	("servo[3].errorState", 1),
+	("servo[3].goal", 10),
+	("servo[3].present", 10),
+	("servo[3].load", 10),
+	("servo[4].errorState", 1),
+	("servo[4].goal", 10),
+	("servo[4].present", 10),
+	("servo[4].load", 10),
+	("servo[5].errorState", 1),
+	("servo[5].goal", 10),
+	("servo[5].present", 10),
+	("servo[5].load", 10),
+	("servo[6].errorState", 1),
+	("servo[6].goal", 10),
+	("servo[6].present", 10),
+	("servo[6].load", 10),
+	("servo[7].errorState", 1),
+	("servo[7].goal", 10),
+	("servo[7].present", 10),
+	("servo[7].load", 10),
+	("servo[8].errorState", 1),
+	("servo[8].goal", 10),
+	("servo[8].present", 10),
+	("servo[8].load", 10),
+	("servo[9].errorState", 1),
+	("servo[9].goal", 10),
+	("servo[9].present", 10),
+	("servo[9].load", 10),
+	("battery[0].errorState", 1),
+	("battery[0].voltage", 100),
+	("battery[0].current", 1),
+	("battery[1].errorState", 1),
+	("battery[1].voltage", 100),
+	("battery[1].current", 1),
+	("battery[2].errorState", 1),
+	("battery[2].voltage", 100),
+	("battery[2].current", 1),
+]
+
+PACKET_HEADER_FIELDS = [
+	("type", 0, 2, False),
+	("source", 2, 2, False),
+	("seqnum", 4, 3, False),
+	("reserved", 7, 1, False),
+]
+
+CONTROL_PACKET_FIELDS = [
+	("axis0", 8, 10, True),
+	("axis1", 18, 10, True),
+	("axis2", 28, 10, True),
+	("axis3", 38, 10, True),
+	("axis4", 48, 10, True),
+	("button0", 58, 1, False),
+	("button1", 59, 1, False),
+	("button2", 60, 1, False),
+	("button3", 61, 1, False),
+	("button4", 62, 1, False),
+	("event", 63, 1, False),
+]
+
+STATE_PACKET_FIELDS = [
+	("controlMode.driveControl", 8, 2, False),
+	("controlMode.domeControl", 10, 2, False),
+	("controlMode.armsControl", 12, 2, False),
+	("controlMode.soundControl", 14, 2, False),
+	("subsysStatus.battery", 16, 2, False),
+	("subsysStatus.drive", 18, 2, False),
+	("subsysStatus.servos", 20, 2, False),
+	("subsysStatus.comm", 22, 2, False),
+	("item", 24, 8, False),
+]
+
+STATE_BATTERY_FIELDS = [
+	("data.battery.voltage", 32, 16, False),
+	("data.battery.current", 48, 16, True),
+]
+
+STATE_DRIVE_FIELDS = [
+	("data.drive.speed", 32, 16, True),
+	("data.drive.pitch", 48, 16, True),
+]
+
+CONFIG_PACKET_FIELDS = [
+	("type", 8, 8, False),
+]
+
+CONFIG_ID_FIELDS = [
+	("parameter.id", 40, 16, False),
+]
+
+CONFIG_CONTROL_MODE_FIELDS = [
+	("parameter.controlMode.driveControl", 40, 2, False),
+	("parameter.controlMode.domeControl", 42, 2, False),
+	("parameter.controlMode.armsControl", 44, 2, False),
+	("parameter.controlMode.soundControl", 46, 2, False),
+]
+
+CONFIG_SUPERFRAME_FIELDS = [
+	("parameter.superframe.numSlots", 40, 8, False),
+	("parameter.superframe.beaconSeq", 48, 8, False),
+]
+
+PAIRING_PACKET_FIELDS = [
+	("dummy", 8, 8, False),
+]
+
+TABLES = {
+	"PACKET_HEADER": PACKET_HEADER_FIELDS,
+	"CONTROL_PACKET": CONTROL_PACKET_FIELDS,
+	"STATE_PACKET": STATE_PACKET_FIELDS,
+	"STATE_BATTERY": STATE_BATTERY_FIELDS,
+	"STATE_DRIVE": STATE_DRIVE_FIELDS,
+	"CONFIG_PACKET": CONFIG_PACKET_FIELDS,
+	"CONFIG_ID": CONFIG_ID_FIELDS,
+	"CONFIG_CONTROL_MODE": CONFIG_CONTROL_MODE_FIELDS,
+	"CONFIG_SUPERFRAME": CONFIG_SUPERFRAME_FIELDS,
+	"PAIRING_PACKET": PAIRING_PACKET_FIELDS,
+}
+
+def get_field(buf, offset, width, signed):
+	value = (int.from_bytes(buf[:PACKET_SIZE], "little") >> offset) & ((1 << width) - 1)
+	if signed and value & (1 << (width - 1)):
+		value -= 1 << width
+	return value
+
+def decode_fields(buf, fields, into=None):
+	if into is None:
+		into = {}
+	for (name, offset, width, signed) in fields:
+		into[name] = get_field(buf, offset, width, signed)
+	return into
+
+def decode_packet(buf, tables=None):
+	"""Decodes one 8 byte realtime protocol packet into a dict with the header fields, and the payload fields
+	in a dict under "payload". tables maps table names to field lists, like the ones in a droid's schema; the
+	default is TABLES."""
+	if len(buf) < PACKET_SIZE:
+		raise ValueError("Packet too short (%d bytes, need %d)" % (len(buf), PACKET_SIZE))
+	if tables is None:
+		tables = TABLES
+	p = decode_fields(buf, tables["PACKET_HEADER"])
+	payload = {}
+	if p["type"] == PACKET_TYPE_CONTROL:
+		decode_fields(buf, tables["CONTROL_PACKET"], payload)
+	elif p["type"] == PACKET_TYPE_STATE:
+		decode_fields(buf, tables["STATE_PACKET"], payload)
+		if payload["item"] == STATE_BATTERY:
+			decode_fields(buf, tables["STATE_BATTERY"], payload)
+		elif payload["item"] == STATE_DRIVE:
+			decode_fields(buf, tables["STATE_DRIVE"], payload)
+	elif p["type"] == PACKET_TYPE_CONFIG:
+		decode_fields(buf, tables["CONFIG_PACKET"], payload)
+		if payload["type"] in (CONFIG_SET_LEFT_REMOTE_ID, CONFIG_SET_DROID_ID):
+			decode_fields(buf, tables["CONFIG_ID"], payload)
+		elif payload["type"] == CONFIG_SET_CONTROL_MODE:
+			decode_fields(buf, tables["CONFIG_CONTROL_MODE"], payload)
+		elif payload["type"] == CONFIG_SUPERFRAME_BEACON:
+			decode_fields(buf, tables["CONFIG_SUPERFRAME"], payload)
+	else:
+		decode_fields(buf, tables["PAIRING_PACKET"], payload)
+	p["payload"] = payload
+	return p
@@ -0,0 +1,136 @@
+import re
+import struct
+
+import CommandClient
+
+# Runtime decoder description, parsed from the schema descriptor the droid sends (see
+# Arduino/LibBB/include/BBSchema.h).
+
+SCHEMA_VERSION = 1
+
+KIND_UNSIGNED = 0
+KIND_SIGNED = 1
+KIND_FLOAT = 2
+
+STRUCT_CODES = {
+	(KIND_UNSIGNED, 1): "B", (KIND_SIGNED, 1): "b",
+	(KIND_UNSIGNED, 2): "H", (KIND_SIGNED, 2): "h",
+	(KIND_UNSIGNED, 4): "I", (KIND_SIGNED, 4): "i",
+	(KIND_FLOAT, 4): "f",
+}
+
+def schemaHash(blob):
+	h = 2166136261
+	for b in blob:
+		h = ((h ^ b) * 16777619) & 0xffffffff
+	return (h >> 16) ^ (h & 0xffff)
+
+def parsePath(name):
+	"""Turns a C++ member expression like "drive[0].err" into the steps ["drive", 0, "err"]."""
+	return [int(index) if index else attr for (attr, index) in re.findall(r"(\w+)|\[(\d+)\]", name)]
+
+class Schema:
+	def __init__(self, blob):
+		self.blob = bytes(blob)
+		self.id = schemaHash(self.blob)
+		r = Reader(self.blob)
+		version = r.u8()
+		if version != SCHEMA_VERSION:
+			raise ValueError("Unknown schema version %d" % version)
+		self.stateSize = r.u16()
+		self.nameOffset = r.u16()
+		self.nameSize = r.u8()
+
+		self.telemetryFields = [] # (name, type, offset, scale)
+		for n in range(r.u8()):
+			self.telemetryFields.append((r.str(), r.u8(), r.u16(), r.f32()))
+		self.packetTables = {}    # name -> [(name, bit offset, width, signed)]
+		for n in range(r.u8()):
+			table = r.str()
+			self.packetTables[table] = [(r.str(), r.u8(), r.u8(), r.u8() != 0) for m in range(r.u8())]
+
+		self.numFields = len(self.telemetryFields)
+		self.scales = [scale for (name, type, offset, scale) in self.telemetryFields]
+		self.paths = [parsePath(name) for (name, type, offset, scale) in self.telemetryFields]
+		self.stateStruct = self.buildStateStruct()
+
+	def buildStateStruct(self):
+		"""Precompiles the struct format for a raw LargeStatePacket: the droid name, then all telemetry fields in
+		channel order, with padding for anything not described."""
+		members = [(self.nameOffset, "%ds" % self.nameSize, self.nameSize, None)]
+		for (n, (name, type, offset, scale)) in enumerate(self.telemetryFields):
+			code = STRUCT_CODES.get((type >> 4, type & 0xf))
+			if code is None:
+				raise ValueError("Field %s has unknown type 0x%x" % (name, type))
+			members.append((offset, code, type & 0xf, n))
+		members.sort()
+		fmt, pos, self.stateOrder = "<", 0, []
+		for (offset, code, size, n) in members:
+			if offset < pos:
+				raise ValueError("Overlapping fields in schema at offset %d" % offset)
+			if offset > pos:
+				fmt += "%dx" % (offset - pos)
+			fmt += code
+			pos = offset + size
+			self.stateOrder.append(n)
+		if pos < self.stateSize:
+			fmt += "%dx" % (self.stateSize - pos)
+		return struct.Struct(fmt)
+
+	def unpackState(self, buf):
+		"""Decodes a raw LargeStatePacket into (values in channel order, droid name)."""
+		t = self.stateStruct.unpack(buf)
+		values = [0] * self.numFields
+		name = b""
+		for (n, v) in zip(self.stateOrder, t):
+			if n is None:
+				name = v
+			else:
+				values[n] = v
+		return values, name.rstrip(b"\0")
+
+	def channels(self, prefixes):
+		"""Returns the IDs of all telemetry channels whose name starts with one of the given prefixes."""
+		return [n for (n, field) in enumerate(self.telemetryFields) if field[0].startswith(tuple(prefixes))]
+
+	@classmethod
+	def fetch(cls, client):
+		"""Reads the schema from a droid via a CommandClient. All chunks after the first are requested at once."""
+		payload = client.request(CommandClient.OP_GET_SCHEMA, struct.pack("<H", 0))
+		id, size = struct.unpack_from("<HH", payload, 0)
+		chunk = payload[4:]
+		if len(chunk) == 0:
+			raise ValueError("Empty schema chunk")
+		blob = bytearray(size)
+		blob[0:len(chunk)] = chunk
+		requests = {client.send(CommandClient.OP_GET_SCHEMA, struct.pack("<H", offset)): offset
+			for offset in range(len(chunk), size, len(chunk))}
+		if not client.wait(requests.keys()):
+			raise TimeoutError("No response to schema request")
+		for (reqID, offset) in requests.items():
+			opcode, result, payload = client.response(reqID)
+			if result != CommandClient.RES_OK:
+				raise CommandClient.CommandError(opcode, result)
+			blob[offset:offset+len(payload)-4] = payload[4:]
+		schema = cls(blob)
+		if schema.id != id:
+			raise ValueError("Schema ID mismatch (got 0x%04x, computed 0x%04x)" % (id, schema.id))
+		return schema
+
+class Reader:
+	def __init__(self, buf):
+		self.buf = buf
+		self.i = 0
+	def u8(self):
+		self.i += 1
+		return self.buf[self.i-1]
+	def u16(self):
+		self.i += 2
+		return struct.unpack_from("<H", self.buf, self.i-2)[0]
+	def f32(self):
+		self.i += 4
+		return struct.unpack_from("<f", self.buf, self.i-4)[0]
+	def str(self):
+		n = self.u8()
+		self.i += n
+		return self.buf[self.i-n:self.i].decode()
@@ -0,0 +1,111 @@
+# Decoder for the compact telemetry format (see Arduino/LibBB/include/BBTelemetry.h).
+
+import PacketLayout
+from LargeStatePacket import LargeStatePacket
+
+HEADER_SIZE = 5
+
+def isTelemetryFrame(buf):
+	return len(buf) >= HEADER_SIZE and buf[0] == PacketLayout.TELEMETRY_MAGIC
+
+def getVarint(buf, i):
+	value = 0
+	shift = 0
+	while True:
+		b = buf[i]
+		i += 1
+		value |= (b & 0x7f) << shift
+		shift += 7
+		if b & 0x80 == 0:
+			break
+	return ((value >> 1) ^ -(value & 1)), i # zigzag
+
+def wrap32(value):
+	value &= 0xffffffff
+	return value - (1 << 32) if value & 0x80000000 else value
+
+class TelemetryDecoder:
+	"""Keeps the last keyframe of one droid and turns telemetry frames back into LargeStatePackets. Needs the
+	droid's schema for that; if a keyframe names a schema other than the one set, decode() records its ID in
+	wantedSchemaID and returns None until setSchema() is called with the right one."""
+	def __init__(self, schema=None):
+		self.schema = schema
+		self.wantedSchemaID = None
+		self.keyframe = None
+		self.keyframeSeqnum = None
+		self.mask = []
+		self.name = b""
+		self.lastSeqnum = None
+		self.frames = 0
+		self.bytes = 0
+		self.dropped = 0
+		self.undecodable = 0
+
+	def setSchema(self, schema):
+		self.schema = schema
+		self.keyframe = None
+		self.wantedSchemaID = None
+
+	def bytesPerSample(self):
+		return self.bytes / self.frames if self.frames else 0
+
+	def decode(self, buf):
+		"""Returns a LargeStatePacket, or None if the frame cannot be decoded (yet)."""
+		if not isTelemetryFrame(buf):
+			return None
+		flags, seqnum, keyframeSeqnum, numFields = buf[1], buf[2], buf[3], buf[4]
+		if flags & PacketLayout.TELEMETRY_FLAG_KEYFRAME and len(buf) >= HEADER_SIZE + 2:
+			schemaID = buf[HEADER_SIZE] | (buf[HEADER_SIZE+1] << 8)
+			if self.schema is None or schemaID != self.schema.id:
+				self.wantedSchemaID = schemaID
+				self.keyframe = None
+			else:
+				self.wantedSchemaID = None
+		if self.schema is None or self.wantedSchemaID is not None:
+			self.undecodable += 1
+			return None
+		if numFields != self.schema.numFields:
+			print("Telemetry frame has %d fields, schema has %d" % (numFields, self.schema.numFields))
+			self.undecodable += 1
+			return None
+		bitmapSize = (numFields + 7) // 8
+
+		if self.lastSeqnum is not None:
+			self.dropped += (seqnum - self.lastSeqnum - 1) % 256
+		self.lastSeqnum = seqnum
+		self.frames += 1
+		self.bytes += len(buf)
+
+		i = HEADER_SIZE
+		try:
+			if flags & PacketLayout.TELEMETRY_FLAG_KEYFRAME:
+				i += 2 # schema ID, checked above
+				nameLen = buf[i]
+				self.name = bytes(buf[i+1:i+1+nameLen])
+				i += 1 + nameLen
+				bitmap = buf[i:i+bitmapSize]
+				i += bitmapSize
+				self.mask = [n for n in range(numFields) if bitmap[n//8] & (1 << (n%8))]
+				values = [0] * numFields # fields not subscribed to read as 0
+				for n in self.mask:
+					values[n], i = getVarint(buf, i)
+				self.keyframe = values
+				self.keyframeSeqnum = seqnum
+			else:
+				if self.keyframe is None or keyframeSeqnum != self.keyframeSeqnum:
+					self.undecodable += 1
+					return None
+				bitmap = buf[i:i+bitmapSize]
+				i += bitmapSize
+				values = list(self.keyframe)
+				for n in range(numFields):
+					if bitmap[n//8] & (1 << (n%8)):
+						d, i = getVarint(buf, i)
+						values[n] = wrap32(values[n] + d)
+		except IndexError:
+			print("Truncated telemetry frame (%d bytes)" % len(buf))
+			self.undecodable += 1
+			return None
+
+		scaled = [v / scale if scale != 1 else v for (v, scale) in zip(values, self.schema.scales)]
+		return LargeStatePacket.fromValues(self.schema, scaled, self.name)
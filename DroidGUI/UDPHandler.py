@@ -1,20 +1,77 @@
 import socket
+import struct
+import time
 
 from LargeStatePacket import LargeStatePacket
+from TelemetryDecoder import TelemetryDecoder, isTelemetryFrame
+from Schema import Schema
+from CommandClient import CommandClient, CommandError
+import PacketLayout
 
 STATE_PORTNUM = 3000
 
+SUBSCRIBE_MAGIC = 0xb6
+REQUEST_SUBSCRIBE = 0
+REQUEST_UNSUBSCRIBE = 1
+
+BATCH_MAGIC = 0xb4
+
+def getVarint(buf, i):
+	value = 0
+	shift = 0
+	while True:
+		b = buf[i]
+		i += 1
+		value |= (b & 0x7f) << shift
+		shift += 7
+		if b & 0x80 == 0:
+			return value, i
+
+def splitBatch(buf):
+	"""Splits a batch datagram (see WifiServer::streamUDPPacket()) into a list of (micros, datagram). Anything
+	else is returned as a single datagram with time None."""
+	if len(buf) < 6 or buf[0] != BATCH_MAGIC:
+		return [(None, buf)]
+	count = buf[1]
+	firstUS = struct.unpack_from("<I", buf, 2)[0]
+	datagrams = []
+	i = 6
+	try:
+		for n in range(count):
+			offset, i = getVarint(buf, i)
+			length, i = getVarint(buf, i)
+			if i + length > len(buf):
+				raise IndexError
+			datagrams.append(((firstUS + offset) & 0xffffffff, buf[i:i+length]))
+			i += length
+	except IndexError:
+		print("Truncated batch datagram (%d bytes)" % len(buf))
+	return datagrams
+
+def telemetryChannels(prefixes):
+	"""Returns the IDs of all telemetry channels whose name starts with one of the given prefixes. Uses the
+	channel table from PacketLayout.py, since this is needed before we know any droid's schema."""
+	return [n for (n, (name, scale)) in enumerate(PacketLayout.TELEMETRY_FIELDS) if name.startswith(tuple(prefixes))]
+
 class UDPHandler:
 	def __init__(self):
 		self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
 		self.sock.bind(('', STATE_PORTNUM))
 		self.sock.setblocking(0)
+		self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
 		self.cmdqueue = []
 		self.states = {}
+		self.decoders = {}
+		self.schemas = {}
+		self.schemaRequestTimes = {}
+		self.commandClients = {}
+		self.pending = []
 		self.address = None
 		self.broadcast = False
 		self.seqnum = 0
 		self.newDroidDiscoveredCB = None
+		self.subscription = None
+		self.lastSubscriptionTime = 0
 
 	def setNewDroidDiscoveredCB(self, cb):
 		self.newDroidDiscoveredCB = cb
@@ -34,104 +91,136 @@ class UDPHandler:
 	def useBroadcast(self, b):
 		self.broadcast = b
 
+	def subscribe(self, channels, rate = 0, lease = 3000):
+		"""Asks the droid(s) to send the given telemetry channels at rate Hz (0 = every cycle). The subscription is
+		renewed automatically while readIfAvailable() is called. Until a droid is selected, it goes to all droids."""
+		self.subscription = struct.pack("<BBHHB%dB" % len(channels), SUBSCRIBE_MAGIC, REQUEST_SUBSCRIBE, rate, lease,
+			len(channels), *channels)
+		self.subscriptionLease = lease / 1000.0
+		self.lastSubscriptionTime = 0
+
+	def unsubscribe(self):
+		if self.subscription is not None and self.address is not None:
+			self.sock.sendto(struct.pack("<BBHHB", SUBSCRIBE_MAGIC, REQUEST_UNSUBSCRIBE, 0, 0, 0), (self.address, STATE_PORTNUM))
+		self.subscription = None
+
+	def renewSubscription(self):
+		if self.subscription is None or time.time() - self.lastSubscriptionTime < self.subscriptionLease / 3:
+			return
+		address = self.address if self.address is not None else "<broadcast>"
+		try:
+			self.sock.sendto(self.subscription, (address, STATE_PORTNUM))
+		except OSError as e:
+			print("Could not send subscription to %s: %s" % (address, e))
+		self.lastSubscriptionTime = time.time()
+
 	def readIfAvailable(self):
+		"""Returns the next state packet received, or None. Packets from a batch carry the droid's micros() at
+		the time of sending in packet.timeUS."""
+		self.renewSubscription()
+		while len(self.pending) == 0:
+			try:
+				buf, (address, port) = self.sock.recvfrom(2048)
+			except BlockingIOError:
+				return None
+			for (timeUS, datagram) in splitBatch(buf):
+				self.handleDatagram(address, datagram, timeUS)
+		return self.pending.pop(0)
+
+	def handleDatagram(self, address, buf, timeUS):
+		if address not in self.states.keys() and self.newDroidDiscoveredCB:
+			shouldCallCallback = True
+		else:
+			shouldCallCallback = False
+		schema = self.schemas.get(address)
+		if isTelemetryFrame(buf) and (schema is None or len(buf) != schema.stateSize):
+			if address not in self.decoders:
+				self.decoders[address] = TelemetryDecoder(schema)
+			decoder = self.decoders[address]
+			packet = decoder.decode(buf)
+			if packet is None:
+				if decoder.wantedSchemaID is not None:
+					schema = self.fetchSchema(address)
+					if schema is not None and schema.id == decoder.wantedSchemaID:
+						decoder.setSchema(schema) # decodes from the next keyframe on
+				return
+		elif schema is not None and len(buf) == schema.stateSize:
+			packet = LargeStatePacket.fromBuffer(schema, buf)
+		else:
+			if schema is None and len(buf) > PacketLayout.PACKET_SIZE:
+				self.fetchSchema(address) # maybe a raw state packet
+			return # e.g. our own broadcast subscription request
+		packet.timeUS = timeUS
+
+		self.states[address] = packet
+		self.pending.append(packet)
+		if shouldCallCallback:
+			self.newDroidDiscoveredCB(address)
+
+	def commandClient(self, address = None):
+		if address == None:
+			address = self.address
+		if address not in self.commandClients:
+			self.commandClients[address] = CommandClient(address, timeout=0.05, retries=2)
+		return self.commandClients[address]
+
+	def fetchSchema(self, address):
+		"""Asks the droid for its schema, at most once per second. Returns the schema, or None."""
+		if time.time() - self.schemaRequestTimes.get(address, 0) < 1.0:
+			return self.schemas.get(address)
+		self.schemaRequestTimes[address] = time.time()
 		try:
-			buf = self.sock.recvfrom(1024)
-			address = buf[1][0]
-			if address not in self.states.keys() and self.newDroidDiscoveredCB:
-				shouldCallCallback = True
-			else:
-				shouldCallCallback = False
-			packet = LargeStatePacket(buf[0])
-
-			self.states[address] = packet
-			if shouldCallCallback:
-				self.newDroidDiscoveredCB(address)
-			return packet
-		except BlockingIOError:
+			schema = Schema.fetch(self.commandClient(address))
+		except (TimeoutError, CommandError, ValueError) as e:
+			print("Could not get schema from %s: %s" % (address, e))
 			return None
+		print("Got schema 0x%04x from %s (%d channels)" % (schema.id, address, schema.numFields))
+		self.schemas[address] = schema
+		return schema
+
+	def getSchema(self, address = None):
+		if address == None:
+			address = self.address
+		return self.schemas.get(address)
+
+	def queueParameter(self, subsys, name, value):
+		"""Queues a parameter change for the selected droid. Later changes to the same parameter replace earlier
+		ones that have not been sent yet."""
+		self.removeAndQueueNew((subsys, name), value)
 
-	def removeAndQueueNew(self, key, bytes):
+	def removeAndQueueNew(self, key, value):
 		i = 0
 		while i<len(self.cmdqueue):
 			if(self.cmdqueue[i][0] == key):
 				del self.cmdqueue[i]
 			else:
 				i = i+1
-		self.cmdqueue.append((key, bytes))
-
-	def queueFloatCommand(self, command, floatarg):
-		bytes = struct.pack(PACK_FORMAT_FLOATARG, self.seqnum, command, floatarg)
-		self.seqnum = (self.seqnum+1)%256
-		self.removeAndQueueNew(command, bytes)
-
-	def queueIndexedFloatCommand(self, command, index, floatarg):
-		bytes = struct.pack(PACK_FORMAT_INDEXEDFLOATARG, self.seqnum, command, index, floatarg)
-		self.seqnum = (self.seqnum + 1)%256
-		self.removeAndQueueNew((command, index), bytes)
-
-	def queueFloatListCommand(self, command, float0, float1, float2, float3):
-		bytes = struct.pack(PACK_FORMAT_FLOATLISTARG, self.seqnum, command, float0, float1, float2, float3)
-		self.seqnum = (self.seqnum + 1)%256
-		self.removeAndQueueNew(command, bytes)
+		self.cmdqueue.append((key, value))
 
 	def sendCommandQueue(self):
-		for key, bytes in self.cmdqueue:
-			self.sock.sendto(bytes, (self.address, CMD_PORTNUM))
+		if self.address is None:
+			return
+		client = self.commandClient()
+		for ((subsys, name), value) in self.cmdqueue:
+			client.setAsync(subsys, name, value)
 		self.cmdqueue = []
-
-	def getFloatVal(self, index, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return -1
-		return self.states[address][index]
-
-	def getSeqNum(self, address = None):
+		for id in client.poll():
+			opcode, result, payload = client.response(id)
+			if result != 0:
+				print("Parameter change failed with result %d" % result)
+		now = time.time()
+		for (id, (opcode, request, sent)) in list(client.pending.items()):
+			if now - sent > 1.0:
+				del client.pending[id] # fire and forget, the next change will go out anyway
+
+	def getTelemetryDecoder(self, address = None):
 		if address == None:
 			address = self.address
-		if address not in self.states:
-			return -1
-		return self.states[address][0]
-
-	def getIMUsOK(self, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return False
-		return self.states[address][1]
-
-	def getMotorsOK(self, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return False
-		return self.states[address][2]
-
-	def getServosOK(self, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return False
-		return self.states[address][3]
-
-	def getDomeIMUData(self, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return (0, 0, 0)
-		return self.states[address][4], self.states[address][5], self.states[address][6]
-
-	def getBodyIMUData(self, address = None):
-		if address == None:
-			address = self.address
-		if address not in self.states:
-			return (0, 0, 0)
-		return self.states[address][7], self.states[address][8], self.states[address][9]
+		return self.decoders.get(address)
 
 	def getServoData(self, address = None):
 		if address == None:
 			address = self.address
 		if address not in self.states:
 			return (0, 0, 0, 0)
-		return self.states[address][10], self.states[address][11], self.states[address][12], self.states[address][13]
+		return tuple(self.states[address].servos[i].present for i in range(4))